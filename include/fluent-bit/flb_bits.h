@@ -21,6 +21,11 @@
 #ifndef FLB_BITS_H
 #define FLB_BITS_H
 
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #define FLB_BITS_U64_SET(a, b)   ((uint64_t) a << 32 | b)
 #define FLB_BITS_U64_HIGH(val)   ((uint64_t) val >> 32)
 #define FLB_BITS_U64_LOW(val)    ((uint64_t) val & 0xffffffff)
@@ -29,4 +34,29 @@
     ((__TYPE__) (-((__ONE_COUNT__) != 0)))                              \
     & (((__TYPE__) -1) >> ((sizeof(__TYPE__) * CHAR_BIT) - (__ONE_COUNT__)))
 
+/* Count trailing/leading zero bits, 'val' must not be zero */
+static inline int flb_bits_ctz64(uint64_t val)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+
+    _BitScanForward64(&idx, val);
+    return (int) idx;
+#else
+    return __builtin_ctzll(val);
+#endif
+}
+
+static inline int flb_bits_clz64(uint64_t val)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+
+    _BitScanReverse64(&idx, val);
+    return 63 - (int) idx;
+#else
+    return __builtin_clzll(val);
+#endif
+}
+
 #endif
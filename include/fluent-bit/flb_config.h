@@ -169,6 +169,10 @@ struct flb_config {
     /* Co-routines */
     unsigned int coro_stack_size;
 
+    /* Compression workers */
+    int compress_workers;       /* number of threads, 0 = compress inline */
+    void *gzip_pool;            /* struct flb_gzip_pool                   */
+
     /*
      * Input table-id: table to keep a reference of thread-IDs used by the
      * input plugins.
@@ -231,4 +235,7 @@ enum conf_type {
 /* Coroutines */
 #define FLB_CONF_STR_CORO_STACK_SIZE "Coro_Stack_Size"
 
+/* Compression */
+#define FLB_CONF_STR_COMPRESS_WORKERS "compress.workers"
+
 #endif
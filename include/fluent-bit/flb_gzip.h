@@ -22,11 +22,57 @@
 #define FLB_GZIP_H
 
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_compat.h>
 #include <stdio.h>
 
 int flb_gzip_compress(void *in_data, size_t in_len,
                       void **out_data, size_t *out_len);
+int flb_gzip_compress_level(const void *in_data, size_t in_len,
+                            void **out_data, size_t *out_len, int level);
 int flb_gzip_uncompress(void *in_data, size_t in_len,
                         void **out_data, size_t *out_len);
 
+/* Reusable deflate context */
+struct flb_gzip_deflate;
+
+struct flb_gzip_deflate *flb_gzip_deflate_create(int level);
+int flb_gzip_deflate_compress(struct flb_gzip_deflate *ctx,
+                              const void *in_data, size_t in_len,
+                              void **out_data, size_t *out_len);
+void flb_gzip_deflate_destroy(struct flb_gzip_deflate *ctx);
+
+/* Streaming deflate */
+int flb_gzip_deflate_begin(struct flb_gzip_deflate *ctx,
+                           int (*cb)(const void *, size_t, void *),
+                           void *cb_data);
+int flb_gzip_deflate_write(struct flb_gzip_deflate *ctx,
+                           const void *in_data, size_t in_len);
+int flb_gzip_deflate_end(struct flb_gzip_deflate *ctx);
+
+/* Deflate context owned by the calling thread */
+struct flb_gzip_deflate *flb_gzip_deflate_get(int level);
+
+/* Streaming inflate context */
+struct flb_gzip_inflate;
+
+struct flb_gzip_inflate *flb_gzip_inflate_create();
+int flb_gzip_inflate_stream(struct flb_gzip_inflate *ctx,
+                            const void *in_data, size_t in_len,
+                            int (*cb)(const void *, size_t, void *),
+                            void *cb_data);
+void flb_gzip_inflate_destroy(struct flb_gzip_inflate *ctx);
+
+/* Incremental inflate */
+void flb_gzip_inflate_reset(struct flb_gzip_inflate *ctx);
+ssize_t flb_gzip_inflate_read(struct flb_gzip_inflate *ctx,
+                              const void *in_data, size_t in_len,
+                              size_t *in_used,
+                              void *out_data, size_t out_size);
+
+/* Incremental inflate checkpoint */
+size_t flb_gzip_inflate_checkpoint_size(struct flb_gzip_inflate *ctx);
+void flb_gzip_inflate_save(struct flb_gzip_inflate *ctx, void *buf);
+int flb_gzip_inflate_restore(struct flb_gzip_inflate *ctx,
+                             const void *buf, size_t size);
+
 #endif
@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_GZIP_POOL_H
+#define FLB_GZIP_POOL_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_pipe.h>
+#include <monkey/mk_core.h>
+
+#include <pthread.h>
+
+/* Smaller payloads are compressed inline, the hand-off is not worth it */
+#define FLB_GZIP_POOL_MIN_SIZE  65536
+
+struct flb_gzip_pool {
+    struct mk_event event;      /* completion channel event (engine loop) */
+    flb_pipefd_t ch[2];         /* workers write completed jobs here      */
+
+    int exit;                   /* workers must stop                      */
+    int workers;                /* number of threads                      */
+    pthread_t *tids;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct mk_list jobs;        /* pending jobs                           */
+
+    struct flb_config *config;
+};
+
+struct flb_gzip_pool *flb_gzip_pool_create(struct flb_config *config,
+                                           int workers);
+void flb_gzip_pool_destroy(struct flb_gzip_pool *pool);
+int flb_gzip_pool_compress(struct flb_gzip_pool *pool,
+                           const void *in_data, size_t in_len, int level,
+                           void **out_data, size_t *out_len);
+
+#endif
@@ -0,0 +1,105 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_INPUT_LISTENER_H
+#define FLB_INPUT_LISTENER_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_compat.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_input.h>
+#include <monkey/mk_core.h>
+
+/* Number of buffers that each listener can queue, must be a power of 2 */
+#define FLB_INPUT_LISTENER_QUEUE   1024
+
+/* Buffer of records handed from a listener thread to the engine */
+struct flb_input_listener_msg {
+    char *tag;
+    int tag_len;
+    char *buf;
+    size_t size;
+};
+
+/*
+ * A listener: a POSIX thread with it own event loop and a listening socket
+ * bound to the same address of the others through SO_REUSEPORT.
+ */
+struct flb_input_listener {
+    struct mk_event event;               /* server socket event       */
+    int id;                              /* listener number           */
+    flb_sockfd_t server_fd;              /* listening socket          */
+    pthread_t tid;                       /* thread id                 */
+    int started;                         /* thread is running ?       */
+    struct mk_event_loop *evl;           /* thread event loop         */
+
+    /* Channel to stop the thread */
+    flb_pipefd_t ch_stop[2];
+    struct mk_event stop_event;
+
+    /* Single-producer / single-consumer queue of buffers */
+    unsigned int q_head;                 /* written by the listener   */
+    unsigned int q_tail;                 /* written by the engine     */
+    struct flb_input_listener_msg *queue;
+
+    /* Connections owned by this listener, managed by the plugin */
+    struct mk_list connections;
+
+    struct flb_input_listeners *parent;
+    struct mk_list _head;
+};
+
+struct flb_input_listeners {
+    int running;
+    int notified;                        /* engine has a pending wake up */
+    int coll_fd;                         /* collector ID                 */
+    flb_pipefd_t ch_notify[2];           /* wake up the engine           */
+
+    /* Invoked from the listener thread for every new connection */
+    int (*cb_accept) (flb_sockfd_t fd, struct flb_input_listener *lst,
+                      void *data);
+    void *data;
+
+    struct mk_list listeners;
+    struct flb_input_instance *in;
+    struct flb_config *config;
+};
+
+struct flb_input_listeners *flb_input_listeners_create(struct flb_input_instance *in,
+                                                       const char *listen,
+                                                       const char *port,
+                                                       int workers,
+                                                       int (*cb_accept) (flb_sockfd_t,
+                                                                         struct flb_input_listener *,
+                                                                         void *),
+                                                       void *data,
+                                                       struct flb_config *config);
+int flb_input_listeners_start(struct flb_input_listeners *ls,
+                              int (*cb_collect) (struct flb_input_instance *,
+                                                 struct flb_config *, void *));
+int flb_input_listeners_collect(struct flb_input_listeners *ls);
+void flb_input_listeners_stop(struct flb_input_listeners *ls);
+void flb_input_listeners_destroy(struct flb_input_listeners *ls);
+
+int flb_input_listener_append(struct flb_input_listener *lst,
+                              const char *tag, int tag_len,
+                              const void *buf, size_t size);
+
+#endif
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_JSON_INDEX_H
+#define FLB_JSON_INDEX_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pack.h>
+
+/* Structural index implementations */
+#define FLB_JSON_INDEX_SCALAR   0
+#define FLB_JSON_INDEX_SSE2     1
+#define FLB_JSON_INDEX_AVX2     2
+
+int flb_json_index_pack(struct flb_pack_state *state,
+                        const char *js, size_t len, int partial,
+                        char **buffer, int *size, int *root_type);
+
+int flb_json_index_impl();
+int flb_json_index_set_impl(int impl);
+const char *flb_json_index_impl_name(int impl);
+
+#endif
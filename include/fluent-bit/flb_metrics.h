@@ -31,6 +31,7 @@
 #define FLB_METRIC_N_BYTES     1
 #define FLB_METRIC_N_DROPPED   2
 #define FLB_METRIC_N_ADDED     3
+#define FLB_METRIC_N_KERNEL_DROPS  4
 
 #define FLB_METRIC_OUT_OK_RECORDS     10
 #define FLB_METRIC_OUT_OK_BYTES       11
@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_NET_DGRAM_H
+#define FLB_NET_DGRAM_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_socket.h>
+
+#include <stdint.h>
+
+/* Default number of datagrams retrieved per receive call */
+#define FLB_NET_DGRAM_BATCH   16
+
+/*
+ * A set of buffers to receive many datagrams with a single system call
+ * (recvmmsg(2) when available). Every slot is 'dgram_size' bytes long, the
+ * last byte is reserved so received data is always NULL terminated.
+ */
+struct flb_net_dgram_batch {
+    int size;                  /* number of slots                     */
+    int count;                 /* datagrams received by last call     */
+    size_t dgram_size;         /* slot size                           */
+    char *buf;                 /* size * dgram_size bytes             */
+    size_t *lens;              /* length of each received datagram    */
+
+    /* Kernel drop counter (SO_RXQ_OVFL) */
+    int rxq_ovfl;              /* drop reporting enabled ?            */
+    uint32_t drops_total;      /* last counter reported by Kernel     */
+    uint32_t drops;            /* new drops seen by the last call     */
+
+    void *msgs;                /* struct mmsghdr array                */
+    void *iovs;                /* struct iovec array                  */
+    char *cmsg;                /* ancillary data buffers              */
+};
+
+#define flb_net_dgram_data(b, i)  ((b)->buf + ((i) * (b)->dgram_size))
+#define flb_net_dgram_len(b, i)   ((b)->lens[i])
+
+struct flb_net_dgram_batch *flb_net_dgram_batch_create(flb_sockfd_t fd,
+                                                       int size,
+                                                       size_t dgram_size);
+void flb_net_dgram_batch_destroy(struct flb_net_dgram_batch *b);
+int flb_net_dgram_recv(flb_sockfd_t fd, struct flb_net_dgram_batch *b);
+
+#endif
@@ -43,9 +43,12 @@ int flb_net_host_set(const char *plugin_name, struct flb_net_host *host, const c
 
 /* TCP options */
 int flb_net_socket_reset(flb_sockfd_t fd);
+int flb_net_socket_reuseport(flb_sockfd_t fd);
 int flb_net_socket_tcp_nodelay(flb_sockfd_t fd);
 int flb_net_socket_nonblocking(flb_sockfd_t fd);
 int flb_net_socket_tcp_fastopen(flb_sockfd_t sockfd);
+int flb_net_socket_rcvbuf(flb_sockfd_t fd, int size);
+int flb_net_socket_rxq_ovfl(flb_sockfd_t fd);
 
 /* Socket handling */
 flb_sockfd_t flb_net_socket_create(int family, int nonblock);
@@ -54,6 +57,7 @@ flb_sockfd_t flb_net_tcp_connect(const char *host, unsigned long port);
 flb_sockfd_t flb_net_udp_connect(const char *host, unsigned long port);
 int flb_net_tcp_fd_connect(flb_sockfd_t fd, const char *host, unsigned long port);
 flb_sockfd_t flb_net_server(const char *port, const char *listen_addr);
+flb_sockfd_t flb_net_server_reuseport(const char *port, const char *listen_addr);
 flb_sockfd_t flb_net_server_udp(const char *port, const char *listen_addr);
 int flb_net_bind(flb_sockfd_t fd, const struct sockaddr *addr,
                  socklen_t addrlen, int backlog);
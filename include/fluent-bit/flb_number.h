@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_NUMBER_H
+#define FLB_NUMBER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Number types */
+#define FLB_NUMBER_INT      0     /* fits in int64_t               */
+#define FLB_NUMBER_UINT     1     /* above INT64_MAX, fits uint64  */
+#define FLB_NUMBER_DOUBLE   2     /* fraction, exponent or overflow */
+
+struct flb_number {
+    int type;
+    union {
+        int64_t i64;
+        uint64_t u64;
+        double f64;
+    } val;
+};
+
+int flb_number_parse(const char *str, size_t len, struct flb_number *num);
+int flb_number_parse_lenient(const char *str, size_t len,
+                             struct flb_number *num);
+double flb_number_decimal(uint64_t mantissa, int exp10, int negative);
+double flb_number_to_double(struct flb_number *num);
+
+#endif
@@ -0,0 +1,66 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_OUTPUT_BATCH_H
+#define FLB_OUTPUT_BATCH_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_config.h>
+
+/* Default number of concurrent workers used to flush sub-batches */
+#define FLB_OUTPUT_BATCH_WORKERS   4
+
+/* Part status, besides FLB_OK, FLB_RETRY and FLB_ERROR */
+#define FLB_OUTPUT_BATCH_PENDING  -1
+
+/* A sub-batch: a range of complete records inside a chunk buffer */
+struct flb_output_batch_part {
+    size_t offset;              /* offset in the chunk buffer   */
+    size_t size;                /* bytes used by the records    */
+    int records;                /* number of records            */
+    int status;                 /* delivery status              */
+};
+
+struct flb_output_batch {
+    int n_parts;
+    struct flb_output_batch_part *parts;
+};
+
+/*
+ * Callback invoked by the workers for every sub-batch, it must return
+ * FLB_OK, FLB_RETRY or FLB_ERROR. It runs inside a co-routine so it can
+ * use the upstream and I/O interfaces as a regular flush callback does,
+ * but it must never call FLB_OUTPUT_RETURN().
+ */
+typedef int (*flb_output_batch_cb) (const void *data, size_t bytes,
+                                    void *cb_data);
+
+int flb_output_batch_split(const void *data, size_t bytes, size_t max_size,
+                           struct flb_output_batch *batch);
+void flb_output_batch_destroy(struct flb_output_batch *batch);
+
+int flb_output_batch_flush(const void *data, size_t bytes,
+                           size_t max_size, int workers,
+                           flb_output_batch_cb cb, void *cb_data,
+                           struct flb_config *config);
+
+void flb_output_batch_prepare();
+
+#endif
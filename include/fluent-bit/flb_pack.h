@@ -58,6 +58,17 @@ struct flb_pack_state {
     char *buf_data;       /* temporal buffer           */
     size_t buf_size;      /* temporal buffer size      */
     size_t buf_len;       /* temporal buffer length    */
+
+    /* structural index (flb_json_index.c) */
+    uint32_t *index;      /* structural positions      */
+    size_t index_size;    /* index capacity            */
+    size_t index_full;    /* entries of full blocks    */
+    size_t index_off;     /* bytes of full blocks      */
+    uint64_t index_carry[3];
+    uint32_t *sizes;      /* size of every container   */
+    size_t sizes_size;
+    uint32_t *stack;      /* open containers           */
+    size_t stack_size;
 };
 
 int flb_json_tokenise(const char *js, size_t len, struct flb_pack_state *state);
@@ -81,6 +92,7 @@ void flb_pack_print(const char *data, size_t bytes);
 int flb_msgpack_to_json(char *json_str, size_t str_len,
                         const msgpack_object *obj);
 char* flb_msgpack_to_json_str(size_t size, const msgpack_object *obj);
+int flb_msgpack_to_json_sds(flb_sds_t *json, const msgpack_object *obj);
 flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size);
 
 int flb_pack_time_now(msgpack_packer *pck);
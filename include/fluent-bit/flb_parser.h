@@ -32,6 +32,7 @@
 #define FLB_PARSER_JSON  2
 #define FLB_PARSER_LTSV  3
 #define FLB_PARSER_LOGFMT 4
+#define FLB_PARSER_NATIVE 5
 
 struct flb_parser_types {
     char *key;
@@ -39,11 +40,23 @@ struct flb_parser_types {
     int type;
 };
 
+/* Regex parser: action for a named capture, resolved at creation time */
+struct flb_parser_field {
+    int group;            /* capture group number */
+    int type;             /* FLB_PARSER_TYPE_*, zero if not casted */
+    int is_time;          /* is it the time key ? */
+    char *name;           /* field name */
+    int name_len;
+    char *key;            /* msgpack packed key, header and name */
+    int key_size;
+};
+
 struct flb_parser {
     /* configuration */
     int type;             /* parser type */
     char *name;           /* format name */
     char *p_regex;        /* pattern for main regular expression */
+    int native;           /* built-in scanner, FLB_PARSER_NATIVE only */
     char *time_fmt;       /* time format */
     char *time_key;       /* field name that contains the time */
     int time_offset;      /* fixed UTC offset */
@@ -59,7 +72,13 @@ struct flb_parser {
     int time_with_year;   /* do time_fmt consider a year (%Y) ? */
     char *time_fmt_year;
     int time_with_tz;     /* do time_fmt consider a timezone ?  */
+    int time_fast;        /* specialised parser for time_fmt, if any */
+    int time_fast_tz;     /* timezone suffix of time_fmt */
+    int time_frac_tz;     /* timezone suffix after fractional seconds */
+    uint64_t time_id;     /* key in the per-thread time cache */
     struct flb_regex *regex;
+    struct flb_parser_field *fields; /* regex named captures */
+    int fields_len;
     struct mk_list _head;
 };
 
@@ -96,6 +115,7 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
                                      struct mk_list *decoders,
                                      struct flb_config *config);
 int flb_parser_conf_file(const char *file, struct flb_config *config);
+struct flb_parser *flb_parser_dup(struct flb_parser *parser);
 void flb_parser_destroy(struct flb_parser *parser);
 struct flb_parser *flb_parser_get(const char *name, struct flb_config *config);
 int flb_parser_do(struct flb_parser *parser, const char *buf, size_t length,
@@ -107,6 +127,12 @@ int flb_parser_frac(const char *str, int len, double *frac, const char **end);
 int flb_parser_time_lookup(const char *time, size_t tsize, time_t now,
                            struct flb_parser *parser,
                            struct tm *tm, double *ns);
+int flb_parser_time_lookup_epoch(const char *time, size_t tsize, time_t now,
+                                 struct flb_parser *parser,
+                                 time_t *epoch, double *ns);
+int flb_parser_typecast_value(const char *key, int key_len, int type,
+                              const char *val, int val_len,
+                              msgpack_packer *pck);
 int flb_parser_typecast(const char *key, int key_len,
                         const char *val, int val_len,
                         msgpack_packer *pck,
@@ -59,6 +59,7 @@ struct flb_parser_dec {
 };
 
 struct mk_list *flb_parser_decoder_list_create(struct mk_rconf_section *section);
+struct mk_list *flb_parser_decoder_list_dup(struct mk_list *list);
 int flb_parser_decoder_list_destroy(struct mk_list *list);
 int flb_parser_decoder_do(struct mk_list *decoders,
                           const char *in_buf, size_t in_size,
@@ -56,6 +56,14 @@ int flb_regex_parse(struct flb_regex *r, struct flb_regex_search *result,
                                       const char *, size_t,  /* value */
                                       void *),                  /* caller data */
                     void *data);
+int flb_regex_groups(struct flb_regex *r,
+                     int (*cb_group) (const char *, int, /* name  */
+                                      int,               /* group */
+                                      void *),           /* caller data */
+                     void *data);
+int flb_regex_group_get(struct flb_regex_search *result, int group,
+                        const char **val, size_t *len);
+void flb_regex_results_release(struct flb_regex_search *result);
 int flb_regex_destroy(struct flb_regex *r);
 void flb_regex_exit();
 
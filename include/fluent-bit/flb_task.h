@@ -53,6 +53,11 @@
 
 struct flb_task_route {
     struct flb_output_instance *out;
+
+    /* Sub-batches already delivered, see flb_output_batch.c */
+    int batch_parts;
+    char *batch_done;
+
     struct mk_list _head;
 };
 
@@ -23,6 +23,9 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_net_dgram.h>
+#include <fluent-bit/flb_metrics.h>
 #include <msgpack.h>
 #include "netprot.h"
 #include "typesdb.h"
@@ -43,8 +46,10 @@
 #define DEFAULT_TYPESDB "/usr/share/collectd/types.db";
 
 struct flb_in_collectd_config {
-    char *buf;
-    int bufsize;
+    /* Receive buffers */
+    int recv_batch;
+    int rcvbuf;
+    struct flb_net_dgram_batch *dgram;
 
     /* Server */
     char listen[256]; /* RFC-2181 */
@@ -81,12 +86,17 @@ static int in_collectd_init(struct flb_input_instance *in,
     }
     ctx->i_ins = in;
 
-    ctx->bufsize = BUFFER_SIZE;
-    ctx->buf = flb_malloc(ctx->bufsize);
-    if (!ctx->buf) {
-        flb_errno();
-        flb_free(ctx);
-        return -1;
+    /* Datagrams per receive call */
+    ctx->recv_batch = FLB_NET_DGRAM_BATCH;
+    tmp = flb_input_get_property("receive_batch", in);
+    if (tmp) {
+        ctx->recv_batch = atoi(tmp);
+    }
+
+    /* Socket receive buffer size */
+    tmp = flb_input_get_property("receive_buffer_size", in);
+    if (tmp) {
+        ctx->rcvbuf = flb_utils_size_to_bytes(tmp);
     }
 
     /* Listening address */
@@ -118,7 +128,6 @@ static int in_collectd_init(struct flb_input_instance *in,
     tdb = typesdb_load_all(tmp);
     if (!tdb) {
         flb_error("[in_collectd] failed to load '%s'", tmp);
-        flb_free(ctx->buf);
         flb_free(ctx);
         return -1;
     }
@@ -132,11 +141,34 @@ static int in_collectd_init(struct flb_input_instance *in,
         flb_error("[in_collectd] failed to bind to %s:%s", ctx->listen,
                                                            ctx->port);
         typesdb_destroy(ctx->tdb);
-        flb_free(ctx->buf);
         flb_free(ctx);
         return -1;
     }
 
+    if (ctx->rcvbuf > 0) {
+        ret = flb_net_socket_rcvbuf(ctx->server_fd, ctx->rcvbuf);
+        if (ret != -1 && ret < ctx->rcvbuf) {
+            flb_warn("[in_collectd] receive buffer size capped to %i bytes, "
+                     "check net.core.rmem_max", ret);
+        }
+    }
+
+    ctx->dgram = flb_net_dgram_batch_create(ctx->server_fd, ctx->recv_batch,
+                                            BUFFER_SIZE + 1);
+    if (!ctx->dgram) {
+        flb_socket_close(ctx->server_fd);
+        typesdb_destroy(ctx->tdb);
+        flb_free(ctx);
+        return -1;
+    }
+
+#ifdef FLB_HAVE_METRICS
+    if (in->metrics) {
+        flb_metrics_add(FLB_METRIC_N_KERNEL_DROPS, "kernel_drops",
+                        in->metrics);
+    }
+#endif
+
     /* Set the collector */
     ret = flb_input_set_collector_socket(in,
                                          in_collectd_callback,
@@ -146,7 +178,7 @@ static int in_collectd_init(struct flb_input_instance *in,
         flb_error("[in_collectd] failed set up a collector");
         flb_socket_close(ctx->server_fd);
         typesdb_destroy(ctx->tdb);
-        flb_free(ctx->buf);
+        flb_net_dgram_batch_destroy(ctx->dgram);
         flb_free(ctx);
         return -1;
     }
@@ -160,30 +192,50 @@ static int in_collectd_init(struct flb_input_instance *in,
 static int in_collectd_callback(struct flb_input_instance *i_ins,
                                 struct flb_config *config, void *in_context)
 {
+    int i;
+    int ret;
+    size_t len;
+    size_t off;
     struct flb_in_collectd_config *ctx = in_context;
-    int len;
     msgpack_packer pck;
     msgpack_sbuffer sbuf;
 
-    len = recv(ctx->server_fd, ctx->buf, ctx->bufsize, 0);
-    if (len < 0) {
-        flb_errno();
-        return -1;
+    ret = flb_net_dgram_recv(ctx->server_fd, ctx->dgram);
+    if (ret <= 0) {
+        return ret;
     }
-    if (len == 0) {
-        return 0;
+
+#ifdef FLB_HAVE_METRICS
+    if (ctx->dgram->drops > 0 && i_ins->metrics) {
+        flb_metrics_sum(FLB_METRIC_N_KERNEL_DROPS, ctx->dgram->drops,
+                        i_ins->metrics);
     }
+#endif
 
     msgpack_sbuffer_init(&sbuf);
     msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
 
-    if (netprot_to_msgpack(ctx->buf, len, ctx->tdb, &pck)) {
-        flb_error("[in_collectd] netprot_to_msgpack fails");
-        msgpack_sbuffer_destroy(&sbuf);
-        return -1;
+    for (i = 0; i < ctx->dgram->count; i++) {
+        len = flb_net_dgram_len(ctx->dgram, i);
+        if (len == 0) {
+            continue;
+        }
+
+        /*
+         * The buffer is shared by all datagrams in the batch, on failure
+         * discard only the partial records of the broken one.
+         */
+        off = sbuf.size;
+        if (netprot_to_msgpack(flb_net_dgram_data(ctx->dgram, i), len,
+                               ctx->tdb, &pck)) {
+            flb_error("[in_collectd] netprot_to_msgpack fails");
+            sbuf.size = off;
+        }
     }
 
-    flb_input_chunk_append_raw(i_ins, NULL, 0, sbuf.data, sbuf.size);
+    if (sbuf.size > 0) {
+        flb_input_chunk_append_raw(i_ins, NULL, 0, sbuf.data, sbuf.size);
+    }
 
     msgpack_sbuffer_destroy(&sbuf);
     return 0;
@@ -195,7 +247,7 @@ static int in_collectd_exit(void *data, struct flb_config *config)
     flb_socket_close(ctx->server_fd);
     flb_pipe_close(ctx->coll_fd);
     typesdb_destroy(ctx->tdb);
-    flb_free(ctx->buf);
+    flb_net_dgram_batch_destroy(ctx->dgram);
     flb_free(ctx);
     return 0;
 }
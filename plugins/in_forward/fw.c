@@ -89,13 +89,85 @@ static int in_fw_collect(struct flb_input_instance *i_ins,
     }
 
     flb_trace("[in_fw] new TCP connection arrived FD=%i", fd);
-    conn = fw_conn_add(fd, ctx);
+    conn = fw_conn_add(fd, ctx, NULL);
     if (!conn) {
         return -1;
     }
     return 0;
 }
 
+/* New connection on a listener thread */
+static int in_fw_accept(flb_sockfd_t fd, struct flb_input_listener *lst,
+                        void *data)
+{
+    struct fw_conn *conn;
+
+    conn = fw_conn_add(fd, data, lst);
+    if (!conn) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Records packed by the listener threads are ready */
+static int in_fw_collect_listeners(struct flb_input_instance *i_ins,
+                                   struct flb_config *config, void *in_context)
+{
+    struct flb_in_fw_config *ctx = in_context;
+
+    flb_input_listeners_collect(ctx->listeners);
+    return 0;
+}
+
+static void in_fw_listeners_exit(struct flb_in_fw_config *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_list *l_head;
+    struct fw_conn *conn;
+    struct flb_input_listener *lst;
+
+    flb_input_listeners_stop(ctx->listeners);
+
+    mk_list_foreach(l_head, &ctx->listeners->listeners) {
+        lst = mk_list_entry(l_head, struct flb_input_listener, _head);
+        mk_list_foreach_safe(head, tmp, &lst->connections) {
+            conn = mk_list_entry(head, struct fw_conn, _head);
+            fw_conn_del(conn);
+        }
+    }
+
+    flb_input_listeners_destroy(ctx->listeners);
+    ctx->listeners = NULL;
+}
+
+static int in_fw_listeners_init(struct flb_in_fw_config *ctx,
+                                struct flb_config *config)
+{
+    int ret;
+
+    ctx->listeners = flb_input_listeners_create(ctx->in,
+                                                ctx->listen, ctx->tcp_port,
+                                                ctx->workers, in_fw_accept,
+                                                ctx, config);
+    if (!ctx->listeners) {
+        flb_error("[in_fw] could not bind address %s:%s. Aborting",
+                  ctx->listen, ctx->tcp_port);
+        return -1;
+    }
+
+    ret = flb_input_listeners_start(ctx->listeners, in_fw_collect_listeners);
+    if (ret == -1) {
+        flb_error("[in_fw] could not start listeners");
+        in_fw_listeners_exit(ctx);
+        return -1;
+    }
+
+    flb_info("[in_fw] binding %s:%s (%i workers)",
+             ctx->listen, ctx->tcp_port, ctx->workers);
+    return 0;
+}
+
 /* Initialize plugin */
 static int in_fw_init(struct flb_input_instance *in,
                       struct flb_config *config, void *data)
@@ -110,11 +182,22 @@ static int in_fw_init(struct flb_input_instance *in,
         return -1;
     }
     ctx->in = in;
+    ctx->evl = config->evl;
     mk_list_init(&ctx->connections);
 
     /* Set the context */
     flb_input_set_context(in, ctx);
 
+    /* TCP listener threads */
+    if (!ctx->unix_path && ctx->workers > 0) {
+        ret = in_fw_listeners_init(ctx, config);
+        if (ret == -1) {
+            fw_config_destroy(ctx);
+            return -1;
+        }
+        return 0;
+    }
+
     /* Unix Socket mode */
     if (ctx->unix_path) {
 #ifndef FLB_HAVE_UNIX_SOCKET
@@ -148,8 +231,6 @@ static int in_fw_init(struct flb_input_instance *in,
     }
     flb_net_socket_nonblocking(ctx->server_fd);
 
-    ctx->evl = config->evl;
-
     /* Collect upon data available on the standard input */
     ret = flb_input_set_collector_socket(in,
                                          in_fw_collect,
@@ -172,6 +253,10 @@ int in_fw_exit(void *data, struct flb_config *config)
     struct flb_in_fw_config *ctx = data;
     struct fw_conn *conn;
 
+    if (ctx->listeners) {
+        in_fw_listeners_exit(ctx);
+    }
+
     mk_list_foreach_safe(head, tmp, &ctx->connections) {
         conn = mk_list_entry(head, struct fw_conn, _head);
         fw_conn_del(conn);
@@ -23,6 +23,7 @@
 
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_listener.h>
 
 struct flb_in_fw_config {
     int server_fd;               /* TCP server file descriptor  */
@@ -36,6 +37,10 @@ struct flb_in_fw_config {
     /* Unix Socket (TCP only) */
     char *unix_path;             /* Unix path for socket        */
 
+    /* Listener threads, if 'workers' is set */
+    int workers;
+    struct flb_input_listeners *listeners;
+
     struct mk_list connections;    /* List of active connections */
     struct mk_event_loop *evl;     /* Event loop file descriptor */
     struct flb_input_instance *in; /* Input plugin instace       */
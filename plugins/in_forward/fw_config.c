@@ -67,6 +67,12 @@ struct flb_in_fw_config *fw_config_init(struct flb_input_instance *i_ins)
             snprintf(tmp, sizeof(tmp) - 1, "%d", i_ins->host.port);
             config->tcp_port = flb_strdup(tmp);
         }
+
+        /* Number of listener threads (SO_REUSEPORT) */
+        p = flb_input_get_property("workers", i_ins);
+        if (p) {
+            config->workers = atoi(p);
+        }
     }
 
     /* Chunk size */
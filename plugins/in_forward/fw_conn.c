@@ -93,8 +93,24 @@ int fw_conn_event(void *data)
     return 0;
 }
 
+/*
+ * Register records for the connection: if the connection is handled by a
+ * listener thread the buffer is queued for the engine, otherwise it's
+ * appended directly.
+ */
+int fw_conn_append(struct fw_conn *conn, const char *tag, int tag_len,
+                   const void *buf, size_t size)
+{
+    if (conn->lst) {
+        return flb_input_listener_append(conn->lst, tag, tag_len, buf, size);
+    }
+
+    return flb_input_chunk_append_raw(conn->in, tag, tag_len, buf, size);
+}
+
 /* Create a new Forward request instance */
-struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
+struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx,
+                            struct flb_input_listener *lst)
 {
     int ret;
     struct fw_conn *conn;
@@ -116,7 +132,6 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
     conn->fd      = fd;
     conn->ctx     = ctx;
     conn->buf_len = 0;
-    conn->rest    = 0;
     conn->status  = FW_NEW;
 
     /* Allocate read buffer */
@@ -129,9 +144,18 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
     }
     conn->buf_size = ctx->buffer_chunk_size;
     conn->in       = ctx->in;
+    conn->lst      = lst;
+    conn->gz       = NULL;
+
+    if (lst) {
+        conn->evl = lst->evl;
+    }
+    else {
+        conn->evl = ctx->evl;
+    }
 
     /* Register instance into the event loop */
-    ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
+    ret = mk_event_add(conn->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
     if (ret == -1) {
         flb_error("[in_fw] could not register new connection");
         flb_socket_close(fd);
@@ -140,7 +164,12 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
         return NULL;
     }
 
-    mk_list_add(&conn->_head, &ctx->connections);
+    if (lst) {
+        mk_list_add(&conn->_head, &lst->connections);
+    }
+    else {
+        mk_list_add(&conn->_head, &ctx->connections);
+    }
 
     return conn;
 }
@@ -148,10 +177,13 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
 int fw_conn_del(struct fw_conn *conn)
 {
     /* Unregister the file descriptior from the event-loop */
-    mk_event_del(conn->ctx->evl, &conn->event);
+    mk_event_del(conn->evl, &conn->event);
 
     /* Release resources */
     mk_list_del(&conn->_head);
+    if (conn->gz) {
+        flb_gzip_inflate_destroy(conn->gz);
+    }
     flb_socket_close(conn->fd);
     flb_free(conn->buf);
     flb_free(conn);
@@ -21,6 +21,8 @@
 #ifndef FLB_IN_FW_CONN_H
 #define FLB_IN_FW_CONN_H
 
+#include <fluent-bit/flb_gzip.h>
+
 #define FLB_IN_FW_CHUNK 32768
 
 enum {
@@ -43,15 +45,20 @@ struct fw_conn {
     char *buf;                       /* Buffer data                       */
     int  buf_len;                    /* Data length                       */
     int  buf_size;                   /* Buffer size                       */
-    size_t rest;                     /* Unpacking offset                  */
 
     struct flb_input_instance *in;   /* Parent plugin instance            */
     struct flb_in_fw_config *ctx;    /* Plugin configuration context      */
+    struct mk_event_loop *evl;       /* Event loop of the connection      */
+    struct flb_input_listener *lst;  /* Listener thread, if any           */
+    struct flb_gzip_inflate *gz;     /* Inflate context (lazy created)    */
 
     struct mk_list _head;
 };
 
-struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx);
+struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx,
+                            struct flb_input_listener *lst);
 int fw_conn_del(struct fw_conn *conn);
+int fw_conn_append(struct fw_conn *conn, const char *tag, int tag_len,
+                   const void *buf, size_t size);
 
 #endif
@@ -19,6 +19,7 @@
  */
 
 #include <msgpack.h>
+#include <mpack/mpack.h>
 
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_config.h>
@@ -29,274 +30,503 @@
 #include "fw_prot.h"
 #include "fw_conn.h"
 
-/* Try parsing rounds up-to 32 bytes */
-#define EACH_RECV_SIZE 32
+/* Check msgpack type by the first byte */
+#define FW_IS_STR(c)    ((((unsigned char) (c)) & 0xe0) == 0xa0 || \
+                         (((unsigned char) (c)) >= 0xd9 &&         \
+                          ((unsigned char) (c)) <= 0xdb))
+#define FW_IS_BIN(c)    (((unsigned char) (c)) >= 0xc4 && \
+                         ((unsigned char) (c)) <= 0xc6)
+#define FW_IS_ARRAY(c)  ((((unsigned char) (c)) & 0xf0) == 0x90 || \
+                         ((unsigned char) (c)) == 0xdc ||          \
+                         ((unsigned char) (c)) == 0xdd)
+
+/* Return values of fw_prot_frame() */
+#define FW_FRAME_INVALID     -1
+#define FW_FRAME_INCOMPLETE   0
+#define FW_FRAME_COMPLETE     1
+
+/* Read a big-endian length of 'n' bytes */
+static inline uint32_t frame_len(const unsigned char *p, int n)
+{
+    if (n == 1) {
+        return p[0];
+    }
+    else if (n == 2) {
+        return ((uint32_t) p[0] << 8) | p[1];
+    }
 
-static int fw_process_array(struct flb_input_instance *in,
-                            const char *tag, int tag_len,
-                            msgpack_object *arr)
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8) | p[3];
+}
+
+/*
+ * Lightweight framer: find where the msgpack object starting at 'buf' ends
+ * without decoding it. On success 'out_size' is set to the object size.
+ *
+ * Unlike a full unpacker, it's able to tell apart truncated data (we need
+ * to wait for more bytes) from invalid data (the connection must be closed)
+ * and it does not allocate memory.
+ */
+static int fw_prot_frame(const char *buf, size_t size, size_t *out_size)
 {
-    int i;
-    msgpack_object entry;
+    int n;
+    size_t off = 0;
+    size_t hdr;
+    uint64_t body;
+    uint64_t pending = 1;
+    const unsigned char *p = (const unsigned char *) buf;
+
+    while (pending > 0) {
+        if (off >= size) {
+            return FW_FRAME_INCOMPLETE;
+        }
+        pending--;
+
+        /* Single byte types */
+        if (p[off] <= 0x7f || p[off] >= 0xe0 ||
+            p[off] == 0xc0 || p[off] == 0xc2 || p[off] == 0xc3) {
+            off++;
+            continue;
+        }
+
+        /* fixmap, fixarray and fixstr */
+        if ((p[off] & 0xf0) == 0x80) {
+            pending += (uint64_t) (p[off] & 0x0f) * 2;
+            off++;
+            continue;
+        }
+        else if ((p[off] & 0xf0) == 0x90) {
+            pending += p[off] & 0x0f;
+            off++;
+            continue;
+        }
+        else if ((p[off] & 0xe0) == 0xa0) {
+            off += 1 + (p[off] & 0x1f);
+            continue;
+        }
+
+        /* Types with a length field: size of the length, extra header */
+        n = 0;
+        hdr = 1;
+        body = 0;
+        switch (p[off]) {
+        case 0xc4: case 0xd9:  n = 1; break;         /* bin8, str8   */
+        case 0xc5: case 0xda:  n = 2; break;         /* bin16, str16 */
+        case 0xc6: case 0xdb:  n = 4; break;         /* bin32, str32 */
+        case 0xc7:             n = 1; hdr++; break;  /* ext8         */
+        case 0xc8:             n = 2; hdr++; break;  /* ext16        */
+        case 0xc9:             n = 4; hdr++; break;  /* ext32        */
+        case 0xcc: case 0xd0:  body = 1; break;
+        case 0xcd: case 0xd1:  body = 2; break;
+        case 0xca: case 0xce: case 0xd2: body = 4; break;
+        case 0xcb: case 0xcf: case 0xd3: body = 8; break;
+        case 0xd4:             body = 2; break;      /* fixext1      */
+        case 0xd5:             body = 3; break;      /* fixext2      */
+        case 0xd6:             body = 5; break;      /* fixext4      */
+        case 0xd7:             body = 9; break;      /* fixext8      */
+        case 0xd8:             body = 17; break;     /* fixext16     */
+        case 0xdc: case 0xde:  n = 2; break;         /* array/map 16 */
+        case 0xdd: case 0xdf:  n = 4; break;         /* array/map 32 */
+        default:
+            /* 0xc1 is never used */
+            return FW_FRAME_INVALID;
+        }
+
+        if (n > 0) {
+            if (off + 1 + n > size) {
+                return FW_FRAME_INCOMPLETE;
+            }
+            body = frame_len(p + off + 1, n);
+            hdr += n;
+
+            /* Containers: account their items, not bytes */
+            if (p[off] == 0xdc || p[off] == 0xdd) {
+                pending += body;
+                body = 0;
+            }
+            else if (p[off] == 0xde || p[off] == 0xdf) {
+                pending += body * 2;
+                body = 0;
+            }
+        }
+
+        off += hdr + body;
+    }
+
+    if (off > size) {
+        return FW_FRAME_INCOMPLETE;
+    }
+
+    *out_size = off;
+    return FW_FRAME_COMPLETE;
+}
+
+/*
+ * Message mode: [tag, time, record, option]. Time and record are
+ * contiguous in the source buffer, so the entry is composed by just
+ * prefixing the array header.
+ */
+static int fw_process_message(struct fw_conn *conn,
+                              const char *tag, int tag_len,
+                              mpack_reader_t *reader)
+{
+    size_t len;
+    const char *start;
+    const char *end;
+    mpack_tag_t map;
     msgpack_sbuffer mp_sbuf;
     msgpack_packer mp_pck;
 
-    /*
-     * This process is not quite optimal from a performance perspective,
-     * we need to fix it later, likely using the offset of the original
-     * msgpack buffer.
-     *
-     * For now we iterate the array and append each entry into a chunk
-     */
+    mpack_reader_remaining(reader, &start);
+
+    /* Time: integer or EventTime */
+    mpack_discard(reader);
+
+    /* Record */
+    map = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok ||
+        mpack_tag_type(&map) != mpack_type_map) {
+        flb_warn("[in_fw] invalid data format, map expected");
+        return -1;
+    }
+    for (len = 0; len < mpack_tag_map_count(&map) * 2; len++) {
+        mpack_discard(reader);
+    }
+    mpack_done_map(reader);
+
+    if (mpack_reader_error(reader) != mpack_ok) {
+        return -1;
+    }
+    mpack_reader_remaining(reader, &end);
+
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
-    for (i = 0; i < arr->via.array.size; i++) {
-        entry = arr->via.array.ptr[i];
-        msgpack_pack_object(&mp_pck, entry);
-    }
+    msgpack_pack_array(&mp_pck, 2);
+    msgpack_sbuffer_write(&mp_sbuf, start, end - start);
 
-    flb_input_chunk_append_raw(in, tag, tag_len, mp_sbuf.data, mp_sbuf.size);
+    fw_conn_append(conn, tag, tag_len, mp_sbuf.data, mp_sbuf.size);
     msgpack_sbuffer_destroy(&mp_sbuf);
 
-    return i;
+    return 0;
 }
 
-static size_t receiver_recv(struct fw_conn *conn, char *buf, size_t try_size) {
-    size_t off;
-    size_t actual_size;
-
-    off = conn->buf_len - conn->rest;
-    actual_size = try_size;
+/*
+ * Forward mode: [tag, [[time, record], ...], option]. The entries follow
+ * the array header in the source buffer, they are appended as they are.
+ */
+static int fw_process_array(struct fw_conn *conn,
+                            const char *tag, int tag_len,
+                            mpack_reader_t *reader)
+{
+    uint32_t i;
+    uint32_t count;
+    const char *start;
+    const char *end;
+
+    count = mpack_expect_array(reader);
+    mpack_reader_remaining(reader, &start);
+    for (i = 0; i < count; i++) {
+        mpack_discard(reader);
+    }
+    mpack_done_array(reader);
 
-    if (actual_size > conn->rest) {
-        actual_size = conn->rest;
+    if (mpack_reader_error(reader) != mpack_ok) {
+        return -1;
     }
+    mpack_reader_remaining(reader, &end);
 
-    memcpy(buf, conn->buf + off, actual_size);
-    conn->rest -= actual_size;
+    if (end > start) {
+        fw_conn_append(conn, tag, tag_len, start, end - start);
+    }
 
-    return actual_size;
+    return count;
 }
 
-static size_t receiver_to_unpacker(struct fw_conn *conn, size_t request_size,
-                                   msgpack_unpacker *unpacker)
+/* Decompressed entries pending to be appended */
+struct fw_inflate {
+    struct fw_conn *conn;
+    const char *tag;
+    int tag_len;
+    msgpack_sbuffer buf;
+};
+
+/* Append every complete entry inflated so far, keep the remaining bytes */
+static int fw_inflate_cb(const void *data, size_t size, void *cb_data)
 {
-    size_t recv_len;
+    int ret;
+    size_t off = 0;
+    size_t len;
+    struct fw_inflate *inf = cb_data;
 
-    /* make sure there's enough room, or expand the unpacker accordingly */
-    if (msgpack_unpacker_buffer_capacity(unpacker) < request_size) {
-        msgpack_unpacker_reserve_buffer(unpacker, request_size);
-        assert(msgpack_unpacker_buffer_capacity(unpacker) >= request_size);
+    msgpack_sbuffer_write(&inf->buf, data, size);
+
+    while (off < inf->buf.size) {
+        ret = fw_prot_frame(inf->buf.data + off, inf->buf.size - off, &len);
+        if (ret == FW_FRAME_INCOMPLETE) {
+            break;
+        }
+        else if (ret == FW_FRAME_INVALID) {
+            flb_warn("[in_fw] invalid compressed entries");
+            return -1;
+        }
+        off += len;
     }
-    recv_len = receiver_recv(conn, msgpack_unpacker_buffer(unpacker),
-                             request_size);
-    msgpack_unpacker_buffer_consumed(unpacker, recv_len);
 
-    return recv_len;
+    if (off > 0) {
+        fw_conn_append(inf->conn, inf->tag, inf->tag_len, inf->buf.data, off);
+        memmove(inf->buf.data, inf->buf.data + off, inf->buf.size - off);
+        inf->buf.size -= off;
+    }
+
+    /* An incomplete entry can't be bigger than the connection buffer */
+    if (inf->buf.size > inf->conn->ctx->buffer_max_size) {
+        flb_warn("[in_fw] fd=%i decompressed entry exceed limit (%lu bytes)",
+                 inf->conn->fd, inf->conn->ctx->buffer_max_size);
+        return -1;
+    }
+
+    return 0;
 }
 
-int fw_prot_process(struct fw_conn *conn)
+/* CompressedPackedForward: inflate the GZip'ed entries */
+static int fw_process_compressed(struct fw_conn *conn,
+                                 const char *tag, int tag_len,
+                                 const char *data, size_t len)
 {
     int ret;
-    int stag_len;
-    int c = 0;
-    const char *stag;
-    size_t bytes;
-    size_t buf_off = 0;
-    size_t recv_len;
-    msgpack_object tag;
-    msgpack_object entry;
-    msgpack_object map;
-    msgpack_object root;
-    msgpack_unpacked result;
-    msgpack_unpacker *unp;
-    size_t all_used = 0;
+    struct fw_inflate inf;
 
-    /*
-     * [tag, time, record]
-     * [tag, [[time,record], [time,record], ...]]
-     */
+    if (!conn->gz) {
+        conn->gz = flb_gzip_inflate_create();
+        if (!conn->gz) {
+            return -1;
+        }
+    }
 
-    unp = msgpack_unpacker_new(1024);
-    msgpack_unpacked_init(&result);
-    conn->rest = conn->buf_len;
-
-    while (1) {
-        recv_len = receiver_to_unpacker(conn, EACH_RECV_SIZE, unp);
-        if (recv_len == 0) {
-            /* No more data */
-            msgpack_unpacker_free(unp);
-            msgpack_unpacked_destroy(&result);
-
-            /* Adjust buffer data */
-            if (conn->buf_len >= all_used && all_used > 0) {
-                memmove(conn->buf, conn->buf + all_used,
-                        conn->buf_len - all_used);
-                conn->buf_len -= all_used;
-            }
-            return 0;
+    inf.conn = conn;
+    inf.tag = tag;
+    inf.tag_len = tag_len;
+    msgpack_sbuffer_init(&inf.buf);
+
+    ret = flb_gzip_inflate_stream(conn->gz, data, len, fw_inflate_cb, &inf);
+    if (ret == 0 && inf.buf.size > 0) {
+        flb_warn("[in_fw] incomplete compressed entries");
+        ret = -1;
+    }
+    msgpack_sbuffer_destroy(&inf.buf);
+
+    return ret;
+}
+
+/* Check if the options map contains 'compressed: gzip' */
+static int fw_options_gzip(mpack_reader_t *reader)
+{
+    int gzip = FLB_FALSE;
+    uint32_t i;
+    uint32_t count;
+    uint32_t len;
+    const char *key;
+    const char *val;
+    mpack_tag_t t;
+
+    t = mpack_read_tag(reader);
+    if (mpack_tag_type(&t) != mpack_type_map) {
+        return FLB_FALSE;
+    }
+
+    count = mpack_tag_map_count(&t);
+    for (i = 0; i < count && mpack_reader_error(reader) == mpack_ok; i++) {
+        t = mpack_read_tag(reader);
+        if (mpack_tag_type(&t) != mpack_type_str) {
+            mpack_discard(reader);
+            continue;
         }
+        len = mpack_tag_str_length(&t);
+        key = mpack_read_bytes_inplace(reader, len);
+        mpack_done_str(reader);
 
-        /* Always summarize the total number of bytes requested to parse */
-        buf_off += recv_len;
-        ret = msgpack_unpacker_next_with_size(unp, &result, &bytes);
-
-        /*
-         * Upon parsing or memory errors, break the loop, return the error
-         * and expect the connection to be closed.
-         */
-        if (ret == MSGPACK_UNPACK_PARSE_ERROR ||
-            ret == MSGPACK_UNPACK_NOMEM_ERROR) {
-            /* A bit redunant, print out the real error */
-            if (ret == MSGPACK_UNPACK_PARSE_ERROR) {
-                flb_debug("[in_fw] err=MSGPACK_UNPACK_PARSE_ERROR");
-            }
-            else {
-                flb_error("[in_fw] err=MSGPACK_UNPACK_NOMEM_ERROR");
-            }
+        if (len != 10 || !key || strncmp(key, "compressed", 10) != 0) {
+            mpack_discard(reader);
+            continue;
+        }
 
-            /* Cleanup buffers */
-            msgpack_unpacked_destroy(&result);
-            msgpack_unpacker_free(unp);
+        /* Skip values of other types as a whole */
+        if (mpack_reader_remaining(reader, &val) == 0 || !FW_IS_STR(*val)) {
+            mpack_discard(reader);
+            continue;
+        }
 
-            return -1;
+        t = mpack_read_tag(reader);
+        len = mpack_tag_str_length(&t);
+        val = mpack_read_bytes_inplace(reader, len);
+        mpack_done_str(reader);
+
+        if (len == 4 && val && strncmp(val, "gzip", 4) == 0) {
+            gzip = FLB_TRUE;
         }
+    }
 
-        while (ret == MSGPACK_UNPACK_SUCCESS) {
-            /*
-             * For buffering optimization we always want to know the total
-             * number of bytes involved on the new object returned. Despites
-             * buf_off always know the given bytes, it's likely we used a bit
-             * less. This 'all_used' field keep a reference per object so
-             * when returning to the caller we can adjust the source buffer
-             * and deprecated consumed data.
-             *
-             * The 'last_parsed' field is Fluent Bit specific and is documented
-             * in:
-             *
-             *  lib/msgpack-c/include/msgpack/unpack.h
-             *
-             * Other references:
-             *
-             *  https://github.com/msgpack/msgpack-c/issues/514
-             */
-            all_used += bytes;
-
-
-            /* Map the array */
-            root = result.data;
-
-            if (root.type != MSGPACK_OBJECT_ARRAY) {
-                flb_debug("[in_fw] parser: expecting an array (type=%i), skip.",
-                          root.type);
-                msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
-                return -1;
-            }
+    return gzip;
+}
 
-            if (root.via.array.size < 2) {
-                flb_debug("[in_fw] parser: array of invalid size, skip.");
-                msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
-                return -1;
-            }
+/*
+ * PackedForward mode: [tag, <str|bin>, option]. The payload is a stream of
+ * [time, record] entries in our internal format, append it as-is.
+ *
+ * CompressedPackedForward mode sets the 'compressed: gzip' option.
+ */
+static int fw_process_packed(struct fw_conn *conn,
+                             const char *tag, int tag_len,
+                             mpack_reader_t *reader, uint32_t count)
+{
+    int gzip = FLB_FALSE;
+    uint32_t len;
+    const char *data;
+    mpack_tag_t entry;
+
+    entry = mpack_read_tag(reader);
+    len = mpack_tag_bytes(&entry);
+    data = mpack_read_bytes_inplace(reader, len);
+    if (mpack_tag_type(&entry) == mpack_type_str) {
+        mpack_done_str(reader);
+    }
+    else {
+        mpack_done_bin(reader);
+    }
 
-            /* Get the tag */
-            tag = root.via.array.ptr[0];
-            if (tag.type != MSGPACK_OBJECT_STR) {
-                flb_debug("[in_fw] parser: invalid tag format, skip.");
-                msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
-                return -1;
-            }
+    if (count >= 3) {
+        gzip = fw_options_gzip(reader);
+    }
 
-            stag     = tag.via.str.ptr;
-            stag_len = tag.via.str.size;
+    if (mpack_reader_error(reader) != mpack_ok) {
+        return -1;
+    }
 
-            entry = root.via.array.ptr[1];
-            if (entry.type == MSGPACK_OBJECT_ARRAY) {
-                /* Forward format 1: [tag, [[time, map], ...]] */
-                fw_process_array(conn->in, stag, stag_len, &entry);
-            }
-            else if (entry.type == MSGPACK_OBJECT_POSITIVE_INTEGER ||
-                     entry.type == MSGPACK_OBJECT_EXT) {
-                /* Forward format 2: [tag, time, map] */
-                map = root.via.array.ptr[2];
-                if (map.type != MSGPACK_OBJECT_MAP) {
-                    flb_warn("[in_fw] invalid data format, map expected");
-                    msgpack_unpacked_destroy(&result);
-                    msgpack_unpacker_free(unp);
-                    return -1;
-                }
-
-                /* Compose the new array */
-                struct msgpack_sbuffer mp_sbuf;
-                struct msgpack_packer mp_pck;
-
-                msgpack_sbuffer_init(&mp_sbuf);
-                msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-
-                msgpack_pack_array(&mp_pck, 2);
-                msgpack_pack_object(&mp_pck, entry);
-                msgpack_pack_object(&mp_pck, map);
-
-                /* Register data object */
-                flb_input_chunk_append_raw(conn->in, stag, stag_len,
-                                           mp_sbuf.data, mp_sbuf.size);
-                msgpack_sbuffer_destroy(&mp_sbuf);
-                c++;
-            }
-            else if (entry.type == MSGPACK_OBJECT_STR ||
-                     entry.type == MSGPACK_OBJECT_BIN) {
-                /* PackedForward Mode */
-                const char *data = NULL;
-                size_t len = 0;
-
-                if (entry.type == MSGPACK_OBJECT_STR) {
-                    data = entry.via.str.ptr;
-                    len = entry.via.str.size;
-                }
-                else if (entry.type == MSGPACK_OBJECT_BIN) {
-                    data = entry.via.bin.ptr;
-                    len = entry.via.bin.size;
-                }
-
-                if (data) {
-                    flb_input_chunk_append_raw(conn->in,
-                                               stag, stag_len,
-                                               data, len);
-                }
-            }
-            else {
-                flb_warn("[in_fw] invalid data format, type=%i",
-                         entry.type);
-                msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
-                return -1;
-            }
+    if (len == 0) {
+        return 0;
+    }
 
-            ret = msgpack_unpacker_next(unp, &result);
-        }
+    if (gzip == FLB_TRUE) {
+        return fw_process_compressed(conn, tag, tag_len, data, len);
     }
 
-    msgpack_unpacked_destroy(&result);
-    msgpack_unpacker_free(unp);
+    fw_conn_append(conn, tag, tag_len, data, len);
+    return 0;
+}
+
+/* Process one complete Forward protocol message */
+static int fw_process_frame(struct fw_conn *conn, const char *buf, size_t size)
+{
+    int ret;
+    int tag_len;
+    uint32_t count;
+    const char *tag;
+    const char *entry;
+    unsigned char type;
+    mpack_tag_t root;
+    mpack_tag_t t;
+    mpack_reader_t reader;
 
-    switch (ret) {
-    case MSGPACK_UNPACK_EXTRA_BYTES:
-        flb_error("[in_fw] MSGPACK_UNPACK_EXTRA_BYTES");
+    /*
+     * [tag, time, record]
+     * [tag, [[time,record], [time,record], ...]]
+     * [tag, packed_entries]
+     */
+    mpack_reader_init_data(&reader, buf, size);
+
+    root = mpack_read_tag(&reader);
+    if (mpack_tag_type(&root) != mpack_type_array) {
+        flb_debug("[in_fw] parser: expecting an array (type=%i), skip.",
+                  mpack_tag_type(&root));
+        mpack_reader_destroy(&reader);
         return -1;
-    case MSGPACK_UNPACK_CONTINUE:
-        flb_trace("[in_fw] MSGPACK_UNPACK_CONTINUE");
-        return 1;
-    case MSGPACK_UNPACK_PARSE_ERROR:
-        flb_debug("[in_fw] err=MSGPACK_UNPACK_PARSE_ERROR");
+    }
+
+    count = mpack_tag_array_count(&root);
+    if (count < 2) {
+        flb_debug("[in_fw] parser: array of invalid size, skip.");
+        mpack_reader_destroy(&reader);
+        return -1;
+    }
+
+    /* Get the tag */
+    t = mpack_read_tag(&reader);
+    if (mpack_tag_type(&t) != mpack_type_str) {
+        flb_debug("[in_fw] parser: invalid tag format, skip.");
+        mpack_reader_destroy(&reader);
         return -1;
-    case MSGPACK_UNPACK_NOMEM_ERROR:
-        flb_error("[in_fw] err=MSGPACK_UNPACK_NOMEM_ERROR");
+    }
+    tag_len = mpack_tag_str_length(&t);
+    tag = mpack_read_bytes_inplace(&reader, tag_len);
+    mpack_done_str(&reader);
+
+    if (mpack_reader_error(&reader) != mpack_ok) {
+        mpack_reader_destroy(&reader);
         return -1;
-    };
+    }
+
+    /* The mode is defined by the type of the second entry */
+    mpack_reader_remaining(&reader, &entry);
+    type = (unsigned char) *entry;
+
+    if (FW_IS_ARRAY(type)) {
+        /* Forward mode */
+        ret = fw_process_array(conn, tag, tag_len, &reader);
+    }
+    else if (FW_IS_STR(type) || FW_IS_BIN(type)) {
+        /* PackedForward mode */
+        ret = fw_process_packed(conn, tag, tag_len, &reader, count);
+    }
+    else if (type <= 0x7f || (type >= 0xcc && type <= 0xcf) ||
+             (type >= 0xc7 && type <= 0xc9) ||
+             (type >= 0xd4 && type <= 0xd8)) {
+        /* Message mode: positive integer or EventTime extension */
+        if (count < 3) {
+            flb_warn("[in_fw] invalid data format, map expected");
+            mpack_reader_destroy(&reader);
+            return -1;
+        }
+        ret = fw_process_message(conn, tag, tag_len, &reader);
+    }
+    else {
+        flb_warn("[in_fw] invalid data format, type=0x%02x", type);
+        ret = -1;
+    }
+
+    mpack_reader_destroy(&reader);
+    return ret;
+}
+
+int fw_prot_process(struct fw_conn *conn)
+{
+    int ret;
+    size_t off = 0;
+    size_t size;
+
+    /* Process every complete message available in the buffer */
+    while (off < conn->buf_len) {
+        ret = fw_prot_frame(conn->buf + off, conn->buf_len - off, &size);
+        if (ret == FW_FRAME_INCOMPLETE) {
+            break;
+        }
+        else if (ret == FW_FRAME_INVALID) {
+            flb_debug("[in_fw] invalid msgpack data");
+            return -1;
+        }
+
+        ret = fw_process_frame(conn, conn->buf + off, size);
+        if (ret == -1) {
+            return -1;
+        }
+        off += size;
+    }
+
+    /* Adjust buffer data */
+    if (off > 0) {
+        memmove(conn->buf, conn->buf + off, conn->buf_len - off);
+        conn->buf_len -= off;
+    }
 
     return 0;
 }
@@ -0,0 +1,213 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_network.h>
+
+#include "http.h"
+#include "http_conn.h"
+#include "http_config.h"
+
+/* A new client arrived on the server socket */
+static int in_http_collect(struct flb_input_instance *ins,
+                           struct flb_config *config, void *in_context)
+{
+    int fd;
+    struct flb_http *ctx = in_context;
+    struct http_conn *conn;
+
+    fd = flb_net_accept(ctx->server_fd);
+    if (fd == -1) {
+        flb_error("[in_http] could not accept new connection");
+        return -1;
+    }
+
+    flb_trace("[in_http] new TCP connection arrived FD=%i", fd);
+    conn = http_conn_add(fd, ctx, NULL);
+    if (!conn) {
+        return -1;
+    }
+    return 0;
+}
+
+/* New connection on a listener thread */
+static int in_http_accept(flb_sockfd_t fd, struct flb_input_listener *lst,
+                          void *data)
+{
+    struct http_conn *conn;
+
+    conn = http_conn_add(fd, data, lst);
+    if (!conn) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Records packed by the listener threads are ready */
+static int in_http_collect_listeners(struct flb_input_instance *ins,
+                                     struct flb_config *config,
+                                     void *in_context)
+{
+    struct flb_http *ctx = in_context;
+
+    flb_input_listeners_collect(ctx->listeners);
+    return 0;
+}
+
+static void in_http_listeners_exit(struct flb_http *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_list *l_head;
+    struct http_conn *conn;
+    struct flb_input_listener *lst;
+
+    flb_input_listeners_stop(ctx->listeners);
+
+    mk_list_foreach(l_head, &ctx->listeners->listeners) {
+        lst = mk_list_entry(l_head, struct flb_input_listener, _head);
+        mk_list_foreach_safe(head, tmp, &lst->connections) {
+            conn = mk_list_entry(head, struct http_conn, _head);
+            http_conn_del(conn);
+        }
+    }
+
+    flb_input_listeners_destroy(ctx->listeners);
+    ctx->listeners = NULL;
+}
+
+static int in_http_listeners_init(struct flb_http *ctx,
+                                  struct flb_config *config)
+{
+    int ret;
+
+    ctx->listeners = flb_input_listeners_create(ctx->in,
+                                                ctx->listen, ctx->tcp_port,
+                                                ctx->workers, in_http_accept,
+                                                ctx, config);
+    if (!ctx->listeners) {
+        flb_error("[in_http] could not bind address %s:%s. Aborting",
+                  ctx->listen, ctx->tcp_port);
+        return -1;
+    }
+
+    ret = flb_input_listeners_start(ctx->listeners,
+                                    in_http_collect_listeners);
+    if (ret == -1) {
+        flb_error("[in_http] could not start listeners");
+        in_http_listeners_exit(ctx);
+        return -1;
+    }
+
+    flb_info("[in_http] listening on %s:%s (%i workers)",
+             ctx->listen, ctx->tcp_port, ctx->workers);
+    return 0;
+}
+
+static int in_http_init(struct flb_input_instance *ins,
+                        struct flb_config *config, void *data)
+{
+    int ret;
+    struct flb_http *ctx;
+    (void) data;
+
+    ctx = http_config_create(ins);
+    if (!ctx) {
+        return -1;
+    }
+    ctx->in = ins;
+    ctx->evl = config->evl;
+    mk_list_init(&ctx->connections);
+
+    flb_input_set_context(ins, ctx);
+
+    /* TCP listener threads */
+    if (ctx->workers > 0) {
+        ret = in_http_listeners_init(ctx, config);
+        if (ret == -1) {
+            http_config_destroy(ctx);
+            return -1;
+        }
+        return 0;
+    }
+
+    ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
+    if (ctx->server_fd > 0) {
+        flb_info("[in_http] listening on %s:%s", ctx->listen, ctx->tcp_port);
+    }
+    else {
+        flb_error("[in_http] could not bind address %s:%s. Aborting",
+                  ctx->listen, ctx->tcp_port);
+        ctx->server_fd = -1;
+        http_config_destroy(ctx);
+        return -1;
+    }
+    flb_net_socket_nonblocking(ctx->server_fd);
+
+    ret = flb_input_set_collector_socket(ins,
+                                         in_http_collect,
+                                         ctx->server_fd,
+                                         config);
+    if (ret == -1) {
+        flb_error("[in_http] could not set server socket collector");
+        http_config_destroy(ctx);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int in_http_exit(void *data, struct flb_config *config)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct http_conn *conn;
+    struct flb_http *ctx = data;
+    (void) config;
+
+    if (!ctx) {
+        return 0;
+    }
+
+    if (ctx->listeners) {
+        in_http_listeners_exit(ctx);
+    }
+
+    mk_list_foreach_safe(head, tmp, &ctx->connections) {
+        conn = mk_list_entry(head, struct http_conn, _head);
+        http_conn_del(conn);
+    }
+
+    http_config_destroy(ctx);
+    return 0;
+}
+
+/* Plugin reference */
+struct flb_input_plugin in_http_plugin = {
+    .name         = "http",
+    .description  = "HTTP",
+    .cb_init      = in_http_init,
+    .cb_pre_run   = NULL,
+    .cb_collect   = in_http_collect,
+    .cb_flush_buf = NULL,
+    .cb_exit      = in_http_exit,
+    .flags        = FLB_INPUT_NET,
+};
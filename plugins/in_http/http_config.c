@@ -0,0 +1,109 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_socket.h>
+
+#include "http.h"
+#include "http_config.h"
+
+#include <stdlib.h>
+
+struct flb_http *http_config_create(struct flb_input_instance *ins)
+{
+    char port[16];
+    int64_t size;
+    const char *tmp;
+    struct flb_http *ctx;
+
+    ctx = flb_calloc(1, sizeof(struct flb_http));
+    if (!ctx) {
+        flb_errno();
+        return NULL;
+    }
+    ctx->server_fd = -1;
+
+    /* Listen interface (if not set, defaults to 0.0.0.0) */
+    if (!ins->host.listen) {
+        tmp = flb_input_get_property("listen", ins);
+        if (tmp) {
+            ctx->listen = flb_strdup(tmp);
+        }
+        else {
+            ctx->listen = flb_strdup("0.0.0.0");
+        }
+    }
+    else {
+        ctx->listen = flb_strdup(ins->host.listen);
+    }
+
+    /* Listener TCP Port */
+    if (ins->host.port == 0) {
+        ctx->tcp_port = flb_strdup("9880");
+    }
+    else {
+        snprintf(port, sizeof(port) - 1, "%d", ins->host.port);
+        ctx->tcp_port = flb_strdup(port);
+    }
+
+    /* Number of listener threads (SO_REUSEPORT) */
+    tmp = flb_input_get_property("workers", ins);
+    if (tmp) {
+        ctx->workers = atoi(tmp);
+    }
+
+    /* Buffer allocation unit for each connection */
+    size = -1;
+    tmp = flb_input_get_property("buffer_chunk_size", ins);
+    if (tmp) {
+        size = flb_utils_size_to_bytes(tmp);
+    }
+    ctx->buffer_chunk_size = (size > 0) ? size : FLB_IN_HTTP_CHUNK;
+
+    /* Maximum size of a request, decompressed body included */
+    size = -1;
+    tmp = flb_input_get_property("buffer_max_size", ins);
+    if (tmp) {
+        size = flb_utils_size_to_bytes(tmp);
+    }
+    ctx->buffer_max_size = (size > 0) ? size : FLB_IN_HTTP_MAX_BUFFER;
+    if (ctx->buffer_max_size < ctx->buffer_chunk_size) {
+        ctx->buffer_max_size = ctx->buffer_chunk_size;
+    }
+
+    flb_debug("[in_http] Listen='%s' TCP_Port=%s buffer_max_size=%lu",
+              ctx->listen, ctx->tcp_port, ctx->buffer_max_size);
+
+    return ctx;
+}
+
+int http_config_destroy(struct flb_http *ctx)
+{
+    if (ctx->server_fd != -1) {
+        flb_socket_close(ctx->server_fd);
+    }
+    flb_free(ctx->listen);
+    flb_free(ctx->tcp_port);
+    flb_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_network.h>
+
+#include "http.h"
+#include "http_conn.h"
+#include "http_prot.h"
+
+/* Make sure the buffer can hold 'size' bytes plus a NULL byte */
+int http_conn_reserve(struct http_conn *conn, size_t size)
+{
+    char *tmp;
+
+    if (size + 1 <= conn->buf_size) {
+        return 0;
+    }
+
+    tmp = flb_realloc(conn->buf_data, size + 1);
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    flb_trace("[in_http] fd=%i buffer realloc %lu -> %lu",
+              conn->fd, conn->buf_size, size + 1);
+
+    conn->buf_data = tmp;
+    conn->buf_size = size + 1;
+    return 0;
+}
+
+/* Callback invoked every time an event is triggered for a connection */
+static int http_conn_event(void *data)
+{
+    int ret;
+    ssize_t bytes;
+    size_t available;
+    struct mk_event *event;
+    struct http_conn *conn = data;
+    struct flb_http *ctx = conn->ctx;
+
+    event = &conn->event;
+    if (event->mask & MK_EVENT_READ) {
+        available = (conn->buf_size - conn->buf_len) - 1;
+        if (available < 1) {
+            if (conn->buf_len >= ctx->buffer_max_size) {
+                flb_warn("[in_http] fd=%i request exceeds buffer_max_size "
+                         "(%lu bytes)", event->fd, ctx->buffer_max_size);
+                http_prot_error(conn, 413);
+                http_conn_del(conn);
+                return -1;
+            }
+
+            ret = http_conn_reserve(conn, conn->buf_size +
+                                    ctx->buffer_chunk_size);
+            if (ret == -1) {
+                http_conn_del(conn);
+                return -1;
+            }
+            available = (conn->buf_size - conn->buf_len) - 1;
+        }
+
+        /* Read data */
+        bytes = recv(conn->fd, conn->buf_data + conn->buf_len, available, 0);
+        if (bytes <= 0) {
+            flb_trace("[in_http] fd=%i closed connection", event->fd);
+            http_conn_del(conn);
+            return -1;
+        }
+
+        conn->buf_len += bytes;
+        conn->buf_data[conn->buf_len] = '\0';
+
+        /* Process every complete request */
+        ret = http_prot_process(conn);
+        if (ret == -1) {
+            http_conn_del(conn);
+            return -1;
+        }
+
+        return bytes;
+    }
+
+    if (event->mask & MK_EVENT_CLOSE) {
+        flb_trace("[in_http] fd=%i hangup", event->fd);
+        http_conn_del(conn);
+        return -1;
+    }
+
+    return 0;
+}
+
+struct http_conn *http_conn_add(int fd, struct flb_http *ctx,
+                                struct flb_input_listener *lst)
+{
+    int ret;
+    struct http_conn *conn;
+    struct mk_event *event;
+
+    conn = flb_calloc(1, sizeof(struct http_conn));
+    if (!conn) {
+        flb_errno();
+        flb_socket_close(fd);
+        return NULL;
+    }
+
+    /* Set data for the event-loop */
+    event = &conn->event;
+    MK_EVENT_NEW(event);
+    event->fd           = fd;
+    event->type         = FLB_ENGINE_EV_CUSTOM;
+    event->handler      = http_conn_event;
+
+    /* Connection info */
+    conn->fd  = fd;
+    conn->ctx = ctx;
+    conn->in  = ctx->in;
+    conn->lst = lst;
+
+    if (lst) {
+        conn->evl = lst->evl;
+    }
+    else {
+        conn->evl = ctx->evl;
+    }
+
+    conn->buf_data = flb_malloc(ctx->buffer_chunk_size);
+    if (!conn->buf_data) {
+        flb_errno();
+        flb_socket_close(fd);
+        flb_error("[in_http] could not allocate new connection");
+        flb_free(conn);
+        return NULL;
+    }
+    conn->buf_size = ctx->buffer_chunk_size;
+    http_prot_reset(conn);
+
+    /* Register instance into the event loop */
+    ret = mk_event_add(conn->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
+    if (ret == -1) {
+        flb_error("[in_http] could not register new connection");
+        flb_socket_close(fd);
+        flb_free(conn->buf_data);
+        flb_free(conn);
+        return NULL;
+    }
+
+    if (lst) {
+        mk_list_add(&conn->_head, &lst->connections);
+    }
+    else {
+        mk_list_add(&conn->_head, &ctx->connections);
+    }
+
+    return conn;
+}
+
+int http_conn_del(struct http_conn *conn)
+{
+    /* Unregister the file descriptior from the event-loop */
+    mk_event_del(conn->evl, &conn->event);
+
+    /* Release resources */
+    mk_list_del(&conn->_head);
+    flb_socket_close(conn->fd);
+    if (conn->gz) {
+        flb_gzip_inflate_destroy(conn->gz);
+    }
+    flb_free(conn->buf_data);
+    flb_free(conn);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_IN_HTTP_CONN_H
+#define FLB_IN_HTTP_CONN_H
+
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_input_listener.h>
+
+#include "http.h"
+
+/* Request parser status */
+#define HTTP_REQ_HEADERS  0   /* waiting for the request headers */
+#define HTTP_REQ_BODY     1   /* waiting for the request body    */
+
+/* State of the request being parsed, offsets are relative to buf_data */
+struct http_request {
+    int status;                       /* HTTP_REQ_HEADERS or HTTP_REQ_BODY */
+    int keepalive;                    /* keep connection after response    */
+    int chunked;                      /* Transfer-Encoding: chunked        */
+    int gzip;                         /* Content-Encoding: gzip            */
+    int tag_len;                      /* tag length, 0 means instance tag  */
+    char tag[256];                    /* tag taken from the request URI    */
+    size_t headers_len;               /* request line and headers          */
+    size_t content_length;            /* Content-Length body size          */
+    size_t chunk_rd;                  /* chunked: encoded bytes consumed   */
+    size_t body_len;                  /* chunked: decoded bytes            */
+};
+
+/* Represents a connection */
+struct http_conn {
+    struct mk_event event;            /* Built-in event data for mk_events */
+    int fd;                           /* Socket file descriptor            */
+
+    /* Buffer */
+    char *buf_data;                   /* Buffer data                       */
+    size_t buf_len;                   /* Data length                       */
+    size_t buf_size;                  /* Buffer size                       */
+
+    struct http_request req;          /* Request being parsed              */
+    struct flb_gzip_inflate *gz;      /* Inflate context, created on use   */
+
+    struct flb_input_instance *in;    /* Parent plugin instance            */
+    struct flb_http *ctx;             /* Plugin configuration context      */
+    struct mk_event_loop *evl;        /* Event loop of the connection      */
+    struct flb_input_listener *lst;   /* Listener thread, if any           */
+    struct mk_list _head;
+};
+
+struct http_conn *http_conn_add(int fd, struct flb_http *ctx,
+                                struct flb_input_listener *lst);
+int http_conn_reserve(struct http_conn *conn, size_t size);
+int http_conn_del(struct http_conn *conn);
+
+#endif
@@ -0,0 +1,673 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_network.h>
+#include <msgpack.h>
+
+#include "http.h"
+#include "http_conn.h"
+#include "http_prot.h"
+
+/* Return codes of the chunked body decoder */
+#define HTTP_CHUNK_INVALID  -1
+#define HTTP_CHUNK_TOO_BIG  -2
+#define HTTP_CHUNK_PARTIAL   0
+#define HTTP_CHUNK_COMPLETE  1
+
+/* Decompressed body, limited to buffer_max_size */
+struct http_inflate {
+    int overflow;
+    size_t limit;
+    msgpack_sbuffer sbuf;
+};
+
+static const char *http_status_str(int status)
+{
+    switch (status) {
+    case 100:
+        return "Continue";
+    case 201:
+        return "Created";
+    case 400:
+        return "Bad Request";
+    case 405:
+        return "Method Not Allowed";
+    case 411:
+        return "Length Required";
+    case 413:
+        return "Payload Too Large";
+    case 415:
+        return "Unsupported Media Type";
+    case 501:
+        return "Not Implemented";
+    }
+
+    return "Internal Server Error";
+}
+
+static int http_send(struct http_conn *conn, const char *buf, size_t size)
+{
+    ssize_t bytes;
+    size_t sent = 0;
+
+    /*
+     * Responses are a few bytes long, if the socket buffer is full the
+     * client is not reading them and the connection is dropped.
+     */
+    while (sent < size) {
+        bytes = send(conn->fd, buf + sent, size - sent, 0);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            flb_errno();
+            return -1;
+        }
+        sent += bytes;
+    }
+
+    return 0;
+}
+
+static int http_respond(struct http_conn *conn, int status, int keepalive)
+{
+    int len;
+    char buf[128];
+
+    if (status == 100) {
+        len = snprintf(buf, sizeof(buf), "HTTP/1.1 100 Continue\r\n\r\n");
+    }
+    else {
+        len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 %i %s\r\n"
+                       "Content-Length: 0\r\n"
+                       "%s"
+                       "\r\n",
+                       status, http_status_str(status),
+                       keepalive ? "" : "Connection: close\r\n");
+    }
+
+    return http_send(conn, buf, len);
+}
+
+/* Reply with an error status, the connection is closed by the caller */
+int http_prot_error(struct http_conn *conn, int status)
+{
+    return http_respond(conn, status, FLB_FALSE);
+}
+
+void http_prot_reset(struct http_conn *conn)
+{
+    struct http_request *req = &conn->req;
+
+    req->status = HTTP_REQ_HEADERS;
+    req->keepalive = FLB_TRUE;
+    req->chunked = FLB_FALSE;
+    req->gzip = FLB_FALSE;
+    req->tag_len = 0;
+    req->headers_len = 0;
+    req->content_length = 0;
+    req->chunk_rd = 0;
+    req->body_len = 0;
+}
+
+static inline int http_header_eq(const char *str, int len, const char *value)
+{
+    int v_len = strlen(value);
+
+    if (len != v_len) {
+        return FLB_FALSE;
+    }
+    return (strncasecmp(str, value, len) == 0);
+}
+
+/* Compose the record tag from the request URI, '/app/logs' -> 'app.logs' */
+static int http_set_tag(struct http_request *req, const char *uri, int len)
+{
+    int i;
+    int c;
+
+    while (len > 0 && *uri == '/') {
+        uri++;
+        len--;
+    }
+
+    for (i = 0; i < len && uri[i] != '?'; i++) {
+        if (i >= sizeof(req->tag) - 1) {
+            return -1;
+        }
+
+        c = uri[i];
+        if (c == '/') {
+            c = '.';
+        }
+        else if (!isalnum(c) && c != '.' && c != '_' && c != '-') {
+            return -1;
+        }
+        req->tag[i] = c;
+    }
+
+    req->tag[i] = '\0';
+    req->tag_len = i;
+    return 0;
+}
+
+/*
+ * Parse the request line and headers, on error it returns the HTTP status
+ * code to reply with.
+ */
+static int http_parse_headers(struct http_conn *conn, int *expect)
+{
+    int len;
+    int n_len;
+    int v_len;
+    int line = 0;
+    int has_length = FLB_FALSE;
+    char *p;
+    char *sp;
+    char *eol;
+    char *end;
+    char *name;
+    char *value;
+    char *num_end;
+    unsigned long long num;
+    struct http_request *req = &conn->req;
+
+    p = conn->buf_data;
+    end = conn->buf_data + req->headers_len - 2;
+
+    while (p < end) {
+        eol = memmem(p, end - p, "\r\n", 2);
+        if (!eol) {
+            return 400;
+        }
+        len = eol - p;
+
+        /* Request line: METHOD SP URI SP VERSION */
+        if (line++ == 0) {
+            sp = memchr(p, ' ', len);
+            if (!sp) {
+                return 400;
+            }
+            if (sp - p != 4 || strncmp(p, "POST", 4) != 0) {
+                return 405;
+            }
+            p = sp + 1;
+            len = eol - p;
+
+            sp = memchr(p, ' ', len);
+            if (!sp) {
+                return 400;
+            }
+            if (http_set_tag(req, p, sp - p) == -1) {
+                flb_debug("[in_http] invalid tag in URI '%.*s'",
+                          (int) (sp - p), p);
+                return 400;
+            }
+            p = sp + 1;
+            len = eol - p;
+
+            if (http_header_eq(p, len, "HTTP/1.1")) {
+                req->keepalive = FLB_TRUE;
+            }
+            else if (http_header_eq(p, len, "HTTP/1.0")) {
+                req->keepalive = FLB_FALSE;
+            }
+            else {
+                return 400;
+            }
+
+            p = eol + 2;
+            continue;
+        }
+
+        /* Header: 'name: value' */
+        sp = memchr(p, ':', len);
+        if (!sp) {
+            return 400;
+        }
+        name = p;
+        n_len = sp - p;
+
+        value = sp + 1;
+        while (value < eol && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        v_len = eol - value;
+        while (v_len > 0 && (value[v_len - 1] == ' ' ||
+                             value[v_len - 1] == '\t')) {
+            v_len--;
+        }
+
+        if (http_header_eq(name, n_len, "Content-Length")) {
+            if (v_len == 0 || !isdigit(*value)) {
+                return 400;
+            }
+            errno = 0;
+            num = strtoull(value, &num_end, 10);
+            if (errno != 0 || num_end != value + v_len) {
+                return 400;
+            }
+            req->content_length = num;
+            has_length = FLB_TRUE;
+        }
+        else if (http_header_eq(name, n_len, "Transfer-Encoding")) {
+            if (!http_header_eq(value, v_len, "chunked")) {
+                return 501;
+            }
+            req->chunked = FLB_TRUE;
+        }
+        else if (http_header_eq(name, n_len, "Content-Encoding")) {
+            if (http_header_eq(value, v_len, "gzip") ||
+                http_header_eq(value, v_len, "x-gzip")) {
+                req->gzip = FLB_TRUE;
+            }
+            else if (!http_header_eq(value, v_len, "identity")) {
+                return 415;
+            }
+        }
+        else if (http_header_eq(name, n_len, "Connection")) {
+            if (http_header_eq(value, v_len, "close")) {
+                req->keepalive = FLB_FALSE;
+            }
+            else if (http_header_eq(value, v_len, "keep-alive")) {
+                req->keepalive = FLB_TRUE;
+            }
+        }
+        else if (http_header_eq(name, n_len, "Expect")) {
+            if (http_header_eq(value, v_len, "100-continue")) {
+                *expect = FLB_TRUE;
+            }
+        }
+
+        p = eol + 2;
+    }
+
+    /* Chunked transfer coding takes precedence over Content-Length */
+    if (req->chunked == FLB_TRUE) {
+        req->content_length = 0;
+    }
+    else if (has_length == FLB_FALSE) {
+        return 411;
+    }
+    else if (req->content_length > conn->ctx->buffer_max_size) {
+        return 413;
+    }
+
+    return 0;
+}
+
+/*
+ * Decode a chunked body in place: the data of every complete chunk is moved
+ * right after the request headers, so the decoded body is contiguous.
+ */
+static int http_dechunk(struct http_conn *conn)
+{
+    size_t size;
+    size_t left;
+    size_t need;
+    char *p;
+    char *eol;
+    char *end;
+    char *body;
+    struct http_request *req = &conn->req;
+
+    body = conn->buf_data + req->headers_len;
+
+    while (1) {
+        p = body + req->chunk_rd;
+        left = conn->buf_len - (req->headers_len + req->chunk_rd);
+
+        /* chunk-size [; extensions] CRLF */
+        eol = memmem(p, left, "\r\n", 2);
+        if (!eol) {
+            return HTTP_CHUNK_PARTIAL;
+        }
+
+        errno = 0;
+        size = strtoul(p, &end, 16);
+        if (end == p || errno != 0 || (*end != ';' && end != eol)) {
+            return HTTP_CHUNK_INVALID;
+        }
+
+        /* Last chunk, followed by optional trailers and an empty line */
+        if (size == 0) {
+            p = eol + 2;
+            left = conn->buf_len - (p - conn->buf_data);
+            if (left < 2) {
+                return HTTP_CHUNK_PARTIAL;
+            }
+            if (p[0] != '\r' || p[1] != '\n') {
+                end = memmem(p, left, "\r\n\r\n", 4);
+                if (!end) {
+                    return HTTP_CHUNK_PARTIAL;
+                }
+                p = end + 2;
+            }
+            req->chunk_rd = (p + 2) - body;
+            return HTTP_CHUNK_COMPLETE;
+        }
+
+        if (size > conn->ctx->buffer_max_size ||
+            req->body_len + size > conn->ctx->buffer_max_size) {
+            return HTTP_CHUNK_TOO_BIG;
+        }
+
+        need = (eol + 2 - p) + size + 2;
+        if (left < need) {
+            return HTTP_CHUNK_PARTIAL;
+        }
+        if (eol[2 + size] != '\r' || eol[3 + size] != '\n') {
+            return HTTP_CHUNK_INVALID;
+        }
+
+        memmove(body + req->body_len, eol + 2, size);
+        req->body_len += size;
+        req->chunk_rd += need;
+    }
+}
+
+/* Register records, through the listener queue if the connection has one */
+static inline int http_append(struct http_conn *conn,
+                              const void *buf, size_t size)
+{
+    char *tag = NULL;
+    struct http_request *req = &conn->req;
+
+    if (req->tag_len > 0) {
+        tag = req->tag;
+    }
+
+    if (conn->lst) {
+        return flb_input_listener_append(conn->lst, tag, req->tag_len,
+                                         buf, size);
+    }
+
+    return flb_input_chunk_append_raw(conn->in, tag, req->tag_len, buf, size);
+}
+
+/*
+ * Convert a JSON body into records: a JSON map, an array of maps or
+ * newline delimited maps. All records share the request timestamp and are
+ * registered with a single append.
+ */
+static int http_pack_json(struct http_conn *conn, const char *json, size_t size)
+{
+    int i;
+    int ret;
+    int out_size;
+    int records = 0;
+    int invalid = 0;
+    size_t off = 0;
+    size_t prev = 0;
+    char *pack;
+    msgpack_object *obj;
+    msgpack_object *entry;
+    msgpack_unpacked result;
+    msgpack_packer mp_pck;
+    msgpack_sbuffer mp_sbuf;
+    struct flb_time tm;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state(json, size, &pack, &out_size, &state);
+    if (ret == 0) {
+        /* Only blank characters may follow the last JSON message */
+        for (off = state.last_byte; off < size; off++) {
+            if (!isspace(json[off])) {
+                flb_free(pack);
+                ret = -1;
+                break;
+            }
+        }
+    }
+    flb_pack_state_reset(&state);
+
+    if (ret != 0) {
+        flb_debug("[in_http] fd=%i invalid JSON body", conn->fd);
+        return 400;
+    }
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    flb_time_get(&tm);
+
+    off = 0;
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, pack, out_size, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        obj = &result.data;
+
+        if (obj->type == MSGPACK_OBJECT_MAP) {
+            /* The map is already serialized, copy it as-is */
+            msgpack_pack_array(&mp_pck, 2);
+            flb_time_append_to_msgpack(&tm, &mp_pck, 0);
+            msgpack_sbuffer_write(&mp_sbuf, pack + prev, off - prev);
+            records++;
+        }
+        else if (obj->type == MSGPACK_OBJECT_ARRAY) {
+            for (i = 0; i < obj->via.array.size; i++) {
+                entry = &obj->via.array.ptr[i];
+                if (entry->type != MSGPACK_OBJECT_MAP) {
+                    invalid++;
+                    continue;
+                }
+                msgpack_pack_array(&mp_pck, 2);
+                flb_time_append_to_msgpack(&tm, &mp_pck, 0);
+                msgpack_pack_object(&mp_pck, *entry);
+                records++;
+            }
+        }
+        else {
+            invalid++;
+        }
+        prev = off;
+    }
+    msgpack_unpacked_destroy(&result);
+    flb_free(pack);
+
+    if (invalid > 0) {
+        flb_debug("[in_http] fd=%i %i entries are not JSON maps, "
+                  "request rejected", conn->fd, invalid);
+        msgpack_sbuffer_destroy(&mp_sbuf);
+        return 400;
+    }
+
+    if (records > 0) {
+        ret = http_append(conn, mp_sbuf.data, mp_sbuf.size);
+        if (ret == -1) {
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            return 500;
+        }
+    }
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    return 201;
+}
+
+static int http_inflate_cb(const void *data, size_t size, void *cb_data)
+{
+    struct http_inflate *inf = cb_data;
+
+    if (inf->sbuf.size + size > inf->limit) {
+        inf->overflow = FLB_TRUE;
+        return -1;
+    }
+    return msgpack_sbuffer_write(&inf->sbuf, data, size);
+}
+
+/* Process a complete request body, returns the HTTP status code */
+static int http_prot_body(struct http_conn *conn, char *body, size_t size)
+{
+    int ret;
+    int status;
+    struct http_inflate inf;
+
+    if (conn->req.gzip == FLB_FALSE) {
+        return http_pack_json(conn, body, size);
+    }
+
+    if (!conn->gz) {
+        conn->gz = flb_gzip_inflate_create();
+        if (!conn->gz) {
+            return 500;
+        }
+    }
+
+    inf.overflow = FLB_FALSE;
+    inf.limit = conn->ctx->buffer_max_size;
+    msgpack_sbuffer_init(&inf.sbuf);
+
+    ret = flb_gzip_inflate_stream(conn->gz, body, size, http_inflate_cb, &inf);
+    if (ret == -1) {
+        if (inf.overflow == FLB_TRUE) {
+            flb_warn("[in_http] fd=%i decompressed body exceeds "
+                     "buffer_max_size (%lu bytes)", conn->fd, inf.limit);
+            status = 413;
+        }
+        else {
+            status = 400;
+        }
+        msgpack_sbuffer_destroy(&inf.sbuf);
+        return status;
+    }
+
+    status = http_pack_json(conn, inf.sbuf.data, inf.sbuf.size);
+    msgpack_sbuffer_destroy(&inf.sbuf);
+
+    return status;
+}
+
+/*
+ * Process every complete request available in the connection buffer.
+ * Returns -1 when the connection must be closed.
+ */
+int http_prot_process(struct http_conn *conn)
+{
+    int ret;
+    int expect;
+    int status;
+    int keepalive;
+    char *end;
+    size_t consumed;
+    size_t body_len;
+    struct http_request *req = &conn->req;
+
+    while (conn->buf_len > 0) {
+        if (req->status == HTTP_REQ_HEADERS) {
+            /* Skip empty lines between pipelined requests */
+            consumed = 0;
+            while (consumed < conn->buf_len &&
+                   (conn->buf_data[consumed] == '\r' ||
+                    conn->buf_data[consumed] == '\n')) {
+                consumed++;
+            }
+            if (consumed > 0) {
+                memmove(conn->buf_data, conn->buf_data + consumed,
+                        conn->buf_len - consumed);
+                conn->buf_len -= consumed;
+                conn->buf_data[conn->buf_len] = '\0';
+                continue;
+            }
+
+            end = memmem(conn->buf_data, conn->buf_len, "\r\n\r\n", 4);
+            if (!end) {
+                return 0;
+            }
+            req->headers_len = (end - conn->buf_data) + 4;
+
+            expect = FLB_FALSE;
+            status = http_parse_headers(conn, &expect);
+            if (status != 0) {
+                http_prot_error(conn, status);
+                return -1;
+            }
+
+            /* Allocate the whole request at once */
+            if (req->chunked == FLB_FALSE) {
+                ret = http_conn_reserve(conn, req->headers_len +
+                                        req->content_length);
+                if (ret == -1) {
+                    return -1;
+                }
+            }
+            req->status = HTTP_REQ_BODY;
+
+            if (expect == FLB_TRUE && conn->buf_len == req->headers_len) {
+                ret = http_respond(conn, 100, FLB_TRUE);
+                if (ret == -1) {
+                    return -1;
+                }
+            }
+        }
+
+        if (req->chunked == FLB_TRUE) {
+            ret = http_dechunk(conn);
+            if (ret == HTTP_CHUNK_PARTIAL) {
+                return 0;
+            }
+            else if (ret == HTTP_CHUNK_TOO_BIG) {
+                http_prot_error(conn, 413);
+                return -1;
+            }
+            else if (ret == HTTP_CHUNK_INVALID) {
+                http_prot_error(conn, 400);
+                return -1;
+            }
+            body_len = req->body_len;
+            consumed = req->headers_len + req->chunk_rd;
+        }
+        else {
+            if (conn->buf_len - req->headers_len < req->content_length) {
+                return 0;
+            }
+            body_len = req->content_length;
+            consumed = req->headers_len + req->content_length;
+        }
+
+        status = http_prot_body(conn, conn->buf_data + req->headers_len,
+                                body_len);
+        keepalive = req->keepalive;
+
+        ret = http_respond(conn, status, keepalive);
+        if (ret == -1 || keepalive == FLB_FALSE) {
+            return -1;
+        }
+
+        /* Move any pipelined request to the beginning of the buffer */
+        memmove(conn->buf_data, conn->buf_data + consumed,
+                conn->buf_len - consumed);
+        conn->buf_len -= consumed;
+        conn->buf_data[conn->buf_len] = '\0';
+        http_prot_reset(conn);
+    }
+
+    return 0;
+}
@@ -23,6 +23,9 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_socket.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_net_dgram.h>
+#include <fluent-bit/flb_metrics.h>
 
 #define MAX_PACKET_SIZE 65536
 #define DEFAULT_LISTEN "0.0.0.0"
@@ -34,7 +37,9 @@
 #define STATSD_TYPE_SET     4
 
 struct flb_statsd {
-    char *buf;                         /* buffer */
+    int recv_batch;                    /* datagrams per receive call */
+    int rcvbuf;                        /* socket receive buffer size */
+    struct flb_net_dgram_batch *dgram; /* receive buffers */
     char listen[256];                  /* listening address (RFC-2181) */
     char port[6];                      /* listening port (RFC-793) */
     flb_sockfd_t server_fd;            /* server socket */
@@ -193,31 +198,39 @@ static int statsd_process_line(msgpack_packer *mp_pck, char *line)
 static int cb_statsd_receive(struct flb_input_instance *i_ins,
                              struct flb_config *config, void *data)
 {
-    struct flb_statsd *ctx = data;
+    int i;
+    int ret;
     char *line;
-    int len;
+    struct flb_statsd *ctx = data;
     msgpack_packer mp_pck;
     msgpack_sbuffer mp_sbuf;
 
-    /* Receive a UDP datagram */
-    len = recv(ctx->server_fd, ctx->buf, MAX_PACKET_SIZE - 1, 0);
-    if (len < 0) {
-        flb_errno();
-        return -1;
+    /* Receive a batch of UDP datagrams */
+    ret = flb_net_dgram_recv(ctx->server_fd, ctx->dgram);
+    if (ret <= 0) {
+        return ret;
+    }
+
+#ifdef FLB_HAVE_METRICS
+    if (ctx->dgram->drops > 0 && i_ins->metrics) {
+        flb_metrics_sum(FLB_METRIC_N_KERNEL_DROPS, ctx->dgram->drops,
+                        i_ins->metrics);
     }
-    ctx->buf[len] = '\0';
+#endif
 
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
-    /* Process all messages in buffer */
-    line = strtok(ctx->buf, "\n");
-    while (line) {
-        flb_trace("[in_statsd] received a line: '%s'", line);
-        if (statsd_process_line(&mp_pck, line) < 0) {
-            flb_error("[in_statsd] failed to process line: '%s'", line);
+    /* Process all messages in every datagram */
+    for (i = 0; i < ctx->dgram->count; i++) {
+        line = strtok(flb_net_dgram_data(ctx->dgram, i), "\n");
+        while (line) {
+            flb_trace("[in_statsd] received a line: '%s'", line);
+            if (statsd_process_line(&mp_pck, line) < 0) {
+                flb_error("[in_statsd] failed to process line: '%s'", line);
+            }
+            line = strtok(NULL, "\n");
         }
-        line = strtok(NULL, "\n");
     }
 
     /* Send to output */
@@ -232,23 +245,31 @@ static int cb_statsd_receive(struct flb_input_instance *i_ins,
 static int cb_statsd_init(struct flb_input_instance *i_ins,
                           struct flb_config *config, void *data)
 {
-    struct flb_statsd *ctx;
-    char *listen;
+    int ret;
     int port;
+    char *listen;
+    const char *tmp;
+    struct flb_statsd *ctx;
 
     ctx = flb_calloc(1, sizeof(struct flb_statsd));
     if (!ctx) {
         flb_errno();
         return -1;
     }
+    ctx->i_ins = i_ins;
 
-    ctx->buf = flb_malloc(MAX_PACKET_SIZE);
-    if (!ctx->buf) {
-        flb_errno();
-        flb_free(ctx);
-        return -1;
+    /* Datagrams per receive call */
+    ctx->recv_batch = FLB_NET_DGRAM_BATCH;
+    tmp = flb_input_get_property("receive_batch", i_ins);
+    if (tmp) {
+        ctx->recv_batch = atoi(tmp);
+    }
+
+    /* Socket receive buffer size */
+    tmp = flb_input_get_property("receive_buffer_size", i_ins);
+    if (tmp) {
+        ctx->rcvbuf = flb_utils_size_to_bytes(tmp);
     }
-    ctx->i_ins = i_ins;
 
     /* Listening address */
     if (i_ins->host.listen) {
@@ -275,18 +296,40 @@ static int cb_statsd_init(struct flb_input_instance *i_ins,
     ctx->server_fd = flb_net_server_udp(ctx->port, ctx->listen);
     if (ctx->server_fd == -1) {
         flb_error("[in_statsd] can't bind to %s:%s", ctx->listen, ctx->port);
-        flb_free(ctx->buf);
         flb_free(ctx);
         return -1;
     }
 
+    if (ctx->rcvbuf > 0) {
+        ret = flb_net_socket_rcvbuf(ctx->server_fd, ctx->rcvbuf);
+        if (ret != -1 && ret < ctx->rcvbuf) {
+            flb_warn("[in_statsd] receive buffer size capped to %i bytes, "
+                     "check net.core.rmem_max", ret);
+        }
+    }
+
+    ctx->dgram = flb_net_dgram_batch_create(ctx->server_fd, ctx->recv_batch,
+                                            MAX_PACKET_SIZE);
+    if (!ctx->dgram) {
+        flb_socket_close(ctx->server_fd);
+        flb_free(ctx);
+        return -1;
+    }
+
+#ifdef FLB_HAVE_METRICS
+    if (i_ins->metrics) {
+        flb_metrics_add(FLB_METRIC_N_KERNEL_DROPS, "kernel_drops",
+                        i_ins->metrics);
+    }
+#endif
+
     /* Set up the UDP connection callback */
     ctx->coll_fd = flb_input_set_collector_socket(i_ins, cb_statsd_receive,
                                                   ctx->server_fd, config);
     if (ctx->coll_fd == -1) {
         flb_error("[in_statsd] cannot set up connection callback ");
         flb_socket_close(ctx->server_fd);
-        flb_free(ctx->buf);
+        flb_net_dgram_batch_destroy(ctx->dgram);
         flb_free(ctx);
         return -1;
     }
@@ -314,7 +357,7 @@ static int cb_statsd_exit(void *data, struct flb_config *config)
 
     flb_input_collector_pause(ctx->coll_fd, ctx->i_ins);
     flb_socket_close(ctx->server_fd);
-    flb_free(ctx->buf);
+    flb_net_dgram_batch_destroy(ctx->dgram);
     flb_free(ctx);
     return 0;
 }
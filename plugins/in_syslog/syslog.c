@@ -29,6 +29,8 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_metrics.h>
+#include <fluent-bit/flb_parser.h>
 
 #include "syslog.h"
 #include "syslog_conf.h"
@@ -53,7 +55,7 @@ static int in_syslog_collect_tcp(struct flb_input_instance *i_ins,
     }
 
     flb_trace("[in_syslog] new Unix connection arrived FD=%i", fd);
-    conn = syslog_conn_add(fd, ctx);
+    conn = syslog_conn_add(fd, ctx, NULL);
     if (!conn) {
         return -1;
     }
@@ -61,31 +63,134 @@ static int in_syslog_collect_tcp(struct flb_input_instance *i_ins,
     return 0;
 }
 
+/* New connection on a listener thread */
+static int in_syslog_accept(flb_sockfd_t fd, struct flb_input_listener *lst,
+                            void *data)
+{
+    struct syslog_conn *conn;
+
+    conn = syslog_conn_add(fd, data, lst);
+    if (!conn) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Records packed by the listener threads are ready */
+static int in_syslog_collect_listeners(struct flb_input_instance *i_ins,
+                                       struct flb_config *config,
+                                       void *in_context)
+{
+    struct flb_syslog *ctx = in_context;
+
+    flb_input_listeners_collect(ctx->listeners);
+    return 0;
+}
+
+static void in_syslog_listeners_exit(struct flb_syslog *ctx)
+{
+    int i;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_list *l_head;
+    struct syslog_conn *conn;
+    struct flb_input_listener *lst;
+
+    flb_input_listeners_stop(ctx->listeners);
+
+    mk_list_foreach(l_head, &ctx->listeners->listeners) {
+        lst = mk_list_entry(l_head, struct flb_input_listener, _head);
+        mk_list_foreach_safe(head, tmp, &lst->connections) {
+            conn = mk_list_entry(head, struct syslog_conn, _head);
+            syslog_conn_del(conn);
+        }
+    }
+
+    flb_input_listeners_destroy(ctx->listeners);
+    ctx->listeners = NULL;
+
+    if (ctx->parsers) {
+        for (i = 0; i < ctx->workers; i++) {
+            if (ctx->parsers[i]) {
+                flb_parser_destroy(ctx->parsers[i]);
+            }
+        }
+        flb_free(ctx->parsers);
+        ctx->parsers = NULL;
+    }
+}
+
+static int in_syslog_listeners_init(struct flb_syslog *ctx,
+                                    struct flb_config *config)
+{
+    int i;
+    int ret;
+
+    ctx->listeners = flb_input_listeners_create(ctx->i_ins,
+                                                ctx->listen, ctx->port,
+                                                ctx->workers, in_syslog_accept,
+                                                ctx, config);
+    if (!ctx->listeners) {
+        flb_error("[in_syslog] could not bind address %s:%s. Aborting",
+                  ctx->listen, ctx->port);
+        return -1;
+    }
+
+    /*
+     * The parser decoders use a scratch buffer, every listener thread
+     * needs its own copy of the parser.
+     */
+    ctx->parsers = flb_calloc(ctx->workers, sizeof(struct flb_parser *));
+    if (!ctx->parsers) {
+        flb_errno();
+        in_syslog_listeners_exit(ctx);
+        return -1;
+    }
+    for (i = 0; i < ctx->workers; i++) {
+        ctx->parsers[i] = flb_parser_dup(ctx->parser);
+        if (!ctx->parsers[i]) {
+            in_syslog_listeners_exit(ctx);
+            return -1;
+        }
+    }
+
+    ret = flb_input_listeners_start(ctx->listeners,
+                                    in_syslog_collect_listeners);
+    if (ret == -1) {
+        flb_error("[in_syslog] could not start listeners");
+        in_syslog_listeners_exit(ctx);
+        return -1;
+    }
+
+    flb_info("[in_syslog] TCP server binding %s:%s (%i workers)",
+             ctx->listen, ctx->port, ctx->workers);
+    return 0;
+}
+
 /*
- * Collect a datagram, per Syslog specification a datagram contains only
- * one syslog message and it should not exceed 1KB.
+ * Collect a batch of datagrams, per Syslog specification a datagram
+ * contains only one syslog message and it should not exceed 1KB.
  */
 static int in_syslog_collect_udp(struct flb_input_instance *i_ins,
                                  struct flb_config *config,
                                  void *in_context)
 {
-    int bytes;
+    int ret;
     struct flb_syslog *ctx = in_context;
-    (void) i_ins;
 
-    bytes = recvfrom(ctx->server_fd,
-                     ctx->buffer_data, ctx->buffer_size - 1, 0,
-                     NULL, NULL);
-    if (bytes > 0) {
-        ctx->buffer_data[bytes] = '\0';
-        ctx->buffer_len = bytes;
-        syslog_prot_process_udp(ctx->buffer_data, ctx->buffer_len, ctx);
+    ret = flb_net_dgram_recv(ctx->server_fd, ctx->dgram);
+    if (ret <= 0) {
+        return 0;
     }
-    else {
-        flb_errno();
+
+#ifdef FLB_HAVE_METRICS
+    if (ctx->dgram->drops > 0 && i_ins->metrics) {
+        flb_metrics_sum(FLB_METRIC_N_KERNEL_DROPS, ctx->dgram->drops,
+                        i_ins->metrics);
     }
-    ctx->buffer_len = 0;
+#endif
 
+    syslog_prot_process_udp(ctx->dgram, ctx);
     return 0;
 }
 
@@ -110,6 +215,17 @@ static int in_syslog_init(struct flb_input_instance *in,
         return -1;
     }
 
+    /* TCP listener threads */
+    if (ctx->mode == FLB_SYSLOG_TCP && ctx->workers > 0) {
+        flb_input_set_context(in, ctx);
+        ret = in_syslog_listeners_init(ctx, config);
+        if (ret == -1) {
+            syslog_conf_destroy(ctx);
+            return -1;
+        }
+        return 0;
+    }
+
     /* Create Unix Socket */
     ret = syslog_server_create(ctx);
     if (ret == -1) {
@@ -120,6 +236,13 @@ static int in_syslog_init(struct flb_input_instance *in,
     /* Set context */
     flb_input_set_context(in, ctx);
 
+#ifdef FLB_HAVE_METRICS
+    if (ctx->dgram && in->metrics) {
+        flb_metrics_add(FLB_METRIC_N_KERNEL_DROPS, "kernel_drops",
+                        in->metrics);
+    }
+#endif
+
     /* Collect events for every opened connection to our socket */
     if (ctx->mode == FLB_SYSLOG_UNIX_TCP ||
         ctx->mode == FLB_SYSLOG_TCP) {
@@ -148,6 +271,10 @@ static int in_syslog_exit(void *data, struct flb_config *config)
     struct flb_syslog *ctx = data;
     (void) config;
 
+    if (ctx->listeners) {
+        in_syslog_listeners_exit(ctx);
+    }
+
     syslog_conn_exit(ctx);
     syslog_conf_destroy(ctx);
 
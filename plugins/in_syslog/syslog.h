@@ -23,6 +23,8 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_listener.h>
+#include <fluent-bit/flb_net_dgram.h>
 
 /* Syslog modes */
 #define FLB_SYSLOG_UNIX_TCP  1
@@ -47,10 +49,10 @@ struct flb_syslog {
     char *unix_path;
     unsigned int unix_perm;
 
-    /* UDP buffer, data length and buffer size */
-    char *buffer_data;
-    size_t buffer_len;
-    size_t buffer_size;
+    /* UDP receive buffers */
+    int recv_batch;
+    int rcvbuf;
+    struct flb_net_dgram_batch *dgram;
 
     /* Buffers setup */
     size_t buffer_max_size;
@@ -59,6 +61,11 @@ struct flb_syslog {
     /* Configuration */
     struct flb_parser *parser;
 
+    /* TCP listener threads (SO_REUSEPORT) */
+    int workers;
+    struct flb_input_listeners *listeners;
+    struct flb_parser **parsers;           /* parser copy of each listener */
+
     /* List for connections and event loop */
     struct mk_list connections;
     struct mk_event_loop *evl;
@@ -44,7 +44,7 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
     }
     ctx->evl = config->evl;
     ctx->i_ins = i_ins;
-    ctx->buffer_data = NULL;
+    ctx->server_fd = -1;
     mk_list_init(&ctx->connections);
 
     /* Syslog mode: unix_udp, unix_tcp, tcp or udp */
@@ -98,6 +98,14 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
         }
     }
 
+    /* Number of listener threads, TCP mode only */
+    if (ctx->mode == FLB_SYSLOG_TCP) {
+        tmp = flb_input_get_property("workers", i_ins);
+        if (tmp) {
+            ctx->workers = atoi(tmp);
+        }
+    }
+
     /* Unix socket path and permission */
     if (ctx->mode == FLB_SYSLOG_UNIX_UDP || ctx->mode == FLB_SYSLOG_UNIX_TCP) {
         tmp = flb_input_get_property("path", i_ins);
@@ -131,6 +139,20 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
         ctx->buffer_max_size  = flb_utils_size_to_bytes(tmp);
     }
 
+    /* UDP: datagrams per receive call and socket receive buffer size */
+    if (ctx->mode == FLB_SYSLOG_UDP || ctx->mode == FLB_SYSLOG_UNIX_UDP) {
+        ctx->recv_batch = FLB_NET_DGRAM_BATCH;
+        tmp = flb_input_get_property("receive_batch", i_ins);
+        if (tmp) {
+            ctx->recv_batch = atoi(tmp);
+        }
+
+        tmp = flb_input_get_property("receive_buffer_size", i_ins);
+        if (tmp) {
+            ctx->rcvbuf = flb_utils_size_to_bytes(tmp);
+        }
+    }
+
     /* Parser */
     tmp = flb_input_get_property("parser", i_ins);
     if (tmp) {
@@ -156,9 +178,9 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
 
 int syslog_conf_destroy(struct flb_syslog *ctx)
 {
-    if (ctx->buffer_data) {
-        flb_free(ctx->buffer_data);
-        ctx->buffer_data = NULL;
+    if (ctx->dgram) {
+        flb_net_dgram_batch_destroy(ctx->dgram);
+        ctx->dgram = NULL;
     }
     syslog_server_destroy(ctx);
     flb_free(ctx);
@@ -94,7 +94,8 @@ int syslog_conn_event(void *data)
 }
 
 /* Create a new mqtt request instance */
-struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
+struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx,
+                                    struct flb_input_listener *lst)
 {
     int ret;
     struct syslog_conn *conn;
@@ -118,6 +119,14 @@ struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
     conn->buf_len = 0;
     conn->buf_parsed = 0;
     conn->in      = ctx->i_ins;
+    conn->lst     = lst;
+
+    if (lst) {
+        conn->evl = lst->evl;
+    }
+    else {
+        conn->evl = ctx->evl;
+    }
 
     /* Allocate read buffer */
     conn->buf_data = flb_malloc(ctx->buffer_chunk_size);
@@ -130,7 +139,7 @@ struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
     conn->buf_size = ctx->buffer_chunk_size;
 
     /* Register instance into the event loop */
-    ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
+    ret = mk_event_add(conn->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
     if (ret == -1) {
         flb_error("[in_fw] could not register new connection");
         close(fd);
@@ -139,7 +148,12 @@ struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
         return NULL;
     }
 
-    mk_list_add(&conn->_head, &ctx->connections);
+    if (lst) {
+        mk_list_add(&conn->_head, &lst->connections);
+    }
+    else {
+        mk_list_add(&conn->_head, &ctx->connections);
+    }
 
     return conn;
 }
@@ -147,7 +161,7 @@ struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
 int syslog_conn_del(struct syslog_conn *conn)
 {
     /* Unregister the file descriptior from the event-loop */
-    mk_event_del(conn->ctx->evl, &conn->event);
+    mk_event_del(conn->evl, &conn->event);
 
     /* Release resources */
     mk_list_del(&conn->_head);
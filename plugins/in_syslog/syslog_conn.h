@@ -39,12 +39,15 @@ struct syslog_conn {
     size_t buf_parsed;               /* Parsed buffer (offset)            */
     struct flb_input_instance *in;   /* Parent plugin instance            */
     struct flb_syslog *ctx;          /* Plugin configuration context      */
+    struct mk_event_loop *evl;       /* Event loop of the connection      */
+    struct flb_input_listener *lst;  /* Listener thread, if any           */
 
     struct mk_list _head;
 };
 
 int syslog_conn_event(void *data);
-struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx);
+struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx,
+                                    struct flb_input_listener *lst);
 int syslog_conn_del(struct syslog_conn *conn);
 int syslog_conn_exit(struct flb_syslog *ctx);
 
@@ -32,7 +32,17 @@ static inline void consume_bytes(char *buf, int bytes, int length)
     memmove(buf, buf + bytes, length - bytes);
 }
 
-static inline int pack_line(struct flb_syslog *ctx,
+static inline void pack_record(msgpack_packer *mp_pck,
+                               msgpack_sbuffer *mp_sbuf,
+                               struct flb_time *time,
+                               char *data, size_t data_size)
+{
+    msgpack_pack_array(mp_pck, 2);
+    flb_time_append_to_msgpack(time, mp_pck, 0);
+    msgpack_sbuffer_write(mp_sbuf, data, data_size);
+}
+
+static inline int pack_line(struct flb_syslog *ctx, struct syslog_conn *conn,
                             struct flb_time *time, char *data, size_t data_size)
 {
     msgpack_packer mp_pck;
@@ -42,11 +52,17 @@ static inline int pack_line(struct flb_syslog *ctx,
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
-    msgpack_pack_array(&mp_pck, 2);
-    flb_time_append_to_msgpack(time, &mp_pck, 0);
-    msgpack_sbuffer_write(&mp_sbuf, data, data_size);
+    pack_record(&mp_pck, &mp_sbuf, time, data, data_size);
 
-    flb_input_chunk_append_raw(ctx->i_ins, NULL, 0, mp_sbuf.data, mp_sbuf.size);
+    /* Connections owned by a listener thread go through its queue */
+    if (conn && conn->lst) {
+        flb_input_listener_append(conn->lst, NULL, 0,
+                                  mp_sbuf.data, mp_sbuf.size);
+    }
+    else {
+        flb_input_chunk_append_raw(ctx->i_ins, NULL, 0,
+                                   mp_sbuf.data, mp_sbuf.size);
+    }
     msgpack_sbuffer_destroy(&mp_sbuf);
 
     return 0;
@@ -62,8 +78,17 @@ int syslog_prot_process(struct syslog_conn *conn)
     void *out_buf;
     size_t out_size;
     struct flb_time out_time;
+    struct flb_parser *parser;
     struct flb_syslog *ctx = conn->ctx;
 
+    /* Every listener thread has its own copy of the parser */
+    if (conn->lst) {
+        parser = ctx->parsers[conn->lst->id];
+    }
+    else {
+        parser = ctx->parser;
+    }
+
     eof = conn->buf_data;
     end = conn->buf_data + conn->buf_len;
 
@@ -97,10 +122,10 @@ int syslog_prot_process(struct syslog_conn *conn)
         }
 
         /* Process the string */
-        ret = flb_parser_do(ctx->parser, p, len,
+        ret = flb_parser_do(parser, p, len,
                             &out_buf, &out_size, &out_time);
         if (ret >= 0) {
-            pack_line(ctx, &out_time, out_buf, out_size);
+            pack_line(ctx, conn, &out_time, out_buf, out_size);
             flb_free(out_buf);
         }
         else {
@@ -122,26 +147,46 @@ int syslog_prot_process(struct syslog_conn *conn)
     return 0;
 }
 
-int syslog_prot_process_udp(char *buf, size_t size, struct flb_syslog *ctx)
+/* Parse a batch of datagrams and register all records with one append */
+int syslog_prot_process_udp(struct flb_net_dgram_batch *dgram,
+                            struct flb_syslog *ctx)
 {
+    int i;
     int ret;
+    int errors = 0;
     void *out_buf;
     size_t out_size;
-    struct flb_time out_time = {0};
+    struct flb_time out_time;
+    msgpack_packer mp_pck;
+    msgpack_sbuffer mp_sbuf;
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < dgram->count; i++) {
+        flb_time_zero(&out_time);
+        ret = flb_parser_do(ctx->parser,
+                            flb_net_dgram_data(dgram, i),
+                            flb_net_dgram_len(dgram, i),
+                            &out_buf, &out_size, &out_time);
+        if (ret < 0) {
+            flb_warn("[in_syslog] error parsing log message");
+            errors++;
+            continue;
+        }
 
-    ret = flb_parser_do(ctx->parser, buf, size,
-                        &out_buf, &out_size, &out_time);
-    if (ret >= 0) {
         if (flb_time_to_double(&out_time) == 0) {
             flb_time_get(&out_time);
         }
-        pack_line(ctx, &out_time, out_buf, out_size);
+        pack_record(&mp_pck, &mp_sbuf, &out_time, out_buf, out_size);
         flb_free(out_buf);
     }
-    else {
-        flb_warn("[in_syslog] error parsing log message");
-        return -1;
+
+    if (mp_sbuf.size > 0) {
+        flb_input_chunk_append_raw(ctx->i_ins, NULL, 0,
+                                   mp_sbuf.data, mp_sbuf.size);
     }
+    msgpack_sbuffer_destroy(&mp_sbuf);
 
-    return 0;
+    return (errors > 0) ? -1 : 0;
 }
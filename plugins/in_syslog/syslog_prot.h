@@ -26,6 +26,7 @@
 #include "syslog.h"
 
 int syslog_prot_process(struct syslog_conn *conn);
-int syslog_prot_process_udp(char *buf, size_t size, struct flb_syslog *ctx);
+int syslog_prot_process_udp(struct flb_net_dgram_batch *dgram,
+                            struct flb_syslog *ctx);
 
 #endif
@@ -109,22 +109,34 @@ static int syslog_server_net_create(struct flb_syslog *ctx)
     return 0;
 }
 
-int syslog_server_create(struct flb_syslog *ctx)
+/* Receive buffers for UDP modes, one slot of 'buffer_chunk_size' each */
+static int syslog_server_dgram_create(struct flb_syslog *ctx)
 {
     int ret;
 
-    if (ctx->mode == FLB_SYSLOG_UDP || ctx->mode == FLB_SYSLOG_UNIX_UDP) {
-        /* Create UDP buffer */
-        ctx->buffer_data = flb_calloc(1, ctx->buffer_chunk_size);
-        if (!ctx->buffer_data) {
-            flb_errno();
-            return -1;
+    if (ctx->rcvbuf > 0) {
+        ret = flb_net_socket_rcvbuf(ctx->server_fd, ctx->rcvbuf);
+        if (ret != -1 && ret < ctx->rcvbuf) {
+            flb_warn("[in_syslog] receive buffer size capped to %i bytes, "
+                     "check net.core.rmem_max", ret);
         }
-        ctx->buffer_size = ctx->buffer_chunk_size;
-        flb_info("[in_syslog] UDP buffer size set to %lu bytes",
-                 ctx->buffer_size);
     }
 
+    ctx->dgram = flb_net_dgram_batch_create(ctx->server_fd, ctx->recv_batch,
+                                            ctx->buffer_chunk_size);
+    if (!ctx->dgram) {
+        return -1;
+    }
+
+    flb_info("[in_syslog] UDP buffer size set to %lu bytes (%i datagrams "
+             "per read)", ctx->buffer_chunk_size, ctx->dgram->size);
+    return 0;
+}
+
+int syslog_server_create(struct flb_syslog *ctx)
+{
+    int ret;
+
     if (ctx->mode == FLB_SYSLOG_TCP || ctx->mode == FLB_SYSLOG_UDP) {
         ret = syslog_server_net_create(ctx);
     }
@@ -137,6 +149,13 @@ int syslog_server_create(struct flb_syslog *ctx)
         return -1;
     }
 
+    if (ctx->mode == FLB_SYSLOG_UDP || ctx->mode == FLB_SYSLOG_UNIX_UDP) {
+        ret = syslog_server_dgram_create(ctx);
+        if (ret != 0) {
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -153,7 +172,9 @@ int syslog_server_destroy(struct flb_syslog *ctx)
         flb_free(ctx->port);
     }
 
-    close(ctx->server_fd);
+    if (ctx->server_fd != -1) {
+        close(ctx->server_fd);
+    }
 
     return 0;
 }
@@ -37,8 +37,11 @@
 #include "tail_scan.h"
 #include "tail_signal.h"
 #include "tail_config.h"
+#include "tail_thread.h"
 #include "tail_dockermode.h"
 #include "tail_multiline.h"
+#include "tail_multiline_rules.h"
+#include "tail_gzip.h"
 
 static inline int consume_byte(int fd)
 {
@@ -55,21 +58,65 @@ static inline int consume_byte(int fd)
     return 0;
 }
 
+/*
+ * Files are served in round-robin: the first file of the list is taken and
+ * moved to the end, so a round that runs out of budget is continued by the
+ * next one where it stopped.
+ */
+static inline struct flb_tail_file *round_next(struct mk_list *files)
+{
+    struct flb_tail_file *file;
+
+    file = mk_list_entry_first(files, struct flb_tail_file, _head);
+    mk_list_del(&file->_head);
+    mk_list_add(&file->_head, files);
+    return file;
+}
+
+static inline int round_done(size_t budget, size_t consumed)
+{
+    return budget > 0 && consumed >= budget;
+}
+
 /* cb_collect callback */
 static int in_tail_collect_pending(struct flb_input_instance *i_ins,
                                    struct flb_config *config, void *in_context)
 {
+    int i;
+    int n;
     int ret;
     int active = 0;
-    struct mk_list *tmp;
-    struct mk_list *head;
+    off_t pending;
+    size_t consumed = 0;
     struct flb_tail_config *ctx = in_context;
+    struct mk_list *head;
     struct flb_tail_file *file;
     struct stat st;
 
+    /* Hand the files with pending bytes to the readers */
+    if (ctx->threads > 0) {
+        mk_list_foreach(head, &ctx->files_event) {
+            file = mk_list_entry(head, struct flb_tail_file, _head);
+            if (file->pending_bytes > 0 &&
+                flb_tail_thread_dispatch(file) == 0) {
+                file->pending_bytes = 0;
+            }
+        }
+        ctx->events_pending = FLB_FALSE;
+        tail_consume_pending(ctx);
+        return 0;
+    }
+
     /* Iterate promoted event files with pending bytes */
-    mk_list_foreach_safe(head, tmp, &ctx->files_event) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
+    n = mk_list_size(&ctx->files_event);
+    for (i = 0; i < n; i++) {
+        if (round_done(ctx->round_read_budget, consumed)) {
+            /* the next round continues with the remaining files */
+            active++;
+            break;
+        }
+
+        file = round_next(&ctx->files_event);
         if (file->pending_bytes <= 0) {
             continue;
         }
@@ -83,6 +130,7 @@ static int in_tail_collect_pending(struct flb_input_instance *i_ins,
         }
 
         ret = flb_tail_file_chunk(file);
+        consumed += file->last_read;
         switch (ret) {
         case FLB_TAIL_ERROR:
             /* Could not longer read the file */
@@ -94,19 +142,24 @@ static int in_tail_collect_pending(struct flb_input_instance *i_ins,
              * Adjust counter to verify if we need a further read(2) later.
              * For more details refer to tail_fs_inotify.c:96.
              */
-            if (file->offset < st.st_size) {
-                file->pending_bytes = (st.st_size - file->offset);
+            pending = flb_tail_file_pending(file, &st);
+            if (pending > 0) {
+                file->pending_bytes = pending;
                 active++;
             }
             else {
                 file->pending_bytes = 0;
             }
             break;
+        case FLB_TAIL_WAIT:
+            file->pending_bytes = 0;
+            break;
         }
     }
 
     /* If no more active files, consume pending signal so we don't get called again. */
     if (active == 0) {
+        ctx->events_pending = FLB_FALSE;
         tail_consume_pending(ctx);
     }
 
@@ -117,17 +170,51 @@ static int in_tail_collect_pending(struct flb_input_instance *i_ins,
 static int in_tail_collect_static(struct flb_input_instance *i_ins,
                                   struct flb_config *config, void *in_context)
 {
+    int i;
+    int n;
     int ret;
     int active = 0;
-    struct mk_list *tmp;
+    size_t budget;
+    size_t consumed = 0;
     struct mk_list *head;
     struct flb_tail_config *ctx = in_context;
     struct flb_tail_file *file;
 
+    /*
+     * Hand the files to the readers, each file signals the manager again
+     * when it's done and there is more to read.
+     */
+    if (ctx->threads > 0) {
+        mk_list_foreach(head, &ctx->files_static) {
+            file = mk_list_entry(head, struct flb_tail_file, _head);
+            flb_tail_thread_dispatch(file);
+        }
+        consume_byte(ctx->ch_manager[0]);
+        ctx->ch_reads++;
+        return 0;
+    }
+
+    /*
+     * Static files are catching up with their content, if requested they
+     * only get a single file budget while new data of event files waits.
+     */
+    budget = ctx->round_read_budget;
+    if (ctx->new_data_first == FLB_TRUE && ctx->events_pending == FLB_TRUE) {
+        budget = ctx->file_read_budget;
+    }
+
     /* Do a data chunk collection for each file */
-    mk_list_foreach_safe(head, tmp, &ctx->files_static) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
+    n = mk_list_size(&ctx->files_static);
+    for (i = 0; i < n; i++) {
+        if (round_done(budget, consumed)) {
+            /* the next round continues with the remaining files */
+            active++;
+            break;
+        }
+
+        file = round_next(&ctx->files_static);
         ret = flb_tail_file_chunk(file);
+        consumed += file->last_read;
         switch (ret) {
         case FLB_TAIL_ERROR:
             /* Could not longer read the file */
@@ -166,6 +253,70 @@ static int in_tail_collect_static(struct flb_input_instance *i_ins,
     return 0;
 }
 
+#ifdef FLB_HAVE_METRICS
+/* Refresh the lag metrics: bytes written to the files but not read yet */
+static int in_tail_collect_lag(struct flb_input_instance *i_ins,
+                               struct flb_config *config, void *in_context)
+{
+    int i;
+    int ret;
+    off_t lag;
+    off_t lag_total = 0;
+    off_t lag_max = 0;
+    struct mk_list *head;
+    struct mk_list *lists[2];
+    struct flb_metric *metric;
+    struct flb_tail_config *ctx = in_context;
+    struct flb_tail_file *file;
+    struct stat st;
+
+    lists[0] = &ctx->files_static;
+    lists[1] = &ctx->files_event;
+    for (i = 0; i < 2; i++) {
+        mk_list_foreach(head, lists[i]) {
+            file = mk_list_entry(head, struct flb_tail_file, _head);
+            ret = fstat(file->fd, &st);
+            if (ret == -1) {
+                continue;
+            }
+
+            /*
+             * The read position and the buffer of a file being read belong
+             * to its reader, use the position it had when it was handed.
+             * The buffer of a compressed file has inflated content.
+             */
+            if (file->thread_busy == FLB_TRUE) {
+                lag = st.st_size - file->thread_pos;
+            }
+            else {
+                lag = flb_tail_file_pending(file, &st);
+                if (!file->gz) {
+                    lag -= file->buf_len;
+                }
+            }
+            if (lag < 0) {
+                lag = 0;
+            }
+            lag_total += lag;
+            if (lag > lag_max) {
+                lag_max = lag;
+            }
+        }
+    }
+
+    metric = flb_metrics_get_id(FLB_TAIL_METRIC_LAG, i_ins->metrics);
+    if (metric) {
+        metric->val = lag_total;
+    }
+    metric = flb_metrics_get_id(FLB_TAIL_METRIC_LAG_MAX, i_ins->metrics);
+    if (metric) {
+        metric->val = lag_max;
+    }
+
+    return 0;
+}
+#endif
+
 int in_tail_collect_event(void *file, struct flb_config *config)
 {
     int ret;
@@ -173,6 +324,11 @@ int in_tail_collect_event(void *file, struct flb_config *config)
 
     flb_debug("[in_tail] file=%s event", f->name);
 
+    if (f->config->threads > 0) {
+        flb_tail_thread_dispatch(f);
+        return 0;
+    }
+
     ret = flb_tail_file_chunk(f);
     switch (ret) {
     case FLB_TAIL_ERROR:
@@ -255,12 +411,29 @@ static int in_tail_init(struct flb_input_instance *in,
     ctx->coll_fd_pending = ret;
 
 
-    if (ctx->multiline == FLB_TRUE && ctx->parser) {
+    /* With multiline rules the parser runs over the joined records */
+    if (ctx->multiline == FLB_TRUE && !ctx->mult_rules && ctx->parser) {
         ctx->parser = NULL;
         flb_warn("[in_tail] on multiline mode 'Parser' is not allowed "
                  "(parser disabled)");
     }
 
+    /* Reader threads */
+    if (ctx->threads > 0 &&
+        (ctx->multiline == FLB_TRUE || ctx->docker_mode == FLB_TRUE)) {
+        ctx->threads = 0;
+        flb_warn("[in_tail] 'Threads' is not supported in multiline or "
+                 "docker mode (files are read by the engine)");
+    }
+    if (ctx->threads > 0) {
+        ret = flb_tail_threads_create(ctx, config);
+        if (ret == -1) {
+            ctx->threads = 0;
+            flb_tail_config_destroy(ctx);
+            return -1;
+        }
+    }
+
     /* Register callback to process docker mode queued buffer */
     if (ctx->docker_mode == FLB_TRUE) {
         ret = flb_input_set_collector_time(in, flb_tail_dmode_pending_flush,
@@ -277,7 +450,10 @@ static int in_tail_init(struct flb_input_instance *in,
 #ifdef FLB_HAVE_PARSER
     /* Register callback to process multiline queued buffer */
     if (ctx->multiline == FLB_TRUE) {
-        ret = flb_input_set_collector_time(in, flb_tail_mult_pending_flush,
+        ret = flb_input_set_collector_time(in,
+                                           ctx->mult_rules ?
+                                           flb_tail_mult_rules_pending_flush :
+                                           flb_tail_mult_pending_flush,
                                            ctx->multiline_flush, 0,
                                            config);
         if (ret == -1) {
@@ -289,6 +465,31 @@ static int in_tail_init(struct flb_input_instance *in,
     }
 #endif
 
+#ifdef FLB_HAVE_METRICS
+    /* Register callback to refresh the lag metrics */
+    ret = flb_input_set_collector_time(in, in_tail_collect_lag,
+                                       1, 0, config);
+    if (ret == -1) {
+        flb_tail_config_destroy(ctx);
+        return -1;
+    }
+    ctx->coll_fd_lag = ret;
+#endif
+
+#ifdef FLB_HAVE_SQLDB
+    /* Register callback to write the pending offsets to the database */
+    if (ctx->db && ctx->db_sync_interval > 0) {
+        ret = flb_input_set_collector_time(in, flb_tail_db_sync_callback,
+                                           ctx->db_sync_interval, 0,
+                                           config);
+        if (ret == -1) {
+            flb_tail_config_destroy(ctx);
+            return -1;
+        }
+        ctx->coll_fd_db_sync = ret;
+    }
+#endif
+
     return 0;
 }
 
@@ -311,7 +512,20 @@ static int in_tail_exit(void *data, struct flb_config *config)
         flb_utils_split_free(ctx->exclude_list);
     }
 
+    /* Readers must be gone before the files are released */
+    if (ctx->threads > 0) {
+        flb_tail_threads_destroy(ctx);
+    }
+
+#ifdef FLB_HAVE_SQLDB
+    /* Write the pending offsets at once before the files are released */
+    if (ctx->db) {
+        flb_tail_db_sync(ctx);
+    }
+#endif
+
     flb_tail_file_remove_all(ctx);
+    flb_tail_fs_exit(ctx);
     flb_tail_config_destroy(ctx);
 
     return 0;
@@ -329,6 +543,11 @@ static void in_tail_pause(void *data, struct flb_config *config)
     flb_input_collector_pause(ctx->coll_fd_static, ctx->i_ins);
     flb_input_collector_pause(ctx->coll_fd_pending, ctx->i_ins);
 
+    /* Readers stop once their queues are full */
+    if (ctx->threads > 0) {
+        flb_input_collector_pause(ctx->coll_fd_threads, ctx->i_ins);
+    }
+
     if (ctx->docker_mode == FLB_TRUE) {
         flb_input_collector_pause(ctx->coll_fd_dmode_flush, ctx->i_ins);
     }
@@ -348,6 +567,10 @@ static void in_tail_resume(void *data, struct flb_config *config)
     flb_input_collector_resume(ctx->coll_fd_static, ctx->i_ins);
     flb_input_collector_resume(ctx->coll_fd_pending, ctx->i_ins);
 
+    if (ctx->threads > 0) {
+        flb_input_collector_resume(ctx->coll_fd_threads, ctx->i_ins);
+    }
+
     if (ctx->docker_mode == FLB_TRUE) {
         flb_input_collector_resume(ctx->coll_fd_dmode_flush, ctx->i_ins);
     }
@@ -38,6 +38,7 @@
 #define FLB_TAIL_CHUNK        32*1024 /* buffer chunk = 32KB            */
 #define FLB_TAIL_REFRESH      60      /* refresh every 60 seconds       */
 #define FLB_TAIL_ROTATE_WAIT  5       /* time to monitor after rotation */
+#define FLB_TAIL_ROUND_BUDGET 1024*1024 /* bytes read per collection round */
 
 int in_tail_collect_event(void *file, struct flb_config *config);
 
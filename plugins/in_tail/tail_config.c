@@ -32,6 +32,7 @@
 #include "tail_config.h"
 #include "tail_scan.h"
 #include "tail_dockermode.h"
+#include "tail_thread.h"
 
 #ifdef FLB_HAVE_PARSER
 #include "tail_multiline.h"
@@ -56,8 +57,10 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
     ctx->i_ins = i_ins;
     ctx->ignore_older = 0;
     ctx->skip_long_lines = FLB_FALSE;
+    ctx->decompress = FLB_TRUE;
 #ifdef FLB_HAVE_SQLDB
     ctx->db_sync = -1;
+    ctx->db_sync_interval = 1;
 #endif
 
     /* Create the channel manager */
@@ -163,11 +166,20 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         ret = flb_utils_bool(tmp);
         if (ret == FLB_TRUE) {
             ctx->multiline = FLB_TRUE;
-            ret = flb_tail_mult_create(ctx, i_ins, config);
-            if (ret == -1) {
-                flb_tail_config_destroy(ctx);
-                return NULL;
-            }
+        }
+    }
+
+    /* Multiline rules enable the multiline mode on their own */
+    if (flb_input_get_property("multiline_rules", i_ins) ||
+        flb_input_get_property("multiline_rule", i_ins)) {
+        ctx->multiline = FLB_TRUE;
+    }
+
+    if (ctx->multiline == FLB_TRUE) {
+        ret = flb_tail_mult_create(ctx, i_ins, config);
+        if (ret == -1) {
+            flb_tail_config_destroy(ctx);
+            return NULL;
         }
     }
 #endif
@@ -233,12 +245,53 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         ctx->buf_max_size = FLB_TAIL_CHUNK;
     }
 
+    /* Config: bytes read from a file before serving the next one */
+    ctx->file_read_budget = ctx->buf_chunk_size;
+    tmp = flb_input_get_property("file_read_budget", i_ins);
+    if (tmp) {
+        bytes = flb_utils_size_to_bytes(tmp);
+        if (bytes > 0) {
+            ctx->file_read_budget = (size_t) bytes;
+        }
+    }
+
+    /* Config: bytes read from all files in a collection round, 0: no limit */
+    ctx->round_read_budget = FLB_TAIL_ROUND_BUDGET;
+    tmp = flb_input_get_property("round_read_budget", i_ins);
+    if (tmp) {
+        bytes = flb_utils_size_to_bytes(tmp);
+        if (bytes >= 0) {
+            ctx->round_read_budget = (size_t) bytes;
+        }
+    }
+
+    /* Config: prioritize new data over catch-up reads */
+    tmp = flb_input_get_property("new_data_first", i_ins);
+    if (tmp) {
+        ctx->new_data_first = flb_utils_bool(tmp);
+    }
+
+    /* Config: number of reader threads, 0 reads in the engine thread */
+    tmp = flb_input_get_property("threads", i_ins);
+    if (tmp) {
+        ctx->threads = atoi(tmp);
+        if (ctx->threads < 0) {
+            ctx->threads = 0;
+        }
+    }
+
     /* Config: skip long lines */
     tmp = flb_input_get_property("skip_long_lines", i_ins);
     if (tmp) {
         ctx->skip_long_lines = flb_utils_bool(tmp);
     }
 
+    /* Config: read gzip compressed files, e.g: rotated by logrotate */
+    tmp = flb_input_get_property("decompress", i_ins);
+    if (tmp) {
+        ctx->decompress = flb_utils_bool(tmp);
+    }
+
     /* Config: Exit on EOF (for testing) */
     tmp = flb_input_get_property("exit_on_eof", i_ins);
     if (tmp) {
@@ -266,6 +319,20 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
     mk_list_init(&ctx->files_static);
     mk_list_init(&ctx->files_event);
     mk_list_init(&ctx->files_rotated);
+    mk_list_init(&ctx->threads_list);
+    msgpack_sbuffer_init(&ctx->mp_sbuf);
+    msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
+
+    ctx->hash_names = flb_hash_create(FLB_HASH_EVICT_NONE,
+                                      FLB_TAIL_HASH_SIZE, 0);
+    ctx->hash_inodes = flb_hash_create(FLB_HASH_EVICT_NONE,
+                                       FLB_TAIL_HASH_SIZE, 0);
+    if (!ctx->hash_names || !ctx->hash_inodes) {
+        flb_error("[in_tail] could not create files index");
+        flb_tail_config_destroy(ctx);
+        return NULL;
+    }
+
 #ifdef FLB_HAVE_SQLDB
     ctx->db = NULL;
 #endif
@@ -313,6 +380,16 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         }
     }
 
+    /* Offsets are written to the database every 'db.sync_interval' seconds */
+    tmp = flb_input_get_property("db.sync_interval", i_ins);
+    if (tmp) {
+        ctx->db_sync_interval = atoi(tmp);
+        if (ctx->db_sync_interval < 0) {
+            flb_error("[in_tail] invalid 'db.sync_interval' value");
+            ctx->db_sync_interval = 1;
+        }
+    }
+
     /* Initialize database */
     tmp = flb_input_get_property("db", i_ins);
     if (tmp) {
@@ -330,6 +407,10 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
                     "files_closed", ctx->i_ins->metrics);
     flb_metrics_add(FLB_TAIL_METRIC_F_ROTATED,
                     "files_rotated", ctx->i_ins->metrics);
+    flb_metrics_add(FLB_TAIL_METRIC_LAG,
+                    "lag_bytes", ctx->i_ins->metrics);
+    flb_metrics_add(FLB_TAIL_METRIC_LAG_MAX,
+                    "lag_max_bytes", ctx->i_ins->metrics);
 #endif
 
     return ctx;
@@ -337,6 +418,10 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
 
 int flb_tail_config_destroy(struct flb_tail_config *config)
 {
+    /* Initialization failed after the readers were started */
+    if (config->threads_running == FLB_TRUE) {
+        flb_tail_threads_destroy(config);
+    }
 
 #ifdef FLB_HAVE_PARSER
     flb_tail_mult_destroy(config);
@@ -356,13 +441,24 @@ int flb_tail_config_destroy(struct flb_tail_config *config)
 
 #ifdef FLB_HAVE_SQLDB
     if (config->db != NULL) {
-        flb_tail_db_close(config->db);
+        flb_tail_db_close(config->db, config);
     }
 #endif
 
+    if (config->hash_names) {
+        flb_hash_destroy(config->hash_names);
+    }
+    if (config->hash_inodes) {
+        flb_hash_destroy(config->hash_inodes);
+    }
+    if (config->scan_excluded) {
+        flb_hash_destroy(config->scan_excluded);
+    }
+
     if (config->key != NULL) {
         flb_free(config->key);
     }
+    msgpack_sbuffer_destroy(&config->mp_sbuf);
     flb_free(config);
     return 0;
 }
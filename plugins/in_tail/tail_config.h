@@ -25,19 +25,38 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_pipe.h>
 #ifdef FLB_HAVE_REGEX
 #include <fluent-bit/flb_regex.h>
 #endif
+#ifdef FLB_HAVE_SQLDB
+#include <fluent-bit/flb_sqldb.h>
+#endif
+
+/* Size of the tables used to index the monitored files */
+#define FLB_TAIL_HASH_SIZE        1024
 
 /* Metrics */
 #ifdef FLB_HAVE_METRICS
 #define FLB_TAIL_METRIC_F_OPENED  100  /* number of opened files  */
 #define FLB_TAIL_METRIC_F_CLOSED  101  /* number of closed files  */
 #define FLB_TAIL_METRIC_F_ROTATED 102  /* number of rotated files */
+#define FLB_TAIL_METRIC_LAG       103  /* bytes not read yet      */
+#define FLB_TAIL_METRIC_LAG_MAX   104  /* largest lag of a file   */
 #endif
 
 struct flb_tail_config {
     int fd_notify;             /* inotify fd               */
+#ifdef FLB_HAVE_INOTIFY
+    flb_sds_t *dir_comps;      /* path pattern components  */
+    int dir_comps_n;
+    int dir_level;             /* component of 'dir_root'  */
+    flb_sds_t dir_root;        /* deepest fixed directory  */
+    struct flb_hash *dir_watches; /* watched dirs by wd    */
+    struct mk_list dir_list;
+#endif
 #ifdef _WIN32
     intptr_t ch_manager[2];    /* pipe: channel manager    */
     intptr_t ch_pending[2];    /* pipe: pending events     */
@@ -52,6 +71,12 @@ struct flb_tail_config {
     size_t buf_chunk_size;     /* allocation chunks        */
     size_t buf_max_size;       /* max size of a buffer     */
 
+    /* Read budgets */
+    size_t file_read_budget;   /* bytes read from a file per round   */
+    size_t round_read_budget;  /* bytes read from all files per round */
+    int new_data_first;        /* catch-up reads wait for new data   */
+    int events_pending;        /* event files have pending bytes ?   */
+
     /* Collectors */
     int coll_fd_static;
     int coll_fd_scan;
@@ -59,6 +84,9 @@ struct flb_tail_config {
     int coll_fd_pending;
     int coll_fd_dmode_flush;
     int coll_fd_mult_flush;
+    int coll_fd_db_sync;
+    int coll_fd_lag;
+    int coll_fd_threads;
 
     /* Backend collectors */
     int coll_fd_fs1;           /* used by fs_inotify & fs_stat */
@@ -82,11 +110,21 @@ struct flb_tail_config {
     int   key_len;             /* length of key ^              */
     int   skip_long_lines;     /* skip long lines              */
     int   exit_on_eof;         /* exit fluent-bit on EOF, test */
+    int   decompress;          /* inflate gzip files ?         */
 
     /* Database */
 #ifdef FLB_HAVE_SQLDB
     struct flb_sqldb *db;
     int db_sync;
+    int db_sync_interval;      /* seconds between offsets sync */
+    sqlite3_stmt *stmt_get_file;
+    sqlite3_stmt *stmt_insert_file;
+    sqlite3_stmt *stmt_offset;
+    sqlite3_stmt *stmt_rotate_file;
+    sqlite3_stmt *stmt_delete_file;
+    sqlite3_stmt *stmt_get_gzip;
+    sqlite3_stmt *stmt_set_gzip;
+    sqlite3_stmt *stmt_delete_gzip;
 #endif
 
     /* Parser / Format */
@@ -97,6 +135,7 @@ struct flb_tail_config {
     int multiline_flush;       /* multiline flush/wait */
     struct flb_parser *mult_parser_firstline;
     struct mk_list mult_parsers;
+    struct flb_tail_mult_rules *mult_rules;  /* compiled multiline rules */
 
     /* Docker mode */
     int docker_mode;           /* Docker mode enabled ?  */
@@ -109,9 +148,27 @@ struct flb_tail_config {
     /* List of rotated files that needs to be removed after 'rotate_wait' */
     struct mk_list files_rotated;
 
+    /* Monitored files indexed by name and by device/inode */
+    struct flb_hash *hash_names;
+    struct flb_hash *hash_inodes;
+
+    /* Paths excluded by the last scan */
+    struct flb_hash *scan_excluded;
+
     /* List of shell patterns used to exclude certain file names */
     struct mk_list *exclude_list;
 
+    /* Buffer to pack the records of a file read before appending them */
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    /* Reader threads */
+    int threads;               /* number of reader threads */
+    int threads_running;
+    int threads_notified;      /* engine has a pending wake up */
+    flb_pipefd_t ch_threads[2];/* wake up the engine           */
+    struct mk_list threads_list;
+
     /* Plugin input instance */
     struct flb_input_instance *i_ins;
 };
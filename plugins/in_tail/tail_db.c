@@ -26,12 +26,44 @@
 #include "tail_db.h"
 #include "tail_sql.h"
 #include "tail_file.h"
+#include "tail_gzip.h"
 
-struct query_status {
-    int id;
-    int rows;
-    off_t offset;
-};
+/* Prepare a statement, returns -1 on error */
+static int db_prepare(struct flb_sqldb *db, const char *sql,
+                      sqlite3_stmt **stmt)
+{
+    int ret;
+
+    ret = sqlite3_prepare_v2(db->handler, sql, -1, stmt, 0);
+    if (ret != SQLITE_OK) {
+        flb_error("[in_tail:db] cannot prepare statement '%s': %s",
+                  sql, sqlite3_errmsg(db->handler));
+        *stmt = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void db_finalize(struct flb_tail_config *ctx)
+{
+    sqlite3_finalize(ctx->stmt_get_file);
+    sqlite3_finalize(ctx->stmt_insert_file);
+    sqlite3_finalize(ctx->stmt_offset);
+    sqlite3_finalize(ctx->stmt_rotate_file);
+    sqlite3_finalize(ctx->stmt_delete_file);
+    sqlite3_finalize(ctx->stmt_get_gzip);
+    sqlite3_finalize(ctx->stmt_set_gzip);
+    sqlite3_finalize(ctx->stmt_delete_gzip);
+
+    ctx->stmt_get_file = NULL;
+    ctx->stmt_insert_file = NULL;
+    ctx->stmt_offset = NULL;
+    ctx->stmt_rotate_file = NULL;
+    ctx->stmt_delete_file = NULL;
+    ctx->stmt_get_gzip = NULL;
+    ctx->stmt_set_gzip = NULL;
+    ctx->stmt_delete_gzip = NULL;
+}
 
 /* Open or create database required by tail plugin */
 struct flb_sqldb *flb_tail_db_open(const char *path,
@@ -57,6 +89,13 @@ struct flb_sqldb *flb_tail_db_open(const char *path,
         return NULL;
     }
 
+    ret = flb_sqldb_query(db, SQL_CREATE_GZIP, NULL, NULL);
+    if (ret != FLB_OK) {
+        flb_error("[in_tail:db] could not create 'gzip' table");
+        flb_sqldb_close(db);
+        return NULL;
+    }
+
     if (ctx->db_sync >= 0) {
         snprintf(tmp, sizeof(tmp) - 1, SQL_PRAGMA_SYNC,
                  ctx->db_sync);
@@ -76,81 +115,234 @@ struct flb_sqldb *flb_tail_db_open(const char *path,
         return NULL;
     }
 
+    /* Statements are parsed once and reused for every file */
+    if (db_prepare(db, SQL_GET_FILE, &ctx->stmt_get_file) == -1 ||
+        db_prepare(db, SQL_INSERT_FILE, &ctx->stmt_insert_file) == -1 ||
+        db_prepare(db, SQL_UPDATE_OFFSET, &ctx->stmt_offset) == -1 ||
+        db_prepare(db, SQL_ROTATE_FILE, &ctx->stmt_rotate_file) == -1 ||
+        db_prepare(db, SQL_DELETE_FILE, &ctx->stmt_delete_file) == -1 ||
+        db_prepare(db, SQL_GET_GZIP, &ctx->stmt_get_gzip) == -1 ||
+        db_prepare(db, SQL_SET_GZIP, &ctx->stmt_set_gzip) == -1 ||
+        db_prepare(db, SQL_DELETE_GZIP, &ctx->stmt_delete_gzip) == -1) {
+        db_finalize(ctx);
+        flb_sqldb_close(db);
+        return NULL;
+    }
+
     return db;
 }
 
-int flb_tail_db_close(struct flb_sqldb *db)
+int flb_tail_db_close(struct flb_sqldb *db, struct flb_tail_config *ctx)
 {
+    db_finalize(ctx);
     flb_sqldb_close(db);
     return 0;
 }
 
-
-static int cb_file_check(void *data, int argc, char **argv, char **cols)
+int flb_tail_db_file_set(struct flb_tail_file *file,
+                         struct flb_tail_config *ctx)
 {
-    struct query_status *qs = data;
+    int ret;
+    int64_t id;
+    off_t offset;
+    uint64_t created;
+
+    /* Check if the file exists */
+    sqlite3_bind_text(ctx->stmt_get_file, 1, file->name, -1, 0);
+    sqlite3_bind_int64(ctx->stmt_get_file, 2, file->inode);
+
+    ret = sqlite3_step(ctx->stmt_get_file);
+    if (ret == SQLITE_ROW) {
+        id = sqlite3_column_int64(ctx->stmt_get_file, 0);     /* id */
+        offset = sqlite3_column_int64(ctx->stmt_get_file, 2); /* offset */
+
+        sqlite3_clear_bindings(ctx->stmt_get_file);
+        sqlite3_reset(ctx->stmt_get_file);
+
+        file->db_id  = id;
+        file->offset = offset;
+        return 0;
+    }
+
+    sqlite3_clear_bindings(ctx->stmt_get_file);
+    sqlite3_reset(ctx->stmt_get_file);
+
+    if (ret != SQLITE_DONE) {
+        flb_error("[in_tail:db] error looking up file %s: %s",
+                  file->name, sqlite3_errmsg(ctx->db->handler));
+        return -1;
+    }
+
+    /* Register the file */
+    created = time(NULL);
+    sqlite3_bind_text(ctx->stmt_insert_file, 1, file->name, -1, 0);
+    sqlite3_bind_int64(ctx->stmt_insert_file, 2, 0);
+    sqlite3_bind_int64(ctx->stmt_insert_file, 3, file->inode);
+    sqlite3_bind_int64(ctx->stmt_insert_file, 4, created);
 
-    qs->id = atoi(argv[0]);      /* id column */
-    qs->offset = atoll(argv[2]); /* offset column */
+    ret = sqlite3_step(ctx->stmt_insert_file);
+    sqlite3_clear_bindings(ctx->stmt_insert_file);
+    sqlite3_reset(ctx->stmt_insert_file);
 
-    qs->rows++;
+    if (ret != SQLITE_DONE) {
+        flb_error("[in_tail:db] error registering file %s: %s",
+                  file->name, sqlite3_errmsg(ctx->db->handler));
+        return -1;
+    }
+
+    /* Get the database ID for this file */
+    file->db_id = flb_sqldb_last_id(ctx->db);
     return 0;
 }
 
-int flb_tail_db_file_set(struct flb_tail_file *file,
-                         struct flb_tail_config *ctx)
+/* Write the inflate checkpoint of a compressed file, or delete it */
+static int db_gz_save(struct flb_tail_file *file, struct flb_tail_config *ctx)
 {
     int ret;
-    char query[PATH_MAX];
-    struct query_status qs = {0};
-    uint64_t created;
+    sqlite3_stmt *stmt;
 
-    /* Check if the file exists */
-    snprintf(query, sizeof(query) - 1,
-             SQL_GET_FILE,
-             file->name, file->inode);
-
-    memset(&qs, '\0', sizeof(qs));
-    ret = flb_sqldb_query(ctx->db,
-                          query, cb_file_check, &qs);
-
-    if (qs.rows == 0) {
-        /* Register the file */
-        created = time(NULL);
-        snprintf(query, sizeof(query) - 1,
-                 SQL_INSERT_FILE,
-                 file->name, (uint64_t) 0, (uint64_t) file->inode, created);
-        ret = flb_sqldb_query(ctx->db, query, NULL, NULL);
-        if (ret == FLB_ERROR) {
-            return -1;
-        }
+    if (file->gz_ckpt_len > 0) {
+        stmt = ctx->stmt_set_gzip;
+        sqlite3_bind_int64(stmt, 1, file->db_id);
+        sqlite3_bind_blob(stmt, 2, file->gz_ckpt, file->gz_ckpt_len, 0);
+    }
+    else {
+        stmt = ctx->stmt_delete_gzip;
+        sqlite3_bind_int64(stmt, 1, file->db_id);
+    }
 
-        /* Get the database ID for this file */
-        file->db_id = flb_sqldb_last_id(ctx->db);
-        return 0;
+    ret = sqlite3_step(stmt);
+    sqlite3_clear_bindings(stmt);
+    sqlite3_reset(stmt);
+
+    if (ret != SQLITE_DONE) {
+        flb_error("[in_tail:db] error saving inflate status of %s: %s",
+                  file->name, sqlite3_errmsg(ctx->db->handler));
+        return -1;
     }
 
-    file->db_id  = qs.id;
-    file->offset = qs.offset;
+    file->gz_ckpt_dirty = FLB_FALSE;
     return 0;
 }
 
+/* Resume the inflate of a compressed file from its saved checkpoint */
+int flb_tail_db_gz_restore(struct flb_tail_file *file,
+                           struct flb_tail_config *ctx)
+{
+    int ret = -1;
+    int size;
+    const void *data;
+
+    sqlite3_bind_int64(ctx->stmt_get_gzip, 1, file->db_id);
+    if (sqlite3_step(ctx->stmt_get_gzip) == SQLITE_ROW) {
+        data = sqlite3_column_blob(ctx->stmt_get_gzip, 0);
+        size = sqlite3_column_bytes(ctx->stmt_get_gzip, 0);
+        if (data) {
+            ret = flb_tail_gz_restore(file, data, size);
+        }
+    }
+
+    sqlite3_clear_bindings(ctx->stmt_get_gzip);
+    sqlite3_reset(ctx->stmt_get_gzip);
+    return ret;
+}
+
 /* Update offset */
 int flb_tail_db_file_offset(struct flb_tail_file *file,
                             struct flb_tail_config *ctx)
 {
     int ret;
-    char query[PATH_MAX];
 
-    snprintf(query, sizeof(query) - 1,
-             SQL_UPDATE_OFFSET,
-             (uint64_t) file->offset, file->db_id);
+    sqlite3_bind_int64(ctx->stmt_offset, 1, file->offset);
+    sqlite3_bind_int64(ctx->stmt_offset, 2, file->db_id);
+
+    ret = sqlite3_step(ctx->stmt_offset);
+    sqlite3_clear_bindings(ctx->stmt_offset);
+    sqlite3_reset(ctx->stmt_offset);
+
+    if (ret != SQLITE_DONE) {
+        flb_error("[in_tail:db] error updating offset of %s: %s",
+                  file->name, sqlite3_errmsg(ctx->db->handler));
+        return -1;
+    }
+    file->db_dirty = FLB_FALSE;
+
+    /*
+     * The inflate checkpoint is written once the offset reached it, never
+     * while a reader thread owns the file.
+     */
+    if (file->gz_ckpt_dirty == FLB_TRUE && file->thread_busy == FLB_FALSE &&
+        file->gz_ckpt_offset <= file->offset) {
+        return db_gz_save(file, ctx);
+    }
+
+    return 0;
+}
+
+/*
+ * Register the new offset of a file after a read: it's written right away
+ * unless a sync interval is set, on that case it's written by the next
+ * call to flb_tail_db_sync().
+ */
+int flb_tail_db_file_offset_update(struct flb_tail_file *file,
+                                   struct flb_tail_config *ctx)
+{
+    if (ctx->db_sync_interval > 0) {
+        file->db_dirty = FLB_TRUE;
+        return 0;
+    }
+
+    return flb_tail_db_file_offset(file, ctx);
+}
+
+static int db_sync_list(struct mk_list *files, struct flb_tail_config *ctx)
+{
+    int ret = 0;
+    struct mk_list *head;
+    struct flb_tail_file *file;
+
+    mk_list_foreach(head, files) {
+        file = mk_list_entry(head, struct flb_tail_file, _head);
+        if (file->db_dirty == FLB_TRUE &&
+            flb_tail_db_file_offset(file, ctx) == -1) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Write the pending offsets of all files in a single transaction */
+int flb_tail_db_sync(struct flb_tail_config *ctx)
+{
+    int ret;
+
+    ret = flb_sqldb_query(ctx->db, SQL_BEGIN, NULL, NULL);
+    if (ret != FLB_OK) {
+        return -1;
+    }
 
-    ret = flb_sqldb_query(ctx->db,
-                          query, NULL, NULL);
-    if (ret == FLB_ERROR) {
+    ret = db_sync_list(&ctx->files_static, ctx);
+    if (db_sync_list(&ctx->files_event, ctx) == -1) {
+        ret = -1;
+    }
+
+    if (flb_sqldb_query(ctx->db, SQL_COMMIT, NULL, NULL) != FLB_OK) {
         return -1;
     }
+
+    return ret;
+}
+
+/* Collector callback for the periodic offsets sync */
+int flb_tail_db_sync_callback(struct flb_input_instance *i_ins,
+                              struct flb_config *config, void *context)
+{
+    struct flb_tail_config *ctx = context;
+    (void) i_ins;
+    (void) config;
+
+    flb_tail_db_sync(ctx);
     return 0;
 }
 
@@ -160,18 +352,15 @@ int flb_tail_db_file_rotate(const char *new_name,
                             struct flb_tail_config *ctx)
 {
     int ret;
-    char query[PATH_MAX];
-    struct query_status qs = {0};
 
-    /* Check if the file exists */
-    snprintf(query, sizeof(query) - 1,
-             SQL_ROTATE_FILE,
-             new_name, file->db_id);
+    sqlite3_bind_text(ctx->stmt_rotate_file, 1, new_name, -1, 0);
+    sqlite3_bind_int64(ctx->stmt_rotate_file, 2, file->db_id);
 
-    memset(&qs, '\0', sizeof(qs));
-    ret = flb_sqldb_query(ctx->db,
-                          query, cb_file_check, &qs);
-    if (ret != FLB_OK) {
+    ret = sqlite3_step(ctx->stmt_rotate_file);
+    sqlite3_clear_bindings(ctx->stmt_rotate_file);
+    sqlite3_reset(ctx->stmt_rotate_file);
+
+    if (ret != SQLITE_DONE) {
         return -1;
     }
 
@@ -183,16 +372,26 @@ int flb_tail_db_file_delete(struct flb_tail_file *file,
                             struct flb_tail_config *ctx)
 {
     int ret;
-    char query[PATH_MAX];
 
-    /* Check if the file exists */
-    snprintf(query, sizeof(query) - 1, SQL_DELETE_FILE, file->db_id);
-    ret = flb_sqldb_query(ctx->db, query, NULL, NULL);
-    if (ret != FLB_OK) {
+    sqlite3_bind_int64(ctx->stmt_delete_file, 1, file->db_id);
+
+    ret = sqlite3_step(ctx->stmt_delete_file);
+    sqlite3_clear_bindings(ctx->stmt_delete_file);
+    sqlite3_reset(ctx->stmt_delete_file);
+
+    if (ret != SQLITE_DONE) {
         flb_error("[in_tail:db] error deleting entry from database: %s", file->name);
         return -1;
     }
 
+    /* and its inflate checkpoint, if any */
+    sqlite3_bind_int64(ctx->stmt_delete_gzip, 1, file->db_id);
+    sqlite3_step(ctx->stmt_delete_gzip);
+    sqlite3_clear_bindings(ctx->stmt_delete_gzip);
+    sqlite3_reset(ctx->stmt_delete_gzip);
+    file->gz_ckpt_dirty = FLB_FALSE;
+
+    file->db_dirty = FLB_FALSE;
     flb_debug("[in_tail:db] file deleted from database: %s", file->name);
     return 0;
 }
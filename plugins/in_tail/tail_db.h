@@ -31,11 +31,18 @@ struct flb_sqldb *flb_tail_db_open(const char *path,
                                    struct flb_tail_config *ctx,
                                    struct flb_config *config);
 
-int flb_tail_db_close(struct flb_sqldb *db);
+int flb_tail_db_close(struct flb_sqldb *db, struct flb_tail_config *ctx);
 int flb_tail_db_file_set(struct flb_tail_file *file,
                          struct flb_tail_config *ctx);
+int flb_tail_db_gz_restore(struct flb_tail_file *file,
+                           struct flb_tail_config *ctx);
 int flb_tail_db_file_offset(struct flb_tail_file *file,
                             struct flb_tail_config *ctx);
+int flb_tail_db_file_offset_update(struct flb_tail_file *file,
+                                   struct flb_tail_config *ctx);
+int flb_tail_db_sync(struct flb_tail_config *ctx);
+int flb_tail_db_sync_callback(struct flb_input_instance *i_ins,
+                              struct flb_config *config, void *context);
 int flb_tail_db_file_rotate(const char *new_name,
                             struct flb_tail_file *file,
                             struct flb_tail_config *ctx);
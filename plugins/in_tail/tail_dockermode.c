@@ -18,13 +18,29 @@
  *  limitations under the License.
  */
 
-#include <fluent-bit/flb_pack.h>
-#include <fluent-bit/flb_unescape.h>
+#include <string.h>
+
+#include <fluent-bit/flb_parser.h>
 
 #include "tail_config.h"
 #include "tail_dockermode.h"
 #include "tail_file_internal.h"
 
+/*
+ * Docker and CRI runtimes split long lines in pieces of 16KB. Docker marks
+ * the last piece with a trailing '\n' in the 'log' value, CRI writes a 'P'
+ * (partial) or 'F' (full) tag after the stream name. We locate the content
+ * with a direct scan of the raw line and join the pieces in 'dmode_buf' as
+ * a single line: the prefix of the first piece, the content of every
+ * piece, then the suffix of the last one. The result is parsed once.
+ */
+struct dmode_line {
+    size_t start;    /* offset of the content (still JSON escaped) */
+    size_t end;      /* end of the content                         */
+    ssize_t tag;     /* offset of the CRI tag, -1 for Docker JSON  */
+    int partial;     /* piece of a longer line ?                   */
+};
+
 int flb_tail_dmode_create(struct flb_tail_config *ctx,
                           struct flb_input_instance *i_ins,
                           struct flb_config *config)
@@ -50,237 +66,334 @@ int flb_tail_dmode_create(struct flb_tail_config *ctx,
     return 0;
 }
 
-static int modify_json_cond(char *js, size_t js_len,
-                            char **val, size_t *val_len,
-                            char **out, size_t *out_len,
-                            int cond(char*, size_t),
-                            int mod(char*, size_t, char**, size_t*, void*), void *data)
+static inline char *skip_spaces(char *p, char *end)
 {
-    int ret;
-    struct flb_pack_state state;
-    jsmntok_t *t;
-    jsmntok_t *t_val = NULL;
-    int i;
-    int i_root = -1;
-    int i_key = -1;
-    char *old_val;
-    size_t old_val_len;
-    char *new_val = NULL;
-    size_t new_val_len = 0;
-    size_t mod_len;
-
-    ret = flb_pack_state_init(&state);
-    if (ret != 0) {
-        ret = -1;
-        goto modify_json_cond_end;
-    }
-
-    ret = flb_json_tokenise(js, js_len, &state);
-    if (ret != 0 || state.tokens_count == 0) {
-        ret = -1;
-        goto modify_json_cond_end;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
     }
+    return p;
+}
 
-    for (i = 0; i < state.tokens_count; i++) {
-        t = &state.tokens[i];
+/*
+ * Return the position of the quote closing the string that starts at 'p'
+ * (after the opening quote) or NULL. If 'nl' is set, it reports whether
+ * the decoded string ends with a new line.
+ */
+static char *json_string_end(char *p, char *end, int *nl)
+{
+    int last_nl = FLB_FALSE;
 
-        if (i_key >= 0) {
-            if (t->parent == i_key) {
-                if (t->type == JSMN_STRING) {
-                   t_val = t;
-                }
-                break;
+    while (p < end) {
+        if (*p == '"') {
+            if (nl) {
+                *nl = last_nl;
             }
-            continue;
+            return p;
         }
 
-        if (t->start == 0 && t->parent == -1 && t->type == JSMN_OBJECT) {
-            i_root = i;
+        if (*p == '\\') {
+            if (p + 1 >= end) {
+                return NULL;
+            }
+            if (p[1] == 'n') {
+                last_nl = FLB_TRUE;
+            }
+            else if (p[1] == 'u' && end - p >= 6 &&
+                     strncasecmp(p + 2, "000a", 4) == 0) {
+                last_nl = FLB_TRUE;
+                p += 4;
+            }
+            else {
+                last_nl = FLB_FALSE;
+            }
+            p += 2;
             continue;
         }
-        if (i_root == -1) {
+
+        last_nl = FLB_FALSE;
+        p++;
+    }
+
+    return NULL;
+}
+
+/* Skip a JSON value, returns the position right after it or NULL */
+static char *json_value_end(char *p, char *end)
+{
+    int depth = 0;
+
+    while (p < end) {
+        if (*p == '"') {
+            p = json_string_end(p + 1, end, NULL);
+            if (!p) {
+                return NULL;
+            }
+            p++;
+            if (depth == 0) {
+                return p;
+            }
             continue;
         }
 
-        if (t->parent == i_root && t->type == JSMN_STRING && t->end - t->start == 3 && strncmp(js + t->start, "log", 3) == 0) {
-            i_key = i;
+        if (*p == '{' || *p == '[') {
+            depth++;
         }
+        else if (*p == '}' || *p == ']') {
+            if (depth == 0) {
+                return p;
+            }
+            if (--depth == 0) {
+                return p + 1;
+            }
+        }
+        else if (depth == 0 && (*p == ',' || *p == ' ')) {
+            return p;
+        }
+        p++;
     }
 
-    if (!t_val) {
-        ret = -1;
-        goto modify_json_cond_end;
-    }
-
-    *out = js;
-    *out_len = js_len;
+    return NULL;
+}
 
-    if (val) {
-        *val = js + t_val->start;
-    }
-    if (val_len) {
-        *val_len = t_val->end - t_val->start;
+/* Locate the 'log' value of a Docker JSON line */
+static int dmode_json_scan(char *line, size_t len, struct dmode_line *out)
+{
+    int nl;
+    int is_log;
+    char *p = line;
+    char *end = line + len;
+    char *key;
+    char *val;
+
+    p = skip_spaces(p, end);
+    if (p == end || *p != '{') {
+        return -1;
     }
+    p++;
 
-    if (!cond || cond(js + t_val->start, t_val->end - t_val->start)) {
-        old_val = js + t_val->start;
-        old_val_len = t_val->end - t_val->start;
-        ret = mod(old_val, old_val_len, &new_val, &new_val_len, data);
-        if (ret != 0) {
-            ret = -1;
-            goto modify_json_cond_end;
+    while (1) {
+        p = skip_spaces(p, end);
+        if (p == end || *p != '"') {
+            return -1;
         }
 
-        ret = 1;
-
-        if (new_val == old_val) {
-            goto modify_json_cond_end;
+        /* key */
+        key = p + 1;
+        p = json_string_end(key, end, NULL);
+        if (!p) {
+            return -1;
         }
+        is_log = (p - key == 3 && strncmp(key, "log", 3) == 0);
 
-        mod_len = js_len + new_val_len - old_val_len;
-        *out = flb_malloc(mod_len);
-        if (!*out) {
-            flb_errno();
-            flb_free(new_val);
-            ret = -1;
-            goto modify_json_cond_end;
+        p = skip_spaces(p + 1, end);
+        if (p == end || *p != ':') {
+            return -1;
+        }
+        p = skip_spaces(p + 1, end);
+        if (p == end) {
+            return -1;
         }
-        *out_len = mod_len;
 
-        memcpy(*out, js, t_val->start);
-        memcpy(*out + t_val->start, new_val, new_val_len);
-        memcpy(*out + t_val->start + new_val_len, js + t_val->end, js_len - t_val->end);
+        if (is_log && *p == '"') {
+            val = p + 1;
+            p = json_string_end(val, end, &nl);
+            if (!p) {
+                return -1;
+            }
+            out->start = val - line;
+            out->end = p - line;
+            out->tag = -1;
+            out->partial = !nl;
+            return 0;
+        }
 
-        flb_free(new_val);
+        /* any other value */
+        p = json_value_end(p, end);
+        if (!p) {
+            return -1;
+        }
+        p = skip_spaces(p, end);
+        if (p == end || *p != ',') {
+            return -1;
+        }
+        p++;
     }
 
- modify_json_cond_end:
-    flb_pack_state_reset(&state);
-    if (ret < 0) {
-        *out = NULL;
-    }
-    return ret;
+    return -1;
 }
 
-static int unesc_ends_with_nl(char *str, size_t len)
+/* Locate the message of a CRI line: TIME STREAM TAG MESSAGE */
+static int dmode_cri_scan(char *line, size_t len, struct dmode_line *out)
 {
-    char* unesc;
-    int unesc_len;
-    int nl;
+    char *p;
+    char *tag;
+    char *end = line + len;
 
-    unesc = flb_malloc(len + 1);
-    if (!unesc) {
-        flb_errno();
-        return FLB_FALSE;
+    /* time */
+    p = memchr(line, ' ', len);
+    if (!p) {
+        return -1;
     }
-    unesc_len = flb_unescape_string(str, len, &unesc);
-    nl = unesc[unesc_len - 1] == '\n';
-    flb_free(unesc);
-    return nl;
-}
-
-static int prepend_sds_to_str(char *str, size_t len, char **out, size_t *out_len, void *data)
-{
-    flb_sds_t sds = data;
+    p++;
 
-    if (flb_sds_len(sds) == 0) {
-        *out = str;
-        *out_len = len;
-        return 0;
+    /* stream */
+    if (end - p < 7 ||
+        (strncmp(p, "stdout ", 7) != 0 && strncmp(p, "stderr ", 7) != 0)) {
+        return -1;
     }
+    p += 7;
 
-    size_t mod_len = flb_sds_len(sds) + len;
-    *out = flb_malloc(mod_len);
-    if (!*out) {
-        flb_errno();
+    /* tag, 'P' or 'F' optionally followed by more ':' separated tags */
+    tag = p;
+    if (p == end || (*p != 'P' && *p != 'F')) {
         return -1;
     }
-    *out_len = mod_len;
+    p++;
+    while (p < end && *p != ' ') {
+        if (p == tag + 1 && *p != ':') {
+            return -1;
+        }
+        p++;
+    }
+    if (p < end) {
+        p++;
+    }
 
-    memcpy(*out, sds, flb_sds_len(sds));
-    memcpy(*out + flb_sds_len(sds), str, len);
+    out->start = p - line;
+    out->end = len;
+    out->tag = tag - line;
+    out->partial = (*tag == 'P');
     return 0;
 }
 
-static int use_sds(char *str, size_t len, char **out, size_t *out_len, void *data)
+/* Forget the joined line handed to the caller by the previous call */
+static inline void dmode_reset(struct flb_tail_file *file)
 {
-    flb_sds_t sds = data;
-    size_t mod_len = flb_sds_len(sds);
-    *out = flb_malloc(mod_len);
-    if (!*out) {
-        flb_errno();
-        return -1;
+    if (file->dmode_complete == FLB_TRUE) {
+        flb_sds_len_set(file->dmode_buf, 0);
+        file->dmode_complete = FLB_FALSE;
     }
-    *out_len = mod_len;
-
-    memcpy(*out, sds, flb_sds_len(sds));
-    return 0;
 }
 
+/*
+ * Process a line in Docker mode. Returns 0 if the line is a piece of a
+ * longer one and has been buffered, 1 if 'repl_line' has a complete line
+ * to be processed (the same line or the joined pieces, it must not be
+ * released) and -1 if the line is not a Docker or CRI log entry.
+ */
 int flb_tail_dmode_process_content(time_t now,
                                    char* line, size_t line_len,
                                    char **repl_line, size_t *repl_line_len,
                                    struct flb_tail_file *file,
                                    struct flb_tail_config *ctx)
 {
-    char* val = NULL;
-    size_t val_len;
     int ret;
+    flb_sds_t tmp;
+    struct dmode_line dl;
+
+    dmode_reset(file);
+
+    if (line_len > 0 && line[0] == '{') {
+        ret = dmode_json_scan(line, line_len, &dl);
+    }
+    else {
+        ret = dmode_cri_scan(line, line_len, &dl);
+    }
+    if (ret == -1) {
+        return -1;
+    }
 
-    ret = modify_json_cond(line, line_len,
-                           &val, &val_len,
-                           repl_line, repl_line_len,
-                           unesc_ends_with_nl,
-                           prepend_sds_to_str, file->dmode_buf);
-    if (ret >= 0) {
-        flb_sds_len_set(file->dmode_lastline, 0);
-
-        if (ret == 0) {
-            file->dmode_buf = flb_sds_cat(file->dmode_buf, val, val_len);
-            file->dmode_lastline = flb_sds_copy(file->dmode_lastline, line, line_len);
-            file->dmode_flush_timeout = now + (ctx->docker_mode_flush - 1);
-            return ret;
+    /* A complete line, nothing to join */
+    if (!dl.partial && flb_sds_len(file->dmode_buf) == 0) {
+        *repl_line = line;
+        *repl_line_len = line_len;
+        return 1;
+    }
+
+    /* First piece, keep what comes before the content */
+    if (flb_sds_len(file->dmode_buf) == 0) {
+        tmp = flb_sds_cat(file->dmode_buf, line, dl.start);
+        if (!tmp) {
+            return -1;
         }
+        file->dmode_buf = tmp;
 
-        flb_sds_len_set(file->dmode_buf, 0);
-        file->dmode_flush_timeout = 0;
+        /* the joined line is a full one */
+        if (dl.tag >= 0) {
+            file->dmode_buf[dl.tag] = 'F';
+        }
+    }
+
+    tmp = flb_sds_cat(file->dmode_buf, line + dl.start, dl.end - dl.start);
+    if (!tmp) {
+        return -1;
     }
-    return ret;
+    file->dmode_buf = tmp;
+
+    if (dl.partial) {
+        /* keep the end of the piece, needed if no other piece comes */
+        tmp = flb_sds_copy(file->dmode_lastline, line + dl.end,
+                           line_len - dl.end);
+        if (!tmp) {
+            return -1;
+        }
+        file->dmode_lastline = tmp;
+        file->dmode_flush_timeout = now + (ctx->docker_mode_flush - 1);
+        return 0;
+    }
+
+    /* Last piece */
+    tmp = flb_sds_cat(file->dmode_buf, line + dl.end, line_len - dl.end);
+    if (!tmp) {
+        return -1;
+    }
+    file->dmode_buf = tmp;
+    flb_sds_len_set(file->dmode_lastline, 0);
+    file->dmode_flush_timeout = 0;
+    file->dmode_complete = FLB_TRUE;
+
+    *repl_line = file->dmode_buf;
+    *repl_line_len = flb_sds_len(file->dmode_buf);
+    return 1;
+}
+
+static inline int dmode_pending(struct flb_tail_file *file)
+{
+    return (file->dmode_complete == FLB_FALSE &&
+            flb_sds_len(file->dmode_buf) > 0);
 }
 
 void flb_tail_dmode_flush(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
                           struct flb_tail_file *file, struct flb_tail_config *ctx)
 {
     int ret;
-    char *repl_line = NULL;
-    size_t repl_line_len = 0;
     void *out_buf = NULL;
     size_t out_size;
+    char *line;
+    size_t line_len;
+    flb_sds_t tmp;
     struct flb_time out_time = {0};
     time_t now = time(NULL);
 
-    if (flb_sds_len(file->dmode_lastline) == 0) {
+    dmode_reset(file);
+    if (!dmode_pending(file)) {
         return;
     }
 
-    flb_time_zero(&out_time);
-
-    ret = modify_json_cond(file->dmode_lastline, flb_sds_len(file->dmode_lastline),
-                           NULL, NULL,
-                           &repl_line, &repl_line_len,
-                           NULL,
-                           use_sds, file->dmode_buf);
-    if (ret < 0) {
-        return;
+    /* Close the line with the end of the last piece */
+    tmp = flb_sds_cat(file->dmode_buf, file->dmode_lastline,
+                      flb_sds_len(file->dmode_lastline));
+    if (tmp) {
+        file->dmode_buf = tmp;
     }
+    line = file->dmode_buf;
+    line_len = flb_sds_len(file->dmode_buf);
 
-    flb_sds_len_set(file->dmode_buf, 0);
-    flb_sds_len_set(file->dmode_lastline, 0);
-    file->dmode_flush_timeout = 0;
+    flb_time_zero(&out_time);
 
 #ifdef FLB_HAVE_REGEX
     if (ctx->parser) {
-        ret = flb_parser_do(ctx->parser, repl_line, repl_line_len,
+        ret = flb_parser_do(ctx->parser, line, line_len,
                             &out_buf, &out_size, &out_time);
         if (ret >= 0) {
             if (flb_time_to_double(&out_time) == 0) {
@@ -290,16 +403,19 @@ void flb_tail_dmode_flush(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
                 goto dmode_flush_end;
             }
             flb_tail_pack_line_map(mp_sbuf, mp_pck, &out_time,
-                                   (char**) &out_buf, &out_size, file);
-            goto dmode_flush_end;        }
+                                   out_buf, out_size, file);
+            goto dmode_flush_end;
+        }
     }
 #endif
     flb_time_get(&out_time);
     flb_tail_file_pack_line(mp_sbuf, mp_pck, &out_time,
-                            repl_line, repl_line_len, file);
+                            line, line_len, file);
 
  dmode_flush_end:
-    flb_free(repl_line);
+    flb_sds_len_set(file->dmode_buf, 0);
+    flb_sds_len_set(file->dmode_lastline, 0);
+    file->dmode_flush_timeout = 0;
     flb_free(out_buf);
 }
 
@@ -323,7 +439,7 @@ int flb_tail_dmode_pending_flush(struct flb_input_instance *i_ins,
             continue;
         }
 
-        if (flb_sds_len(file->dmode_lastline) == 0) {
+        if (!dmode_pending(file)) {
             continue;
         }
 
@@ -22,6 +22,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
+#include <ctype.h>
+#include <inttypes.h>
 
 #include <fluent-bit/flb_compat.h>
 #include <fluent-bit/flb_info.h>
@@ -39,6 +41,8 @@
 #include "tail_signal.h"
 #include "tail_dockermode.h"
 #include "tail_multiline.h"
+#include "tail_multiline_rules.h"
+#include "tail_gzip.h"
 #include "tail_scan.h"
 
 #ifdef _MSC_VER
@@ -90,119 +94,89 @@ static int open_file(const char *path)
 }
 #endif
 
-static int unpack_and_pack(msgpack_packer *pck, msgpack_object *root,
-                           const char *key, size_t key_len,
-                           const char *val, size_t val_len)
+/*
+ * Get the number of entries of the msgpack map in 'data', returns the size
+ * of the map header or -1 if 'data' is not a map.
+ */
+static inline int map_header(const char *data, size_t size, uint32_t *count)
 {
-    int i;
-    int size = root->via.map.size;
-
-    msgpack_pack_map(pck, size + 1);
+    const unsigned char *p = (const unsigned char *) data;
 
-    /* Append new k/v */
-    msgpack_pack_str(pck, key_len);
-    msgpack_pack_str_body(pck, key, key_len);
-    msgpack_pack_str(pck, val_len);
-    msgpack_pack_str_body(pck, val, val_len);
-
-    for (i = 0; i < size; i++) {
-        msgpack_object k = root->via.map.ptr[i].key;
-        msgpack_object v = root->via.map.ptr[i].val;;
-
-        msgpack_pack_object(pck, k);
-        msgpack_pack_object(pck, v);
+    if (size >= 1 && (p[0] & 0xf0) == 0x80) {
+        *count = p[0] & 0x0f;
+        return 1;
     }
-
-    return 0;
-}
-
-static int append_record_to_map(char **data, size_t *data_size,
-                                const char *key, size_t key_len,
-                                const char *val, size_t val_len)
-{
-    int ret;
-    msgpack_unpacked result;
-    msgpack_object   root;
-    msgpack_sbuffer sbuf;
-    msgpack_packer  pck;
-    size_t off = 0;
-
-    msgpack_sbuffer_init(&sbuf);
-    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
-    msgpack_unpacked_init(&result);
-
-    ret = msgpack_unpack_next(&result, *data, *data_size, &off);
-    if (ret != MSGPACK_UNPACK_SUCCESS) {
-        msgpack_unpacked_destroy(&result);
-        msgpack_sbuffer_destroy(&sbuf);
-        return -1;
+    else if (size >= 3 && p[0] == 0xde) {
+        *count = ((uint32_t) p[1] << 8) | p[2];
+        return 3;
     }
-
-    root = result.data;
-    ret = unpack_and_pack(&pck, &root,
-                          key, key_len, val, val_len);
-    if (ret < 0) {
-        /* fail! */
-        msgpack_unpacked_destroy(&result);
-        msgpack_sbuffer_destroy(&sbuf);
-        return -1;
-    }
-    else {
-        /* success !*/
-        flb_free(*data);
-        *data      = sbuf.data;
-        *data_size = sbuf.size;
+    else if (size >= 5 && p[0] == 0xdf) {
+        *count = ((uint32_t) p[1] << 24) | ((uint32_t) p[2] << 16) |
+                 ((uint32_t) p[3] << 8) | p[4];
+        return 5;
     }
 
-    msgpack_unpacked_destroy(&result);
-    return 0;
+    return -1;
 }
 
-int flb_tail_pack_line_map(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                           struct flb_time *time, char **data,
-                           size_t *data_size, struct flb_tail_file *file)
+/*
+ * Pack a record from the map generated by a parser. Extra keys are packed
+ * right after a new map header followed by the original entries as they
+ * are, so the parser output is copied once and never unpacked.
+ */
+static int pack_line_map(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                         struct flb_time *time, const char *data,
+                         size_t data_size, struct flb_tail_config *ctx,
+                         const char *name, size_t name_len)
 {
-    int map_num = 1;
+    int hdr = -1;
+    uint32_t count;
 
-    if (file->config->path_key != NULL) {
-        map_num++; /* to append path_key */
+    msgpack_pack_array(mp_pck, 2);
+    flb_time_append_to_msgpack(time, mp_pck, 0);
+
+    if (ctx->path_key != NULL) {
+        hdr = map_header(data, data_size, &count);
     }
 
-    if (file->config->path_key != NULL) {
-        append_record_to_map(data, data_size,
-                             file->config->path_key,
-                             file->config->path_key_len,
-                             file->name, file->name_len);
+    if (hdr == -1) {
+        msgpack_sbuffer_write(mp_sbuf, data, data_size);
+        return 0;
     }
 
-    msgpack_pack_array(mp_pck, 2);
-    flb_time_append_to_msgpack(time, mp_pck, 0);
-    msgpack_sbuffer_write(mp_sbuf, *data, *data_size);
+    msgpack_pack_map(mp_pck, count + 1);
+
+    /* append path_key */
+    msgpack_pack_str(mp_pck, ctx->path_key_len);
+    msgpack_pack_str_body(mp_pck, ctx->path_key, ctx->path_key_len);
+    msgpack_pack_str(mp_pck, name_len);
+    msgpack_pack_str_body(mp_pck, name, name_len);
+
+    msgpack_sbuffer_write(mp_sbuf, data + hdr, data_size - hdr);
 
     return 0;
 }
 
-int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                            struct flb_time *time, char *data, size_t data_size,
-                            struct flb_tail_file *file)
+static int pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                     struct flb_time *time, const char *data, size_t data_size,
+                     struct flb_tail_config *ctx,
+                     const char *name, size_t name_len)
 {
     int map_num = 1;
-    struct flb_tail_config *ctx = file->config;
 
-    if (file->config->path_key != NULL) {
+    if (ctx->path_key != NULL) {
         map_num++; /* to append path_key */
     }
     msgpack_pack_array(mp_pck, 2);
     flb_time_append_to_msgpack(time, mp_pck, 0);
     msgpack_pack_map(mp_pck, map_num);
 
-    if (file->config->path_key != NULL) {
+    if (ctx->path_key != NULL) {
         /* append path_key */
-        msgpack_pack_str(mp_pck, file->config->path_key_len);
-        msgpack_pack_str_body(mp_pck, file->config->path_key,
-                              file->config->path_key_len);
-        msgpack_pack_str(mp_pck, file->name_len);
-        msgpack_pack_str_body(mp_pck, file->name, file->name_len);
+        msgpack_pack_str(mp_pck, ctx->path_key_len);
+        msgpack_pack_str_body(mp_pck, ctx->path_key, ctx->path_key_len);
+        msgpack_pack_str(mp_pck, name_len);
+        msgpack_pack_str_body(mp_pck, name, name_len);
     }
 
     msgpack_pack_str(mp_pck, ctx->key_len);
@@ -213,7 +187,24 @@ int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
     return 0;
 }
 
-static int process_content(struct flb_tail_file *file, off_t *bytes)
+int flb_tail_pack_line_map(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                           struct flb_time *time, const char *data,
+                           size_t data_size, struct flb_tail_file *file)
+{
+    return pack_line_map(mp_sbuf, mp_pck, time, data, data_size,
+                         file->config, file->name, file->name_len);
+}
+
+int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                            struct flb_time *time, char *data, size_t data_size,
+                            struct flb_tail_file *file)
+{
+    return pack_line(mp_sbuf, mp_pck, time, data, data_size,
+                     file->config, file->name, file->name_len);
+}
+
+static int process_content(struct flb_tail_file *file,
+                           struct flb_tail_file_out *out, off_t *bytes)
 {
     int len;
     int lines = 0;
@@ -231,20 +222,16 @@ static int process_content(struct flb_tail_file *file, off_t *bytes)
     size_t repl_line_len;
     time_t now = time(NULL);
     struct flb_time out_time = {0};
-    msgpack_sbuffer mp_sbuf;
-    msgpack_packer mp_pck;
     msgpack_sbuffer *out_sbuf;
     msgpack_packer *out_pck;
     struct flb_tail_config *ctx = file->config;
 
-    /* Create a temporal msgpack buffer */
-    msgpack_sbuffer_init(&mp_sbuf);
-    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-    out_sbuf = &mp_sbuf;
-    out_pck  = &mp_pck;
+    /* Records are packed in the buffer of the caller */
+    out_sbuf = out->mp_sbuf;
+    out_pck  = out->mp_pck;
 
     /* Parse the data content */
-    data = file->buf_data;
+    data = file->buf_data + file->buf_start;
     end = data + file->buf_len;
     while ((p = memchr(data, '\n', end - data))) {
         len = (p - data);
@@ -276,23 +263,18 @@ static int process_content(struct flb_tail_file *file, off_t *bytes)
 
         line = data;
         line_len = len - crlf;
-        repl_line = NULL;
 
         if (ctx->docker_mode) {
             ret = flb_tail_dmode_process_content(now, line, line_len,
                                                  &repl_line, &repl_line_len,
                                                  file, ctx);
-            if (ret >= 0) {
-                if (repl_line == line) {
-                    repl_line = NULL;
-                }
-                else {
-                    line = repl_line;
-                    line_len = repl_line_len;
-                }
-                if (ret == 0) {
-                    goto go_next;
-                }
+            if (ret == 0) {
+                /* piece of a long line, wait for the rest */
+                goto go_next;
+            }
+            else if (ret > 0) {
+                line = repl_line;
+                line_len = repl_line_len;
             }
             else {
                 flb_tail_dmode_flush(out_sbuf, out_pck, file, ctx);
@@ -300,9 +282,14 @@ static int process_content(struct flb_tail_file *file, off_t *bytes)
         }
 
 #ifdef FLB_HAVE_PARSER
-        if (ctx->parser) {
+        if (ctx->mult_rules) {
+            /* Multiline rules, records are parsed when complete */
+            flb_tail_mult_rules_process(now, line, line_len, file,
+                                        out_sbuf, out_pck);
+        }
+        else if (out->parser) {
             /* Common parser (non-multiline) */
-            ret = flb_parser_do(ctx->parser, line, line_len,
+            ret = flb_parser_do(out->parser, line, line_len,
                                 &out_buf, &out_size, &out_time);
             if (ret >= 0) {
                 if (flb_time_to_double(&out_time) == 0) {
@@ -321,15 +308,16 @@ static int process_content(struct flb_tail_file *file, off_t *bytes)
                     flb_tail_mult_flush(out_sbuf, out_pck, file, ctx);
                 }
 
-                flb_tail_pack_line_map(out_sbuf, out_pck, &out_time,
-                                       (char**) &out_buf, &out_size, file);
+                pack_line_map(out_sbuf, out_pck, &out_time,
+                              out_buf, out_size, ctx,
+                              out->name, out->name_len);
                 flb_free(out_buf);
             }
             else {
                 /* Parser failed, pack raw text */
                 flb_time_get(&out_time);
-                flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
-                                        data, len, file);
+                pack_line(out_sbuf, out_pck, &out_time, line, line_len, ctx,
+                          out->name, out->name_len);
             }
         }
         else if (ctx->multiline == FLB_TRUE) {
@@ -355,18 +343,16 @@ static int process_content(struct flb_tail_file *file, off_t *bytes)
         }
         else {
             flb_time_get(&out_time);
-            flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
-                                    line, line_len, file);
+            pack_line(out_sbuf, out_pck, &out_time, line, line_len, ctx,
+                      out->name, out->name_len);
         }
 #else
         flb_time_get(&out_time);
-        flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
-                                line, line_len, file);
+        pack_line(out_sbuf, out_pck, &out_time, line, line_len, ctx,
+                  out->name, out->name_len);
 #endif
 
     go_next:
-        flb_free(repl_line);
-        repl_line = NULL;
         /* Adjust counters */
         data += len + 1;
         processed_bytes += len + 1;
@@ -376,14 +362,6 @@ static int process_content(struct flb_tail_file *file, off_t *bytes)
     file->parsed = file->buf_len;
     *bytes = processed_bytes;
 
-    /* Append buffer content to a chunk */
-    flb_input_chunk_append_raw(ctx->i_ins,
-                               file->tag_buf,
-                               file->tag_len,
-                               out_sbuf->data,
-                               out_sbuf->size);
-
-    msgpack_sbuffer_destroy(out_sbuf);
     return lines;
 }
 
@@ -549,25 +527,126 @@ static int tag_compose(char *tag, char *fname, char *out_buf, size_t *out_size)
     return 0;
 }
 
-int flb_tail_file_exists(char *name, struct flb_tail_config *ctx)
+/*
+ * Monitored files are indexed by name and by device/inode. The name key is
+ * the one compared by flb_tail_file_name_cmp(), on Windows the comparison
+ * is case insensitive so the key is lower cased.
+ */
+static const char *hash_name_key(const char *name, char *buf)
 {
-    struct mk_list *head;
+#if defined(FLB_SYSTEM_WINDOWS)
+    int i;
+
+    for (i = 0; name[i] != '\0' && i < PATH_MAX - 1; i++) {
+        buf[i] = tolower((unsigned char) name[i]);
+    }
+    buf[i] = '\0';
+    return buf;
+#else
+    (void) buf;
+    return name;
+#endif
+}
+
+static inline const char *hash_file_name(struct flb_tail_file *file)
+{
+#if defined(__linux__)
+    return file->name;
+#else
+    return file->real_name;
+#endif
+}
+
+static int hash_inode_key(uint64_t dev, uint64_t inode, char *buf, int size)
+{
+    return snprintf(buf, size, "%" PRIu64 ":%" PRIu64, dev, inode);
+}
+
+static struct flb_tail_file *hash_lookup(struct flb_hash *ht,
+                                         const char *key, int key_len)
+{
+    int ret;
+    size_t size;
+    const char *val;
     struct flb_tail_file *file;
 
-    /* Iterate static list */
-    mk_list_foreach(head, &ctx->files_static) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (flb_tail_file_name_cmp(name, file) == 0) {
-            return FLB_TRUE;
-        }
+    ret = flb_hash_get(ht, key, key_len, &val, &size);
+    if (ret == -1) {
+        return NULL;
     }
 
-    /* Iterate dynamic list */
-    mk_list_foreach(head, &ctx->files_event) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (flb_tail_file_name_cmp(name, file) == 0) {
-            return FLB_TRUE;
-        }
+    memcpy(&file, val, sizeof(file));
+    return file;
+}
+
+static int hash_add_name(struct flb_tail_file *file)
+{
+    int ret;
+    const char *key;
+    char buf[PATH_MAX];
+
+    key = hash_name_key(hash_file_name(file), buf);
+    ret = flb_hash_add(file->config->hash_names, key, strlen(key),
+                       (char *) &file, sizeof(file));
+    if (ret == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static void hash_del_name(struct flb_tail_file *file)
+{
+    const char *key;
+    char buf[PATH_MAX];
+
+    key = hash_name_key(hash_file_name(file), buf);
+    if (hash_lookup(file->config->hash_names, key, strlen(key)) == file) {
+        flb_hash_del(file->config->hash_names, key);
+    }
+}
+
+static int hash_add(struct flb_tail_file *file)
+{
+    int len;
+    int ret;
+    char key[64];
+
+    ret = hash_add_name(file);
+    if (ret == -1) {
+        return -1;
+    }
+
+    len = hash_inode_key(file->dev, file->inode, key, sizeof(key));
+    ret = flb_hash_add(file->config->hash_inodes, key, len,
+                       (char *) &file, sizeof(file));
+    if (ret == -1) {
+        hash_del_name(file);
+        return -1;
+    }
+    return 0;
+}
+
+static void hash_del(struct flb_tail_file *file)
+{
+    int len;
+    char key[64];
+
+    hash_del_name(file);
+
+    len = hash_inode_key(file->dev, file->inode, key, sizeof(key));
+    if (hash_lookup(file->config->hash_inodes, key, len) == file) {
+        flb_hash_del(file->config->hash_inodes, key);
+    }
+}
+
+int flb_tail_file_exists(char *name, struct flb_tail_config *ctx)
+{
+    const char *key;
+    char buf[PATH_MAX];
+
+    key = hash_name_key(name, buf);
+    if (hash_lookup(ctx->hash_names, key, strlen(key))) {
+        return FLB_TRUE;
     }
 
     return FLB_FALSE;
@@ -582,7 +661,7 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     off_t offset;
     char *tag;
     size_t tag_len;
-    struct mk_list *head;
+    char key[64];
     struct flb_tail_file *file;
 
     if (!S_ISREG(st->st_mode)) {
@@ -590,17 +669,8 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     }
 
     /* Double check this file is not already being monitored */
-    mk_list_foreach(head, &ctx->files_static) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (flb_tail_file_name_cmp(path, file) == 0) {
-            return -1;
-        }
-    }
-    mk_list_foreach(head, &ctx->files_event) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (flb_tail_file_name_cmp(path, file) == 0) {
-            return -1;
-        }
+    if (flb_tail_file_exists(path, ctx) == FLB_TRUE) {
+        return -1;
     }
 
 #ifdef _MSC_VER
@@ -660,9 +730,23 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
 #else
     file->inode     = st->st_ino;
 #endif
+    file->dev       = st->st_dev;
+
+    /*
+     * The same file can be reached through another name, e.g: it was just
+     * renamed by a rotation not processed yet or it's a link.
+     */
+    len = hash_inode_key(file->dev, file->inode, key, sizeof(key));
+    if (hash_lookup(ctx->hash_inodes, key, len)) {
+        flb_debug("[in_tail] file %s is already monitored (inode=%" PRIu64 ")",
+                  path, (uint64_t) file->inode);
+        goto error;
+    }
+
     file->offset    = 0;
     file->size      = st->st_size;
     file->buf_len   = 0;
+    file->buf_start = 0;
     file->parsed    = 0;
     file->config    = ctx;
     file->tail_mode = mode;
@@ -675,14 +759,31 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     file->mult_flush_timeout = 0;
     file->mult_skipping = FLB_FALSE;
     msgpack_sbuffer_init(&file->mult_sbuf);
+    file->mult_state = 0;
+    file->mult_text = NULL;
     file->dmode_flush_timeout = 0;
     file->dmode_buf = flb_sds_create_size(ctx->docker_mode == FLB_TRUE ? 65536 : 0);
-    file->dmode_lastline = flb_sds_create_size(ctx->docker_mode == FLB_TRUE ? 20000 : 0);
+    file->dmode_lastline = flb_sds_create_size(ctx->docker_mode == FLB_TRUE ? 256 : 0);
+    file->dmode_complete = FLB_FALSE;
 #ifdef FLB_HAVE_SQLDB
     file->db_id     = 0;
 #endif
     file->skip_next = FLB_FALSE;
     file->skip_warn = FLB_FALSE;
+    file->gz = NULL;
+    file->gz_buf = NULL;
+    file->gz_len = 0;
+    file->gz_pos = 0;
+    file->gz_skip = 0;
+    file->gz_more = FLB_FALSE;
+    file->gz_checked = FLB_FALSE;
+    file->gz_out = 0;
+    file->gz_ckpt = NULL;
+    file->gz_ckpt_size = 0;
+    file->gz_ckpt_len = 0;
+    file->gz_ckpt_out = 0;
+    file->gz_ckpt_offset = 0;
+    file->gz_ckpt_dirty = FLB_FALSE;
 
     /* Local buffer */
     file->buf_size = ctx->buf_chunk_size;
@@ -733,6 +834,13 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
         goto error;
     }
 
+    ret = hash_add(file);
+    if (ret == -1) {
+        flb_error("[in_tail] could not index file %s", path);
+        flb_tail_fs_remove(file);
+        goto error;
+    }
+
     if (mode == FLB_TAIL_STATIC) {
         mk_list_add(&file->_head, &ctx->files_static);
     }
@@ -750,8 +858,23 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     }
 #endif
 
+    /*
+     * Compressed files are inflated from the beginning, unless the inflate
+     * status was saved with the offset.
+     */
+    if (ctx->decompress == FLB_TRUE) {
+        flb_tail_gz_check(file);
+#ifdef FLB_HAVE_SQLDB
+        if (ctx->db && file->gz && file->offset > 0 &&
+            flb_tail_db_gz_restore(file, ctx) == 0) {
+            flb_debug("[in_tail] file=%s inflate resumed at %lu",
+                      path, file->gz_pos);
+        }
+#endif
+    }
+
     /* Seek if required */
-    if (file->offset > 0) {
+    if (file->offset > 0 && !file->gz) {
         offset = lseek(file->fd, file->offset, SEEK_SET);
         if (offset == -1) {
             flb_errno();
@@ -787,6 +910,13 @@ void flb_tail_file_remove(struct flb_tail_file *file)
     struct flb_tail_config *ctx;
 
     ctx = file->config;
+
+    /* The file is being read by a reader thread, remove it when it's done */
+    if (file->thread_busy == FLB_TRUE) {
+        file->thread_remove = FLB_TRUE;
+        return;
+    }
+
     if (file->rotated > 0) {
 #ifdef FLB_HAVE_SQLDB
         /*
@@ -799,10 +929,19 @@ void flb_tail_file_remove(struct flb_tail_file *file)
 #endif
         mk_list_del(&file->_rotate_head);
     }
+#ifdef FLB_HAVE_SQLDB
+    else if (ctx->db && file->db_dirty == FLB_TRUE) {
+        /* Don't lose the offset of a file still waiting for a sync */
+        flb_tail_db_file_offset(file, ctx);
+    }
+#endif
 
     flb_sds_destroy(file->dmode_buf);
     flb_sds_destroy(file->dmode_lastline);
+    flb_sds_destroy(file->mult_text);
+    flb_tail_gz_destroy(file);
     mk_list_del(&file->_head);
+    hash_del(file);
     flb_tail_fs_remove(file);
     close(file->fd);
     if (file->tag_buf) {
@@ -844,7 +983,8 @@ int flb_tail_file_remove_all(struct flb_tail_config *ctx)
     return count;
 }
 
-int flb_tail_file_chunk(struct flb_tail_file *file)
+static int file_read(struct flb_tail_file *file, struct flb_tail_file_out *out,
+                     ssize_t *out_bytes)
 {
     int ret;
     char *tmp;
@@ -852,15 +992,27 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
     off_t capacity;
     off_t processed_bytes;
     ssize_t bytes;
-    struct flb_tail_config *ctx;
+    struct flb_tail_config *ctx = file->config;
 
-    /* Check if we the engine issued a pause */
-    ctx = file->config;
-    if (flb_input_buf_paused(ctx->i_ins) == FLB_TRUE) {
-        return FLB_TAIL_BUSY;
+    /*
+     * Processed bytes are not removed from the buffer after every read,
+     * the pending ones are moved to the beginning only when the room left
+     * at the end gets low. Long partial lines are not copied over and over
+     * and lines always stay contiguous for the parsers.
+     */
+    if (file->buf_len == 0) {
+        file->buf_start = 0;
+    }
+    else if (file->buf_start > 0 &&
+             file->buf_size - (file->buf_start + file->buf_len) <=
+             file->buf_size / 2) {
+        consume_bytes(file->buf_data, file->buf_start,
+                      file->buf_start + file->buf_len);
+        file->buf_start = 0;
+        file->buf_data[file->buf_len] = '\0';
     }
 
-    capacity = (file->buf_size - file->buf_len) - 1;
+    capacity = (file->buf_size - file->buf_start - file->buf_len) - 1;
     if (capacity < 1) {
         /*
          * If there is no more room for more data, try to increase the
@@ -869,14 +1021,14 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
         if (file->buf_size >= ctx->buf_max_size) {
             if (ctx->skip_long_lines == FLB_FALSE) {
                 flb_error("[in_tail] file=%s requires a larger buffer size, "
-                          "lines are too long. Skipping file.", file->name);
+                          "lines are too long. Skipping file.", out->name);
                 return FLB_TAIL_ERROR;
             }
 
             /* Warn the user */
             if (file->skip_warn == FLB_FALSE) {
                 flb_warn("[in_tail] file=%s have long lines. "
-                         "Skipping long lines.", file->name);
+                         "Skipping long lines.", out->name);
                 file->skip_warn = FLB_TRUE;
             }
 
@@ -894,25 +1046,49 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
             tmp = flb_realloc(file->buf_data, size);
             if (tmp) {
                 flb_trace("[in_tail] file=%s increase buffer size %lu => %lu bytes",
-                          file->name, file->buf_size, size);
+                          out->name, file->buf_size, size);
                 file->buf_data = tmp;
                 file->buf_size = size;
             }
             else {
                 flb_errno();
                 flb_error("[in_tail] cannot increase buffer size for %s, "
-                          "skipping file.", file->name);
+                          "skipping file.", out->name);
                 return FLB_TAIL_ERROR;
             }
         }
         capacity = (file->buf_size - file->buf_len) - 1;
     }
 
-    bytes = read(file->fd, file->buf_data + file->buf_len, capacity);
+    /* The first bytes tell if the file is compressed */
+    if (file->gz_checked == FLB_FALSE && ctx->decompress == FLB_TRUE &&
+        file->offset == 0) {
+        ret = flb_tail_gz_check(file);
+        if (ret == -1) {
+            *out_bytes = 0;
+            return FLB_TAIL_WAIT;
+        }
+    }
+
+    if (file->gz) {
+#ifdef FLB_HAVE_SQLDB
+        if (ctx->db) {
+            flb_tail_gz_checkpoint(file);
+        }
+#endif
+        bytes = flb_tail_gz_read(file, file->buf_data + file->buf_start +
+                                 file->buf_len, capacity);
+    }
+    else {
+        bytes = read(file->fd,
+                     file->buf_data + file->buf_start + file->buf_len,
+                     capacity);
+    }
+    *out_bytes = bytes;
     if (bytes > 0) {
         /* we read some data, let the content processor take care of it */
         file->buf_len += bytes;
-        file->buf_data[file->buf_len] = '\0';
+        file->buf_data[file->buf_start + file->buf_len] = '\0';
 
         /* Now that we have some data in the buffer, call the data processor
          * which aims to cut lines and register the entries into the engine.
@@ -921,28 +1097,23 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
          * now. It may need to get back a few bytes at the beginning of a new
          * line.
          */
-        ret = process_content(file, &processed_bytes);
+        ret = process_content(file, out, &processed_bytes);
         if (ret >= 0) {
             flb_debug("[in_tail] file=%s read=%lu lines=%i",
-                      file->name, bytes, ret);
+                      out->name, bytes, ret);
         }
         else {
-            flb_debug("[in_tail] file=%s ERROR", file->name);
+            flb_debug("[in_tail] file=%s ERROR", out->name);
             return FLB_TAIL_ERROR;
         }
 
-
-        /* Adjust the file offset and buffer */
-        file->offset += processed_bytes;
-        consume_bytes(file->buf_data, processed_bytes, file->buf_len);
+        /*
+         * Adjust the buffer, the file offset is moved forward by the caller
+         * once the records are registered.
+         */
+        out->processed += processed_bytes;
+        file->buf_start += processed_bytes;
         file->buf_len -= processed_bytes;
-        file->buf_data[file->buf_len] = '\0';
-
-#ifdef FLB_HAVE_SQLDB
-        if (file->config->db) {
-            flb_tail_db_file_offset(file, file->config);
-        }
-#endif
 
         /* Data was consumed but likely some bytes still remain */
         return FLB_TAIL_OK;
@@ -954,16 +1125,132 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
     else {
         /* error */
         flb_errno();
-        flb_error("[in_tail] error reading %s", file->name);
+        flb_error("[in_tail] error reading %s", out->name);
         return FLB_TAIL_ERROR;
     }
 
     return FLB_TAIL_ERROR;
 }
 
+/*
+ * Read a file up to its budget for the current collection round, a file
+ * with a big backlog is continued on the next rounds so it cannot hold the
+ * event loop. The records are packed in the buffer of 'out', the file
+ * offset is not modified: the caller must pass the result to
+ * flb_tail_file_commit() from the engine thread.
+ *
+ * This function can run in a reader thread, it only touches the buffer of
+ * the file.
+ */
+int flb_tail_file_read(struct flb_tail_file *file,
+                       struct flb_tail_file_out *out)
+{
+    int ret;
+    ssize_t bytes;
+
+    out->read = 0;
+    out->processed = 0;
+    do {
+        ret = file_read(file, out, &bytes);
+        if (ret != FLB_TAIL_OK) {
+            break;
+        }
+        out->read += bytes;
+    } while (out->read < file->config->file_read_budget);
+
+    /* Some data was read before reaching the end of the file */
+    if (ret == FLB_TAIL_WAIT && out->read > 0) {
+        return FLB_TAIL_OK;
+    }
+
+    return ret;
+}
+
+/* Register the records read from a file and move its offset forward */
+void flb_tail_file_commit(struct flb_tail_file *file,
+                          const char *buf, size_t size,
+                          off_t processed, size_t read)
+{
+    struct flb_tail_config *ctx = file->config;
+
+    if (size > 0) {
+        flb_input_chunk_append_raw(ctx->i_ins,
+                                   file->tag_buf,
+                                   file->tag_len,
+                                   buf, size);
+    }
+
+    file->offset += processed;
+    file->last_read = read;
+
+#ifdef FLB_HAVE_SQLDB
+    if (ctx->db && (read > 0 || file->gz_ckpt_dirty == FLB_TRUE)) {
+        flb_tail_db_file_offset_update(file, ctx);
+    }
+#endif
+}
+
+/* The file was truncated, read it again from the beginning */
+int flb_tail_file_rewind(struct flb_tail_file *file)
+{
+    off_t offset;
+
+    offset = lseek(file->fd, 0, SEEK_SET);
+    if (offset == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    flb_debug("[in_tail] truncated %s", file->name);
+    file->offset = offset;
+    file->buf_len = 0;
+    flb_tail_gz_rewind(file);
+
+    /* Update offset in the database file */
+#ifdef FLB_HAVE_SQLDB
+    if (file->config->db) {
+        flb_tail_db_file_offset(file, file->config);
+    }
+#endif
+
+    return 0;
+}
+
+/* Read a file from the engine thread, 'last_read' gets the bytes read */
+int flb_tail_file_chunk(struct flb_tail_file *file)
+{
+    int ret;
+    struct flb_tail_file_out out;
+    struct flb_tail_config *ctx = file->config;
+
+    /* Check if we the engine issued a pause */
+    file->last_read = 0;
+    if (flb_input_buf_paused(ctx->i_ins) == FLB_TRUE) {
+        return FLB_TAIL_BUSY;
+    }
+
+    /*
+     * Records are packed in the buffer owned by the plugin context, it
+     * keeps its allocation across calls.
+     */
+    out.name = file->name;
+    out.name_len = file->name_len;
+    out.parser = ctx->parser;
+    out.mp_sbuf = &ctx->mp_sbuf;
+    out.mp_pck = &ctx->mp_pck;
+    msgpack_sbuffer_clear(out.mp_sbuf);
+
+    ret = flb_tail_file_read(file, &out);
+    flb_tail_file_commit(file, out.mp_sbuf->data, out.mp_sbuf->size,
+                         out.processed, out.read);
+
+    return ret;
+}
+
 int flb_tail_file_to_event(struct flb_tail_file *file)
 {
     int ret;
+    off_t pending;
     char *name;
     struct stat st;
     struct stat st_rotated;
@@ -974,8 +1261,9 @@ int flb_tail_file_to_event(struct flb_tail_file *file)
         return -1;
     }
 
-    if (file->offset < st.st_size) {
-        file->pending_bytes = (st.st_size - file->offset);
+    pending = flb_tail_file_pending(file, &st);
+    if (pending > 0) {
+        file->pending_bytes = pending;
         tail_signal_pending(file->config);
     }
     else {
@@ -1167,8 +1455,10 @@ int flb_tail_file_rotated(struct flb_tail_file *file)
 #endif
 
     /* Update local file entry */
+    hash_del_name(file);
     tmp        = file->name;
     flb_tail_file_name_dup(name, file);
+    hash_add_name(file);
 
     if (file->rotated == 0) {
         file->rotated = time(NULL);
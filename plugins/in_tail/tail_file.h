@@ -36,6 +36,17 @@
 #define FLB_HASH_TABLE_SIZE 50
 #endif
 
+/* Destination of the records packed by flb_tail_file_read() */
+struct flb_tail_file_out {
+    char *name;                 /* value of the path key           */
+    size_t name_len;
+    struct flb_parser *parser;  /* parser, NULL for raw lines      */
+    msgpack_sbuffer *mp_sbuf;
+    msgpack_packer *mp_pck;
+    off_t processed;            /* bytes to move the offset forward */
+    size_t read;                /* bytes read from the file         */
+};
+
 static inline int flb_tail_file_name_cmp(char *name,
                                         struct flb_tail_file *file)
 {
@@ -51,6 +62,12 @@ static inline int flb_tail_file_name_cmp(char *name,
 int flb_tail_file_name_dup(char *path, struct flb_tail_file *file);
 int flb_tail_file_to_event(struct flb_tail_file *file);
 int flb_tail_file_chunk(struct flb_tail_file *file);
+int flb_tail_file_read(struct flb_tail_file *file,
+                       struct flb_tail_file_out *out);
+void flb_tail_file_commit(struct flb_tail_file *file,
+                          const char *buf, size_t size,
+                          off_t processed, size_t read);
+int flb_tail_file_rewind(struct flb_tail_file *file);
 int flb_tail_file_append(char *path, struct stat *st, int mode,
                          struct flb_tail_config *ctx);
 int flb_tail_file_exists(char *f, struct flb_tail_config *ctx);
@@ -61,8 +78,8 @@ int flb_tail_file_rotated(struct flb_tail_file *file);
 int flb_tail_file_rotated_purge(struct flb_input_instance *i_ins,
                                 struct flb_config *config, void *context);
 int flb_tail_pack_line_map(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                           struct flb_time *time, char **data,
-                           size_t *data_size, struct flb_tail_file *file);
+                           struct flb_time *time, const char *data,
+                           size_t data_size, struct flb_tail_file *file);
 int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
                             struct flb_time *time, char *data, size_t data_size,
                             struct flb_tail_file *file);
@@ -43,6 +43,7 @@ struct flb_tail_file {
 #else
     ino_t inode;
 #endif
+    uint64_t dev;
     char *name;                 /* target file name given by scan routine */
 #if !defined(__linux)
     char *real_name;            /* real file name in the file system */
@@ -50,6 +51,7 @@ struct flb_tail_file {
     size_t name_len;
     time_t rotated;
     off_t pending_bytes;
+    size_t last_read;           /* bytes read by the last chunk call  */
 
     /* dynamic tag for this file */
     int tag_len;
@@ -63,15 +65,19 @@ struct flb_tail_file {
     msgpack_sbuffer mult_sbuf;  /* temporal msgpack buffer               */
     msgpack_packer mult_pck;    /* temporal msgpack packer               */
     struct flb_time mult_time;  /* multiline time parsed from first line */
+    int mult_state;             /* current state of the multiline rules  */
+    flb_sds_t mult_text;        /* lines joined by the multiline rules   */
 
     /* docker mode */
     time_t dmode_flush_timeout; /* time when docker mode started         */
-    flb_sds_t dmode_buf;        /* buffer for docker mode                */
-    flb_sds_t dmode_lastline;   /* last incomplete line                  */
+    flb_sds_t dmode_buf;        /* pieces of a long line joined          */
+    flb_sds_t dmode_lastline;   /* end of the last piece                 */
+    int dmode_complete;         /* bool: dmode_buf is a complete line ?  */
 
     /* buffering */
     off_t parsed;
-    off_t buf_len;
+    off_t buf_len;              /* pending bytes, from buf_start         */
+    size_t buf_start;           /* offset of the pending bytes           */
     size_t buf_size;
     char *buf_data;
 
@@ -87,11 +93,41 @@ struct flb_tail_file {
     /* Did the plugin already warn the user about long lines ? */
     int skip_warn;
 
+    /*
+     * Compressed files, see tail_gzip.c. The offset of these files counts
+     * inflated bytes.
+     */
+    struct flb_gzip_inflate *gz; /* inflate context, NULL if not gzip   */
+    char *gz_buf;              /* compressed bytes not inflated yet     */
+    size_t gz_len;
+    off_t gz_pos;              /* compressed bytes inflated             */
+    off_t gz_skip;             /* inflated bytes read before a restart  */
+    int gz_more;               /* bool: more output may be pending ?    */
+    int gz_checked;            /* bool: magic bytes checked ?           */
+    off_t gz_out;              /* inflated bytes, skipped ones included */
+
+    /* inflate checkpoint saved in the database */
+    char *gz_ckpt;
+    size_t gz_ckpt_size;
+    size_t gz_ckpt_len;        /* 0 if there is no checkpoint           */
+    off_t gz_ckpt_out;         /* inflated bytes when it was taken      */
+    off_t gz_ckpt_offset;      /* offset of its first pending byte      */
+    int gz_ckpt_dirty;         /* bool: not written to the database ?   */
+
     /* Opaque data type for specific fs-event backend data */
     void *fs_backend;
 
+    /* reader thread, see tail_thread.c */
+    int thread_busy;           /* owned by a reader thread ?          */
+    int thread_remove;         /* remove once the reader is done      */
+    char *thread_name;         /* copy of the name used by the reader */
+    off_t thread_pos;          /* read position when it was handed    */
+    int thread_truncated;      /* truncated while the reader had it ? */
+    struct mk_list _thread_head;
+
     /* database reference */
     uint64_t db_id;
+    int db_dirty;              /* offset not yet written to the database */
 
     /* reference */
     int tail_mode;
@@ -22,42 +22,309 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_sds.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
 #include <sys/inotify.h>
 
 #include "tail_config.h"
 #include "tail_file.h"
 #include "tail_db.h"
+#include "tail_scan.h"
 #include "tail_signal.h"
+#include "tail_gzip.h"
 
 #include <limits.h>
 #include <fcntl.h>
 
-static int tail_fs_event(struct flb_input_instance *i_ins,
-                         struct flb_config *config, void *in_context)
+#define TAIL_DIR_EVENTS  (IN_CREATE | IN_MOVED_TO | IN_MOVE_SELF | IN_ONLYDIR)
+
+/*
+ * New files are discovered by watching the directories covered by the path
+ * pattern. The pattern is split in components: the directories up to the
+ * first one with wildcards are fixed and only the deepest one is watched.
+ * Below it, every directory matching the next component is watched too, so
+ * a new directory is watched as soon as it's created. A watched directory
+ * of 'level' N contains the entries matched by the component N.
+ */
+struct tail_dir {
+    int wd;
+    int level;
+    flb_sds_t path;
+    struct mk_list _head;
+};
+
+static int has_wildcards(const char *str)
+{
+    return strpbrk(str, "*?[") != NULL;
+}
+
+/* Split the path pattern, returns -1 if the directories cannot be watched */
+static int dir_pattern_create(struct flb_tail_config *ctx)
+{
+    int i;
+    int n = 0;
+    int len;
+    const char *p;
+    const char *end;
+
+    p = ctx->path;
+    if (p[0] == '~') {
+        return -1;
+    }
+
+    for (i = 0; p[i] != '\0'; i++) {
+        if (p[i] == '/') {
+            n++;
+        }
+    }
+
+    ctx->dir_comps = flb_calloc(n + 1, sizeof(flb_sds_t));
+    if (!ctx->dir_comps) {
+        flb_errno();
+        return -1;
+    }
+
+    /* Components, empty ones (e.g: '//') are skipped */
+    n = 0;
+    while (*p) {
+        end = strchr(p, '/');
+        len = end ? end - p : strlen(p);
+        if (len > 0) {
+            ctx->dir_comps[n] = flb_sds_create_len(p, len);
+            if (!ctx->dir_comps[n]) {
+                return -1;
+            }
+            n++;
+        }
+        if (!end) {
+            break;
+        }
+        p = end + 1;
+    }
+    ctx->dir_comps_n = n;
+    if (n == 0) {
+        return -1;
+    }
+
+    /* First component with wildcards, the file name at most */
+    for (i = 0; i < n - 1; i++) {
+        if (has_wildcards(ctx->dir_comps[i])) {
+            break;
+        }
+    }
+    ctx->dir_level = i;
+
+    /* Fixed directory, an empty root means the working directory */
+    ctx->dir_root = flb_sds_create(ctx->path[0] == '/' ? "/" : "");
+    if (!ctx->dir_root) {
+        return -1;
+    }
+    for (i = 0; i < ctx->dir_level; i++) {
+        if (i > 0) {
+            ctx->dir_root = flb_sds_cat(ctx->dir_root, "/", 1);
+        }
+        ctx->dir_root = flb_sds_cat(ctx->dir_root, ctx->dir_comps[i],
+                                    flb_sds_len(ctx->dir_comps[i]));
+    }
+
+    return 0;
+}
+
+static flb_sds_t dir_path_join(const char *dir, const char *name)
 {
+    int len;
+    flb_sds_t path;
+
+    len = strlen(dir);
+    path = flb_sds_create_size(len + strlen(name) + 2);
+    if (!path) {
+        return NULL;
+    }
+    if (len > 0) {
+        path = flb_sds_cat(path, dir, len);
+        if (dir[len - 1] != '/') {
+            path = flb_sds_cat(path, "/", 1);
+        }
+    }
+    return flb_sds_cat(path, name, strlen(name));
+}
+
+static struct tail_dir *dir_lookup(struct flb_tail_config *ctx, int wd)
+{
+    int len;
     int ret;
-    off_t offset;
+    char key[32];
+    size_t size;
+    const char *val;
+    struct tail_dir *dir;
+
+    len = snprintf(key, sizeof(key), "%i", wd);
+    ret = flb_hash_get(ctx->dir_watches, key, len, &val, &size);
+    if (ret == -1) {
+        return NULL;
+    }
+    memcpy(&dir, val, sizeof(dir));
+    return dir;
+}
+
+static void dir_remove(struct flb_tail_config *ctx, struct tail_dir *dir)
+{
+    char key[32];
+
+    snprintf(key, sizeof(key), "%i", dir->wd);
+    flb_hash_del(ctx->dir_watches, key);
+    mk_list_del(&dir->_head);
+    flb_sds_destroy(dir->path);
+    flb_free(dir);
+}
+
+/* Watch a directory and the ones below it covered by the pattern */
+static void dir_watch(struct flb_tail_config *ctx, const char *path, int level)
+{
+    int wd;
+    int len;
+    char key[32];
+    DIR *d;
+    struct dirent *ent;
+    struct stat st;
+    struct tail_dir *dir;
+    flb_sds_t child;
+
+    wd = inotify_add_watch(ctx->fd_notify, *path ? path : ".",
+                           TAIL_DIR_EVENTS);
+    if (wd == -1) {
+        flb_debug("[in_tail] cannot watch directory %s", *path ? path : ".");
+        return;
+    }
+
+    if (!dir_lookup(ctx, wd)) {
+        dir = flb_malloc(sizeof(struct tail_dir));
+        if (!dir) {
+            flb_errno();
+            inotify_rm_watch(ctx->fd_notify, wd);
+            return;
+        }
+        dir->wd = wd;
+        dir->level = level;
+        dir->path = flb_sds_create(path);
+        if (!dir->path) {
+            flb_free(dir);
+            inotify_rm_watch(ctx->fd_notify, wd);
+            return;
+        }
+
+        len = snprintf(key, sizeof(key), "%i", wd);
+        if (flb_hash_add(ctx->dir_watches, key, len,
+                         (char *) &dir, sizeof(dir)) == -1) {
+            flb_sds_destroy(dir->path);
+            flb_free(dir);
+            inotify_rm_watch(ctx->fd_notify, wd);
+            return;
+        }
+        mk_list_add(&dir->_head, &ctx->dir_list);
+        flb_debug("[in_tail] watching directory %s", *path ? path : ".");
+    }
+
+    /* The last level only contains files */
+    if (level >= ctx->dir_comps_n - 1) {
+        return;
+    }
+
+    d = opendir(*path ? path : ".");
+    if (!d) {
+        return;
+    }
+    while ((ent = readdir(d))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0 ||
+            fnmatch(ctx->dir_comps[level], ent->d_name, FNM_PERIOD) != 0) {
+            continue;
+        }
+        child = dir_path_join(path, ent->d_name);
+        if (!child) {
+            continue;
+        }
+        if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+            dir_watch(ctx, child, level + 1);
+        }
+        flb_sds_destroy(child);
+    }
+    closedir(d);
+}
+
+/* An entry was created or moved into a watched directory */
+static void dir_event(struct flb_tail_config *ctx, struct tail_dir *dir,
+                      struct inotify_event *ev)
+{
+    int i;
+    int ret = FLB_FALSE;
+    flb_sds_t path;
+
+    if (ev->mask & IN_IGNORED) {
+        dir_remove(ctx, dir);
+        return;
+    }
+
+    /* The directory path is not longer valid, IN_IGNORED will follow */
+    if (ev->mask & IN_MOVE_SELF) {
+        inotify_rm_watch(ctx->fd_notify, dir->wd);
+        return;
+    }
+
+    if (ev->len == 0 ||
+        fnmatch(ctx->dir_comps[dir->level], ev->name, FNM_PERIOD) != 0) {
+        return;
+    }
+
+    path = dir_path_join(dir->path, ev->name);
+    if (!path) {
+        return;
+    }
+
+    if (dir->level == ctx->dir_comps_n - 1) {
+        if (!(ev->mask & IN_ISDIR)) {
+            ret = flb_tail_scan_file(path, ctx);
+        }
+    }
+    else if (ev->mask & IN_ISDIR) {
+        dir_watch(ctx, path, dir->level + 1);
+
+        /* Evaluate the rest of the pattern under the new directory */
+        for (i = dir->level + 1; i < ctx->dir_comps_n; i++) {
+            path = flb_sds_cat(path, "/", 1);
+            path = flb_sds_cat(path, ctx->dir_comps[i],
+                               flb_sds_len(ctx->dir_comps[i]));
+        }
+        flb_tail_scan(path, ctx);
+        ret = FLB_TRUE;
+    }
+    flb_sds_destroy(path);
+
+    if (ret == FLB_TRUE) {
+        tail_signal_manager(ctx);
+    }
+}
+
+static int tail_fs_file_event(struct flb_tail_config *ctx,
+                              struct flb_config *config,
+                              struct inotify_event *ev)
+{
+    int ret;
+    off_t pending;
     struct mk_list *head;
     struct mk_list *tmp;
-    struct flb_tail_config *ctx = in_context;
     struct flb_tail_file *file = NULL;
-    struct inotify_event ev;
     struct stat st;
 
-    /* Read the event */
-    ret  = read(ctx->fd_notify, &ev, sizeof(struct inotify_event));
-    if (ret < 1) {
-        return -1;
-    }
-
     /* Lookup watched file */
     mk_list_foreach_safe(head, tmp, &ctx->files_event) {
         file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (file->watch_fd != ev.wd) {
+        if (file->watch_fd != ev->wd) {
             file = NULL;
             continue;
         }
@@ -69,12 +336,12 @@ static int tail_fs_event(struct flb_input_instance *i_ins,
     }
 
     /* Check if the file was rotated */
-    if (ev.mask & IN_MOVE_SELF) {
+    if (ev->mask & IN_MOVE_SELF) {
         flb_tail_file_rotated(file);
     }
 
     /* File was removed ? */
-    if (ev.mask & IN_ATTRIB) {
+    if (ev->mask & IN_ATTRIB) {
         ret = fstat(file->fd, &st);
         if (ret == -1) {
             flb_debug("[in_tail] error stat(2) %s, removing", file->name);
@@ -98,13 +365,13 @@ static int tail_fs_event(struct flb_input_instance *i_ins,
         }
     }
 
-    if (ev.mask & IN_IGNORED) {
+    if (ev->mask & IN_IGNORED) {
         flb_debug("[in_tail] removed %s", file->name);
         flb_tail_file_remove(file);
         return 0;
     }
 
-    if (ev.mask & IN_MODIFY) {
+    if (ev->mask & IN_MODIFY) {
         /*
          * The file was modified, check how many new bytes do
          * we have.
@@ -115,29 +382,27 @@ static int tail_fs_event(struct flb_input_instance *i_ins,
             return -1;
         }
 
-        /* Check if the file was truncated */
-        if (file->offset > st.st_size) {
-            offset = lseek(file->fd, 0, SEEK_SET);
-            if (offset == -1) {
-                flb_errno();
-                return -1;
+        /*
+         * Check if the file was truncated. The read position of a file owned
+         * by a reader thread is not stable, it's compared with the one it
+         * had when it was handed and rewound once the reader is done.
+         */
+        if (file->thread_busy == FLB_TRUE) {
+            if (st.st_size < file->thread_pos) {
+                file->thread_truncated = FLB_TRUE;
             }
-
-            flb_debug("[in_tail] truncated %s", file->name);
-            file->offset = offset;
-            file->buf_len = 0;
-
-            /* Update offset in the database file */
-#ifdef FLB_HAVE_SQLDB
-            if (ctx->db) {
-                flb_tail_db_file_offset(file, ctx);
+        }
+        else if (flb_tail_file_truncated(file, &st)) {
+            if (flb_tail_file_rewind(file) == -1) {
+                return -1;
             }
-#endif
         }
 
         /* Collect the data */
         ret = in_tail_collect_event(file, config);
-        if (ret != FLB_TAIL_ERROR) {
+
+        /* A reader owns the file now, it checks the pending bytes when done */
+        if (ret != FLB_TAIL_ERROR && file->thread_busy == FLB_FALSE) {
             /*
              * Due to read buffer size capacity, there are some cases where the
              * read operation cannot consume all new data available on one
@@ -152,8 +417,9 @@ static int tail_fs_event(struct flb_input_instance *i_ins,
              * read(2) operation, that might kill performance. Just let's
              * wait a second and do a good job.
              */
-            if (file->offset < st.st_size) {
-                file->pending_bytes = (st.st_size - file->offset);
+            pending = flb_tail_file_pending(file, &st);
+            if (pending > 0) {
+                file->pending_bytes = pending;
                 tail_signal_pending(ctx);
             }
             else {
@@ -166,6 +432,104 @@ static int tail_fs_event(struct flb_input_instance *i_ins,
     return 0;
 }
 
+static int tail_fs_event(struct flb_input_instance *i_ins,
+                         struct flb_config *config, void *in_context)
+{
+    int ret;
+    ssize_t bytes;
+    char *p;
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    struct tail_dir *dir;
+    struct flb_tail_config *ctx = in_context;
+
+    /*
+     * Read the events: the ones of the directories carry the entry name
+     * so every event has a variable length.
+     */
+    bytes = read(ctx->fd_notify, buf, sizeof(buf));
+    if (bytes < 1) {
+        return -1;
+    }
+
+    ret = 0;
+    p = buf;
+    while (p < buf + bytes) {
+        ev = (struct inotify_event *) p;
+        p += sizeof(struct inotify_event) + ev->len;
+
+        /* Events were lost, the whole pattern must be scanned again */
+        if (ev->mask & IN_Q_OVERFLOW) {
+            flb_warn("[in_tail] inotify events queue overflow, re-scanning");
+            flb_tail_scan(ctx->path, ctx);
+            tail_signal_manager(ctx);
+            continue;
+        }
+
+        if (ctx->dir_watches) {
+            dir = dir_lookup(ctx, ev->wd);
+            if (dir) {
+                dir_event(ctx, dir, ev);
+                continue;
+            }
+        }
+
+        ret = tail_fs_file_event(ctx, config, ev);
+    }
+
+    return ret;
+}
+
+/* Watch the directories covered by the path pattern */
+static int tail_fs_dirs_init(struct flb_tail_config *ctx)
+{
+    mk_list_init(&ctx->dir_list);
+    if (dir_pattern_create(ctx) == -1) {
+        flb_debug("[in_tail] new files in %s are found by scans only",
+                  ctx->path);
+        return -1;
+    }
+
+    ctx->dir_watches = flb_hash_create(FLB_HASH_EVICT_NONE,
+                                       FLB_TAIL_HASH_SIZE, 0);
+    if (!ctx->dir_watches) {
+        return -1;
+    }
+
+    dir_watch(ctx, ctx->dir_root, ctx->dir_level);
+    return 0;
+}
+
+static void tail_fs_dirs_exit(struct flb_tail_config *ctx)
+{
+    int i;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct tail_dir *dir;
+
+    if (ctx->dir_watches) {
+        mk_list_foreach_safe(head, tmp, &ctx->dir_list) {
+            dir = mk_list_entry(head, struct tail_dir, _head);
+            dir_remove(ctx, dir);
+        }
+        flb_hash_destroy(ctx->dir_watches);
+        ctx->dir_watches = NULL;
+    }
+
+    if (ctx->dir_comps) {
+        for (i = 0; i < ctx->dir_comps_n; i++) {
+            flb_sds_destroy(ctx->dir_comps[i]);
+        }
+        flb_free(ctx->dir_comps);
+        ctx->dir_comps = NULL;
+    }
+    if (ctx->dir_root) {
+        flb_sds_destroy(ctx->dir_root);
+        ctx->dir_root = NULL;
+    }
+}
+
 /* File System events based on Inotify(2). Linux >= 2.6.32 is suggested */
 int flb_tail_fs_init(struct flb_input_instance *in,
                      struct flb_tail_config *ctx, struct flb_config *config)
@@ -191,9 +555,22 @@ int flb_tail_fs_init(struct flb_input_instance *in,
     }
     ctx->coll_fd_fs1 = ret;
 
+    /* New files are found through their directories */
+    if (tail_fs_dirs_init(ctx) == -1) {
+        tail_fs_dirs_exit(ctx);
+    }
+
     return 0;
 }
 
+/* Periodic scan: watch the directories that could not be watched before */
+void flb_tail_fs_rescan(struct flb_tail_config *ctx)
+{
+    if (ctx->dir_watches) {
+        dir_watch(ctx, ctx->dir_root, ctx->dir_level);
+    }
+}
+
 void flb_tail_fs_pause(struct flb_tail_config *ctx)
 {
     flb_input_collector_pause(ctx->coll_fd_fs1, ctx->i_ins);
@@ -247,6 +624,7 @@ int flb_tail_fs_remove(struct flb_tail_file *file)
 
 int flb_tail_fs_exit(struct flb_tail_config *ctx)
 {
-    (void) ctx;
+    tail_fs_dirs_exit(ctx);
+    close(ctx->fd_notify);
     return 0;
 }
@@ -31,6 +31,7 @@
 #include "tail_db.h"
 #include "tail_config.h"
 #include "tail_signal.h"
+#include "tail_gzip.h"
 
 struct fs_stat {
     /* last time check */
@@ -83,7 +84,7 @@ static int tail_fs_check(struct flb_input_instance *i_ins,
                          struct flb_config *config, void *in_context)
 {
     int ret;
-    off_t offset;
+    off_t pending;
     char *name;
     struct mk_list *tmp;
     struct mk_list *head;
@@ -135,27 +136,29 @@ static int tail_fs_check(struct flb_input_instance *i_ins,
         }
         flb_free(name);
 
-        /* Check if the file was truncated */
-        if (file->offset > st.st_size) {
-            offset = lseek(file->fd, 0, SEEK_SET);
-            if (offset == -1) {
-                flb_errno();
-                return -1;
+        /*
+         * Check if the file was truncated. The read position of a file owned
+         * by a reader thread is not stable, it's compared with the one it
+         * had when it was handed and rewound once the reader is done, the
+         * reader also checks the pending bytes then.
+         */
+        if (file->thread_busy == FLB_TRUE) {
+            if (st.st_size < file->thread_pos) {
+                file->thread_truncated = FLB_TRUE;
             }
+            continue;
+        }
 
-            flb_debug("[in_tail] truncated %s", file->name);
-            file->offset = offset;
-            file->buf_len = 0;
-            memcpy(&fst->st, &st, sizeof(struct stat));
-
-            /* Update offset in database file */
-            if (ctx->db) {
-                flb_tail_db_file_offset(file, ctx);
+        if (flb_tail_file_truncated(file, &st)) {
+            if (flb_tail_file_rewind(file) == -1) {
+                return -1;
             }
+            memcpy(&fst->st, &st, sizeof(struct stat));
         }
 
-        if (file->offset < st.st_size) {
-            file->pending_bytes = (st.st_size - file->offset);
+        pending = flb_tail_file_pending(file, &st);
+        if (pending > 0) {
+            file->pending_bytes = pending;
             tail_signal_pending(ctx);
         }
         else {
@@ -234,6 +237,12 @@ int flb_tail_fs_remove(struct flb_tail_file *file)
     return 0;
 }
 
+/* New files are only found by the periodic scans */
+void flb_tail_fs_rescan(struct flb_tail_config *ctx)
+{
+    (void) ctx;
+}
+
 int flb_tail_fs_exit(struct flb_tail_config *ctx)
 {
     (void) ctx;
@@ -0,0 +1,343 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_gzip.h>
+
+#include "tail_config.h"
+#include "tail_file.h"
+#include "tail_gzip.h"
+
+/*
+ * Compressed files
+ * ================
+ * Rotated files are often compressed by logrotate before we finished
+ * reading them. A file starting with the GZip magic bytes is inflated on
+ * the fly while it's read: the content is read in 'gz_buf' and inflated in
+ * the buffer of the file, the lines processing is the same for both.
+ *
+ * The offset of a compressed file (the one saved in the database) counts
+ * inflated bytes. A deflate stream cannot be resumed from the middle
+ * without the status of the inflater, so when a database is used the file
+ * keeps a checkpoint: the inflate status, the position of the compressed
+ * bytes and the inflated bytes not processed yet. It's taken before a read
+ * every FLB_TAIL_GZ_CKPT inflated bytes or when the reader caught up, and
+ * saved with the offset once that one reached it.
+ *
+ * After a restart the inflate resumes from the checkpoint, the content
+ * delivered after it is dropped without being processed. Without one the
+ * file is inflated again from the beginning.
+ */
+
+/* Header of a checkpoint, followed by the inflate and pending bytes */
+#define FLB_TAIL_GZ_CKPT_MAGIC  0x464c4254   /* 'FLBT' */
+
+struct tail_gz_checkpoint {
+    uint32_t magic;
+    uint32_t pad;
+    uint64_t inode;
+    uint64_t pos;              /* compressed bytes inflated             */
+    uint64_t out;              /* inflated bytes                        */
+    uint64_t inflate;          /* size of the inflate status            */
+    uint64_t pending;          /* inflated bytes not processed          */
+};
+
+/*
+ * Check the magic bytes of a file not read yet and prepare the inflate
+ * context. Returns FLB_TRUE for a GZip file, FLB_FALSE if it's not and -1
+ * if the file is too small to know.
+ */
+int flb_tail_gz_check(struct flb_tail_file *file)
+{
+    ssize_t bytes;
+    unsigned char magic[2];
+
+    if (file->gz_checked == FLB_TRUE) {
+        return file->gz ? FLB_TRUE : FLB_FALSE;
+    }
+
+    bytes = read(file->fd, magic, sizeof(magic));
+    if (lseek(file->fd, 0, SEEK_SET) == -1) {
+        flb_errno();
+        return -1;
+    }
+    if (bytes < (ssize_t) sizeof(magic)) {
+        return -1;
+    }
+    file->gz_checked = FLB_TRUE;
+
+    if (magic[0] != 0x1F || magic[1] != 0x8B) {
+        return FLB_FALSE;
+    }
+
+    file->gz = flb_gzip_inflate_create();
+    if (!file->gz) {
+        return -1;
+    }
+    file->gz_buf = flb_malloc(FLB_TAIL_GZ_BUF);
+    if (!file->gz_buf) {
+        flb_errno();
+        flb_gzip_inflate_destroy(file->gz);
+        file->gz = NULL;
+        return -1;
+    }
+    file->gz_len = 0;
+    file->gz_pos = 0;
+    file->gz_more = FLB_FALSE;
+
+    /* content delivered before a restart */
+    file->gz_skip = file->offset;
+
+    flb_debug("[in_tail] file=%s is gzip compressed", file->name);
+    return FLB_TRUE;
+}
+
+/*
+ * Read and inflate the next content of a compressed file. Returns the
+ * number of bytes stored in 'buf', 0 if no more content is available yet
+ * and -1 on error.
+ */
+ssize_t flb_tail_gz_read(struct flb_tail_file *file, char *buf, size_t size)
+{
+    int eof = FLB_FALSE;
+    size_t used;
+    ssize_t bytes;
+    ssize_t out;
+
+    while (1) {
+        if (!eof && file->gz_len < FLB_TAIL_GZ_BUF) {
+            bytes = read(file->fd, file->gz_buf + file->gz_len,
+                         FLB_TAIL_GZ_BUF - file->gz_len);
+            if (bytes == -1) {
+                return -1;
+            }
+            eof = (bytes == 0);
+            file->gz_len += bytes;
+        }
+
+        out = flb_gzip_inflate_read(file->gz, file->gz_buf, file->gz_len,
+                                    &used, buf, size);
+        if (out == -1) {
+            flb_error("[in_tail] file=%s invalid gzip content", file->name);
+            return -1;
+        }
+        if (used > 0) {
+            memmove(file->gz_buf, file->gz_buf + used, file->gz_len - used);
+            file->gz_len -= used;
+            file->gz_pos += used;
+        }
+        file->gz_more = ((size_t) out == size);
+        file->gz_out += out;
+
+        /* drop what was delivered before a restart */
+        if (file->gz_skip > 0 && out > 0) {
+            if (out <= file->gz_skip) {
+                file->gz_skip -= out;
+                continue;
+            }
+            memmove(buf, buf + file->gz_skip, out - file->gz_skip);
+            out -= file->gz_skip;
+            file->gz_skip = 0;
+        }
+
+        if (out > 0) {
+            return out;
+        }
+        else if (eof) {
+            return 0;
+        }
+        else if (file->gz_len == FLB_TAIL_GZ_BUF) {
+            /* a full buffer and no progress, this is not gzip content */
+            flb_error("[in_tail] file=%s invalid gzip content", file->name);
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Take a checkpoint of the file before reading it. The pending bytes of the
+ * file buffer are part of it, it's not taken while content is skipped.
+ */
+void flb_tail_gz_checkpoint(struct flb_tail_file *file)
+{
+    size_t size;
+    size_t inflate;
+    char *tmp;
+    struct tail_gz_checkpoint *ck;
+
+    if (file->gz_skip > 0 || file->skip_next == FLB_TRUE ||
+        file->gz_out == file->gz_ckpt_out) {
+        return;
+    }
+    if (file->gz_more == FLB_TRUE &&
+        file->gz_out - file->gz_ckpt_out < FLB_TAIL_GZ_CKPT) {
+        return;
+    }
+
+    inflate = flb_gzip_inflate_checkpoint_size(file->gz);
+    size = sizeof(struct tail_gz_checkpoint) + inflate + file->buf_len;
+    if (size > file->gz_ckpt_size) {
+        tmp = flb_realloc(file->gz_ckpt, size);
+        if (!tmp) {
+            flb_errno();
+            return;
+        }
+        file->gz_ckpt = tmp;
+        file->gz_ckpt_size = size;
+    }
+
+    ck = (struct tail_gz_checkpoint *) file->gz_ckpt;
+    memset(ck, '\0', sizeof(struct tail_gz_checkpoint));
+    ck->magic = FLB_TAIL_GZ_CKPT_MAGIC;
+    ck->inode = file->inode;
+    ck->pos = file->gz_pos;
+    ck->out = file->gz_out;
+    ck->inflate = inflate;
+    ck->pending = file->buf_len;
+
+    tmp = file->gz_ckpt + sizeof(struct tail_gz_checkpoint);
+    flb_gzip_inflate_save(file->gz, tmp);
+    memcpy(tmp + inflate, file->buf_data + file->buf_start, file->buf_len);
+
+    file->gz_ckpt_len = size;
+    file->gz_ckpt_out = file->gz_out;
+    file->gz_ckpt_offset = file->gz_out - file->buf_len;
+    file->gz_ckpt_dirty = FLB_TRUE;
+}
+
+/*
+ * Resume the inflate of a file not read yet from a saved checkpoint, the
+ * offset must not be behind it. Returns -1 if it cannot be used, the file
+ * is inflated from the beginning then.
+ */
+int flb_tail_gz_restore(struct flb_tail_file *file,
+                        const void *data, size_t size)
+{
+    uint64_t drop;
+    uint64_t skip;
+    size_t len;
+    char *tmp;
+    const char *inflate;
+    const char *pending;
+    struct tail_gz_checkpoint ck;
+
+    if (size < sizeof(struct tail_gz_checkpoint)) {
+        return -1;
+    }
+    memcpy(&ck, data, sizeof(struct tail_gz_checkpoint));
+    if (ck.magic != FLB_TAIL_GZ_CKPT_MAGIC || ck.inode != file->inode ||
+        ck.pending > ck.out ||
+        ck.out - ck.pending > (uint64_t) file->offset ||
+        size != sizeof(struct tail_gz_checkpoint) + ck.inflate + ck.pending) {
+        return -1;
+    }
+
+    /*
+     * The pending bytes processed before the restart are dropped, if the
+     * offset is past them the next inflated bytes are skipped.
+     */
+    drop = file->offset - (ck.out - ck.pending);
+    if (drop < ck.pending) {
+        len = ck.pending - drop;
+        skip = 0;
+    }
+    else {
+        len = 0;
+        skip = drop - ck.pending;
+    }
+
+    if (len + 1 > file->buf_size) {
+        tmp = flb_realloc(file->buf_data, len + 1);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        file->buf_data = tmp;
+        file->buf_size = len + 1;
+    }
+
+    inflate = (const char *) data + sizeof(struct tail_gz_checkpoint);
+    if (flb_gzip_inflate_restore(file->gz, inflate, ck.inflate) == -1) {
+        flb_warn("[in_tail] file=%s invalid inflate checkpoint", file->name);
+        return -1;
+    }
+    if (lseek(file->fd, ck.pos, SEEK_SET) == -1) {
+        flb_errno();
+        flb_gzip_inflate_reset(file->gz);
+        return -1;
+    }
+
+    if (len > 0) {
+        pending = inflate + ck.inflate;
+        memcpy(file->buf_data, pending + drop, len);
+    }
+    file->buf_data[len] = '\0';
+    file->buf_start = 0;
+    file->buf_len = len;
+
+    file->gz_len = 0;
+    file->gz_pos = ck.pos;
+    file->gz_out = ck.out;
+    file->gz_skip = skip;
+    file->gz_more = FLB_TRUE;
+    file->gz_ckpt_out = ck.out;
+    file->gz_ckpt_offset = ck.out - ck.pending;
+    return 0;
+}
+
+/* The file was truncated, inflate it again from the beginning */
+void flb_tail_gz_rewind(struct flb_tail_file *file)
+{
+    if (!file->gz) {
+        return;
+    }
+
+    flb_gzip_inflate_reset(file->gz);
+    file->gz_len = 0;
+    file->gz_pos = 0;
+    file->gz_skip = 0;
+    file->gz_more = FLB_FALSE;
+    file->gz_out = 0;
+
+    /* the saved checkpoint is not valid anymore */
+    file->gz_ckpt_len = 0;
+    file->gz_ckpt_out = 0;
+    file->gz_ckpt_offset = 0;
+    file->gz_ckpt_dirty = FLB_TRUE;
+}
+
+void flb_tail_gz_destroy(struct flb_tail_file *file)
+{
+    if (file->gz) {
+        flb_gzip_inflate_destroy(file->gz);
+        file->gz = NULL;
+    }
+    flb_free(file->gz_buf);
+    file->gz_buf = NULL;
+    flb_free(file->gz_ckpt);
+    file->gz_ckpt = NULL;
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TAIL_GZIP_H
+#define FLB_TAIL_GZIP_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "tail_file.h"
+
+/* Size of the buffer for compressed bytes */
+#define FLB_TAIL_GZ_BUF  65536
+
+/* Inflated bytes between two checkpoints of a file */
+#define FLB_TAIL_GZ_CKPT 4194304
+
+int flb_tail_gz_check(struct flb_tail_file *file);
+ssize_t flb_tail_gz_read(struct flb_tail_file *file, char *buf, size_t size);
+void flb_tail_gz_checkpoint(struct flb_tail_file *file);
+int flb_tail_gz_restore(struct flb_tail_file *file,
+                        const void *data, size_t size);
+void flb_tail_gz_rewind(struct flb_tail_file *file);
+void flb_tail_gz_destroy(struct flb_tail_file *file);
+
+/* Bytes of the file content not consumed by the reader yet */
+static inline off_t flb_tail_file_pending(struct flb_tail_file *file,
+                                          struct stat *st)
+{
+    /*
+     * The offset of a compressed file is not comparable with its size, count
+     * the bytes not read yet plus one when inflated content is waiting.
+     */
+    if (file->gz) {
+        return (st->st_size - (off_t) (file->gz_pos + file->gz_len)) +
+               (file->gz_more ? 1 : 0);
+    }
+    return st->st_size - file->offset;
+}
+
+/* Position in the file of the content already read */
+static inline off_t flb_tail_file_read_pos(struct flb_tail_file *file)
+{
+    if (file->gz) {
+        return file->gz_pos + file->gz_len;
+    }
+    return file->offset;
+}
+
+/* Check if the file is now smaller than the content already read */
+static inline int flb_tail_file_truncated(struct flb_tail_file *file,
+                                          struct stat *st)
+{
+    return flb_tail_file_read_pos(file) > st->st_size;
+}
+
+#endif
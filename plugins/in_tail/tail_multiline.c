@@ -24,6 +24,7 @@
 
 #include "tail_config.h"
 #include "tail_multiline.h"
+#include "tail_multiline_rules.h"
 
 static int tail_mult_append(struct flb_parser *parser,
                             struct flb_tail_config *ctx)
@@ -52,6 +53,8 @@ int flb_tail_mult_create(struct flb_tail_config *ctx,
     struct flb_parser *parser;
     struct flb_kv *kv;
 
+    mk_list_init(&ctx->mult_parsers);
+
     tmp = flb_input_get_property("multiline_flush", i_ins);
     if (!tmp) {
         ctx->multiline_flush = FLB_TAIL_MULT_FLUSH;
@@ -63,6 +66,12 @@ int flb_tail_mult_create(struct flb_tail_config *ctx,
         }
     }
 
+    /* Rules based multiline, firstline parsers are not used */
+    if (flb_input_get_property("multiline_rules", i_ins) ||
+        flb_input_get_property("multiline_rule", i_ins)) {
+        return flb_tail_mult_rules_create(ctx, i_ins);
+    }
+
     /* Get firstline parser */
     tmp = flb_input_get_property("parser_firstline", i_ins);
     if (!tmp) {
@@ -76,7 +85,6 @@ int flb_tail_mult_create(struct flb_tail_config *ctx,
     }
 
     ctx->mult_parser_firstline = parser;
-    mk_list_init(&ctx->mult_parsers);
 
     /* Read all multiline rules */
     mk_list_foreach(head, &i_ins->properties) {
@@ -118,6 +126,9 @@ int flb_tail_mult_destroy(struct flb_tail_config *ctx)
         flb_free(mp);
     }
 
+    flb_tail_mult_rules_destroy(ctx->mult_rules);
+    ctx->mult_rules = NULL;
+
     return 0;
 }
 
@@ -0,0 +1,990 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <ctype.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_kv.h>
+#include <fluent-bit/flb_time.h>
+
+#include "tail_config.h"
+#include "tail_multiline.h"
+#include "tail_multiline_rules.h"
+
+/*
+ * Multiline rules
+ * ===============
+ * A rule set describes a multiline message as a state machine: every
+ * record begins with a line matching one of the 'start_state' rules, each
+ * following line must match a rule of the current state to be part of the
+ * record. Lines matching nothing close the record and are tested again
+ * from 'start_state'.
+ *
+ * Lines are joined as raw text and the 'Parser' of the input, if any, runs
+ * once over the complete record when it's flushed.
+ *
+ * Empty lines are discarded by the reader before they get here, so the
+ * built-in sets below don't have the blank line transitions that separate
+ * the blocks of some stack traces.
+ */
+
+struct mult_rule_def {
+    char *state;
+    char *regex;
+    char *next;
+};
+
+struct mult_rule_set {
+    char *name;
+    struct mult_rule_def *rules;
+};
+
+static struct mult_rule_def rules_java[] = {
+    {"start_state",
+     "(?:Exception|Error|Throwable|V8 errors stack trace)[:\\r\\n]",
+     "java_after_exception"},
+    {"java_start_exception",
+     "(?:Exception|Error|Throwable|V8 errors stack trace)[:\\r\\n]",
+     "java_after_exception"},
+    {"java_after_exception", "^[\\t ]*nested exception is:[\\t ]*",
+     "java_start_exception"},
+    {"java_after_exception", "^[\\t ]+(?:eval )?at ",
+     "java_after_exception"},
+    {"java_after_exception", "^[\\t ]*(?:Caused by|Suppressed):",
+     "java_after_exception"},
+    {"java_after_exception",
+     "^[\\t ]*\\.\\.\\. \\d+ (?:more|common frames omitted)",
+     "java_after_exception"},
+    {"java_after_exception",
+     "^[\\t ]+--- End of inner exception stack trace ---$",
+     "java_after_exception"},
+    {"java_after_exception",
+     "^--- End of stack trace from previous location where exception "
+     "was thrown ---$",
+     "java_after_exception"},
+    {NULL, NULL, NULL}
+};
+
+static struct mult_rule_def rules_python[] = {
+    {"start_state", "^Traceback \\(most recent call last\\):$", "python"},
+    {"python", "^[\\t ]+File ", "python_code"},
+    {"python_code", "[^\\t ]", "python"},
+    {"python", "^(?:[^\\s.():]+\\.)*[^\\s.():]+:", "start_state"},
+    {NULL, NULL, NULL}
+};
+
+static struct mult_rule_def rules_go[] = {
+    {"start_state", "\\bpanic: ", "go_after_panic"},
+    {"start_state", "http: panic serving", "go_goroutine"},
+    {"go_after_panic", "^\\[signal ", "go_after_signal"},
+    {"go_after_panic", "^goroutine \\d+ \\[[^\\]]+\\]:$", "go_frame_1"},
+    {"go_after_signal", "^goroutine \\d+ \\[[^\\]]+\\]:$", "go_frame_1"},
+    {"go_goroutine", "^goroutine \\d+ \\[[^\\]]+\\]:$", "go_frame_1"},
+    {"go_frame_1", "^(?:[^\\s.:]+\\.)*[^\\s.():]+\\(|^created by ",
+     "go_frame_2"},
+    {"go_frame_2", "^\\s", "go_frames"},
+    {"go_frames", "^(?:[^\\s.:]+\\.)*[^\\s.():]+\\(|^created by ",
+     "go_frame_2"},
+    {"go_frames", "^goroutine \\d+ \\[[^\\]]+\\]:$", "go_frame_1"},
+    {NULL, NULL, NULL}
+};
+
+static struct mult_rule_set rule_sets[] = {
+    {"java",   rules_java},
+    {"python", rules_python},
+    {"go",     rules_go},
+    {NULL, NULL}
+};
+
+/*
+ * Literal prefilters
+ * ==================
+ * Running a regex for every line and state is what makes multiline
+ * expensive, while most lines can be discarded by a plain memcmp() or
+ * memmem(). The helpers below look for literals that any line matching a
+ * pattern must contain: runs of plain characters at the top level of the
+ * pattern, or a group made only of literal alternatives like
+ * '(?:Exception|Error)'. Anything we don't fully understand is skipped,
+ * the regex has the last word anyway.
+ */
+
+struct mult_literals {
+    int n;
+    int anchored;
+    flb_sds_t *lits;
+};
+
+static void literals_free(struct mult_literals *l)
+{
+    int i;
+
+    for (i = 0; i < l->n; i++) {
+        flb_sds_destroy(l->lits[i]);
+    }
+    flb_free(l->lits);
+    l->n = 0;
+    l->lits = NULL;
+}
+
+static int literals_add(struct mult_literals *l, const char *str, int len)
+{
+    flb_sds_t *tmp;
+
+    tmp = flb_realloc(l->lits, sizeof(flb_sds_t) * (l->n + 1));
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    l->lits = tmp;
+    l->lits[l->n] = flb_sds_create_len(str, len);
+    if (!l->lits[l->n]) {
+        return -1;
+    }
+    l->n++;
+    return 0;
+}
+
+/* How good a set of literals is to discard lines, higher is better */
+static int literals_score(struct mult_literals *l)
+{
+    int i;
+    int min = -1;
+
+    for (i = 0; i < l->n; i++) {
+        if (min == -1 || flb_sds_len(l->lits[i]) < min) {
+            min = flb_sds_len(l->lits[i]);
+        }
+    }
+
+    if (l->anchored) {
+        return min * 2;
+    }
+    else if (l->n == 1) {
+        return min >= 2 ? min : 0;
+    }
+    return min >= 3 ? min - 1 : 0;
+}
+
+/* Keep the best of the literals found so far */
+static void literals_offer(struct mult_literals *best,
+                           struct mult_literals *cand)
+{
+    if (literals_score(cand) > literals_score(best)) {
+        literals_free(best);
+        *best = *cand;
+    }
+    else {
+        literals_free(cand);
+    }
+    cand->n = 0;
+    cand->lits = NULL;
+}
+
+/* Character matched by the escape sequence '\c', -1 if not a literal */
+static int escape_literal(char c)
+{
+    switch (c) {
+    case 't':
+        return '\t';
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    }
+
+    if (c == '\0' || isalnum((unsigned char) c)) {
+        return -1;
+    }
+    return c;
+}
+
+/* Skip an optional quantifier, returns FLB_TRUE if it allows zero matches */
+static int skip_quantifier(const char **p, const char *end)
+{
+    int opt = FLB_FALSE;
+    const char *s = *p;
+
+    if (s < end && (*s == '?' || *s == '*')) {
+        opt = FLB_TRUE;
+        s++;
+    }
+    else if (s < end && *s == '+') {
+        s++;
+    }
+    else if (s < end && *s == '{') {
+        opt = FLB_TRUE;
+        while (s < end && *s != '}') {
+            s++;
+        }
+        if (s < end) {
+            s++;
+        }
+    }
+    else {
+        return FLB_FALSE;
+    }
+
+    /* lazy or possessive modifiers */
+    if (s < end && (*s == '?' || *s == '+')) {
+        s++;
+    }
+
+    *p = s;
+    return opt;
+}
+
+/* Return the position after the closing ']' of a character class */
+static const char *skip_class(const char *p, const char *end)
+{
+    int depth = 0;
+
+    while (p < end) {
+        if (*p == '\\') {
+            p += 2;
+            continue;
+        }
+        if (*p == '[') {
+            depth++;
+            /* a ']' right after the opening is part of the class */
+            if (p + 1 < end && p[1] == '^') {
+                p++;
+            }
+            if (p + 1 < end && p[1] == ']') {
+                p++;
+            }
+        }
+        else if (*p == ']') {
+            depth--;
+            if (depth == 0) {
+                return p + 1;
+            }
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Return the position of the ')' closing the group opened at 'p' */
+static const char *group_end(const char *p, const char *end)
+{
+    int depth = 0;
+
+    while (p < end) {
+        if (*p == '\\') {
+            p += 2;
+            continue;
+        }
+        if (*p == '[') {
+            p = skip_class(p, end);
+            if (!p) {
+                return NULL;
+            }
+            continue;
+        }
+        if (*p == '(') {
+            depth++;
+        }
+        else if (*p == ')') {
+            depth--;
+            if (depth == 0) {
+                return p;
+            }
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Split a group made only of literal alternatives, e.g: 'foo|bar' */
+static int group_literals(const char *p, const char *end,
+                          struct mult_literals *out)
+{
+    int c;
+    char buf[256];
+    int len = 0;
+
+    while (p <= end) {
+        if (p == end || *p == '|') {
+            if (len == 0 || literals_add(out, buf, len) == -1) {
+                literals_free(out);
+                return -1;
+            }
+            len = 0;
+            p++;
+            continue;
+        }
+
+        if (*p == '\\') {
+            c = escape_literal(p[1]);
+            p += 2;
+        }
+        else if (strchr(".[](){}?*+^$", *p)) {
+            c = -1;
+        }
+        else {
+            c = *p++;
+        }
+
+        if (c == -1 || len >= sizeof(buf)) {
+            literals_free(out);
+            return -1;
+        }
+        buf[len++] = c;
+    }
+    return 0;
+}
+
+/*
+ * Find the literal prefilter of a pattern and store it in the rule. Returns
+ * FLB_TRUE when the pattern is a plain literal and the regex is not needed.
+ */
+static int rule_literals(struct flb_tail_mult_rule *rule, const char *pattern)
+{
+    int c;
+    int opt;
+    int first = FLB_TRUE;
+    int complete = FLB_TRUE;
+    int anchored = FLB_FALSE;
+    int exact = FLB_FALSE;
+    int run_len = 0;
+    int run_anchored = FLB_FALSE;
+    char run[256];
+    const char *p = pattern;
+    const char *end = pattern + strlen(pattern);
+    const char *q;
+    struct mult_literals best = {0};
+    struct mult_literals cand = {0};
+
+#define END_RUN()                                                   \
+    if (run_len > 0) {                                              \
+        if (literals_add(&cand, run, run_len) == 0) {               \
+            cand.anchored = run_anchored;                           \
+            literals_offer(&best, &cand);                           \
+        }                                                           \
+        else {                                                      \
+            literals_free(&cand);                                   \
+        }                                                           \
+        run_len = 0;                                                \
+    }                                                               \
+    first = FLB_FALSE;
+
+    if (*p == '^') {
+        anchored = FLB_TRUE;
+        p++;
+    }
+
+    while (p < end) {
+        c = *p;
+
+        /* alternatives at the top level have no common requirement */
+        if (c == '|') {
+            literals_free(&best);
+            return FLB_FALSE;
+        }
+
+        if (c == '(') {
+            /* options and look-arounds change what a literal means */
+            if (p[1] == '?' && p[2] != ':') {
+                literals_free(&best);
+                return FLB_FALSE;
+            }
+            q = group_end(p, end);
+            if (!q) {
+                literals_free(&best);
+                return FLB_FALSE;
+            }
+
+            END_RUN();
+            complete = FLB_FALSE;
+            cand.anchored = FLB_FALSE;
+            p += (p[1] == '?') ? 3 : 1;
+            if (group_literals(p, q, &cand) == -1) {
+                cand.n = 0;
+            }
+
+            p = q + 1;
+            opt = skip_quantifier(&p, end);
+            if (!opt && cand.n > 0) {
+                literals_offer(&best, &cand);
+            }
+            else {
+                literals_free(&cand);
+            }
+            continue;
+        }
+
+        if (c == '[') {
+            END_RUN();
+            complete = FLB_FALSE;
+            p = skip_class(p, end);
+            if (!p) {
+                literals_free(&best);
+                return FLB_FALSE;
+            }
+            skip_quantifier(&p, end);
+            continue;
+        }
+
+        if (c == '$' && p + 1 == end && complete) {
+            exact = FLB_TRUE;
+            p++;
+            continue;
+        }
+
+        if (c == '\\') {
+            c = escape_literal(p[1]);
+            q = p + 2;
+        }
+        else if (strchr(".^$?*+{})]", c)) {
+            c = -1;
+            q = p + 1;
+        }
+        else {
+            q = p + 1;
+        }
+
+        /* not a literal character */
+        if (c == -1) {
+            END_RUN();
+            complete = FLB_FALSE;
+            p = q;
+            skip_quantifier(&p, end);
+            continue;
+        }
+
+        /* a literal character that can be missing ends the run */
+        if (q < end && (*q == '?' || *q == '*' || *q == '{')) {
+            END_RUN();
+            complete = FLB_FALSE;
+            p = q;
+            skip_quantifier(&p, end);
+            continue;
+        }
+
+        if (run_len == 0) {
+            run_anchored = (anchored && first);
+        }
+        if (run_len >= sizeof(run)) {
+            END_RUN();
+            complete = FLB_FALSE;
+            continue;
+        }
+        run[run_len++] = c;
+        p = q;
+
+        /* a repeated character ends the run too */
+        if (p < end && *p == '+') {
+            END_RUN();
+            complete = FLB_FALSE;
+            skip_quantifier(&p, end);
+        }
+    }
+
+    /* a pattern made of a single run don't need the regex */
+    if (complete && run_len > 0 && (anchored || !exact)) {
+        cand.anchored = anchored;
+        literals_free(&best);
+        if (literals_add(&cand, run, run_len) == -1) {
+            literals_free(&cand);
+            return FLB_FALSE;
+        }
+        rule->anchored = anchored;
+        rule->exact = exact;
+        rule->n_literals = cand.n;
+        rule->literals = cand.lits;
+        return FLB_TRUE;
+    }
+    END_RUN();
+#undef END_RUN
+
+    if (best.n > 0 && literals_score(&best) > 0) {
+        rule->anchored = best.anchored;
+        rule->n_literals = best.n;
+        rule->literals = best.lits;
+    }
+    else {
+        literals_free(&best);
+    }
+    return FLB_FALSE;
+}
+
+/* Check if a line matches a rule */
+static inline int rule_match(struct flb_tail_mult_rule *rule,
+                             char *buf, size_t len)
+{
+    int i;
+    size_t l_len;
+    flb_sds_t lit;
+
+    if (rule->n_literals > 0) {
+        if (rule->anchored) {
+            lit = rule->literals[0];
+            l_len = flb_sds_len(lit);
+            if (len < l_len || memcmp(buf, lit, l_len) != 0) {
+                return FLB_FALSE;
+            }
+            if (rule->exact && len != l_len) {
+                return FLB_FALSE;
+            }
+        }
+        else {
+            for (i = 0; i < rule->n_literals; i++) {
+                lit = rule->literals[i];
+                if (memmem(buf, len, lit, flb_sds_len(lit))) {
+                    break;
+                }
+            }
+            if (i == rule->n_literals) {
+                return FLB_FALSE;
+            }
+        }
+
+        if (!rule->regex) {
+            return FLB_TRUE;
+        }
+    }
+
+    return flb_regex_match(rule->regex, (unsigned char *) buf, len) > 0;
+}
+
+/* Return the state reached from 'state' with the given line, or -1 */
+static inline int state_next(struct flb_tail_mult_state *state,
+                             char *buf, size_t len)
+{
+    int i;
+
+    for (i = 0; i < state->n_rules; i++) {
+        if (rule_match(&state->rules[i], buf, len) == FLB_TRUE) {
+            return state->rules[i].to;
+        }
+    }
+    return -1;
+}
+
+/* Get the index of a state by name, registering it if it don't exists */
+static int state_get(struct flb_tail_mult_rules *rules,
+                     const char *name, int len)
+{
+    int i;
+    struct flb_tail_mult_state *tmp;
+    struct flb_tail_mult_state *state;
+
+    for (i = 0; i < rules->n_states; i++) {
+        state = &rules->states[i];
+        if (flb_sds_len(state->name) == len &&
+            strncmp(state->name, name, len) == 0) {
+            return i;
+        }
+    }
+
+    tmp = flb_realloc(rules->states,
+                      sizeof(struct flb_tail_mult_state) *
+                      (rules->n_states + 1));
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    rules->states = tmp;
+
+    state = &rules->states[rules->n_states];
+    state->name = flb_sds_create_len(name, len);
+    if (!state->name) {
+        return -1;
+    }
+    state->n_rules = 0;
+    state->rules = NULL;
+
+    return rules->n_states++;
+}
+
+static int rules_add(struct flb_tail_mult_rules *rules,
+                     const char *from, int from_len,
+                     const char *pattern,
+                     const char *to, int to_len)
+{
+    int ret;
+    int i_from;
+    int i_to;
+    struct flb_tail_mult_rule *tmp;
+    struct flb_tail_mult_rule *rule;
+    struct flb_tail_mult_state *state;
+
+    i_from = state_get(rules, from, from_len);
+    i_to = state_get(rules, to, to_len);
+    if (i_from == -1 || i_to == -1) {
+        return -1;
+    }
+
+    state = &rules->states[i_from];
+    tmp = flb_realloc(state->rules,
+                      sizeof(struct flb_tail_mult_rule) *
+                      (state->n_rules + 1));
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    state->rules = tmp;
+
+    rule = &state->rules[state->n_rules];
+    memset(rule, '\0', sizeof(struct flb_tail_mult_rule));
+    rule->to = i_to;
+    state->n_rules++;
+
+    ret = rule_literals(rule, pattern);
+    if (ret == FLB_FALSE) {
+        rule->regex = flb_regex_create(pattern);
+        if (!rule->regex) {
+            flb_error("[in_tail] multiline rule: invalid regex '%s'", pattern);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Parse a 'Multiline_Rule' value: state /regex/ next_state */
+static int rules_add_custom(struct flb_tail_mult_rules *rules, const char *val)
+{
+    int ret;
+    const char *p = val;
+    const char *from;
+    const char *to;
+    const char *re_end;
+    int from_len;
+    int to_len;
+    flb_sds_t pattern;
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    from = p;
+    while (*p && !isspace((unsigned char) *p)) {
+        p++;
+    }
+    from_len = p - from;
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+
+    re_end = strrchr(p, '/');
+    if (from_len == 0 || *p != '/' || re_end == p) {
+        goto error;
+    }
+
+    to = re_end + 1;
+    while (isspace((unsigned char) *to)) {
+        to++;
+    }
+    to_len = 0;
+    while (to[to_len] && !isspace((unsigned char) to[to_len])) {
+        to_len++;
+    }
+    if (to_len == 0 || to[to_len + strspn(to + to_len, " \t")] != '\0') {
+        goto error;
+    }
+
+    pattern = flb_sds_create_len(p + 1, re_end - p - 1);
+    if (!pattern) {
+        return -1;
+    }
+    ret = rules_add(rules, from, from_len, pattern, to, to_len);
+    flb_sds_destroy(pattern);
+    return ret;
+
+ error:
+    flb_error("[in_tail] invalid multiline rule '%s', expected "
+              "'state /regex/ next_state'", val);
+    return -1;
+}
+
+static int rules_add_set(struct flb_tail_mult_rules *rules,
+                         const char *name, int len)
+{
+    int ret;
+    struct mult_rule_set *set;
+    struct mult_rule_def *def;
+
+    for (set = rule_sets; set->name; set++) {
+        if (strlen(set->name) == len && strncasecmp(set->name, name, len) == 0) {
+            break;
+        }
+    }
+    if (!set->name) {
+        flb_error("[in_tail] unknown multiline rules '%.*s'", len, name);
+        return -1;
+    }
+
+    for (def = set->rules; def->state; def++) {
+        ret = rules_add(rules,
+                        def->state, strlen(def->state),
+                        def->regex,
+                        def->next, strlen(def->next));
+        if (ret == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void flb_tail_mult_rules_destroy(struct flb_tail_mult_rules *rules)
+{
+    int i;
+    int j;
+    int k;
+    struct flb_tail_mult_rule *rule;
+    struct flb_tail_mult_state *state;
+
+    if (!rules) {
+        return;
+    }
+
+    for (i = 0; i < rules->n_states; i++) {
+        state = &rules->states[i];
+        for (j = 0; j < state->n_rules; j++) {
+            rule = &state->rules[j];
+            for (k = 0; k < rule->n_literals; k++) {
+                flb_sds_destroy(rule->literals[k]);
+            }
+            flb_free(rule->literals);
+            if (rule->regex) {
+                flb_regex_destroy(rule->regex);
+            }
+        }
+        flb_free(state->rules);
+        flb_sds_destroy(state->name);
+    }
+    flb_free(rules->states);
+    flb_free(rules);
+}
+
+/*
+ * Compile the rules set by 'Multiline_Rules' (comma separated built-in
+ * sets) and 'Multiline_Rule' (custom transitions) into ctx->mult_rules.
+ */
+int flb_tail_mult_rules_create(struct flb_tail_config *ctx,
+                               struct flb_input_instance *i_ins)
+{
+    int i;
+    int ret;
+    int len;
+    const char *p;
+    struct mk_list *head;
+    struct flb_kv *kv;
+    struct flb_tail_mult_rules *rules;
+
+    rules = flb_calloc(1, sizeof(struct flb_tail_mult_rules));
+    if (!rules) {
+        flb_errno();
+        return -1;
+    }
+    ctx->mult_rules = rules;
+
+    /* every record begins on 'start_state' */
+    ret = state_get(rules, "start_state", 11);
+    if (ret != FLB_TAIL_MULT_START) {
+        return -1;
+    }
+
+    p = flb_input_get_property("multiline_rules", i_ins);
+    while (p && *p) {
+        len = strcspn(p, ", \t");
+        if (len > 0 && rules_add_set(rules, p, len) == -1) {
+            return -1;
+        }
+        p += len;
+        p += strspn(p, ", \t");
+    }
+
+    mk_list_foreach(head, &i_ins->properties) {
+        kv = mk_list_entry(head, struct flb_kv, _head);
+        if (strcasecmp(kv->key, "multiline_rule") != 0) {
+            continue;
+        }
+        if (rules_add_custom(rules, kv->val) == -1) {
+            return -1;
+        }
+    }
+
+    /* a state without transitions is most likely a typo */
+    for (i = 0; i < rules->n_states; i++) {
+        if (rules->states[i].n_rules == 0) {
+            flb_error("[in_tail] multiline state '%s' has no rules",
+                      rules->states[i].name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Pack a complete record, parsing it if a parser was set */
+static void pack_record(char *buf, size_t len, struct flb_time *time,
+                        struct flb_tail_file *file,
+                        msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck)
+{
+    int ret;
+    void *out_buf;
+    size_t out_size;
+    struct flb_time out_time = {0};
+    struct flb_tail_config *ctx = file->config;
+
+    if (ctx->parser) {
+        ret = flb_parser_do(ctx->parser, buf, len,
+                            &out_buf, &out_size, &out_time);
+        if (ret >= 0) {
+            if (flb_time_to_double(&out_time) == 0) {
+                flb_time_copy(&out_time, time);
+            }
+
+            if (ctx->ignore_older > 0 &&
+                (time->tm.tv_sec - ctx->ignore_older) > out_time.tm.tv_sec) {
+                flb_free(out_buf);
+                return;
+            }
+
+            flb_tail_pack_line_map(mp_sbuf, mp_pck, &out_time,
+                                   out_buf, out_size, file);
+            flb_free(out_buf);
+            return;
+        }
+    }
+
+    flb_tail_file_pack_line(mp_sbuf, mp_pck, time, buf, len, file);
+}
+
+int flb_tail_mult_rules_process(time_t now, char *buf, size_t len,
+                                struct flb_tail_file *file,
+                                msgpack_sbuffer *mp_sbuf,
+                                msgpack_packer *mp_pck)
+{
+    int to;
+    flb_sds_t tmp;
+    struct flb_time out_time;
+    struct flb_tail_config *ctx = file->config;
+    struct flb_tail_mult_rules *rules = ctx->mult_rules;
+
+    /* Continuation of the current record ? */
+    if (file->mult_firstline == FLB_TRUE &&
+        file->mult_state != FLB_TAIL_MULT_START) {
+        to = state_next(&rules->states[file->mult_state], buf, len);
+        if (to >= 0) {
+            tmp = flb_sds_cat(file->mult_text, "\n", 1);
+            if (tmp) {
+                file->mult_text = tmp;
+                tmp = flb_sds_cat(file->mult_text, buf, len);
+            }
+            if (tmp) {
+                file->mult_text = tmp;
+                file->mult_state = to;
+                return FLB_TAIL_MULT_MORE;
+            }
+        }
+    }
+
+    /* Anything buffered is a complete record now */
+    flb_tail_mult_rules_flush(mp_sbuf, mp_pck, file);
+
+    /* Beginning of a new record ? */
+    to = state_next(&rules->states[FLB_TAIL_MULT_START], buf, len);
+    if (to >= 0) {
+        if (!file->mult_text) {
+            file->mult_text = flb_sds_create_size(len > 1024 ? len : 1024);
+        }
+        tmp = NULL;
+        if (file->mult_text) {
+            tmp = flb_sds_copy(file->mult_text, buf, len);
+        }
+        if (tmp) {
+            file->mult_text = tmp;
+            file->mult_firstline = FLB_TRUE;
+            file->mult_state = to;
+            file->mult_flush_timeout = now + (ctx->multiline_flush - 1);
+            flb_time_get(&file->mult_time);
+            return FLB_TAIL_MULT_MORE;
+        }
+    }
+
+    /* A line on its own */
+    flb_time_get(&out_time);
+    pack_record(buf, len, &out_time, file, mp_sbuf, mp_pck);
+
+    return FLB_TAIL_MULT_NA;
+}
+
+/* Pack the buffered record, if any */
+int flb_tail_mult_rules_flush(msgpack_sbuffer *mp_sbuf,
+                              msgpack_packer *mp_pck,
+                              struct flb_tail_file *file)
+{
+    if (file->mult_firstline == FLB_FALSE) {
+        return -1;
+    }
+
+    pack_record(file->mult_text, flb_sds_len(file->mult_text),
+                &file->mult_time, file, mp_sbuf, mp_pck);
+
+    /* Reset status */
+    file->mult_firstline = FLB_FALSE;
+    file->mult_state = FLB_TAIL_MULT_START;
+    file->mult_flush_timeout = 0;
+    flb_sds_len_set(file->mult_text, 0);
+    flb_time_zero(&file->mult_time);
+
+    return 0;
+}
+
+int flb_tail_mult_rules_pending_flush(struct flb_input_instance *i_ins,
+                                      struct flb_config *config,
+                                      void *context)
+{
+    time_t now;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    struct mk_list *head;
+    struct flb_tail_file *file;
+    struct flb_tail_config *ctx = context;
+
+    now = time(NULL);
+
+    mk_list_foreach(head, &ctx->files_event) {
+        file = mk_list_entry(head, struct flb_tail_file, _head);
+
+        if (file->mult_firstline == FLB_FALSE ||
+            file->mult_flush_timeout > now) {
+            continue;
+        }
+
+        msgpack_sbuffer_init(&mp_sbuf);
+        msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+
+        flb_tail_mult_rules_flush(&mp_sbuf, &mp_pck, file);
+        flb_input_chunk_append_raw(i_ins,
+                                   file->tag_buf,
+                                   file->tag_len,
+                                   mp_sbuf.data,
+                                   mp_sbuf.size);
+        msgpack_sbuffer_destroy(&mp_sbuf);
+    }
+
+    return 0;
+}
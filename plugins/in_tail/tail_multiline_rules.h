@@ -0,0 +1,77 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TAIL_TAIL_MULT_RULES_H
+#define FLB_TAIL_TAIL_MULT_RULES_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_regex.h>
+#include <fluent-bit/flb_sds.h>
+
+#include "tail_config.h"
+#include "tail_file.h"
+
+/* Index of the state every record starts from */
+#define FLB_TAIL_MULT_START  0
+
+/*
+ * A transition of the state machine: a line matching 'regex' is appended to
+ * the current record and the machine moves to the state 'to'. Before running
+ * the regex, the line must contain one of 'literals' (or start with it when
+ * 'anchored' is set). When the pattern is a plain literal the regex is not
+ * compiled at all.
+ */
+struct flb_tail_mult_rule {
+    int to;                     /* next state                          */
+    int anchored;               /* literal must be at the line start   */
+    int exact;                  /* ... and must be the whole line      */
+    int n_literals;             /* number of literal alternatives      */
+    flb_sds_t *literals;        /* one of them must be found           */
+    struct flb_regex *regex;    /* NULL when literals decide the match */
+};
+
+struct flb_tail_mult_state {
+    flb_sds_t name;
+    int n_rules;
+    struct flb_tail_mult_rule *rules;
+};
+
+struct flb_tail_mult_rules {
+    int n_states;
+    struct flb_tail_mult_state *states;   /* states[0] is 'start_state' */
+};
+
+int flb_tail_mult_rules_create(struct flb_tail_config *ctx,
+                               struct flb_input_instance *i_ins);
+void flb_tail_mult_rules_destroy(struct flb_tail_mult_rules *rules);
+
+int flb_tail_mult_rules_process(time_t now, char *buf, size_t len,
+                                struct flb_tail_file *file,
+                                msgpack_sbuffer *mp_sbuf,
+                                msgpack_packer *mp_pck);
+int flb_tail_mult_rules_flush(msgpack_sbuffer *mp_sbuf,
+                              msgpack_packer *mp_pck,
+                              struct flb_tail_file *file);
+int flb_tail_mult_rules_pending_flush(struct flb_input_instance *i_ins,
+                                      struct flb_config *config,
+                                      void *context);
+
+#endif
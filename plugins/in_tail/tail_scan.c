@@ -18,6 +18,106 @@
  *  limitations under the License.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_hash.h>
+
+#include "tail_config.h"
+#include "tail_fs.h"
+#include "tail_file.h"
+#include "tail_scan.h"
+
+static int tail_is_excluded(char *path, struct flb_tail_config *ctx);
+
+/*
+ * A scan only does the full work for the paths that changed since the
+ * previous one: monitored files are found in the files index and the
+ * exclusion result of a path is reused from the previous scan. The paths
+ * excluded by this scan are registered in 'excluded'.
+ */
+static int tail_scan_skip(char *path, struct flb_hash *excluded,
+                          struct flb_tail_config *ctx)
+{
+    int ret;
+    int len;
+    size_t size;
+    const char *val;
+
+    if (flb_tail_file_exists(path, ctx) == FLB_TRUE) {
+        return FLB_TRUE;
+    }
+
+    if (!ctx->exclude_list) {
+        return FLB_FALSE;
+    }
+
+    len = strlen(path);
+    ret = -1;
+    if (ctx->scan_excluded) {
+        ret = flb_hash_get(ctx->scan_excluded, path, len, &val, &size);
+    }
+    if (ret == -1 && tail_is_excluded(path, ctx) == FLB_FALSE) {
+        return FLB_FALSE;
+    }
+
+    flb_debug("[in_tail] excluded=%s", path);
+    if (excluded) {
+        flb_hash_add(excluded, path, len, "1", 1);
+    }
+    return FLB_TRUE;
+}
+
+static struct flb_hash *tail_scan_excluded_create(const char *path,
+                                                  struct flb_tail_config *ctx)
+{
+    /* partial scans don't know about the exclusions of other paths */
+    if (!ctx->exclude_list || strcmp(path, ctx->path) != 0) {
+        return NULL;
+    }
+    return flb_hash_create(FLB_HASH_EVICT_NONE, FLB_TAIL_HASH_SIZE, 0);
+}
+
+/* Keep the exclusions of the last scan, paths that are gone are dropped */
+static void tail_scan_excluded_set(struct flb_hash *excluded,
+                                   struct flb_tail_config *ctx)
+{
+    if (!excluded) {
+        return;
+    }
+    if (ctx->scan_excluded) {
+        flb_hash_destroy(ctx->scan_excluded);
+    }
+    ctx->scan_excluded = excluded;
+}
+
+/*
+ * Register a single path reported by the file system backend, returns
+ * FLB_TRUE if it's a new file.
+ */
+int flb_tail_scan_file(char *path, struct flb_tail_config *ctx)
+{
+    int ret;
+    struct stat st;
+
+    if (tail_scan_skip(path, NULL, ctx) == FLB_TRUE) {
+        return FLB_FALSE;
+    }
+
+    ret = stat(path, &st);
+    if (ret != 0 || !S_ISREG(st.st_mode)) {
+        return FLB_FALSE;
+    }
+
+    if (flb_tail_file_append(path, &st, FLB_TAIL_STATIC, ctx) == -1) {
+        return FLB_FALSE;
+    }
+
+    flb_debug("[in_tail] append new file: %s", path);
+    return FLB_TRUE;
+}
+
 #ifdef FLB_SYSTEM_WINDOWS
 #include "tail_scan_win32.c"
 #else
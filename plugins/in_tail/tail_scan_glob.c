@@ -211,11 +211,12 @@ int flb_tail_scan(const char *path, struct flb_tail_config *ctx)
     int count = 0;
     glob_t globbuf;
     struct stat st;
+    struct flb_hash *excluded;
 
     flb_debug("[in_tail] scanning path %s", path);
 
     /* Generate exclusion list */
-    if (ctx->exclude_path) {
+    if (ctx->exclude_path && !ctx->exclude_list) {
         tail_exclude_generate(ctx);
     }
 
@@ -251,15 +252,15 @@ int flb_tail_scan(const char *path, struct flb_tail_config *ctx)
     }
 
     /* For every entry found, generate an output list */
+    excluded = tail_scan_excluded_create(path, ctx);
     for (i = 0; i < globbuf.gl_pathc; i++) {
+        /* Skip monitored and blacklisted files */
+        if (tail_scan_skip(globbuf.gl_pathv[i], excluded, ctx) == FLB_TRUE) {
+            continue;
+        }
+
         ret = stat(globbuf.gl_pathv[i], &st);
         if (ret == 0 && S_ISREG(st.st_mode)) {
-            /* Check if this file is blacklisted */
-            if (tail_is_excluded(globbuf.gl_pathv[i], ctx) == FLB_TRUE) {
-                flb_debug("[in_tail] excluded=%s", globbuf.gl_pathv[i]);
-                continue;
-            }
-
             /* Append file to list */
             flb_tail_file_append(globbuf.gl_pathv[i], &st,
                                  FLB_TAIL_STATIC, ctx);
@@ -269,6 +270,7 @@ int flb_tail_scan(const char *path, struct flb_tail_config *ctx)
             flb_debug("[in_tail] skip (invalid) entry=%s", globbuf.gl_pathv[i]);
         }
     }
+    tail_scan_excluded_set(excluded, ctx);
 
     globfree(&globbuf);
     return 0;
@@ -286,9 +288,13 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
     int count = 0;
     glob_t globbuf;
     struct stat st;
+    struct flb_hash *excluded;
     struct flb_tail_config *ctx = context;
     (void) config;
 
+    /* Safety net for the directories watched by the fs backend */
+    flb_tail_fs_rescan(ctx);
+
     /* Scan the path */
     ret = do_glob(ctx->path, GLOB_TILDE, NULL, &globbuf);
     if (ret != 0) {
@@ -304,20 +310,18 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
         }
     }
 
-    /* For every entry found, check if is already registered or not */
+    /*
+     * For every entry found, check if is already registered or not. Known
+     * entries are skipped before calling stat(2).
+     */
+    excluded = tail_scan_excluded_create(ctx->path, ctx);
     for (i = 0; i < globbuf.gl_pathc; i++) {
+        if (tail_scan_skip(globbuf.gl_pathv[i], excluded, ctx) == FLB_TRUE) {
+            continue;
+        }
+
         ret = stat(globbuf.gl_pathv[i], &st);
         if (ret == 0 && S_ISREG(st.st_mode)) {
-            /* Check if this file is blacklisted */
-            if (tail_is_excluded(globbuf.gl_pathv[i], ctx) == FLB_TRUE) {
-                continue;
-            }
-
-            ret = flb_tail_file_exists(globbuf.gl_pathv[i], ctx);
-            if (ret == FLB_TRUE) {
-                continue;
-            }
-
             /* Append file to list */
             if (flb_tail_file_append(globbuf.gl_pathv[i], &st,
                                      FLB_TAIL_STATIC, ctx)) {
@@ -333,6 +337,8 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
         }
     }
 
+    tail_scan_excluded_set(excluded, ctx);
+
     if (globbuf.gl_pathc > 0) {
         globfree(&globbuf);
     }
@@ -113,12 +113,13 @@ int flb_tail_scan(const char *pattern, struct flb_tail_config *ctx)
     HANDLE h;
     WIN32_FIND_DATA found;
     struct stat st;
+    struct flb_hash *excluded;
     char path[MAX_PATH];
     int ret;
 
     flb_debug("[in_tail] scanning path %s", pattern);
 
-    if (ctx->exclude_path) {
+    if (ctx->exclude_path && !ctx->exclude_list) {
         tail_exclude_generate(ctx);
     }
 
@@ -134,6 +135,7 @@ int flb_tail_scan(const char *pattern, struct flb_tail_config *ctx)
         }
     }
 
+    excluded = tail_scan_excluded_create(pattern, ctx);
     do {
         /* WIN32_FIND_DATA.cFileName is just a file name, we need to
          * construct a proper path by combining the original pattern.
@@ -144,16 +146,16 @@ int flb_tail_scan(const char *pattern, struct flb_tail_config *ctx)
             continue;
         }
 
+        if (tail_scan_skip(path, excluded, ctx) == FLB_TRUE) {
+            continue;
+        }
+
         ret = stat(path, &st);
         if (ret == 0 && S_ISREG(st.st_mode)) {
-            if (tail_is_excluded(path, ctx) == FLB_TRUE) {
-                flb_debug("[in_tail] excluded=%s", path);
-                continue;
-            }
-
             flb_tail_file_append(path, &st, FLB_TAIL_STATIC, ctx);
         }
     } while(FindNextFileA(h, &found));
+    tail_scan_excluded_set(excluded, ctx);
 
     FindClose(h);
     return 0;
@@ -165,6 +167,7 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
     HANDLE h;
     WIN32_FIND_DATA found;
     struct stat st;
+    struct flb_hash *excluded;
     struct flb_tail_config *ctx;
     char path[MAX_PATH];
     char *pattern;
@@ -174,6 +177,9 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
     ctx = (struct flb_tail_config *) context;
     pattern = ctx->path;
 
+    /* Safety net for the directories watched by the fs backend */
+    flb_tail_fs_rescan(ctx);
+
     h = FindFirstFileA(pattern, &found);
     if (h == INVALID_HANDLE_VALUE) {
         switch (GetLastError()) {
@@ -185,6 +191,7 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
         }
     }
 
+    excluded = tail_scan_excluded_create(pattern, ctx);
     do {
         ret = tail_filepath(path, MAX_PATH, pattern, found.cFileName);
         if (ret) {
@@ -192,16 +199,12 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
             continue;
         }
 
+        if (tail_scan_skip(path, excluded, ctx) == FLB_TRUE) {
+            continue;
+        }
+
         ret = stat(path, &st);
         if (ret == 0 && S_ISREG(st.st_mode)) {
-            if (tail_is_excluded(path, ctx) == FLB_TRUE) {
-                continue;
-            }
-            ret = flb_tail_file_exists(path, ctx);
-            if (ret == FLB_TRUE) {
-                continue;
-            }
-
             flb_debug("[in_tail] append new file: %s", path);
 
             flb_tail_file_append(path, &st, FLB_TAIL_STATIC, ctx);
@@ -211,6 +214,7 @@ int flb_tail_scan_callback(struct flb_input_instance *i_ins,
             flb_debug("[in_tail] skip (invalid) entry=%s", path);
         }
     } while(FindNextFileA(h, &found));
+    tail_scan_excluded_set(excluded, ctx);
 
     FindClose(h);
 
@@ -61,6 +61,8 @@ static inline int tail_signal_pending(struct flb_tail_config *ctx)
     int n;
     uint64_t val = 0xc002;
 
+    ctx->events_pending = FLB_TRUE;
+
     /* Insert a dummy event into the 'pending' channel */
     n = flb_pipe_w(ctx->ch_pending[1], &val, sizeof(val));
     /* If we get EAGAIN, it simply means pending channel is full. As notification is already pending, it's safe to ignore. */
@@ -38,21 +38,43 @@
     "  rotated INTEGER DEFAULT 0"                                       \
     ");"
 
-#define SQL_GET_FILE "SELECT * from in_tail_files WHERE name='%s'"  \
-    " AND inode=%"PRIu64";"
+#define SQL_GET_FILE                                                    \
+    "SELECT * from in_tail_files WHERE name=@name AND inode=@inode;"
 
 #define SQL_INSERT_FILE                                             \
     "INSERT INTO in_tail_files (name, offset, inode, created)"      \
-    "  VALUES ('%s', %"PRIu64", %"PRIu64", %"PRIu64");"
+    "  VALUES (@name, @offset, @inode, @created);"
 
 #define SQL_UPDATE_OFFSET                                           \
-    "UPDATE in_tail_files set offset=%"PRIu64" WHERE id=%"PRId64";"
+    "UPDATE in_tail_files set offset=@offset WHERE id=@id;"
 
 #define SQL_ROTATE_FILE                                                 \
-    "UPDATE in_tail_files set name='%s',rotated=1 WHERE id=%"PRId64";"
+    "UPDATE in_tail_files set name=@name,rotated=1 WHERE id=@id;"
 
 #define SQL_DELETE_FILE                                                 \
-    "DELETE FROM in_tail_files WHERE id=%"PRId64";"
+    "DELETE FROM in_tail_files WHERE id=@id;"
+
+/* Inflate checkpoints of compressed files, by in_tail_files id */
+#define SQL_CREATE_GZIP                                                 \
+    "CREATE TABLE IF NOT EXISTS in_tail_gzip ("                         \
+    "  id      INTEGER PRIMARY KEY,"                                    \
+    "  data    BLOB"                                                    \
+    ");"
+
+#define SQL_GET_GZIP                                                    \
+    "SELECT data from in_tail_gzip WHERE id=@id;"
+
+#define SQL_SET_GZIP                                                    \
+    "INSERT OR REPLACE INTO in_tail_gzip (id, data) VALUES (@id, @data);"
+
+#define SQL_DELETE_GZIP                                                 \
+    "DELETE FROM in_tail_gzip WHERE id=@id;"
+
+#define SQL_BEGIN                               \
+    "BEGIN;"
+
+#define SQL_COMMIT                              \
+    "COMMIT;"
 
 #define SQL_PRAGMA_SYNC                         \
     "PRAGMA synchronous=%i;"
@@ -0,0 +1,471 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Reader threads
+ * ==============
+ * By default every file is read, parsed and packed in the engine thread,
+ * with thousands of busy files that is the bottleneck of the instance.
+ *
+ * When 'Threads' is set, the files are sharded across N reader threads by
+ * inode. The engine thread still owns the file list: discovery, rotation,
+ * inotify events, offsets and the database. When a file has data to read
+ * it is handed to its reader, which reads up to 'File_Read_Budget' bytes
+ * with it own parser instance and queues the packed records. The engine
+ * drains the queues, registers the records and moves the file offset
+ * forward. A file is owned by the reader until its buffer is drained, so
+ * the engine never touches the read buffer of a file while it is read and
+ * a removal requested in the meantime is deferred.
+ *
+ * When the engine pauses the instance the queues are not drained, once a
+ * queue is full its reader stops reading (backpressure).
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_worker.h>
+
+#include "tail.h"
+#include "tail_file.h"
+#include "tail_signal.h"
+#include "tail_config.h"
+#include "tail_thread.h"
+#include "tail_gzip.h"
+
+#define QUEUE_MASK   (FLB_TAIL_THREAD_QUEUE - 1)
+
+#ifdef _MSC_VER
+#define queue_load(p)           (*(volatile unsigned int *) (p))
+#define queue_store(p, v)       (*(volatile unsigned int *) (p) = (v))
+#define notify_swap(p, v)       InterlockedExchange((volatile LONG *) (p), v)
+#else
+#define queue_load(p)           __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define queue_store(p, v)       __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define notify_swap(p, v)       __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#endif
+
+/* Wake up the engine if it's not aware about pending data */
+static void threads_notify(struct flb_tail_config *ctx)
+{
+    int ret;
+    uint64_t val = 1;
+
+    if (notify_swap(&ctx->threads_notified, 1) == 1) {
+        return;
+    }
+
+    ret = flb_pipe_w(ctx->ch_threads[1], &val, sizeof(val));
+    if (ret == -1) {
+        flb_errno();
+    }
+}
+
+/* Read a file and queue the records, it runs in the reader thread */
+static void thread_read(struct flb_tail_thread *th, struct flb_tail_file *file)
+{
+    int ret;
+    unsigned int head;
+    struct flb_tail_file_out out;
+    struct flb_tail_thread_buf *b;
+    struct flb_tail_config *ctx = th->ctx;
+
+    out.name = file->thread_name;
+    out.name_len = strlen(file->thread_name);
+    out.parser = th->parser;
+    out.mp_sbuf = &th->mp_sbuf;
+    out.mp_pck = &th->mp_pck;
+    msgpack_sbuffer_clear(&th->mp_sbuf);
+
+    ret = flb_tail_file_read(file, &out);
+
+    /* The engine is paused or behind, wait for room in the queue */
+    head = th->q_head;
+    while (head - queue_load(&th->q_tail) >= FLB_TAIL_THREAD_QUEUE) {
+        if (queue_load(&ctx->threads_running) == FLB_FALSE) {
+            return;
+        }
+        threads_notify(ctx);
+        flb_time_msleep(1);
+    }
+
+    b = &th->queue[head & QUEUE_MASK];
+    b->file = file;
+    b->ret = ret;
+    b->processed = out.processed;
+    b->read = out.read;
+    b->size = th->mp_sbuf.size;
+    b->buf = NULL;
+    if (b->size > 0) {
+        /* the engine takes the buffer as it is */
+        b->buf = msgpack_sbuffer_release(&th->mp_sbuf);
+    }
+
+    queue_store(&th->q_head, head + 1);
+    threads_notify(ctx);
+}
+
+static void thread_worker(void *data)
+{
+    struct flb_tail_file *file;
+    struct flb_tail_thread *th = data;
+    struct flb_tail_config *ctx = th->ctx;
+
+    flb_debug("[in_tail] reader %i started", th->id);
+
+    while (FLB_TRUE) {
+        pthread_mutex_lock(&th->lock);
+        while (mk_list_is_empty(&th->files) == 0 &&
+               queue_load(&ctx->threads_running) == FLB_TRUE) {
+            pthread_cond_wait(&th->cond, &th->lock);
+        }
+        if (queue_load(&ctx->threads_running) == FLB_FALSE) {
+            pthread_mutex_unlock(&th->lock);
+            break;
+        }
+        file = mk_list_entry_first(&th->files, struct flb_tail_file,
+                                   _thread_head);
+        mk_list_del(&file->_thread_head);
+        pthread_mutex_unlock(&th->lock);
+
+        thread_read(th, file);
+    }
+
+    flb_debug("[in_tail] reader %i stopped", th->id);
+}
+
+/* The reader is done with a file, decide what's next for it */
+static void thread_done(struct flb_tail_file *file, int ret)
+{
+    off_t pending;
+    struct stat st;
+    struct flb_tail_config *ctx = file->config;
+
+    flb_free(file->thread_name);
+    file->thread_name = NULL;
+
+    if (file->thread_remove == FLB_TRUE || ret == FLB_TAIL_ERROR) {
+        flb_tail_file_remove(file);
+        return;
+    }
+
+    if (file->tail_mode == FLB_TAIL_STATIC) {
+        if (ret != FLB_TAIL_WAIT) {
+            /* let the static collector hand the file again */
+            tail_signal_manager(ctx);
+            return;
+        }
+
+        if (ctx->exit_on_eof) {
+            flb_info("[in_tail] file=%s ended, stop", file->name);
+            flb_engine_exit(ctx->i_ins->config);
+        }
+
+        /* Promote file to 'events' type handler */
+        flb_debug("[in_tail] file=%s promote to TAIL_EVENT", file->name);
+        if (flb_tail_file_to_event(file) == -1) {
+            flb_debug("[in_tail] file=%s cannot promote, unregistering",
+                      file->name);
+            flb_tail_file_remove(file);
+        }
+        return;
+    }
+
+    /* Events received while the file was read are handled here */
+    if (fstat(file->fd, &st) == -1) {
+        flb_errno();
+        file->pending_bytes = 0;
+        return;
+    }
+
+    /*
+     * Truncation seen while the reader owned the file, or not seen yet:
+     * the file may have grown again past the read position since then.
+     */
+    if (file->thread_truncated == FLB_TRUE ||
+        flb_tail_file_truncated(file, &st)) {
+        file->thread_truncated = FLB_FALSE;
+        if (flb_tail_file_rewind(file) == -1) {
+            flb_tail_file_remove(file);
+            return;
+        }
+    }
+
+    pending = flb_tail_file_pending(file, &st);
+    if (pending > 0) {
+        file->pending_bytes = pending;
+        tail_signal_pending(ctx);
+    }
+    else {
+        file->pending_bytes = 0;
+    }
+}
+
+/* Drain the queues of all readers, it runs in the engine thread */
+int flb_tail_threads_collect(struct flb_input_instance *i_ins,
+                             struct flb_config *config, void *in_context)
+{
+    int ret;
+    uint64_t val;
+    unsigned int tail;
+    struct mk_list *head;
+    struct flb_tail_file *file;
+    struct flb_tail_thread *th;
+    struct flb_tail_thread_buf *b;
+    struct flb_tail_config *ctx = in_context;
+
+    flb_pipe_r(ctx->ch_threads[0], &val, sizeof(val));
+
+    /* From now on, new data needs a new notification */
+    notify_swap(&ctx->threads_notified, 0);
+
+    mk_list_foreach(head, &ctx->threads_list) {
+        th = mk_list_entry(head, struct flb_tail_thread, _head);
+
+        tail = th->q_tail;
+        while (tail != queue_load(&th->q_head)) {
+            b = &th->queue[tail & QUEUE_MASK];
+            file = b->file;
+            ret = b->ret;
+
+            /* The reader is done with the file, commit it as the owner */
+            file->thread_busy = FLB_FALSE;
+            flb_tail_file_commit(file, b->buf, b->size,
+                                 b->processed, b->read);
+            flb_free(b->buf);
+            tail++;
+            queue_store(&th->q_tail, tail);
+
+            thread_done(file, ret);
+        }
+    }
+
+    return 0;
+}
+
+/* Hand a file to its reader, returns -1 if it's still being read */
+int flb_tail_thread_dispatch(struct flb_tail_file *file)
+{
+    int i = 0;
+    int id;
+    char *name;
+    struct mk_list *head;
+    struct flb_tail_thread *th = NULL;
+    struct flb_tail_config *ctx = file->config;
+
+    if (file->thread_busy == FLB_TRUE) {
+        return -1;
+    }
+
+    /* the name can change on rotation, the reader works with a copy */
+    name = flb_strdup(file->name);
+    if (!name) {
+        flb_errno();
+        return -1;
+    }
+
+    /* Files always go to the same reader */
+    id = file->inode % ctx->threads;
+    mk_list_foreach(head, &ctx->threads_list) {
+        th = mk_list_entry(head, struct flb_tail_thread, _head);
+        if (i++ == id) {
+            break;
+        }
+    }
+
+    file->thread_name = name;
+    file->thread_pos = flb_tail_file_read_pos(file);
+    file->thread_truncated = FLB_FALSE;
+    file->thread_busy = FLB_TRUE;
+
+    pthread_mutex_lock(&th->lock);
+    mk_list_add(&file->_thread_head, &th->files);
+    pthread_cond_signal(&th->cond);
+    pthread_mutex_unlock(&th->lock);
+
+    return 0;
+}
+
+static void thread_destroy(struct flb_tail_thread *th)
+{
+    struct flb_tail_thread_buf *b;
+
+    /* Release buffers that did not reach the engine */
+    while (th->q_tail != th->q_head) {
+        b = &th->queue[th->q_tail & QUEUE_MASK];
+        flb_free(b->buf);
+        th->q_tail++;
+    }
+
+#ifdef FLB_HAVE_PARSER
+    if (th->parser) {
+        flb_parser_destroy(th->parser);
+    }
+#endif
+
+    pthread_mutex_destroy(&th->lock);
+    pthread_cond_destroy(&th->cond);
+    msgpack_sbuffer_destroy(&th->mp_sbuf);
+    mk_list_del(&th->_head);
+    flb_free(th->queue);
+    flb_free(th);
+}
+
+static struct flb_tail_thread *thread_create(struct flb_tail_config *ctx,
+                                             int id)
+{
+    struct flb_tail_thread *th;
+
+    th = flb_calloc(1, sizeof(struct flb_tail_thread));
+    if (!th) {
+        flb_errno();
+        return NULL;
+    }
+    th->id = id;
+    th->ctx = ctx;
+    pthread_mutex_init(&th->lock, NULL);
+    pthread_cond_init(&th->cond, NULL);
+    mk_list_init(&th->files);
+    msgpack_sbuffer_init(&th->mp_sbuf);
+    msgpack_packer_init(&th->mp_pck, &th->mp_sbuf, msgpack_sbuffer_write);
+    mk_list_add(&th->_head, &ctx->threads_list);
+
+    th->queue = flb_calloc(FLB_TAIL_THREAD_QUEUE,
+                           sizeof(struct flb_tail_thread_buf));
+    if (!th->queue) {
+        flb_errno();
+        thread_destroy(th);
+        return NULL;
+    }
+
+#ifdef FLB_HAVE_PARSER
+    /* Parsers keep scratch buffers, every reader needs it own instance */
+    if (ctx->parser) {
+        th->parser = flb_parser_dup(ctx->parser);
+        if (!th->parser) {
+            thread_destroy(th);
+            return NULL;
+        }
+    }
+#endif
+
+    return th;
+}
+
+/* Create the readers, register the engine collector and spawn the threads */
+int flb_tail_threads_create(struct flb_tail_config *ctx,
+                            struct flb_config *config)
+{
+    int i;
+    int ret;
+    struct mk_list *head;
+    struct flb_tail_thread *th;
+
+    ret = flb_pipe_create(ctx->ch_threads);
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    for (i = 0; i < ctx->threads; i++) {
+        th = thread_create(ctx, i);
+        if (!th) {
+            flb_error("[in_tail] could not create reader %i", i);
+            flb_tail_threads_destroy(ctx);
+            return -1;
+        }
+    }
+
+    ret = flb_input_set_collector_event(ctx->i_ins, flb_tail_threads_collect,
+                                        ctx->ch_threads[0], config);
+    if (ret == -1) {
+        flb_tail_threads_destroy(ctx);
+        return -1;
+    }
+    ctx->coll_fd_threads = ret;
+    ctx->threads_running = FLB_TRUE;
+
+    mk_list_foreach(head, &ctx->threads_list) {
+        th = mk_list_entry(head, struct flb_tail_thread, _head);
+        ret = flb_worker_create(thread_worker, th, &th->tid, config);
+        if (ret == -1) {
+            flb_error("[in_tail] could not spawn reader %i", th->id);
+            flb_tail_threads_destroy(ctx);
+            return -1;
+        }
+        th->started = FLB_TRUE;
+    }
+
+    return 0;
+}
+
+/*
+ * Stop and release the readers. Records not registered yet are dropped
+ * and their files keep the previous offset, so they are read again.
+ */
+void flb_tail_threads_destroy(struct flb_tail_config *ctx)
+{
+    int i;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_list *lists[2];
+    struct flb_tail_file *file;
+    struct flb_tail_thread *th;
+
+    queue_store(&ctx->threads_running, FLB_FALSE);
+    mk_list_foreach(head, &ctx->threads_list) {
+        th = mk_list_entry(head, struct flb_tail_thread, _head);
+        if (th->started == FLB_FALSE) {
+            continue;
+        }
+        pthread_mutex_lock(&th->lock);
+        pthread_cond_signal(&th->cond);
+        pthread_mutex_unlock(&th->lock);
+        pthread_join(th->tid, NULL);
+        th->started = FLB_FALSE;
+    }
+
+    mk_list_foreach_safe(head, tmp, &ctx->threads_list) {
+        th = mk_list_entry(head, struct flb_tail_thread, _head);
+        thread_destroy(th);
+    }
+
+    /* The files are owned by the engine again */
+    lists[0] = &ctx->files_static;
+    lists[1] = &ctx->files_event;
+    for (i = 0; i < 2; i++) {
+        mk_list_foreach(head, lists[i]) {
+            file = mk_list_entry(head, struct flb_tail_file, _head);
+            file->thread_busy = FLB_FALSE;
+            flb_free(file->thread_name);
+            file->thread_name = NULL;
+        }
+    }
+
+    if (ctx->ch_threads[0] > 0) {
+        flb_pipe_destroy(ctx->ch_threads);
+        ctx->ch_threads[0] = -1;
+    }
+}
@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TAIL_THREAD_H
+#define FLB_TAIL_THREAD_H
+
+#include <pthread.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_input.h>
+#include <msgpack.h>
+
+#include "tail_config.h"
+#include "tail_file.h"
+
+/* Number of buffers that each reader can queue, must be a power of 2 */
+#define FLB_TAIL_THREAD_QUEUE   64
+
+/* Records read from a file, handed from a reader thread to the engine */
+struct flb_tail_thread_buf {
+    struct flb_tail_file *file;
+    int ret;                             /* FLB_TAIL_OK, WAIT or ERROR */
+    char *buf;
+    size_t size;
+    off_t processed;                     /* offset to move forward     */
+    size_t read;
+};
+
+/*
+ * A reader: a POSIX thread that reads, parses and packs the content of the
+ * files assigned to it, with it own parser instance and buffers.
+ */
+struct flb_tail_thread {
+    int id;                              /* reader number             */
+    pthread_t tid;                       /* thread id                 */
+    int started;                         /* thread is running ?       */
+    struct flb_parser *parser;           /* private copy of 'parser'  */
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    /* Files to read, appended by the engine */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct mk_list files;
+
+    /* Single-producer / single-consumer queue of buffers */
+    unsigned int q_head;                 /* written by the reader     */
+    unsigned int q_tail;                 /* written by the engine     */
+    struct flb_tail_thread_buf *queue;
+
+    struct flb_tail_config *ctx;
+    struct mk_list _head;
+};
+
+int flb_tail_threads_create(struct flb_tail_config *ctx,
+                            struct flb_config *config);
+void flb_tail_threads_destroy(struct flb_tail_config *ctx);
+int flb_tail_thread_dispatch(struct flb_tail_file *file);
+int flb_tail_threads_collect(struct flb_input_instance *i_ins,
+                             struct flb_config *config, void *in_context);
+
+#endif
@@ -46,13 +46,85 @@ static int in_tcp_collect(struct flb_input_instance *in,
     }
 
     flb_trace("[in_tcp] new TCP connection arrived FD=%i", fd);
-    conn = tcp_conn_add(fd, ctx);
+    conn = tcp_conn_add(fd, ctx, NULL);
     if (!conn) {
         return -1;
     }
     return 0;
 }
 
+/* New connection on a listener thread */
+static int in_tcp_accept(flb_sockfd_t fd, struct flb_input_listener *lst,
+                         void *data)
+{
+    struct tcp_conn *conn;
+
+    conn = tcp_conn_add(fd, data, lst);
+    if (!conn) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Records packed by the listener threads are ready */
+static int in_tcp_collect_listeners(struct flb_input_instance *in,
+                                    struct flb_config *config, void *in_context)
+{
+    struct flb_in_tcp_config *ctx = in_context;
+
+    flb_input_listeners_collect(ctx->listeners);
+    return 0;
+}
+
+static void in_tcp_listeners_exit(struct flb_in_tcp_config *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_list *l_head;
+    struct tcp_conn *conn;
+    struct flb_input_listener *lst;
+
+    flb_input_listeners_stop(ctx->listeners);
+
+    mk_list_foreach(l_head, &ctx->listeners->listeners) {
+        lst = mk_list_entry(l_head, struct flb_input_listener, _head);
+        mk_list_foreach_safe(head, tmp, &lst->connections) {
+            conn = mk_list_entry(head, struct tcp_conn, _head);
+            tcp_conn_del(conn);
+        }
+    }
+
+    flb_input_listeners_destroy(ctx->listeners);
+    ctx->listeners = NULL;
+}
+
+static int in_tcp_listeners_init(struct flb_in_tcp_config *ctx,
+                                 struct flb_config *config)
+{
+    int ret;
+
+    ctx->listeners = flb_input_listeners_create(ctx->in,
+                                                ctx->listen, ctx->tcp_port,
+                                                ctx->workers, in_tcp_accept,
+                                                ctx, config);
+    if (!ctx->listeners) {
+        flb_error("[in_tcp] could not bind address %s:%s. Aborting",
+                  ctx->listen, ctx->tcp_port);
+        return -1;
+    }
+
+    ret = flb_input_listeners_start(ctx->listeners, in_tcp_collect_listeners);
+    if (ret == -1) {
+        flb_error("[in_tcp] could not start listeners");
+        in_tcp_listeners_exit(ctx);
+        return -1;
+    }
+
+    flb_info("[in_tcp] binding %s:%s (%i workers)",
+             ctx->listen, ctx->tcp_port, ctx->workers);
+    return 0;
+}
+
 /* Initialize plugin */
 static int in_tcp_init(struct flb_input_instance *in,
                       struct flb_config *config, void *data)
@@ -72,6 +144,18 @@ static int in_tcp_init(struct flb_input_instance *in,
     /* Set the context */
     flb_input_set_context(in, ctx);
 
+    ctx->evl = config->evl;
+
+    /* TCP listener threads */
+    if (ctx->workers > 0) {
+        ret = in_tcp_listeners_init(ctx, config);
+        if (ret == -1) {
+            tcp_config_destroy(ctx);
+            return -1;
+        }
+        return 0;
+    }
+
     /* Create TCP server */
     ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
     if (ctx->server_fd > 0) {
@@ -85,8 +169,6 @@ static int in_tcp_init(struct flb_input_instance *in,
     }
     flb_net_socket_nonblocking(ctx->server_fd);
 
-    ctx->evl = config->evl;
-
     /* Collect upon data available on the standard input */
     ret = flb_input_set_collector_socket(in,
                                         in_tcp_collect,
@@ -109,6 +191,10 @@ static int in_tcp_exit(void *data, struct flb_config *config)
     struct flb_in_tcp_config *ctx = data;
     struct tcp_conn *conn;
 
+    if (ctx->listeners) {
+        in_tcp_listeners_exit(ctx);
+    }
+
     mk_list_foreach_safe(head, tmp, &ctx->connections) {
         conn = mk_list_entry(head, struct tcp_conn, _head);
         tcp_conn_del(conn);
@@ -25,6 +25,7 @@
 #define FLB_TCP_FMT_NONE    1  /* no format, use delimiters */
 
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_listener.h>
 #include <fluent-bit/flb_sds.h>
 #include <msgpack.h>
 
@@ -36,6 +37,8 @@ struct flb_in_tcp_config {
     char *listen;                  /* Listen interface            */
     char *tcp_port;                /* TCP Port                    */
     flb_sds_t separator;           /* String delimiter            */
+    int workers;                   /* Number of listener threads  */
+    struct flb_input_listeners *listeners;
     struct mk_list connections;    /* List of active connections  */
     struct mk_event_loop *evl;     /* Event loop file descriptor  */
     struct flb_input_instance *in; /* Input plugin instace        */
@@ -118,6 +118,12 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
         ctx->tcp_port = flb_strdup(port);
     }
 
+    /* Number of listener threads (SO_REUSEPORT) */
+    tmp = flb_input_get_property("workers", i_ins);
+    if (tmp) {
+        ctx->workers = atoi(tmp);
+    }
+
     /* Chunk size */
     chunk_size = flb_input_get_property("chunk_size", i_ins);
     if (!chunk_size) {
@@ -33,6 +33,17 @@ static inline void consume_bytes(char *buf, int bytes, int length)
     memmove(buf, buf + bytes, length - bytes);
 }
 
+/* Register records, through the listener queue if the connection has one */
+static inline int tcp_conn_append(struct tcp_conn *conn,
+                                  const void *buf, size_t size)
+{
+    if (conn->lst) {
+        return flb_input_listener_append(conn->lst, NULL, 0, buf, size);
+    }
+
+    return flb_input_chunk_append_raw(conn->in, NULL, 0, buf, size);
+}
+
 static inline int process_pack(struct tcp_conn *conn,
                                char *pack, size_t size)
 {
@@ -73,7 +84,7 @@ static inline int process_pack(struct tcp_conn *conn,
 
     msgpack_unpacked_destroy(&result);
 
-    flb_input_chunk_append_raw(conn->in, NULL, 0, mp_sbuf.data, mp_sbuf.size);
+    tcp_conn_append(conn, mp_sbuf.data, mp_sbuf.size);
     msgpack_sbuffer_destroy(&mp_sbuf);
 
     return 0;
@@ -154,7 +165,7 @@ static ssize_t parse_payload_none(struct tcp_conn *conn)
         }
     }
 
-    flb_input_chunk_append_raw(conn->in, NULL, 0, mp_sbuf.data, mp_sbuf.size);
+    tcp_conn_append(conn, mp_sbuf.data, mp_sbuf.size);
     msgpack_sbuffer_destroy(&mp_sbuf);
 
     return consumed;
@@ -253,6 +264,7 @@ int tcp_conn_event(void *data)
         if (ctx->format == FLB_TCP_FMT_JSON) {
             jsmn_init(&conn->pack_state.parser);
             conn->pack_state.tokens_count = 0;
+            conn->pack_state.index_off = 0;
             conn->pack_state.last_byte = 0;
             conn->pack_state.buf_len = 0;
         }
@@ -270,7 +282,8 @@ int tcp_conn_event(void *data)
 }
 
 /* Create a new mqtt request instance */
-struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
+struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx,
+                              struct flb_input_listener *lst)
 {
     int ret;
     struct tcp_conn *conn;
@@ -306,6 +319,14 @@ struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
     }
     conn->buf_size = ctx->chunk_size;
     conn->in       = ctx->in;
+    conn->lst      = lst;
+
+    if (lst) {
+        conn->evl = lst->evl;
+    }
+    else {
+        conn->evl = ctx->evl;
+    }
 
     /* Initialize JSON parser */
     if (ctx->format == FLB_TCP_FMT_JSON) {
@@ -314,7 +335,7 @@ struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
     }
 
     /* Register instance into the event loop */
-    ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
+    ret = mk_event_add(conn->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
     if (ret == -1) {
         flb_error("[in_tcp] could not register new connection");
         flb_socket_close(fd);
@@ -323,7 +344,12 @@ struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
         return NULL;
     }
 
-    mk_list_add(&conn->_head, &ctx->connections);
+    if (lst) {
+        mk_list_add(&conn->_head, &lst->connections);
+    }
+    else {
+        mk_list_add(&conn->_head, &ctx->connections);
+    }
 
     return conn;
 }
@@ -338,7 +364,7 @@ int tcp_conn_del(struct tcp_conn *conn)
         flb_pack_state_reset(&conn->pack_state);
     }
     /* Unregister the file descriptior from the event-loop */
-    mk_event_del(ctx->evl, &conn->event);
+    mk_event_del(conn->evl, &conn->event);
 
     /* Release resources */
     mk_list_del(&conn->_head);
@@ -49,12 +49,15 @@ struct tcp_conn {
 
     struct flb_input_instance *in;    /* Parent plugin instance            */
     struct flb_in_tcp_config *ctx;    /* Plugin configuration context      */
+    struct mk_event_loop *evl;        /* Event loop of the connection      */
+    struct flb_input_listener *lst;   /* Listener thread, if any           */
     struct flb_pack_state pack_state; /* Internal JSON parser              */
 
     struct mk_list _head;
 };
 
-struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx);
+struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx,
+                              struct flb_input_listener *lst);
 int tcp_conn_del(struct tcp_conn *conn);
 
 #endif
@@ -26,6 +26,7 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_gzip_pool.h>
 
 #include <msgpack.h>
 
@@ -305,8 +306,9 @@ static void cb_datadog_flush(const void *data, size_t bytes,
 
     /* Should we compress the payload ? */
     if (ctx->compress_gzip == FLB_TRUE) {
-        ret = flb_gzip_compress((void *) payload_buf, payload_size,
-                                &final_payload_buf, &final_payload_size);
+        ret = flb_gzip_pool_compress(config->gzip_pool,
+                                     payload_buf, payload_size, -1,
+                                     &final_payload_buf, &final_payload_size);
         if (ret == -1) {
             flb_error("[out_http] cannot gzip payload, disabling compression");
         } else {
@@ -29,6 +29,10 @@
 #include <msgpack.h>
 
 #include "forward.h"
+#include "forward_ack.h"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 struct flb_output_plugin out_forward_plugin;
 
@@ -452,6 +456,9 @@ static int secure_forward_write_options(struct flb_upstream_conn *u_conn,
             opt_count++;
         }
     }
+    if (fc->compress == FLB_FORWARD_COMPRESS_GZIP) {
+        opt_count++;
+    }
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
@@ -471,6 +478,14 @@ static int secure_forward_write_options(struct flb_upstream_conn *u_conn,
     msgpack_pack_str_body(&mp_pck, "size", 4);
     msgpack_pack_int64(&mp_pck, size);
 
+    // "compressed": "gzip"
+    if (fc->compress == FLB_FORWARD_COMPRESS_GZIP) {
+        msgpack_pack_str(&mp_pck, 10);
+        msgpack_pack_str_body(&mp_pck, "compressed", 10);
+        msgpack_pack_str(&mp_pck, 4);
+        msgpack_pack_str_body(&mp_pck, "gzip", 4);
+    }
+
     ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size, &bytes_sent);
     if (ret == -1) {
         msgpack_sbuffer_destroy(&mp_sbuf);
@@ -570,9 +585,77 @@ static int secure_forward_read_ack(struct flb_upstream_conn *u_conn,
 }
 
 
+/* Set the compression mode, it implies sending options */
+static int forward_config_compress(struct flb_forward_config *fc,
+                                   const char *tmp)
+{
+    if (!tmp || strcasecmp(tmp, "none") == 0) {
+        fc->compress = FLB_FORWARD_COMPRESS_NONE;
+    }
+    else if (strcasecmp(tmp, "gzip") == 0) {
+        fc->compress = FLB_FORWARD_COMPRESS_GZIP;
+        fc->send_options = FLB_TRUE;
+    }
+    else {
+        flb_error("[out_forward] invalid compress mode '%s'", tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Ack pipelining: un-acked chunks per connection and ack timeout */
+static int forward_config_ack(struct flb_forward_config *fc,
+                              const char *max_inflight, const char *timeout)
+{
+    fc->max_inflight = FLB_FORWARD_MAX_INFLIGHT;
+    if (max_inflight) {
+        fc->max_inflight = atoi(max_inflight);
+        if (fc->max_inflight < 1) {
+            flb_error("[out_forward] invalid max_inflight_chunks '%s'",
+                      max_inflight);
+            return -1;
+        }
+    }
+
+    fc->ack_timeout = FLB_FORWARD_ACK_TIMEOUT;
+    if (timeout) {
+        fc->ack_timeout = atoi(timeout);
+        if (fc->ack_timeout < 1) {
+            flb_error("[out_forward] invalid ack_response_timeout '%s'",
+                      timeout);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Seed for the chunk ids, they only need to be unique */
+static void forward_config_chunk_seed(struct flb_forward_config *fc)
+{
+    int fd;
+    ssize_t bytes = 0;
+    uint64_t seed;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd != -1) {
+        bytes = read(fd, fc->chunk_seed, sizeof(fc->chunk_seed));
+        close(fd);
+    }
+
+    if (bytes != sizeof(fc->chunk_seed)) {
+        seed = ((uint64_t) time(NULL) << 32) ^ getpid() ^ (uintptr_t) fc;
+        memcpy(fc->chunk_seed, &seed, sizeof(seed));
+    }
+    fc->chunk_seq = 0;
+}
+
 static int forward_config_init(struct flb_forward_config *fc,
                                struct flb_forward *ctx)
 {
+    forward_config_chunk_seed(fc);
+
 #ifdef FLB_HAVE_TLS
     /* Initialize Secure Forward mode */
     if (fc->secured == FLB_TRUE) {
@@ -580,12 +663,26 @@ static int forward_config_init(struct flb_forward_config *fc,
     }
 #endif
 
+    /* Deflate context for CompressedPackedForward mode */
+    if (fc->compress == FLB_FORWARD_COMPRESS_GZIP) {
+        fc->gzip = flb_gzip_deflate_create(-1);
+        if (!fc->gzip) {
+            return -1;
+        }
+    }
+
     mk_list_add(&fc->_head, &ctx->configs);
     return 0;
 }
 
 static void forward_config_destroy(struct flb_forward_config *fc)
 {
+    if (fc->pipeline) {
+        forward_ack_pipeline_destroy(fc->pipeline);
+    }
+    if (fc->gzip) {
+        flb_gzip_deflate_destroy(fc->gzip);
+    }
     flb_sds_destroy(fc->shared_key);
     flb_sds_destroy(fc->self_hostname);
     flb_free(fc);
@@ -699,6 +796,23 @@ static int forward_config_ha(const char *upstream_file,
             }
         }
 
+        /* CompressedPackedForward mode (implies send_options) */
+        tmp = flb_upstream_node_get_property("compress", node);
+        ret = forward_config_compress(fc, tmp);
+        if (ret == -1) {
+            forward_config_destroy(fc);
+            return -1;
+        }
+
+        /* Ack pipelining */
+        ret = forward_config_ack(fc,
+                   flb_upstream_node_get_property("max_inflight_chunks", node),
+                   flb_upstream_node_get_property("ack_response_timeout", node));
+        if (ret == -1) {
+            forward_config_destroy(fc);
+            return -1;
+        }
+
         /* Initialize and validate forward_config context */
         ret = forward_config_init(fc, ctx);
         if (ret == -1) {
@@ -835,6 +949,23 @@ static int forward_config_simple(struct flb_forward *ctx,
         }
     }
 
+    /* CompressedPackedForward mode (implies send_options) */
+    tmp = flb_output_get_property("compress", ins);
+    ret = forward_config_compress(fc, tmp);
+    if (ret == -1) {
+        forward_config_destroy(fc);
+        return -1;
+    }
+
+    /* Ack pipelining */
+    ret = forward_config_ack(fc,
+                             flb_output_get_property("max_inflight_chunks", ins),
+                             flb_output_get_property("ack_response_timeout", ins));
+    if (ret == -1) {
+        forward_config_destroy(fc);
+        return -1;
+    }
+
     /* Initialize and validate forward_config context */
     ret = forward_config_init(fc, ctx);
     if (ret == -1) {
@@ -964,6 +1095,134 @@ static int cb_forward_exit(void *data, struct flb_config *config)
     return 0;
 }
 
+/* Cheap chunk id: per config random seed plus a sequence number */
+static void forward_chunk_id(struct flb_forward_config *fc, char *out)
+{
+    uint8_t id[16];
+    uint64_t seq;
+
+    seq = fc->chunk_seq++;
+    memcpy(id, fc->chunk_seed, 8);
+    memcpy(id + 8, &seq, 8);
+    secure_forward_bin_to_hex(id, 16, out);
+    out[FLB_FORWARD_CHUNK_ID_SIZE] = '\0';
+}
+
+/* Write a complete message: header, entries and options */
+static int forward_write_message(struct flb_upstream_conn *u_conn,
+                                 struct flb_forward_config *fc,
+                                 struct flb_forward *ctx,
+                                 msgpack_sbuffer *hdr,
+                                 const void *buf, size_t size,
+                                 int entries, char *chunk, size_t *total)
+{
+    int ret;
+    size_t bytes_sent;
+
+    ret = flb_io_net_write(u_conn, hdr->data, hdr->size, &bytes_sent);
+    if (ret == -1) {
+        flb_error("[out_fw] could not write chunk header");
+        return -1;
+    }
+    *total = bytes_sent;
+
+    ret = flb_io_net_write(u_conn, buf, size, &bytes_sent);
+    if (ret == -1) {
+        flb_error("[out_fw] error writing content body");
+        return -1;
+    }
+    *total += bytes_sent;
+
+    if (fc->send_options) {
+        flb_debug("[out_fw] send options entries=%d chunk='%s'",
+                  entries, chunk ? chunk : "NULL");
+
+        ret = secure_forward_write_options(u_conn, fc, ctx, entries, chunk,
+                                           &bytes_sent);
+        if (ret < 0) {
+            flb_error("[out_fw] error writing option");
+            return -1;
+        }
+        *total += bytes_sent;
+    }
+
+    return 0;
+}
+
+/*
+ * require_ack_response over a connection shared by the flushes: the chunk
+ * is written as soon as the connection is free and several chunks wait
+ * for their ack at the same time.
+ */
+static int forward_flush_pipeline(struct flb_forward_config *fc,
+                                  struct flb_forward *ctx,
+                                  struct flb_upstream *u,
+                                  msgpack_sbuffer *hdr,
+                                  const void *buf, size_t size,
+                                  int entries, struct flb_config *config)
+{
+    int ret;
+    size_t total;
+    char chunk[FLB_FORWARD_CHUNK_ID_SIZE + 1];
+    struct flb_upstream_conn *u_conn;
+    struct flb_forward_pipeline *pl;
+
+    if (!fc->pipeline) {
+        fc->pipeline = forward_ack_pipeline_create(fc, config);
+        if (!fc->pipeline) {
+            return FLB_RETRY;
+        }
+    }
+    pl = fc->pipeline;
+
+    forward_ack_lock(pl);
+
+    if (!pl->u_conn) {
+        u_conn = flb_upstream_conn_get(u);
+        if (!u_conn) {
+            flb_error("[out_fw] no upstream connections available");
+            forward_ack_unlock(pl);
+            return FLB_RETRY;
+        }
+
+        if (fc->shared_key && u_conn->ka_count == 0) {
+            ret = secure_forward_handshake(u_conn, fc, ctx);
+            flb_debug("[out_fw] handshake status = %i", ret);
+            if (ret == -1) {
+                flb_upstream_conn_release(u_conn);
+                forward_ack_unlock(pl);
+                return FLB_RETRY;
+            }
+        }
+
+        ret = forward_ack_attach(pl, u_conn);
+        if (ret == -1) {
+            flb_upstream_conn_release(u_conn);
+            forward_ack_unlock(pl);
+            return FLB_RETRY;
+        }
+    }
+
+    forward_chunk_id(fc, chunk);
+    ret = forward_write_message(pl->u_conn, fc, ctx, hdr, buf, size,
+                                entries, chunk, &total);
+    if (ret == -1) {
+        forward_ack_fail(pl);
+        forward_ack_unlock(pl);
+        return FLB_RETRY;
+    }
+    flb_trace("[out_fw] ended write()=%lu bytes", total);
+
+    /* Releases the connection for the next chunk and waits */
+    ret = forward_ack_wait(pl, chunk);
+    if (ret == -1) {
+        flb_error("[out_fw] chunk '%s' was not acknowledged", chunk);
+        return FLB_RETRY;
+    }
+
+    return FLB_OK;
+}
+
 static void cb_forward_flush(const void *data, size_t bytes,
                              const char *tag, int tag_len,
                              struct flb_input_instance *i_ins,
@@ -973,12 +1232,13 @@ static void cb_forward_flush(const void *data, size_t bytes,
     int ret = -1;
     int entries = 0;
     size_t total;
-    size_t bytes_sent;
     msgpack_packer   mp_pck;
     msgpack_sbuffer  mp_sbuf;
     void *tmp_buf = NULL;
+    void *zip_buf = NULL;
     const void *out_buf = NULL;
     size_t out_size = 0;
+    size_t zip_size = 0;
     struct flb_forward *ctx = out_context;
     struct flb_forward_config *fc = NULL;
     struct flb_upstream_conn *u_conn;
@@ -986,9 +1246,7 @@ static void cb_forward_flush(const void *data, size_t bytes,
     (void) i_ins;
     (void) config;
     char *chunkptr;
-    struct flb_sha512 sha512;
-    uint8_t checksum[64];
-    char checksum_hex[33];
+    char chunk[FLB_FORWARD_CHUNK_ID_SIZE + 1];
 
     if (ctx->ha_mode == FLB_TRUE) {
         node = flb_upstream_ha_node_get(ctx->ha);
@@ -1023,11 +1281,49 @@ static void cb_forward_flush(const void *data, size_t bytes,
     flb_debug("[out_fw] %i entries tag='%s' tag_len=%i",
               entries, tag, tag_len);
 
+    /* CompressedPackedForward: entries are sent as a GZip'ed binary */
+    if (fc->compress == FLB_FORWARD_COMPRESS_GZIP) {
+        ret = flb_gzip_deflate_compress(fc->gzip, out_buf, out_size,
+                                        &zip_buf, &zip_size);
+        if (tmp_buf) {
+            flb_free(tmp_buf);
+        }
+        if (ret == -1) {
+            flb_error("[out_fw] could not compress chunk");
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        flb_debug("[out_fw] gzip %lu -> %lu bytes", out_size, zip_size);
+
+        /* From now the compressed buffer is the one to be released */
+        tmp_buf = zip_buf;
+        out_buf = zip_buf;
+        out_size = zip_size;
+    }
+
     /* Output: root array */
     msgpack_pack_array(&mp_pck, fc->send_options ? 3 : 2);
     msgpack_pack_str(&mp_pck, tag_len);
     msgpack_pack_str_body(&mp_pck, tag, tag_len);
-    msgpack_pack_array(&mp_pck, entries);
+    if (fc->compress == FLB_FORWARD_COMPRESS_GZIP) {
+        msgpack_pack_bin(&mp_pck, out_size);
+    }
+    else {
+        msgpack_pack_array(&mp_pck, entries);
+    }
+
+    /* TLS connections wait for the ack on the same connection */
+    if (fc->require_ack_response && fc->secured == FLB_FALSE) {
+        ret = forward_flush_pipeline(fc, ctx,
+                                     ctx->ha_mode ? node->u : ctx->u,
+                                     &mp_sbuf, out_buf, out_size,
+                                     entries, config);
+        msgpack_sbuffer_destroy(&mp_sbuf);
+        if (tmp_buf) {
+            flb_free(tmp_buf);
+        }
+        FLB_OUTPUT_RETURN(ret);
+    }
 
     /* Get a TCP connection instance */
     if (ctx->ha_mode == FLB_TRUE) {
@@ -1039,7 +1335,7 @@ static void cb_forward_flush(const void *data, size_t bytes,
     if (!u_conn) {
         flb_error("[out_fw] no upstream connections available");
         msgpack_sbuffer_destroy(&mp_sbuf);
-        if (fc->time_as_integer == FLB_TRUE) {
+        if (tmp_buf) {
             flb_free(tmp_buf);
         }
         FLB_OUTPUT_RETURN(FLB_RETRY);
@@ -1053,81 +1349,42 @@ static void cb_forward_flush(const void *data, size_t bytes,
         if (ret == -1) {
             flb_upstream_conn_release(u_conn);
             msgpack_sbuffer_destroy(&mp_sbuf);
-            if (fc->time_as_integer == FLB_TRUE) {
+            if (tmp_buf) {
                 flb_free(tmp_buf);
             }
             FLB_OUTPUT_RETURN(FLB_RETRY);
         }
     }
 
-    /* Write message header */
-    ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size, &bytes_sent);
-    if (ret == -1) {
-        flb_error("[out_fw] could not write chunk header");
-        msgpack_sbuffer_destroy(&mp_sbuf);
-        flb_upstream_conn_release(u_conn);
-        if (fc->time_as_integer == FLB_TRUE) {
-            flb_free(tmp_buf);
-        }
-        FLB_OUTPUT_RETURN(FLB_RETRY);
+    chunkptr = NULL;
+    if (fc->require_ack_response) {
+        forward_chunk_id(fc, chunk);
+        chunkptr = chunk;
     }
 
+    ret = forward_write_message(u_conn, fc, ctx, &mp_sbuf, out_buf, out_size,
+                                entries, chunkptr, &total);
     msgpack_sbuffer_destroy(&mp_sbuf);
-    total = ret;
-
-    /* Write body (records) */
-    ret = flb_io_net_write(u_conn, out_buf, out_size, &bytes_sent);
+    if (tmp_buf) {
+        flb_free(tmp_buf);
+    }
     if (ret == -1) {
-        flb_error("[out_fw] error writing content body");
-        if (fc->time_as_integer == FLB_TRUE) {
-            flb_free(tmp_buf);
-        }
         flb_upstream_conn_release(u_conn);
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
 
-    total += bytes_sent;
-
-    if (fc->time_as_integer == FLB_TRUE) {
-        flb_free(tmp_buf);
-    }
-
-    if(fc->send_options) {
-        chunkptr = NULL;
-        if(fc->require_ack_response) {
-            /* for ack we calculate  sha512 of context, take 16 bytes,  make 32 byte hex string of it */
-            flb_sha512_init(&sha512);
-            flb_sha512_update(&sha512,data,bytes);
-            flb_sha512_sum(&sha512,checksum); // => 65 bytes
-            secure_forward_bin_to_hex(checksum, 16, checksum_hex);
-            checksum_hex[32] = '\0';
-            chunkptr = (char*) checksum_hex;
-        }
-
-        flb_debug("[out_fw] send options entries=%d chunk='%s'", entries, chunkptr ? chunkptr : "NULL");
-
-        ret = secure_forward_write_options(u_conn, fc, ctx, entries, chunkptr, &bytes_sent);
-        if(ret < 0) {
-            flb_error("[out_fw] error writing option");
+    if (chunkptr) {
+        ret = secure_forward_read_ack(u_conn, fc, ctx, chunkptr);
+        if (ret < 0) {
+            flb_error("[out_fw] error wait ACK");
             flb_upstream_conn_release(u_conn);
             FLB_OUTPUT_RETURN(FLB_RETRY);
         }
-
-        total += bytes_sent;
-
-        if(chunkptr) {
-            ret = secure_forward_read_ack(u_conn, fc, ctx, chunkptr);
-            if(ret < 0) {
-                flb_error("[out_fw] error wait ACK");
-                flb_upstream_conn_release(u_conn);
-                FLB_OUTPUT_RETURN(FLB_RETRY);
-            }
-        }
     }
 
     flb_upstream_conn_release(u_conn);
 
-    flb_trace("[out_fw] ended write()=%d bytes", total);
+    flb_trace("[out_fw] ended write()=%lu bytes", total);
     FLB_OUTPUT_RETURN(FLB_OK);
 }
 
@@ -23,6 +23,7 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_gzip.h>
 
 #ifdef FLB_HAVE_TLS
 #include <mbedtls/entropy.h>
@@ -30,6 +31,19 @@
 #include <mbedtls/ctr_drbg.h>
 #endif
 
+/* Chunk id: 16 bytes as a hex string */
+#define FLB_FORWARD_CHUNK_ID_SIZE  32
+
+/* Ack pipelining defaults */
+#define FLB_FORWARD_MAX_INFLIGHT   8
+#define FLB_FORWARD_ACK_TIMEOUT    190
+
+struct flb_forward_pipeline;
+
+/* Compression modes */
+#define FLB_FORWARD_COMPRESS_NONE  0
+#define FLB_FORWARD_COMPRESS_GZIP  1
+
 /*
  * Configuration: we put this separate from the main
  * context so every Upstream Node can have it own configuration
@@ -49,6 +63,19 @@ struct flb_forward_config {
     int empty_shared_key;     /* use an empty string as shared key */
     int require_ack_response; /* Require acknowledge for "chunk" */
     int send_options;         /* send options in messages */
+    int compress;             /* CompressedPackedForward mode */
+    int max_inflight;         /* Un-acked chunks per connection */
+    int ack_timeout;          /* Seconds to wait for a chunk ack */
+
+    /* Chunk id source: random seed and sequence number */
+    uint8_t chunk_seed[8];
+    uint64_t chunk_seq;
+
+    /* Connection shared by flushes waiting for acks */
+    struct flb_forward_pipeline *pipeline;
+
+    /* Reusable deflate context (compress gzip) */
+    struct flb_gzip_deflate *gzip;
 
     const char *username;
     const char *password;
@@ -0,0 +1,497 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_upstream.h>
+#include <msgpack.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "forward.h"
+#include "forward_ack.h"
+
+/* A co-routine waiting to write on the pipeline */
+struct forward_ack_waiter {
+    int queued;
+    struct flb_thread *th;
+    struct mk_list _head;
+};
+
+static void forward_ack_timer(struct flb_forward_pipeline *pl);
+
+/* Resume a co-routine and restore the running context afterwards */
+static void forward_ack_resume(struct flb_thread *th)
+{
+    void *prev;
+
+    prev = pthread_getspecific(flb_thread_key);
+    flb_thread_resume(th);
+    pthread_setspecific(flb_thread_key, prev);
+}
+
+/* Let the next writer in if the write side and an in-flight slot are free */
+static void forward_ack_wake(struct flb_forward_pipeline *pl)
+{
+    struct forward_ack_waiter *w;
+
+    if (pl->writing == FLB_TRUE || pl->inflight >= pl->fc->max_inflight ||
+        mk_list_is_empty(&pl->waiters) == 0) {
+        return;
+    }
+
+    w = mk_list_entry_first(&pl->waiters, struct forward_ack_waiter, _head);
+    mk_list_del(&w->_head);
+    w->queued = FLB_FALSE;
+    forward_ack_resume(w->th);
+}
+
+/* Resume the co-routines whose chunk got a final status */
+static void forward_ack_complete(struct flb_forward_pipeline *pl,
+                                 struct mk_list *done)
+{
+    struct flb_thread *th;
+    struct flb_forward_ack *ack;
+
+    while (mk_list_is_empty(done) != 0) {
+        ack = mk_list_entry_first(done, struct flb_forward_ack, _head);
+        mk_list_del(&ack->_head);
+
+        /* Chunks not waiting yet will check their status by themselves */
+        th = ack->th;
+        if (th) {
+            forward_ack_resume(th);
+        }
+    }
+
+    forward_ack_wake(pl);
+}
+
+/* Move every in-flight chunk to the done list as failed */
+static void forward_ack_fail_all(struct flb_forward_pipeline *pl,
+                                 struct mk_list *done)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_forward_ack *ack;
+
+    mk_list_foreach_safe(head, tmp, &pl->acks) {
+        ack = mk_list_entry(head, struct flb_forward_ack, _head);
+        mk_list_del(&ack->_head);
+        ack->status = FLB_FORWARD_ACK_FAILED;
+        mk_list_add(&ack->_head, done);
+        pl->inflight--;
+    }
+}
+
+/* Release the connection, the write side must not be in use */
+static void forward_ack_release(struct flb_forward_pipeline *pl)
+{
+    if (pl->ack_fd != -1) {
+        mk_event_del(pl->config->evl, &pl->event);
+        close(pl->ack_fd);
+        pl->ack_fd = -1;
+    }
+
+    if (pl->u_conn) {
+        /* Make sure a keepalive connection is not recycled */
+        shutdown(pl->u_conn->fd, SHUT_RDWR);
+        flb_upstream_conn_release(pl->u_conn);
+        pl->u_conn = NULL;
+    }
+
+    pl->ack_len = 0;
+    pl->broken = FLB_FALSE;
+}
+
+/*
+ * The connection failed: in-flight chunks will be retried. If a co-routine
+ * is writing, the connection is released once it's done with it.
+ */
+static void forward_ack_drop(struct flb_forward_pipeline *pl,
+                             struct mk_list *done)
+{
+    forward_ack_fail_all(pl, done);
+
+    if (pl->ack_fd != -1) {
+        mk_event_del(pl->config->evl, &pl->event);
+        close(pl->ack_fd);
+        pl->ack_fd = -1;
+    }
+
+    if (pl->writing == FLB_TRUE) {
+        pl->broken = FLB_TRUE;
+    }
+    else {
+        forward_ack_release(pl);
+    }
+}
+
+static struct flb_forward_ack *forward_ack_lookup(struct flb_forward_pipeline *pl,
+                                                  const char *chunk, size_t len)
+{
+    struct mk_list *head;
+    struct flb_forward_ack *ack;
+
+    if (len != FLB_FORWARD_CHUNK_ID_SIZE) {
+        return NULL;
+    }
+
+    mk_list_foreach(head, &pl->acks) {
+        ack = mk_list_entry(head, struct flb_forward_ack, _head);
+        if (memcmp(ack->chunk, chunk, len) == 0) {
+            return ack;
+        }
+    }
+
+    return NULL;
+}
+
+/* Parse complete ack messages: {"ack": "<chunk id>"} */
+static int forward_ack_parse(struct flb_forward_pipeline *pl,
+                             struct mk_list *done)
+{
+    int i;
+    int ret;
+    size_t off = 0;
+    size_t prev = 0;
+    msgpack_object root;
+    msgpack_object *key;
+    msgpack_object *val;
+    msgpack_unpacked result;
+    struct flb_forward_ack *ack;
+
+    msgpack_unpacked_init(&result);
+    while ((ret = msgpack_unpack_next(&result, pl->ack_buf, pl->ack_len,
+                                      &off)) == MSGPACK_UNPACK_SUCCESS) {
+        root = result.data;
+        if (root.type != MSGPACK_OBJECT_MAP) {
+            flb_error("[out_fw] ACK response not MAP (type:%d)", root.type);
+            msgpack_unpacked_destroy(&result);
+            return -1;
+        }
+
+        val = NULL;
+        for (i = 0; i < root.via.map.size; i++) {
+            key = &root.via.map.ptr[i].key;
+            if (key->type == MSGPACK_OBJECT_STR && key->via.str.size == 3 &&
+                strncmp(key->via.str.ptr, "ack", 3) == 0) {
+                val = &root.via.map.ptr[i].val;
+                break;
+            }
+        }
+
+        if (!val || val->type != MSGPACK_OBJECT_STR) {
+            flb_error("[out_fw] ack: ack not found");
+            msgpack_unpacked_destroy(&result);
+            return -1;
+        }
+
+        ack = forward_ack_lookup(pl, val->via.str.ptr, val->via.str.size);
+        if (ack) {
+            flb_debug("[out_fw] protocol: received ACK %s", ack->chunk);
+            mk_list_del(&ack->_head);
+            ack->status = FLB_FORWARD_ACK_OK;
+            mk_list_add(&ack->_head, done);
+            pl->inflight--;
+        }
+        else {
+            /* likely the ack of a chunk that timed out */
+            flb_warn("[out_fw] ack: unknown chunk '%.*s'",
+                     (int) val->via.str.size, val->via.str.ptr);
+        }
+        prev = off;
+    }
+    msgpack_unpacked_destroy(&result);
+
+    if (ret == MSGPACK_UNPACK_PARSE_ERROR || ret == MSGPACK_UNPACK_NOMEM_ERROR) {
+        flb_error("[out_fw] invalid ACK message");
+        return -1;
+    }
+
+    /* Keep any incomplete message */
+    if (prev > 0) {
+        memmove(pl->ack_buf, pl->ack_buf + prev, pl->ack_len - prev);
+        pl->ack_len -= prev;
+    }
+
+    return 0;
+}
+
+/* Event loop handler: the server sent acks */
+static int forward_ack_event(void *data)
+{
+    int ret;
+    ssize_t bytes;
+    struct mk_list done;
+    struct flb_forward_pipeline *pl = data;
+
+    mk_list_init(&done);
+
+    while (1) {
+        if (pl->ack_len == sizeof(pl->ack_buf)) {
+            flb_error("[out_fw] ACK message too large");
+            forward_ack_drop(pl, &done);
+            break;
+        }
+
+        bytes = recv(pl->ack_fd, pl->ack_buf + pl->ack_len,
+                     sizeof(pl->ack_buf) - pl->ack_len, MSG_DONTWAIT);
+        if (bytes == -1 && FLB_WOULDBLOCK()) {
+            break;
+        }
+        else if (bytes <= 0) {
+            flb_warn("[out_fw] connection closed, %i chunks in flight",
+                     pl->inflight);
+            forward_ack_drop(pl, &done);
+            break;
+        }
+        pl->ack_len += bytes;
+
+        ret = forward_ack_parse(pl, &done);
+        if (ret == -1) {
+            forward_ack_drop(pl, &done);
+            break;
+        }
+    }
+
+    forward_ack_complete(pl, &done);
+    return 0;
+}
+
+/* Timer callback: fail the chunks whose ack did not arrive in time */
+static void forward_ack_timeout(struct flb_config *config, void *data)
+{
+    time_t now;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_list done;
+    struct flb_forward_ack *ack;
+    struct flb_forward_pipeline *pl = data;
+    (void) config;
+
+    pl->timer = FLB_FALSE;
+    mk_list_init(&done);
+
+    now = time(NULL);
+    mk_list_foreach_safe(head, tmp, &pl->acks) {
+        ack = mk_list_entry(head, struct flb_forward_ack, _head);
+        if (ack->deadline >= now) {
+            continue;
+        }
+
+        flb_warn("[out_fw] chunk '%s' ack timeout (%i seconds)",
+                 ack->chunk, pl->fc->ack_timeout);
+        mk_list_del(&ack->_head);
+        ack->status = FLB_FORWARD_ACK_FAILED;
+        mk_list_add(&ack->_head, &done);
+        pl->inflight--;
+    }
+
+    forward_ack_complete(pl, &done);
+    forward_ack_timer(pl);
+}
+
+/*
+ * Check ack timeouts while there are chunks in flight. Timer expirations are
+ * rounded to whole seconds, a two seconds period makes sure a timer armed
+ * from its own callback does not fire again right away.
+ */
+static void forward_ack_timer(struct flb_forward_pipeline *pl)
+{
+    int ret;
+
+    if (pl->timer == FLB_TRUE || pl->inflight == 0) {
+        return;
+    }
+
+    ret = flb_sched_timer_cb_create(pl->config, 2000,
+                                    forward_ack_timeout, pl);
+    if (ret == 0) {
+        pl->timer = FLB_TRUE;
+    }
+}
+
+/* Wait until this co-routine can write a new chunk */
+void forward_ack_lock(struct flb_forward_pipeline *pl)
+{
+    struct flb_thread *th;
+    struct forward_ack_waiter w;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+
+    while (pl->writing == FLB_TRUE || pl->inflight >= pl->fc->max_inflight) {
+        w.th = th;
+        w.queued = FLB_TRUE;
+        mk_list_add(&w._head, &pl->waiters);
+        while (w.queued == FLB_TRUE) {
+            flb_thread_yield(th, FLB_FALSE);
+        }
+    }
+
+    pl->writing = FLB_TRUE;
+}
+
+void forward_ack_unlock(struct flb_forward_pipeline *pl)
+{
+    pl->writing = FLB_FALSE;
+
+    /* The connection failed while we were writing */
+    if (pl->broken == FLB_TRUE) {
+        forward_ack_release(pl);
+    }
+
+    forward_ack_wake(pl);
+}
+
+/* Use a new connection, called with the write side locked */
+int forward_ack_attach(struct flb_forward_pipeline *pl,
+                       struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    struct mk_event *event;
+
+    /* A recycled keepalive connection is monitored for disconnections */
+    if (u_conn->event.status & MK_EVENT_REGISTERED) {
+        mk_event_del(u_conn->u->evl, &u_conn->event);
+    }
+
+    /*
+     * Acks are read from the event loop through a duplicate of the socket,
+     * so the connection event stays available for the writers.
+     */
+    pl->ack_fd = dup(u_conn->fd);
+    if (pl->ack_fd == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    event = &pl->event;
+    MK_EVENT_NEW(event);
+    event->fd      = pl->ack_fd;
+    event->type    = FLB_ENGINE_EV_CUSTOM;
+    event->handler = forward_ack_event;
+
+    ret = mk_event_add(pl->config->evl, pl->ack_fd,
+                       FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, pl);
+    if (ret == -1) {
+        flb_error("[out_fw] could not register ack reader");
+        close(pl->ack_fd);
+        pl->ack_fd = -1;
+        return -1;
+    }
+
+    pl->u_conn = u_conn;
+    pl->ack_len = 0;
+    pl->broken = FLB_FALSE;
+
+    return 0;
+}
+
+/* A write failed, called with the write side locked */
+void forward_ack_fail(struct flb_forward_pipeline *pl)
+{
+    struct mk_list done;
+
+    mk_list_init(&done);
+    forward_ack_drop(pl, &done);
+    forward_ack_complete(pl, &done);
+}
+
+/*
+ * The chunk has been written: register it as in-flight, release the write
+ * side and wait for the ack. Returns 0 once acknowledged.
+ */
+int forward_ack_wait(struct flb_forward_pipeline *pl, const char *chunk)
+{
+    struct flb_thread *th;
+    struct flb_forward_ack ack;
+
+    /* The connection failed while we were writing */
+    if (pl->broken == FLB_TRUE) {
+        forward_ack_unlock(pl);
+        return -1;
+    }
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+
+    memcpy(ack.chunk, chunk, FLB_FORWARD_CHUNK_ID_SIZE);
+    ack.chunk[FLB_FORWARD_CHUNK_ID_SIZE] = '\0';
+    ack.status = FLB_FORWARD_ACK_PENDING;
+    ack.deadline = time(NULL) + pl->fc->ack_timeout;
+    ack.th = NULL;
+    mk_list_add(&ack._head, &pl->acks);
+    pl->inflight++;
+
+    flb_trace("[out_fw] wait ACK (%s), %i chunks in flight",
+              ack.chunk, pl->inflight);
+
+    forward_ack_timer(pl);
+    forward_ack_unlock(pl);
+
+    while (ack.status == FLB_FORWARD_ACK_PENDING) {
+        ack.th = th;
+        flb_thread_yield(th, FLB_FALSE);
+        ack.th = NULL;
+    }
+
+    if (ack.status != FLB_FORWARD_ACK_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+struct flb_forward_pipeline *forward_ack_pipeline_create(
+                                             struct flb_forward_config *fc,
+                                             struct flb_config *config)
+{
+    struct flb_forward_pipeline *pl;
+
+    pl = flb_calloc(1, sizeof(struct flb_forward_pipeline));
+    if (!pl) {
+        flb_errno();
+        return NULL;
+    }
+
+    pl->ack_fd = -1;
+    pl->fc = fc;
+    pl->config = config;
+    mk_list_init(&pl->acks);
+    mk_list_init(&pl->waiters);
+
+    return pl;
+}
+
+void forward_ack_pipeline_destroy(struct flb_forward_pipeline *pl)
+{
+    if (pl->ack_fd != -1) {
+        mk_event_del(pl->config->evl, &pl->event);
+        close(pl->ack_fd);
+    }
+    if (pl->u_conn) {
+        flb_upstream_conn_release(pl->u_conn);
+    }
+    flb_free(pl);
+}
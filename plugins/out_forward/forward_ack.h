@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_OUT_FORWARD_ACK_H
+#define FLB_OUT_FORWARD_ACK_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_upstream.h>
+#include <monkey/mk_core.h>
+
+#include "forward.h"
+
+/* Status of an in-flight chunk */
+#define FLB_FORWARD_ACK_PENDING  0
+#define FLB_FORWARD_ACK_OK       1
+#define FLB_FORWARD_ACK_FAILED   2
+
+/* A chunk waiting for its ack, it lives in the flush co-routine stack */
+struct flb_forward_ack {
+    char chunk[FLB_FORWARD_CHUNK_ID_SIZE + 1];
+    int status;                  /* FLB_FORWARD_ACK_*                    */
+    time_t deadline;             /* ack timeout                          */
+    struct flb_thread *th;       /* co-routine, set while it is waiting  */
+    struct mk_list _head;        /* link to pipeline acks or done list   */
+};
+
+/*
+ * A connection shared by the flush co-routines of one upstream node: the
+ * messages are written one after the other without waiting for the acks,
+ * which are read from the event loop and matched by chunk id.
+ */
+struct flb_forward_pipeline {
+    struct mk_event event;       /* ack reader event (dup of the socket) */
+    int ack_fd;                  /* socket duplicate used to read acks   */
+    char ack_buf[512];           /* partial ack messages                 */
+    size_t ack_len;
+
+    int writing;                 /* a co-routine owns the write side     */
+    int broken;                  /* connection failed while writing      */
+    int inflight;                /* number of un-acked chunks            */
+    int timer;                   /* timeout timer is armed               */
+
+    struct flb_upstream_conn *u_conn;
+    struct mk_list acks;         /* in-flight chunks                     */
+    struct mk_list waiters;      /* co-routines waiting to write         */
+
+    struct flb_forward_config *fc;
+    struct flb_config *config;
+};
+
+struct flb_forward_pipeline *forward_ack_pipeline_create(
+                                             struct flb_forward_config *fc,
+                                             struct flb_config *config);
+void forward_ack_pipeline_destroy(struct flb_forward_pipeline *pl);
+
+void forward_ack_lock(struct flb_forward_pipeline *pl);
+void forward_ack_unlock(struct flb_forward_pipeline *pl);
+int forward_ack_attach(struct flb_forward_pipeline *pl,
+                       struct flb_upstream_conn *u_conn);
+void forward_ack_fail(struct flb_forward_pipeline *pl);
+int forward_ack_wait(struct flb_forward_pipeline *pl, const char *chunk);
+
+#endif
@@ -20,6 +20,7 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_output_batch.h>
 #include <fluent-bit/flb_http_client.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_str.h>
@@ -28,6 +29,7 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_sds.h>
 #include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_gzip_pool.h>
 #include <msgpack.h>
 
 #include <stdio.h>
@@ -88,8 +90,9 @@ static int http_post(struct flb_out_http *ctx,
 
     /* Should we compress the payload ? */
     if (ctx->compress_gzip == FLB_TRUE) {
-        ret = flb_gzip_compress((void *) body, body_len,
-                                &payload_buf, &payload_size);
+        ret = flb_gzip_pool_compress(ctx->config->gzip_pool,
+                                     body, body_len, ctx->compress_level,
+                                     &payload_buf, &payload_size);
         if (ret == -1) {
             flb_error("[out_http] cannot gzip payload, disabling compression");
         }
@@ -270,16 +273,13 @@ static int http_gelf(struct flb_out_http *ctx,
     return ret;
 }
 
-static void cb_http_flush(const void *data, size_t bytes,
-                          const char *tag, int tag_len,
-                          struct flb_input_instance *i_ins,
-                          void *out_context,
-                          struct flb_config *config)
+/* Deliver a set of records, invoked once per sub-batch */
+static int http_flush_records(const void *data, size_t bytes, void *cb_data)
 {
     int ret = FLB_ERROR;
     flb_sds_t json;
-    struct flb_out_http *ctx = out_context;
-    (void) i_ins;
+    struct flb_out_http_req *req = cb_data;
+    struct flb_out_http *ctx = req->ctx;
 
     if ((ctx->out_format == FLB_PACK_JSON_FORMAT_JSON) ||
         (ctx->out_format == FLB_PACK_JSON_FORMAT_STREAM) ||
@@ -290,17 +290,39 @@ static void cb_http_flush(const void *data, size_t bytes,
                                                ctx->json_date_format,
                                                ctx->json_date_key);
         if (json != NULL) {
-            ret = http_post(ctx, json, flb_sds_len(json), tag, tag_len);
+            ret = http_post(ctx, json, flb_sds_len(json),
+                            req->tag, req->tag_len);
             flb_sds_destroy(json);
         }
     }
     else if (ctx->out_format == FLB_HTTP_OUT_GELF) {
-        ret = http_gelf(ctx, data, bytes, tag, tag_len);
+        ret = http_gelf(ctx, data, bytes, req->tag, req->tag_len);
     }
     else {
-        ret = http_post(ctx, data, bytes, tag, tag_len);
+        ret = http_post(ctx, data, bytes, req->tag, req->tag_len);
     }
 
+    return ret;
+}
+
+static void cb_http_flush(const void *data, size_t bytes,
+                          const char *tag, int tag_len,
+                          struct flb_input_instance *i_ins,
+                          void *out_context,
+                          struct flb_config *config)
+{
+    int ret;
+    struct flb_out_http *ctx = out_context;
+    struct flb_out_http_req req;
+    (void) i_ins;
+
+    req.ctx = ctx;
+    req.tag = tag;
+    req.tag_len = tag_len;
+
+    ret = flb_output_batch_flush(data, bytes,
+                                 ctx->max_payload_size, ctx->batch_workers,
+                                 http_flush_records, &req, config);
     FLB_OUTPUT_RETURN(ret);
 }
 
@@ -354,6 +376,11 @@ static struct flb_config_map config_map[] = {
      0, FLB_FALSE, 0,
      NULL
     },
+    {
+     FLB_CONFIG_MAP_STR, "compress_level", NULL,
+     0, FLB_FALSE, 0,
+     NULL
+    },
     {
      FLB_CONFIG_MAP_SLIST_1, "header", NULL,
      FLB_CONFIG_MAP_MULT, FLB_TRUE, offsetof(struct flb_out_http, headers),
@@ -364,6 +391,16 @@ static struct flb_config_map config_map[] = {
      0, FLB_TRUE, offsetof(struct flb_out_http, uri),
      NULL,
     },
+    {
+     FLB_CONFIG_MAP_SIZE, "max_payload_size", "0",
+     0, FLB_TRUE, offsetof(struct flb_out_http, max_payload_size),
+     NULL,
+    },
+    {
+     FLB_CONFIG_MAP_INT, "batch_workers", "4",
+     0, FLB_TRUE, offsetof(struct flb_out_http, batch_workers),
+     NULL,
+    },
 
     /* Gelf Properties */
     {
@@ -28,6 +28,13 @@
 #define FLB_HTTP_MIME_MSGPACK   "application/msgpack"
 #define FLB_HTTP_MIME_JSON      "application/json"
 
+/* Context for every sub-batch request */
+struct flb_out_http_req {
+    struct flb_out_http *ctx;
+    const char *tag;
+    int tag_len;
+};
+
 struct flb_out_http {
     /* HTTP Auth */
     char *http_user;
@@ -57,12 +64,19 @@ struct flb_out_http {
 
     /* Compression mode (gzip) */
     int compress_gzip;
+    int compress_level;
+
+    /* Split large chunks in sub-batches flushed concurrently */
+    size_t max_payload_size;
+    int batch_workers;
 
     /* Upstream connection to the backend server */
     struct flb_upstream *u;
 
     /* Arbitrary HTTP headers */
     struct mk_list *headers;
+
+    struct flb_config *config;
 };
 
 #endif
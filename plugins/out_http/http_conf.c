@@ -209,7 +209,22 @@ struct flb_out_http *flb_http_conf_create(struct flb_output_instance *ins,
         }
     }
 
+    /* Compression level: -1 (default) or 0 to 9 */
+    ctx->compress_level = -1;
+    tmp = flb_output_get_property("compress_level", ins);
+    if (tmp) {
+        ret = atoi(tmp);
+        if (ret < -1 || ret > 9) {
+            flb_error("[out_http] invalid 'compress_level' option. "
+                      "Using default.");
+        }
+        else {
+            ctx->compress_level = ret;
+        }
+    }
+
     ctx->u = upstream;
+    ctx->config = config;
     ctx->uri = uri;
     ctx->host = ins->host.name;
     ctx->port = ins->host.port;
@@ -24,6 +24,7 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_gzip_pool.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_http_client.h>
 
@@ -46,7 +47,8 @@ struct flb_http_client *td_http_client(struct flb_upstream_conn *u_conn,
     struct flb_http_client *c;
 
     /* Compress data */
-    ret = flb_gzip_compress(data, len, &gz_data, &gz_size);
+    ret = flb_gzip_pool_compress(config->gzip_pool, data, len, -1,
+                                 &gz_data, &gz_size);
     if (ret == -1) {
         flb_error("[td_http] error compressing data");
         return NULL;
@@ -109,6 +109,11 @@ struct flb_service_config service_configs[] = {
      FLB_CONF_TYPE_INT,
      offsetof(struct flb_config, coro_stack_size)},
 
+    /* Compression */
+    {FLB_CONF_STR_COMPRESS_WORKERS,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, compress_workers)},
+
 #ifdef FLB_HAVE_STREAM_PROCESSOR
     {FLB_CONF_STR_STREAMS_FILE,
      FLB_CONF_TYPE_STR,
@@ -42,6 +42,7 @@
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_sosreport.h>
 #include <fluent-bit/flb_storage.h>
+#include <fluent-bit/flb_gzip_pool.h>
 #include <fluent-bit/flb_http_server.h>
 
 #ifdef FLB_HAVE_METRICS
@@ -440,6 +441,16 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
 
+    /* Compression workers */
+    if (config->compress_workers > 0) {
+        config->gzip_pool = flb_gzip_pool_create(config,
+                                                 config->compress_workers);
+        if (!config->gzip_pool) {
+            flb_error("[engine] compression workers could not start");
+            return -1;
+        }
+    }
+
     /* Initialize collectors */
     flb_input_collectors_start(config);
 
@@ -562,6 +573,10 @@ int flb_engine_shutdown(struct flb_config *config)
     flb_input_exit_all(config);
     flb_output_exit(config);
 
+    if (config->gzip_pool) {
+        flb_gzip_pool_destroy(config->gzip_pool);
+        config->gzip_pool = NULL;
+    }
 
     /* Destroy the storage context */
     flb_storage_destroy(config);
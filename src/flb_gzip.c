@@ -24,8 +24,14 @@
 #include <fluent-bit/flb_gzip.h>
 #include <miniz/miniz.h>
 
+#include <stddef.h>
+#include <pthread.h>
+
 #define FLB_GZIP_HEADER_OFFSET 10
 
+/* Size of the blocks handed to the streaming deflate callback */
+#define FLB_GZIP_DEFLATE_BLOCK 65536
+
 static inline void gzip_header(void *buf)
 {
     uint8_t *p;
@@ -44,95 +50,25 @@ static inline void gzip_header(void *buf)
     *p++ = 0xFF;
 }
 
+/* Compress with the calling thread context for the default level */
 int flb_gzip_compress(void *in_data, size_t in_len,
                       void **out_data, size_t *out_len)
 {
-    int flush;
-    int status;
-    int footer_start;
-    uint8_t *pb;
-    size_t out_size;
-    void *out_buf;
-    z_stream strm;
-    mz_ulong crc;
-
-    out_size = in_len + 32;
-    out_buf = flb_malloc(out_size);
-    if (!out_buf) {
-        flb_errno();
-        flb_error("[gzip] could not allocate outgoing buffer");
-        return -1;
-    }
-
-    /* Initialize streaming buffer context */
-    memset(&strm, '\0', sizeof(strm));
-    strm.zalloc    = Z_NULL;
-    strm.zfree     = Z_NULL;
-    strm.opaque    = Z_NULL;
-    strm.next_in   = in_data;
-    strm.avail_in  = in_len;
-    strm.total_out = 0;
-
-    /* Deflate mode */
-    deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
-                 Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY);
-
-    /*
-     * Miniz don't support GZip format directly, instead we will:
-     *
-     * - append manual GZip magic bytes
-     * - deflate raw content
-     * - append manual CRC32 data
-     */
-    gzip_header(out_buf);
-
-    /* Header offset */
-    pb = (uint8_t *) out_buf + FLB_GZIP_HEADER_OFFSET;
-
-    flush = Z_NO_FLUSH;
-    while (1) {
-        strm.next_out  = pb + strm.total_out;
-        strm.avail_out = out_size - (pb - (uint8_t *) out_data);
-
-        if (strm.avail_in == 0) {
-            flush = Z_FINISH;
-        }
+    return flb_gzip_compress_level(in_data, in_len, out_data, out_len,
+                                   Z_DEFAULT_COMPRESSION);
+}
 
-        status = deflate(&strm, flush);
-        if (status == Z_STREAM_END) {
-            break;
-        }
-        else if (status != Z_OK) {
-            deflateEnd(&strm);
-            return -1;
-        }
-    }
+int flb_gzip_compress_level(const void *in_data, size_t in_len,
+                            void **out_data, size_t *out_len, int level)
+{
+    struct flb_gzip_deflate *ctx;
 
-    if (deflateEnd(&strm) != Z_OK) {
-        flb_free(out_buf);
+    ctx = flb_gzip_deflate_get(level);
+    if (!ctx) {
         return -1;
     }
-    *out_len = strm.total_out;
-
-    /* Construct the gzip checksum (CRC32 footer) */
-    footer_start = FLB_GZIP_HEADER_OFFSET + *out_len;
-    pb = (uint8_t *) out_buf + footer_start;
-
-    crc = mz_crc32(MZ_CRC32_INIT, in_data, in_len);
-    *pb++ = crc & 0xFF;
-    *pb++ = (crc >> 8) & 0xFF;
-    *pb++ = (crc >> 16) & 0xFF;
-    *pb++ = (crc >> 24) & 0xFF;
-    *pb++ = in_len & 0xFF;
-    *pb++ = (in_len >> 8) & 0xFF;
-    *pb++ = (in_len >> 16) & 0xFF;
-    *pb++ = (in_len >> 24) & 0xFF;
-
-    /* Set the real buffer size for the caller */
-    *out_len += FLB_GZIP_HEADER_OFFSET + 8;
-    *out_data = out_buf;
 
-    return 0;
+    return flb_gzip_deflate_compress(ctx, in_data, in_len, out_data, out_len);
 }
 
 /*
@@ -205,3 +141,691 @@ int flb_gzip_uncompress(void *in_data, size_t in_len,
     mz_inflateEnd(&stream);
     return 0;
 }
+
+/*
+ * Reusable deflate context
+ * ------------------------
+ * deflateInit2() allocates and initializes a large compressor state, the
+ * context below keeps it around so every new compression only needs a
+ * cheap deflateReset().
+ */
+struct flb_gzip_deflate {
+    z_stream strm;
+
+    /* Streaming state, see flb_gzip_deflate_begin() */
+    mz_ulong crc;
+    size_t in_size;
+    int (*cb)(const void *, size_t, void *);
+    void *cb_data;
+    unsigned char out[FLB_GZIP_DEFLATE_BLOCK];
+};
+
+struct flb_gzip_deflate *flb_gzip_deflate_create(int level)
+{
+    int ret;
+    struct flb_gzip_deflate *ctx;
+
+    ctx = flb_calloc(1, sizeof(struct flb_gzip_deflate));
+    if (!ctx) {
+        flb_errno();
+        return NULL;
+    }
+
+    ret = deflateInit2(&ctx->strm, level,
+                       Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9,
+                       Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        flb_error("[gzip] could not initialize deflate context");
+        flb_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void flb_gzip_deflate_destroy(struct flb_gzip_deflate *ctx)
+{
+    deflateEnd(&ctx->strm);
+    flb_free(ctx);
+}
+
+/* Compress 'in_data' as a single GZip member using the given context */
+int flb_gzip_deflate_compress(struct flb_gzip_deflate *ctx,
+                              const void *in_data, size_t in_len,
+                              void **out_data, size_t *out_len)
+{
+    int status;
+    size_t out_size;
+    uint8_t *out_buf;
+    uint8_t *pb;
+    mz_ulong crc;
+    z_stream *strm = &ctx->strm;
+
+    deflateReset(strm);
+
+    out_size = FLB_GZIP_HEADER_OFFSET + deflateBound(strm, in_len) + 8;
+    out_buf = flb_malloc(out_size);
+    if (!out_buf) {
+        flb_errno();
+        flb_error("[gzip] could not allocate outgoing buffer");
+        return -1;
+    }
+
+    gzip_header(out_buf);
+
+    strm->next_in   = (unsigned char *) in_data;
+    strm->avail_in  = in_len;
+    strm->next_out  = out_buf + FLB_GZIP_HEADER_OFFSET;
+    strm->avail_out = out_size - FLB_GZIP_HEADER_OFFSET - 8;
+
+    status = deflate(strm, Z_FINISH);
+    if (status != Z_STREAM_END) {
+        flb_error("[gzip] deflate failed (status=%i)", status);
+        flb_free(out_buf);
+        return -1;
+    }
+
+    /* CRC32 and input size footer */
+    pb = out_buf + FLB_GZIP_HEADER_OFFSET + strm->total_out;
+    crc = mz_crc32(MZ_CRC32_INIT, in_data, in_len);
+    *pb++ = crc & 0xFF;
+    *pb++ = (crc >> 8) & 0xFF;
+    *pb++ = (crc >> 16) & 0xFF;
+    *pb++ = (crc >> 24) & 0xFF;
+    *pb++ = in_len & 0xFF;
+    *pb++ = (in_len >> 8) & 0xFF;
+    *pb++ = (in_len >> 16) & 0xFF;
+    *pb++ = (in_len >> 24) & 0xFF;
+
+    *out_len = FLB_GZIP_HEADER_OFFSET + strm->total_out + 8;
+    *out_data = out_buf;
+
+    return 0;
+}
+
+/* Hand the pending output to the callback and reset the output block */
+static int deflate_emit(struct flb_gzip_deflate *ctx)
+{
+    int ret;
+    size_t len;
+
+    len = sizeof(ctx->out) - ctx->strm.avail_out;
+    if (len > 0) {
+        ret = ctx->cb(ctx->out, len, ctx->cb_data);
+        if (ret != 0) {
+            return -1;
+        }
+    }
+
+    ctx->strm.next_out  = ctx->out;
+    ctx->strm.avail_out = sizeof(ctx->out);
+    return 0;
+}
+
+/*
+ * Streaming deflate
+ * -----------------
+ * Compress content that is not available in a single buffer: a GZip member
+ * is started with flb_gzip_deflate_begin(), every piece of input is passed
+ * to flb_gzip_deflate_write() and flb_gzip_deflate_end() completes it. The
+ * compressed data is handed to the callback in blocks of up to
+ * FLB_GZIP_DEFLATE_BLOCK bytes, a callback returning non-zero aborts the
+ * operation.
+ */
+int flb_gzip_deflate_begin(struct flb_gzip_deflate *ctx,
+                           int (*cb)(const void *, size_t, void *),
+                           void *cb_data)
+{
+    deflateReset(&ctx->strm);
+
+    ctx->crc = MZ_CRC32_INIT;
+    ctx->in_size = 0;
+    ctx->cb = cb;
+    ctx->cb_data = cb_data;
+
+    gzip_header(ctx->out);
+    ctx->strm.next_out  = ctx->out + FLB_GZIP_HEADER_OFFSET;
+    ctx->strm.avail_out = sizeof(ctx->out) - FLB_GZIP_HEADER_OFFSET;
+
+    return 0;
+}
+
+int flb_gzip_deflate_write(struct flb_gzip_deflate *ctx,
+                           const void *in_data, size_t in_len)
+{
+    int status;
+    z_stream *strm = &ctx->strm;
+
+    ctx->crc = mz_crc32(ctx->crc, in_data, in_len);
+    ctx->in_size += in_len;
+
+    strm->next_in  = (unsigned char *) in_data;
+    strm->avail_in = in_len;
+
+    while (strm->avail_in > 0) {
+        status = deflate(strm, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            flb_error("[gzip] deflate failed (status=%i)", status);
+            return -1;
+        }
+
+        if (strm->avail_out == 0 && deflate_emit(ctx) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int flb_gzip_deflate_end(struct flb_gzip_deflate *ctx)
+{
+    int status;
+    uint8_t *pb;
+    z_stream *strm = &ctx->strm;
+
+    strm->next_in  = NULL;
+    strm->avail_in = 0;
+
+    do {
+        status = deflate(strm, Z_FINISH);
+        if (status != Z_OK && status != Z_STREAM_END &&
+            status != Z_BUF_ERROR) {
+            flb_error("[gzip] deflate failed (status=%i)", status);
+            return -1;
+        }
+
+        /* Flush a full block, or make room for the footer */
+        if (strm->avail_out < 8 && deflate_emit(ctx) != 0) {
+            return -1;
+        }
+    } while (status != Z_STREAM_END);
+
+    /* CRC32 and input size footer */
+    pb = strm->next_out;
+    *pb++ = ctx->crc & 0xFF;
+    *pb++ = (ctx->crc >> 8) & 0xFF;
+    *pb++ = (ctx->crc >> 16) & 0xFF;
+    *pb++ = (ctx->crc >> 24) & 0xFF;
+    *pb++ = ctx->in_size & 0xFF;
+    *pb++ = (ctx->in_size >> 8) & 0xFF;
+    *pb++ = (ctx->in_size >> 16) & 0xFF;
+    *pb++ = (ctx->in_size >> 24) & 0xFF;
+    strm->next_out = pb;
+    strm->avail_out -= 8;
+
+    return deflate_emit(ctx);
+}
+
+/*
+ * Per-thread deflate contexts
+ * ---------------------------
+ * Every thread keeps one context per compression level, created on first
+ * use and released when the thread exits. Callers must not keep a context
+ * across a co-routine yield since another co-routine on the same thread
+ * may use it in the meantime.
+ */
+#define FLB_GZIP_LEVELS  11   /* Z_DEFAULT_COMPRESSION (-1) to 9 */
+
+static pthread_key_t gzip_tls_key;
+static pthread_once_t gzip_tls_once = PTHREAD_ONCE_INIT;
+
+static void gzip_tls_destroy(void *data)
+{
+    int i;
+    struct flb_gzip_deflate **slots = data;
+
+    for (i = 0; i < FLB_GZIP_LEVELS; i++) {
+        if (slots[i]) {
+            flb_gzip_deflate_destroy(slots[i]);
+        }
+    }
+    flb_free(slots);
+}
+
+static void gzip_tls_init()
+{
+    pthread_key_create(&gzip_tls_key, gzip_tls_destroy);
+}
+
+struct flb_gzip_deflate *flb_gzip_deflate_get(int level)
+{
+    struct flb_gzip_deflate **slots;
+
+    if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+        flb_error("[gzip] invalid compression level %i", level);
+        return NULL;
+    }
+
+    pthread_once(&gzip_tls_once, gzip_tls_init);
+
+    slots = pthread_getspecific(gzip_tls_key);
+    if (!slots) {
+        slots = flb_calloc(FLB_GZIP_LEVELS, sizeof(struct flb_gzip_deflate *));
+        if (!slots) {
+            flb_errno();
+            return NULL;
+        }
+        pthread_setspecific(gzip_tls_key, slots);
+    }
+
+    if (!slots[level + 1]) {
+        slots[level + 1] = flb_gzip_deflate_create(level);
+    }
+
+    return slots[level + 1];
+}
+
+/*
+ * Streaming inflate context
+ * -------------------------
+ * Decompress GZip data produced by third party applications: optional
+ * header fields are skipped, the CRC32 and size of every member are
+ * verified and concatenated members are supported. The uncompressed data
+ * is handed to a callback in blocks of FLB_GZIP_INFLATE_BLOCK bytes, so the
+ * caller never needs to hold the whole decompressed content.
+ */
+#define FLB_GZIP_INFLATE_BLOCK  65536
+
+/* GZip header flags */
+#define FLB_GZIP_FHCRC     0x02
+#define FLB_GZIP_FEXTRA    0x04
+#define FLB_GZIP_FNAME     0x08
+#define FLB_GZIP_FCOMMENT  0x10
+
+/* Position of the incremental inflate in the current member */
+#define FLB_GZIP_STATE_HEADER  0
+#define FLB_GZIP_STATE_DATA    1
+#define FLB_GZIP_STATE_FOOTER  2
+
+struct flb_gzip_inflate {
+    mz_stream strm;
+    size_t strm_size;          /* size of the miniz state */
+
+    /* incremental inflate status */
+    int state;
+    int members;               /* members completed      */
+    mz_ulong crc;              /* CRC32 of the member    */
+    size_t total;              /* size of the member     */
+
+    unsigned char out[FLB_GZIP_INFLATE_BLOCK];
+};
+
+/*
+ * The miniz inflate state is allocated through these hooks: its size is
+ * not public and it's needed to save and restore it.
+ */
+static void *inflate_state_alloc(void *opaque, size_t items, size_t size)
+{
+    struct flb_gzip_inflate *ctx = opaque;
+
+    ctx->strm_size = items * size;
+    return flb_malloc(items * size);
+}
+
+static void inflate_state_free(void *opaque, void *address)
+{
+    (void) opaque;
+    flb_free(address);
+}
+
+struct flb_gzip_inflate *flb_gzip_inflate_create()
+{
+    int ret;
+    struct flb_gzip_inflate *ctx;
+
+    ctx = flb_malloc(sizeof(struct flb_gzip_inflate));
+    if (!ctx) {
+        flb_errno();
+        return NULL;
+    }
+    memset(&ctx->strm, '\0', sizeof(mz_stream));
+    ctx->strm.zalloc = inflate_state_alloc;
+    ctx->strm.zfree = inflate_state_free;
+    ctx->strm.opaque = ctx;
+
+    ret = mz_inflateInit2(&ctx->strm, -Z_DEFAULT_WINDOW_BITS);
+    if (ret != MZ_OK) {
+        flb_error("[gzip] could not initialize inflate context");
+        flb_free(ctx);
+        return NULL;
+    }
+    flb_gzip_inflate_reset(ctx);
+
+    return ctx;
+}
+
+void flb_gzip_inflate_destroy(struct flb_gzip_inflate *ctx)
+{
+    mz_inflateEnd(&ctx->strm);
+    flb_free(ctx);
+}
+
+/*
+ * Return the size of the GZip member header, 0 if more bytes are needed to
+ * get the complete header or -1 if it's invalid.
+ */
+static int gzip_header_size(const uint8_t *p, size_t len)
+{
+    int flags;
+    size_t off = FLB_GZIP_HEADER_OFFSET;
+
+    if ((len > 0 && p[0] != 0x1F) || (len > 1 && p[1] != 0x8B) ||
+        (len > 2 && p[2] != 8)) {
+        return -1;
+    }
+    if (len < FLB_GZIP_HEADER_OFFSET) {
+        return 0;
+    }
+    flags = p[3];
+
+    if (flags & FLB_GZIP_FEXTRA) {
+        if (off + 2 > len) {
+            return -1;
+        }
+        off += 2 + (p[off] | (p[off + 1] << 8));
+    }
+    if (flags & FLB_GZIP_FNAME) {
+        while (off < len && p[off] != '\0') {
+            off++;
+        }
+        off++;
+    }
+    if (flags & FLB_GZIP_FCOMMENT) {
+        while (off < len && p[off] != '\0') {
+            off++;
+        }
+        off++;
+    }
+    if (flags & FLB_GZIP_FHCRC) {
+        off += 2;
+    }
+
+    if (off > len) {
+        return 0;
+    }
+    return off;
+}
+
+static inline uint32_t gzip_le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+           ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+int flb_gzip_inflate_stream(struct flb_gzip_inflate *ctx,
+                            const void *in_data, size_t in_len,
+                            int (*cb)(const void *, size_t, void *),
+                            void *cb_data)
+{
+    int ret;
+    int status;
+    size_t off = 0;
+    size_t bytes;
+    size_t total;
+    mz_ulong crc;
+    const uint8_t *p = in_data;
+    mz_stream *strm = &ctx->strm;
+
+    while (off < in_len) {
+        /* Trailing zero padding after the last member is allowed */
+        if (off > 0 && p[off] == 0x00) {
+            while (off < in_len && p[off] == 0x00) {
+                off++;
+            }
+            break;
+        }
+
+        ret = gzip_header_size(p + off, in_len - off);
+        if (ret <= 0) {
+            flb_error("[gzip] invalid header");
+            return -1;
+        }
+        off += ret;
+
+        mz_inflateReset(strm);
+        strm->next_in = p + off;
+        strm->avail_in = in_len - off;
+        crc = MZ_CRC32_INIT;
+        total = 0;
+
+        do {
+            strm->next_out = ctx->out;
+            strm->avail_out = sizeof(ctx->out);
+
+            status = mz_inflate(strm, MZ_SYNC_FLUSH);
+            if (status != MZ_OK && status != MZ_STREAM_END) {
+                flb_error("[gzip] inflate failed (status=%i)", status);
+                return -1;
+            }
+
+            bytes = sizeof(ctx->out) - strm->avail_out;
+            if (bytes > 0) {
+                crc = mz_crc32(crc, ctx->out, bytes);
+                total += bytes;
+                ret = cb(ctx->out, bytes, cb_data);
+                if (ret == -1) {
+                    return -1;
+                }
+            }
+        } while (status != MZ_STREAM_END);
+
+        off = in_len - strm->avail_in;
+
+        /* Member footer: CRC32 and input size modulo 2^32 */
+        if (off + 8 > in_len) {
+            flb_error("[gzip] truncated content");
+            return -1;
+        }
+        if (gzip_le32(p + off) != crc ||
+            gzip_le32(p + off + 4) != (uint32_t) total) {
+            flb_error("[gzip] checksum mismatch");
+            return -1;
+        }
+        off += 8;
+    }
+
+    return 0;
+}
+
+/* Prepare the context to inflate a new GZip content */
+void flb_gzip_inflate_reset(struct flb_gzip_inflate *ctx)
+{
+    mz_inflateReset(&ctx->strm);
+    ctx->state = FLB_GZIP_STATE_HEADER;
+    ctx->members = 0;
+    ctx->crc = MZ_CRC32_INIT;
+    ctx->total = 0;
+}
+
+/*
+ * Incremental inflate, for compressed content that is not available at
+ * once, e.g: a file being read by blocks or still being written. Every
+ * call consumes what it can from 'in_data' and writes up to 'out_size'
+ * bytes in 'out_data'. The bytes of 'in_data' not consumed ('in_used'
+ * reports the consumed ones) must be given again on the next call, with
+ * more data appended if any. Returns the number of bytes written, 0 when
+ * more input is needed and -1 on error.
+ */
+ssize_t flb_gzip_inflate_read(struct flb_gzip_inflate *ctx,
+                              const void *in_data, size_t in_len,
+                              size_t *in_used,
+                              void *out_data, size_t out_size)
+{
+    int ret;
+    int status;
+    size_t off = 0;
+    size_t in_bytes;
+    size_t out_bytes;
+    size_t produced = 0;
+    const uint8_t *p = in_data;
+    uint8_t *out = out_data;
+    mz_stream *strm = &ctx->strm;
+
+    while (produced < out_size) {
+        if (ctx->state == FLB_GZIP_STATE_HEADER) {
+            /* Trailing zero padding after the last member is allowed */
+            if (ctx->members > 0) {
+                while (off < in_len && p[off] == 0x00) {
+                    off++;
+                }
+            }
+            if (off == in_len) {
+                break;
+            }
+
+            ret = gzip_header_size(p + off, in_len - off);
+            if (ret == -1) {
+                flb_error("[gzip] invalid header");
+                return -1;
+            }
+            else if (ret == 0) {
+                break;
+            }
+            off += ret;
+
+            mz_inflateReset(strm);
+            ctx->crc = MZ_CRC32_INIT;
+            ctx->total = 0;
+            ctx->state = FLB_GZIP_STATE_DATA;
+        }
+        else if (ctx->state == FLB_GZIP_STATE_DATA) {
+            in_bytes = in_len - off;
+            out_bytes = out_size - produced;
+            strm->next_in = p + off;
+            strm->avail_in = in_bytes;
+            strm->next_out = out + produced;
+            strm->avail_out = out_bytes;
+
+            status = mz_inflate(strm, MZ_SYNC_FLUSH);
+            if (status != MZ_OK && status != MZ_STREAM_END &&
+                status != MZ_BUF_ERROR) {
+                flb_error("[gzip] inflate failed (status=%i)", status);
+                return -1;
+            }
+
+            in_bytes -= strm->avail_in;
+            out_bytes -= strm->avail_out;
+            off += in_bytes;
+            if (out_bytes > 0) {
+                ctx->crc = mz_crc32(ctx->crc, out + produced, out_bytes);
+                ctx->total += out_bytes;
+                produced += out_bytes;
+            }
+
+            if (status == MZ_STREAM_END) {
+                ctx->state = FLB_GZIP_STATE_FOOTER;
+            }
+            else if (in_bytes == 0 && out_bytes == 0) {
+                /* no progress without more input */
+                break;
+            }
+        }
+        else {
+            /* Member footer: CRC32 and input size modulo 2^32 */
+            if (in_len - off < 8) {
+                break;
+            }
+            if (gzip_le32(p + off) != ctx->crc ||
+                gzip_le32(p + off + 4) != (uint32_t) ctx->total) {
+                flb_error("[gzip] checksum mismatch");
+                return -1;
+            }
+            off += 8;
+            ctx->members++;
+            ctx->state = FLB_GZIP_STATE_HEADER;
+        }
+    }
+
+    *in_used = off;
+    return produced;
+}
+
+/*
+ * Incremental inflate checkpoint
+ * ------------------------------
+ * The miniz inflate state is a plain structure: the decompressor status
+ * and the 32KB dictionary, it holds no pointers. With the status of the
+ * current member it's enough to resume an incremental inflate from the
+ * input position where it was saved, e.g: after a restart.
+ *
+ * The checkpoint is only valid for the same build of the library, a
+ * header with its size and a CRC32 of the content reject anything else.
+ */
+#define FLB_GZIP_CHECKPOINT_MAGIC  0x464c4247   /* 'FLBG' */
+
+struct gzip_checkpoint {
+    uint32_t magic;
+    uint32_t crc;              /* CRC32 of what follows the header */
+    uint64_t strm_size;
+    int32_t state;
+    int32_t members;
+    uint64_t member_crc;
+    uint64_t member_total;
+};
+
+size_t flb_gzip_inflate_checkpoint_size(struct flb_gzip_inflate *ctx)
+{
+    return sizeof(struct gzip_checkpoint) + ctx->strm_size;
+}
+
+/* Save the status in 'buf', of flb_gzip_inflate_checkpoint_size() bytes */
+void flb_gzip_inflate_save(struct flb_gzip_inflate *ctx, void *buf)
+{
+    struct gzip_checkpoint *ck = buf;
+    uint8_t *state = (uint8_t *) buf + sizeof(struct gzip_checkpoint);
+
+    memset(ck, '\0', sizeof(struct gzip_checkpoint));
+    ck->magic = FLB_GZIP_CHECKPOINT_MAGIC;
+    ck->strm_size = ctx->strm_size;
+    ck->state = ctx->state;
+    ck->members = ctx->members;
+    ck->member_crc = ctx->crc;
+    ck->member_total = ctx->total;
+    memcpy(state, ctx->strm.state, ctx->strm_size);
+
+    ck->crc = mz_crc32(MZ_CRC32_INIT, (uint8_t *) &ck->strm_size,
+                       sizeof(struct gzip_checkpoint) -
+                       offsetof(struct gzip_checkpoint, strm_size) +
+                       ctx->strm_size);
+}
+
+/* Restore a saved status, returns -1 if it's not a valid checkpoint */
+int flb_gzip_inflate_restore(struct flb_gzip_inflate *ctx,
+                             const void *buf, size_t size)
+{
+    uint32_t crc;
+    struct gzip_checkpoint ck;
+    const uint8_t *state = (const uint8_t *) buf +
+                           sizeof(struct gzip_checkpoint);
+
+    if (size != flb_gzip_inflate_checkpoint_size(ctx)) {
+        return -1;
+    }
+    memcpy(&ck, buf, sizeof(struct gzip_checkpoint));
+    if (ck.magic != FLB_GZIP_CHECKPOINT_MAGIC ||
+        ck.strm_size != ctx->strm_size) {
+        return -1;
+    }
+
+    crc = mz_crc32(MZ_CRC32_INIT,
+                   (const uint8_t *) buf +
+                   offsetof(struct gzip_checkpoint, strm_size),
+                   size - offsetof(struct gzip_checkpoint, strm_size));
+    if (crc != ck.crc) {
+        return -1;
+    }
+
+    if (ck.state != FLB_GZIP_STATE_HEADER &&
+        ck.state != FLB_GZIP_STATE_DATA &&
+        ck.state != FLB_GZIP_STATE_FOOTER) {
+        return -1;
+    }
+
+    memcpy(ctx->strm.state, state, ctx->strm_size);
+    ctx->state = ck.state;
+    ctx->members = ck.members;
+    ctx->crc = ck.member_crc;
+    ctx->total = ck.member_total;
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_worker.h>
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_gzip_pool.h>
+
+/*
+ * Compression pool
+ * ----------------
+ * Compressing a large payload takes several milliseconds of CPU, when it's
+ * done from an output flush it stalls every other co-routine and event
+ * handled by the engine. The pool moves that work to a few threads: the
+ * flush co-routine queues a job and yields, the worker compresses it with
+ * its own per-thread deflate context and writes the job reference to a
+ * channel watched by the engine, which resumes the co-routine.
+ */
+
+struct gzip_pool_job {
+    const void *in_data;
+    size_t in_len;
+    int level;
+    void *out_data;
+    size_t out_len;
+    int ret;
+    struct flb_thread *th;
+    struct mk_list _head;
+};
+
+static void gzip_pool_worker(void *data)
+{
+    struct gzip_pool_job *job;
+    struct flb_gzip_pool *pool = data;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->exit == FLB_FALSE && mk_list_is_empty(&pool->jobs) == 0) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        if (mk_list_is_empty(&pool->jobs) == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        job = mk_list_entry_first(&pool->jobs, struct gzip_pool_job, _head);
+        mk_list_del(&job->_head);
+        pthread_mutex_unlock(&pool->lock);
+
+        job->ret = flb_gzip_compress_level(job->in_data, job->in_len,
+                                           &job->out_data, &job->out_len,
+                                           job->level);
+
+        if (flb_pipe_write_all(pool->ch[1], &job, sizeof(job)) == -1) {
+            flb_errno();
+        }
+    }
+}
+
+/* Engine side: resume the co-routines whose job is done */
+static int gzip_pool_event(void *data)
+{
+    int i;
+    int n;
+    ssize_t bytes;
+    struct gzip_pool_job *jobs[64];
+    struct flb_gzip_pool *pool = data;
+
+    while (1) {
+        bytes = flb_pipe_r(pool->ch[0], jobs, sizeof(jobs));
+        if (bytes <= 0) {
+            break;
+        }
+
+        n = bytes / sizeof(struct gzip_pool_job *);
+        for (i = 0; i < n; i++) {
+            flb_thread_resume(jobs[i]->th);
+        }
+    }
+
+    return 0;
+}
+
+struct flb_gzip_pool *flb_gzip_pool_create(struct flb_config *config,
+                                           int workers)
+{
+    int i;
+    int ret;
+    struct mk_event *event;
+    struct flb_gzip_pool *pool;
+
+    pool = flb_calloc(1, sizeof(struct flb_gzip_pool));
+    if (!pool) {
+        flb_errno();
+        return NULL;
+    }
+    pool->config = config;
+    pool->workers = 0;
+    mk_list_init(&pool->jobs);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pool->tids = flb_calloc(workers, sizeof(pthread_t));
+    if (!pool->tids) {
+        flb_errno();
+        flb_free(pool);
+        return NULL;
+    }
+
+    ret = flb_pipe_create(pool->ch);
+    if (ret == -1) {
+        flb_errno();
+        flb_free(pool->tids);
+        flb_free(pool);
+        return NULL;
+    }
+    flb_pipe_set_nonblocking(pool->ch[0]);
+
+    event = &pool->event;
+    MK_EVENT_NEW(event);
+    event->type = FLB_ENGINE_EV_CUSTOM;
+    event->handler = gzip_pool_event;
+
+    ret = mk_event_add(config->evl, pool->ch[0],
+                       FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, event);
+    if (ret == -1) {
+        flb_error("[gzip pool] could not register channel");
+        flb_pipe_destroy(pool->ch);
+        flb_free(pool->tids);
+        flb_free(pool);
+        return NULL;
+    }
+
+    for (i = 0; i < workers; i++) {
+        ret = flb_worker_create(gzip_pool_worker, pool,
+                                &pool->tids[i], config);
+        if (ret == -1) {
+            flb_error("[gzip pool] could not spawn worker %i", i);
+            flb_gzip_pool_destroy(pool);
+            return NULL;
+        }
+        pool->workers++;
+    }
+
+    flb_info("[gzip pool] %i compression workers", workers);
+    return pool;
+}
+
+void flb_gzip_pool_destroy(struct flb_gzip_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->exit = FLB_TRUE;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->workers; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+
+    mk_event_del(pool->config->evl, &pool->event);
+    flb_pipe_destroy(pool->ch);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    flb_free(pool->tids);
+    flb_free(pool);
+}
+
+/*
+ * GZip compress 'in_data'. When called from a co-routine and a pool is
+ * available, the work is done by a pool thread while the co-routine
+ * yields, otherwise it's compressed in place.
+ */
+int flb_gzip_pool_compress(struct flb_gzip_pool *pool,
+                           const void *in_data, size_t in_len, int level,
+                           void **out_data, size_t *out_len)
+{
+    struct flb_thread *th;
+    struct gzip_pool_job job;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    if (!pool || !th || in_len < FLB_GZIP_POOL_MIN_SIZE) {
+        return flb_gzip_compress_level(in_data, in_len,
+                                       out_data, out_len, level);
+    }
+
+    job.in_data = in_data;
+    job.in_len = in_len;
+    job.level = level;
+    job.out_data = NULL;
+    job.out_len = 0;
+    job.ret = -1;
+    job.th = th;
+
+    pthread_mutex_lock(&pool->lock);
+    mk_list_add(&job._head, &pool->jobs);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Resumed by gzip_pool_event() once the job is done */
+    flb_thread_yield(th, FLB_FALSE);
+
+    if (job.ret == 0) {
+        *out_data = job.out_data;
+        *out_len = job.out_len;
+    }
+    return job.ret;
+}
@@ -477,7 +477,7 @@ static int add_host_and_content_length(struct flb_http_client *c)
             flb_errno();
             return -1;
         }
-        len = snprintf(tmp, sizeof(tmp) - 1, "%i", c->body_len);
+        len = snprintf(tmp, 32, "%i", c->body_len);
         flb_http_add_header(c, "Content-Length", 14, tmp, len);
         flb_free(tmp);
     }
@@ -567,6 +567,12 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
     c->flags       = flags;
     mk_list_init(&c->headers);
 
+    /* The body length must be known before composing Content-Length */
+    if (body && body_len > 0) {
+        c->body_buf = body;
+        c->body_len = body_len;
+    }
+
     add_host_and_content_length(c);
 
     /* Check if we have a query string */
@@ -588,11 +594,6 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
         c->flags |= FLB_HTTP_11;
     }
 
-    if (body && body_len > 0) {
-        c->body_buf = body;
-        c->body_len = body_len;
-    }
-
     /* Check proxy data */
     if (proxy) {
         ret = proxy_parse(proxy, c);
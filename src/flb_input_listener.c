@@ -0,0 +1,427 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Input listeners
+ * ===============
+ * Network input plugins by default accept and process every connection in
+ * the engine thread, so a busy sender can saturate the same core that runs
+ * every other plugin.
+ *
+ * This interface creates N listener threads, each one with it own event
+ * loop and a listening socket bound with SO_REUSEPORT to the same address,
+ * so the Kernel distribute the incoming connections across them. Plugins
+ * read, parse and pack the records inside the listener thread and hand the
+ * msgpack buffers to the engine through a single-producer/single-consumer
+ * lock-free queue. The engine is only woken up through a pipe when it is
+ * not already aware of pending data.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_listener.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_worker.h>
+
+#define QUEUE_MASK   (FLB_INPUT_LISTENER_QUEUE - 1)
+
+#ifdef _MSC_VER
+#define queue_load(p)           (*(volatile unsigned int *) (p))
+#define queue_store(p, v)       (*(volatile unsigned int *) (p) = (v))
+#define notify_swap(p, v)       InterlockedExchange((volatile LONG *) (p), v)
+#else
+#define queue_load(p)           __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define queue_store(p, v)       __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define notify_swap(p, v)       __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#endif
+
+/* Wake up the engine if it's not aware about pending data */
+static void listeners_notify(struct flb_input_listeners *ls)
+{
+    int ret;
+    uint64_t val = 1;
+
+    if (notify_swap(&ls->notified, 1) == 1) {
+        return;
+    }
+
+    ret = flb_pipe_w(ls->ch_notify[1], &val, sizeof(val));
+    if (ret == -1) {
+        flb_errno();
+    }
+}
+
+/*
+ * Enqueue a copy of a msgpack buffer, it must be called from the listener
+ * thread. If the queue is full the listener waits for the engine to drain
+ * it, stopping reading from it connections (backpressure).
+ */
+int flb_input_listener_append(struct flb_input_listener *lst,
+                              const char *tag, int tag_len,
+                              const void *buf, size_t size)
+{
+    unsigned int head;
+    struct flb_input_listener_msg *msg;
+    struct flb_input_listeners *ls = lst->parent;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    head = lst->q_head;
+    while (head - queue_load(&lst->q_tail) >= FLB_INPUT_LISTENER_QUEUE) {
+        if (ls->running == FLB_FALSE) {
+            return -1;
+        }
+        listeners_notify(ls);
+        flb_time_msleep(1);
+    }
+
+    msg = &lst->queue[head & QUEUE_MASK];
+    msg->buf = flb_malloc(size);
+    if (!msg->buf) {
+        flb_errno();
+        return -1;
+    }
+    memcpy(msg->buf, buf, size);
+    msg->size = size;
+
+    msg->tag = NULL;
+    msg->tag_len = 0;
+    if (tag && tag_len > 0) {
+        msg->tag = flb_malloc(tag_len);
+        if (!msg->tag) {
+            flb_errno();
+            flb_free(msg->buf);
+            return -1;
+        }
+        memcpy(msg->tag, tag, tag_len);
+        msg->tag_len = tag_len;
+    }
+
+    queue_store(&lst->q_head, head + 1);
+    listeners_notify(ls);
+
+    return 0;
+}
+
+/* Drain the queues of all listeners, it runs in the engine thread */
+int flb_input_listeners_collect(struct flb_input_listeners *ls)
+{
+    int c = 0;
+    uint64_t val;
+    unsigned int tail;
+    struct mk_list *head;
+    struct flb_input_listener *lst;
+    struct flb_input_listener_msg *msg;
+
+    flb_pipe_r(ls->ch_notify[0], &val, sizeof(val));
+
+    /* From now on, new data needs a new notification */
+    notify_swap(&ls->notified, 0);
+
+    mk_list_foreach(head, &ls->listeners) {
+        lst = mk_list_entry(head, struct flb_input_listener, _head);
+
+        tail = lst->q_tail;
+        while (tail != queue_load(&lst->q_head)) {
+            msg = &lst->queue[tail & QUEUE_MASK];
+            flb_input_chunk_append_raw(ls->in, msg->tag, msg->tag_len,
+                                       msg->buf, msg->size);
+            flb_free(msg->buf);
+            if (msg->tag) {
+                flb_free(msg->tag);
+            }
+            tail++;
+            queue_store(&lst->q_tail, tail);
+            c++;
+        }
+    }
+
+    return c;
+}
+
+/* New connection on a listener socket */
+static int listener_accept(void *data)
+{
+    flb_sockfd_t fd;
+    struct flb_input_listener *lst = data;
+    struct flb_input_listeners *ls = lst->parent;
+
+    fd = flb_net_accept(lst->server_fd);
+    if (fd == -1) {
+        return -1;
+    }
+
+    flb_trace("[listener %i] new connection fd=%i", lst->id, fd);
+    return ls->cb_accept(fd, lst, ls->data);
+}
+
+static void listener_worker(void *data)
+{
+    int run = FLB_TRUE;
+    struct mk_event *event;
+    struct flb_input_listener *lst = data;
+
+    flb_debug("[listener %i] started on fd=%i", lst->id, lst->server_fd);
+
+    while (run) {
+        mk_event_wait(lst->evl);
+        mk_event_foreach(event, lst->evl) {
+            if (event == &lst->stop_event) {
+                run = FLB_FALSE;
+                break;
+            }
+            else if (event->type == FLB_ENGINE_EV_CUSTOM) {
+                event->handler(event);
+            }
+        }
+    }
+
+    flb_debug("[listener %i] stopped", lst->id);
+}
+
+static void listener_destroy(struct flb_input_listener *lst)
+{
+    struct flb_input_listener_msg *msg;
+
+    /* Release buffers that did not reach the engine */
+    while (lst->q_tail != lst->q_head) {
+        msg = &lst->queue[lst->q_tail & QUEUE_MASK];
+        flb_free(msg->buf);
+        if (msg->tag) {
+            flb_free(msg->tag);
+        }
+        lst->q_tail++;
+    }
+
+    if (lst->evl) {
+        mk_event_loop_destroy(lst->evl);
+    }
+    if (lst->ch_stop[0] > 0) {
+        flb_pipe_destroy(lst->ch_stop);
+    }
+    if (lst->server_fd > 0) {
+        flb_socket_close(lst->server_fd);
+    }
+
+    mk_list_del(&lst->_head);
+    flb_free(lst->queue);
+    flb_free(lst);
+}
+
+static struct flb_input_listener *listener_create(struct flb_input_listeners *ls,
+                                                  int id,
+                                                  const char *listen,
+                                                  const char *port)
+{
+    int ret;
+    struct flb_input_listener *lst;
+
+    lst = flb_calloc(1, sizeof(struct flb_input_listener));
+    if (!lst) {
+        flb_errno();
+        return NULL;
+    }
+    lst->id = id;
+    lst->parent = ls;
+    mk_list_init(&lst->connections);
+    mk_list_add(&lst->_head, &ls->listeners);
+
+    lst->queue = flb_calloc(FLB_INPUT_LISTENER_QUEUE,
+                            sizeof(struct flb_input_listener_msg));
+    if (!lst->queue) {
+        flb_errno();
+        listener_destroy(lst);
+        return NULL;
+    }
+
+    lst->server_fd = flb_net_server_reuseport(port, listen);
+    if (lst->server_fd == -1) {
+        listener_destroy(lst);
+        return NULL;
+    }
+    flb_net_socket_nonblocking(lst->server_fd);
+
+    lst->evl = mk_event_loop_create(256);
+    if (!lst->evl) {
+        listener_destroy(lst);
+        return NULL;
+    }
+
+    /* Listening socket */
+    MK_EVENT_NEW(&lst->event);
+    lst->event.fd = lst->server_fd;
+    lst->event.type = FLB_ENGINE_EV_CUSTOM;
+    lst->event.handler = listener_accept;
+    ret = mk_event_add(lst->evl, lst->server_fd,
+                       FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, &lst->event);
+    if (ret == -1) {
+        listener_destroy(lst);
+        return NULL;
+    }
+
+    /* Stop channel */
+    ret = flb_pipe_create(lst->ch_stop);
+    if (ret == -1) {
+        flb_errno();
+        listener_destroy(lst);
+        return NULL;
+    }
+    MK_EVENT_ZERO(&lst->stop_event);
+    ret = mk_event_add(lst->evl, lst->ch_stop[0],
+                       FLB_ENGINE_EV_CORE, MK_EVENT_READ, &lst->stop_event);
+    if (ret == -1) {
+        listener_destroy(lst);
+        return NULL;
+    }
+
+    return lst;
+}
+
+/*
+ * Create 'workers' listeners on the given address, every new connection
+ * is passed to 'cb_accept' from the listener thread context.
+ */
+struct flb_input_listeners *flb_input_listeners_create(struct flb_input_instance *in,
+                                                       const char *listen,
+                                                       const char *port,
+                                                       int workers,
+                                                       int (*cb_accept) (flb_sockfd_t,
+                                                                         struct flb_input_listener *,
+                                                                         void *),
+                                                       void *data,
+                                                       struct flb_config *config)
+{
+    int i;
+    int ret;
+    struct flb_input_listener *lst;
+    struct flb_input_listeners *ls;
+
+    ls = flb_calloc(1, sizeof(struct flb_input_listeners));
+    if (!ls) {
+        flb_errno();
+        return NULL;
+    }
+    ls->in = in;
+    ls->config = config;
+    ls->cb_accept = cb_accept;
+    ls->data = data;
+    ls->coll_fd = -1;
+    mk_list_init(&ls->listeners);
+
+    ret = flb_pipe_create(ls->ch_notify);
+    if (ret == -1) {
+        flb_errno();
+        flb_free(ls);
+        return NULL;
+    }
+
+    for (i = 0; i < workers; i++) {
+        lst = listener_create(ls, i, listen, port);
+        if (!lst) {
+            flb_error("[listener] could not create listener %i on %s:%s",
+                      i, listen, port);
+            flb_input_listeners_destroy(ls);
+            return NULL;
+        }
+    }
+
+    return ls;
+}
+
+/* Register the engine collector and spawn the listener threads */
+int flb_input_listeners_start(struct flb_input_listeners *ls,
+                              int (*cb_collect) (struct flb_input_instance *,
+                                                 struct flb_config *, void *))
+{
+    int ret;
+    struct mk_list *head;
+    struct flb_input_listener *lst;
+
+    ret = flb_input_set_collector_event(ls->in, cb_collect,
+                                        ls->ch_notify[0], ls->config);
+    if (ret == -1) {
+        return -1;
+    }
+    ls->coll_fd = ret;
+    ls->running = FLB_TRUE;
+
+    mk_list_foreach(head, &ls->listeners) {
+        lst = mk_list_entry(head, struct flb_input_listener, _head);
+        ret = flb_worker_create(listener_worker, lst, &lst->tid, ls->config);
+        if (ret == -1) {
+            flb_error("[listener] could not spawn listener %i", lst->id);
+            return -1;
+        }
+        lst->started = FLB_TRUE;
+    }
+
+    return 0;
+}
+
+/* Stop and wait for all the listener threads */
+void flb_input_listeners_stop(struct flb_input_listeners *ls)
+{
+    uint64_t val = 1;
+    struct mk_list *head;
+    struct flb_input_listener *lst;
+
+    if (ls->running == FLB_FALSE) {
+        return;
+    }
+    ls->running = FLB_FALSE;
+
+    mk_list_foreach(head, &ls->listeners) {
+        lst = mk_list_entry(head, struct flb_input_listener, _head);
+        if (lst->started == FLB_FALSE) {
+            continue;
+        }
+        flb_pipe_w(lst->ch_stop[1], &val, sizeof(val));
+        pthread_join(lst->tid, NULL);
+        lst->started = FLB_FALSE;
+    }
+}
+
+/*
+ * Release the listeners. The threads must be stopped and the plugin must
+ * release it connections in every listener before calling this function.
+ */
+void flb_input_listeners_destroy(struct flb_input_listeners *ls)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_input_listener *lst;
+
+    flb_input_listeners_stop(ls);
+
+    mk_list_foreach_safe(head, tmp, &ls->listeners) {
+        lst = mk_list_entry(head, struct flb_input_listener, _head);
+        listener_destroy(lst);
+    }
+
+    flb_pipe_destroy(ls->ch_notify);
+    flb_free(ls);
+}
@@ -0,0 +1,843 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * JSON to MessagePack packer based on a structural index
+ * ------------------------------------------------------
+ * The input is processed in two stages:
+ *
+ * 1. The buffer is classified in blocks of 64 bytes into bitmasks (quotes,
+ *    backslashes, operators, white spaces). Escaped characters and string
+ *    ranges are resolved with plain bit arithmetic and the position of every
+ *    structural character is appended to an index. The classification step
+ *    is the only one that depends on the CPU, a SSE2 and an AVX2 version
+ *    are available on x86_64, other platforms use a lookup table.
+ *
+ * 2. The index is walked twice: first to validate the grammar and count
+ *    the size of every map and array, then to write the MessagePack output.
+ *
+ * The behavior matches the former jsmn based packer: multiple root values
+ * can be concatenated (optionally separated by a comma), root strings are
+ * not allowed and a primitive must be followed by a delimiter to be
+ * considered complete.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_bits.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_unescape.h>
+#include <fluent-bit/flb_number.h>
+#include <fluent-bit/flb_json_index.h>
+
+#include <msgpack.h>
+#include <jsmn/jsmn.h>
+
+#if defined(FLB_HAVE_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define JSON_INDEX_X86
+#include <immintrin.h>
+#endif
+
+/* Character classes */
+#define JC_QUOTE      1
+#define JC_BACKSLASH  2
+#define JC_OP         4
+#define JC_SPACE      8
+#define JC_NUL       16
+
+/* Parser expectations while walking the index */
+#define EXPECT_ROOT             0
+#define EXPECT_VALUE            1
+#define EXPECT_VALUE_OR_CLOSE   2
+#define EXPECT_KEY              3
+#define EXPECT_KEY_OR_CLOSE     4
+#define EXPECT_COLON            5
+#define EXPECT_COMMA_OR_CLOSE   6
+
+/* Index carries between blocks */
+#define CARRY_ESCAPED    0
+#define CARRY_STRING     1
+#define CARRY_SCALAR     2
+
+/* Bitmasks of a 64 bytes block */
+struct json_block {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t space;
+    uint64_t nul;
+};
+
+typedef void (*json_classify_t)(const unsigned char *, struct json_block *);
+
+static const unsigned char json_class[256] = {
+    [0]    = JC_NUL,
+    ['"']  = JC_QUOTE,
+    ['\\'] = JC_BACKSLASH,
+    ['{']  = JC_OP, ['}'] = JC_OP, ['['] = JC_OP, [']'] = JC_OP,
+    [':']  = JC_OP, [','] = JC_OP,
+    [' ']  = JC_SPACE, ['\t'] = JC_SPACE, ['\r'] = JC_SPACE, ['\n'] = JC_SPACE,
+};
+
+static void classify_scalar(const unsigned char *in, struct json_block *b)
+{
+    int i;
+    uint64_t c;
+
+    memset(b, '\0', sizeof(struct json_block));
+    for (i = 0; i < 64; i++) {
+        c = json_class[in[i]];
+        b->quote     |= (c & 1) << i;
+        b->backslash |= ((c >> 1) & 1) << i;
+        b->op        |= ((c >> 2) & 1) << i;
+        b->space     |= ((c >> 3) & 1) << i;
+        b->nul       |= ((c >> 4) & 1) << i;
+    }
+}
+
+#ifdef JSON_INDEX_X86
+static inline uint64_t sse2_mask(__m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+    return ((uint64_t) (uint32_t) _mm_movemask_epi8(m0)) |
+           ((uint64_t) (uint32_t) _mm_movemask_epi8(m1) << 16) |
+           ((uint64_t) (uint32_t) _mm_movemask_epi8(m2) << 32) |
+           ((uint64_t) (uint32_t) _mm_movemask_epi8(m3) << 48);
+}
+
+#define SSE2_EQ(c)                                              \
+    sse2_mask(_mm_cmpeq_epi8(v[0], c), _mm_cmpeq_epi8(v[1], c), \
+              _mm_cmpeq_epi8(v[2], c), _mm_cmpeq_epi8(v[3], c))
+
+static void classify_sse2(const unsigned char *in, struct json_block *b)
+{
+    int i;
+    __m128i v[4];
+    __m128i l[4];
+    __m128i lower = _mm_set1_epi8(0x20);
+
+    for (i = 0; i < 4; i++) {
+        v[i] = _mm_loadu_si128((const __m128i *) (in + (i * 16)));
+    }
+
+    b->quote     = SSE2_EQ(_mm_set1_epi8('"'));
+    b->backslash = SSE2_EQ(_mm_set1_epi8('\\'));
+    b->nul       = SSE2_EQ(_mm_setzero_si128());
+    b->space     = SSE2_EQ(_mm_set1_epi8(' ')) |
+                   SSE2_EQ(_mm_set1_epi8('\t')) |
+                   SSE2_EQ(_mm_set1_epi8('\r')) |
+                   SSE2_EQ(_mm_set1_epi8('\n'));
+    b->op        = SSE2_EQ(_mm_set1_epi8(':')) |
+                   SSE2_EQ(_mm_set1_epi8(','));
+
+    /* '[' and ']' only differ from '{' and '}' by the 0x20 bit */
+    for (i = 0; i < 4; i++) {
+        l[i] = _mm_or_si128(v[i], lower);
+    }
+    b->op |= sse2_mask(_mm_cmpeq_epi8(l[0], _mm_set1_epi8('{')),
+                       _mm_cmpeq_epi8(l[1], _mm_set1_epi8('{')),
+                       _mm_cmpeq_epi8(l[2], _mm_set1_epi8('{')),
+                       _mm_cmpeq_epi8(l[3], _mm_set1_epi8('{'))) |
+             sse2_mask(_mm_cmpeq_epi8(l[0], _mm_set1_epi8('}')),
+                       _mm_cmpeq_epi8(l[1], _mm_set1_epi8('}')),
+                       _mm_cmpeq_epi8(l[2], _mm_set1_epi8('}')),
+                       _mm_cmpeq_epi8(l[3], _mm_set1_epi8('}')));
+}
+
+#define AVX2_EQ(a, c)                                                    \
+    ((uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a[0], c)) | \
+     ((uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a[1], c)) << 32))
+
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char *in, struct json_block *b)
+{
+    __m256i v[2];
+    __m256i l[2];
+    __m256i lower = _mm256_set1_epi8(0x20);
+
+    v[0] = _mm256_loadu_si256((const __m256i *) in);
+    v[1] = _mm256_loadu_si256((const __m256i *) (in + 32));
+    l[0] = _mm256_or_si256(v[0], lower);
+    l[1] = _mm256_or_si256(v[1], lower);
+
+    b->quote     = AVX2_EQ(v, _mm256_set1_epi8('"'));
+    b->backslash = AVX2_EQ(v, _mm256_set1_epi8('\\'));
+    b->nul       = AVX2_EQ(v, _mm256_setzero_si256());
+    b->space     = AVX2_EQ(v, _mm256_set1_epi8(' ')) |
+                   AVX2_EQ(v, _mm256_set1_epi8('\t')) |
+                   AVX2_EQ(v, _mm256_set1_epi8('\r')) |
+                   AVX2_EQ(v, _mm256_set1_epi8('\n'));
+    b->op        = AVX2_EQ(v, _mm256_set1_epi8(':')) |
+                   AVX2_EQ(v, _mm256_set1_epi8(',')) |
+                   AVX2_EQ(l, _mm256_set1_epi8('{')) |
+                   AVX2_EQ(l, _mm256_set1_epi8('}'));
+}
+#endif
+
+static json_classify_t json_classify = NULL;
+static int json_classify_impl = -1;
+
+/* Packing runs from reader and listener threads too, select only once */
+static pthread_once_t json_classify_once = PTHREAD_ONCE_INIT;
+
+static void json_index_select()
+{
+#ifdef JSON_INDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        json_classify_impl = FLB_JSON_INDEX_AVX2;
+        json_classify = classify_avx2;
+    }
+    else {
+        json_classify_impl = FLB_JSON_INDEX_SSE2;
+        json_classify = classify_sse2;
+    }
+#else
+    json_classify_impl = FLB_JSON_INDEX_SCALAR;
+    json_classify = classify_scalar;
+#endif
+}
+
+int flb_json_index_impl()
+{
+    pthread_once(&json_classify_once, json_index_select);
+    return json_classify_impl;
+}
+
+/* Force a specific implementation, used by tests and benchmarks */
+int flb_json_index_set_impl(int impl)
+{
+    pthread_once(&json_classify_once, json_index_select);
+    if (impl == FLB_JSON_INDEX_SCALAR) {
+        json_classify = classify_scalar;
+    }
+#ifdef JSON_INDEX_X86
+    else if (impl == FLB_JSON_INDEX_SSE2) {
+        json_classify = classify_sse2;
+    }
+    else if (impl == FLB_JSON_INDEX_AVX2) {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) {
+            return -1;
+        }
+        json_classify = classify_avx2;
+    }
+#endif
+    else {
+        return -1;
+    }
+
+    json_classify_impl = impl;
+    return 0;
+}
+
+const char *flb_json_index_impl_name(int impl)
+{
+    switch (impl) {
+    case FLB_JSON_INDEX_SCALAR:
+        return "scalar";
+    case FLB_JSON_INDEX_SSE2:
+        return "sse2";
+    case FLB_JSON_INDEX_AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+/*
+ * Return the mask of characters escaped by a backslash. Sequences of
+ * backslashes are resolved by their parity, 'carry' tells if the first
+ * character of the block is escaped by the previous one.
+ */
+static inline uint64_t json_escaped(uint64_t backslash, uint64_t *carry)
+{
+    const uint64_t even = 0x5555555555555555ULL;
+    uint64_t follows;
+    uint64_t odd_starts;
+    uint64_t even_seqs;
+
+    backslash &= ~*carry;
+    follows = (backslash << 1) | *carry;
+    odd_starts = backslash & ~even & ~follows;
+    even_seqs = odd_starts + backslash;
+    *carry = (even_seqs < backslash);
+
+    return (even ^ (even_seqs << 1)) & follows;
+}
+
+/* Every bit set is toggled from its position up to the next set bit */
+static inline uint64_t prefix_xor(uint64_t m)
+{
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    m ^= m << 16;
+    m ^= m << 32;
+    return m;
+}
+
+static int index_grow(uint32_t **arr, size_t *size, size_t need)
+{
+    size_t s;
+    void *tmp;
+
+    if (need <= *size) {
+        return 0;
+    }
+
+    s = *size ? *size : 256;
+    while (s < need) {
+        s *= 2;
+    }
+
+    tmp = flb_realloc(*arr, s * sizeof(uint32_t));
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    *arr = tmp;
+    *size = s;
+    return 0;
+}
+
+/*
+ * Stage 1: append the position of every structural character. Full blocks
+ * are kept in the state so a partial message can be resumed when more data
+ * is appended to the same buffer. Returns the number of entries and set
+ * 'len' to the effective length (the content stops at the first NUL byte).
+ */
+static ssize_t json_index_build(struct flb_pack_state *state,
+                                const char *js, size_t *len)
+{
+    int has_nul;
+    size_t n;
+    size_t off;
+    size_t end;
+    size_t bytes;
+    uint64_t carry[3];
+    uint64_t escaped;
+    uint64_t quote;
+    uint64_t in_string;
+    uint64_t other;
+    uint64_t valid;
+    uint64_t structural;
+    uint32_t *idx;
+    unsigned char tail[64];
+    const unsigned char *p;
+    struct json_block b;
+
+    pthread_once(&json_classify_once, json_index_select);
+
+    /* Resume from the last full block */
+    if (state->index_off > *len) {
+        state->index_off = 0;
+    }
+    off = state->index_off;
+    if (off > 0) {
+        n = state->index_full;
+        memcpy(carry, state->index_carry, sizeof(carry));
+    }
+    else {
+        n = 0;
+        memset(carry, '\0', sizeof(carry));
+    }
+    end = *len;
+
+    while (off < end) {
+        if (index_grow(&state->index, &state->index_size, n + 64) == -1) {
+            return -1;
+        }
+        idx = state->index;
+
+        bytes = end - off;
+        if (bytes >= 64) {
+            p = (const unsigned char *) js + off;
+            bytes = 64;
+        }
+        else {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, js + off, bytes);
+            p = tail;
+        }
+        json_classify(p, &b);
+
+        has_nul = FLB_FALSE;
+        if (b.nul) {
+            /* jsmn compatibility: a NUL byte ends the content */
+            has_nul = FLB_TRUE;
+            bytes = flb_bits_ctz64(b.nul);
+            end = off + bytes;
+        }
+
+        if (bytes < 64) {
+            valid = (bytes == 0) ? 0 : (~0ULL >> (64 - bytes));
+            b.quote &= valid;
+            b.backslash &= valid;
+            b.op &= valid;
+            b.space |= ~valid;
+        }
+
+        escaped = json_escaped(b.backslash, &carry[CARRY_ESCAPED]);
+        quote = b.quote & ~escaped;
+        in_string = prefix_xor(quote) ^ carry[CARRY_STRING];
+        carry[CARRY_STRING] = (uint64_t) ((int64_t) in_string >> 63);
+
+        /* First byte of every primitive value */
+        other = ~(b.op | b.space | quote | in_string);
+        structural = (b.op & ~in_string) | quote |
+                     (other & ~((other << 1) | carry[CARRY_SCALAR]));
+        carry[CARRY_SCALAR] = other >> 63;
+
+        while (structural) {
+            idx[n++] = off + flb_bits_ctz64(structural);
+            structural &= structural - 1;
+        }
+
+        off += bytes;
+        if (bytes == 64 && !has_nul) {
+            state->index_off = off;
+            state->index_full = n;
+            memcpy(state->index_carry, carry, sizeof(carry));
+        }
+        if (has_nul) {
+            break;
+        }
+    }
+
+    *len = end;
+    return n;
+}
+
+static inline int literal_start(char c)
+{
+    return ((c >= '0' && c <= '9') || c == '-' ||
+            c == 't' || c == 'f' || c == 'n');
+}
+
+static inline int literal_valid(const char *p, size_t len)
+{
+    switch (*p) {
+    case 't':
+        return (len == 4 && memcmp(p, "true", 4) == 0);
+    case 'f':
+        return (len == 5 && memcmp(p, "false", 5) == 0);
+    case 'n':
+        return (len == 4 && memcmp(p, "null", 4) == 0);
+    }
+    return FLB_TRUE;
+}
+
+/*
+ * Return the end of the primitive starting at 'pos', zero if the buffer ends
+ * before a delimiter or -1 if it contains an invalid character.
+ */
+static inline ssize_t primitive_end(const char *js, size_t len, size_t pos)
+{
+    unsigned char c;
+    size_t e;
+
+    for (e = pos; e < len; e++) {
+        c = js[e];
+        if (json_class[c] & (JC_SPACE | JC_NUL) ||
+            c == ',' || c == ']' || c == '}') {
+            return e;
+        }
+        if (c < 32 || c >= 127 || json_class[c]) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Validate the escape sequences of a string with the jsmn rules */
+static int string_escapes_valid(const char *p, const char *end)
+{
+    int i;
+    char c;
+
+    while ((p = memchr(p, '\\', end - p)) != NULL) {
+        p++;
+        if (p >= end) {
+            return FLB_FALSE;
+        }
+        switch (*p) {
+        case '"': case '/': case '\\': case 'b':
+        case 'f': case 'r': case 'n':  case 't':
+            break;
+        case 'u':
+            for (i = 1; i <= 4; i++) {
+                if (p + i >= end) {
+                    return FLB_FALSE;
+                }
+                c = p[i];
+                if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') ||
+                      (c >= 'a' && c <= 'f'))) {
+                    return FLB_FALSE;
+                }
+            }
+            p += 4;
+            break;
+        default:
+            return FLB_FALSE;
+        }
+        p++;
+    }
+    return FLB_TRUE;
+}
+
+static int pack_string(struct flb_pack_state *state, msgpack_packer *pck,
+                       const char *str, int len)
+{
+    int out_len;
+    char *tmp;
+
+    if (!memchr(str, '\\', len)) {
+        msgpack_pack_str(pck, len);
+        msgpack_pack_str_body(pck, str, len);
+        return 0;
+    }
+
+    if (string_escapes_valid(str, str + len) == FLB_FALSE) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (state->buf_size < len + 1) {
+        tmp = flb_realloc(state->buf_data, len + 1);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        state->buf_data = tmp;
+        state->buf_size = len + 1;
+    }
+
+    /* Always decode any UTF-8 or special characters */
+    out_len = flb_unescape_string_utf8(str, len, state->buf_data);
+    msgpack_pack_str(pck, out_len);
+    msgpack_pack_str_body(pck, state->buf_data, out_len);
+    return 0;
+}
+
+static int pack_primitive(msgpack_packer *pck, const char *p, int len)
+{
+    int ret;
+    struct flb_number num;
+
+    if (*p == 'f') {
+        msgpack_pack_false(pck);
+        return 0;
+    }
+    else if (*p == 't') {
+        msgpack_pack_true(pck);
+        return 0;
+    }
+    else if (*p == 'n') {
+        msgpack_pack_nil(pck);
+        return 0;
+    }
+
+    ret = flb_number_parse(p, len, &num);
+    if (ret == -1) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (num.type == FLB_NUMBER_INT) {
+        msgpack_pack_int64(pck, num.val.i64);
+    }
+    else if (num.type == FLB_NUMBER_UINT) {
+        msgpack_pack_uint64(pck, num.val.u64);
+    }
+    else {
+        msgpack_pack_double(pck, num.val.f64);
+    }
+    return 0;
+}
+
+/*
+ * Stage 2a: validate the index and register the size of every container in
+ * order of appearance. On success 'complete' is set to the number of index
+ * entries that belong to complete root values.
+ */
+static int json_index_validate(struct flb_pack_state *state,
+                               const char *js, size_t len, size_t n,
+                               size_t *complete, int *incomplete,
+                               size_t *last_byte)
+{
+    int top;
+    int expect = EXPECT_ROOT;
+    int roots = 0;
+    size_t i;
+    size_t depth = 0;
+    size_t containers = 0;
+    size_t pos;
+    ssize_t end;
+    uint32_t *idx = state->index;
+    uint32_t *stack;
+    uint32_t *sizes;
+    char c;
+
+    *complete = 0;
+    *incomplete = FLB_FALSE;
+
+    for (i = 0; i < n; i++) {
+        pos = idx[i];
+        c = js[pos];
+        end = -1;
+
+        switch (c) {
+        case '{':
+        case '[':
+            if (expect != EXPECT_ROOT && expect != EXPECT_VALUE &&
+                expect != EXPECT_VALUE_OR_CLOSE) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            if (index_grow(&state->sizes, &state->sizes_size,
+                           containers + 1) == -1 ||
+                index_grow(&state->stack, &state->stack_size,
+                           depth + 1) == -1) {
+                return -1;
+            }
+            sizes = state->sizes;
+            stack = state->stack;
+            if (depth > 0 && !(stack[depth - 1] & 1)) {
+                sizes[stack[depth - 1] >> 1]++;
+            }
+            sizes[containers] = 0;
+            stack[depth++] = (containers << 1) | (c == '{');
+            containers++;
+            expect = (c == '{') ? EXPECT_KEY_OR_CLOSE : EXPECT_VALUE_OR_CLOSE;
+            continue;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            top = state->stack[depth - 1] & 1;
+            if (top != (c == '}') ||
+                (expect != EXPECT_COMMA_OR_CLOSE &&
+                 expect != (top ? EXPECT_KEY_OR_CLOSE : EXPECT_VALUE_OR_CLOSE))) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            depth--;
+            end = pos + 1;
+            break;
+        case ':':
+            if (expect != EXPECT_COLON) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            expect = EXPECT_VALUE;
+            continue;
+        case ',':
+            if (depth == 0) {
+                /* jsmn compatibility: root values can be comma separated */
+                if (expect != EXPECT_ROOT || roots == 0) {
+                    return FLB_ERR_JSON_INVAL;
+                }
+                continue;
+            }
+            if (expect != EXPECT_COMMA_OR_CLOSE) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            expect = (state->stack[depth - 1] & 1) ? EXPECT_KEY : EXPECT_VALUE;
+            continue;
+        case '"':
+            /* root strings are not allowed */
+            if (expect != EXPECT_KEY && expect != EXPECT_KEY_OR_CLOSE &&
+                expect != EXPECT_VALUE && expect != EXPECT_VALUE_OR_CLOSE) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            if (i + 1 >= n) {
+                *incomplete = FLB_TRUE;
+                goto done;
+            }
+            i++;
+            if (expect == EXPECT_KEY || expect == EXPECT_KEY_OR_CLOSE) {
+                state->sizes[state->stack[depth - 1] >> 1]++;
+                expect = EXPECT_COLON;
+                continue;
+            }
+            end = idx[i] + 1;
+            break;
+        default:
+            if (expect != EXPECT_ROOT && expect != EXPECT_VALUE &&
+                expect != EXPECT_VALUE_OR_CLOSE) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            if (!literal_start(js[pos])) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            end = primitive_end(js, len, pos);
+            if (end == 0) {
+                *incomplete = FLB_TRUE;
+                goto done;
+            }
+            if (end == -1 || !literal_valid(js + pos, end - pos)) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            break;
+        }
+
+        /* A value has been completed, containers count their items */
+        if (depth > 0) {
+            /* containers were counted by their parent when opened */
+            if (c != '}' && c != ']' && !(state->stack[depth - 1] & 1)) {
+                state->sizes[state->stack[depth - 1] >> 1]++;
+            }
+            expect = EXPECT_COMMA_OR_CLOSE;
+        }
+        else {
+            roots++;
+            *complete = i + 1;
+            *last_byte = end;
+            expect = EXPECT_ROOT;
+        }
+    }
+
+ done:
+    if (depth > 0) {
+        *incomplete = FLB_TRUE;
+    }
+    return roots;
+}
+
+/* Stage 2b: write the MessagePack representation of the complete entries */
+static int json_index_emit(struct flb_pack_state *state,
+                           const char *js, size_t len, size_t complete,
+                           msgpack_packer *pck)
+{
+    int ret;
+    size_t i;
+    size_t pos;
+    size_t containers = 0;
+    ssize_t end;
+    uint32_t *idx = state->index;
+    char c;
+
+    for (i = 0; i < complete; i++) {
+        pos = idx[i];
+        c = js[pos];
+
+        switch (c) {
+        case '{':
+            msgpack_pack_map(pck, state->sizes[containers++]);
+            break;
+        case '[':
+            msgpack_pack_array(pck, state->sizes[containers++]);
+            break;
+        case '}':
+        case ']':
+        case ':':
+        case ',':
+            break;
+        case '"':
+            i++;
+            ret = pack_string(state, pck, js + pos + 1, idx[i] - pos - 1);
+            if (ret != 0) {
+                return ret;
+            }
+            break;
+        default:
+            end = primitive_end(js, len, pos);
+            ret = pack_primitive(pck, js + pos, end - pos);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Pack the JSON content of 'js' into MessagePack. If 'partial' is set and
+ * the buffer ends with an incomplete value, the complete root values before
+ * it are packed and state->last_byte tells where they end.
+ */
+int flb_json_index_pack(struct flb_pack_state *state,
+                        const char *js, size_t len, int partial,
+                        char **buffer, int *size, int *root_type)
+{
+    int ret;
+    int roots;
+    int incomplete;
+    ssize_t n;
+    size_t complete;
+    size_t last_byte;
+    msgpack_packer pck;
+    msgpack_sbuffer sbuf;
+
+    n = json_index_build(state, js, &len);
+    if (n == -1) {
+        return -1;
+    }
+
+    roots = json_index_validate(state, js, len, n,
+                                &complete, &incomplete, &last_byte);
+    if (roots < 0) {
+        return roots;
+    }
+    else if (roots == 0) {
+        return incomplete ? FLB_ERR_JSON_PART : FLB_ERR_JSON_INVAL;
+    }
+    else if (incomplete && partial == FLB_FALSE) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    /* MessagePack output is usually smaller than its JSON representation */
+    msgpack_sbuffer_init(&sbuf);
+    sbuf.data = malloc(len + 64);
+    if (!sbuf.data) {
+        flb_errno();
+        return -1;
+    }
+    sbuf.alloc = len + 64;
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    ret = json_index_emit(state, js, len, complete, &pck);
+    if (ret != 0) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return ret;
+    }
+
+    if (root_type) {
+        switch (js[state->index[0]]) {
+        case '{':
+            *root_type = JSMN_OBJECT;
+            break;
+        case '[':
+            *root_type = JSMN_ARRAY;
+            break;
+        default:
+            *root_type = JSMN_PRIMITIVE;
+        }
+    }
+
+    state->last_byte = last_byte;
+    *buffer = sbuf.data;
+    *size = sbuf.size;
+    return 0;
+}
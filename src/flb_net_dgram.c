@@ -0,0 +1,204 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_socket.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_net_dgram.h>
+
+#ifdef FLB_HAVE_RECVMMSG
+#include <sys/uio.h>
+
+/* Room for the SO_RXQ_OVFL counter in every message */
+#define DGRAM_CMSG_SIZE  CMSG_SPACE(sizeof(uint32_t))
+#endif
+
+struct flb_net_dgram_batch *flb_net_dgram_batch_create(flb_sockfd_t fd,
+                                                       int size,
+                                                       size_t dgram_size)
+{
+    struct flb_net_dgram_batch *b;
+
+    if (size <= 0) {
+        size = FLB_NET_DGRAM_BATCH;
+    }
+
+    b = flb_calloc(1, sizeof(struct flb_net_dgram_batch));
+    if (!b) {
+        flb_errno();
+        return NULL;
+    }
+    b->size = size;
+    b->dgram_size = dgram_size;
+
+    b->buf = flb_malloc(size * dgram_size);
+    b->lens = flb_calloc(size, sizeof(size_t));
+    if (!b->buf || !b->lens) {
+        flb_errno();
+        flb_net_dgram_batch_destroy(b);
+        return NULL;
+    }
+
+#ifdef FLB_HAVE_RECVMMSG
+    b->msgs = flb_calloc(size, sizeof(struct mmsghdr));
+    b->iovs = flb_calloc(size, sizeof(struct iovec));
+    b->cmsg = flb_calloc(size, DGRAM_CMSG_SIZE);
+    if (!b->msgs || !b->iovs || !b->cmsg) {
+        flb_errno();
+        flb_net_dgram_batch_destroy(b);
+        return NULL;
+    }
+
+    if (flb_net_socket_rxq_ovfl(fd) == 0) {
+        b->rxq_ovfl = FLB_TRUE;
+    }
+    else {
+        flb_debug("[net] fd=%i kernel drop counters are not available", fd);
+    }
+#endif
+
+    return b;
+}
+
+void flb_net_dgram_batch_destroy(struct flb_net_dgram_batch *b)
+{
+    flb_free(b->buf);
+    flb_free(b->lens);
+    flb_free(b->msgs);
+    flb_free(b->iovs);
+    flb_free(b->cmsg);
+    flb_free(b);
+}
+
+#ifdef FLB_HAVE_RECVMMSG
+/* Lookup the Kernel drop counter in the ancillary data of a message */
+static void dgram_drops(struct flb_net_dgram_batch *b, struct msghdr *hdr)
+{
+#ifdef SO_RXQ_OVFL
+    uint32_t counter;
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(hdr); cm; cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SO_RXQ_OVFL) {
+            continue;
+        }
+
+        memcpy(&counter, CMSG_DATA(cm), sizeof(counter));
+        if (counter != b->drops_total) {
+            b->drops += counter - b->drops_total;
+            b->drops_total = counter;
+        }
+    }
+#endif
+}
+
+/*
+ * Receive up to 'b->size' datagrams without blocking. Returns the number of
+ * datagrams stored in the batch or -1 on error.
+ */
+int flb_net_dgram_recv(flb_sockfd_t fd, struct flb_net_dgram_batch *b)
+{
+    int i;
+    int ret;
+    struct mmsghdr *msgs = b->msgs;
+    struct iovec *iovs = b->iovs;
+
+    for (i = 0; i < b->size; i++) {
+        iovs[i].iov_base = flb_net_dgram_data(b, i);
+        iovs[i].iov_len = b->dgram_size - 1;
+
+        memset(&msgs[i].msg_hdr, '\0', sizeof(struct msghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (b->rxq_ovfl == FLB_TRUE) {
+            msgs[i].msg_hdr.msg_control = b->cmsg + (i * DGRAM_CMSG_SIZE);
+            msgs[i].msg_hdr.msg_controllen = DGRAM_CMSG_SIZE;
+        }
+        msgs[i].msg_len = 0;
+    }
+
+    b->count = 0;
+    b->drops = 0;
+
+    ret = recvmmsg(fd, msgs, b->size, MSG_DONTWAIT, NULL);
+    if (ret == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        flb_errno();
+        return -1;
+    }
+
+    for (i = 0; i < ret; i++) {
+        b->lens[i] = msgs[i].msg_len;
+        flb_net_dgram_data(b, i)[b->lens[i]] = '\0';
+        if (b->rxq_ovfl == FLB_TRUE) {
+            dgram_drops(b, &msgs[i].msg_hdr);
+        }
+    }
+    b->count = ret;
+
+    return ret;
+}
+#else
+int flb_net_dgram_recv(flb_sockfd_t fd, struct flb_net_dgram_batch *b)
+{
+    int i;
+    int flags = 0;
+    ssize_t bytes;
+    char *buf;
+
+#ifdef MSG_DONTWAIT
+    flags = MSG_DONTWAIT;
+#endif
+
+    b->count = 0;
+    b->drops = 0;
+
+    for (i = 0; i < b->size; i++) {
+        buf = flb_net_dgram_data(b, i);
+        bytes = recv(fd, buf, b->dgram_size - 1, flags);
+        if (bytes < 0) {
+            if (i == 0 && !FLB_WOULDBLOCK()) {
+                flb_errno();
+                return -1;
+            }
+            break;
+        }
+        buf[bytes] = '\0';
+        b->lens[i] = bytes;
+        b->count++;
+
+        /* Without a non-blocking flag, only one read is safe */
+        if (flags == 0) {
+            break;
+        }
+    }
+
+    return b->count;
+}
+#endif
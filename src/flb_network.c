@@ -112,6 +112,26 @@ int flb_net_socket_reset(flb_sockfd_t fd)
     return 0;
 }
 
+/* Allow multiple sockets to bind the same address (Linux >= 3.9) */
+int flb_net_socket_reuseport(flb_sockfd_t fd)
+{
+#ifdef SO_REUSEPORT
+    int on = 1;
+    int ret;
+
+    ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    return 0;
+#else
+    flb_error("[net] SO_REUSEPORT is not supported on this system");
+    return -1;
+#endif
+}
+
 int flb_net_socket_tcp_nodelay(flb_sockfd_t fd)
 {
     int on = 1;
@@ -141,6 +161,47 @@ int flb_net_socket_nonblocking(flb_sockfd_t fd)
     return 0;
 }
 
+/*
+ * Set the socket receive buffer size (SO_RCVBUF). The Kernel caps the value
+ * to net.core.rmem_max, the effective size is returned.
+ */
+int flb_net_socket_rcvbuf(flb_sockfd_t fd, int size)
+{
+    int ret;
+    int val = 0;
+    socklen_t len = sizeof(val);
+
+    ret = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const void *) &size,
+                     sizeof(size));
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    ret = getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *) &val, &len);
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    return val;
+}
+
+/*
+ * Ask the Kernel to report the number of datagrams dropped on the socket
+ * receive queue as ancillary data of each message (Linux >= 2.6.33).
+ */
+int flb_net_socket_rxq_ovfl(flb_sockfd_t fd)
+{
+#ifdef SO_RXQ_OVFL
+    int on = 1;
+
+    return setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+#else
+    return -1;
+#endif
+}
+
 /*
  * Enable the TCP_FASTOPEN feature for server side implemented in Linux Kernel >= 3.7,
  * for more details read here:
@@ -305,7 +366,8 @@ int flb_net_tcp_fd_connect(flb_sockfd_t fd, const char *host, unsigned long port
     return ret;
 }
 
-flb_sockfd_t flb_net_server(const char *port, const char *listen_addr)
+static flb_sockfd_t net_server(const char *port, const char *listen_addr,
+                               int reuseport)
 {
     flb_sockfd_t fd = -1;
     int ret;
@@ -334,6 +396,11 @@ flb_sockfd_t flb_net_server(const char *port, const char *listen_addr)
         flb_net_socket_tcp_nodelay(fd);
         flb_net_socket_reset(fd);
 
+        if (reuseport == FLB_TRUE && flb_net_socket_reuseport(fd) == -1) {
+            flb_socket_close(fd);
+            continue;
+        }
+
         ret = flb_net_bind(fd, rp->ai_addr, rp->ai_addrlen, 128);
         if(ret == -1) {
             flb_warn("Cannot listen on %s port %s", listen_addr, port);
@@ -351,6 +418,21 @@ flb_sockfd_t flb_net_server(const char *port, const char *listen_addr)
     return fd;
 }
 
+flb_sockfd_t flb_net_server(const char *port, const char *listen_addr)
+{
+    return net_server(port, listen_addr, FLB_FALSE);
+}
+
+/*
+ * Create a TCP server socket with SO_REUSEPORT enabled, so other sockets
+ * created with this same function can bind the same address and the Kernel
+ * balance the incoming connections across them.
+ */
+flb_sockfd_t flb_net_server_reuseport(const char *port, const char *listen_addr)
+{
+    return net_server(port, listen_addr, FLB_TRUE);
+}
+
 flb_sockfd_t flb_net_server_udp(const char *port, const char *listen_addr)
 {
     flb_sockfd_t fd = -1;
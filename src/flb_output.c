@@ -28,6 +28,7 @@
 #include <fluent-bit/flb_env.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_output_batch.h>
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_uri.h>
@@ -41,6 +42,7 @@ FLB_TLS_DEFINE(struct flb_libco_out_params, flb_libco_params);
 void flb_output_prepare()
 {
     FLB_TLS_INIT(flb_libco_params);
+    flb_output_batch_prepare();
 }
 
 /* Validate the the output address protocol */
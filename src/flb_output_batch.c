@@ -0,0 +1,431 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Output sub-batches
+ * ==================
+ * A chunk can be quite large (2MB or more) and plugins that deliver the
+ * content through a request/response protocol end up waiting on a single
+ * serial upload, or a single serial retry when it fails.
+ *
+ * The interface below split a chunk buffer on record boundaries into
+ * sub-batches of a maximum size and flush them concurrently. From the
+ * current output co-routine (the parent) a small number of worker
+ * co-routines are spawned, each one takes the next pending sub-batch and
+ * invokes the plugin callback. Since every worker uses its own upstream
+ * connection, while one of them waits for the network the others can
+ * keep going. The parent co-routine is resumed once all workers finished.
+ *
+ * The delivery status of every sub-batch is kept in the task route, so if
+ * the flush is retried only the sub-batches that failed are sent again.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_output_batch.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_thread_storage.h>
+#include <fluent-bit/flb_task.h>
+
+#include <mpack/mpack.h>
+
+/* Shared state between the parent co-routine and the workers */
+struct batch_flush {
+    const char *data;
+    struct flb_output_batch *batch;
+    int next;                         /* next part to lookup          */
+    int running;                      /* number of active workers     */
+    int waiting;                      /* parent is waiting on workers */
+    flb_output_batch_cb cb;
+    void *cb_data;
+    struct flb_thread *parent;
+};
+
+struct batch_worker {
+    struct batch_flush *flush;
+};
+
+/* libco entry points do not take arguments, pass the worker through TLS */
+FLB_TLS_DEFINE(struct flb_thread, flb_batch_worker_th);
+
+void flb_output_batch_prepare()
+{
+    FLB_TLS_INIT(flb_batch_worker_th);
+}
+
+static struct flb_output_batch_part *batch_part_new(struct flb_output_batch *b,
+                                                    int *size, size_t offset)
+{
+    int new_size;
+    struct flb_output_batch_part *tmp;
+    struct flb_output_batch_part *part;
+
+    if (b->n_parts == *size) {
+        new_size = (*size == 0) ? 8 : *size * 2;
+        tmp = flb_realloc(b->parts,
+                          sizeof(struct flb_output_batch_part) * new_size);
+        if (!tmp) {
+            flb_errno();
+            return NULL;
+        }
+        b->parts = tmp;
+        *size = new_size;
+    }
+
+    part = &b->parts[b->n_parts];
+    part->offset = offset;
+    part->size = 0;
+    part->records = 0;
+    part->status = FLB_OUTPUT_BATCH_PENDING;
+    b->n_parts++;
+
+    return part;
+}
+
+/*
+ * Split the msgpack buffer in parts of up to 'max_size' bytes, always on
+ * record boundaries. A record bigger than 'max_size' gets its own part. If
+ * 'max_size' is zero, one part is generated for the whole buffer.
+ */
+int flb_output_batch_split(const void *data, size_t bytes, size_t max_size,
+                           struct flb_output_batch *batch)
+{
+    int size = 0;
+    size_t off;
+    size_t prev = 0;
+    size_t rec_size;
+    mpack_reader_t reader;
+    struct flb_output_batch_part *part = NULL;
+
+    batch->n_parts = 0;
+    batch->parts = NULL;
+
+    mpack_reader_init_data(&reader, (const char *) data, bytes);
+    while (mpack_reader_remaining(&reader, NULL) > 0) {
+        mpack_discard(&reader);
+        if (mpack_reader_error(&reader) != mpack_ok) {
+            flb_error("[batch] invalid msgpack content at offset %lu", prev);
+            mpack_reader_destroy(&reader);
+            flb_output_batch_destroy(batch);
+            return -1;
+        }
+
+        off = bytes - mpack_reader_remaining(&reader, NULL);
+        rec_size = off - prev;
+
+        if (!part || (max_size > 0 && part->records > 0 &&
+                      part->size + rec_size > max_size)) {
+            part = batch_part_new(batch, &size, prev);
+            if (!part) {
+                mpack_reader_destroy(&reader);
+                flb_output_batch_destroy(batch);
+                return -1;
+            }
+        }
+
+        part->size += rec_size;
+        part->records++;
+        prev = off;
+    }
+    mpack_reader_destroy(&reader);
+
+    return batch->n_parts;
+}
+
+void flb_output_batch_destroy(struct flb_output_batch *batch)
+{
+    if (batch->parts) {
+        flb_free(batch->parts);
+    }
+    batch->parts = NULL;
+    batch->n_parts = 0;
+}
+
+/* Get the next sub-batch that needs to be delivered */
+static int batch_next_part(struct batch_flush *flush)
+{
+    int i;
+    struct flb_output_batch *batch = flush->batch;
+
+    for (i = flush->next; i < batch->n_parts; i++) {
+        if (batch->parts[i].status == FLB_OUTPUT_BATCH_PENDING) {
+            flush->next = i + 1;
+            return i;
+        }
+    }
+
+    flush->next = batch->n_parts;
+    return -1;
+}
+
+static void batch_worker_entry(void)
+{
+    int i;
+    struct flb_thread *th;
+    struct flb_thread *parent;
+    struct batch_worker *worker;
+    struct batch_flush *flush;
+    struct flb_output_batch_part *part;
+
+    th = (struct flb_thread *) FLB_TLS_GET(flb_batch_worker_th);
+    worker = (struct batch_worker *) FLB_THREAD_DATA(th);
+    flush = worker->flush;
+
+    while ((i = batch_next_part(flush)) != -1) {
+        part = &flush->batch->parts[i];
+        part->status = flush->cb(flush->data + part->offset, part->size,
+                                 flush->cb_data);
+    }
+
+    flush->running--;
+    if (flush->running == 0 && flush->waiting == FLB_TRUE) {
+        /*
+         * We are the last worker and the parent is suspended. Resume it
+         * handing over our caller (the event loop), so when the parent
+         * yields the control goes back to the event loop and not to this
+         * co-routine, which is about to be destroyed by the parent.
+         */
+        parent = flush->parent;
+        parent->caller = th->caller;
+        pthread_setspecific(flb_thread_key, (void *) parent);
+        co_switch(parent->callee);
+    }
+    else {
+        co_switch(th->caller);
+    }
+
+    /* Never reached: the co-routine is never resumed again */
+}
+
+static struct flb_thread *batch_worker_create(struct batch_flush *flush,
+                                              struct flb_config *config)
+{
+    size_t stack_size;
+    struct flb_thread *th;
+    struct batch_worker *worker;
+
+    th = flb_thread_new(sizeof(struct batch_worker), NULL);
+    if (!th) {
+        return NULL;
+    }
+
+    worker = (struct batch_worker *) FLB_THREAD_DATA(th);
+    worker->flush = flush;
+
+    th->caller = co_active();
+    th->callee = co_create(config->coro_stack_size,
+                           batch_worker_entry, &stack_size);
+    if (!th->callee) {
+        flb_free(th);
+        return NULL;
+    }
+
+#ifdef FLB_HAVE_VALGRIND
+    th->valgrind_stack_id = VALGRIND_STACK_REGISTER(th->callee,
+                                                    ((char *)th->callee) + stack_size);
+#endif
+
+    return th;
+}
+
+/* Lookup the task route of the output instance running this flush */
+static struct flb_task_route *batch_route_get(struct flb_thread *th)
+{
+    struct mk_list *head;
+    struct flb_task_route *route;
+    struct flb_output_thread *out_th;
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    mk_list_foreach(head, &out_th->task->routes) {
+        route = mk_list_entry(head, struct flb_task_route, _head);
+        if (route->out == out_th->o_ins) {
+            return route;
+        }
+    }
+
+    return NULL;
+}
+
+/* Save or reset the delivery status of the sub-batches */
+static void batch_route_update(struct flb_task_route *route,
+                               struct flb_output_batch *batch, int ret)
+{
+    int i;
+
+    if (route->batch_done) {
+        flb_free(route->batch_done);
+        route->batch_done = NULL;
+    }
+    route->batch_parts = 0;
+
+    if (ret != FLB_RETRY) {
+        return;
+    }
+
+    route->batch_done = flb_malloc(batch->n_parts);
+    if (!route->batch_done) {
+        flb_errno();
+        return;
+    }
+    route->batch_parts = batch->n_parts;
+
+    for (i = 0; i < batch->n_parts; i++) {
+        if (batch->parts[i].status == FLB_RETRY) {
+            route->batch_done[i] = FLB_FALSE;
+        }
+        else {
+            route->batch_done[i] = FLB_TRUE;
+        }
+    }
+}
+
+/*
+ * Flush a chunk buffer in sub-batches of up to 'max_size' bytes using up to
+ * 'workers' concurrent co-routines. It must be called from an output plugin
+ * flush callback. It returns FLB_OK if every sub-batch was delivered,
+ * FLB_RETRY if some of them must be retried or FLB_ERROR otherwise.
+ */
+int flb_output_batch_flush(const void *data, size_t bytes,
+                           size_t max_size, int workers,
+                           flb_output_batch_cb cb, void *cb_data,
+                           struct flb_config *config)
+{
+    int i;
+    int ret;
+    int pending = 0;
+    int n_workers = 0;
+    struct flb_thread *th;
+    struct flb_thread **ths;
+    struct flb_task_route *route;
+    struct flb_output_batch batch;
+    struct batch_flush flush;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    route = batch_route_get(th);
+
+    /* Nothing to split and nothing pending from a previous try */
+    if ((max_size == 0 || bytes <= max_size) &&
+        (!route || route->batch_parts == 0)) {
+        return cb(data, bytes, cb_data);
+    }
+
+    ret = flb_output_batch_split(data, bytes, max_size, &batch);
+    if (ret <= 0) {
+        return FLB_ERROR;
+    }
+
+    /* Skip sub-batches delivered by a previous try */
+    if (route && route->batch_parts == batch.n_parts) {
+        for (i = 0; i < batch.n_parts; i++) {
+            if (route->batch_done[i] == FLB_TRUE) {
+                batch.parts[i].status = FLB_OK;
+            }
+        }
+    }
+
+    for (i = 0; i < batch.n_parts; i++) {
+        if (batch.parts[i].status == FLB_OUTPUT_BATCH_PENDING) {
+            pending++;
+        }
+    }
+
+    flb_debug("[batch] flushing %i/%i sub-batches (%lu bytes)",
+              pending, batch.n_parts, bytes);
+
+    flush.data = data;
+    flush.batch = &batch;
+    flush.next = 0;
+    flush.running = 0;
+    flush.waiting = FLB_FALSE;
+    flush.cb = cb;
+    flush.cb_data = cb_data;
+    flush.parent = th;
+
+    if (workers > pending) {
+        workers = pending;
+    }
+
+    if (workers <= 1) {
+        /* Serial mode: no need for extra co-routines */
+        while ((i = batch_next_part(&flush)) != -1) {
+            batch.parts[i].status = cb((char *) data + batch.parts[i].offset,
+                                       batch.parts[i].size, cb_data);
+        }
+    }
+    else {
+        ths = flb_calloc(workers, sizeof(struct flb_thread *));
+        if (!ths) {
+            flb_errno();
+            flb_output_batch_destroy(&batch);
+            return FLB_RETRY;
+        }
+
+        for (i = 0; i < workers; i++) {
+            ths[i] = batch_worker_create(&flush, config);
+            if (!ths[i]) {
+                break;
+            }
+            n_workers++;
+            flush.running++;
+
+            /* Start the worker, it returns as soon as it waits for I/O */
+            FLB_TLS_SET(flb_batch_worker_th, ths[i]);
+            flb_thread_resume(ths[i]);
+            pthread_setspecific(flb_thread_key, (void *) th);
+        }
+
+        /* Wait until the last worker finish and resume us */
+        if (flush.running > 0) {
+            flush.waiting = FLB_TRUE;
+            flb_thread_yield(th, FLB_FALSE);
+        }
+
+        for (i = 0; i < n_workers; i++) {
+            flb_thread_destroy(ths[i]);
+        }
+        flb_free(ths);
+
+        /* If no workers could be created, do the remaining work here */
+        while ((i = batch_next_part(&flush)) != -1) {
+            batch.parts[i].status = cb((char *) data + batch.parts[i].offset,
+                                       batch.parts[i].size, cb_data);
+        }
+    }
+
+    /* Compose the final status */
+    ret = FLB_OK;
+    for (i = 0; i < batch.n_parts; i++) {
+        if (batch.parts[i].status == FLB_RETRY) {
+            ret = FLB_RETRY;
+        }
+        else if (batch.parts[i].status == FLB_ERROR && ret == FLB_OK) {
+            ret = FLB_ERROR;
+        }
+    }
+
+    if (route) {
+        batch_route_update(route, &batch, ret);
+    }
+
+    flb_output_batch_destroy(&batch);
+    return ret;
+}
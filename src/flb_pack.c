@@ -30,12 +30,14 @@
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_unescape.h>
+#include <fluent-bit/flb_json_index.h>
+#include <fluent-bit/flb_bits.h>
+#include <fluent-bit/flb_utf8.h>
+#include <fluent-bit/flb_log.h>
 
 #include <msgpack.h>
 #include <jsmn/jsmn.h>
 
-#define try_to_write_str  flb_utils_write_str
-
 int flb_json_tokenise(const char *js, size_t len,
                       struct flb_pack_state *state)
 {
@@ -45,6 +47,15 @@ int flb_json_tokenise(const char *js, size_t len,
     size_t new_size;
     void *tmp;
 
+    if (!state->tokens) {
+        state->tokens = flb_calloc(new_tokens, sizeof(jsmntok_t));
+        if (!state->tokens) {
+            flb_errno();
+            return -1;
+        }
+        state->tokens_size = new_tokens;
+    }
+
     ret = jsmn_parse(&state->parser, js, len,
                      state->tokens, state->tokens_size);
     while (ret == JSMN_ERROR_NOMEM) {
@@ -80,134 +91,6 @@ int flb_json_tokenise(const char *js, size_t len,
     return 0;
 }
 
-static inline int is_float(const char *buf, int len)
-{
-    const char *end = buf + len;
-    const char *p = buf;
-
-    while (p <= end) {
-        if (*p == '.') {
-            return 1;
-        }
-        p++;
-    }
-    return 0;
-}
-
-/* Sanitize incoming JSON string */
-static inline int pack_string_token(struct flb_pack_state *state,
-                                    const char *str, int len,
-                                    msgpack_packer *pck)
-{
-    int s;
-    int out_len;
-    char *tmp;
-    char *out_buf;
-
-    if (state->buf_size < len + 1) {
-        s = len + 1;
-        tmp = flb_realloc(state->buf_data, s);
-        if (!tmp) {
-            flb_errno();
-            return -1;
-        }
-        else {
-            state->buf_data = tmp;
-            state->buf_size = s;
-        }
-    }
-    out_buf = state->buf_data;
-
-    /* Always decode any UTF-8 or special characters */
-    out_len = flb_unescape_string_utf8(str, len, out_buf);
-
-    /* Pack decoded text */
-    msgpack_pack_str(pck, out_len);
-    msgpack_pack_str_body(pck, out_buf, out_len);
-
-    return out_len;
-}
-
-/* Receive a tokenized JSON message and convert it to MsgPack */
-static char *tokens_to_msgpack(struct flb_pack_state *state,
-                               const char *js,
-                               int *out_size, int *last_byte)
-{
-    int i;
-    int flen;
-    int arr_size;
-    const char *p;
-    char *buf;
-    const jsmntok_t *t;
-    msgpack_packer pck;
-    msgpack_sbuffer sbuf;
-    jsmntok_t *tokens;
-
-    tokens = state->tokens;
-    arr_size = state->tokens_count;
-
-    if (arr_size == 0) {
-        return NULL;
-    }
-
-    /* initialize buffers */
-    msgpack_sbuffer_init(&sbuf);
-    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
-
-    for (i = 0; i < arr_size ; i++) {
-        t = &tokens[i];
-
-        if (t->start == -1 || t->end == -1 || (t->start == 0 && t->end == 0)) {
-            break;
-        }
-
-        if (t->parent == -1) {
-            *last_byte = t->end;
-        }
-
-        flen = (t->end - t->start);
-        switch (t->type) {
-        case JSMN_OBJECT:
-            msgpack_pack_map(&pck, t->size);
-            break;
-        case JSMN_ARRAY:
-            msgpack_pack_array(&pck, t->size);
-            break;
-        case JSMN_STRING:
-            pack_string_token(state, js + t->start, flen, &pck);
-            break;
-        case JSMN_PRIMITIVE:
-            p = js + t->start;
-            if (*p == 'f') {
-                msgpack_pack_false(&pck);
-            }
-            else if (*p == 't') {
-                msgpack_pack_true(&pck);
-            }
-            else if (*p == 'n') {
-                msgpack_pack_nil(&pck);
-            }
-            else {
-                if (is_float(p, flen)) {
-                    msgpack_pack_double(&pck, atof(p));
-                }
-                else {
-                    msgpack_pack_int64(&pck, atol(p));
-                }
-            }
-            break;
-        case JSMN_UNDEFINED:
-            msgpack_sbuffer_destroy(&sbuf);
-            return NULL;
-        }
-    }
-
-    *out_size = sbuf.size;
-    buf = sbuf.data;
-
-    return buf;
-}
-
 /*
  * It parse a JSON string and convert it to MessagePack format, this packer is
  * useful when a complete JSON message exists, otherwise it will fail until
@@ -220,9 +103,8 @@ int flb_pack_json(const char *js, size_t len, char **buffer, size_t *size,
                   int *root_type)
 
 {
-    int ret = -1;
+    int ret;
     int out;
-    int last;
     char *buf = NULL;
     struct flb_pack_state state;
 
@@ -230,61 +112,26 @@ int flb_pack_json(const char *js, size_t len, char **buffer, size_t *size,
     if (ret != 0) {
         return -1;
     }
-    ret = flb_json_tokenise(js, len, &state);
-    if (ret != 0) {
-        ret = -1;
-        goto flb_pack_json_end;
-    }
 
-    if (state.tokens_count == 0) {
-        ret = -1;
-        goto flb_pack_json_end;
-    }
-
-    buf = tokens_to_msgpack(&state, js, &out, &last);
-    if (!buf) {
-        ret = -1;
-        goto flb_pack_json_end;
+    ret = flb_json_index_pack(&state, js, len, FLB_FALSE,
+                              &buf, &out, root_type);
+    flb_pack_state_reset(&state);
+    if (ret != 0) {
+        return -1;
     }
 
-    *root_type = state.tokens[0].type;
     *size = out;
     *buffer = buf;
-
-    ret = 0;
-
- flb_pack_json_end:
-    flb_pack_state_reset(&state);
-    return ret;
+    return 0;
 }
 
 /* Initialize a JSON packer state */
 int flb_pack_state_init(struct flb_pack_state *s)
 {
-    int tokens = 256;
-    size_t size = 256;
-
+    /* buffers are allocated on demand */
+    memset(s, '\0', sizeof(struct flb_pack_state));
     jsmn_init(&s->parser);
-
-    size = sizeof(jsmntok_t) * tokens;
-    s->tokens = flb_calloc(1, size);
-    if (!s->tokens) {
-        flb_errno();
-        return -1;
-    }
-    s->tokens_size   = tokens;
-    s->tokens_count  = 0;
-    s->last_byte     = 0;
-    s->multiple      = FLB_FALSE;
-
-    s->buf_data = flb_malloc(size);
-    if (!s->buf_data) {
-        flb_errno();
-        flb_free(s->tokens);
-        return -1;
-    }
-    s->buf_size = size;
-    s->buf_len = 0;
+    s->multiple = FLB_FALSE;
 
     return 0;
 }
@@ -292,11 +139,11 @@ int flb_pack_state_init(struct flb_pack_state *s)
 void flb_pack_state_reset(struct flb_pack_state *s)
 {
     flb_free(s->tokens);
-    s->tokens_size  = 0;
-    s->tokens_count = 0;
-    s->last_byte    = 0;
-    s->buf_size     = 0;
     flb_free(s->buf_data);
+    flb_free(s->index);
+    flb_free(s->sizes);
+    flb_free(s->stack);
+    memset(s, '\0', sizeof(struct flb_pack_state));
 }
 
 
@@ -310,68 +157,9 @@ int flb_pack_json_state(const char *js, size_t len,
                         char **buffer, int *size,
                         struct flb_pack_state *state)
 {
-    int ret;
-    int out;
-    int delim = 0;
-    int last =  0;
-    char *buf;
-    jsmntok_t *t;
-
-    ret = flb_json_tokenise(js, len, state);
     state->multiple = FLB_TRUE;
-    if (ret == FLB_ERR_JSON_PART && state->multiple == FLB_TRUE) {
-        /*
-         * If the caller enabled 'multiple' flag, it means that the incoming
-         * JSON message may have multiple messages concatenated and likely
-         * the last one is only incomplete.
-         *
-         * The following routine aims to determinate how many JSON messages
-         * are OK in the array of tokens, if any, process them and adjust
-         * the JSMN context/buffers.
-         */
-        int i;
-        int found = 0;
-
-        for (i = 1; i < state->tokens_size; i++) {
-            t = &state->tokens[i];
-
-            if (t->start < (state->tokens[i - 1]).start) {
-                break;
-            }
-
-            if (t->parent == -1 && (t->end != 0)) {
-                found++;
-                delim = i;
-            }
-
-        }
-
-        if (found > 0) {
-            state->tokens_count += delim;
-        }
-        else {
-            return ret;
-        }
-    }
-    else if (ret != 0) {
-        return ret;
-    }
-
-    if (state->tokens_count == 0) {
-        state->last_byte = last;
-        return FLB_ERR_JSON_INVAL;
-    }
-
-    buf = tokens_to_msgpack(state, js, &out, &last);
-    if (!buf) {
-        return -1;
-    }
-
-    *size = out;
-    *buffer = buf;
-    state->last_byte = last;
-
-    return 0;
+    return flb_json_index_pack(state, js, len, FLB_TRUE,
+                               buffer, size, NULL);
 }
 
 static int pack_print_fluent_record(size_t cnt, msgpack_unpacked result)
@@ -428,159 +216,378 @@ void flb_pack_print(const char *data, size_t bytes)
 }
 
 
-static inline int try_to_write(char *buf, int *off, size_t left,
-                               const char *str, size_t str_len)
+/*
+ * MessagePack to JSON
+ * -------------------
+ * The encoder appends to a sds buffer that grows geometrically, so every
+ * object is converted in a single pass. The output is the same produced
+ * by flb_utils_write_str() for strings: the escaping rules and the
+ * handling of invalid or truncated UTF-8 sequences must not change, since
+ * every JSON based output depends on it.
+ */
+
+/* Make room for 'size' more bytes */
+static inline int json_reserve(flb_sds_t *buf, size_t size)
+{
+    size_t grow;
+    flb_sds_t tmp;
+
+    if (flb_sds_avail(*buf) >= size) {
+        return FLB_TRUE;
+    }
+
+    grow = flb_sds_alloc(*buf);
+    if (grow < size) {
+        grow = size;
+    }
+
+    tmp = flb_sds_increase(*buf, grow);
+    if (!tmp) {
+        return FLB_FALSE;
+    }
+    *buf = tmp;
+    return FLB_TRUE;
+}
+
+static inline int json_write(flb_sds_t *buf, const char *str, size_t len)
+{
+    struct flb_sds *head;
+
+    if (!json_reserve(buf, len)) {
+        return FLB_FALSE;
+    }
+
+    head = FLB_SDS_HEADER(*buf);
+    memcpy(*buf + head->len, str, len);
+    head->len += len;
+    return FLB_TRUE;
+}
+
+static inline int json_write_char(flb_sds_t *buf, char c)
+{
+    struct flb_sds *head;
+
+    if (!json_reserve(buf, 1)) {
+        return FLB_FALSE;
+    }
+
+    head = FLB_SDS_HEADER(*buf);
+    (*buf)[head->len++] = c;
+    return FLB_TRUE;
+}
+
+static int json_write_ulong(flb_sds_t *buf, unsigned long val)
+{
+    char tmp[32];
+    char *p = tmp + sizeof(tmp);
+
+    do {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+
+    return json_write(buf, p, (tmp + sizeof(tmp)) - p);
+}
+
+static int json_write_double(flb_sds_t *buf, double val)
+{
+    int len;
+    char tmp[512];
+
+    len = snprintf(tmp, sizeof(tmp), "%f", val);
+    if (len < 0 || len >= sizeof(tmp)) {
+        return FLB_FALSE;
+    }
+    return json_write(buf, tmp, len);
+}
+
+/* \uXXXX with at least four lowercase hex digits */
+static int json_write_unicode(flb_sds_t *buf, uint32_t cp)
+{
+    int i;
+    int digits = 4;
+    char tmp[16];
+    static const char hex[] = "0123456789abcdef";
+
+    while (digits < 8 && (cp >> (digits * 4)) != 0) {
+        digits++;
+    }
+
+    tmp[0] = '\\';
+    tmp[1] = 'u';
+    for (i = 0; i < digits; i++) {
+        tmp[2 + i] = hex[(cp >> ((digits - 1 - i) * 4)) & 0xf];
+    }
+    return json_write(buf, tmp, 2 + digits);
+}
+
+#if defined(FLB_HAVE_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define PACK_JSON_SSE2
+#include <emmintrin.h>
+#endif
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGH  0x8080808080808080ULL
+#define SWAR_ZERO(v)  (((v) - SWAR_ONES) & ~(v) & SWAR_HIGH)
+
+/*
+ * Length of the leading run of 'str' that can be copied as is: no control
+ * characters, quotes, backslashes, DEL or multi-byte characters.
+ */
+static inline size_t json_str_clean(const char *str, size_t len)
 {
-    if (str_len <= 0){
-        str_len = strlen(str);
+    size_t i = 0;
+    uint64_t v;
+    unsigned char c;
+#ifdef PACK_JSON_SSE2
+    int mask;
+    __m128i in;
+    __m128i m;
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7f);
+
+    /* signed compare: bytes >= 0x80 are lower than a space too */
+    for (; i + 16 <= len; i += 16) {
+        in = _mm_loadu_si128((const __m128i *) (str + i));
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(in, quote),
+                                      _mm_cmpeq_epi8(in, backslash)),
+                         _mm_or_si128(_mm_cmplt_epi8(in, space),
+                                      _mm_cmpeq_epi8(in, del)));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + flb_bits_ctz64(mask);
+        }
+    }
+#endif
+
+    /* eight bytes at a time, the exact position is resolved below */
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&v, str + i, 8);
+        if ((v & SWAR_HIGH) ||
+            SWAR_ZERO(v & ~(SWAR_ONES * 0x1f)) ||
+            SWAR_ZERO(v ^ (SWAR_ONES * '"')) ||
+            SWAR_ZERO(v ^ (SWAR_ONES * '\\')) ||
+            SWAR_ZERO(v ^ (SWAR_ONES * 0x7f))) {
+            break;
+        }
+    }
+
+    for (; i < len; i++) {
+        c = str[i];
+        if (c < 32 || c == '"' || c == '\\' || c >= 0x7f) {
+            break;
+        }
     }
-    if (left <= *off+str_len) {
+    return i;
+}
+
+static int json_write_str(flb_sds_t *buf, const char *str, size_t len)
+{
+    int b;
+    int hex_bytes;
+    size_t i = 0;
+    size_t run;
+    uint32_t state;
+    uint32_t cp;
+    unsigned char c;
+    char *esc;
+
+    /* most strings do not need any escaping */
+    if (!json_reserve(buf, len + 2)) {
         return FLB_FALSE;
     }
-    memcpy(buf+*off, str, str_len);
-    *off += str_len;
+
+    while (i < len) {
+        run = json_str_clean(str + i, len - i);
+        if (run > 0) {
+            if (!json_write(buf, str + i, run)) {
+                return FLB_FALSE;
+            }
+            i += run;
+            if (i == len) {
+                break;
+            }
+        }
+
+        c = str[i];
+        esc = NULL;
+        switch (c) {
+        case '"':
+            esc = "\\\"";
+            break;
+        case '\\':
+            esc = "\\\\";
+            break;
+        case '\n':
+            esc = "\\n";
+            break;
+        case '\r':
+            esc = "\\r";
+            break;
+        case '\t':
+            esc = "\\t";
+            break;
+        case '\b':
+            esc = "\\b";
+            break;
+        case '\f':
+            esc = "\\f";
+            break;
+        }
+
+        if (esc) {
+            if (!json_write(buf, esc, 2)) {
+                return FLB_FALSE;
+            }
+            i++;
+            continue;
+        }
+
+        if (c < 0x80) {
+            /* other control characters and DEL */
+            if (!json_write_unicode(buf, c)) {
+                return FLB_FALSE;
+            }
+            i++;
+            continue;
+        }
+
+        /* multi-byte character, the rest of the string is dropped if invalid */
+        hex_bytes = flb_utf8_len(str + i);
+        if (i + hex_bytes > len) {
+            break;
+        }
+
+        state = FLB_UTF8_ACCEPT;
+        cp = 0;
+        for (b = 0; b < hex_bytes; b++) {
+            if (flb_utf8_decode(&state, &cp, (uint8_t) str[i + b]) == 0) {
+                break;
+            }
+        }
+        if (state != FLB_UTF8_ACCEPT) {
+            flb_warn("[pack] invalid UTF-8 bytes, skipping");
+            break;
+        }
+
+        if (!json_write_unicode(buf, cp)) {
+            return FLB_FALSE;
+        }
+        i += hex_bytes;
+    }
+
     return FLB_TRUE;
 }
 
-static int msgpack2json(char *buf, int *off, size_t left,
-                        const msgpack_object *o)
+static int msgpack2json(flb_sds_t *buf, const msgpack_object *o)
 {
-    int ret = FLB_FALSE;
     int i;
-    int loop;
+    int len;
+    char temp[32];
+    msgpack_object *p;
+    msgpack_object_kv *kv;
 
     switch(o->type) {
     case MSGPACK_OBJECT_NIL:
-        ret = try_to_write(buf, off, left, "null", 4);
-        break;
+        return json_write(buf, "null", 4);
 
     case MSGPACK_OBJECT_BOOLEAN:
-        ret = try_to_write(buf, off, left,
-                           (o->via.boolean ? "true":"false"),0);
-
-        break;
+        if (o->via.boolean) {
+            return json_write(buf, "true", 4);
+        }
+        return json_write(buf, "false", 5);
 
     case MSGPACK_OBJECT_POSITIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%lu", (unsigned long)o->via.u64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        return json_write_ulong(buf, (unsigned long) o->via.u64);
 
     case MSGPACK_OBJECT_NEGATIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%ld", (signed long)o->via.i64);
-            ret = try_to_write(buf, off, left, temp, i);
+        if ((signed long) o->via.i64 >= 0) {
+            return json_write_ulong(buf, (signed long) o->via.i64);
         }
-        break;
+        return json_write_char(buf, '-') &&
+               json_write_ulong(buf,
+                                -(unsigned long) (signed long) o->via.i64);
+
     case MSGPACK_OBJECT_FLOAT32:
     case MSGPACK_OBJECT_FLOAT64:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%f", o->via.f64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        return json_write_double(buf, o->via.f64);
 
     case MSGPACK_OBJECT_STR:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.str.size > 0 ?
-             try_to_write_str(buf, off, left, o->via.str.ptr, o->via.str.size)
-             : 1/* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
-        }
-        break;
+        return json_write_char(buf, '"') &&
+               json_write_str(buf, o->via.str.ptr, o->via.str.size) &&
+               json_write_char(buf, '"');
 
     case MSGPACK_OBJECT_BIN:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.bin.size > 0 ?
-             try_to_write_str(buf, off, left, o->via.bin.ptr, o->via.bin.size)
-              : 1 /* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
-        }
-        break;
+        return json_write_char(buf, '"') &&
+               json_write_str(buf, o->via.bin.ptr, o->via.bin.size) &&
+               json_write_char(buf, '"');
 
     case MSGPACK_OBJECT_EXT:
-        if (!try_to_write(buf, off, left, "\"", 1)) {
-            goto msg2json_end;
-        }
         /* ext body. fortmat is similar to printf(1) */
-        {
-            char temp[32] = {0};
-            int  len;
-            loop = o->via.ext.size;
-            for(i=0; i<loop; i++) {
-                len = snprintf(temp, sizeof(temp)-1, "\\x%02x", (char)o->via.ext.ptr[i]);
-                if (!try_to_write(buf, off, left, temp, len)) {
-                    goto msg2json_end;
-                }
+        if (!json_write_char(buf, '"')) {
+            return FLB_FALSE;
+        }
+        for (i = 0; i < o->via.ext.size; i++) {
+            len = snprintf(temp, sizeof(temp) - 1, "\\x%02x",
+                           (char) o->via.ext.ptr[i]);
+            if (!json_write(buf, temp, len)) {
+                return FLB_FALSE;
             }
         }
-        if (!try_to_write(buf, off, left, "\"", 1)) {
-            goto msg2json_end;
-        }
-        ret = FLB_TRUE;
-        break;
+        return json_write_char(buf, '"');
 
     case MSGPACK_OBJECT_ARRAY:
-        loop = o->via.array.size;
-
-        if (!try_to_write(buf, off, left, "[", 1)) {
-            goto msg2json_end;
-        }
-        if (loop != 0) {
-            msgpack_object* p = o->via.array.ptr;
-            if (!msgpack2json(buf, off, left, p)) {
-                goto msg2json_end;
-            }
-            for (i=1; i<loop; i++) {
-                if (!try_to_write(buf, off, left, ",", 1) ||
-                    !msgpack2json(buf, off, left, p+i)) {
-                    goto msg2json_end;
-                }
+        if (!json_write_char(buf, '[')) {
+            return FLB_FALSE;
+        }
+        p = o->via.array.ptr;
+        for (i = 0; i < o->via.array.size; i++) {
+            if ((i > 0 && !json_write_char(buf, ',')) ||
+                !msgpack2json(buf, p + i)) {
+                return FLB_FALSE;
             }
         }
-
-        ret = try_to_write(buf, off, left, "]", 1);
-        break;
+        return json_write_char(buf, ']');
 
     case MSGPACK_OBJECT_MAP:
-        loop = o->via.map.size;
-        if (!try_to_write(buf, off, left, "{", 1)) {
-            goto msg2json_end;
-        }
-        if (loop != 0) {
-            msgpack_object_kv *p = o->via.map.ptr;
-            if (!msgpack2json(buf, off, left, &p->key) ||
-                !try_to_write(buf, off, left, ":", 1)  ||
-                !msgpack2json(buf, off, left, &p->val)) {
-                goto msg2json_end;
-            }
-            for (i = 1; i < loop; i++) {
-                if (
-                    !try_to_write(buf, off, left, ",", 1) ||
-                    !msgpack2json(buf, off, left, &(p+i)->key) ||
-                    !try_to_write(buf, off, left, ":", 1)  ||
-                    !msgpack2json(buf, off, left, &(p+i)->val) ) {
-                    goto msg2json_end;
-
-                }
+        if (!json_write_char(buf, '{')) {
+            return FLB_FALSE;
+        }
+        kv = o->via.map.ptr;
+        for (i = 0; i < o->via.map.size; i++) {
+            if ((i > 0 && !json_write_char(buf, ',')) ||
+                !msgpack2json(buf, &kv[i].key) ||
+                !json_write_char(buf, ':') ||
+                !msgpack2json(buf, &kv[i].val)) {
+                return FLB_FALSE;
             }
         }
-
-        ret = try_to_write(buf, off, left, "}", 1);
-        break;
+        return json_write_char(buf, '}');
 
     default:
         flb_warn("[%s] unknown msgpack type %i", __FUNCTION__, o->type);
     }
 
- msg2json_end:
-    return ret;
+    return FLB_FALSE;
+}
+
+/*
+ * Append the JSON representation of 'obj' to the sds buffer 'json', which
+ * may be reallocated. Returns 0 on success or -1 on error, in which case
+ * the buffer is still valid but its content is undefined.
+ */
+int flb_msgpack_to_json_sds(flb_sds_t *json, const msgpack_object *obj)
+{
+    int ret;
+
+    ret = msgpack2json(json, obj);
+
+    /* sds buffers always have room for the NULL byte */
+    (*json)[flb_sds_len(*json)] = '\0';
+
+    return ret ? 0 : -1;
 }
 
 /**
@@ -595,30 +602,40 @@ static int msgpack2json(char *buf, int *off, size_t left,
 int flb_msgpack_to_json(char *json_str, size_t json_size,
                         const msgpack_object *obj)
 {
-    int ret = -1;
-    int off = 0;
+    int ret;
+    size_t len;
+    flb_sds_t out;
+
+    if (json_str == NULL || obj == NULL || json_size == 0) {
+        return -1;
+    }
+
+    out = flb_sds_create_size(json_size);
+    if (!out) {
+        return -1;
+    }
 
-    if (json_str == NULL || obj == NULL) {
+    ret = flb_msgpack_to_json_sds(&out, obj);
+    len = flb_sds_len(out);
+    if (ret == -1 || len + 1 >= json_size) {
+        json_str[0] = '\0';
+        flb_sds_destroy(out);
         return -1;
     }
 
-    ret = msgpack2json(json_str, &off, json_size - 1, obj);
-    json_str[off] = '\0';
-    return ret ? off: ret;
+    memcpy(json_str, out, len + 1);
+    flb_sds_destroy(out);
+    return len;
 }
 
 flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size)
 {
     int ret;
     size_t off = 0;
-    size_t out_size;
     msgpack_unpacked result;
-    msgpack_object *root;
     flb_sds_t out_buf;
-    flb_sds_t tmp_buf;
 
-    out_size = in_size * 1.5;
-    out_buf = flb_sds_create_size(out_size);
+    out_buf = flb_sds_create_size(in_size * 1.5);
     if (!out_buf) {
         flb_errno();
         return NULL;
@@ -626,30 +643,14 @@ flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size)
 
     msgpack_unpacked_init(&result);
     msgpack_unpack_next(&result, in_buf, in_size, &off);
-    root = &result.data;
-
-    while (1) {
-        ret = flb_msgpack_to_json(out_buf, out_size, root);
-        if (ret <= 0) {
-            tmp_buf = flb_sds_increase(out_buf, 256);
-            if (tmp_buf) {
-                out_buf = tmp_buf;
-                out_size += 256;
-            }
-            else {
-                flb_errno();
-                flb_sds_destroy(out_buf);
-                msgpack_unpacked_destroy(&result);
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
-    }
 
+    ret = flb_msgpack_to_json_sds(&out_buf, &result.data);
     msgpack_unpacked_destroy(&result);
-    flb_sds_len_set(out_buf, ret);
+
+    if (ret == -1) {
+        flb_sds_destroy(out_buf);
+        return NULL;
+    }
 
     return out_buf;
 }
@@ -703,15 +704,15 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
     int ok = MSGPACK_UNPACK_SUCCESS;
     int records = 0;
     int map_size;
+    int ok_json;
     size_t off = 0;
     char time_formatted[32];
     size_t s;
-    flb_sds_t out_tmp;
-    flb_sds_t out_js;
     flb_sds_t out_buf = NULL;
     msgpack_unpacked result;
     msgpack_object root;
     msgpack_object map;
+    msgpack_object date;
     msgpack_sbuffer tmp_sbuf;
     msgpack_packer tmp_pck;
     msgpack_object *obj;
@@ -770,16 +771,13 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
         /* Get the record/map */
         map = root.via.array.ptr[1];
         map_size = map.via.map.size;
-        msgpack_pack_map(&tmp_pck, map_size + 1);
 
-        /* Append date key */
-        msgpack_pack_str(&tmp_pck, flb_sds_len(date_key));
-        msgpack_pack_str_body(&tmp_pck, date_key, flb_sds_len(date_key));
-
-        /* Append date value */
+        /* Date value */
+        date.type = MSGPACK_OBJECT_NIL;
         switch (date_format) {
         case FLB_PACK_JSON_DATE_DOUBLE:
-            msgpack_pack_double(&tmp_pck, flb_time_to_double(&tms));
+            date.type = MSGPACK_OBJECT_FLOAT64;
+            date.via.f64 = flb_time_to_double(&tms);
             break;
         case FLB_PACK_JSON_DATE_ISO8601:
             /* Format the time, use microsecond precision not nanoseconds */
@@ -792,28 +790,33 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
                            ".%06" PRIu64 "Z",
                            (uint64_t) tms.tm.tv_nsec / 1000);
             s += len;
-            msgpack_pack_str(&tmp_pck, s);
-            msgpack_pack_str_body(&tmp_pck, time_formatted, s);
+            date.type = MSGPACK_OBJECT_STR;
+            date.via.str.ptr = time_formatted;
+            date.via.str.size = s;
             break;
         case FLB_PACK_JSON_DATE_EPOCH:
-            msgpack_pack_uint64(&tmp_pck, (long long unsigned)(tms.tm.tv_sec));
+            date.type = MSGPACK_OBJECT_POSITIVE_INTEGER;
+            date.via.u64 = (long long unsigned)(tms.tm.tv_sec);
             break;
         }
 
-        /* Append remaining keys/values */
-        for (i = 0; i < map_size; i++) {
-            msgpack_object *k = &map.via.map.ptr[i].key;
-            msgpack_object *v = &map.via.map.ptr[i].val;
-
-            msgpack_pack_object(&tmp_pck, *k);
-            msgpack_pack_object(&tmp_pck, *v);
-        }
-
         /*
-         * If the format is the original msgpack style, just continue since
-         * we don't care about separator or JSON convertion at this point.
+         * The original msgpack style of one big array is converted at once
+         * at the end, just compose the record with the date key.
          */
         if (json_format == FLB_PACK_JSON_FORMAT_JSON) {
+            msgpack_pack_map(&tmp_pck, map_size + 1);
+            msgpack_pack_str(&tmp_pck, flb_sds_len(date_key));
+            msgpack_pack_str_body(&tmp_pck, date_key, flb_sds_len(date_key));
+            msgpack_pack_object(&tmp_pck, date);
+
+            for (i = 0; i < map_size; i++) {
+                msgpack_object *k = &map.via.map.ptr[i].key;
+                msgpack_object *v = &map.via.map.ptr[i].val;
+
+                msgpack_pack_object(&tmp_pck, *k);
+                msgpack_pack_object(&tmp_pck, *v);
+            }
             continue;
         }
 
@@ -830,51 +833,36 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
          * FLB_PACK_JSON_FORMAT_STREAM: no separators, e.g:
          *
          *     {'ts':abc,'k1':1}{'ts':abc,'k1':2}{N}
+         *
+         * Records are encoded straight into the outgoing buffer.
          */
-        if (json_format == FLB_PACK_JSON_FORMAT_LINES ||
-            json_format == FLB_PACK_JSON_FORMAT_STREAM) {
-
-            /* Encode current record into JSON in a temporal variable */
-            out_js = flb_msgpack_raw_to_json_sds(tmp_sbuf.data, tmp_sbuf.size);
-            if (!out_js) {
-                msgpack_sbuffer_destroy(&tmp_sbuf);
-                flb_sds_destroy(out_buf);
-                return NULL;
-            }
+        ok_json = json_write_char(&out_buf, '{') &&
+                  json_write_char(&out_buf, '"') &&
+                  json_write_str(&out_buf, date_key, flb_sds_len(date_key)) &&
+                  json_write(&out_buf, "\":", 2) &&
+                  msgpack2json(&out_buf, &date);
 
-            /*
-             * One map record has been converted, now append it to the
-             * outgoing out_buf sds variable.
-             */
-            out_tmp = flb_sds_cat(out_buf, out_js, flb_sds_len(out_js));
-            if (!out_tmp) {
-                msgpack_sbuffer_destroy(&tmp_sbuf);
-                flb_sds_destroy(out_js);
-                flb_sds_destroy(out_buf);
-                return NULL;
-            }
+        for (i = 0; ok_json && i < map_size; i++) {
+            ok_json = json_write_char(&out_buf, ',') &&
+                      msgpack2json(&out_buf, &map.via.map.ptr[i].key) &&
+                      json_write_char(&out_buf, ':') &&
+                      msgpack2json(&out_buf, &map.via.map.ptr[i].val);
+        }
 
-            /* Release temporal json sds buffer */
-            flb_sds_destroy(out_js);
+        if (ok_json) {
+            ok_json = json_write_char(&out_buf, '}');
+        }
 
-            /* If a realloc happened, check the returned address */
-            if (out_tmp != out_buf) {
-                out_buf = out_tmp;
-            }
+        /* Append the breakline only for json lines mode */
+        if (ok_json && json_format == FLB_PACK_JSON_FORMAT_LINES) {
+            ok_json = json_write_char(&out_buf, '\n');
+        }
 
-            /* Append the breakline only for json lines mode */
-            if (json_format == FLB_PACK_JSON_FORMAT_LINES) {
-                out_tmp = flb_sds_cat(out_buf, "\n", 1);
-                if (!out_tmp) {
-                    msgpack_sbuffer_destroy(&tmp_sbuf);
-                    flb_sds_destroy(out_buf);
-                    return NULL;
-                }
-                if (out_tmp != out_buf) {
-                    out_buf = out_tmp;
-                }
-            }
-            msgpack_sbuffer_clear(&tmp_sbuf);
+        if (!ok_json) {
+            msgpack_unpacked_destroy(&result);
+            msgpack_sbuffer_destroy(&tmp_sbuf);
+            flb_sds_destroy(out_buf);
+            return NULL;
         }
     }
 
@@ -892,6 +880,7 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
     }
     else {
         msgpack_sbuffer_destroy(&tmp_sbuf);
+        out_buf[flb_sds_len(out_buf)] = '\0';
     }
 
     return out_buf;
@@ -907,8 +896,8 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
 char *flb_msgpack_to_json_str(size_t size, const msgpack_object *obj)
 {
     int ret;
-    char *buf = NULL;
-    char *tmp;
+    char *buf;
+    flb_sds_t out;
 
     if (obj == NULL) {
         return NULL;
@@ -918,31 +907,26 @@ char *flb_msgpack_to_json_str(size_t size, const msgpack_object *obj)
         size = 128;
     }
 
-    buf = flb_malloc(size);
-    if (!buf) {
+    out = flb_sds_create_size(size);
+    if (!out) {
         flb_errno();
         return NULL;
     }
 
-    while (1) {
-        ret = flb_msgpack_to_json(buf, size, obj);
-        if (ret <= 0) {
-            /* buffer is small. retry.*/
-            size += 128;
-            tmp = flb_realloc(buf, size);
-            if (tmp) {
-                buf = tmp;
-            }
-            else {
-                flb_free(buf);
-                flb_errno();
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
+    ret = flb_msgpack_to_json_sds(&out, obj);
+    if (ret == -1) {
+        flb_sds_destroy(out);
+        return NULL;
+    }
+
+    buf = flb_malloc(flb_sds_len(out) + 1);
+    if (!buf) {
+        flb_errno();
+        flb_sds_destroy(out);
+        return NULL;
     }
+    memcpy(buf, out, flb_sds_len(out) + 1);
+    flb_sds_destroy(out);
 
     return buf;
 }
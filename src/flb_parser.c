@@ -29,11 +29,13 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_strptime.h>
+#include <fluent-bit/flb_number.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <string.h>
+#include <pthread.h>
 
 static inline uint32_t digits10(uint64_t v) {
     if (v < 10) return 1;
@@ -87,6 +89,14 @@ int flb_parser_regex_do(struct flb_parser *parser,
                         const char *buf, size_t length,
                         void **out_buf, size_t *out_size,
                         struct flb_time *out_time);
+int flb_parser_regex_fields_create(struct flb_parser *parser);
+void flb_parser_regex_fields_destroy(struct flb_parser *parser);
+
+int flb_parser_native_create(struct flb_parser *parser, const char *name);
+int flb_parser_native_do(struct flb_parser *parser,
+                         const char *buf, size_t length,
+                         void **out_buf, size_t *out_size,
+                         struct flb_time *out_time);
 
 int flb_parser_json_do(struct flb_parser *parser,
                        const char *buf, size_t length,
@@ -103,6 +113,341 @@ int flb_parser_logfmt_do(struct flb_parser *parser,
                          void **out_buf, size_t *out_size,
                          struct flb_time *out_time);
 
+/*
+ * Specialised time parsers
+ * ------------------------
+ * Most parsers use one of a few well known time formats. For those, the
+ * seconds prefix is parsed here instead of strptime(3). They only accept
+ * the strict canonical form of each field (fixed width digits, valid
+ * calendar dates, English month names) and return NULL for anything
+ * else, so the caller can fall back to strptime(3) and get the exact
+ * same result, including its error handling.
+ */
+#define FLB_PARSER_TIME_GENERIC     0
+#define FLB_PARSER_TIME_ISO8601     1   /* %Y-%m-%dT%H:%M:%S     */
+#define FLB_PARSER_TIME_ISO8601_SP  2   /* %Y-%m-%d %H:%M:%S     */
+#define FLB_PARSER_TIME_APACHE      3   /* %d/%b/%Y:%H:%M:%S     */
+#define FLB_PARSER_TIME_SYSLOG      4   /* %Y %b %d %H:%M:%S     */
+
+#define FLB_PARSER_TZ_UNKNOWN      -1   /* use strptime(3)       */
+#define FLB_PARSER_TZ_NONE          0   /* nothing to parse      */
+#define FLB_PARSER_TZ_UTC           1   /* literal 'Z'           */
+#define FLB_PARSER_TZ_OFFSET        2   /* %z                    */
+#define FLB_PARSER_TZ_SPACE_OFFSET  3   /* ' ' followed by %z    */
+
+static const char *time_months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const int time_mdays[2][12] = {
+    {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
+    {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31}
+};
+
+static const int time_ydays[2][12] = {
+    {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334},
+    {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335}
+};
+
+static int time_tz_kind(const char *fmt)
+{
+    if (*fmt == '\0') {
+        return FLB_PARSER_TZ_NONE;
+    }
+    else if (strcmp(fmt, "Z") == 0) {
+        return FLB_PARSER_TZ_UTC;
+    }
+    else if (strcmp(fmt, "%z") == 0) {
+        return FLB_PARSER_TZ_OFFSET;
+    }
+    else if (strcmp(fmt, " %z") == 0) {
+        return FLB_PARSER_TZ_SPACE_OFFSET;
+    }
+    return FLB_PARSER_TZ_UNKNOWN;
+}
+
+/* Lookup a specialised parser for the format given to strptime(3) */
+static void time_fast_detect(struct flb_parser *p)
+{
+    int i;
+    int len;
+    char *fmt;
+    struct {
+        char *prefix;
+        int type;
+    } formats[] = {
+        {"%Y-%m-%dT%H:%M:%S", FLB_PARSER_TIME_ISO8601},
+        {"%Y-%m-%d %H:%M:%S", FLB_PARSER_TIME_ISO8601_SP},
+        {"%d/%b/%Y:%H:%M:%S", FLB_PARSER_TIME_APACHE},
+        {"%Y %b %d %H:%M:%S", FLB_PARSER_TIME_SYSLOG},
+    };
+
+    p->time_fast = FLB_PARSER_TIME_GENERIC;
+    p->time_fast_tz = FLB_PARSER_TZ_UNKNOWN;
+    p->time_frac_tz = FLB_PARSER_TZ_UNKNOWN;
+
+    if (p->time_with_year == FLB_TRUE) {
+        fmt = p->time_fmt;
+    }
+    else {
+        fmt = p->time_fmt_year;
+    }
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        len = strlen(formats[i].prefix);
+        if (strncmp(fmt, formats[i].prefix, len) != 0) {
+            continue;
+        }
+
+        p->time_fast_tz = time_tz_kind(fmt + len);
+        if (p->time_fast_tz != FLB_PARSER_TZ_UNKNOWN) {
+            p->time_fast = formats[i].type;
+        }
+        break;
+    }
+
+    if (p->time_frac_secs) {
+        p->time_frac_tz = time_tz_kind(p->time_frac_secs);
+    }
+}
+
+static inline int time_digits(const char *p, int n)
+{
+    int i;
+    int val = 0;
+
+    for (i = 0; i < n; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return -1;
+        }
+        val = (val * 10) + (p[i] - '0');
+    }
+    return val;
+}
+
+static inline int time_month(const char *p)
+{
+    int i;
+
+    for (i = 0; i < 12; i++) {
+        if (p[0] == time_months[i][0] && p[1] == time_months[i][1] &&
+            p[2] == time_months[i][2]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Parse the seconds prefix, 'str' must be NUL terminated */
+static const char *time_fast_date(int type, const char *str, struct tm *tm)
+{
+    int leap;
+    int year;
+    int mon;
+    int mday;
+    int hour;
+    int min;
+    int sec;
+    long days;
+    const char *p = str;
+
+    switch (type) {
+    case FLB_PARSER_TIME_ISO8601:
+    case FLB_PARSER_TIME_ISO8601_SP:
+        year = time_digits(p, 4);
+        mon = time_digits(p + 5, 2) - 1;
+        mday = time_digits(p + 8, 2);
+        if (year < 1 || p[4] != '-' || p[7] != '-' ||
+            p[10] != (type == FLB_PARSER_TIME_ISO8601 ? 'T' : ' ')) {
+            return NULL;
+        }
+        p += 11;
+        break;
+    case FLB_PARSER_TIME_APACHE:
+        mday = time_digits(p, 2);
+        if (p[2] != '/') {
+            return NULL;
+        }
+        mon = time_month(p + 3);
+        year = time_digits(p + 7, 4);
+        if (p[6] != '/' || year < 1 || p[11] != ':') {
+            return NULL;
+        }
+        p += 12;
+        break;
+    case FLB_PARSER_TIME_SYSLOG:
+        year = time_digits(p, 4);
+        if (year < 1 || p[4] != ' ') {
+            return NULL;
+        }
+        mon = time_month(p + 5);
+        if (p[8] != ' ') {
+            return NULL;
+        }
+        p += 9;
+
+        /* the day can be padded with a space or a zero */
+        if (*p == ' ') {
+            p++;
+        }
+        if (p[0] >= '0' && p[0] <= '9' && p[1] == ' ') {
+            mday = p[0] - '0';
+            p += 2;
+        }
+        else {
+            mday = time_digits(p, 2);
+            if (p[2] != ' ') {
+                return NULL;
+            }
+            p += 3;
+        }
+        break;
+    default:
+        return NULL;
+    }
+
+    hour = time_digits(p, 2);
+    min = time_digits(p + 3, 2);
+    sec = time_digits(p + 6, 2);
+    if (p[2] != ':' || p[5] != ':' || mon < 0 || mon > 11 ||
+        hour < 0 || hour > 23 || min < 0 || min > 59 || sec < 0 || sec > 59) {
+        return NULL;
+    }
+
+    leap = (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+    if (mday < 1 || mday > time_mdays[leap][mon]) {
+        return NULL;
+    }
+
+    tm->tm_year = year - 1900;
+    tm->tm_mon = mon;
+    tm->tm_mday = mday;
+    tm->tm_hour = hour;
+    tm->tm_min = min;
+    tm->tm_sec = sec;
+    tm->tm_yday = time_ydays[leap][mon] + mday - 1;
+
+    /* days since 1970-01-01, a Thursday */
+    year--;
+    days = (365L * (year - 1969)) + (year / 4) - (year / 100) + (year / 400)
+           - 477 + tm->tm_yday;
+    tm->tm_wday = (int) (((days + 4) % 7 + 7) % 7);
+
+    return p + 8;
+}
+
+/*
+ * Parse a timezone suffix. Offsets are limited to the ones every strptime(3)
+ * implementation converts the same way.
+ */
+static const char *time_fast_tz(int type, const char *p, struct tm *tm)
+{
+    int neg;
+    int hour;
+    int min;
+
+    switch (type) {
+    case FLB_PARSER_TZ_NONE:
+        return p;
+    case FLB_PARSER_TZ_UTC:
+        if (*p != 'Z') {
+            return NULL;
+        }
+        return p + 1;
+    case FLB_PARSER_TZ_SPACE_OFFSET:
+        if (*p != ' ') {
+            return NULL;
+        }
+        p++;
+        /* fall through */
+    case FLB_PARSER_TZ_OFFSET:
+        if (*p != '+' && *p != '-') {
+            return NULL;
+        }
+        neg = (*p++ == '-');
+
+        hour = time_digits(p, 2);
+        if (p[2] == ':') {
+            p++;
+        }
+        min = time_digits(p + 2, 2);
+        if (hour < 0 || (min != 0 && min != 30 && min != 45) ||
+            (hour * 100) + min > 1200) {
+            return NULL;
+        }
+#ifdef FLB_HAVE_GMTOFF
+        tm->tm_gmtoff = (hour * 3600) + (min * 60);
+        if (neg) {
+            tm->tm_gmtoff = -tm->tm_gmtoff;
+        }
+#else
+        (void) neg;
+#endif
+        return p + 4;
+    }
+
+    return NULL;
+}
+
+/*
+ * Per-thread time cache
+ * ---------------------
+ * Log records written within the same second share the same timestamp
+ * prefix. Every thread keeps the last result of each parser (slots are
+ * indexed by the parser id) and reuses it when the next timestamp has the
+ * same bytes, only the fractional seconds are parsed again.
+ */
+#define FLB_PARSER_TIME_CACHE  16
+
+struct time_cache {
+    uint64_t id;          /* parser id, zero if unused */
+    time_t day;           /* day of 'now' for formats without a year */
+    int year;             /* year of 'day' */
+    int len;              /* length of 'str', -1 if nothing is cached */
+    int frac_off;         /* offset of fractional seconds, or -1 */
+    int rem_len;          /* length of 'rem' */
+    char str[64];         /* time string, including the year prefix */
+    char rem[32];         /* suffix after fractional seconds */
+    struct tm tm;         /* result before the fixed time offset */
+    time_t utc;           /* timegm() of 'tm' */
+};
+
+static uint64_t time_cache_ids = 0;
+static pthread_key_t time_cache_key;
+static pthread_once_t time_cache_once = PTHREAD_ONCE_INIT;
+
+static void time_cache_init()
+{
+    pthread_key_create(&time_cache_key, flb_free);
+}
+
+static struct time_cache *time_cache_get(struct flb_parser *parser)
+{
+    struct time_cache *slots;
+    struct time_cache *cache;
+
+    pthread_once(&time_cache_once, time_cache_init);
+
+    slots = pthread_getspecific(time_cache_key);
+    if (!slots) {
+        slots = flb_calloc(FLB_PARSER_TIME_CACHE, sizeof(struct time_cache));
+        if (!slots) {
+            flb_errno();
+            return NULL;
+        }
+        pthread_setspecific(time_cache_key, slots);
+    }
+
+    cache = &slots[parser->time_id % FLB_PARSER_TIME_CACHE];
+    if (cache->id != parser->time_id) {
+        cache->id = parser->time_id;
+        cache->day = -1;
+        cache->len = -1;
+    }
+    return cache;
+}
+
 struct flb_parser *flb_parser_create(const char *name, const char *format,
                                      const char *p_regex,
                                      const char *time_fmt, const char *time_key,
@@ -139,6 +484,7 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
         return NULL;
     }
     p->decoders = decoders;
+    p->time_id = ++time_cache_ids;
 
     /* Format lookup */
     if (strcasecmp(format, "regex") == 0) {
@@ -153,6 +499,9 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
     else if (strcmp(format, "logfmt") == 0) {
         p->type = FLB_PARSER_LOGFMT;
     }
+    else if (strcasecmp(format, "native") == 0) {
+        p->type = FLB_PARSER_NATIVE;
+    }
     else {
         flb_error("[parser:%s] Invalid format %s", name, format);
         flb_free(p);
@@ -178,6 +527,22 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
 
     p->name = flb_strdup(name);
 
+    if (p->type == FLB_PARSER_NATIVE) {
+        /* for native parsers p_regex is the name of the format */
+        if (!p_regex) {
+            flb_error("[parser:%s] Invalid native format", name);
+            ret = -1;
+        }
+        else {
+            ret = flb_parser_native_create(p, p_regex);
+        }
+        if (ret == -1) {
+            flb_free(p->name);
+            flb_free(p);
+            return NULL;
+        }
+    }
+
     if (time_fmt) {
         p->time_fmt = flb_strdup(time_fmt);
 
@@ -266,6 +631,9 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
             }
         }
 
+        /* Specialised parsers for common time formats */
+        time_fast_detect(p);
+
         /* Optional fixed timezone offset */
         if (time_offset) {
             diff = 0;
@@ -289,13 +657,159 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
 
     mk_list_add(&p->_head, &config->parsers);
 
+    if (p->type == FLB_PARSER_REGEX || p->type == FLB_PARSER_NATIVE) {
+        ret = flb_parser_regex_fields_create(p);
+        if (ret == -1) {
+            flb_parser_destroy(p);
+            return NULL;
+        }
+    }
+
+    return p;
+}
+
+/*
+ * Copy a time format. When the format has fractional seconds, 'frac' points
+ * to the suffix stored right after the NUL that ends the main format.
+ */
+static char *time_fmt_dup(const char *fmt, const char *frac, char **out_frac)
+{
+    size_t size;
+    char *buf;
+
+    size = strlen(fmt) + 1;
+    if (frac && frac == fmt + size + 2) {
+        size = (frac - fmt) + strlen(frac) + 1;
+    }
+    else {
+        frac = NULL;
+    }
+
+    buf = flb_malloc(size);
+    if (!buf) {
+        flb_errno();
+        return NULL;
+    }
+    memcpy(buf, fmt, size);
+
+    if (frac) {
+        *out_frac = buf + (frac - fmt);
+    }
+    return buf;
+}
+
+/*
+ * Create a private copy of a parser to be used from another thread, it is
+ * not registered in the configuration and must be released with
+ * flb_parser_destroy(). Regular expressions are compiled again and the
+ * decoders get their own scratch buffers.
+ */
+struct flb_parser *flb_parser_dup(struct flb_parser *parser)
+{
+    int i;
+    int ret;
+    struct flb_parser *p;
+
+    p = flb_calloc(1, sizeof(struct flb_parser));
+    if (!p) {
+        flb_errno();
+        return NULL;
+    }
+    memcpy(p, parser, sizeof(struct flb_parser));
+    mk_list_init(&p->_head);
+
+    p->name = NULL;
+    p->p_regex = NULL;
+    p->regex = NULL;
+    p->time_fmt = NULL;
+    p->time_fmt_year = NULL;
+    p->time_frac_secs = NULL;
+    p->time_key = NULL;
+    p->types = NULL;
+    p->types_len = 0;
+    p->decoders = NULL;
+    p->fields = NULL;
+    p->fields_len = 0;
+
+    if (parser->type == FLB_PARSER_REGEX || parser->type == FLB_PARSER_NATIVE) {
+        p->regex = flb_regex_create(parser->p_regex);
+        if (!p->regex) {
+            flb_error("[parser:%s] cannot duplicate parser", parser->name);
+            flb_free(p);
+            return NULL;
+        }
+        p->p_regex = flb_strdup(parser->p_regex);
+    }
+
+    p->name = flb_strdup(parser->name);
+    if (!p->name) {
+        goto error;
+    }
+
+    if (parser->time_fmt) {
+        p->time_fmt = time_fmt_dup(parser->time_fmt, parser->time_frac_secs,
+                                   &p->time_frac_secs);
+        if (!p->time_fmt) {
+            goto error;
+        }
+    }
+    if (parser->time_fmt_year) {
+        p->time_fmt_year = time_fmt_dup(parser->time_fmt_year,
+                                        parser->time_frac_secs,
+                                        &p->time_frac_secs);
+        if (!p->time_fmt_year) {
+            goto error;
+        }
+    }
+    if (parser->time_key) {
+        p->time_key = flb_strdup(parser->time_key);
+        if (!p->time_key) {
+            goto error;
+        }
+    }
+
+    if (parser->types_len > 0) {
+        p->types = flb_calloc(parser->types_len,
+                              sizeof(struct flb_parser_types));
+        if (!p->types) {
+            flb_errno();
+            goto error;
+        }
+        p->types_len = parser->types_len;
+        for (i = 0; i < parser->types_len; i++) {
+            p->types[i] = parser->types[i];
+            p->types[i].key = flb_strdup(parser->types[i].key);
+        }
+    }
+
+    if (parser->decoders) {
+        p->decoders = flb_parser_decoder_list_dup(parser->decoders);
+        if (!p->decoders) {
+            goto error;
+        }
+    }
+
+    if (p->regex) {
+        ret = flb_parser_regex_fields_create(p);
+        if (ret == -1) {
+            goto error;
+        }
+    }
+
     return p;
+
+ error:
+    flb_error("[parser:%s] cannot duplicate parser", parser->name);
+    flb_parser_destroy(p);
+    return NULL;
 }
 
 void flb_parser_destroy(struct flb_parser *parser)
 {
     int i = 0;
-    if (parser->type == FLB_PARSER_REGEX) {
+    if (parser->type == FLB_PARSER_REGEX ||
+        parser->type == FLB_PARSER_NATIVE) {
+        flb_parser_regex_fields_destroy(parser);
         flb_regex_destroy(parser->regex);
         flb_free(parser->p_regex);
     }
@@ -477,6 +991,18 @@ int flb_parser_conf_file(const char *file, struct flb_config *config)
             goto fconf_error;
         }
 
+        /* Native (if format is native), the built-in format name */
+        if (strcasecmp(format, "native") == 0) {
+            if (regex) {
+                flb_free(regex);
+            }
+            regex = mk_rconf_section_get_key(section, "Native", MK_RCONF_STR);
+            if (!regex) {
+                flb_error("[parser] no parser 'native' found for '%s' in file '%s'", name, cfg);
+                goto fconf_error;
+            }
+        }
+
         /* Time_Format */
         time_fmt = mk_rconf_section_get_key(section, "Time_Format",
                                             MK_RCONF_STR);
@@ -605,6 +1131,10 @@ int flb_parser_do(struct flb_parser *parser, const char *buf, size_t length,
         return flb_parser_logfmt_do(parser, buf, length,
                                   out_buf, out_size, out_time);
     }
+    else if (parser->type == FLB_PARSER_NATIVE) {
+        return flb_parser_native_do(parser, buf, length,
+                                    out_buf, out_size, out_time);
+    }
 
     return -1;
 }
@@ -658,22 +1188,144 @@ int flb_parser_tzone_offset(const char *str, int len, int *tmdiff)
     return 0;
 }
 
-int flb_parser_time_lookup(const char *time_str, size_t tsize,
-                           time_t now,
-                           struct flb_parser *parser,
-                           struct tm *tm, double *ns)
+/*
+ * Parse fractional seconds found at 'off', the suffix that follows them is
+ * copied into 'rem' for the timezone lookup.
+ */
+static int time_frac(const char *str, int len, int off,
+                     double *frac, char *rem, int *rem_len)
 {
     int ret;
     int slen;
+    const char *end;
+
+    slen = len - off;
+    if (slen > 31) {
+        slen = 31;
+    }
+
+    ret = flb_parser_frac(str + off, slen, frac, &end);
+    if (ret == -1) {
+        return -1;
+    }
+
+    *rem_len = slen - (end - (str + off));
+    memcpy(rem, end, *rem_len);
+    rem[*rem_len] = '\0';
+    return 0;
+}
+
+/* Same seconds prefix and timezone than the cached entry ? */
+static int time_cache_match(struct time_cache *cache,
+                            const char *str, int len, double *frac)
+{
+    int ret;
+    int off = cache->frac_off;
+    int rem_len;
+    char rem[32];
+
+    if (cache->len < 0) {
+        return FLB_FALSE;
+    }
+
+    if (off == -1) {
+        return (len == cache->len && memcmp(str, cache->str, len) == 0);
+    }
+
+    if (len <= off || (str[off] != '.' && str[off] != ',') ||
+        memcmp(str, cache->str, off) != 0) {
+        return FLB_FALSE;
+    }
+
+    ret = time_frac(str, len, off, frac, rem, &rem_len);
+    if (ret == -1 || rem_len != cache->rem_len ||
+        memcmp(rem, cache->rem, rem_len) != 0) {
+        *frac = 0;
+        return FLB_FALSE;
+    }
+    return FLB_TRUE;
+}
+
+/* Parse a time string, the result is saved in the cache */
+static int time_parse(struct flb_parser *parser, const char *fmt,
+                      const char *str, int len,
+                      struct time_cache *cache,
+                      struct tm *tm, time_t *utc, double *frac)
+{
+    int ret;
+    int rem_len = 0;
+    int frac_off = -1;
+    const char *p = NULL;
+    char rem[32];
+    struct tm tmp;
+
+    memset(tm, '\0', sizeof(struct tm));
+    if (parser->time_fast != FLB_PARSER_TIME_GENERIC) {
+        p = time_fast_date(parser->time_fast, str, tm);
+        if (p) {
+            p = time_fast_tz(parser->time_fast_tz, p, tm);
+        }
+        if (!p) {
+            memset(tm, '\0', sizeof(struct tm));
+        }
+    }
+    if (!p) {
+        p = strptime(str, fmt, tm);
+        if (p == NULL) {
+            return -1;
+        }
+    }
+
+    /* Check if we have fractional seconds */
+    if (parser->time_frac_secs && (*p == '.' || *p == ',')) {
+        frac_off = p - str;
+        ret = time_frac(str, len, frac_off, frac, rem, &rem_len);
+        if (ret == -1) {
+            flb_warn("[parser] Error parsing time string");
+            return -1;
+        }
+
+        p = NULL;
+        if (parser->time_frac_tz != FLB_PARSER_TZ_UNKNOWN) {
+            p = time_fast_tz(parser->time_frac_tz, rem, tm);
+        }
+        if (!p) {
+            p = strptime(rem, parser->time_frac_secs, tm);
+            if (p == NULL) {
+                return -1;
+            }
+        }
+    }
+
+    tmp = *tm;
+    *utc = timegm(&tmp);
+
+    if (cache) {
+        cache->len = len;
+        memcpy(cache->str, str, len);
+        cache->frac_off = frac_off;
+        cache->rem_len = rem_len;
+        memcpy(cache->rem, rem, rem_len);
+        cache->tm = *tm;
+        cache->utc = *utc;
+    }
+    return 0;
+}
+
+static int time_lookup(const char *time_str, size_t tsize, time_t now,
+                       struct flb_parser *parser,
+                       struct tm *tm, time_t *epoch, double *ns)
+{
+    int ret;
+    int len = 0;
+    int year;
     time_t time_now;
+    time_t utc;
     double tmfrac = 0;
-    char *p = NULL;
     char *fmt;
-    int time_len = tsize;
-    const char *time_ptr = time_str;
     char tmp[64];
-    char fs_tmp[32];
     struct tm tmy;
+    struct time_cache *cache;
 
     *ns = 0;
 
@@ -682,6 +1334,8 @@ int flb_parser_time_lookup(const char *time_str, size_t tsize,
         return -1;
     }
 
+    cache = time_cache_get(parser);
+
     /*
      * Some records coming from old Syslog messages do not contain the
      * year, so it's required to ingest this information in the value
@@ -689,14 +1343,10 @@ int flb_parser_time_lookup(const char *time_str, size_t tsize,
      */
     if (parser->time_with_year == FLB_FALSE) {
         /* Given time string is too long */
-        if (time_len + 6 >= sizeof(tmp)) {
+        if (tsize + 6 >= sizeof(tmp)) {
             return -1;
         }
 
-        /*
-         * This is not the most elegant way but for now it let
-         * get the work done.
-         */
         if (now <= 0) {
             time_now = time(NULL);
         }
@@ -704,100 +1354,239 @@ int flb_parser_time_lookup(const char *time_str, size_t tsize,
             time_now = now;
         }
 
-        gmtime_r(&time_now, &tmy);
-        uint64_t t = tmy.tm_year + 1900;
-
-        fmt = tmp;
-        u64_to_str(t, fmt);
-        fmt += 4;
-        *fmt++ = ' ';
-
-        memcpy(fmt, time_ptr, time_len);
-        fmt += time_len;
-        *fmt++ = '\0';
+        if (cache && cache->day == time_now / 86400) {
+            year = cache->year;
+        }
+        else {
+            gmtime_r(&time_now, &tmy);
+            year = tmy.tm_year + 1900;
+            if (cache) {
+                cache->day = time_now / 86400;
+                cache->year = year;
+            }
+        }
 
-        time_ptr = tmp;
-        time_len = strlen(tmp);
-        p = strptime(time_ptr, parser->time_fmt_year, tm);
+        len = u64_to_str(year, tmp);
+        tmp[len++] = ' ';
+        fmt = parser->time_fmt_year;
     }
     else {
-        p = strptime(time_ptr, parser->time_fmt, tm);
-    }
-
-    if (p != NULL) {
-        /* Check if we have fractional seconds */
-        if (parser->time_frac_secs && (*p == '.' || *p == ',')) {
-            /*
-             * Further parser routines needs a null byte, for fractional seconds
-             * we make a safe copy of the content.
-             */
-            slen = time_len - (p - time_ptr);
-            if (slen > 31) {
-                slen = 31;
-            }
-            memcpy(fs_tmp, p, slen);
-            fs_tmp[slen] = '\0';
-
-            /* Parse fractional seconds */
-            ret = flb_parser_frac(fs_tmp, slen, &tmfrac, &time_ptr);
-            if (ret == -1) {
-                flb_warn("[parser] Error parsing time string");
-                return -1;
-            }
-            *ns = tmfrac;
+        fmt = parser->time_fmt;
+    }
 
-            p = strptime(time_ptr, parser->time_frac_secs, tm);
+    /* strptime(3) needs a NUL terminated string */
+    memcpy(tmp + len, time_str, tsize);
+    tmp[len + tsize] = '\0';
+    len = strlen(tmp);
 
-            if (p == NULL) {
-                return -1;
-            }
+    if (cache && time_cache_match(cache, tmp, len, &tmfrac) == FLB_TRUE) {
+        *tm = cache->tm;
+        utc = cache->utc;
+    }
+    else {
+        ret = time_parse(parser, fmt, tmp, len, cache, tm, &utc, &tmfrac);
+        if (ret == -1) {
+            return -1;
         }
+    }
 
 #ifdef FLB_HAVE_GMTOFF
-        if (parser->time_with_tz == FLB_FALSE) {
-            tm->tm_gmtoff = parser->time_offset;
-        }
+    if (parser->time_with_tz == FLB_FALSE) {
+        tm->tm_gmtoff = parser->time_offset;
+    }
+    *epoch = utc - tm->tm_gmtoff;
+#else
+    *epoch = utc;
 #endif
+    *ns = tmfrac;
 
-        return 0;
-    }
+    return 0;
+}
 
-    return -1;
+int flb_parser_time_lookup(const char *time_str, size_t tsize,
+                           time_t now,
+                           struct flb_parser *parser,
+                           struct tm *tm, double *ns)
+{
+    time_t epoch;
+
+    return time_lookup(time_str, tsize, now, parser, tm, &epoch, ns);
+}
+
+/* Same as flb_parser_time_lookup() but returns the Unix time directly */
+int flb_parser_time_lookup_epoch(const char *time_str, size_t tsize,
+                                 time_t now,
+                                 struct flb_parser *parser,
+                                 time_t *epoch, double *ns)
+{
+    struct tm tm;
+
+    return time_lookup(time_str, tsize, now, parser, &tm, epoch, ns);
 }
 
 int flb_parser_frac(const char *str, int len, double *frac, const char **end)
 {
-    int ret = 0;
-    char *p;
-    double d;
-    const char *pstr;
-    char *tmp = NULL;
-
-    /* Fractional seconds */
-    /* Normalize the fractional seperator to be '.' since that's what strtod()
-     * expects in standard C locale */
-    if (*str == ',') {
-        tmp = flb_strdup(str);
-        tmp[0] = '.';
-        pstr = tmp;
+    int digits = 0;
+    int exp10 = 0;
+    uint64_t mantissa = 0;
+    const char *p = str;
+    const char *p_end = str + len;
+
+    /* Fractional seconds, the separator can be a dot or a comma */
+    if (len < 2 || (*p != '.' && *p != ',')) {
+        return -1;
     }
-    else {
-        pstr = str;
+    p++;
+
+    if (*p < '0' || *p > '9') {
+        return -1;
     }
 
-    d = strtod(pstr, &p);
-    if ((d == 0 && p == pstr) || !p) {
-        ret = -1;
-        goto free_and_return;
+    while (p < p_end && *p >= '0' && *p <= '9') {
+        /* digits beyond the double precision are ignored */
+        if (digits < 19) {
+            mantissa = (mantissa * 10) + (*p - '0');
+            digits++;
+            exp10--;
+        }
+        p++;
     }
-    *frac = d;
-    *end = str + (p - pstr);
 
-free_and_return:
-    if (tmp != NULL) {
-        flb_free(tmp);
+    *frac = flb_number_decimal(mantissa, exp10, FLB_FALSE);
+    *end = p;
+    return 0;
+}
+
+/* Trim white spaces around a value to be converted */
+static inline void typecast_trim(const char **val, int *val_len)
+{
+    const char *s = *val;
+    const char *e = s + *val_len;
+
+    while (s < e && (*s == ' ' || *s == '\t')) {
+        s++;
     }
-    return ret;
+    while (e > s && (*(e - 1) == ' ' || *(e - 1) == '\t')) {
+        e--;
+    }
+    *val = s;
+    *val_len = e - s;
+}
+
+static int typecast_hex(const char *val, int val_len, uint64_t *out)
+{
+    int c;
+    const char *p = val;
+    const char *end = val + val_len;
+    uint64_t v = 0;
+
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        p += 2;
+    }
+    if (p >= end || end - p > 16) {
+        return -1;
+    }
+
+    for (; p < end; p++) {
+        c = *p;
+        if (c >= '0' && c <= '9') {
+            c -= '0';
+        }
+        else if (c >= 'a' && c <= 'f') {
+            c = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F') {
+            c = c - 'A' + 10;
+        }
+        else {
+            return -1;
+        }
+        v = (v << 4) | c;
+    }
+
+    *out = v;
+    return 0;
+}
+
+/*
+ * Pack a value converted to the given type, if the conversion fails the
+ * value is packed as a string. The key is only used in error messages.
+ */
+int flb_parser_typecast_value(const char *key, int key_len, int type,
+                              const char *val, int val_len,
+                              msgpack_packer *pck)
+{
+    int num_len = val_len;
+    int error = FLB_FALSE;
+    uint64_t hex;
+    const char *num_str = val;
+    struct flb_number num;
+
+    switch (type) {
+    case FLB_PARSER_TYPE_INT:
+        typecast_trim(&num_str, &num_len);
+        if (flb_number_parse_lenient(num_str, num_len, &num) == -1) {
+            error = FLB_TRUE;
+        }
+        else if (num.type == FLB_NUMBER_INT) {
+            msgpack_pack_int64(pck, num.val.i64);
+        }
+        else if (num.type == FLB_NUMBER_UINT) {
+            msgpack_pack_uint64(pck, num.val.u64);
+        }
+        else if (num.val.f64 >= -9223372036854775808.0 &&
+                 num.val.f64 < 9223372036854775808.0) {
+            /* truncate the fractional part */
+            msgpack_pack_int64(pck, (int64_t) num.val.f64);
+        }
+        else {
+            error = FLB_TRUE;
+        }
+        break;
+    case FLB_PARSER_TYPE_HEX:
+        typecast_trim(&num_str, &num_len);
+        if (typecast_hex(num_str, num_len, &hex) == -1) {
+            error = FLB_TRUE;
+        }
+        else {
+            msgpack_pack_uint64(pck, hex);
+        }
+        break;
+    case FLB_PARSER_TYPE_FLOAT:
+        typecast_trim(&num_str, &num_len);
+        if (flb_number_parse_lenient(num_str, num_len, &num) == -1) {
+            error = FLB_TRUE;
+        }
+        else {
+            msgpack_pack_double(pck, flb_number_to_double(&num));
+        }
+        break;
+    case FLB_PARSER_TYPE_BOOL:
+        if (!strncasecmp(val, "true", 4)) {
+            msgpack_pack_true(pck);
+        }
+        else if(!strncasecmp(val, "false", 5)){
+            msgpack_pack_false(pck);
+        }
+        else {
+            error = FLB_TRUE;
+        }
+        break;
+    case FLB_PARSER_TYPE_STRING:
+        msgpack_pack_str(pck, val_len);
+        msgpack_pack_str_body(pck, val, val_len);
+        break;
+    default:
+        error = FLB_TRUE;
+    }
+
+    if (error == FLB_TRUE) {
+        flb_warn("[PARSER] key=%.*s cast error. save as string.",
+                 key_len, key);
+        msgpack_pack_str(pck, val_len);
+        msgpack_pack_str_body(pck, val, val_len);
+    }
+    return 0;
 }
 
 int flb_parser_typecast(const char *key, int key_len,
@@ -807,85 +1596,23 @@ int flb_parser_typecast(const char *key, int key_len,
                         int types_len)
 {
     int i;
-    int error = FLB_FALSE;
-    char *tmp_str;
-    int casted = FLB_FALSE;
 
     for(i=0; i<types_len; i++){
         if (types[i].key != NULL
             && key_len == types[i].key_len &&
             !strncmp(key, types[i].key, key_len)) {
 
-            casted = FLB_TRUE;
-
             msgpack_pack_str(pck, key_len);
             msgpack_pack_str_body(pck, key, key_len);
 
-            switch (types[i].type) {
-            case FLB_PARSER_TYPE_INT:
-                {
-                    long long lval;
-
-                    /* msgpack char is not null terminated.
-                       So make a temporary copy.
-                     */
-                    tmp_str = flb_strndup(val, val_len);
-                    lval = atoll(tmp_str);
-                    flb_free(tmp_str);
-                    msgpack_pack_int64(pck, lval);
-                }
-                break;
-            case FLB_PARSER_TYPE_HEX:
-                {
-                    unsigned long long lval;
-                    tmp_str = flb_strndup(val, val_len);
-                    lval = strtoull(tmp_str, NULL, 16);
-                    flb_free(tmp_str);
-                    msgpack_pack_uint64(pck, lval);
-                }
-                break;
-
-            case FLB_PARSER_TYPE_FLOAT:
-                {
-                    double dval;
-                    tmp_str = flb_strndup(val, val_len);
-                    dval = atof(tmp_str);
-                    flb_free(tmp_str);
-                    msgpack_pack_double(pck, dval);
-                }
-                break;
-            case FLB_PARSER_TYPE_BOOL:
-                if (!strncasecmp(val, "true", 4)) {
-                    msgpack_pack_true(pck);
-                }
-                else if(!strncasecmp(val, "false", 5)){
-                    msgpack_pack_false(pck);
-                }
-                else {
-                    error = FLB_TRUE;
-                }
-                break;
-            case FLB_PARSER_TYPE_STRING:
-                msgpack_pack_str(pck, val_len);
-                msgpack_pack_str_body(pck, val, val_len);
-                break;
-            default:
-                error = FLB_TRUE;
-            }
-            if (error == FLB_TRUE) {
-                flb_warn("[PARSER] key=%s cast error. save as string.", key);
-                msgpack_pack_str(pck, val_len);
-                msgpack_pack_str_body(pck, val, val_len);
-            }
-            break;
+            return flb_parser_typecast_value(key, key_len, types[i].type,
+                                             val, val_len, pck);
         }
     }
 
-    if (casted == FLB_FALSE) {
-        msgpack_pack_str(pck, key_len);
-        msgpack_pack_str_body(pck, key, key_len);
-        msgpack_pack_str(pck, val_len);
-        msgpack_pack_str_body(pck, val, val_len);
-    }
+    msgpack_pack_str(pck, key_len);
+    msgpack_pack_str_body(pck, key, key_len);
+    msgpack_pack_str(pck, val_len);
+    msgpack_pack_str_body(pck, val, val_len);
     return 0;
 }
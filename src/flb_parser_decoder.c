@@ -71,15 +71,19 @@ static int decode_json(struct flb_parser_dec *dec,
     return 0;
 }
 
+/*
+ * Unescape a string into 'dst'. The result is never longer than the
+ * input, so 'dst' can be 'in_buf' itself to decode in place.
+ */
 static int decode_escaped(struct flb_parser_dec *dec,
-                          const char *in_buf, size_t in_size,
+                          const char *in_buf, size_t in_size, char *dst,
                           char **out_buf, size_t *out_size, int *out_type)
 {
     int len;
 
     /* Unescape string */
-    len = flb_unescape_string(in_buf, in_size, &dec->buffer);
-    *out_buf = dec->buffer;
+    len = flb_unescape_string(in_buf, in_size, &dst);
+    *out_buf = dst;
     *out_size = len;
     *out_type = TYPE_OUT_STRING;
 
@@ -87,13 +91,13 @@ static int decode_escaped(struct flb_parser_dec *dec,
 }
 
 static int decode_escaped_utf8(struct flb_parser_dec *dec,
-                               const char *in_buf, size_t in_size,
+                               const char *in_buf, size_t in_size, char *dst,
                                char **out_buf, size_t *out_size, int *out_type)
 {
     int len;
 
-    len = flb_unescape_string_utf8(in_buf, in_size, dec->buffer);
-    *out_buf = dec->buffer;
+    len = flb_unescape_string_utf8(in_buf, in_size, dst);
+    *out_buf = dst;
     *out_size = len;
     *out_type = TYPE_OUT_STRING;
 
@@ -181,6 +185,7 @@ int flb_parser_decoder_do(struct mk_list *decoders,
     int extra_keys = FLB_FALSE;
     size_t off = 0;
     char *dec_buf;
+    char *dec_dst;
     size_t dec_size;
     flb_sds_t tmp_sds = NULL;
     flb_sds_t data_sds = NULL;
@@ -369,6 +374,18 @@ int flb_parser_decoder_do(struct mk_list *decoders,
                 continue;
             }
 
+            /*
+             * 'Decode_Field_As' replaces the value with the decoded one, so
+             * escaped content is decoded in place. Other rules keep the
+             * original data for the next ones.
+             */
+            if (rule->type == FLB_PARSER_DEC_AS) {
+                dec_dst = data_sds;
+            }
+            else {
+                dec_dst = dec->buffer;
+            }
+
             /* Process using defined decoder backend */
             if (rule->backend == FLB_PARSER_DEC_JSON) {
                 ret = decode_json(dec, (char *) data_sds, flb_sds_len(data_sds),
@@ -377,12 +394,12 @@ int flb_parser_decoder_do(struct mk_list *decoders,
             else if (rule->backend == FLB_PARSER_DEC_ESCAPED) {
                 ret = decode_escaped(dec,
                                      (char *) data_sds, flb_sds_len(data_sds),
-                                     &dec_buf, &dec_size, &dec_type);
+                                     dec_dst, &dec_buf, &dec_size, &dec_type);
             }
             else if (rule->backend == FLB_PARSER_DEC_ESCAPED_UTF8) {
                 ret = decode_escaped_utf8(dec,
                                      (char *) data_sds, flb_sds_len(data_sds),
-                                     &dec_buf, &dec_size, &dec_type);
+                                     dec_dst, &dec_buf, &dec_size, &dec_type);
             }
 
             /* Check decoder status */
@@ -403,9 +420,15 @@ int flb_parser_decoder_do(struct mk_list *decoders,
                 if (tmp_sds != in_sds) {
                     in_sds = tmp_sds;
                 }
-                tmp_sds = flb_sds_copy(data_sds, dec_buf, dec_size);
-                if (tmp_sds != data_sds) {
-                    data_sds = tmp_sds;
+                if (dec_buf == data_sds) {
+                    /* decoded in place */
+                    flb_sds_len_set(data_sds, dec_size);
+                }
+                else {
+                    tmp_sds = flb_sds_copy(data_sds, dec_buf, dec_size);
+                    if (tmp_sds != data_sds) {
+                        data_sds = tmp_sds;
+                    }
                 }
                 in_type = dec_type;
                 is_decoded_as = FLB_TRUE;
@@ -420,7 +443,7 @@ int flb_parser_decoder_do(struct mk_list *decoders,
             }
 
 
-            if (dec_buf != dec->buffer) {
+            if (dec_buf != dec->buffer && dec_buf != data_sds) {
                 flb_free(dec_buf);
             }
             dec_buf = NULL;
@@ -687,6 +710,56 @@ struct mk_list *flb_parser_decoder_list_create(struct mk_rconf_section *section)
     return list;
 }
 
+/*
+ * Duplicate a list of decoders. Every decoder owns a scratch buffer, so a
+ * list cannot be shared by parsers running in different threads.
+ */
+struct mk_list *flb_parser_decoder_list_dup(struct mk_list *list)
+{
+    struct mk_list *head;
+    struct mk_list *r_head;
+    struct mk_list *out;
+    struct flb_parser_dec *dec;
+    struct flb_parser_dec *dec_new;
+    struct flb_parser_dec_rule *dec_rule;
+    struct flb_parser_dec_rule *rule_new;
+
+    out = flb_malloc(sizeof(struct mk_list));
+    if (!out) {
+        flb_errno();
+        return NULL;
+    }
+    mk_list_init(out);
+
+    mk_list_foreach(head, list) {
+        dec = mk_list_entry(head, struct flb_parser_dec, _head);
+        dec_new = get_decoder_key_context(dec->key, flb_sds_len(dec->key),
+                                          out);
+        if (!dec_new) {
+            flb_parser_decoder_list_destroy(out);
+            return NULL;
+        }
+        dec_new->add_extra_keys = dec->add_extra_keys;
+
+        mk_list_foreach(r_head, &dec->rules) {
+            dec_rule = mk_list_entry(r_head, struct flb_parser_dec_rule,
+                                     _head);
+            rule_new = flb_malloc(sizeof(struct flb_parser_dec_rule));
+            if (!rule_new) {
+                flb_errno();
+                flb_parser_decoder_list_destroy(out);
+                return NULL;
+            }
+            rule_new->type = dec_rule->type;
+            rule_new->backend = dec_rule->backend;
+            rule_new->action = dec_rule->action;
+            mk_list_add(&rule_new->_head, &dec_new->rules);
+        }
+    }
+
+    return out;
+}
+
 int flb_parser_decoder_list_destroy(struct mk_list *list)
 {
     int c = 0;
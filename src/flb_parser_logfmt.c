@@ -69,7 +69,6 @@ static int logfmt_parser(struct flb_parser *parser,
                          size_t *map_size)
 {
     int ret;
-    struct tm tm = {0};
     const unsigned char *key = NULL;
     size_t key_len = 0;
     const unsigned char *value = NULL;
@@ -149,14 +148,14 @@ static int logfmt_parser(struct flb_parser *parser,
                 value_len > 0 &&
                 !strncmp((const char *)key, time_key, key_len)) {
                 if (do_pack) {
-                    ret = flb_parser_time_lookup((const char *) value, value_len,
-                                                  0, parser, &tm, tmfrac);
+                    ret = flb_parser_time_lookup_epoch((const char *) value,
+                                                       value_len, 0, parser,
+                                                       time_lookup, tmfrac);
                     if (ret == -1) {
                        flb_error("[parser:%s] Invalid time format %s.",
                                  parser->name, parser->time_fmt);
                        return -1;
                     }
-                    *time_lookup = flb_parser_tm2time(&tm);
                 }
                 time_found = FLB_TRUE;
             }
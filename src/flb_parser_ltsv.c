@@ -88,7 +88,6 @@ static int ltsv_parser(struct flb_parser *parser,
                        size_t *map_size)
 {
     int ret;
-    struct tm tm = {0};
     const unsigned char *label = NULL;
     size_t label_len = 0;
     const unsigned char *field = NULL;
@@ -133,14 +132,14 @@ static int ltsv_parser(struct flb_parser *parser,
                 field_len > 0 &&
                 !strncmp((const char *)label, time_key, label_len)) {
                 if (do_pack) {
-                    ret = flb_parser_time_lookup((const char *) field, field_len,
-                                                  0, parser, &tm, tmfrac);
+                    ret = flb_parser_time_lookup_epoch((const char *) field,
+                                                       field_len, 0, parser,
+                                                       time_lookup, tmfrac);
                     if (ret == -1) {
                        flb_error("[parser:%s] Invalid time format %s.",
                                  parser->name, parser->time_fmt);
                        return -1;
                     }
-                    *time_lookup = flb_parser_tm2time(&tm);
                 }
                 time_found = FLB_TRUE;
             }
@@ -0,0 +1,678 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Native parsers: hand written scanners for the most common log formats.
+ *
+ * Every native format is defined by the stock regular expression found in
+ * conf/parsers.conf, the scanner only knows how to locate the captures of
+ * that pattern without running the regex engine. Keys, their order, time
+ * handling and type casting are shared with the regex parser, so records
+ * are exactly the same.
+ *
+ * Scanners only accept the canonical form of a line, where the match of
+ * the regex is unique. Anything else (extra white spaces, stray quotes,
+ * invalid UTF-8, ...) is handed to the regex engine, which decides.
+ */
+
+#include <string.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_regex.h>
+#include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_utf8.h>
+
+/* highest capture group number of a native format */
+#define NATIVE_MAX_GROUPS  10
+
+struct native_capture {
+    const char *val;      /* NULL if the group did not match */
+    size_t len;
+};
+
+struct native_format {
+    char *name;
+    char *pattern;        /* regex equivalent, see conf/parsers.conf */
+    int (*scan) (const char *, const char *, struct native_capture *);
+};
+
+int flb_parser_regex_do(struct flb_parser *parser,
+                        const char *buf, size_t length,
+                        void **out_buf, size_t *out_size,
+                        struct flb_time *out_time);
+int flb_parser_regex_pack(struct flb_parser *parser, const char *buf,
+                          int map_size,
+                          int (*cb_get)(void *, int, const char **, size_t *),
+                          void *data,
+                          void **out_buf, size_t *out_size,
+                          struct flb_time *out_time);
+
+static inline void capture(struct native_capture *c,
+                           const char *start, const char *end)
+{
+    c->val = start;
+    c->len = end - start;
+}
+
+/*
+ * Capture '[^ ]*' followed by a space, returns the position after the
+ * space or NULL if there is none. Captures are optional.
+ */
+static inline const char *token(const char *p, const char *end,
+                                struct native_capture *c)
+{
+    const char *t;
+
+    t = memchr(p, ' ', end - p);
+    if (!t) {
+        return NULL;
+    }
+    if (c) {
+        capture(c, p, t);
+    }
+    return t + 1;
+}
+
+/* Same as token() for '[^ ]+' */
+static inline const char *token_nonempty(const char *p, const char *end,
+                                         struct native_capture *c)
+{
+    if (p == end || *p == ' ') {
+        return NULL;
+    }
+    return token(p, end, c);
+}
+
+static inline int is_digit(char c)
+{
+    return (c >= '0' && c <= '9');
+}
+
+/*
+ * Lines with a new line are left to the regex engine since '^' and '$'
+ * match around it; so are invalid UTF-8 sequences, which the engine may
+ * consume in a different way than a byte scanner.
+ */
+static int line_check(const char *buf, size_t len)
+{
+    size_t i;
+    uint32_t cp;
+    uint32_t state = FLB_UTF8_ACCEPT;
+    const unsigned char *p = (const unsigned char *) buf;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] < 0x80 && state == FLB_UTF8_ACCEPT) {
+            if (p[i] == '\n') {
+                return -1;
+            }
+            continue;
+        }
+        if (flb_utf8_decode(&state, &cp, p[i]) == FLB_UTF8_REJECT) {
+            return -1;
+        }
+    }
+
+    if (state != FLB_UTF8_ACCEPT) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * HTTP request line, the contents between the double quotes [p, q). Only
+ * the 'method path protocol' form is handled: a request with no path lets
+ * '\S+' run over the closing quote and other white spaces are matched in
+ * a different way by '\S', both cases have other possible matches.
+ *
+ * The apache2 pattern takes the path as the second token '[^ ]*', the
+ * others as everything up to the last token '[^\"]*?'.
+ */
+static int scan_request(const char *p, const char *q, int lazy,
+                        struct native_capture *method,
+                        struct native_capture *path)
+{
+    const char *s;
+    const char *t;
+
+    for (s = p; s < q; s++) {
+        if (*s == '\t' || *s == '\v' || *s == '\f' || *s == '\r') {
+            return -1;
+        }
+    }
+
+    t = memchr(p, ' ', q - p);
+    if (!t || t == p) {
+        return -1;
+    }
+    capture(method, p, t);
+
+    s = t;
+    while (s < q && *s == ' ') {
+        s++;
+    }
+
+    if (lazy == FLB_TRUE) {
+        /* Locate the last token and the spaces before it */
+        t = q;
+        while (t > s && t[-1] != ' ') {
+            t--;
+        }
+        if (t > s) {
+            while (t[-1] == ' ') {
+                t--;
+            }
+        }
+        else {
+            t = q;
+        }
+        capture(path, s, t);
+        return 0;
+    }
+
+    if (s == q) {
+        return -1;
+    }
+    t = memchr(s, ' ', q - s);
+    if (!t) {
+        return -1;
+    }
+    capture(path, s, t);
+
+    while (t < q && *t == ' ') {
+        t++;
+    }
+    if (memchr(t, ' ', q - t)) {
+        return -1;
+    }
+    return 0;
+}
+
+#define HTTP_APACHE   0
+#define HTTP_APACHE2  1
+#define HTTP_NGINX    2
+
+/*
+ * Access logs: apache, apache2 and nginx patterns only differ on the
+ * leading fields, how the request path is taken and how the referer and
+ * user agent at the end of the line are matched.
+ */
+static int scan_http(const char *p, const char *end, int type,
+                     struct native_capture *c)
+{
+    int g = 1;
+    int ret;
+    const char *t;
+
+    if (type == HTTP_NGINX) {
+        p = token(p, end, &c[g++]);                     /* remote */
+        if (!p) {
+            return -1;
+        }
+        p = token(p, end, &c[g++]);                     /* host */
+    }
+    else {
+        p = token(p, end, &c[g++]);                     /* host */
+        if (!p) {
+            return -1;
+        }
+        p = token(p, end, NULL);
+    }
+    if (!p) {
+        return -1;
+    }
+
+    p = token(p, end, &c[g++]);                         /* user */
+    if (!p || p == end || *p != '[') {
+        return -1;
+    }
+    p++;
+
+    t = memchr(p, ']', end - p);                        /* time */
+    if (!t) {
+        return -1;
+    }
+    capture(&c[g++], p, t);
+    p = t + 1;
+
+    if (end - p < 2 || p[0] != ' ' || p[1] != '"') {
+        return -1;
+    }
+    p += 2;
+
+    t = memchr(p, '"', end - p);                        /* request */
+    if (!t) {
+        return -1;
+    }
+    ret = scan_request(p, t, type != HTTP_APACHE2, &c[g], &c[g + 1]);
+    if (ret == -1) {
+        return -1;
+    }
+    g += 2;
+    p = t + 1;
+
+    if (p == end || *p != ' ') {
+        return -1;
+    }
+    p = token(p + 1, end, &c[g++]);                     /* code */
+    if (!p) {
+        return -1;
+    }
+
+    t = memchr(p, ' ', end - p);                        /* size */
+    if (!t) {
+        if (type == HTTP_NGINX) {
+            return -1;
+        }
+        capture(&c[g], p, end);
+        return 0;
+    }
+    capture(&c[g++], p, t);
+    p = t + 1;
+
+    if (p == end || *p != '"') {
+        return -1;
+    }
+    p++;
+    t = memchr(p, '"', end - p);                        /* referer */
+    if (!t) {
+        return -1;
+    }
+    capture(&c[g++], p, t);
+    p = t + 1;
+
+    if (end - p < 2 || p[0] != ' ' || p[1] != '"') {
+        return -1;
+    }
+    p += 2;
+
+    if (type == HTTP_APACHE2) {
+        /* '.*' up to the quote closing the line */
+        if (p == end || end[-1] != '"') {
+            return -1;
+        }
+        capture(&c[g], p, end - 1);
+        return 0;
+    }
+
+    t = memchr(p, '"', end - p);                        /* agent */
+    if (!t) {
+        return -1;
+    }
+    if (type == HTTP_APACHE && t + 1 != end) {
+        return -1;
+    }
+    capture(&c[g], p, t);
+    return 0;
+}
+
+static int scan_apache(const char *p, const char *end,
+                       struct native_capture *c)
+{
+    return scan_http(p, end, HTTP_APACHE, c);
+}
+
+static int scan_apache2(const char *p, const char *end,
+                        struct native_capture *c)
+{
+    return scan_http(p, end, HTTP_APACHE2, c);
+}
+
+static int scan_nginx(const char *p, const char *end,
+                      struct native_capture *c)
+{
+    return scan_http(p, end, HTTP_NGINX, c);
+}
+
+static int scan_syslog_rfc5424(const char *p, const char *end,
+                               struct native_capture *c)
+{
+    const char *t;
+
+    if (p == end || *p != '<') {
+        return -1;
+    }
+    p++;
+
+    t = p;                                              /* pri */
+    while (t < end && is_digit(*t)) {
+        t++;
+    }
+    if (t == p || t - p > 5 || t == end || *t != '>') {
+        return -1;
+    }
+    capture(&c[1], p, t);
+    p = t + 1;
+
+    if (end - p < 2 || p[0] != '1' || p[1] != ' ') {
+        return -1;
+    }
+    p += 2;
+
+    p = token_nonempty(p, end, &c[2]);                  /* time */
+    if (p) {
+        p = token_nonempty(p, end, &c[3]);              /* host */
+    }
+    if (p) {
+        p = token_nonempty(p, end, &c[4]);              /* ident */
+    }
+    if (p) {
+        p = token_nonempty(p, end, &c[5]);              /* pid */
+    }
+    if (!p) {
+        return -1;
+    }
+    for (t = c[5].val; t < c[5].val + c[5].len; t++) {
+        if (*t != '-' && !is_digit(*t)) {
+            return -1;
+        }
+    }
+
+    p = token_nonempty(p, end, &c[6]);                  /* msgid */
+    if (!p || p == end) {
+        return -1;
+    }
+
+    /* extradata: '-' or the longest '[...]' followed by a message */
+    if (*p == '-') {
+        if (end - p < 3 || p[1] != ' ') {
+            return -1;
+        }
+        t = p + 1;
+    }
+    else if (*p == '[') {
+        for (t = end - 2; t > p; t--) {
+            if (t[-1] == ']' && t[0] == ' ') {
+                break;
+            }
+        }
+        if (t <= p) {
+            return -1;
+        }
+    }
+    else {
+        return -1;
+    }
+    capture(&c[7], p, t);
+    capture(&c[8], t + 1, end);                         /* message */
+
+    return 0;
+}
+
+static inline int is_ident(char c)
+{
+    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            is_digit(c) || c == '_' || c == '/' || c == '.' || c == '-');
+}
+
+/* rfc3164 patterns, with or without the host field */
+static int scan_rfc3164(const char *p, const char *end, int host,
+                        struct native_capture *c)
+{
+    int g = 1;
+    const char *s;
+    const char *t;
+
+    if (p == end || *p != '<') {
+        return -1;
+    }
+    p++;
+
+    t = p;                                              /* pri */
+    while (t < end && is_digit(*t)) {
+        t++;
+    }
+    if (t == p || t == end || *t != '>') {
+        return -1;
+    }
+    capture(&c[g++], p, t);
+    p = t + 1;
+
+    /* time: 'Mmm dd hh:mm:ss' where the day may be padded with a space */
+    s = p;
+    p = token_nonempty(p, end, NULL);
+    if (!p) {
+        return -1;
+    }
+    if (p < end && *p == ' ') {
+        p++;
+    }
+    p = token_nonempty(p, end, NULL);
+    if (!p) {
+        return -1;
+    }
+    if (p == end || *p == ' ') {
+        return -1;
+    }
+    t = memchr(p, ' ', end - p);
+    if (!t) {
+        return -1;
+    }
+    capture(&c[g++], s, t);
+    p = t + 1;
+
+    if (host == FLB_TRUE) {
+        p = token(p, end, &c[g++]);                     /* host */
+        if (!p) {
+            return -1;
+        }
+    }
+
+    t = p;                                              /* ident */
+    while (t < end && is_ident(*t)) {
+        t++;
+    }
+    capture(&c[g++], p, t);
+    p = t;
+
+    if (p < end && *p == '[') {                         /* pid */
+        t = p + 1;
+        while (t < end && is_digit(*t)) {
+            t++;
+        }
+        if (t > p + 1 && t < end && *t == ']') {
+            capture(&c[g], p + 1, t);
+            p = t + 1;
+        }
+    }
+    g++;
+
+    /* anything up to the first colon, then the message */
+    t = memchr(p, ':', end - p);
+    if (t) {
+        p = t + 1;
+    }
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    capture(&c[g], p, end);
+
+    return 0;
+}
+
+static int scan_syslog_rfc3164(const char *p, const char *end,
+                               struct native_capture *c)
+{
+    return scan_rfc3164(p, end, FLB_TRUE, c);
+}
+
+static int scan_syslog_rfc3164_local(const char *p, const char *end,
+                                     struct native_capture *c)
+{
+    return scan_rfc3164(p, end, FLB_FALSE, c);
+}
+
+static int scan_cri(const char *p, const char *end,
+                    struct native_capture *c)
+{
+    const char *t;
+
+    p = token_nonempty(p, end, &c[1]);                  /* time */
+    if (!p || end - p < 7) {
+        return -1;
+    }
+
+    if (memcmp(p, "stdout ", 7) != 0 && memcmp(p, "stderr ", 7) != 0) {
+        return -1;
+    }
+    capture(&c[2], p, p + 6);                           /* stream */
+    p += 7;
+
+    t = memchr(p, ' ', end - p);                        /* logtag */
+    if (!t) {
+        return -1;
+    }
+    capture(&c[3], p, t);
+    capture(&c[4], t + 1, end);                         /* message */
+
+    return 0;
+}
+
+static struct native_format native_formats[] = {
+    {
+        "apache",
+        "^(?<host>[^ ]*) [^ ]* (?<user>[^ ]*) \\[(?<time>[^\\]]*)\\] "
+        "\"(?<method>\\S+)(?: +(?<path>[^\\\"]*?)(?: +\\S*)?)?\" "
+        "(?<code>[^ ]*) (?<size>[^ ]*)"
+        "(?: \"(?<referer>[^\\\"]*)\" \"(?<agent>[^\\\"]*)\")?$",
+        scan_apache
+    },
+    {
+        "apache2",
+        "^(?<host>[^ ]*) [^ ]* (?<user>[^ ]*) \\[(?<time>[^\\]]*)\\] "
+        "\"(?<method>\\S+)(?: +(?<path>[^ ]*) +\\S*)?\" "
+        "(?<code>[^ ]*) (?<size>[^ ]*)"
+        "(?: \"(?<referer>[^\\\"]*)\" \"(?<agent>.*)\")?$",
+        scan_apache2
+    },
+    {
+        "nginx",
+        "^(?<remote>[^ ]*) (?<host>[^ ]*) (?<user>[^ ]*) "
+        "\\[(?<time>[^\\]]*)\\] "
+        "\"(?<method>\\S+)(?: +(?<path>[^\\\"]*?)(?: +\\S*)?)?\" "
+        "(?<code>[^ ]*) (?<size>[^ ]*)"
+        "(?: \"(?<referer>[^\\\"]*)\" \"(?<agent>[^\\\"]*)\")",
+        scan_nginx
+    },
+    {
+        "syslog-rfc5424",
+        "^\\<(?<pri>[0-9]{1,5})\\>1 (?<time>[^ ]+) (?<host>[^ ]+) "
+        "(?<ident>[^ ]+) (?<pid>[-0-9]+) (?<msgid>[^ ]+) "
+        "(?<extradata>(\\[(.*)\\]|-)) (?<message>.+)$",
+        scan_syslog_rfc5424
+    },
+    {
+        "syslog-rfc3164",
+        "^\\<(?<pri>[0-9]+)\\>(?<time>[^ ]* {1,2}[^ ]* [^ ]*) "
+        "(?<host>[^ ]*) (?<ident>[a-zA-Z0-9_\\/\\.\\-]*)"
+        "(?:\\[(?<pid>[0-9]+)\\])?(?:[^\\:]*\\:)? *(?<message>.*)$",
+        scan_syslog_rfc3164
+    },
+    {
+        "syslog-rfc3164-local",
+        "^\\<(?<pri>[0-9]+)\\>(?<time>[^ ]* {1,2}[^ ]* [^ ]*) "
+        "(?<ident>[a-zA-Z0-9_\\/\\.\\-]*)"
+        "(?:\\[(?<pid>[0-9]+)\\])?(?:[^\\:]*\\:)? *(?<message>.*)$",
+        scan_syslog_rfc3164_local
+    },
+    {
+        "cri",
+        "^(?<time>[^ ]+) (?<stream>stdout|stderr) (?<logtag>[^ ]*) "
+        "(?<message>.*)$",
+        scan_cri
+    },
+    { 0 }
+};
+
+/*
+ * Configure a native parser for the format 'name'. The equivalent regex
+ * is compiled too: it defines the record fields and handles the lines
+ * the scanner does not accept.
+ */
+int flb_parser_native_create(struct flb_parser *parser, const char *name)
+{
+    int i;
+    struct native_format *fmt = NULL;
+
+    for (i = 0; native_formats[i].name != NULL; i++) {
+        if (strcasecmp(native_formats[i].name, name) == 0) {
+            fmt = &native_formats[i];
+            break;
+        }
+    }
+
+    if (!fmt) {
+        flb_error("[parser:%s] unknown native format '%s'",
+                  parser->name, name);
+        return -1;
+    }
+
+    parser->regex = flb_regex_create(fmt->pattern);
+    if (!parser->regex) {
+        return -1;
+    }
+    parser->p_regex = flb_strdup(fmt->pattern);
+    parser->native = i;
+
+    return 0;
+}
+
+static int native_group_get(void *data, int group,
+                            const char **val, size_t *len)
+{
+    struct native_capture *c = data;
+
+    if (group > NATIVE_MAX_GROUPS || c[group].val == NULL) {
+        return -1;
+    }
+
+    *val = c[group].val;
+    *len = c[group].len;
+    return 0;
+}
+
+int flb_parser_native_do(struct flb_parser *parser,
+                         const char *buf, size_t length,
+                         void **out_buf, size_t *out_size,
+                         struct flb_time *out_time)
+{
+    int ret;
+    struct native_format *fmt;
+    struct native_capture caps[NATIVE_MAX_GROUPS + 1];
+
+    fmt = &native_formats[parser->native];
+    memset(caps, '\0', sizeof(caps));
+
+    ret = line_check(buf, length);
+    if (ret == 0) {
+        ret = fmt->scan(buf, buf + length, caps);
+    }
+
+    if (ret == -1) {
+        return flb_parser_regex_do(parser, buf, length,
+                                   out_buf, out_size, out_time);
+    }
+
+    return flb_parser_regex_pack(parser, buf, parser->fields_len,
+                                 native_group_get, caps,
+                                 out_buf, out_size, out_time);
+}
@@ -26,6 +26,8 @@
 #include <fluent-bit/flb_parser_decoder.h>
 #include <fluent-bit/flb_regex.h>
 #include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
 
 #include <msgpack.h>
 
@@ -33,36 +35,90 @@
 #define pack_uint16(buf, d) _msgpack_store16(buf, (uint16_t) d)
 #define pack_uint32(buf, d) _msgpack_store32(buf, (uint32_t) d)
 
-struct regex_cb_ctx {
-    int num_skipped;
-    time_t time_lookup;
-    time_t time_now;
-    double time_frac;
-    struct flb_parser *parser;
-    msgpack_packer *pck;
-};
-
-static void cb_results(const char *name, const char *value,
-                       size_t vlen, void *data)
+/* Compose the msgpack string header and body for a field name */
+static char *pack_key(const char *name, int len, int *size)
 {
-    int len;
-    int ret;
-    double frac = 0;
+    int hdr;
+    char *buf;
+    char *p;
+
+    if (len < 32) {
+        hdr = 1;
+    }
+    else if (len < 256) {
+        hdr = 2;
+    }
+    else if (len < 65536) {
+        hdr = 3;
+    }
+    else {
+        hdr = 5;
+    }
+
+    buf = flb_malloc(hdr + len);
+    if (!buf) {
+        flb_errno();
+        return NULL;
+    }
+
+    p = buf;
+    if (hdr == 1) {
+        *p++ = (uint8_t) (0xa0 | len);
+    }
+    else if (hdr == 2) {
+        *p++ = (uint8_t) 0xd9;
+        *p++ = (uint8_t) len;
+    }
+    else if (hdr == 3) {
+        *p++ = (uint8_t) 0xda;
+        pack_uint16(p, len);
+        p += 2;
+    }
+    else {
+        *p++ = (uint8_t) 0xdb;
+        pack_uint32(p, len);
+        p += 4;
+    }
+    memcpy(p, name, len);
+
+    *size = hdr + len;
+    return buf;
+}
+
+static int cb_field(const char *name, int name_len, int group, void *data)
+{
+    int i;
     char *time_key;
-    char tmp[255];
-    struct regex_cb_ctx *pcb = data;
-    struct flb_parser *parser = pcb->parser;
-    struct tm tm = {0};
-    (void) data;
+    struct flb_parser *parser = data;
+    struct flb_parser_field *fields;
+    struct flb_parser_field *f;
 
-    if (vlen == 0) {
-        pcb->num_skipped++;
-        return;
+    fields = flb_realloc(parser->fields,
+                         sizeof(struct flb_parser_field) *
+                         (parser->fields_len + 1));
+    if (!fields) {
+        flb_errno();
+        return -1;
     }
+    parser->fields = fields;
 
-    len = strlen(name);
+    f = &fields[parser->fields_len];
+    memset(f, '\0', sizeof(struct flb_parser_field));
+
+    f->name = flb_strndup(name, name_len);
+    if (!f->name) {
+        return -1;
+    }
+    f->name_len = name_len;
+    f->group = group;
+    parser->fields_len++;
+
+    f->key = pack_key(name, name_len, &f->key_size);
+    if (!f->key) {
+        return -1;
+    }
 
-    /* Check if there is a time lookup field */
+    /* Time lookup field */
     if (parser->time_fmt) {
         if (parser->time_key) {
             time_key = parser->time_key;
@@ -71,88 +127,155 @@ static void cb_results(const char *name, const char *value,
             time_key = "time";
         }
 
-        if (strcmp(name, time_key) == 0) {
-            /* Lookup time */
-            ret = flb_parser_time_lookup(value, vlen,
-                                         pcb->time_now, parser, &tm, &frac);
-            if (ret == -1) {
-                if (vlen > sizeof(tmp) - 1) {
-                    vlen = sizeof(tmp) - 1;
-                }
-                memcpy(tmp, value, vlen);
-                tmp[vlen] = '\0';
-                flb_warn("[parser:%s] Invalid time format %s for '%s'.",
-                         parser->name, parser->time_fmt, tmp);
-                pcb->num_skipped++;
-                return;
-            }
-
-            pcb->time_frac = frac;
-            pcb->time_lookup = flb_parser_tm2time(&tm);
+        if (strcmp(f->name, time_key) == 0) {
+            f->is_time = FLB_TRUE;
+        }
+    }
 
-            if (parser->time_keep == FLB_FALSE) {
-                pcb->num_skipped++;
-                return;
-            }
+    /* Type casting */
+    for (i = 0; i < parser->types_len; i++) {
+        if (parser->types[i].key != NULL &&
+            parser->types[i].key_len == name_len &&
+            strncmp(parser->types[i].key, name, name_len) == 0) {
+            f->type = parser->types[i].type;
+            break;
         }
     }
 
-    if (parser->types_len != 0) {
-        flb_parser_typecast(name, len,
-                            value, vlen,
-                            pcb->pck,
-                            parser->types,
-                            parser->types_len);
+    return 0;
+}
+
+/*
+ * Resolve what to do with every named capture of the pattern: time lookup,
+ * type casting or plain string, and pre-pack the keys. This way parsing a
+ * line only requires to pack the values.
+ */
+int flb_parser_regex_fields_create(struct flb_parser *parser)
+{
+    int ret;
+
+    ret = flb_regex_groups(parser->regex, cb_field, parser);
+    if (ret == -1) {
+        flb_error("[parser:%s] cannot prepare regex fields", parser->name);
+        return -1;
     }
-    else {
-        msgpack_pack_str(pcb->pck, len);
-        msgpack_pack_str_body(pcb->pck, name, len);
-        msgpack_pack_str(pcb->pck, vlen);
-        msgpack_pack_str_body(pcb->pck, value, vlen);
+    return 0;
+}
+
+void flb_parser_regex_fields_destroy(struct flb_parser *parser)
+{
+    int i;
+
+    for (i = 0; i < parser->fields_len; i++) {
+        flb_free(parser->fields[i].name);
+        flb_free(parser->fields[i].key);
     }
+    flb_free(parser->fields);
+    parser->fields = NULL;
+    parser->fields_len = 0;
 }
 
-int flb_parser_regex_do(struct flb_parser *parser,
-                        const char *buf, size_t length,
-                        void **out_buf, size_t *out_size,
-                        struct flb_time *out_time)
+static int regex_group_get(void *data, int group,
+                           const char **val, size_t *len)
 {
+    return flb_regex_group_get(data, group, val, len);
+}
+
+/*
+ * Pack the fields of the parser as a map. The value of every field is
+ * retrieved through cb_get() by capture group number, it returns -1 if the
+ * group did not participate in the match. This is shared by the regex
+ * parser and the native scanners, which emit the very same records.
+ */
+int flb_parser_regex_pack(struct flb_parser *parser, const char *buf,
+                          int map_size,
+                          int (*cb_get)(void *, int, const char **, size_t *),
+                          void *data,
+                          void **out_buf, size_t *out_size,
+                          struct flb_time *out_time)
+{
+    int i;
     int ret;
     int arr_size;
-    int last_byte;
-    ssize_t n;
+    int last_byte = -1;
+    int num_skipped = 0;
+    size_t vlen;
     size_t dec_out_size;
     char *dec_out_buf;
     char *tmp;
-    struct flb_regex_search result;
-    struct regex_cb_ctx pcb;
+    char tmp_val[255];
+    const char *val;
+    double time_frac = 0;
+    double frac;
+    time_t time_lookup = 0;
+    time_t epoch;
+    struct flb_parser_field *f;
     struct flb_time *t;
     msgpack_sbuffer tmp_sbuf;
     msgpack_packer tmp_pck;
 
-    n = flb_regex_do(parser->regex, buf, length, &result);
-    if (n <= 0) {
-        return -1;
-    }
-
     /* Prepare new outgoing buffer */
     msgpack_sbuffer_init(&tmp_sbuf);
     msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
 
     /* Set a Map size with the exact number of matches returned by regex */
-    arr_size = n;
+    arr_size = map_size;
     msgpack_pack_map(&tmp_pck, arr_size);
 
-    /* Callback context */
-    pcb.pck = &tmp_pck;
-    pcb.parser = parser;
-    pcb.num_skipped = 0;
-    pcb.time_lookup = 0;
-    pcb.time_frac = 0;
-    pcb.time_now = time(NULL);
+    /* Iterate named captures and compose new buffer */
+    for (i = 0; i < parser->fields_len; i++) {
+        f = &parser->fields[i];
+
+        ret = cb_get(data, f->group, &val, &vlen);
+        if (ret == -1) {
+            num_skipped++;
+            continue;
+        }
+        last_byte = (val + vlen) - buf;
+
+        if (vlen == 0) {
+            num_skipped++;
+            continue;
+        }
+
+        if (f->is_time == FLB_TRUE) {
+            /* Lookup time */
+            ret = flb_parser_time_lookup_epoch(val, vlen, 0, parser,
+                                               &epoch, &frac);
+            if (ret == -1) {
+                if (vlen > sizeof(tmp_val) - 1) {
+                    vlen = sizeof(tmp_val) - 1;
+                }
+                memcpy(tmp_val, val, vlen);
+                tmp_val[vlen] = '\0';
+                flb_warn("[parser:%s] Invalid time format %s for '%s'.",
+                         parser->name, parser->time_fmt, tmp_val);
+                num_skipped++;
+                continue;
+            }
+
+            time_frac = frac;
+            time_lookup = epoch;
+
+            if (parser->time_keep == FLB_FALSE) {
+                num_skipped++;
+                continue;
+            }
+        }
+
+        /* the key was packed when the parser was created */
+        msgpack_pack_str_body(&tmp_pck, f->key, f->key_size);
+
+        if (f->type != 0) {
+            flb_parser_typecast_value(f->name, f->name_len, f->type,
+                                      val, vlen, &tmp_pck);
+        }
+        else {
+            msgpack_pack_str(&tmp_pck, vlen);
+            msgpack_pack_str_body(&tmp_pck, val, vlen);
+        }
+    }
 
-    /* Iterate results and compose new buffer */
-    last_byte = flb_regex_parse(parser->regex, &result, cb_results, &pcb);
     if (last_byte == -1) {
         msgpack_sbuffer_destroy(&tmp_sbuf);
         return -1;
@@ -180,9 +303,9 @@ int flb_parser_regex_do(struct flb_parser *parser,
      * to use internal msgpack api functions since packing the bytes
      * in Big-Endian is a requirement.
      */
-     if (pcb.num_skipped > 0) {
+     if (num_skipped > 0) {
 
-        arr_size = (n - pcb.num_skipped);
+        arr_size = (map_size - num_skipped);
 
         tmp = tmp_sbuf.data;
         uint8_t h = tmp[0];
@@ -204,8 +327,8 @@ int flb_parser_regex_do(struct flb_parser *parser,
     *out_size = tmp_sbuf.size;
 
     t = out_time;
-    t->tm.tv_sec  = pcb.time_lookup;
-    t->tm.tv_nsec = (pcb.time_frac * 1000000000);
+    t->tm.tv_sec  = time_lookup;
+    t->tm.tv_nsec = (time_frac * 1000000000);
 
     /* Check if some decoder was specified */
     if (parser->decoders) {
@@ -226,3 +349,24 @@ int flb_parser_regex_do(struct flb_parser *parser,
      */
     return last_byte;
 }
+
+int flb_parser_regex_do(struct flb_parser *parser,
+                        const char *buf, size_t length,
+                        void **out_buf, size_t *out_size,
+                        struct flb_time *out_time)
+{
+    int ret;
+    ssize_t n;
+    struct flb_regex_search result;
+
+    n = flb_regex_do(parser->regex, buf, length, &result);
+    if (n <= 0) {
+        return -1;
+    }
+
+    ret = flb_parser_regex_pack(parser, buf, n, regex_group_get, &result,
+                                out_buf, out_size, out_time);
+    flb_regex_results_release(&result);
+
+    return ret;
+}
@@ -41,7 +41,6 @@ cb_onig_named(const UChar *name, const UChar *name_end,
 
     for (i = 0; i < ngroup_num; i++) {
         gn = group_nums[i];
-        onig_name_to_backref_number(reg, name, name_end, region);
 
         if (s->cb_match) {
             s->cb_match((const char *)name,
@@ -209,6 +208,78 @@ int flb_regex_parse(struct flb_regex *r, struct flb_regex_search *result,
     return -1;
 }
 
+struct regex_groups_ctx {
+    int (*cb_group) (const char *, int, int, void *);
+    void *data;
+};
+
+static int cb_onig_groups(const UChar *name, const UChar *name_end,
+                          int ngroup_num, int *group_nums,
+                          regex_t *reg, void *data)
+{
+    int i;
+    int ret;
+    struct regex_groups_ctx *ctx = data;
+
+    for (i = 0; i < ngroup_num; i++) {
+        ret = ctx->cb_group((const char *) name, name_end - name,
+                           group_nums[i], ctx->data);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Invoke the callback for every named group of the pattern, in the same
+ * order used by flb_regex_parse(). Group numbers can be used later with
+ * flb_regex_group_get().
+ */
+int flb_regex_groups(struct flb_regex *r,
+                     int (*cb_group) (const char *, int, /* name  */
+                                      int,               /* group */
+                                      void *),           /* caller data */
+                     void *data)
+{
+    int ret;
+    struct regex_groups_ctx ctx;
+
+    ctx.cb_group = cb_group;
+    ctx.data = data;
+
+    ret = onig_foreach_name(r->regex, cb_onig_groups, &ctx);
+    if (ret != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Get the value captured by a group, returns -1 if it did not match */
+int flb_regex_group_get(struct flb_regex_search *result, int group,
+                        const char **val, size_t *len)
+{
+    OnigRegion *region = result->region;
+
+    if (group >= region->num_regs || region->end[group] < 0) {
+        return -1;
+    }
+
+    *val = result->str + region->beg[group];
+    *len = region->end[group] - region->beg[group];
+    return 0;
+}
+
+/* Release the results of flb_regex_do() when flb_regex_parse() is not used */
+void flb_regex_results_release(struct flb_regex_search *result)
+{
+    if (result->region) {
+        onig_region_free(result->region, 1);
+        result->region = NULL;
+    }
+}
+
 int flb_regex_destroy(struct flb_regex *r)
 {
     onig_free(r->regex);
@@ -298,6 +298,8 @@ struct flb_task *flb_task_create(uint64_t ref_id,
             }
 
             route->out = o_ins;
+            route->batch_parts = 0;
+            route->batch_done = NULL;
             mk_list_add(&route->_head, &task->routes);
             count++;
 
@@ -335,6 +337,9 @@ void flb_task_destroy(struct flb_task *task, int del)
     mk_list_foreach_safe(head, tmp, &task->routes) {
         route = mk_list_entry(head, struct flb_task_route, _head);
         mk_list_del(&route->_head);
+        if (route->batch_done) {
+            flb_free(route->batch_done);
+        }
         flb_free(route);
     }
 
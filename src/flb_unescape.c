@@ -26,6 +26,17 @@
 #include <string.h>
 #include <inttypes.h>
 
+#if defined(FLB_HAVE_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define UNESCAPE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <fluent-bit/flb_bits.h>
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGH  0x8080808080808080ULL
+#define SWAR_ZERO(v)  (((v) - SWAR_ONES) & ~(v) & SWAR_HIGH)
+
 static int octal_digit(char c)
 {
     return (c >= '0' && c <= '7');
@@ -122,11 +133,56 @@ static int u8_read_escape_sequence(const char *str, uint32_t *dest)
     return i;
 }
 
+/*
+ * Length of the leading run of 'str' that has neither a backslash nor a
+ * NULL byte, so it can be copied as it is.
+ */
+static inline size_t unescape_run(const char *str, size_t len)
+{
+    size_t i = 0;
+    uint64_t v;
+#ifdef UNESCAPE_SSE2
+    int mask;
+    __m128i in;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    for (; i + 16 <= len; i += 16) {
+        in = _mm_loadu_si128((const __m128i *) (str + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(in, zero),
+                                              _mm_cmpeq_epi8(in, backslash)));
+        if (mask != 0) {
+            return i + flb_bits_ctz64(mask);
+        }
+    }
+#endif
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&v, str + i, 8);
+        if (SWAR_ZERO(v) || SWAR_ZERO(v ^ (SWAR_ONES * '\\'))) {
+            break;
+        }
+    }
+
+    for (; i < len; i++) {
+        if (str[i] == '\\' || str[i] == '\0') {
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * Unescape 'sz' bytes of 'in_buf' into 'out_buf', decoding \uXXXX and
+ * similar sequences to UTF-8. The output is never longer than the input,
+ * 'out_buf' can be 'in_buf' itself to decode in place.
+ */
 int flb_unescape_string_utf8(const char *in_buf, int sz, char *out_buf)
 {
     uint32_t ch;
     char temp[4];
     const char *next;
+    size_t run;
 
     int count_out = 0;
     int count_in = 0;
@@ -134,6 +190,18 @@ int flb_unescape_string_utf8(const char *in_buf, int sz, char *out_buf)
     int esc_out = 0;
 
     while (*in_buf && count_in < sz) {
+        /* copy everything up to the next escape sequence at once */
+        run = unescape_run(in_buf, sz - count_in);
+        if (run > 0) {
+            if (out_buf + count_out != in_buf) {
+                memmove(out_buf + count_out, in_buf, run);
+            }
+            in_buf += run;
+            count_in += run;
+            count_out += run;
+            continue;
+        }
+
         next = in_buf + 1;
 
         if (*in_buf == '\\') {
@@ -203,15 +271,33 @@ int flb_unescape_string_utf8(const char *in_buf, int sz, char *out_buf)
     return count_out;
 }
 
+/*
+ * Unescape 'buf' into '*unesc_buf', which can be 'buf' itself to decode
+ * in place.
+ */
 int flb_unescape_string(const char *buf, int buf_len, char **unesc_buf)
 {
     int i = 0;
     int j = 0;
+    int run;
     char *p;
     char n;
+    const char *esc;
 
     p = *unesc_buf;
     while (i < buf_len) {
+        /* copy everything up to the next backslash at once */
+        esc = memchr(buf + i, '\\', buf_len - i);
+        run = esc ? esc - (buf + i) : buf_len - i;
+        if (run > 0) {
+            if (p + j != buf + i) {
+                memmove(p + j, buf + i, run);
+            }
+            i += run;
+            j += run;
+            continue;
+        }
+
         if (buf[i] == '\\') {
             if (i + 1 < buf_len) {
                 n = buf[i + 1];
@@ -0,0 +1,594 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_input_listener.h>
+#include <msgpack.h>
+
+#include "../../plugins/in_forward/fw.h"
+#include "../../plugins/in_forward/fw_conn.h"
+#include "../../plugins/in_forward/fw_prot.h"
+
+#include "flb_tests_internal.h"
+
+#define TEST_TAG        "test"
+#define TEST_FRAMES     64
+
+/* Raw frame from a string literal */
+#define FRAME(name, data)   {name, data, sizeof(data) - 1}
+
+/*
+ * A connection handled by a listener that is not running: fw_prot_process()
+ * queues the records and the test reads them back from the queue.
+ */
+struct fw_test {
+    struct flb_input_listeners ls;
+    struct flb_input_listener lst;
+    struct flb_in_fw_config cfg;
+    struct fw_conn conn;
+    int next;                     /* next record number expected */
+};
+
+/* A stream of frames: the offset where each frame ends and its records */
+struct fw_stream {
+    msgpack_sbuffer sbuf;
+    int frames;
+    size_t end[TEST_FRAMES];
+    int records[TEST_FRAMES];
+    int total;
+};
+
+static void fw_test_init(struct fw_test *t, size_t max_size)
+{
+    memset(t, '\0', sizeof(struct fw_test));
+
+    t->ls.config = flb_config_init();
+    TEST_CHECK(t->ls.config != NULL);
+    t->ls.running = FLB_TRUE;
+    t->ls.notified = FLB_TRUE;        /* never write the notify pipe */
+    t->lst.parent = &t->ls;
+    t->lst.queue = flb_calloc(FLB_INPUT_LISTENER_QUEUE,
+                              sizeof(struct flb_input_listener_msg));
+    TEST_CHECK(t->lst.queue != NULL);
+
+    t->cfg.buffer_chunk_size = 1024;
+    t->cfg.buffer_max_size = max_size;
+
+    t->conn.ctx = &t->cfg;
+    t->conn.lst = &t->lst;
+    t->conn.buf = flb_malloc(1024);
+    t->conn.buf_size = 1024;
+}
+
+/* Read back the queued records, -1 if any of them is not the expected one */
+static int fw_test_drain(struct fw_test *t)
+{
+    int ret;
+    int count = 0;
+    int invalid = FLB_FALSE;
+    size_t off;
+    msgpack_object *obj;
+    msgpack_object_kv *kv;
+    msgpack_unpacked result;
+    struct flb_input_listener_msg *msg;
+
+    while (t->lst.q_tail != t->lst.q_head) {
+        msg = &t->lst.queue[t->lst.q_tail % FLB_INPUT_LISTENER_QUEUE];
+
+        if (msg->tag_len != sizeof(TEST_TAG) - 1 ||
+            memcmp(msg->tag, TEST_TAG, msg->tag_len) != 0) {
+            invalid = FLB_TRUE;
+        }
+
+        off = 0;
+        msgpack_unpacked_init(&result);
+        while ((ret = msgpack_unpack_next(&result, msg->buf, msg->size,
+                                          &off)) == MSGPACK_UNPACK_SUCCESS) {
+            /* [time, {"i": N, ...}] */
+            obj = &result.data;
+            if (obj->type != MSGPACK_OBJECT_ARRAY || obj->via.array.size != 2 ||
+                obj->via.array.ptr[1].type != MSGPACK_OBJECT_MAP ||
+                obj->via.array.ptr[1].via.map.size < 1) {
+                invalid = FLB_TRUE;
+                break;
+            }
+            kv = &obj->via.array.ptr[1].via.map.ptr[0];
+            if (kv->val.type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+                kv->val.via.u64 != t->next) {
+                invalid = FLB_TRUE;
+                break;
+            }
+            t->next++;
+            count++;
+        }
+        if (off != msg->size) {
+            invalid = FLB_TRUE;
+        }
+        msgpack_unpacked_destroy(&result);
+
+        flb_free(msg->buf);
+        flb_free(msg->tag);
+        t->lst.q_tail++;
+    }
+
+    return invalid ? -1 : count;
+}
+
+/* Append data to the connection buffer, like a read() would */
+static int fw_test_feed(struct fw_test *t, const char *data, size_t size)
+{
+    char *tmp;
+
+    if (t->conn.buf_len + size > t->conn.buf_size) {
+        tmp = flb_realloc(t->conn.buf, t->conn.buf_len + size);
+        TEST_CHECK(tmp != NULL);
+        t->conn.buf = tmp;
+        t->conn.buf_size = t->conn.buf_len + size;
+    }
+    memcpy(t->conn.buf + t->conn.buf_len, data, size);
+    t->conn.buf_len += size;
+
+    return fw_prot_process(&t->conn);
+}
+
+static void fw_test_destroy(struct fw_test *t)
+{
+    fw_test_drain(t);
+    flb_free(t->lst.queue);
+    flb_free(t->conn.buf);
+    flb_config_exit(t->ls.config);
+    if (t->conn.gz) {
+        flb_gzip_inflate_destroy(t->conn.gz);
+    }
+}
+
+static void pack_tag(msgpack_packer *pck)
+{
+    msgpack_pack_str(pck, sizeof(TEST_TAG) - 1);
+    msgpack_pack_str_body(pck, TEST_TAG, sizeof(TEST_TAG) - 1);
+}
+
+/* {"i": N, "msg": "..."} */
+static void pack_record(msgpack_packer *pck, int n)
+{
+    int len;
+    char msg[128];
+
+    len = snprintf(msg, sizeof(msg), "record number %i", n);
+    msgpack_pack_map(pck, 2);
+    msgpack_pack_str(pck, 1);
+    msgpack_pack_str_body(pck, "i", 1);
+    msgpack_pack_int(pck, n);
+    msgpack_pack_str(pck, 3);
+    msgpack_pack_str_body(pck, "msg", 3);
+    msgpack_pack_str(pck, len);
+    msgpack_pack_str_body(pck, msg, len);
+}
+
+/* Time as integer or as EventTime (extension type 0) */
+static void pack_time(msgpack_packer *pck, int event_time)
+{
+    char buf[8] = {0x5e, 0x0b, 0xe1, 0x00, 0x00, 0x00, 0x00, 0x10};
+
+    if (event_time) {
+        msgpack_pack_ext(pck, 8, 0);
+        msgpack_pack_ext_body(pck, buf, 8);
+    }
+    else {
+        msgpack_pack_uint32(pck, 1577836800);
+    }
+}
+
+static void pack_options(msgpack_packer *pck, const char *key, const char *val)
+{
+    msgpack_pack_map(pck, 1);
+    msgpack_pack_str(pck, strlen(key));
+    msgpack_pack_str_body(pck, key, strlen(key));
+    msgpack_pack_str(pck, strlen(val));
+    msgpack_pack_str_body(pck, val, strlen(val));
+}
+
+/* [time, record] entries, as used by Forward and PackedForward modes */
+static void pack_entries(msgpack_sbuffer *sbuf, int first, int count)
+{
+    int i;
+    msgpack_packer pck;
+
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < count; i++) {
+        msgpack_pack_array(&pck, 2);
+        pack_time(&pck, i % 2);
+        pack_record(&pck, first + i);
+    }
+}
+
+static void stream_frame_end(struct fw_stream *s, int records)
+{
+    s->end[s->frames] = s->sbuf.size;
+    s->records[s->frames] = records;
+    s->frames++;
+    s->total += records;
+}
+
+/* Message: [tag, time, record] or [tag, time, record, options] */
+static void stream_message(struct fw_stream *s, int event_time, int options)
+{
+    msgpack_packer pck;
+
+    msgpack_packer_init(&pck, &s->sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, options ? 4 : 3);
+    pack_tag(&pck);
+    pack_time(&pck, event_time);
+    pack_record(&pck, s->total);
+    if (options) {
+        pack_options(&pck, "chunk", "p8n9gmxTQVC8/nh2wlKKeQ==");
+    }
+    stream_frame_end(s, 1);
+}
+
+/* Forward: [tag, [entries], options?] */
+static void stream_forward(struct fw_stream *s, int count, int options)
+{
+    msgpack_packer pck;
+
+    msgpack_packer_init(&pck, &s->sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, options ? 3 : 2);
+    pack_tag(&pck);
+    msgpack_pack_array(&pck, count);
+    pack_entries(&s->sbuf, s->total, count);
+    if (options) {
+        pack_options(&pck, "chunk", "p8n9gmxTQVC8/nh2wlKKeQ==");
+    }
+    stream_frame_end(s, count);
+}
+
+/*
+ * PackedForward: [tag, bin|str, options?], with 'gzip' the entries are
+ * compressed (CompressedPackedForward).
+ */
+static void stream_packed(struct fw_stream *s, int count, int str, int gzip)
+{
+    int ret;
+    void *gz;
+    size_t gz_size;
+    msgpack_packer pck;
+    msgpack_sbuffer entries;
+
+    msgpack_sbuffer_init(&entries);
+    pack_entries(&entries, s->total, count);
+
+    msgpack_packer_init(&pck, &s->sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, (str || gzip) ? 3 : 2);
+    pack_tag(&pck);
+
+    if (gzip) {
+        ret = flb_gzip_compress(entries.data, entries.size, &gz, &gz_size);
+        TEST_CHECK(ret == 0);
+        msgpack_pack_bin(&pck, gz_size);
+        msgpack_pack_bin_body(&pck, gz, gz_size);
+        pack_options(&pck, "compressed", "gzip");
+        flb_free(gz);
+    }
+    else if (str) {
+        msgpack_pack_str(&pck, entries.size);
+        msgpack_pack_str_body(&pck, entries.data, entries.size);
+        pack_options(&pck, "size", "3");
+    }
+    else {
+        msgpack_pack_bin(&pck, entries.size);
+        msgpack_pack_bin_body(&pck, entries.data, entries.size);
+    }
+    msgpack_sbuffer_destroy(&entries);
+
+    stream_frame_end(s, count);
+}
+
+/* One frame of every mode, with and without options */
+static void stream_create(struct fw_stream *s)
+{
+    memset(s, '\0', sizeof(struct fw_stream));
+    msgpack_sbuffer_init(&s->sbuf);
+
+    stream_message(s, FLB_FALSE, FLB_FALSE);
+    stream_message(s, FLB_TRUE, FLB_FALSE);
+    stream_message(s, FLB_FALSE, FLB_TRUE);
+    stream_forward(s, 3, FLB_FALSE);
+    stream_forward(s, 4, FLB_TRUE);
+    stream_packed(s, 3, FLB_FALSE, FLB_FALSE);
+    stream_packed(s, 2, FLB_TRUE, FLB_FALSE);
+    stream_packed(s, 5, FLB_FALSE, FLB_TRUE);
+    stream_message(s, FLB_TRUE, FLB_TRUE);
+}
+
+/* Records and bytes of the frames complete in the first 'size' bytes */
+static int stream_complete(struct fw_stream *s, size_t size, size_t *bytes)
+{
+    int i;
+    int records = 0;
+
+    *bytes = 0;
+    for (i = 0; i < s->frames && s->end[i] <= size; i++) {
+        records += s->records[i];
+        *bytes = s->end[i];
+    }
+    return records;
+}
+
+void test_fw_modes()
+{
+    int ret;
+    struct fw_test t;
+    struct fw_stream s;
+
+    stream_create(&s);
+    fw_test_init(&t, 1024 * 1024);
+
+    ret = fw_test_feed(&t, s.sbuf.data, s.sbuf.size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(t.conn.buf_len == 0);
+
+    ret = fw_test_drain(&t);
+    TEST_CHECK(ret == s.total);
+    TEST_MSG("records: expected %i, got %i", s.total, ret);
+
+    fw_test_destroy(&t);
+    msgpack_sbuffer_destroy(&s.sbuf);
+}
+
+/* The stream is split at every byte offset */
+void test_fw_split()
+{
+    int ret;
+    int records;
+    size_t off;
+    size_t bytes;
+    struct fw_test t;
+    struct fw_stream s;
+
+    stream_create(&s);
+
+    for (off = 1; off < s.sbuf.size; off++) {
+        fw_test_init(&t, 1024 * 1024);
+
+        /* complete frames are consumed, the partial one is kept */
+        ret = fw_test_feed(&t, s.sbuf.data, off);
+        TEST_CHECK(ret == 0);
+        records = stream_complete(&s, off, &bytes);
+        ret = fw_test_drain(&t);
+        if (!TEST_CHECK(ret == records)) {
+            TEST_MSG("offset %zu: expected %i records, got %i",
+                     off, records, ret);
+        }
+        if (!TEST_CHECK(t.conn.buf_len == off - bytes)) {
+            TEST_MSG("offset %zu: expected %zu pending bytes, got %i",
+                     off, off - bytes, t.conn.buf_len);
+        }
+
+        ret = fw_test_feed(&t, s.sbuf.data + off, s.sbuf.size - off);
+        TEST_CHECK(ret == 0);
+        ret = fw_test_drain(&t);
+        TEST_CHECK(ret == s.total - records);
+        TEST_CHECK(t.conn.buf_len == 0);
+
+        fw_test_destroy(&t);
+    }
+
+    msgpack_sbuffer_destroy(&s.sbuf);
+}
+
+/* One byte per read */
+void test_fw_byte_by_byte()
+{
+    int ret;
+    int records = 0;
+    size_t off;
+    struct fw_test t;
+    struct fw_stream s;
+
+    stream_create(&s);
+    fw_test_init(&t, 1024 * 1024);
+
+    for (off = 0; off < s.sbuf.size; off++) {
+        ret = fw_test_feed(&t, s.sbuf.data + off, 1);
+        TEST_CHECK(ret == 0);
+        ret = fw_test_drain(&t);
+        TEST_CHECK(ret >= 0);
+        records += ret;
+    }
+    TEST_CHECK(records == s.total);
+    TEST_CHECK(t.conn.buf_len == 0);
+
+    fw_test_destroy(&t);
+    msgpack_sbuffer_destroy(&s.sbuf);
+}
+
+/* Frames that must close the connection */
+void test_fw_invalid()
+{
+    int i;
+    int ret;
+    size_t len;
+    struct fw_test t;
+    struct fw_stream s;
+    struct {
+        const char *name;
+        const char *data;
+        size_t size;
+    } frames[] = {
+        /* {"a": 1} */
+        FRAME("map", "\x81\xa1" "a" "\x01"),
+        /* ["test"] */
+        FRAME("one item", "\x91\xa4" "test"),
+        /* [1, 2, {}] */
+        FRAME("tag type", "\x93\x01\x02\x80"),
+        /* never used type */
+        FRAME("type 0xc1", "\xc1"),
+        /* ["test", 1, "a"] */
+        FRAME("record type", "\x93\xa4" "test" "\x01\xa1" "a"),
+        /* ["test", 1] */
+        FRAME("no record", "\x92\xa4" "test" "\x01"),
+        /* ["test", nil, {}] */
+        FRAME("entries type", "\x93\xa4" "test" "\xc0\x80"),
+        /* ["test", bin("abc"), {"compressed": "gzip"}] */
+        FRAME("bad gzip", "\x93\xa4" "test" "\xc4\x03" "abc"
+                          "\x81\xaa" "compressed" "\xa4" "gzip"),
+    };
+
+    for (i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+        fw_test_init(&t, 1024 * 1024);
+        ret = fw_test_feed(&t, frames[i].data, frames[i].size);
+        if (!TEST_CHECK(ret == -1)) {
+            TEST_MSG("frame '%s' was accepted", frames[i].name);
+        }
+        fw_test_destroy(&t);
+    }
+
+    /* Valid frames before an invalid one are still delivered */
+    stream_create(&s);
+    fw_test_init(&t, 1024 * 1024);
+    len = s.sbuf.size;
+    msgpack_sbuffer_write(&s.sbuf, frames[0].data, frames[0].size);
+    ret = fw_test_feed(&t, s.sbuf.data, s.sbuf.size);
+    TEST_CHECK(ret == -1);
+    ret = fw_test_drain(&t);
+    TEST_CHECK(ret == s.total);
+    TEST_MSG("records: expected %i, got %i (stream of %zu bytes)",
+             s.total, ret, len);
+    fw_test_destroy(&t);
+    msgpack_sbuffer_destroy(&s.sbuf);
+}
+
+/*
+ * Headers announcing huge objects: the framer waits for more data without
+ * allocating anything, the connection buffer limit applies.
+ */
+void test_fw_oversized()
+{
+    int i;
+    int ret;
+    struct fw_test t;
+    struct {
+        const char *name;
+        const char *data;
+        size_t size;
+    } frames[] = {
+        /* ["test", bin32(4GB) */
+        FRAME("bin32", "\x92\xa4" "test" "\xc6\xff\xff\xff\xff" "ab"),
+        /* ["test", str32(4GB) */
+        FRAME("str32", "\x92\xa4" "test" "\xdb\xff\xff\xff\xff" "ab"),
+        /* ["test", array32(4G items) */
+        FRAME("array32", "\x92\xa4" "test" "\xdd\xff\xff\xff\xff\x01\x02"),
+        /* array32(4G items) of maps32(4G items) */
+        FRAME("map32", "\xdd\xff\xff\xff\xff\xdf\xff\xff\xff\xff"),
+    };
+
+    for (i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+        fw_test_init(&t, 1024 * 1024);
+        ret = fw_test_feed(&t, frames[i].data, frames[i].size);
+        if (!TEST_CHECK(ret == 0 && t.conn.buf_len == frames[i].size)) {
+            TEST_MSG("frame '%s': ret=%i, pending %i bytes",
+                     frames[i].name, ret, t.conn.buf_len);
+        }
+        TEST_CHECK(fw_test_drain(&t) == 0);
+        fw_test_destroy(&t);
+    }
+}
+
+/* [tag, bin(gzip(entries)), {"compressed": "gzip"}] */
+static void frame_compressed(msgpack_sbuffer *sbuf, msgpack_sbuffer *entries)
+{
+    int ret;
+    void *gz;
+    size_t gz_size;
+    msgpack_packer pck;
+
+    ret = flb_gzip_compress(entries->data, entries->size, &gz, &gz_size);
+    TEST_CHECK(ret == 0);
+
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, 3);
+    pack_tag(&pck);
+    msgpack_pack_bin(&pck, gz_size);
+    msgpack_pack_bin_body(&pck, gz, gz_size);
+    pack_options(&pck, "compressed", "gzip");
+    flb_free(gz);
+}
+
+/*
+ * The decompressed data is limited by 'buffer_max_size' as the data read
+ * from the socket: it applies to a pending entry, not to the whole payload.
+ */
+void test_fw_inflate_limit()
+{
+    int ret;
+    char *big;
+    size_t big_size = 64 * 1024;
+    struct fw_test t;
+    msgpack_sbuffer frame;
+    msgpack_sbuffer entries;
+    msgpack_packer pck;
+
+    /* Many small entries, bigger than the limit all together */
+    msgpack_sbuffer_init(&entries);
+    msgpack_sbuffer_init(&frame);
+    pack_entries(&entries, 0, 1000);
+    TEST_CHECK(entries.size > 16384);
+    frame_compressed(&frame, &entries);
+
+    fw_test_init(&t, 16384);
+    ret = fw_test_feed(&t, frame.data, frame.size);
+    TEST_CHECK(ret == 0);
+    ret = fw_test_drain(&t);
+    TEST_CHECK(ret == 1000);
+    TEST_MSG("records: expected 1000, got %i", ret);
+    fw_test_destroy(&t);
+
+    /* One entry bigger than the limit */
+    big = flb_malloc(big_size);
+    TEST_CHECK(big != NULL);
+    memset(big, 'x', big_size);
+
+    msgpack_sbuffer_clear(&entries);
+    msgpack_sbuffer_clear(&frame);
+    msgpack_packer_init(&pck, &entries, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, 2);
+    pack_time(&pck, FLB_FALSE);
+    msgpack_pack_map(&pck, 2);
+    msgpack_pack_str(&pck, 1);
+    msgpack_pack_str_body(&pck, "i", 1);
+    msgpack_pack_int(&pck, 0);
+    msgpack_pack_str(&pck, 3);
+    msgpack_pack_str_body(&pck, "msg", 3);
+    msgpack_pack_str(&pck, big_size);
+    msgpack_pack_str_body(&pck, big, big_size);
+    flb_free(big);
+    frame_compressed(&frame, &entries);
+
+    fw_test_init(&t, 16384);
+    ret = fw_test_feed(&t, frame.data, frame.size);
+    TEST_CHECK(ret == -1);
+    TEST_CHECK(fw_test_drain(&t) == 0);
+    fw_test_destroy(&t);
+
+    /* Same frame, with a limit that fits it */
+    fw_test_init(&t, 128 * 1024);
+    ret = fw_test_feed(&t, frame.data, frame.size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(fw_test_drain(&t) == 1);
+    fw_test_destroy(&t);
+
+    msgpack_sbuffer_destroy(&entries);
+    msgpack_sbuffer_destroy(&frame);
+}
+
+TEST_LIST = {
+    {"modes",         test_fw_modes},
+    {"split",         test_fw_split},
+    {"byte_by_byte",  test_fw_byte_by_byte},
+    {"invalid",       test_fw_invalid},
+    {"oversized",     test_fw_oversized},
+    {"inflate_limit", test_fw_inflate_limit},
+    { 0 }
+};
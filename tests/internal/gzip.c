@@ -3,8 +3,11 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_gzip.h>
+#include <msgpack.h>
+#include <time.h>
 
 #include "flb_tests_internal.h"
+#include "../lib/bench.h"
 
 /* Sample data */
 char *morpheus = "This is your last chance. After this, there is no "
@@ -40,7 +43,598 @@ void test_compress()
     flb_free(str);
 }
 
+/* Collect inflated data */
+static int inflate_cb(const void *data, size_t size, void *cb_data)
+{
+    msgpack_sbuffer *sbuf = cb_data;
+
+    msgpack_sbuffer_write(sbuf, data, size);
+    return 0;
+}
+
+void test_deflate_inflate_ctx()
+{
+    int i;
+    int ret;
+    size_t len;
+    size_t total = 0;
+    void *zip[3];
+    size_t zip_len[3];
+    char *stream;
+    msgpack_sbuffer sbuf;
+    struct flb_gzip_deflate *def;
+    struct flb_gzip_inflate *inf;
+
+    def = flb_gzip_deflate_create(-1);
+    TEST_CHECK(def != NULL);
+
+    /* Reuse the same context for every member */
+    len = strlen(morpheus);
+    for (i = 0; i < 3; i++) {
+        ret = flb_gzip_deflate_compress(def, morpheus, len,
+                                        &zip[i], &zip_len[i]);
+        TEST_CHECK(ret == 0);
+        total += zip_len[i];
+    }
+    flb_gzip_deflate_destroy(def);
+
+    /* Concatenated members are a valid GZip stream */
+    stream = flb_malloc(total);
+    TEST_CHECK(stream != NULL);
+    total = 0;
+    for (i = 0; i < 3; i++) {
+        memcpy(stream + total, zip[i], zip_len[i]);
+        total += zip_len[i];
+        flb_free(zip[i]);
+    }
+
+    inf = flb_gzip_inflate_create();
+    TEST_CHECK(inf != NULL);
+
+    msgpack_sbuffer_init(&sbuf);
+    ret = flb_gzip_inflate_stream(inf, stream, total, inflate_cb, &sbuf);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(sbuf.size == len * 3);
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(memcmp(sbuf.data + (len * i), morpheus, len) == 0);
+    }
+    msgpack_sbuffer_destroy(&sbuf);
+
+    /* A corrupted checksum must be detected */
+    stream[total - 6] ^= 0xff;
+    msgpack_sbuffer_init(&sbuf);
+    ret = flb_gzip_inflate_stream(inf, stream, total, inflate_cb, &sbuf);
+    TEST_CHECK(ret == -1);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    flb_gzip_inflate_destroy(inf);
+    flb_free(stream);
+}
+
+/* Inflate a stream fed in small pieces, the way a growing file is read */
+static int inflate_pieces(char *stream, size_t total, msgpack_sbuffer *sbuf)
+{
+    size_t fed = 0;
+    size_t pos = 0;
+    size_t used;
+    ssize_t out;
+    char buf[16];
+    struct flb_gzip_inflate *inf;
+
+    inf = flb_gzip_inflate_create();
+    if (!inf) {
+        return -1;
+    }
+
+    while (1) {
+        out = flb_gzip_inflate_read(inf, stream + pos, fed - pos, &used,
+                                    buf, sizeof(buf));
+        if (out == -1) {
+            flb_gzip_inflate_destroy(inf);
+            return -1;
+        }
+        pos += used;
+        if (out > 0) {
+            msgpack_sbuffer_write(sbuf, buf, out);
+            continue;
+        }
+        if (fed == total) {
+            break;
+        }
+        fed += 7;
+        if (fed > total) {
+            fed = total;
+        }
+    }
+
+    flb_gzip_inflate_destroy(inf);
+    return (pos == total) ? 0 : -1;
+}
+
+void test_inflate_read()
+{
+    int i;
+    int ret;
+    size_t len;
+    size_t total = 0;
+    void *zip[2];
+    size_t zip_len[2];
+    char *stream;
+    msgpack_sbuffer sbuf;
+
+    len = strlen(morpheus);
+    for (i = 0; i < 2; i++) {
+        ret = flb_gzip_compress(morpheus, len, &zip[i], &zip_len[i]);
+        TEST_CHECK(ret == 0);
+        total += zip_len[i];
+    }
+
+    /* Two members followed by zero padding */
+    stream = flb_calloc(1, total + 4);
+    TEST_CHECK(stream != NULL);
+    total = 0;
+    for (i = 0; i < 2; i++) {
+        memcpy(stream + total, zip[i], zip_len[i]);
+        total += zip_len[i];
+        flb_free(zip[i]);
+    }
+
+    msgpack_sbuffer_init(&sbuf);
+    ret = inflate_pieces(stream, total + 4, &sbuf);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(sbuf.size == len * 2);
+    for (i = 0; i < 2 && sbuf.size == len * 2; i++) {
+        TEST_CHECK(memcmp(sbuf.data + (len * i), morpheus, len) == 0);
+    }
+    msgpack_sbuffer_destroy(&sbuf);
+
+    /* A corrupted checksum must be detected */
+    stream[total - 6] ^= 0xff;
+    msgpack_sbuffer_init(&sbuf);
+    ret = inflate_pieces(stream, total, &sbuf);
+    TEST_CHECK(ret == -1);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    flb_free(stream);
+}
+
+void test_inflate_header_fields()
+{
+    int ret;
+    size_t len;
+    size_t zip_len;
+    void *zip;
+    char *buf;
+    msgpack_sbuffer sbuf;
+    struct flb_gzip_deflate *def;
+    struct flb_gzip_inflate *inf;
+    const char name[] = "records.msgpack";
+
+    len = strlen(morpheus);
+    def = flb_gzip_deflate_create(9);
+    ret = flb_gzip_deflate_compress(def, morpheus, len, &zip, &zip_len);
+    TEST_CHECK(ret == 0);
+    flb_gzip_deflate_destroy(def);
+
+    /* Insert a FNAME field, as written by gzip(1) */
+    buf = flb_malloc(zip_len + sizeof(name));
+    memcpy(buf, zip, 10);
+    buf[3] = 0x08;
+    memcpy(buf + 10, name, sizeof(name));
+    memcpy(buf + 10 + sizeof(name), (char *) zip + 10, zip_len - 10);
+    flb_free(zip);
+
+    inf = flb_gzip_inflate_create();
+    msgpack_sbuffer_init(&sbuf);
+    ret = flb_gzip_inflate_stream(inf, buf, zip_len + sizeof(name),
+                                  inflate_cb, &sbuf);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(sbuf.size == len);
+    TEST_CHECK(memcmp(sbuf.data, morpheus, len) == 0);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    flb_gzip_inflate_destroy(inf);
+    flb_free(buf);
+}
+
+/* Sample records similar to a container log, returns the number of records */
+static int sample_records(msgpack_sbuffer *sbuf, size_t size)
+{
+    int i;
+    char line[256];
+    msgpack_packer pck;
+
+    msgpack_sbuffer_init(sbuf);
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+    for (i = 0; sbuf->size < size; i++) {
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_uint64(&pck, 1580000000 + i);
+        msgpack_pack_map(&pck, 3);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "log", 3);
+        snprintf(line, sizeof(line) - 1,
+                 "%i GET /api/v1/items/%i?page=%i HTTP/1.1 200 %i "
+                 "\"Mozilla/5.0 (X11; Linux x86_64)\"",
+                 i, i * 7, i % 10, (i * 31) % 5000);
+        msgpack_pack_str(&pck, strlen(line));
+        msgpack_pack_str_body(&pck, line, strlen(line));
+        msgpack_pack_str(&pck, 6);
+        msgpack_pack_str_body(&pck, "stream", 6);
+        msgpack_pack_str(&pck, 6);
+        msgpack_pack_str_body(&pck, "stdout", 6);
+        msgpack_pack_str(&pck, 4);
+        msgpack_pack_str_body(&pck, "host", 4);
+        msgpack_pack_str(&pck, 10);
+        msgpack_pack_str_body(&pck, "node-01234", 10);
+    }
+
+    return i;
+}
+
+void test_deflate_stream()
+{
+    int ret;
+    size_t off;
+    size_t len;
+    msgpack_sbuffer in;
+    msgpack_sbuffer zip;
+    msgpack_sbuffer out;
+    struct flb_gzip_deflate *def;
+    struct flb_gzip_inflate *inf;
+
+    /* Larger than a few output blocks, written in uneven pieces */
+    sample_records(&in, 1024 * 1024);
+
+    def = flb_gzip_deflate_get(-1);
+    TEST_CHECK(def != NULL);
+
+    msgpack_sbuffer_init(&zip);
+    ret = flb_gzip_deflate_begin(def, inflate_cb, &zip);
+    TEST_CHECK(ret == 0);
+    for (off = 0; off < in.size; off += len) {
+        len = (off % 7919) + 1;
+        if (off + len > in.size) {
+            len = in.size - off;
+        }
+        ret = flb_gzip_deflate_write(def, in.data + off, len);
+        TEST_CHECK(ret == 0);
+    }
+    ret = flb_gzip_deflate_end(def);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(zip.size > 18 && zip.size < in.size);
+
+    inf = flb_gzip_inflate_create();
+    msgpack_sbuffer_init(&out);
+    ret = flb_gzip_inflate_stream(inf, zip.data, zip.size, inflate_cb, &out);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out.size == in.size);
+    TEST_CHECK(memcmp(out.data, in.data, in.size) == 0);
+
+    /* An empty member is valid too */
+    zip.size = 0;
+    out.size = 0;
+    flb_gzip_deflate_begin(def, inflate_cb, &zip);
+    ret = flb_gzip_deflate_end(def);
+    TEST_CHECK(ret == 0);
+    ret = flb_gzip_inflate_stream(inf, zip.data, zip.size, inflate_cb, &out);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out.size == 0);
+
+    flb_gzip_inflate_destroy(inf);
+    msgpack_sbuffer_destroy(&out);
+    msgpack_sbuffer_destroy(&zip);
+    msgpack_sbuffer_destroy(&in);
+}
+
+/* Inflate a complete stream from 'pos', -1 if it's not consumed entirely */
+static int inflate_from(struct flb_gzip_inflate *inf, char *stream,
+                        size_t total, size_t pos, msgpack_sbuffer *sbuf)
+{
+    ssize_t out;
+    size_t used;
+    char buf[4096];
+
+    while ((out = flb_gzip_inflate_read(inf, stream + pos, total - pos,
+                                        &used, buf, sizeof(buf))) > 0) {
+        pos += used;
+        msgpack_sbuffer_write(sbuf, buf, out);
+    }
+    pos += used;
+
+    return (out == 0 && pos == total) ? 0 : -1;
+}
+
+/* Resume an incremental inflate from checkpoints taken along the way */
+void test_inflate_checkpoint()
+{
+    int i;
+    int n = 0;
+    int ret;
+    ssize_t out;
+    size_t len;
+    size_t used;
+    size_t size;
+    size_t pos = 0;
+    size_t fed = 0;
+    void *zip;
+    char buf[1000];
+    msgpack_sbuffer in;
+    msgpack_sbuffer stream;
+    msgpack_sbuffer res;
+    msgpack_sbuffer cont;
+    struct flb_gzip_inflate *inf;
+    struct {
+        char *data;
+        size_t pos;
+        size_t out;
+    } ck[16];
+
+    /* Two members */
+    sample_records(&in, 256 * 1024);
+    msgpack_sbuffer_init(&stream);
+    for (i = 0; i < 2; i++) {
+        ret = flb_gzip_compress(in.data, in.size, &zip, &len);
+        TEST_CHECK(ret == 0);
+        msgpack_sbuffer_write(&stream, zip, len);
+        flb_free(zip);
+    }
+
+    inf = flb_gzip_inflate_create();
+    TEST_CHECK(inf != NULL);
+    size = flb_gzip_inflate_checkpoint_size(inf);
+    TEST_CHECK(size > 32768);
+
+    /* Small pieces of input and output, save the status now and then */
+    msgpack_sbuffer_init(&res);
+    for (i = 0; ; i++) {
+        if (i % 29 == 0 && n < 16) {
+            ck[n].data = flb_malloc(size);
+            flb_gzip_inflate_save(inf, ck[n].data);
+            ck[n].pos = pos;
+            ck[n].out = res.size;
+            n++;
+        }
+
+        out = flb_gzip_inflate_read(inf, stream.data + pos, fed - pos, &used,
+                                    buf, sizeof(buf));
+        TEST_CHECK(out != -1);
+        if (out == -1) {
+            break;
+        }
+        pos += used;
+        if (out > 0) {
+            msgpack_sbuffer_write(&res, buf, out);
+            continue;
+        }
+        if (fed == stream.size) {
+            break;
+        }
+        fed += 4093;
+        if (fed > stream.size) {
+            fed = stream.size;
+        }
+    }
+    flb_gzip_inflate_destroy(inf);
+
+    TEST_CHECK(res.size == in.size * 2);
+    TEST_CHECK(n == 16 && ck[n - 1].out > in.size);
+
+    /* Every checkpoint continues with the same content */
+    for (i = 0; i < n; i++) {
+        inf = flb_gzip_inflate_create();
+        ret = flb_gzip_inflate_restore(inf, ck[i].data, size);
+        TEST_CHECK(ret == 0);
+
+        msgpack_sbuffer_init(&cont);
+        ret = inflate_from(inf, stream.data, stream.size, ck[i].pos, &cont);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(ck[i].out + cont.size == res.size &&
+                   memcmp(res.data + ck[i].out, cont.data, cont.size) == 0);
+        TEST_MSG("checkpoint %i: input %zu, output %zu + %zu",
+                 i, ck[i].pos, ck[i].out, cont.size);
+        msgpack_sbuffer_destroy(&cont);
+        flb_gzip_inflate_destroy(inf);
+    }
+
+    /* Corrupted or truncated checkpoints are rejected */
+    inf = flb_gzip_inflate_create();
+    ck[1].data[size / 2] ^= 0x01;
+    TEST_CHECK(flb_gzip_inflate_restore(inf, ck[1].data, size) == -1);
+    TEST_CHECK(flb_gzip_inflate_restore(inf, ck[2].data, size - 1) == -1);
+    flb_gzip_inflate_destroy(inf);
+
+    for (i = 0; i < n; i++) {
+        flb_free(ck[i].data);
+    }
+    msgpack_sbuffer_destroy(&res);
+    msgpack_sbuffer_destroy(&stream);
+    msgpack_sbuffer_destroy(&in);
+}
+
+void test_compress_levels()
+{
+    int i;
+    int ret;
+    int levels[] = {-1, 0, 1, 6, 9};
+    size_t zip_len;
+    void *zip;
+    msgpack_sbuffer in;
+    msgpack_sbuffer out;
+    struct flb_gzip_inflate *inf;
+
+    sample_records(&in, 256 * 1024);
+    inf = flb_gzip_inflate_create();
+
+    for (i = 0; i < sizeof(levels) / sizeof(int); i++) {
+        ret = flb_gzip_compress_level(in.data, in.size, &zip, &zip_len,
+                                      levels[i]);
+        TEST_CHECK(ret == 0);
+
+        /* Level 0 stores the data, it can't be smaller than the input */
+        if (levels[i] == 0) {
+            TEST_CHECK(zip_len > in.size);
+        }
+        else {
+            TEST_CHECK(zip_len < in.size / 4);
+        }
+
+        msgpack_sbuffer_init(&out);
+        ret = flb_gzip_inflate_stream(inf, zip, zip_len, inflate_cb, &out);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(out.size == in.size);
+        TEST_CHECK(memcmp(out.data, in.data, in.size) == 0);
+        msgpack_sbuffer_destroy(&out);
+        flb_free(zip);
+    }
+
+    /* The context of every level is kept by the thread */
+    TEST_CHECK(flb_gzip_deflate_get(1) == flb_gzip_deflate_get(1));
+    TEST_CHECK(flb_gzip_deflate_get(1) != flb_gzip_deflate_get(9));
+
+    ret = flb_gzip_compress_level(in.data, in.size, &zip, &zip_len, 10);
+    TEST_CHECK(ret == -1);
+
+    flb_gzip_inflate_destroy(inf);
+    msgpack_sbuffer_destroy(&in);
+}
+
+/*
+ * Benchmark: bytes on the wire and CPU time per MB for a PackedForward
+ * payload sent as-is or as CompressedPackedForward.
+ */
+void bench_forward_payload()
+{
+    int i;
+    int ret;
+    double mb;
+    double t_def;
+    double t_inf;
+    double start;
+    size_t zip_len;
+    void *zip;
+    msgpack_sbuffer sbuf;
+    msgpack_sbuffer out;
+    struct flb_gzip_deflate *def;
+    struct flb_gzip_inflate *inf;
+
+    i = sample_records(&sbuf, 4 * 1024 * 1024);
+    mb = sbuf.size / (1024.0 * 1024.0);
+
+    def = flb_gzip_deflate_create(-1);
+    inf = flb_gzip_inflate_create();
+
+    start = bench_cpu_time();
+    ret = flb_gzip_deflate_compress(def, sbuf.data, sbuf.size, &zip, &zip_len);
+    t_def = bench_cpu_time() - start;
+    TEST_CHECK(ret == 0);
+
+    msgpack_sbuffer_init(&out);
+    start = bench_cpu_time();
+    ret = flb_gzip_inflate_stream(inf, zip, zip_len, inflate_cb, &out);
+    t_inf = bench_cpu_time() - start;
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out.size == sbuf.size);
+
+    printf("\n  %i records, PackedForward %lu bytes, "
+           "CompressedPackedForward %lu bytes (ratio %.2fx)\n"
+           "  gzip CPU: deflate %.2f ms/MB, inflate %.2f ms/MB\n",
+           i, sbuf.size, zip_len, (double) sbuf.size / zip_len,
+           (t_def * 1000) / mb, (t_inf * 1000) / mb);
+
+    msgpack_sbuffer_destroy(&out);
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_free(zip);
+    flb_gzip_deflate_destroy(def);
+    flb_gzip_inflate_destroy(inf);
+}
+
+/*
+ * Benchmark: a fresh deflate state for every payload, as flb_gzip_compress()
+ * used to do, against the per-thread contexts at different levels.
+ */
+static double bench_fresh(const char *data, size_t size, int rounds,
+                          size_t *zip_size)
+{
+    int i;
+    double start;
+    void *zip;
+    struct flb_gzip_deflate *def;
+
+    start = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        def = flb_gzip_deflate_create(-1);
+        flb_gzip_deflate_compress(def, data, size, &zip, zip_size);
+        flb_gzip_deflate_destroy(def);
+        flb_free(zip);
+    }
+    return (bench_cpu_time() - start) / rounds;
+}
+
+static double bench_cached(const char *data, size_t size, int rounds,
+                           int level, size_t *zip_size)
+{
+    int i;
+    double start;
+    void *zip;
+
+    start = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        flb_gzip_compress_level(data, size, &zip, zip_size, level);
+        flb_free(zip);
+    }
+    return (bench_cpu_time() - start) / rounds;
+}
+
+void bench_compress()
+{
+    int i;
+    int levels[] = {1, 6, 9};
+    double t_fresh;
+    double t_cached;
+    size_t zip_size;
+    msgpack_sbuffer sbuf;
+    struct {
+        size_t size;
+        int rounds;
+    } cases[] = {{4096, 2000}, {64 * 1024, 200}, {2 * 1024 * 1024, 5}};
+
+    sample_records(&sbuf, 2 * 1024 * 1024);
+
+    printf("\n  %10s %14s %14s\n", "payload", "fresh ctx", "thread ctx");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        t_fresh = bench_fresh(sbuf.data, cases[i].size, cases[i].rounds,
+                              &zip_size);
+        t_cached = bench_cached(sbuf.data, cases[i].size, cases[i].rounds,
+                                -1, &zip_size);
+        printf("  %10lu %11.3f ms %11.3f ms\n", cases[i].size,
+               t_fresh * 1000, t_cached * 1000);
+    }
+
+    printf("  %10s %14s %14s\n", "level", "ms/MB", "ratio");
+    for (i = 0; i < sizeof(levels) / sizeof(int); i++) {
+        t_cached = bench_cached(sbuf.data, sbuf.size, 5, levels[i],
+                                &zip_size);
+        printf("  %10i %14.2f %13.2fx\n", levels[i],
+               (t_cached * 1000) / (sbuf.size / (1024.0 * 1024.0)),
+               (double) sbuf.size / zip_size);
+    }
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
+
 TEST_LIST = {
+#ifndef FLB_TESTS_BENCH
     {"compress", test_compress},
+    {"deflate_inflate_ctx", test_deflate_inflate_ctx},
+    {"inflate_read", test_inflate_read},
+    {"inflate_header_fields", test_inflate_header_fields},
+    {"deflate_stream", test_deflate_stream},
+    {"inflate_checkpoint", test_inflate_checkpoint},
+    {"compress_levels", test_compress_levels},
+#else
+    /* Benchmarks: flb-bench-* targets */
+    {"bench_forward_payload", bench_forward_payload},
+    {"bench_compress", bench_compress},
+#endif
     { 0 }
 };
@@ -4,6 +4,7 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_socket.h>
+#include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_http_client.h>
 
 #include "flb_tests_internal.h"
@@ -79,7 +80,74 @@ void test_http_buffer_increase()
     flb_config_exit(config);
 }
 
+/* Get the value of a request header, NULL if it's not set */
+static char *header_get(struct flb_http_client *c, const char *key)
+{
+    struct mk_list *head;
+    struct flb_kv *kv;
+
+    mk_list_foreach(head, &c->headers) {
+        kv = mk_list_entry(head, struct flb_kv, _head);
+        if (strcasecmp(kv->key, key) == 0) {
+            return kv->val;
+        }
+    }
+
+    return NULL;
+}
+
+void test_http_content_length()
+{
+    int i;
+    char *body;
+    char *val;
+    char expected[32];
+    struct flb_http_client *c;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_config *config;
+    size_t lengths[] = {0, 1, 11, 999999, 1000000, 12345678};
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+
+    u = flb_upstream_create(config, "127.0.0.1", 80, 0, NULL);
+    TEST_CHECK(u != NULL);
+
+    u_conn = flb_malloc(sizeof(struct flb_upstream_conn));
+    TEST_CHECK(u_conn != NULL);
+    u_conn->u = u;
+
+    body = flb_calloc(1, 12345678);
+    TEST_CHECK(body != NULL);
+
+    /* The header must announce the body length, whatever its digits */
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        c = flb_http_client(u_conn, FLB_HTTP_POST, "/", body, lengths[i],
+                            "127.0.0.1", 80, NULL, 0);
+        TEST_CHECK(c != NULL);
+        if (!c) {
+            continue;
+        }
+
+        snprintf(expected, sizeof(expected), "%zu", lengths[i]);
+        val = header_get(c, "Content-Length");
+        TEST_CHECK(val != NULL && strcmp(val, expected) == 0);
+        TEST_MSG("Content-Length: expected %s, got %s", expected,
+                 val ? val : "(none)");
+        TEST_CHECK(c->body_len == lengths[i]);
+
+        flb_http_client_destroy(c);
+    }
+
+    flb_free(body);
+    flb_free(u_conn);
+    flb_upstream_destroy(u);
+    flb_config_exit(config);
+}
+
 TEST_LIST = {
     { "http_buffer_increase", test_http_buffer_increase},
+    { "http_content_length",  test_http_content_length},
     { 0 }
 };
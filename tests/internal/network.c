@@ -6,6 +6,7 @@
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_socket.h>
+#include <fluent-bit/flb_net_dgram.h>
 
 #include <time.h>
 #include "flb_tests_internal.h"
@@ -13,6 +14,7 @@
 #define TEST_HOSTv4           "127.0.0.1"
 #define TEST_HOSTv6           "::1"
 #define TEST_PORT             "41322"
+#define TEST_UDP_PORT         "41323"
 
 #define TEST_EV_CLIENT        MK_EVENT_NOTIFICATION
 #define TEST_EV_SERVER        MK_EVENT_CUSTOM
@@ -142,8 +144,179 @@ void test_ipv6_client_server()
     test_client_server(FLB_TRUE);
 }
 
+/* Content of the datagram 'i': the length changes for every one */
+static int dgram_fill(char *buf, int i)
+{
+    int len;
+
+    len = 1 + ((i * 37) % 900);
+    memset(buf, 'a' + (i % 26), len);
+    return len;
+}
+
+static int dgram_valid(struct flb_net_dgram_batch *b, int slot, int i)
+{
+    int len;
+    char buf[1024];
+
+    len = dgram_fill(buf, i);
+    if (flb_net_dgram_len(b, slot) != len) {
+        return FLB_FALSE;
+    }
+    if (memcmp(flb_net_dgram_data(b, slot), buf, len) != 0) {
+        return FLB_FALSE;
+    }
+
+    /* Received data is always NULL terminated */
+    return flb_net_dgram_data(b, slot)[len] == '\0';
+}
+
+/* Receive more datagrams than the batch size, in order and intact */
+void test_dgram_batch()
+{
+    int i;
+    int ret;
+    int len;
+    int total = 0;
+    int calls = 0;
+    int sent = 40;
+    char buf[1024];
+    flb_sockfd_t fd_server;
+    flb_sockfd_t fd_client;
+    struct flb_net_dgram_batch *b;
+
+    fd_server = flb_net_server_udp(TEST_UDP_PORT, TEST_HOSTv4);
+    TEST_CHECK(fd_server != -1);
+    fd_client = flb_net_udp_connect(TEST_HOSTv4, atol(TEST_UDP_PORT));
+    TEST_CHECK(fd_client != -1);
+    if (fd_server == -1 || fd_client == -1) {
+        return;
+    }
+
+    b = flb_net_dgram_batch_create(fd_server, 16, 1024);
+    TEST_CHECK(b != NULL);
+
+    /* Nothing to read: the call must not block */
+    ret = flb_net_dgram_recv(fd_server, b);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < sent; i++) {
+        len = dgram_fill(buf, i);
+        ret = send(fd_client, buf, len, 0);
+        TEST_CHECK(ret == len);
+    }
+
+    while (total < sent && calls < sent) {
+        ret = flb_net_dgram_recv(fd_server, b);
+        TEST_CHECK(ret >= 0 && ret <= b->size);
+        if (ret <= 0) {
+            break;
+        }
+        TEST_CHECK(b->count == ret);
+        for (i = 0; i < ret; i++) {
+            TEST_CHECK(dgram_valid(b, i, total + i) == FLB_TRUE);
+            TEST_MSG("datagram %i is corrupted", total + i);
+        }
+        total += ret;
+        calls++;
+    }
+
+    TEST_CHECK(total == sent);
+    TEST_MSG("datagrams: sent %i, received %i", sent, total);
+#ifdef FLB_HAVE_RECVMMSG
+    /* 40 datagrams, 16 per call */
+    TEST_CHECK(calls == 3);
+#endif
+
+    flb_net_dgram_batch_destroy(b);
+    flb_socket_close(fd_client);
+    flb_socket_close(fd_server);
+}
+
+#if defined(FLB_HAVE_RECVMMSG) && defined(SO_RXQ_OVFL)
+/* Overflow the receive queue, then read all and count the drops */
+static int dgram_overflow(flb_sockfd_t fd_server, flb_sockfd_t fd_client,
+                          struct flb_net_dgram_batch *b, int sent,
+                          int *drops)
+{
+    int i;
+    int ret;
+    int total = 0;
+    char buf[1024];
+
+    *drops = 0;
+    memset(buf, 'x', sizeof(buf));
+    for (i = 0; i < sent; i++) {
+        send(fd_client, buf, sizeof(buf), 0);
+    }
+
+    /*
+     * The Kernel reports the drop counter with the queued datagrams, the
+     * last one is sent once the queue is empty so it carries every drop.
+     */
+    do {
+        ret = flb_net_dgram_recv(fd_server, b);
+        total += ret > 0 ? ret : 0;
+        *drops += b->drops;
+    } while (ret > 0);
+
+    send(fd_client, buf, sizeof(buf), 0);
+    ret = flb_net_dgram_recv(fd_server, b);
+    TEST_CHECK(ret == 1);
+    *drops += b->drops;
+
+    return total;
+}
+
+/* Drops are reported as the delta since the previous receive call */
+void test_dgram_drops()
+{
+    int ret;
+    int drops;
+    int total;
+    int sent = 500;
+    flb_sockfd_t fd_server;
+    flb_sockfd_t fd_client;
+    struct flb_net_dgram_batch *b;
+
+    fd_server = flb_net_server_udp(TEST_UDP_PORT, TEST_HOSTv4);
+    TEST_CHECK(fd_server != -1);
+    fd_client = flb_net_udp_connect(TEST_HOSTv4, atol(TEST_UDP_PORT));
+    TEST_CHECK(fd_client != -1);
+    if (fd_server == -1 || fd_client == -1) {
+        return;
+    }
+
+    ret = flb_net_socket_rcvbuf(fd_server, 4096);
+    TEST_CHECK(ret > 0);
+
+    b = flb_net_dgram_batch_create(fd_server, 16, 2048);
+    TEST_CHECK(b != NULL);
+    TEST_CHECK(b->rxq_ovfl == FLB_TRUE);
+
+    /* Twice: the second round must not count the first drops again */
+    total = dgram_overflow(fd_server, fd_client, b, sent, &drops);
+    TEST_CHECK(drops > 0);
+    TEST_CHECK(total + drops == sent);
+    TEST_MSG("sent %i, received %i, dropped %i", sent, total, drops);
+
+    total = dgram_overflow(fd_server, fd_client, b, sent, &drops);
+    TEST_CHECK(drops > 0);
+    TEST_CHECK(total + drops == sent);
+    TEST_MSG("sent %i, received %i, dropped %i", sent, total, drops);
+
+    flb_net_dgram_batch_destroy(b);
+    flb_socket_close(fd_client);
+    flb_socket_close(fd_server);
+}
+#endif
+
 TEST_LIST = {
     { "ipv4_client_server", test_ipv4_client_server},
     { "ipv6_client_server", test_ipv6_client_server},
+    { "dgram_batch",        test_dgram_batch},
+#if defined(FLB_HAVE_RECVMMSG) && defined(SO_RXQ_OVFL)
+    { "dgram_drops",        test_dgram_drops},
+#endif
     { 0 }
 };
@@ -0,0 +1,360 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_number.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "flb_tests_internal.h"
+#include "../lib/bench.h"
+
+static int num_parse(const char *str, struct flb_number *num)
+{
+    return flb_number_parse(str, strlen(str), num);
+}
+
+static int same_double(double a, double b)
+{
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+void test_integers()
+{
+    int i;
+    int ret;
+    struct flb_number num;
+    struct {
+        char *str;
+        int type;
+        int64_t i64;
+        uint64_t u64;
+    } cases[] = {
+        {"0",                     FLB_NUMBER_INT,  0, 0},
+        {"-0",                    FLB_NUMBER_INT,  0, 0},
+        {"7",                     FLB_NUMBER_INT,  7, 0},
+        {"-42",                   FLB_NUMBER_INT,  -42, 0},
+        {"9223372036854775807",   FLB_NUMBER_INT,  INT64_MAX, 0},
+        {"-9223372036854775808",  FLB_NUMBER_INT,  INT64_MIN, 0},
+        {"9223372036854775808",   FLB_NUMBER_UINT, 0, 9223372036854775808ULL},
+        {"18446744073709551615",  FLB_NUMBER_UINT, 0, UINT64_MAX},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        ret = num_parse(cases[i].str, &num);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(num.type == cases[i].type);
+        TEST_MSG("%s: type=%i", cases[i].str, num.type);
+        if (num.type == FLB_NUMBER_INT) {
+            TEST_CHECK(num.val.i64 == cases[i].i64);
+        }
+        else if (num.type == FLB_NUMBER_UINT) {
+            TEST_CHECK(num.val.u64 == cases[i].u64);
+        }
+    }
+
+    /* Integers out of range become doubles */
+    ret = num_parse("18446744073709551616", &num);
+    TEST_CHECK(ret == 0 && num.type == FLB_NUMBER_DOUBLE &&
+               num.val.f64 == 18446744073709551616.0);
+
+    ret = num_parse("-9223372036854775809", &num);
+    TEST_CHECK(ret == 0 && num.type == FLB_NUMBER_DOUBLE &&
+               num.val.f64 == -9223372036854775808.0);
+}
+
+void test_doubles()
+{
+    int i;
+    int ret;
+    struct flb_number num;
+    struct {
+        char *str;
+        double val;
+    } cases[] = {
+        {"1.5",                     1.5},
+        {"-0.0",                    -0.0},
+        {"0.1",                     0.1},
+        {"1e5",                     1e5},
+        {"1E+5",                    1e5},
+        {"25e-1",                   2.5},
+        {"123.456e2",               12345.6},
+        {"3.141592653589793",       3.141592653589793},
+        {"1.7976931348623157e308",  1.7976931348623157e308},
+        {"2.2250738585072014e-308", 2.2250738585072014e-308},
+        {"4.9e-324",                4.9e-324},
+        {"2.2250738585072011e-308", 2.2250738585072011e-308},
+        {"1e-400",                  0.0},
+        {"9007199254740993",        9007199254740992.0},
+        {"0.000000000000000000000000000001", 1e-30},
+        {"123456789012345678901234567890", 1.2345678901234568e29},
+        {"1.00000000000000011102230246251565404236316680908203125", 1.0},
+        {"1.00000000000000011102230246251565404236316680908203126",
+         1.0000000000000002},
+        {"1.00000000000000011102230246251565404236316680908203124",
+         1.0},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        ret = num_parse(cases[i].str, &num);
+        TEST_CHECK(ret == 0);
+        if (strchr(cases[i].str, '.') || strchr(cases[i].str, 'e') ||
+            strchr(cases[i].str, 'E') || strlen(cases[i].str) > 20) {
+            TEST_CHECK(num.type == FLB_NUMBER_DOUBLE);
+        }
+        if (num.type == FLB_NUMBER_DOUBLE) {
+            TEST_CHECK(same_double(num.val.f64, cases[i].val));
+            TEST_MSG("%s: %.17g expected %.17g", cases[i].str,
+                     num.val.f64, cases[i].val);
+        }
+    }
+
+    ret = num_parse("1e400", &num);
+    TEST_CHECK(ret == 0 && isinf(num.val.f64) && num.val.f64 > 0);
+    ret = num_parse("-1e400", &num);
+    TEST_CHECK(ret == 0 && isinf(num.val.f64) && num.val.f64 < 0);
+}
+
+void test_invalid()
+{
+    int i;
+    int ret;
+    struct flb_number num;
+    char *cases[] = {
+        "", "-", "+1", "01", "-01", "1.", ".5", "1.e5", "1e", "1e+",
+        "0x10", "1.2.3", "1e5e5", " 1", "1 ", "NaN", "inf", "1,5", "--1",
+        "12a", "1-"
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(char *); i++) {
+        ret = num_parse(cases[i], &num);
+        TEST_CHECK(ret == -1);
+        TEST_MSG("'%s' should be invalid", cases[i]);
+    }
+
+    /* The length is honored, no NUL byte needed */
+    ret = flb_number_parse("123456", 3, &num);
+    TEST_CHECK(ret == 0 && num.type == FLB_NUMBER_INT && num.val.i64 == 123);
+}
+
+/* Typecast values: what atof(3) takes, converted exactly */
+void test_lenient()
+{
+    int i;
+    int ret;
+    char *buf;
+    struct flb_number num;
+    struct {
+        char *str;
+        int type;
+        int64_t i64;
+        double f64;
+    } cases[] = {
+        {"007",                   FLB_NUMBER_INT,    7, 0},
+        {"0080",                  FLB_NUMBER_INT,    80, 0},
+        {"-0012",                 FLB_NUMBER_INT,    -12, 0},
+        {"+5",                    FLB_NUMBER_INT,    5, 0},
+        {"000",                   FLB_NUMBER_INT,    0, 0},
+        {"00000000000000000000000000000042", FLB_NUMBER_INT, 42, 0},
+        {"1.",                    FLB_NUMBER_DOUBLE, 0, 1.0},
+        {".5",                    FLB_NUMBER_DOUBLE, 0, 0.5},
+        {"-.25",                  FLB_NUMBER_DOUBLE, 0, -0.25},
+        {"+1.e2",                 FLB_NUMBER_DOUBLE, 0, 100.0},
+        {"00.1",                  FLB_NUMBER_DOUBLE, 0, 0.1},
+        {"0000000000000000000000.30000000000000004",
+                                  FLB_NUMBER_DOUBLE, 0, 0.30000000000000004},
+    };
+    char *invalid[] = {
+        "", "+", "-", ".", "+.", "-.", ".e5", "1e", "+-1", "--1", "++1",
+        " 1", "1 ", "12a", "0x10", "1,5"
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        ret = flb_number_parse_lenient(cases[i].str, strlen(cases[i].str),
+                                       &num);
+        TEST_CHECK(ret == 0 && num.type == cases[i].type);
+        TEST_MSG("%s: ret=%i type=%i", cases[i].str, ret, num.type);
+        if (ret != 0 || num.type != cases[i].type) {
+            continue;
+        }
+        if (num.type == FLB_NUMBER_INT) {
+            TEST_CHECK(num.val.i64 == cases[i].i64);
+        }
+        else {
+            TEST_CHECK(same_double(num.val.f64, cases[i].f64));
+            TEST_MSG("%s: %.17g", cases[i].str, num.val.f64);
+        }
+    }
+
+    for (i = 0; i < sizeof(invalid) / sizeof(char *); i++) {
+        ret = flb_number_parse_lenient(invalid[i], strlen(invalid[i]), &num);
+        TEST_CHECK(ret == -1);
+        TEST_MSG("'%s' should be invalid", invalid[i]);
+    }
+
+    /* The strict parser still rejects them */
+    TEST_CHECK(num_parse("007", &num) == -1);
+    TEST_CHECK(num_parse("+5", &num) == -1);
+
+    /* Leading zeros do not use up significant digits */
+    buf = "0000000000123456789012345678.9";
+    ret = flb_number_parse_lenient(buf, strlen(buf), &num);
+    TEST_CHECK(ret == 0 && num.type == FLB_NUMBER_DOUBLE &&
+               same_double(num.val.f64, strtod(buf, NULL)));
+}
+
+/* xorshift, deterministic across runs */
+static uint64_t rnd(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int random_number(uint64_t *seed, char *buf)
+{
+    int i;
+    int len = 0;
+    int digits;
+
+    if (rnd(seed) & 1) {
+        buf[len++] = '-';
+    }
+
+    digits = 1 + (rnd(seed) % 25);
+    buf[len++] = '1' + (rnd(seed) % 9);
+    for (i = 1; i < digits; i++) {
+        buf[len++] = '0' + (rnd(seed) % 10);
+    }
+
+    if (rnd(seed) % 3) {
+        buf[len++] = '.';
+        digits = 1 + (rnd(seed) % 20);
+        for (i = 0; i < digits; i++) {
+            buf[len++] = '0' + (rnd(seed) % 10);
+        }
+    }
+    if (rnd(seed) % 2) {
+        len += sprintf(buf + len, "e%i", (int) (rnd(seed) % 680) - 340);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* Every double must match the correctly rounded conversion of strtod() */
+void test_random_doubles()
+{
+    int i;
+    int len;
+    int ret;
+    int errors = 0;
+    char buf[128];
+    double d;
+    uint64_t seed = 0x2545f4914f6cdd1dULL;
+    struct flb_number num;
+
+    for (i = 0; i < 200000; i++) {
+        if (i % 2) {
+            /* shortest representation of a random double */
+            do {
+                d = 0;
+                seed = rnd(&seed);
+                memcpy(&d, &seed, sizeof(d));
+            } while (isnan(d) || isinf(d));
+            len = snprintf(buf, sizeof(buf), "%.17g", d);
+        }
+        else {
+            len = random_number(&seed, buf);
+        }
+
+        ret = flb_number_parse(buf, len, &num);
+        if (ret != 0) {
+            /* %g may produce exponents with a '+' sign and leading zeros */
+            continue;
+        }
+        d = strtod(buf, NULL);
+        if (!same_double(flb_number_to_double(&num), d)) {
+            if (num.type != FLB_NUMBER_DOUBLE &&
+                flb_number_to_double(&num) == d) {
+                continue;
+            }
+            errors++;
+            if (errors < 10) {
+                TEST_MSG("%s: %.17g expected %.17g", buf,
+                         flb_number_to_double(&num), d);
+            }
+        }
+    }
+    TEST_CHECK(errors == 0);
+}
+
+/* Benchmark: conversion rate compared with the C library */
+void bench_number_parse()
+{
+    int i;
+    int j;
+    int n = 100000;
+    int rounds = 10;
+    int *lens;
+    char *nums;
+    double t;
+    double sum = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    struct flb_number num;
+
+    nums = flb_malloc(n * 64);
+    lens = flb_malloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+        if (i % 2) {
+            lens[i] = snprintf(nums + (i * 64), 64, "%i",
+                               (int) (rnd(&seed) % 100000000));
+        }
+        else {
+            lens[i] = snprintf(nums + (i * 64), 64, "%i.%03i",
+                               (int) (rnd(&seed) % 100000),
+                               (int) (rnd(&seed) % 1000));
+        }
+    }
+
+    printf("\n  %10s %14s\n", "parser", "Mnum/s");
+    t = bench_cpu_time();
+    for (j = 0; j < rounds; j++) {
+        for (i = 0; i < n; i++) {
+            sum += strtod(nums + (i * 64), NULL);
+        }
+    }
+    printf("  %10s %14.2f\n", "strtod", (n * rounds) / (bench_cpu_time() - t) / 1e6);
+
+    t = bench_cpu_time();
+    for (j = 0; j < rounds; j++) {
+        for (i = 0; i < n; i++) {
+            flb_number_parse(nums + (i * 64), lens[i], &num);
+            sum += flb_number_to_double(&num);
+        }
+    }
+    printf("  %10s %14.2f\n", "flb_number",
+           (n * rounds) / (bench_cpu_time() - t) / 1e6);
+    TEST_CHECK(sum != 0);
+
+    flb_free(nums);
+    flb_free(lens);
+}
+
+TEST_LIST = {
+#ifndef FLB_TESTS_BENCH
+    {"integers", test_integers},
+    {"doubles", test_doubles},
+    {"invalid", test_invalid},
+    {"lenient", test_lenient},
+    {"random_doubles", test_random_doubles},
+#else
+    /* Benchmarks: flb-bench-* targets */
+    {"bench_number_parse", bench_number_parse},
+#endif
+    { 0 }
+};
@@ -0,0 +1,95 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_output_batch.h>
+#include <msgpack.h>
+
+#include "flb_tests_internal.h"
+
+/* Pack 'n' records [time, {"key": "...."}] of the same size */
+static void pack_records(msgpack_sbuffer *sbuf, int n, size_t *rec_size)
+{
+    int i;
+    size_t prev = 0;
+    struct flb_time tm;
+    msgpack_packer pck;
+
+    msgpack_sbuffer_init(sbuf);
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+
+    flb_time_get(&tm);
+    for (i = 0; i < n; i++) {
+        msgpack_pack_array(&pck, 2);
+        flb_time_append_to_msgpack(&tm, &pck, 0);
+        msgpack_pack_map(&pck, 1);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "key", 3);
+        msgpack_pack_str(&pck, 16);
+        msgpack_pack_str_body(&pck, "0123456789abcdef", 16);
+
+        *rec_size = sbuf->size - prev;
+        prev = sbuf->size;
+    }
+}
+
+void test_split()
+{
+    int i;
+    int ret;
+    int records = 0;
+    size_t rec_size;
+    size_t offset = 0;
+    msgpack_sbuffer sbuf;
+    struct flb_output_batch batch;
+
+    pack_records(&sbuf, 100, &rec_size);
+
+    /* Ten records per part */
+    ret = flb_output_batch_split(sbuf.data, sbuf.size, rec_size * 10, &batch);
+    TEST_CHECK(ret == 10);
+    TEST_CHECK(batch.n_parts == 10);
+
+    for (i = 0; i < batch.n_parts; i++) {
+        TEST_CHECK(batch.parts[i].offset == offset);
+        TEST_CHECK(batch.parts[i].size == rec_size * 10);
+        TEST_CHECK(batch.parts[i].status == FLB_OUTPUT_BATCH_PENDING);
+        offset += batch.parts[i].size;
+        records += batch.parts[i].records;
+    }
+    TEST_CHECK(offset == sbuf.size);
+    TEST_CHECK(records == 100);
+    flb_output_batch_destroy(&batch);
+
+    /* Limit not aligned to record boundaries */
+    ret = flb_output_batch_split(sbuf.data, sbuf.size,
+                                 (rec_size * 3) + (rec_size / 2), &batch);
+    TEST_CHECK(ret == 34);
+    TEST_CHECK(batch.parts[0].records == 3);
+    TEST_CHECK(batch.parts[33].records == 1);
+    flb_output_batch_destroy(&batch);
+
+    /* Records bigger than the limit get their own part */
+    ret = flb_output_batch_split(sbuf.data, sbuf.size, 1, &batch);
+    TEST_CHECK(ret == 100);
+    flb_output_batch_destroy(&batch);
+
+    /* No limit */
+    ret = flb_output_batch_split(sbuf.data, sbuf.size, 0, &batch);
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(batch.parts[0].size == sbuf.size);
+    TEST_CHECK(batch.parts[0].records == 100);
+    flb_output_batch_destroy(&batch);
+
+    /* Truncated buffer */
+    ret = flb_output_batch_split(sbuf.data, sbuf.size - 1, 0, &batch);
+    TEST_CHECK(ret == -1);
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
+
+TEST_LIST = {
+    {"split", test_split},
+    { 0 }
+};
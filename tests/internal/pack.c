@@ -5,6 +5,9 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_json_index.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_time.h>
 #include <monkey/mk_core.h>
 
 #include <sys/types.h>
@@ -12,15 +15,23 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
 
 #include "flb_tests_internal.h"
+#include "../lib/bench.h"
 
 /* JSON iteration tests */
 #define JSON_SINGLE_MAP1 FLB_TESTS_DATA_PATH "/data/pack/json_single_map_001.json"
 #define JSON_SINGLE_MAP2 FLB_TESTS_DATA_PATH "/data/pack/json_single_map_002.json"
 #define JSON_BUG342      FLB_TESTS_DATA_PATH "/data/pack/bug342.json"
 
+/* Expected MessagePack output of the JSON files above */
+#define MP_SINGLE_MAP1   FLB_TESTS_DATA_PATH "/data/pack/json_single_map_001.msgpack"
+#define MP_SINGLE_MAP2   FLB_TESTS_DATA_PATH "/data/pack/json_single_map_002.msgpack"
+#define MP_BUG342        FLB_TESTS_DATA_PATH "/data/pack/bug342.msgpack"
+
 /* Pack Samples path */
 #define PACK_SAMPLES     FLB_TESTS_DATA_PATH "/data/pack/"
 
@@ -579,7 +590,821 @@ void test_json_pack_bug1278()
     }
 }
 
+static char *file_read(const char *path, size_t *size)
+{
+    struct stat st;
+    char *buf;
+
+    if (stat(path, &st) == -1) {
+        return NULL;
+    }
+    buf = mk_file_to_buffer(path);
+    *size = st.st_size;
+    return buf;
+}
+
+/* Structural index implementations available on this host */
+static int json_index_impls(int *impls)
+{
+    int i;
+    int n = 0;
+    int def;
+
+    def = flb_json_index_impl();
+    for (i = FLB_JSON_INDEX_SCALAR; i <= FLB_JSON_INDEX_AVX2; i++) {
+        if (flb_json_index_set_impl(i) == 0) {
+            impls[n++] = i;
+        }
+    }
+    flb_json_index_set_impl(def);
+    return n;
+}
+
+/* Compare the packed JSON files with the expected MessagePack output */
+void test_json_pack_fixtures()
+{
+    int i;
+    int j;
+    int n;
+    int ret;
+    int out_size;
+    int impls[3];
+    size_t js_size;
+    size_t mp_size;
+    char *js;
+    char *mp;
+    char *out;
+    struct flb_pack_state state;
+    struct {
+        char *json;
+        char *msgpack;
+    } files[] = {
+        {JSON_SINGLE_MAP1, MP_SINGLE_MAP1},
+        {JSON_SINGLE_MAP2, MP_SINGLE_MAP2},
+        {JSON_BUG342, MP_BUG342},
+    };
+
+    n = json_index_impls(impls);
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        js = file_read(files[i].json, &js_size);
+        mp = file_read(files[i].msgpack, &mp_size);
+        TEST_CHECK(js != NULL && mp != NULL);
+        if (!js || !mp) {
+            exit(EXIT_FAILURE);
+        }
+
+        for (j = 0; j < n; j++) {
+            flb_json_index_set_impl(impls[j]);
+
+            flb_pack_state_init(&state);
+            ret = flb_pack_json_state(js, js_size, &out, &out_size, &state);
+            TEST_CHECK(ret == 0);
+            if (ret != 0) {
+                flb_pack_state_reset(&state);
+                continue;
+            }
+            TEST_CHECK(out_size == mp_size &&
+                       memcmp(out, mp, mp_size) == 0);
+            TEST_MSG("%s: %s output differs",
+                     files[i].json, flb_json_index_impl_name(impls[j]));
+            flb_free(out);
+            flb_pack_state_reset(&state);
+        }
+        flb_free(js);
+        flb_free(mp);
+    }
+    json_index_impls(impls);
+}
+
+static void hex_encode(char *dst, const char *buf, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        sprintf(dst + (i * 2), "%02x", (unsigned char) buf[i]);
+    }
+    dst[size * 2] = '\0';
+}
+
+/* Edge cases: return code, last byte and MessagePack output (hex) */
+void test_json_pack_edge_cases()
+{
+    int i;
+    int j;
+    int n;
+    int ret;
+    int out_size;
+    int impls[3];
+    char *out;
+    char hex[256];
+    char buf[256];
+    struct flb_pack_state state;
+    struct {
+        char *json;
+        int ret;
+        int last;
+        char *hex;
+    } cases[] = {
+        {"{\"a\":1}",                0, 7,  "81a16101"},
+        {"{\"a\":1} ",               0, 7,  "81a16101"},
+        {"{\"a\":1}{\"b\":2}",       0, 14, "81a1610181a16202"},
+        {"{\"a\":1},{\"b\":2}",      0, 15, "81a1610181a16202"},
+        {"{\"a\":1} {\"b\":",        0, 7,  "81a16101"},
+        {"[[],{},[[]]] ",            0, 12, "9390809190"},
+        {"{\"a\":{\"b\":[1,{\"c\":null}],\"d\":true},\"e\":false} ",
+                                     0, 45, "82a16182a1629201"
+                                            "81a163c0a164c3a165c2"},
+        {"  {\"a\"  :  -1.5  }  ",   0, 18, "81a161cbbff8000000000000"},
+        {"{\"a\":\"b\\n\\u00e9\\\"\"}",  0, 19, "81a161a5620ac3a922"},
+        {"{\"a\":\"\\\\\"}",         0, 10, "81a161a15c"},
+        {"123 ",                     0, 3,  "7b"},
+        {"[1e5,-0,18446744073709551615] ",
+                                     0, 29, "93cb40f86a0000000000"
+                                            "00cfffffffffffffffff"},
+        {"[-9223372036854775808] ",  0, 22, "91d38000000000000000"},
+        {"123",                      FLB_ERR_JSON_PART,  0, NULL},
+        {"{\"a\":1",                 FLB_ERR_JSON_PART,  0, NULL},
+        {"[1,2",                     FLB_ERR_JSON_PART,  0, NULL},
+        {"{\"a\":\"b",               FLB_ERR_JSON_PART,  0, NULL},
+        {"\"str\"",                  FLB_ERR_JSON_INVAL, 0, NULL},
+        {"",                         FLB_ERR_JSON_INVAL, 0, NULL},
+        {"   ",                      FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"k\":}",                 FLB_ERR_JSON_INVAL, 0, NULL},
+        {"[1,]",                     FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":1,}",               FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\" 1}",                FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":1}x",               FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":1}]",               FLB_ERR_JSON_INVAL, 0, NULL},
+        {"]",                        FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":\"b\\q\"}",         FLB_ERR_JSON_INVAL, 0, NULL},
+        {"[1 2]",                    FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":tru}",              FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":01}",               FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":1.}",               FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":1.2.3}",            FLB_ERR_JSON_INVAL, 0, NULL},
+        {"{\"a\":-}",                FLB_ERR_JSON_INVAL, 0, NULL},
+    };
+
+    n = json_index_impls(impls);
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        for (j = 0; j < n; j++) {
+            flb_json_index_set_impl(impls[j]);
+
+            flb_pack_state_init(&state);
+            ret = flb_pack_json_state(cases[i].json, strlen(cases[i].json),
+                                      &out, &out_size, &state);
+            TEST_CHECK(ret == cases[i].ret);
+            TEST_MSG("'%s' (%s): ret=%i expected=%i", cases[i].json,
+                     flb_json_index_impl_name(impls[j]), ret, cases[i].ret);
+            if (ret == 0) {
+                hex_encode(hex, out, out_size);
+                TEST_CHECK(strcmp(hex, cases[i].hex) == 0);
+                TEST_MSG("'%s': output=%s expected=%s",
+                         cases[i].json, hex, cases[i].hex);
+                TEST_CHECK(state.last_byte == cases[i].last);
+                flb_free(out);
+            }
+            flb_pack_state_reset(&state);
+        }
+    }
+
+    /* The content stops at the first NUL byte */
+    memcpy(buf, "{\"a\":1}\0{\"b\":2}", 15);
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state(buf, 15, &out, &out_size, &state);
+    TEST_CHECK(ret == 0 && out_size == 4 && state.last_byte == 7);
+    if (ret == 0) {
+        flb_free(out);
+    }
+    flb_pack_state_reset(&state);
+    json_index_impls(impls);
+}
+
+#define XS "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" \
+           "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" \
+           "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+
+/*
+ * Strings with escape sequences and quotes crossing the 64 bytes block
+ * boundaries, every implementation must produce the same output.
+ */
+void test_json_pack_blocks()
+{
+    int i;
+    int j;
+    int n;
+    int ret;
+    int impls[3];
+    int root_type;
+    int k;
+    char js[512];
+    char *out;
+    char *ref = NULL;
+    char *units[] = {"\\\\", "\\\"", "{", "}", "[", "]", ",", ":", "x",
+                     "\\\\\\\\", "\\\\\\\"", "\\u00e9"};
+    size_t out_size;
+    size_t ref_size = 0;
+    size_t len;
+
+    n = json_index_impls(impls);
+    for (i = 0; i < 130; i++) {
+        /* {"<i x's>":"<i % 67 escaped units>","k":[1,"\"\\"]} */
+        len = snprintf(js, sizeof(js), "{\"%.*s\":\"", i, XS);
+        for (k = 0; k < i % 67; k++) {
+            len += snprintf(js + len, sizeof(js) - len, "%s",
+                            units[(i + k) % (sizeof(units) / sizeof(char *))]);
+        }
+        len += snprintf(js + len, sizeof(js) - len,
+                        "\",\"k\":[1,\"\\\"\\\\\"]}");
+
+        for (j = 0; j < n; j++) {
+            flb_json_index_set_impl(impls[j]);
+            ret = flb_pack_json(js, len, &out, &out_size, &root_type);
+            TEST_CHECK(ret == 0);
+            TEST_MSG("%s: %s", flb_json_index_impl_name(impls[j]), js);
+            if (ret != 0) {
+                continue;
+            }
+            TEST_CHECK(root_type == JSMN_OBJECT);
+            if (j == 0) {
+                ref = out;
+                ref_size = out_size;
+                continue;
+            }
+            TEST_CHECK(out_size == ref_size &&
+                       memcmp(out, ref, ref_size) == 0);
+            flb_free(out);
+        }
+        flb_free(ref);
+        ref = NULL;
+    }
+    json_index_impls(impls);
+}
+
+#define PACK_THREADS    8
+
+struct pack_thread {
+    pthread_t tid;
+    const char *js;
+    size_t len;
+    char *out;
+    size_t out_size;
+    int ret;
+};
+
+static pthread_barrier_t pack_threads_barrier;
+
+static void *pack_thread_run(void *data)
+{
+    int root_type;
+    struct pack_thread *th = data;
+
+    /* start all together */
+    pthread_barrier_wait(&pack_threads_barrier);
+    th->ret = flb_pack_json(th->js, th->len, &th->out, &th->out_size,
+                            &root_type);
+    return NULL;
+}
+
+/*
+ * The first calls to the tokenizer pick the structural index implementation,
+ * several threads doing it at once must all get the same result (every test
+ * runs on its own process, so this is really the first use).
+ */
+void test_json_pack_threads()
+{
+    int i;
+    int ret;
+    int root_type;
+    size_t len;
+    size_t ref_size;
+    char js[1024];
+    char *ref;
+    struct pack_thread th[PACK_THREADS];
+
+    len = snprintf(js, sizeof(js),
+                   "{\"key\":\"%.*s\",\"esc\":\"a\\\"b\\\\c\\u00e9\","
+                   "\"list\":[1,2.5,true,false,null,{\"k\":\"%.*s\"}]}",
+                   80, XS, 100, XS);
+
+    pthread_barrier_init(&pack_threads_barrier, NULL, PACK_THREADS);
+    for (i = 0; i < PACK_THREADS; i++) {
+        memset(&th[i], '\0', sizeof(struct pack_thread));
+        th[i].js = js;
+        th[i].len = len;
+        ret = pthread_create(&th[i].tid, NULL, pack_thread_run, &th[i]);
+        TEST_CHECK(ret == 0);
+    }
+    for (i = 0; i < PACK_THREADS; i++) {
+        pthread_join(th[i].tid, NULL);
+    }
+    pthread_barrier_destroy(&pack_threads_barrier);
+
+    ret = flb_pack_json(js, len, &ref, &ref_size, &root_type);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < PACK_THREADS; i++) {
+        TEST_CHECK(th[i].ret == 0);
+        TEST_CHECK(th[i].out_size == ref_size &&
+                   memcmp(th[i].out, ref, ref_size) == 0);
+        TEST_MSG("thread %i got a different result", i);
+        flb_free(th[i].out);
+    }
+    flb_free(ref);
+}
+
+/*
+ * Benchmark: JSON to MessagePack throughput of every structural index
+ * implementation, compared with the jsmn tokenizer alone.
+ */
+void bench_json_pack()
+{
+    int i;
+    int j;
+    int n;
+    int ret;
+    int rounds = 20;
+    int out_size;
+    int impls[3];
+    double t;
+    double mb;
+    char *out;
+    flb_sds_t js;
+    struct flb_pack_state state;
+
+    js = flb_sds_create_size(4 * 1024 * 1024);
+    for (i = 0; flb_sds_len(js) < 4 * 1024 * 1024 - 512; i++) {
+        flb_sds_printf(&js, "{\"date\":\"2020-03-0%iT10:12:%02i.123Z\","
+                       "\"log\":\"GET /api/v1/items/%i HTTP/1.1 200 "
+                       "\\\"curl/7.68.0\\\"\",\"stream\":\"stdout\","
+                       "\"level\":%i,\"latency\":0.%03i,\"tags\":[\"a\","
+                       "\"b\"],\"ok\":true}\n",
+                       i % 10, i % 60, i, i % 7, i % 1000);
+    }
+    mb = flb_sds_len(js) / (1024.0 * 1024.0);
+
+    printf("\n  %10s %14s\n", "tokenizer", "MB/s");
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        flb_pack_state_init(&state);
+        ret = flb_json_tokenise(js, flb_sds_len(js), &state);
+        TEST_CHECK(ret == 0);
+        flb_pack_state_reset(&state);
+    }
+    printf("  %10s %14.1f\n", "jsmn", (mb * rounds) / (bench_cpu_time() - t));
+
+    n = json_index_impls(impls);
+    for (j = 0; j < n; j++) {
+        flb_json_index_set_impl(impls[j]);
+        t = bench_cpu_time();
+        for (i = 0; i < rounds; i++) {
+            flb_pack_state_init(&state);
+            ret = flb_pack_json_state(js, flb_sds_len(js), &out, &out_size,
+                                      &state);
+            TEST_CHECK(ret == 0);
+            if (ret == 0) {
+                flb_free(out);
+            }
+            flb_pack_state_reset(&state);
+        }
+        printf("  %10s %14.1f\n", flb_json_index_impl_name(impls[j]),
+               (mb * rounds) / (bench_cpu_time() - t));
+    }
+    json_index_impls(impls);
+    flb_sds_destroy(js);
+}
+
+/*
+ * Reference MessagePack to JSON conversion, the former fixed buffer
+ * encoder: the streaming one must produce the very same bytes.
+ */
+static int json_ref(char *buf, int *off, size_t size, msgpack_object *o)
+{
+    int i;
+    int len;
+    char tmp[512];
+
+    switch (o->type) {
+    case MSGPACK_OBJECT_NIL:
+        len = snprintf(tmp, sizeof(tmp), "null");
+        break;
+    case MSGPACK_OBJECT_BOOLEAN:
+        len = snprintf(tmp, sizeof(tmp), "%s",
+                       o->via.boolean ? "true" : "false");
+        break;
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        len = snprintf(tmp, sizeof(tmp), "%lu", (unsigned long) o->via.u64);
+        break;
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        len = snprintf(tmp, sizeof(tmp), "%ld", (signed long) o->via.i64);
+        break;
+    case MSGPACK_OBJECT_FLOAT32:
+    case MSGPACK_OBJECT_FLOAT64:
+        len = snprintf(tmp, sizeof(tmp), "%f", o->via.f64);
+        break;
+    case MSGPACK_OBJECT_STR:
+    case MSGPACK_OBJECT_BIN:
+        buf[(*off)++] = '"';
+        if (o->via.str.size > 0 &&
+            !flb_utils_write_str(buf, off, size,
+                                 o->via.str.ptr, o->via.str.size)) {
+            return -1;
+        }
+        buf[(*off)++] = '"';
+        return 0;
+    case MSGPACK_OBJECT_EXT:
+        buf[(*off)++] = '"';
+        for (i = 0; i < o->via.ext.size; i++) {
+            *off += sprintf(buf + *off, "\\x%02x", (char) o->via.ext.ptr[i]);
+        }
+        buf[(*off)++] = '"';
+        return 0;
+    case MSGPACK_OBJECT_ARRAY:
+        buf[(*off)++] = '[';
+        for (i = 0; i < o->via.array.size; i++) {
+            if (i > 0) {
+                buf[(*off)++] = ',';
+            }
+            if (json_ref(buf, off, size, &o->via.array.ptr[i]) == -1) {
+                return -1;
+            }
+        }
+        buf[(*off)++] = ']';
+        return 0;
+    case MSGPACK_OBJECT_MAP:
+        buf[(*off)++] = '{';
+        for (i = 0; i < o->via.map.size; i++) {
+            if (i > 0) {
+                buf[(*off)++] = ',';
+            }
+            if (json_ref(buf, off, size, &o->via.map.ptr[i].key) == -1) {
+                return -1;
+            }
+            buf[(*off)++] = ':';
+            if (json_ref(buf, off, size, &o->via.map.ptr[i].val) == -1) {
+                return -1;
+            }
+        }
+        buf[(*off)++] = '}';
+        return 0;
+    default:
+        return -1;
+    }
+
+    memcpy(buf + *off, tmp, len);
+    *off += len;
+    return 0;
+}
+
+static uint64_t json_rand(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/* Random string mixing clean runs and everything that must be escaped */
+static void json_rand_str(uint64_t *seed, char *buf, int *len)
+{
+    int i;
+    int n;
+    int r;
+    char *pieces[] = {
+        "\"", "\\", "\n", "\r", "\t", "\b", "\f", "\x01", "\x1f", "\x7f",
+        "\xc3\xa9", "\xe3\x81\x82", "\xf0\x9f\x98\x80", "\xe2\x82\xac",
+    };
+    char *invalid[] = {
+        "\x80", "\xc3", "\xe3\x81", "\xed\xa0\x80", "\xc0\xaf", "\xff",
+    };
+
+    *len = 0;
+    n = json_rand(seed) % 24;
+    for (i = 0; i < n; i++) {
+        r = json_rand(seed) % 100;
+        if (r < 50) {
+            /* clean run, crossing the SIMD block boundaries */
+            r = json_rand(seed) % 40;
+            memset(buf + *len, 'a' + i % 26, r);
+            *len += r;
+        }
+        else if (r < 99) {
+            r = json_rand(seed) % (sizeof(pieces) / sizeof(char *));
+            memcpy(buf + *len, pieces[r], strlen(pieces[r]));
+            *len += strlen(pieces[r]);
+        }
+        else {
+            r = json_rand(seed) % (sizeof(invalid) / sizeof(char *));
+            memcpy(buf + *len, invalid[r], strlen(invalid[r]));
+            *len += strlen(invalid[r]);
+        }
+    }
+}
+
+static void json_rand_object(uint64_t *seed, msgpack_packer *pck, int depth)
+{
+    int i;
+    int n;
+    int len;
+    char buf[2048];
+
+    switch (json_rand(seed) % (depth < 3 ? 10 : 8)) {
+    case 0:
+        msgpack_pack_nil(pck);
+        break;
+    case 1:
+        if (json_rand(seed) & 1) {
+            msgpack_pack_true(pck);
+        }
+        else {
+            msgpack_pack_false(pck);
+        }
+        break;
+    case 2:
+        msgpack_pack_uint64(pck, json_rand(seed) >> (json_rand(seed) % 64));
+        break;
+    case 3:
+        msgpack_pack_int64(pck, -(int64_t) (json_rand(seed) >>
+                                            (1 + json_rand(seed) % 63)));
+        break;
+    case 4:
+        msgpack_pack_double(pck, (double) (int64_t) json_rand(seed) /
+                            (1 << (json_rand(seed) % 30)));
+        break;
+    case 5:
+        json_rand_str(seed, buf, &len);
+        msgpack_pack_bin(pck, len);
+        msgpack_pack_bin_body(pck, buf, len);
+        break;
+    case 6:
+    case 7:
+        json_rand_str(seed, buf, &len);
+        msgpack_pack_str(pck, len);
+        msgpack_pack_str_body(pck, buf, len);
+        break;
+    case 8:
+        n = json_rand(seed) % 6;
+        msgpack_pack_array(pck, n);
+        for (i = 0; i < n; i++) {
+            json_rand_object(seed, pck, depth + 1);
+        }
+        break;
+    case 9:
+        n = json_rand(seed) % 6;
+        msgpack_pack_map(pck, n);
+        for (i = 0; i < n; i++) {
+            json_rand_str(seed, buf, &len);
+            msgpack_pack_str(pck, len);
+            msgpack_pack_str_body(pck, buf, len);
+            json_rand_object(seed, pck, depth + 1);
+        }
+        break;
+    }
+}
+
+/* Streaming MessagePack to JSON encoder against the reference one */
+void test_msgpack_to_json()
+{
+    int i;
+    int ret;
+    int off;
+    size_t size = 1024 * 1024;
+    size_t moff;
+    char *ref;
+    char *str;
+    char small[8];
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    flb_sds_t js;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+
+    ref = flb_malloc(size);
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < 5000; i++) {
+        msgpack_sbuffer_clear(&sbuf);
+        json_rand_object(&seed, &pck, 0);
+
+        moff = 0;
+        msgpack_unpacked_init(&result);
+        msgpack_unpack_next(&result, sbuf.data, sbuf.size, &moff);
+
+        off = 0;
+        ret = json_ref(ref, &off, size, &result.data);
+        TEST_CHECK(ret == 0);
+        ref[off] = '\0';
+
+        js = flb_msgpack_raw_to_json_sds(sbuf.data, sbuf.size);
+        if (!TEST_CHECK(js != NULL && flb_sds_len(js) == off &&
+                        memcmp(js, ref, off) == 0 && js[off] == '\0')) {
+            TEST_MSG("expected: %s", ref);
+            TEST_MSG("got     : %s", js);
+        }
+        flb_sds_destroy(js);
+
+        /* the size is only a hint, start small to force reallocations */
+        str = flb_msgpack_to_json_str(1, &result.data);
+        TEST_CHECK(str != NULL && strcmp(str, ref) == 0);
+        flb_free(str);
+
+        ret = flb_msgpack_to_json(ref, size, &result.data);
+        TEST_CHECK(ret == off);
+
+        msgpack_unpacked_destroy(&result);
+    }
+
+    /* fixed buffers still fail when there is no room */
+    msgpack_sbuffer_clear(&sbuf);
+    msgpack_pack_str(&pck, 10);
+    msgpack_pack_str_body(&pck, "0123456789", 10);
+    moff = 0;
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, sbuf.data, sbuf.size, &moff);
+    ret = flb_msgpack_to_json(small, sizeof(small), &result.data);
+    TEST_CHECK(ret < 0);
+    msgpack_unpacked_destroy(&result);
+
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_free(ref);
+}
+
+/* Records to JSON lines, as written by most of the outputs */
+void test_msgpack_to_json_lines()
+{
+    int i;
+    int j;
+    int off;
+    size_t moff;
+    char *ref;
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    int formats[] = {
+        FLB_PACK_JSON_DATE_DOUBLE,
+        FLB_PACK_JSON_DATE_ISO8601,
+        FLB_PACK_JSON_DATE_EPOCH,
+    };
+    struct flb_time tm;
+    flb_sds_t js;
+    flb_sds_t date_key;
+    msgpack_sbuffer sbuf;
+    msgpack_sbuffer rbuf;
+    msgpack_packer pck;
+    msgpack_packer rpck;
+    msgpack_unpacked result;
+
+    ref = flb_malloc(4 * 1024 * 1024);
+    date_key = flb_sds_create("da\"te");
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    msgpack_sbuffer_init(&rbuf);
+    msgpack_packer_init(&rpck, &rbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < 100; i++) {
+        msgpack_pack_array(&pck, 2);
+        tm.tm.tv_sec = 1500000000 + i;
+        tm.tm.tv_nsec = i * 1234567;
+        flb_time_append_to_msgpack(&tm, &pck, 0);
+        msgpack_pack_map(&pck, 2);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "log", 3);
+        json_rand_object(&seed, &pck, 0);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "n", 1);
+        msgpack_pack_int64(&pck, i);
+    }
+
+    for (j = 0; j < sizeof(formats) / sizeof(int); j++) {
+        /* reference: a map with the date key first, one record per line */
+        off = 0;
+        moff = 0;
+        msgpack_unpacked_init(&result);
+        while (msgpack_unpack_next(&result, sbuf.data, sbuf.size, &moff) ==
+               MSGPACK_UNPACK_SUCCESS) {
+            msgpack_object *map;
+
+            flb_time_pop_from_msgpack(&tm, &result, &map);
+            msgpack_sbuffer_clear(&rbuf);
+            msgpack_pack_map(&rpck, map->via.map.size + 1);
+            msgpack_pack_str(&rpck, flb_sds_len(date_key));
+            msgpack_pack_str_body(&rpck, date_key, flb_sds_len(date_key));
+            if (formats[j] == FLB_PACK_JSON_DATE_DOUBLE) {
+                msgpack_pack_double(&rpck, flb_time_to_double(&tm));
+            }
+            else if (formats[j] == FLB_PACK_JSON_DATE_EPOCH) {
+                msgpack_pack_uint64(&rpck, tm.tm.tv_sec);
+            }
+            else {
+                char date[64];
+                struct tm t;
+                size_t s;
+
+                gmtime_r(&tm.tm.tv_sec, &t);
+                s = strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &t);
+                s += snprintf(date + s, sizeof(date) - s, ".%06luZ",
+                              (unsigned long) tm.tm.tv_nsec / 1000);
+                msgpack_pack_str(&rpck, s);
+                msgpack_pack_str_body(&rpck, date, s);
+            }
+            for (i = 0; i < map->via.map.size; i++) {
+                msgpack_pack_object(&rpck, map->via.map.ptr[i].key);
+                msgpack_pack_object(&rpck, map->via.map.ptr[i].val);
+            }
+
+            js = flb_msgpack_raw_to_json_sds(rbuf.data, rbuf.size);
+            memcpy(ref + off, js, flb_sds_len(js));
+            off += flb_sds_len(js);
+            ref[off++] = '\n';
+            flb_sds_destroy(js);
+        }
+        msgpack_unpacked_destroy(&result);
+
+        js = flb_pack_msgpack_to_json_format(sbuf.data, sbuf.size,
+                                             FLB_PACK_JSON_FORMAT_LINES,
+                                             formats[j], date_key);
+        TEST_CHECK(js != NULL && flb_sds_len(js) == off &&
+                   memcmp(js, ref, off) == 0 && js[off] == '\0');
+        flb_sds_destroy(js);
+    }
+
+    msgpack_sbuffer_destroy(&rbuf);
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_sds_destroy(date_key);
+    flb_free(ref);
+}
+
+/* Benchmark: MessagePack to JSON throughput, streaming vs reference */
+void bench_msgpack_to_json()
+{
+    int i;
+    int off;
+    int rounds = 2000;
+    size_t moff;
+    double t;
+    double mb;
+    char *ref;
+    flb_sds_t js;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    msgpack_pack_array(&pck, 200);
+    for (i = 0; i < 200; i++) {
+        msgpack_pack_map(&pck, 4);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "log", 3);
+        msgpack_pack_str(&pck, 88);
+        msgpack_pack_str_body(&pck, "10.0.0.1 - - [17/Jul/2017:20:17:03 "
+                              "+0000] \"GET /api/v1/items HTTP/1.1\" 200 "
+                              "512 \"-\" \"curl\"\n", 88);
+        msgpack_pack_str(&pck, 6);
+        msgpack_pack_str_body(&pck, "stream", 6);
+        msgpack_pack_str(&pck, 6);
+        msgpack_pack_str_body(&pck, "stdout", 6);
+        msgpack_pack_str(&pck, 5);
+        msgpack_pack_str_body(&pck, "level", 5);
+        msgpack_pack_int64(&pck, i);
+        msgpack_pack_str(&pck, 7);
+        msgpack_pack_str_body(&pck, "latency", 7);
+        msgpack_pack_double(&pck, i / 1000.0);
+    }
+
+    moff = 0;
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, sbuf.data, sbuf.size, &moff);
+    ref = flb_malloc(1024 * 1024);
+
+    off = 0;
+    json_ref(ref, &off, 1024 * 1024, &result.data);
+    mb = off / (1024.0 * 1024.0);
+
+    printf("\n  %10s %14s\n", "encoder", "MB/s");
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        off = 0;
+        json_ref(ref, &off, 1024 * 1024, &result.data);
+    }
+    printf("  %10s %14.1f\n", "reference", (mb * rounds) / (bench_cpu_time() - t));
+
+    js = flb_sds_create_size(1024);
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        flb_sds_len_set(js, 0);
+        flb_msgpack_to_json_sds(&js, &result.data);
+    }
+    printf("  %10s %14.1f\n", "streaming", (mb * rounds) / (bench_cpu_time() - t));
+    flb_sds_destroy(js);
+
+    msgpack_unpacked_destroy(&result);
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_free(ref);
+}
+
 TEST_LIST = {
+#ifndef FLB_TESTS_BENCH
     /* JSON maps iteration */
     { "json_pack", test_json_pack },
     { "json_pack_iter", test_json_pack_iter},
@@ -587,8 +1412,19 @@ TEST_LIST = {
     { "json_pack_mult_iter", test_json_pack_mult_iter},
     { "json_pack_bug342", test_json_pack_bug342},
     { "json_pack_bug1278"  , test_json_pack_bug1278},
+    { "json_pack_fixtures", test_json_pack_fixtures},
+    { "json_pack_edge_cases", test_json_pack_edge_cases},
+    { "json_pack_blocks", test_json_pack_blocks},
+    { "json_pack_threads", test_json_pack_threads},
 
     /* Mixed bytes, check JSON encoding */
     { "utf8_to_json", test_utf8_to_json},
+    { "msgpack_to_json", test_msgpack_to_json},
+    { "msgpack_to_json_lines", test_msgpack_to_json_lines},
+#else
+    /* Benchmarks: flb-bench-* targets */
+    { "bench_json_pack", bench_json_pack},
+    { "bench_msgpack_to_json", bench_msgpack_to_json},
+#endif
     { 0 }
 };
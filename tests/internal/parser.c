@@ -4,9 +4,13 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_str.h>
 
 #include <time.h>
+#include <stdlib.h>
 #include "flb_tests_internal.h"
+#include "../lib/bench.h"
 
 /* Parsers configuration */
 #define JSON_PARSERS  FLB_TESTS_DATA_PATH "/data/parser/json.conf"
@@ -402,10 +406,913 @@ void test_regex_parser_time_lookup()
     flb_config_exit(config);
 }
 
+/* Types conversion: numbers as atof(3) takes them, else kept as strings */
+void test_parser_typecast()
+{
+    int i;
+    int ret;
+    size_t off;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+    msgpack_object *o;
+    struct flb_parser_types types[] = {
+        {"i", 1, FLB_PARSER_TYPE_INT},
+        {"h", 1, FLB_PARSER_TYPE_HEX},
+        {"f", 1, FLB_PARSER_TYPE_FLOAT},
+    };
+    struct {
+        char *key;
+        char *val;
+        int type;
+        int64_t i64;
+        double f64;
+    } cases[] = {
+        {"i", "42",                   MSGPACK_OBJECT_POSITIVE_INTEGER, 42, 0},
+        {"i", " -7 ",                 MSGPACK_OBJECT_NEGATIVE_INTEGER, -7, 0},
+        {"i", "12.9",                 MSGPACK_OBJECT_POSITIVE_INTEGER, 12, 0},
+        {"i", "18446744073709551615", MSGPACK_OBJECT_POSITIVE_INTEGER, -1, 0},
+        {"i", "1e30",                 MSGPACK_OBJECT_STR, 0, 0},
+        {"i", "abc",                  MSGPACK_OBJECT_STR, 0, 0},
+        {"i", "12abc",                MSGPACK_OBJECT_STR, 0, 0},
+        {"i", "007",                  MSGPACK_OBJECT_POSITIVE_INTEGER, 7, 0},
+        {"i", "0080",                 MSGPACK_OBJECT_POSITIVE_INTEGER, 80, 0},
+        {"i", "+5",                   MSGPACK_OBJECT_POSITIVE_INTEGER, 5, 0},
+        {"i", "1.",                   MSGPACK_OBJECT_POSITIVE_INTEGER, 1, 0},
+        {"i", ".5",                   MSGPACK_OBJECT_POSITIVE_INTEGER, 0, 0},
+        {"i", "+",                    MSGPACK_OBJECT_STR, 0, 0},
+        {"h", "0xff",                 MSGPACK_OBJECT_POSITIVE_INTEGER, 255, 0},
+        {"h", "FF",                   MSGPACK_OBJECT_POSITIVE_INTEGER, 255, 0},
+        {"h", "0xfg",                 MSGPACK_OBJECT_STR, 0, 0},
+        {"f", "0.99",                 MSGPACK_OBJECT_FLOAT, 0, 0.99},
+        {"f", "1e3",                  MSGPACK_OBJECT_FLOAT, 0, 1000.0},
+        {"f", "-5",                   MSGPACK_OBJECT_FLOAT, 0, -5.0},
+        {"f", "007",                  MSGPACK_OBJECT_FLOAT, 0, 7.0},
+        {"f", "+5",                   MSGPACK_OBJECT_FLOAT, 0, 5.0},
+        {"f", "1.",                   MSGPACK_OBJECT_FLOAT, 0, 1.0},
+        {"f", ".5",                   MSGPACK_OBJECT_FLOAT, 0, 0.5},
+        {"f", "1,5",                  MSGPACK_OBJECT_STR, 0, 0},
+        {"f", ".",                    MSGPACK_OBJECT_STR, 0, 0},
+        {"s", "12",                   MSGPACK_OBJECT_STR, 0, 0},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        msgpack_sbuffer_init(&sbuf);
+        msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+        ret = flb_parser_typecast(cases[i].key, strlen(cases[i].key),
+                                  cases[i].val, strlen(cases[i].val),
+                                  &pck, types,
+                                  sizeof(types) / sizeof(types[0]));
+        TEST_CHECK(ret == 0);
+
+        /* skip the key */
+        off = 0;
+        msgpack_unpacked_init(&result);
+        msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off);
+        ret = msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off);
+        TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+
+        o = &result.data;
+        TEST_CHECK(o->type == cases[i].type);
+        TEST_MSG("%s=%s: type=%i expected=%i", cases[i].key, cases[i].val,
+                 o->type, cases[i].type);
+        if (o->type == cases[i].type) {
+            if (o->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+                TEST_CHECK(o->via.u64 == (uint64_t) cases[i].i64);
+            }
+            else if (o->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
+                TEST_CHECK(o->via.i64 == cases[i].i64);
+            }
+            else if (o->type == MSGPACK_OBJECT_FLOAT) {
+                TEST_CHECK(o->via.f64 == cases[i].f64);
+            }
+            else {
+                TEST_CHECK(o->via.str.size == strlen(cases[i].val) &&
+                           memcmp(o->via.str.ptr, cases[i].val,
+                                  o->via.str.size) == 0);
+            }
+        }
+
+        msgpack_unpacked_destroy(&result);
+        msgpack_sbuffer_destroy(&sbuf);
+    }
+}
+
+/*
+ * Reference implementation of the time lookup: strptime(3) for every
+ * call. Used to verify the cached and specialised paths.
+ */
+static int time_lookup_ref(const char *str, time_t now,
+                           struct flb_parser *p, time_t *epoch, double *ns)
+{
+    int len;
+    char *s;
+    char *end;
+    char tmp[64];
+    char frac[32];
+    struct tm tm;
+    struct tm tmy;
+
+    *ns = 0;
+    memset(&tm, '\0', sizeof(tm));
+
+    if (p->time_with_year == FLB_FALSE) {
+        gmtime_r(&now, &tmy);
+        snprintf(tmp, sizeof(tmp) - 1, "%i %s", tmy.tm_year + 1900, str);
+        s = strptime(tmp, p->time_fmt_year, &tm);
+    }
+    else {
+        snprintf(tmp, sizeof(tmp) - 1, "%s", str);
+        s = strptime(tmp, p->time_fmt, &tm);
+    }
+    if (!s) {
+        return -1;
+    }
+
+    if (p->time_frac_secs && (*s == '.' || *s == ',')) {
+        len = strlen(s);
+        if (len > 31) {
+            len = 31;
+        }
+        memcpy(frac, s, len);
+        frac[len] = '\0';
+        if (frac[1] < '0' || frac[1] > '9') {
+            return -1;
+        }
+        frac[0] = '.';
+        *ns = strtod(frac, &end);
+        s = strptime(end, p->time_frac_secs, &tm);
+        if (!s) {
+            return -1;
+        }
+    }
+
+#ifdef FLB_HAVE_GMTOFF
+    if (p->time_with_tz == FLB_FALSE) {
+        tm.tm_gmtoff = p->time_offset;
+    }
+#endif
+    *epoch = flb_parser_tm2time(&tm);
+    return 0;
+}
+
+static uint64_t fuzz_rand(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/* Compose a time string for 'fmt', %L is replaced by random digits */
+static void fuzz_time(uint64_t *seed, const char *fmt, char *buf, size_t size)
+{
+    int i;
+    int n;
+    int off;
+    char f[64];
+    char digits[16];
+    char *p;
+    time_t t;
+    struct tm tm;
+    static const int offsets[] = {0, 3600, -21600, 19800, 20700, 43200,
+                                  -43200, 46800, 1800, -34200};
+
+    t = fuzz_rand(seed) % 4102444800;
+    off = offsets[fuzz_rand(seed) % (sizeof(offsets) / sizeof(int))];
+    t += off;
+    gmtime_r(&t, &tm);
+
+    snprintf(f, sizeof(f), "%s", fmt);
+    p = strstr(f, "%L");
+    if (p) {
+        n = 1 + fuzz_rand(seed) % 12;
+        for (i = 0; i < n; i++) {
+            digits[i] = '0' + fuzz_rand(seed) % 10;
+        }
+        digits[n] = '\0';
+        memmove(p + n, p + 2, strlen(p + 2) + 1);
+        memcpy(p, digits, n);
+    }
+    p = strstr(f, "%z");
+    if (p) {
+        snprintf(digits, sizeof(digits), "%c%02i%s%02i",
+                 off < 0 ? '-' : '+', abs(off) / 3600,
+                 fuzz_rand(seed) % 4 ? "" : ":", (abs(off) % 3600) / 60);
+        n = strlen(digits);
+        memmove(p + n, p + 2, strlen(p + 2) + 1);
+        memcpy(p, digits, n);
+    }
+    strftime(buf, size, f, &tm);
+}
+
+/* Cached and specialised time parsing must match strptime(3) results */
+void test_parser_time_lookup_fuzz()
+{
+    int i;
+    int j;
+    int k;
+    int len;
+    int ret;
+    int ret_ref;
+    int errors = 0;
+    char name[16];
+    char buf[64];
+    char prev[64] = "";
+    double ns;
+    double ns_ref;
+    time_t now = 1500322623;
+    time_t epoch;
+    time_t epoch_ref;
+    uint64_t seed = 0x853c49e6748fea9bULL;
+    struct tm tm;
+    struct flb_config *config;
+    struct flb_parser *p;
+    static const char mutations[] = "0123456789 :-+.,ZTJanbpO/\t";
+    char *formats[] = {
+        "%Y-%m-%dT%H:%M:%S",
+        "%Y-%m-%dT%H:%M:%S.%L",
+        "%Y-%m-%dT%H:%M:%S,%L",
+        "%Y-%m-%dT%H:%M:%SZ",
+        "%Y-%m-%dT%H:%M:%S.%LZ",
+        "%Y-%m-%dT%H:%M:%S%z",
+        "%Y-%m-%dT%H:%M:%S.%L%z",
+        "%Y-%m-%d %H:%M:%S",
+        "%Y-%m-%d %H:%M:%S.%L %z",
+        "%d/%b/%Y:%H:%M:%S %z",
+        "%b %d %H:%M:%S",
+        "%b %d %H:%M:%S.%L",
+        "%b %d %H:%M:%S %z",
+        "%b %d %H:%M:%S,%L %z",
+        "%m/%d/%Y %H:%M:%S.%L %z",
+    };
+
+    config = flb_config_init();
+
+    for (i = 0; i < sizeof(formats) / sizeof(char *); i++) {
+        snprintf(name, sizeof(name), "fuzz_%i", i);
+        p = flb_parser_create(name, "regex", "(?<time>.*)", formats[i],
+                              NULL, (i % 2) ? "-0600" : NULL, FLB_TRUE,
+                              NULL, 0, NULL, config);
+        TEST_CHECK(p != NULL);
+        if (!p) {
+            continue;
+        }
+
+        for (j = 0; j < 20000; j++) {
+            /* keep the previous timestamp from time to time */
+            if (prev[0] && fuzz_rand(&seed) % 2) {
+                strcpy(buf, prev);
+            }
+            else {
+                fuzz_time(&seed, formats[i], buf, sizeof(buf));
+                strcpy(prev, buf);
+            }
+
+            len = strlen(buf);
+            for (k = fuzz_rand(&seed) % 3; k > 0 && len > 0; k--) {
+                if (fuzz_rand(&seed) % 4 == 0) {
+                    len--;
+                    buf[len] = '\0';
+                }
+                else {
+                    buf[fuzz_rand(&seed) % len] =
+                        mutations[fuzz_rand(&seed) % (sizeof(mutations) - 1)];
+                }
+            }
+
+            ret_ref = time_lookup_ref(buf, now, p, &epoch_ref, &ns_ref);
+            if (j % 2) {
+                ret = flb_parser_time_lookup_epoch(buf, len, now, p,
+                                                   &epoch, &ns);
+            }
+            else {
+                ret = flb_parser_time_lookup(buf, len, now, p, &tm, &ns);
+                epoch = flb_parser_tm2time(&tm);
+            }
+
+            if (ret != ret_ref ||
+                (ret == 0 && (epoch != epoch_ref || ns != ns_ref))) {
+                errors++;
+                if (errors < 10) {
+                    TEST_MSG("fmt='%s' time='%s' ret=%i/%i epoch=%li/%li",
+                             formats[i], buf, ret, ret_ref,
+                             (long) epoch, (long) epoch_ref);
+                }
+            }
+        }
+        prev[0] = '\0';
+    }
+    TEST_CHECK(errors == 0);
+
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
+/* Benchmark: time lookups per second, strptime(3) vs cached lookup */
+void bench_time_lookup()
+{
+    int i;
+    int j;
+    int n = 200000;
+    char *p_str;
+    char *bufs;
+    char f[64];
+    double ns;
+    double t;
+    time_t now = 1500322623;
+    time_t epoch;
+    struct tm tm;
+    struct flb_config *config;
+    struct flb_parser *p;
+    char *formats[] = {
+        "%Y-%m-%dT%H:%M:%S.%L%z",
+        "%d/%b/%Y:%H:%M:%S %z",
+        "%b %d %H:%M:%S",
+    };
+
+    config = flb_config_init();
+    bufs = flb_malloc(n * 64);
+    printf("\n  %-24s %14s %14s\n", "format", "strptime/s", "lookup/s");
+
+    for (i = 0; i < sizeof(formats) / sizeof(char *); i++) {
+        p = flb_parser_create(formats[i], "regex", "(?<time>.*)", formats[i],
+                              NULL, NULL, FLB_TRUE, NULL, 0, NULL, config);
+        TEST_CHECK(p != NULL);
+        if (!p) {
+            continue;
+        }
+
+        /* a new second every 100 records */
+        for (j = 0; j < n; j++) {
+            snprintf(f, sizeof(f), "%s", formats[i]);
+            p_str = strstr(f, "%L");
+            if (p_str) {
+                memmove(p_str + 3, p_str + 2, strlen(p_str + 2) + 1);
+                p_str[0] = '0' + (j / 100) % 10;
+                p_str[1] = '0' + (j / 10) % 10;
+                p_str[2] = '0' + j % 10;
+            }
+            epoch = now + (j / 100);
+            gmtime_r(&epoch, &tm);
+            strftime(bufs + (j * 64), 64, f, &tm);
+        }
+
+        printf("  %-24s", formats[i]);
+
+        t = bench_wall_time();
+        for (j = 0; j < n; j++) {
+            time_lookup_ref(bufs + (j * 64), now, p, &epoch, &ns);
+        }
+        printf(" %14.0f", n / (bench_wall_time() - t));
+
+        t = bench_wall_time();
+        for (j = 0; j < n; j++) {
+            flb_parser_time_lookup_epoch(bufs + (j * 64),
+                                         strlen(bufs + (j * 64)),
+                                         now, p, &epoch, &ns);
+        }
+        printf(" %14.0f\n", n / (bench_wall_time() - t));
+    }
+
+    flb_free(bufs);
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
+static struct flb_parser_types *regex_types(char *key1, int type1,
+                                            char *key2, int type2)
+{
+    struct flb_parser_types *types;
+
+    types = flb_calloc(2, sizeof(struct flb_parser_types));
+    types[0].key = flb_strdup(key1);
+    types[0].key_len = strlen(key1);
+    types[0].type = type1;
+    types[1].key = flb_strdup(key2);
+    types[1].key_len = strlen(key2);
+    types[1].type = type2;
+    return types;
+}
+
+/* Named captures: keys order, types, time key, empty and unmatched groups */
+void test_regex_parser_fields()
+{
+    int i;
+    int ret;
+    size_t out_size;
+    char *out_buf;
+    flb_sds_t json;
+    struct flb_time out_time;
+    struct flb_config *config;
+    struct flb_parser *p;
+    struct {
+        char *pattern;
+        char *time_fmt;
+        int time_keep;
+        int typed;
+        char *line;
+        char *json;
+        time_t sec;
+    } cases[] = {
+        {"^(?<host>[^ ]*) (?<code>[^ ]*) (?<size>[^ ]*) (?<ratio>[^ ]*) "
+         "(?<a_field_name_longer_than_thirty_two_bytes>.*)$", NULL, 0, 1,
+         "web 200 - 0.5 x",
+         "{\"host\":\"web\",\"code\":200,\"size\":\"-\",\"ratio\":0.500000,"
+         "\"a_field_name_longer_than_thirty_two_bytes\":\"x\"}", 0},
+        {"^(?<host>[^ ]*) (?<code>[^ ]*) (?<size>[^ ]*) (?<ratio>[^ ]*) "
+         "(?<msg>.*)$", NULL, 0, 1,
+         "web abc - 1e1 x",
+         "{\"host\":\"web\",\"code\":\"abc\",\"size\":\"-\",\"ratio\":10.000000,"
+         "\"msg\":\"x\"}", 0},
+        {"^(?<time>[^ ]+) (?<msg>.*)$", "%Y-%m-%dT%H:%M:%S", FLB_FALSE, 0,
+         "2017-07-17T20:17:03 hello",
+         "{\"msg\":\"hello\"}", 1500322623},
+        {"^(?<time>[^ ]+) (?<msg>.*)$", "%Y-%m-%dT%H:%M:%S", FLB_TRUE, 0,
+         "2017-07-17T20:17:03 hello",
+         "{\"time\":\"2017-07-17T20:17:03\",\"msg\":\"hello\"}", 1500322623},
+        {"^(?<time>[^ ]+) (?<msg>.*)$", "%Y-%m-%dT%H:%M:%S", FLB_FALSE, 0,
+         "invalid hello",
+         "{\"msg\":\"hello\"}", 0},
+        {"^(?<a>[^ ]*) (?<b>.*)$", NULL, 0, 0,
+         " x",
+         "{\"b\":\"x\"}", 0},
+        {"^(?<a>\\d+)?(?<b>.*)$", NULL, 0, 0,
+         "abc",
+         "{\"b\":\"abc\"}", 0},
+        {"^(?:(?<v>\\d+)|(?<v>[a-z]+))$", NULL, 0, 0,
+         "abc",
+         "{\"v\":\"abc\"}", 0},
+    };
+
+    config = flb_config_init();
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        p = flb_parser_create("fields", "regex", cases[i].pattern,
+                              cases[i].time_fmt, NULL, NULL,
+                              cases[i].time_keep,
+                              cases[i].typed ?
+                              regex_types("code", FLB_PARSER_TYPE_INT,
+                                          "ratio", FLB_PARSER_TYPE_FLOAT) :
+                              NULL,
+                              cases[i].typed ? 2 : 0,
+                              NULL, config);
+        TEST_CHECK(p != NULL);
+        if (!p) {
+            continue;
+        }
+
+        memset(&out_time, '\0', sizeof(out_time));
+        ret = flb_parser_do(p, cases[i].line, strlen(cases[i].line),
+                            (void **) &out_buf, &out_size, &out_time);
+        TEST_CHECK(ret == strlen(cases[i].line));
+        TEST_MSG("'%s': ret=%i", cases[i].line, ret);
+        if (ret == -1) {
+            flb_parser_destroy(p);
+            continue;
+        }
+
+        json = flb_msgpack_raw_to_json_sds(out_buf, out_size);
+        TEST_CHECK(json != NULL && strcmp(json, cases[i].json) == 0);
+        TEST_MSG("'%s': out=%s expected=%s", cases[i].line, json,
+                 cases[i].json);
+        TEST_CHECK(out_time.tm.tv_sec == cases[i].sec);
+
+        flb_sds_destroy(json);
+        flb_free(out_buf);
+        flb_parser_destroy(p);
+    }
+
+    flb_config_exit(config);
+}
+
+/* Stock parsers (conf/parsers.conf) and their native counterparts */
+struct native_check {
+    char *name;
+    char *regex;
+    char *time_fmt;
+    int time_keep;
+    int first;            /* sample lines of the format */
+    int last;
+};
+
+struct native_check native_entries[] = {
+    {"apache",
+     "^(?<host>[^ ]*) [^ ]* (?<user>[^ ]*) \\[(?<time>[^\\]]*)\\] \"(?<method>\\S+)(?: +(?<path>[^\\\"]*?)(?: +\\S*)?)?\" (?<code>[^ ]*) (?<size>[^ ]*)(?: \"(?<referer>[^\\\"]*)\" \"(?<agent>[^\\\"]*)\")?$",
+     "%d/%b/%Y:%H:%M:%S %z", FLB_FALSE, 0, 6},
+    {"apache2",
+     "^(?<host>[^ ]*) [^ ]* (?<user>[^ ]*) \\[(?<time>[^\\]]*)\\] \"(?<method>\\S+)(?: +(?<path>[^ ]*) +\\S*)?\" (?<code>[^ ]*) (?<size>[^ ]*)(?: \"(?<referer>[^\\\"]*)\" \"(?<agent>.*)\")?$",
+     "%d/%b/%Y:%H:%M:%S %z", FLB_FALSE, 0, 6},
+    {"nginx",
+     "^(?<remote>[^ ]*) (?<host>[^ ]*) (?<user>[^ ]*) \\[(?<time>[^\\]]*)\\] \"(?<method>\\S+)(?: +(?<path>[^\\\"]*?)(?: +\\S*)?)?\" (?<code>[^ ]*) (?<size>[^ ]*)(?: \"(?<referer>[^\\\"]*)\" \"(?<agent>[^\\\"]*)\")",
+     "%d/%b/%Y:%H:%M:%S %z", FLB_FALSE, 7, 8},
+    {"syslog-rfc5424",
+     "^\\<(?<pri>[0-9]{1,5})\\>1 (?<time>[^ ]+) (?<host>[^ ]+) (?<ident>[^ ]+) (?<pid>[-0-9]+) (?<msgid>[^ ]+) (?<extradata>(\\[(.*)\\]|-)) (?<message>.+)$",
+     "%Y-%m-%dT%H:%M:%S.%L", FLB_TRUE, 9, 12},
+    {"syslog-rfc3164",
+     "/^\\<(?<pri>[0-9]+)\\>(?<time>[^ ]* {1,2}[^ ]* [^ ]*) (?<host>[^ ]*) (?<ident>[a-zA-Z0-9_\\/\\.\\-]*)(?:\\[(?<pid>[0-9]+)\\])?(?:[^\\:]*\\:)? *(?<message>.*)$/",
+     "%b %d %H:%M:%S", FLB_TRUE, 13, 18},
+    {"syslog-rfc3164-local",
+     "^\\<(?<pri>[0-9]+)\\>(?<time>[^ ]* {1,2}[^ ]* [^ ]*) (?<ident>[a-zA-Z0-9_\\/\\.\\-]*)(?:\\[(?<pid>[0-9]+)\\])?(?:[^\\:]*\\:)? *(?<message>.*)$",
+     "%b %d %H:%M:%S", FLB_TRUE, 13, 18},
+    {"cri",
+     "^(?<time>[^ ]+) (?<stream>stdout|stderr) (?<logtag>[^ ]*) (?<message>.*)$",
+     "%Y-%m-%dT%H:%M:%S.%L%z", FLB_FALSE, 19, 21},
+};
+
+char *native_lines[] = {
+    "192.168.0.1 - frank [10/Oct/2000:13:55:36 -0700] \"GET /apache_pb.gif HTTP/1.0\" 200 2326 \"http://www.example.com/start.html\" \"Mozilla/4.08 [en] (Win98; I ;Nav)\"",
+    "127.0.0.1 - - [17/Jul/2017:20:17:03 +0000] \"POST /a/b?c=d HTTP/1.1\" 404 -",
+    "::1 - - [17/Jul/2017:20:17:03 +0200] \"GET /x y HTTP/1.1\" 200 5 \"-\" \"curl/7.1\"",
+    "10.0.0.1 - - [17/Jul/2017:20:17:03 +0000] \"-\" 400 0 \"-\" \"-\"",
+    "10.0.0.1 - - [17/Jul/2017:20:17:03 +0000] \"GET /\xc3\xa9t\xc3\xa9 HTTP/1.1\" 200 1 \"\" \"an \"odd\" agent\"",
+    "10.0.0.1 - - [17/Jul/2017:20:17:03 +0000] \"GET  /a  HTTP/1.1\" 200 1 \"r\" \"a\"",
+    "10.0.0.1 - - [17/Jul/2017:20:17:03 +0000] \"GET /a \" 200 1",
+    "10.0.0.2 example.com - [17/Jul/2017:20:17:03 +0000] \"GET /index.html HTTP/1.1\" 200 612 \"-\" \"Mozilla/5.0 (X11; Linux x86_64)\" \"-\"",
+    "10.0.0.2 example.com bob [17/Jul/2017:20:17:03 +0000] \"HEAD / HTTP/1.1\" 304 0 \"https://example.com/\" \"curl/7.58.0\"",
+    "<165>1 2003-10-11T22:14:15.003Z mymachine.example.com evntslog - ID47 [exampleSDID@32473 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"] An application event log entry",
+    "<34>1 2003-10-11T22:14:15.003 mymachine.example.com su 1234 ID47 - 'su root' failed for lonvick on /dev/pts/8",
+    "<13>1 2019-01-01T00:00:00.000 host app - - [a] [b] message with ] inside",
+    "<13>1 2019-01-01T00:00:00.000 host app -1 id [] x",
+    "<13>Feb 16 04:06:58 myhost sshd[1234]: Accepted publickey for user",
+    "<13>Feb  5 04:06:58 myhost kernel: [    0.000000] Booting Linux",
+    "<30>Oct  3 11:12:13 host systemd: Started Session 1 of user root.",
+    "<13>Feb 16 04:06:58 myhost message without a colon",
+    "<13>Feb 16 04:06:58 sshd[1234]: Accepted publickey for user",
+    "<13>Feb 16 04:06:58  app[x]: empty host",
+    "2019-01-01T11:11:11.111111111+00:00 stdout F hello world",
+    "2019-01-01T11:11:11.111+01:00 stderr P partial ",
+    "2019-01-01T11:11:11.111+01:00 stdout F ",
+};
+
+/* Parse a line with both parsers, records and times must be the same */
+static void native_compare(struct flb_parser *regex,
+                           struct flb_parser *native,
+                           const char *line, size_t len)
+{
+    int r1;
+    int r2;
+    char *b1 = NULL;
+    char *b2 = NULL;
+    size_t s1 = 0;
+    size_t s2 = 0;
+    struct flb_time t1;
+    struct flb_time t2;
+
+    memset(&t1, '\0', sizeof(t1));
+    memset(&t2, '\0', sizeof(t2));
+
+    r1 = flb_parser_do(regex, line, len, (void **) &b1, &s1, &t1);
+    r2 = flb_parser_do(native, line, len, (void **) &b2, &s2, &t2);
+
+    if (!TEST_CHECK(r1 == r2)) {
+        TEST_MSG("%s: '%.*s' regex=%i native=%i",
+                 native->name, (int) len, line, r1, r2);
+    }
+    else if (r1 >= 0) {
+        if (!TEST_CHECK(s1 == s2 && memcmp(b1, b2, s1) == 0 &&
+                        t1.tm.tv_sec == t2.tm.tv_sec &&
+                        t1.tm.tv_nsec == t2.tm.tv_nsec)) {
+            TEST_MSG("%s: '%.*s' records differ",
+                     native->name, (int) len, line);
+        }
+    }
+
+    if (r1 >= 0) {
+        flb_free(b1);
+    }
+    if (r2 >= 0) {
+        flb_free(b2);
+    }
+}
+
+/* Mutate a line with the characters the stock patterns care about */
+static size_t native_mutate(uint64_t *seed, const char *line,
+                            char *buf, size_t size)
+{
+    int i;
+    int ops;
+    size_t pos;
+    size_t len;
+    char *c;
+    char *alphabet[] = {
+        " ", " ", "  ", "\"", "[", "]", "-", ":", "<", ">", "1", "a", "\t",
+        "\n", "\xc3\xa9", "\xff", "\xe2\x80", "stdout ", "\" \"", "] ",
+    };
+
+    len = strlen(line);
+    memcpy(buf, line, len);
+
+    ops = 1 + fuzz_rand(seed) % 3;
+    for (i = 0; i < ops; i++) {
+        pos = len > 0 ? fuzz_rand(seed) % len : 0;
+        c = alphabet[fuzz_rand(seed) %
+                     (sizeof(alphabet) / sizeof(alphabet[0]))];
+
+        switch (fuzz_rand(seed) % 4) {
+        case 0:
+            /* delete */
+            if (len > 0) {
+                memmove(buf + pos, buf + pos + 1, len - pos - 1);
+                len--;
+            }
+            break;
+        case 1:
+            /* replace */
+            if (len > 0) {
+                buf[pos] = c[0];
+            }
+            break;
+        default:
+            /* insert */
+            if (len + strlen(c) < size) {
+                memmove(buf + pos + strlen(c), buf + pos, len - pos);
+                memcpy(buf + pos, c, strlen(c));
+                len += strlen(c);
+            }
+            break;
+        }
+    }
+
+    return len;
+}
+
+/*
+ * Native parsers against their regex definitions: every sample line, with
+ * time lookups, then random mutations of them to exercise the lines the
+ * scanners must hand over to the regex engine.
+ */
+void test_native_parser_parity()
+{
+    int i;
+    int j;
+    int k;
+    size_t len;
+    char buf[512];
+    char name[64];
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    struct flb_config *config;
+    struct flb_parser *regex;
+    struct flb_parser *native;
+    struct flb_parser *regex_nt;
+    struct flb_parser *native_nt;
+
+    config = flb_config_init();
+
+    for (i = 0; i < sizeof(native_entries) / sizeof(native_entries[0]); i++) {
+        snprintf(name, sizeof(name), "%s", native_entries[i].name);
+        regex = flb_parser_create(name, "regex", native_entries[i].regex,
+                                  native_entries[i].time_fmt, "time", NULL,
+                                  native_entries[i].time_keep,
+                                  NULL, 0, NULL, config);
+        snprintf(name, sizeof(name), "%s_native", native_entries[i].name);
+        native = flb_parser_create(name, "native", native_entries[i].name,
+                                   native_entries[i].time_fmt, "time", NULL,
+                                   native_entries[i].time_keep,
+                                   NULL, 0, NULL, config);
+
+        /* without time lookups, invalid times would flood the output */
+        snprintf(name, sizeof(name), "%s_nt", native_entries[i].name);
+        regex_nt = flb_parser_create(name, "regex", native_entries[i].regex,
+                                     NULL, NULL, NULL, FLB_FALSE,
+                                     NULL, 0, NULL, config);
+        snprintf(name, sizeof(name), "%s_native_nt", native_entries[i].name);
+        native_nt = flb_parser_create(name, "native", native_entries[i].name,
+                                      NULL, NULL, NULL, FLB_FALSE,
+                                      NULL, 0, NULL, config);
+
+        TEST_CHECK(regex != NULL && native != NULL &&
+                   regex_nt != NULL && native_nt != NULL);
+        if (!regex || !native || !regex_nt || !native_nt) {
+            continue;
+        }
+        TEST_CHECK(native->fields_len == regex->fields_len);
+
+        for (j = 0; j < sizeof(native_lines) / sizeof(char *); j++) {
+            if (j >= native_entries[i].first && j <= native_entries[i].last) {
+                native_compare(regex, native, native_lines[j],
+                               strlen(native_lines[j]));
+            }
+            native_compare(regex_nt, native_nt, native_lines[j],
+                           strlen(native_lines[j]));
+
+            for (k = 0; k < 300; k++) {
+                len = native_mutate(&seed, native_lines[j], buf, sizeof(buf));
+                native_compare(regex_nt, native_nt, buf, len);
+            }
+        }
+    }
+
+    TEST_CHECK(flb_parser_create("bad", "native", "unknown", NULL, NULL,
+                                 NULL, FLB_FALSE, NULL, 0, NULL,
+                                 config) == NULL);
+
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
+/* Benchmark: lines per second, regex vs native parser */
+void bench_native_parser()
+{
+    int i;
+    int j;
+    int n = 100000;
+    int ret;
+    char *line;
+    char *out_buf;
+    size_t out_size;
+    char name[64];
+    double t;
+    struct flb_time out_time;
+    struct flb_config *config;
+    struct flb_parser *parsers[2];
+
+    config = flb_config_init();
+    printf("\n  %-24s %14s %14s\n", "format", "regex/s", "native/s");
+
+    for (i = 0; i < sizeof(native_entries) / sizeof(native_entries[0]); i++) {
+        snprintf(name, sizeof(name), "%s", native_entries[i].name);
+        parsers[0] = flb_parser_create(name, "regex", native_entries[i].regex,
+                                       native_entries[i].time_fmt, "time",
+                                       NULL, native_entries[i].time_keep,
+                                       NULL, 0, NULL, config);
+        snprintf(name, sizeof(name), "%s_native", native_entries[i].name);
+        parsers[1] = flb_parser_create(name, "native", native_entries[i].name,
+                                       native_entries[i].time_fmt, "time",
+                                       NULL, native_entries[i].time_keep,
+                                       NULL, 0, NULL, config);
+        TEST_CHECK(parsers[0] != NULL && parsers[1] != NULL);
+        if (!parsers[0] || !parsers[1]) {
+            continue;
+        }
+
+        printf("  %-24s", native_entries[i].name);
+        for (j = 0; j < 2; j++) {
+            t = bench_wall_time();
+            for (ret = 0; ret < n; ret++) {
+                line = native_lines[native_entries[i].first];
+                if (flb_parser_do(parsers[j], line, strlen(line),
+                                  (void **) &out_buf, &out_size,
+                                  &out_time) >= 0) {
+                    flb_free(out_buf);
+                }
+            }
+            printf(" %14.0f", n / (bench_wall_time() - t));
+        }
+        printf("\n");
+    }
+
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
+/* Decode_Field_As rules chained on the same key, decoded in place */
+void test_parser_decode_escaped()
+{
+    int ret;
+    char *in;
+    char *expected;
+    void *out_buf;
+    size_t out_size;
+    flb_sds_t json;
+    struct flb_time out_time;
+    struct flb_parser *p;
+    struct flb_config *config;
+
+    config = flb_config_init();
+    load_json_parsers(config);
+
+    p = flb_parser_get("decode_escaped", config);
+    TEST_CHECK(p != NULL);
+    if (!p) {
+        flb_config_exit(config);
+        return;
+    }
+
+    in = "{\"log\": \"{\\\\\\\"k\\\\\\\": \\\\\\\"v\\\\\\\\u00e9\\\\\\\"}\", "
+         "\"msg\": \"a\\\\\\\\tb\", \"n\": 1}";
+    expected = "{\"log\":{\"k\":\"v\\u00e9\"},\"msg\":\"a\\tb\",\"n\":1}";
+
+    ret = flb_parser_do(p, in, strlen(in), &out_buf, &out_size, &out_time);
+    TEST_CHECK(ret != -1);
+    if (ret != -1) {
+        json = flb_msgpack_raw_to_json_sds(out_buf, out_size);
+        TEST_CHECK(json != NULL && strcmp(json, expected) == 0);
+        TEST_MSG("expected: %s", expected);
+        TEST_MSG("got     : %s", json);
+        flb_sds_destroy(json);
+        flb_free(out_buf);
+    }
+
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
+/* A duplicated parser must work on its own once the original is gone */
+void test_parser_dup()
+{
+    int i;
+    int ret;
+    char *line;
+    void *out_buf;
+    size_t out_size;
+    flb_sds_t json[2];
+    struct flb_time out_time[2];
+    struct flb_parser *p;
+    struct flb_parser *dup;
+    struct flb_parser *parsers[2];
+    struct flb_config *config;
+
+    config = flb_config_init();
+    load_json_parsers(config);
+
+    line = "Jul 17 20:17:03.25 200 hello";
+    p = flb_parser_create("dup", "regex",
+                          "^(?<time>[^ ]+ [^ ]+ [^ ]+) (?<code>[^ ]+) "
+                          "(?<msg>.*)$",
+                          "%b %d %H:%M:%S.%L", NULL, NULL, FLB_FALSE,
+                          regex_types("code", FLB_PARSER_TYPE_INT,
+                                      "none", FLB_PARSER_TYPE_FLOAT),
+                          2, NULL, config);
+    TEST_CHECK(p != NULL);
+    dup = p ? flb_parser_dup(p) : NULL;
+    TEST_CHECK(dup != NULL);
+    if (!dup) {
+        flb_parser_exit(config);
+        flb_config_exit(config);
+        return;
+    }
+    TEST_CHECK(dup->time_frac_secs != p->time_frac_secs);
+
+    /* parse with the original, release it and parse with the copy */
+    parsers[0] = p;
+    parsers[1] = dup;
+    for (i = 0; i < 2; i++) {
+        memset(&out_time[i], '\0', sizeof(struct flb_time));
+        json[i] = NULL;
+        ret = flb_parser_do(parsers[i], line, strlen(line),
+                            &out_buf, &out_size, &out_time[i]);
+        TEST_CHECK(ret != -1);
+        if (ret != -1) {
+            json[i] = flb_msgpack_raw_to_json_sds(out_buf, out_size);
+            flb_free(out_buf);
+        }
+        if (i == 0) {
+            flb_parser_destroy(p);
+        }
+    }
+    TEST_CHECK(json[0] != NULL && json[1] != NULL &&
+               strcmp(json[0], json[1]) == 0);
+    TEST_CHECK(strcmp(json[1], "{\"code\":200,\"msg\":\"hello\"}") == 0);
+    TEST_MSG("got: %s", json[1]);
+    TEST_CHECK(out_time[1].tm.tv_sec == out_time[0].tm.tv_sec &&
+               out_time[1].tm.tv_nsec == 250000000);
+    flb_sds_destroy(json[0]);
+    flb_sds_destroy(json[1]);
+    flb_parser_destroy(dup);
+
+    /* decoders get their own scratch buffers */
+    p = flb_parser_get("decode_escaped", config);
+    TEST_CHECK(p != NULL);
+    dup = p ? flb_parser_dup(p) : NULL;
+    TEST_CHECK(dup != NULL && dup->decoders != NULL &&
+               dup->decoders != p->decoders);
+    if (dup) {
+        line = "{\"msg\": \"a\\\\tb\"}";
+        ret = flb_parser_do(dup, line, strlen(line),
+                            &out_buf, &out_size, &out_time[0]);
+        TEST_CHECK(ret != -1);
+        if (ret != -1) {
+            json[0] = flb_msgpack_raw_to_json_sds(out_buf, out_size);
+            TEST_CHECK(strcmp(json[0], "{\"msg\":\"a\\tb\"}") == 0);
+            TEST_MSG("got: %s", json[0]);
+            flb_sds_destroy(json[0]);
+            flb_free(out_buf);
+        }
+        flb_parser_destroy(dup);
+    }
+
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
 TEST_LIST = {
+#ifndef FLB_TESTS_BENCH
     { "tzone_offset", test_parser_tzone_offset},
     { "time_lookup", test_parser_time_lookup},
     { "json_time_lookup", test_json_parser_time_lookup},
     { "regex_time_lookup", test_regex_parser_time_lookup},
+    { "regex_fields", test_regex_parser_fields},
+    { "native_parity", test_native_parser_parity},
+    { "time_lookup_fuzz", test_parser_time_lookup_fuzz},
+    { "typecast", test_parser_typecast},
+    { "decode_escaped", test_parser_decode_escaped},
+    { "dup", test_parser_dup},
+#else
+    /* Benchmarks: flb-bench-* targets */
+    { "bench_native", bench_native_parser},
+    { "bench_time_lookup", bench_time_lookup},
+#endif
     { 0 }
 };
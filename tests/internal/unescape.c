@@ -0,0 +1,431 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_unescape.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "flb_tests_internal.h"
+#include "../lib/bench.h"
+
+/*
+ * Reference implementation: the former byte by byte unescape routines,
+ * the bulk copy versions must produce the very same output.
+ */
+static int ref_octal_digit(char c)
+{
+    return (c >= '0' && c <= '7');
+}
+
+static int ref_hex_digit(char c)
+{
+    return ((c >= '0' && c <= '9') ||
+            (c >= 'A' && c <= 'F') ||
+            (c >= 'a' && c <= 'f'));
+}
+
+static int ref_wc_toutf8(char *dest, uint32_t ch)
+{
+    if (ch < 0x80) {
+        dest[0] = (char)ch;
+        return 1;
+    }
+    if (ch < 0x800) {
+        dest[0] = (ch>>6) | 0xC0;
+        dest[1] = (ch & 0x3F) | 0x80;
+        return 2;
+    }
+    if (ch < 0x10000) {
+        dest[0] = (ch>>12) | 0xE0;
+        dest[1] = ((ch>>6) & 0x3F) | 0x80;
+        dest[2] = (ch & 0x3F) | 0x80;
+        return 3;
+    }
+    if (ch < 0x110000) {
+        dest[0] = (ch>>18) | 0xF0;
+        dest[1] = ((ch>>12) & 0x3F) | 0x80;
+        dest[2] = ((ch>>6) & 0x3F) | 0x80;
+        dest[3] = (ch & 0x3F) | 0x80;
+        return 4;
+    }
+    return 0;
+}
+
+/* assumes that src points to the character after a backslash
+   returns number of input characters processed */
+static int ref_read_escape(const char *str, uint32_t *dest)
+{
+    uint32_t ch;
+    char digs[9]="\0\0\0\0\0\0\0\0";
+    int dno=0, i=1;
+
+    ch = (uint32_t)str[0];    /* take literal character */
+
+    if (str[0] == 'n')
+        ch = L'\n';
+    else if (str[0] == 't')
+        ch = L'\t';
+    else if (str[0] == 'r')
+        ch = L'\r';
+    else if (str[0] == 'b')
+        ch = L'\b';
+    else if (str[0] == 'f')
+        ch = L'\f';
+    else if (str[0] == 'v')
+        ch = L'\v';
+    else if (str[0] == 'a')
+        ch = L'\a';
+    else if (ref_octal_digit(str[0])) {
+        i = 0;
+        do {
+            digs[dno++] = str[i++];
+        } while (ref_octal_digit(str[i]) && dno < 3);
+        ch = strtol(digs, NULL, 8);
+    }
+    else if (str[0] == 'x') {
+        while (ref_hex_digit(str[i]) && dno < 2) {
+            digs[dno++] = str[i++];
+        }
+        if (dno > 0)
+            ch = strtol(digs, NULL, 16);
+    }
+    else if (str[0] == 'u') {
+        while (ref_hex_digit(str[i]) && dno < 4) {
+            digs[dno++] = str[i++];
+        }
+        if (dno > 0)
+            ch = strtol(digs, NULL, 16);
+    }
+    else if (str[0] == 'U') {
+        while (ref_hex_digit(str[i]) && dno < 8) {
+            digs[dno++] = str[i++];
+        }
+        if (dno > 0)
+            ch = strtol(digs, NULL, 16);
+    }
+    *dest = ch;
+
+    return i;
+}
+
+static int ref_unescape_utf8(const char *in_buf, int sz, char *out_buf)
+{
+    uint32_t ch;
+    char temp[4];
+    const char *next;
+
+    int count_out = 0;
+    int count_in = 0;
+    int esc_in = 0;
+    int esc_out = 0;
+
+    while (*in_buf && count_in < sz) {
+        next = in_buf + 1;
+
+        if (*in_buf == '\\') {
+            esc_in = 2;
+            switch (*next) {
+            case '"':
+                ch = '"';
+                break;
+            case '\'':
+                ch = '\'';
+                break;
+            case '\\':
+                ch = '\\';
+                break;
+            case '/':
+                ch = '/';
+                break;
+            case 'n':
+                ch = '\n';
+                break;
+            case 'b':
+                ch = '\b';
+                break;
+            case 't':
+                ch = '\t';
+                break;
+            case 'f':
+                ch = '\f';
+                break;
+            case 'r':
+                ch = '\r';
+                break;
+            default:
+                esc_in = ref_read_escape((in_buf + 1), &ch) + 1;
+            }
+        }
+        else {
+            ch = (uint32_t) *in_buf;
+            esc_in = 1;
+        }
+
+        in_buf += esc_in;
+        count_in += esc_in;
+
+        esc_out = ref_wc_toutf8(temp, ch);
+        if (esc_out > sz-count_out) {
+            break;
+        }
+
+        if (esc_out == 0) {
+            out_buf[count_out] = ch;
+            esc_out = 1;
+        }
+        else if (esc_out == 1) {
+            out_buf[count_out] = (char) temp[0];
+        }
+        else {
+            memcpy(&out_buf[count_out], temp, esc_out);
+        }
+        count_out += esc_out;
+    }
+    out_buf[count_out] = '\0';
+    return count_out;
+}
+
+static int ref_unescape(const char *buf, int buf_len, char **unesc_buf)
+{
+    int i = 0;
+    int j = 0;
+    char *p;
+    char n;
+
+    p = *unesc_buf;
+    while (i < buf_len) {
+        if (buf[i] == '\\') {
+            if (i + 1 < buf_len) {
+                n = buf[i + 1];
+                if (n == 'n') {
+                    p[j++] = '\n';
+                    i++;
+                }
+                else if (n == 'a') {
+                    p[j++] = '\a';
+                    i++;
+                }
+                else if (n == 'b') {
+                    p[j++] = '\b';
+                    i++;
+                }
+                else if (n == 't') {
+                    p[j++] = '\t';
+                    i++;
+                }
+                else if (n == 'v') {
+                    p[j++] = '\v';
+                    i++;
+                }
+                else if (n == 'f') {
+                    p[j++] = '\f';
+                    i++;
+                }
+                else if (n == 'r') {
+                    p[j++] = '\r';
+                    i++;
+                }
+                else if (n == '\\') {
+                    p[j++] = '\\';
+                    i++;
+                }
+                i++;
+                continue;
+            }
+            else {
+                i++;
+            }
+        }
+        p[j++] = buf[i++];
+    }
+    p[j] = '\0';
+    return j;
+}
+
+static uint64_t unesc_rand(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/* Random string: clean runs plus any kind of escape sequence */
+static int unesc_rand_str(uint64_t *seed, char *buf, int size)
+{
+    int i;
+    int n;
+    int r;
+    int len = 0;
+    char *pieces[] = {
+        "\\n", "\\t", "\\r", "\\b", "\\f", "\\v", "\\a", "\\\\", "\\\"",
+        "\\/", "\\'", "\\q", "\\", "\\u00e9", "\\u20AC", "\\u7", "\\uFFF",
+        "\\x41", "\\xz", "\\101", "\\0", "\\7777", "\\U0001F600",
+        "\\U0011ffff", "\\U", "\xc3\xa9", "\xe2\x82\xac", "\"", "/",
+    };
+
+    n = unesc_rand(seed) % 16;
+    for (i = 0; i < n; i++) {
+        r = unesc_rand(seed) % 100;
+        if (r < 40) {
+            /* clean run, crossing the SIMD block boundaries */
+            r = unesc_rand(seed) % 40;
+            if (len + r >= size) {
+                break;
+            }
+            memset(buf + len, 'a' + i % 26, r);
+            len += r;
+        }
+        else if (r < 99) {
+            r = unesc_rand(seed) % (sizeof(pieces) / sizeof(char *));
+            if (len + strlen(pieces[r]) >= size) {
+                break;
+            }
+            memcpy(buf + len, pieces[r], strlen(pieces[r]));
+            len += strlen(pieces[r]);
+        }
+        else if (len + 1 < size && unesc_rand(seed) % 8 == 0) {
+            /* a NULL byte ends the UTF-8 decoding early */
+            buf[len++] = '\0';
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+void test_unescape_cases()
+{
+    int i;
+    int len;
+    char out[256];
+    char *p = out;
+    struct {
+        char *in;
+        char *out;
+        char *out_utf8;
+    } cases[] = {
+        {"no escapes at all", "no escapes at all", "no escapes at all"},
+        {"a\\nb\\tc", "a\nb\tc", "a\nb\tc"},
+        {"\\\\n", "\\n", "\\n"},
+        {"quote \\\" slash \\/", "quote \" slash /", "quote \" slash /"},
+        {"caf\\u00e9", "cafu00e9", "caf\xc3\xa9"},
+        {"\\u20AC", "u20AC", "\xe2\x82\xac"},
+        {"\\x41\\101", "x41101", "AA"},
+        {"\\U0001F600", "U0001F600", "\xf0\x9f\x98\x80"},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        len = flb_unescape_string(cases[i].in, strlen(cases[i].in), &p);
+        TEST_CHECK(len == strlen(cases[i].out) &&
+                   strcmp(out, cases[i].out) == 0);
+        TEST_MSG("in='%s' out='%s'", cases[i].in, out);
+
+        len = flb_unescape_string_utf8(cases[i].in, strlen(cases[i].in), out);
+        TEST_CHECK(len == strlen(cases[i].out_utf8) &&
+                   strcmp(out, cases[i].out_utf8) == 0);
+        TEST_MSG("in='%s' out='%s'", cases[i].in, out);
+    }
+}
+
+/* Bulk copy unescape, out of place and in place, against the reference */
+void test_unescape_random()
+{
+    int i;
+    int len;
+    int ret;
+    int ref_len;
+    char in[1024];
+    char ref[1024];
+    char out[1024];
+    char *p;
+    uint64_t seed = 0x2545f4914f6cdd1d;
+
+    for (i = 0; i < 20000; i++) {
+        memset(in, 0, sizeof(in));
+        len = unesc_rand_str(&seed, in, 512);
+
+        p = ref;
+        ref_len = ref_unescape(in, len, &p);
+        p = out;
+        ret = flb_unescape_string(in, len, &p);
+        TEST_CHECK(ret == ref_len && memcmp(out, ref, ref_len + 1) == 0);
+
+        p = in;
+        ret = flb_unescape_string(in, len, &p);
+        TEST_CHECK(ret == ref_len && memcmp(in, ref, ref_len + 1) == 0);
+
+        memset(in, 0, sizeof(in));
+        seed ^= i;
+        len = unesc_rand_str(&seed, in, 512);
+
+        ref_len = ref_unescape_utf8(in, len, ref);
+        ret = flb_unescape_string_utf8(in, len, out);
+        if (!TEST_CHECK(ret == ref_len &&
+                        memcmp(out, ref, ref_len + 1) == 0)) {
+            TEST_MSG("input: %s", in);
+        }
+
+        ret = flb_unescape_string_utf8(in, len, in);
+        TEST_CHECK(ret == ref_len && memcmp(in, ref, ref_len + 1) == 0);
+    }
+}
+
+/* Benchmark: unescape a typical log line, reference vs bulk copy */
+void bench_unescape()
+{
+    int i;
+    int len;
+    int rounds = 200000;
+    double t;
+    double mb;
+    char out[512];
+    char *p = out;
+    char *line =
+        "10.0.0.1 - - [17/Jul/2017:20:17:03 +0000] \\\"GET /api/v1/items "
+        "HTTP/1.1\\\" 200 512 \\\"-\\\" \\\"Mozilla/5.0 (X11; Linux x86_64)"
+        " AppleWebKit/537.36 (KHTML, like Gecko) Chrome/60.0\\\"\\n";
+
+    len = strlen(line);
+    mb = (len * (double) rounds) / (1024.0 * 1024.0);
+
+    printf("\n  %16s %10s\n", "unescape", "MB/s");
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        ref_unescape(line, len, &p);
+    }
+    printf("  %16s %10.1f\n", "reference", mb / (bench_cpu_time() - t));
+
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        flb_unescape_string(line, len, &p);
+    }
+    printf("  %16s %10.1f\n", "bulk", mb / (bench_cpu_time() - t));
+
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        ref_unescape_utf8(line, len, out);
+    }
+    printf("  %16s %10.1f\n", "reference utf8", mb / (bench_cpu_time() - t));
+
+    t = bench_cpu_time();
+    for (i = 0; i < rounds; i++) {
+        flb_unescape_string_utf8(line, len, out);
+    }
+    printf("  %16s %10.1f\n", "bulk utf8", mb / (bench_cpu_time() - t));
+}
+
+TEST_LIST = {
+#ifndef FLB_TESTS_BENCH
+    { "unescape_cases", test_unescape_cases},
+    { "unescape_random", test_unescape_random},
+#else
+    /* Benchmarks: flb-bench-* targets */
+    { "bench_unescape", bench_unescape},
+#endif
+    { 0 }
+};
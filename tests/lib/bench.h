@@ -0,0 +1,32 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Helpers for the benchmarks of the test suites. Benchmarks are listed only
+ * when the test file is built with FLB_TESTS_BENCH defined (flb-bench-*
+ * targets, -DFLB_TESTS_BENCH=On), the regular tests never run them.
+ */
+
+#ifndef FLB_TESTS_BENCH_H
+#define FLB_TESTS_BENCH_H
+
+#include <time.h>
+
+/* CPU time consumed by the process, in seconds */
+static inline double bench_cpu_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+/* Monotonic wall clock, in seconds */
+static inline double bench_wall_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+#endif
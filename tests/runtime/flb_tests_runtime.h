@@ -2,6 +2,7 @@
 
 /*  Fluent Bit
  *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
  *  Copyright (C) 2015-2018 Treasure Data Inc.
  *
  *  Licensed under the Apache License, Version 2.0 (the "License");
@@ -17,9 +18,10 @@
  *  limitations under the License.
  */
 
-#ifndef FLB_IN_HTTP_INFO_H
-#define FLB_IN_HTTP_INFO_H
+#ifndef FLB_TESTS_RUNTIME_H
+#define FLB_TESTS_RUNTIME_H
 
-#define FLB_HTTP_CONF_PATH  "@IN_HTTP_CONF_PATH@"
+#include "../lib/acutest/acutest.h"
+#define FLB_TESTS_DATA_PATH "/root/repo/tests/runtime"
 
 #endif
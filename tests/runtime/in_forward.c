@@ -0,0 +1,396 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <msgpack.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "flb_tests_runtime.h"
+
+#define FW_PORT         "24230"
+#define CONNS           8
+#define MESSAGES        1000
+
+static int seen[CONNS][MESSAGES];
+static int records_out;
+static int records_bad;
+
+static void rec_pad(char *buf, int c, int i)
+{
+    int len;
+
+    len = 8 + ((i * 7 + c) % 120);
+    memset(buf, 'a' + ((c * 7 + i) % 26), len);
+    buf[len] = '\0';
+}
+
+/* Pack the record {"c": C, "i": I, "pad": "..."} */
+static void rec_pack(msgpack_packer *mp_pck, int c, int i)
+{
+    int len;
+    char pad[256];
+
+    rec_pad(pad, c, i);
+    len = strlen(pad);
+
+    msgpack_pack_map(mp_pck, 3);
+    msgpack_pack_str(mp_pck, 1);
+    msgpack_pack_str_body(mp_pck, "c", 1);
+    msgpack_pack_int(mp_pck, c);
+    msgpack_pack_str(mp_pck, 1);
+    msgpack_pack_str_body(mp_pck, "i", 1);
+    msgpack_pack_int(mp_pck, i);
+    msgpack_pack_str(mp_pck, 3);
+    msgpack_pack_str_body(mp_pck, "pad", 3);
+    msgpack_pack_str(mp_pck, len);
+    msgpack_pack_str_body(mp_pck, pad, len);
+}
+
+/* [time, record] */
+static void entry_pack(msgpack_packer *mp_pck, int c, int i)
+{
+    msgpack_pack_array(mp_pck, 2);
+    msgpack_pack_uint32(mp_pck, 1577836800 + i);
+    rec_pack(mp_pck, c, i);
+}
+
+/*
+ * Compose the frame of record 'i' of connection 'c', the mode alternates
+ * between Message, Forward and PackedForward.
+ */
+static void frame_pack(msgpack_sbuffer *mp_sbuf, int c, int i)
+{
+    msgpack_packer mp_pck;
+    msgpack_sbuffer entry;
+    msgpack_packer entry_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+
+    switch (i % 3) {
+    case 0:
+        /* Message: [tag, time, record] */
+        msgpack_pack_array(&mp_pck, 3);
+        msgpack_pack_str(&mp_pck, 4);
+        msgpack_pack_str_body(&mp_pck, "test", 4);
+        msgpack_pack_uint32(&mp_pck, 1577836800 + i);
+        rec_pack(&mp_pck, c, i);
+        break;
+    case 1:
+        /* Forward: [tag, [[time, record]]] */
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_str(&mp_pck, 4);
+        msgpack_pack_str_body(&mp_pck, "test", 4);
+        msgpack_pack_array(&mp_pck, 1);
+        entry_pack(&mp_pck, c, i);
+        break;
+    default:
+        /* PackedForward: [tag, bin([time, record])] */
+        msgpack_sbuffer_init(&entry);
+        msgpack_packer_init(&entry_pck, &entry, msgpack_sbuffer_write);
+        entry_pack(&entry_pck, c, i);
+
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_str(&mp_pck, 4);
+        msgpack_pack_str_body(&mp_pck, "test", 4);
+        msgpack_pack_bin(&mp_pck, entry.size);
+        msgpack_pack_bin_body(&mp_pck, entry.data, entry.size);
+        msgpack_sbuffer_destroy(&entry);
+        break;
+    }
+}
+
+/* Validate every record against the message it comes from */
+static int callback_check(void *data, size_t size, void *cb_data)
+{
+    int c;
+    int i;
+    char *p;
+    char *end;
+    char pad[256];
+
+    if (size == 0) {
+        return 0;
+    }
+
+    p = strstr(data, "{\"c\":");
+    if (!p || sscanf(p, "{\"c\":%i,\"i\":%i,", &c, &i) != 2 ||
+        c < 0 || c >= CONNS || i < 0 || i >= MESSAGES) {
+        __sync_fetch_and_add(&records_bad, 1);
+        flb_lib_free(data);
+        return 0;
+    }
+
+    rec_pad(pad, c, i);
+    p = strstr(p, "\"pad\":\"");
+    end = p ? strchr(p + 7, '"') : NULL;
+    if (!end || end - (p + 7) != strlen(pad) ||
+        memcmp(p + 7, pad, strlen(pad)) != 0) {
+        __sync_fetch_and_add(&records_bad, 1);
+    }
+    else {
+        __sync_fetch_and_add(&seen[c][i], 1);
+    }
+    __sync_fetch_and_add(&records_out, 1);
+
+    flb_lib_free(data);
+    return 0;
+}
+
+static int wait_records(int expected, int sec)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < sec * 10; i++) {
+        n = __sync_fetch_and_add(&records_out, 0);
+        if (n >= expected) {
+            break;
+        }
+        usleep(100000);
+    }
+    return n;
+}
+
+static int tcp_connect(const char *port)
+{
+    int fd;
+    int ret;
+    int on = 1;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int fd_write(int fd, const char *buf, size_t size)
+{
+    ssize_t bytes;
+    size_t sent = 0;
+
+    while (sent < size) {
+        bytes = write(fd, buf + sent, size - sent);
+        if (bytes <= 0) {
+            return -1;
+        }
+        sent += bytes;
+    }
+    return 0;
+}
+
+static flb_ctx_t *fw_start(const char *workers, const char *buffer_max)
+{
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    flb_ctx_t *ctx;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_check;
+    cb.data = NULL;
+    records_out = 0;
+    records_bad = 0;
+    memset(seen, 0, sizeof(seen));
+
+    ctx = flb_create();
+    TEST_CHECK(flb_service_set(ctx, "Flush", "0.2", "Grace", "1",
+                               NULL) == 0);
+
+    in_ffd = flb_input(ctx, (char *) "forward", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    TEST_CHECK(flb_input_set(ctx, in_ffd, "tag", "fw",
+                             "port", FW_PORT,
+                             "workers", workers,
+                             NULL) == 0);
+    if (buffer_max) {
+        TEST_CHECK(flb_input_set(ctx, in_ffd,
+                                 "buffer_max_size", buffer_max,
+                                 NULL) == 0);
+    }
+
+    out_ffd = flb_output(ctx, (char *) "lib", &cb);
+    TEST_CHECK(out_ffd >= 0);
+    TEST_CHECK(flb_output_set(ctx, out_ffd, "match", "*", "format", "json",
+                              NULL) == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+    usleep(200000);
+
+    return ctx;
+}
+
+static void fw_check(int conns, int messages)
+{
+    int c;
+    int i;
+    int missing = 0;
+
+    TEST_CHECK(records_bad == 0);
+    TEST_MSG("corrupted records: %i", records_bad);
+    TEST_CHECK(records_out == conns * messages);
+    TEST_MSG("records: expected %i, got %i", conns * messages, records_out);
+
+    for (c = 0; c < conns; c++) {
+        for (i = 0; i < messages; i++) {
+            if (seen[c][i] != 1) {
+                missing++;
+            }
+        }
+    }
+    TEST_CHECK(missing == 0);
+    TEST_MSG("records not received exactly once: %i", missing);
+}
+
+/* Frames of every mode over several connections, two listener threads */
+void flb_test_fw_workers()
+{
+    int c;
+    int i;
+    int fds[CONNS];
+    msgpack_sbuffer mp_sbuf;
+    flb_ctx_t *ctx;
+
+    ctx = fw_start("2", NULL);
+
+    for (c = 0; c < CONNS; c++) {
+        fds[c] = tcp_connect(FW_PORT);
+        TEST_CHECK(fds[c] != -1);
+    }
+
+    /* Interleave the connections, some frames are split in two writes */
+    msgpack_sbuffer_init(&mp_sbuf);
+    for (i = 0; i < MESSAGES; i++) {
+        for (c = 0; c < CONNS; c++) {
+            if (fds[c] == -1) {
+                continue;
+            }
+            msgpack_sbuffer_clear(&mp_sbuf);
+            frame_pack(&mp_sbuf, c, i);
+            if (i % 5 == 0) {
+                fd_write(fds[c], mp_sbuf.data, mp_sbuf.size / 2);
+                fd_write(fds[c], mp_sbuf.data + mp_sbuf.size / 2,
+                         mp_sbuf.size - mp_sbuf.size / 2);
+            }
+            else {
+                fd_write(fds[c], mp_sbuf.data, mp_sbuf.size);
+            }
+        }
+    }
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    wait_records(CONNS * MESSAGES, 10);
+    fw_check(CONNS, MESSAGES);
+
+    for (c = 0; c < CONNS; c++) {
+        if (fds[c] != -1) {
+            close(fds[c]);
+        }
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/*
+ * A frame bigger than 'buffer_max_size' closes its connection, the other
+ * connections are not affected.
+ */
+void flb_test_fw_oversized()
+{
+    int i;
+    int fd;
+    int ret;
+    char buf[64];
+    char *big;
+    size_t big_size = 256 * 1024;
+    struct timeval tv = {5, 0};
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    flb_ctx_t *ctx;
+
+    ctx = fw_start("1", "64k");
+
+    /* [tag, time, {"c": 0, "i": 0, "pad": <256KB>}] */
+    big = flb_malloc(big_size);
+    TEST_CHECK(big != NULL);
+    memset(big, 'x', big_size);
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 3);
+    msgpack_pack_str(&mp_pck, 4);
+    msgpack_pack_str_body(&mp_pck, "test", 4);
+    msgpack_pack_uint32(&mp_pck, 1577836800);
+    msgpack_pack_map(&mp_pck, 3);
+    msgpack_pack_str(&mp_pck, 1);
+    msgpack_pack_str_body(&mp_pck, "c", 1);
+    msgpack_pack_int(&mp_pck, 0);
+    msgpack_pack_str(&mp_pck, 1);
+    msgpack_pack_str_body(&mp_pck, "i", 1);
+    msgpack_pack_int(&mp_pck, 0);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "pad", 3);
+    msgpack_pack_str(&mp_pck, big_size);
+    msgpack_pack_str_body(&mp_pck, big, big_size);
+    flb_free(big);
+
+    fd = tcp_connect(FW_PORT);
+    TEST_CHECK(fd != -1);
+    if (fd != -1) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        send(fd, mp_sbuf.data, mp_sbuf.size, MSG_NOSIGNAL);
+
+        /* The server closes the connection */
+        ret = recv(fd, buf, sizeof(buf), 0);
+        TEST_CHECK(ret == 0 || (ret == -1 && errno == ECONNRESET));
+        TEST_MSG("recv()=%i errno=%i", ret, errno);
+        close(fd);
+    }
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    /* A new connection works */
+    fd = tcp_connect(FW_PORT);
+    TEST_CHECK(fd != -1);
+    if (fd != -1) {
+        msgpack_sbuffer_init(&mp_sbuf);
+        for (i = 0; i < MESSAGES; i++) {
+            msgpack_sbuffer_clear(&mp_sbuf);
+            frame_pack(&mp_sbuf, 0, i);
+            fd_write(fd, mp_sbuf.data, mp_sbuf.size);
+        }
+        msgpack_sbuffer_destroy(&mp_sbuf);
+
+        wait_records(MESSAGES, 10);
+        fw_check(1, MESSAGES);
+        close(fd);
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+TEST_LIST = {
+    {"workers",   flb_test_fw_workers},
+    {"oversized", flb_test_fw_oversized},
+    {NULL, NULL}
+};
@@ -0,0 +1,290 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "flb_tests_runtime.h"
+
+#define HTTP_PORT        "9883"
+#define LOAD_CLIENTS     4
+#define LOAD_REQUESTS    500
+#define LOAD_RECORDS     20
+
+static int64_t records_out;
+
+static int callback_count(void *data, size_t size, void *cb_data)
+{
+    if (size > 0) {
+        __sync_fetch_and_add(&records_out, 1);
+        flb_lib_free(data);
+    }
+    return 0;
+}
+
+static int http_connect()
+{
+    int fd;
+    int ret;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(HTTP_PORT));
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int http_write(int fd, const char *buf, size_t size)
+{
+    ssize_t bytes;
+    size_t sent = 0;
+
+    while (sent < size) {
+        bytes = write(fd, buf + sent, size - sent);
+        if (bytes <= 0) {
+            return -1;
+        }
+        sent += bytes;
+    }
+    return 0;
+}
+
+/* Read one response, return its status code */
+static int http_read_status(int fd)
+{
+    int len = 0;
+    ssize_t bytes;
+    char buf[512];
+
+    while (len < sizeof(buf) - 1) {
+        bytes = read(fd, buf + len, sizeof(buf) - 1 - len);
+        if (bytes <= 0) {
+            return -1;
+        }
+        len += bytes;
+        buf[len] = '\0';
+        if (strstr(buf, "\r\n\r\n")) {
+            return atoi(buf + 9);
+        }
+    }
+    return -1;
+}
+
+static int http_post(int fd, const char *headers,
+                     const char *body, size_t size)
+{
+    int ret;
+    int len;
+    char *req;
+
+    /* Single write per request, avoid Nagle delays on the client side */
+    req = malloc(size + 512);
+    if (!req) {
+        return -1;
+    }
+    len = snprintf(req, 512,
+                   "POST /test HTTP/1.1\r\n"
+                   "Host: 127.0.0.1\r\n"
+                   "%s"
+                   "Content-Length: %lu\r\n\r\n",
+                   headers, size);
+    memcpy(req + len, body, size);
+
+    ret = http_write(fd, req, len + size);
+    free(req);
+    if (ret == -1) {
+        return -1;
+    }
+    return http_read_status(fd);
+}
+
+static flb_ctx_t *http_start(const char *workers)
+{
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    flb_ctx_t *ctx;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_count;
+    cb.data = NULL;
+    records_out = 0;
+
+    ctx = flb_create();
+    TEST_CHECK(flb_service_set(ctx, "Flush", "0.2", "Grace", "1",
+                               NULL) == 0);
+
+    in_ffd = flb_input(ctx, (char *) "http", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    TEST_CHECK(flb_input_set(ctx, in_ffd, "tag", "http",
+                             "port", HTTP_PORT,
+                             "workers", workers,
+                             NULL) == 0);
+
+    out_ffd = flb_output(ctx, (char *) "lib", &cb);
+    TEST_CHECK(out_ffd >= 0);
+    TEST_CHECK(flb_output_set(ctx, out_ffd, "match", "*", NULL) == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+    usleep(200000);
+
+    return ctx;
+}
+
+/* Wait until the output received the expected number of records */
+static int64_t wait_records(int64_t expected)
+{
+    int i;
+    int64_t n = 0;
+
+    for (i = 0; i < 100; i++) {
+        n = __sync_fetch_and_add(&records_out, 0);
+        if (n >= expected) {
+            break;
+        }
+        usleep(100000);
+    }
+    return n;
+}
+
+void flb_test_in_http_formats()
+{
+    int fd;
+    int status;
+    flb_ctx_t *ctx;
+    const char *json = "[{\"a\":1},{\"b\":2}]";
+    const char *ndjson = "{\"n\":1}\n{\"n\":2}\n{\"n\":3}\n";
+    const char *chunked =
+        "POST /test HTTP/1.1\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n"
+        "7\r\n{\"c\":1}\r\n0\r\n\r\n";
+
+    ctx = http_start("0");
+
+    fd = http_connect();
+    TEST_CHECK(fd != -1);
+
+    status = http_post(fd, "Content-Type: application/json\r\n",
+                       json, strlen(json));
+    TEST_CHECK(status == 201);
+
+    status = http_post(fd, "Content-Type: application/x-ndjson\r\n",
+                       ndjson, strlen(ndjson));
+    TEST_CHECK(status == 201);
+
+    TEST_CHECK(http_write(fd, chunked, strlen(chunked)) == 0);
+    TEST_CHECK(http_read_status(fd) == 201);
+
+    status = http_post(fd, "", "[1,2]", 5);
+    TEST_CHECK(status == 400);
+
+    close(fd);
+
+    TEST_CHECK(wait_records(6) == 6);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/* Load generator: keepalive clients posting NDJSON batches */
+static void *load_client(void *data)
+{
+    int i;
+    int fd;
+    int len = 0;
+    char body[LOAD_RECORDS * 128];
+    long *failed = data;
+
+    for (i = 0; i < LOAD_RECORDS; i++) {
+        len += snprintf(body + len, sizeof(body) - len,
+                        "{\"id\":%i,\"level\":\"info\","
+                        "\"message\":\"GET /api/v1/items 200\"}\n", i);
+    }
+
+    fd = http_connect();
+    if (fd == -1) {
+        *failed = LOAD_REQUESTS;
+        return NULL;
+    }
+
+    for (i = 0; i < LOAD_REQUESTS; i++) {
+        if (http_post(fd, "", body, len) != 201) {
+            (*failed)++;
+        }
+    }
+    close(fd);
+
+    return NULL;
+}
+
+static void load_test(const char *workers)
+{
+    int i;
+    double elapsed;
+    int64_t total;
+    int64_t received;
+    long failed[LOAD_CLIENTS] = {0};
+    pthread_t tid[LOAD_CLIENTS];
+    struct timespec t0;
+    struct timespec t1;
+    flb_ctx_t *ctx;
+
+    ctx = http_start(workers);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < LOAD_CLIENTS; i++) {
+        pthread_create(&tid[i], NULL, load_client, &failed[i]);
+    }
+    for (i = 0; i < LOAD_CLIENTS; i++) {
+        pthread_join(tid[i], NULL);
+        TEST_CHECK(failed[i] == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    total = (int64_t) LOAD_CLIENTS * LOAD_REQUESTS * LOAD_RECORDS;
+    received = wait_records(total);
+    TEST_CHECK(received == total);
+
+    printf("\n  workers=%s clients=%i: %.0f requests/s, %.0f records/s\n",
+           workers, LOAD_CLIENTS,
+           (LOAD_CLIENTS * LOAD_REQUESTS) / elapsed, total / elapsed);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+void flb_test_in_http_load()
+{
+    load_test("0");
+}
+
+void flb_test_in_http_load_workers()
+{
+    load_test("2");
+}
+
+/* Test list */
+TEST_LIST = {
+    {"formats",      flb_test_in_http_formats},
+    {"load",         flb_test_in_http_load},
+    {"load_workers", flb_test_in_http_load_workers},
+    {NULL, NULL}
+};
@@ -0,0 +1,375 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "flb_tests_runtime.h"
+
+#define SYSLOG_PORT     "5145"
+#define CONNS           8
+#define MESSAGES        500
+#define MSG_MAX         16384
+
+/*
+ * The parser decodes the message field: decoders own a scratch buffer that
+ * grows with the values bigger than 8KB, a parser shared by the listener
+ * threads would reallocate it under the feet of the other ones.
+ */
+#define PARSERS_CONF                                                    \
+    "[PARSER]\n"                                                        \
+    "    Name   syslog_dec\n"                                           \
+    "    Format regex\n"                                                \
+    "    Regex  ^<(?<pri>[0-9]+)>(?<host>[^ ]+) (?<message>.*)$\n"      \
+    "    Decode_Field_As escaped message\n"
+
+static int seen[CONNS][MESSAGES];
+static int records_out;
+static int records_bad;
+
+/* Length and filling of message 'i' of connection 'c' */
+static int msg_fill_len(int c, int i)
+{
+    /* every tenth message is big enough to grow the decoder buffer */
+    if (i % 10 == 9) {
+        return 8192 + i * 8;
+    }
+    return 16 + ((i * 7 + c) % 200);
+}
+
+static int msg_body(char *buf, size_t size, int c, int i)
+{
+    int n;
+    int len;
+
+    n = snprintf(buf, size, "c%i-%i-", c, i);
+    len = msg_fill_len(c, i);
+    if (n + len >= size) {
+        return -1;
+    }
+    memset(buf + n, 'a' + ((c * 7 + i) % 26), len);
+    buf[n + len] = '\0';
+    return n + len;
+}
+
+static int msg_valid(const char *p, size_t size, int c, int i)
+{
+    int n;
+    int len;
+    char prefix[32];
+
+    n = snprintf(prefix, sizeof(prefix), "c%i-%i-", c, i);
+    len = msg_fill_len(c, i);
+    if (size != n + len || memcmp(p, prefix, n) != 0) {
+        return FLB_FALSE;
+    }
+    for (p += n; len > 0; p++, len--) {
+        if (*p != 'a' + ((c * 7 + i) % 26)) {
+            return FLB_FALSE;
+        }
+    }
+    return FLB_TRUE;
+}
+
+/* Validate every record against the message it comes from */
+static int callback_check(void *data, size_t size, void *cb_data)
+{
+    int c;
+    int i;
+    char *p;
+    char *end;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    p = strstr(data, "\"message\":\"");
+    if (!p || sscanf(p + 11, "c%i-%i-", &c, &i) != 2 ||
+        c < 0 || c >= CONNS || i < 0 || i >= MESSAGES) {
+        __sync_fetch_and_add(&records_bad, 1);
+        flb_lib_free(data);
+        return 0;
+    }
+    p += 11;
+    end = strchr(p, '"');
+
+    if (!end || !msg_valid(p, end - p, c, i)) {
+        __sync_fetch_and_add(&records_bad, 1);
+    }
+    else {
+        __sync_fetch_and_add(&seen[c][i], 1);
+    }
+    __sync_fetch_and_add(&records_out, 1);
+
+    flb_lib_free(data);
+    return 0;
+}
+
+static int wait_records(int expected, int sec)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < sec * 10; i++) {
+        n = __sync_fetch_and_add(&records_out, 0);
+        if (n >= expected) {
+            break;
+        }
+        usleep(100000);
+    }
+    return n;
+}
+
+static int tcp_connect(const char *port)
+{
+    int fd;
+    int ret;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int fd_write(int fd, const char *buf, size_t size)
+{
+    ssize_t bytes;
+    size_t sent = 0;
+
+    while (sent < size) {
+        bytes = write(fd, buf + sent, size - sent);
+        if (bytes <= 0) {
+            return -1;
+        }
+        sent += bytes;
+    }
+    return 0;
+}
+
+static int udp_connect(const char *port)
+{
+    int fd;
+    int ret;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static flb_ctx_t *syslog_start(const char *mode, const char *workers,
+                               const char *parser, const char *batch)
+{
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    FILE *fp;
+    char path[PATH_MAX];
+    flb_ctx_t *ctx;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_check;
+    cb.data = NULL;
+    records_out = 0;
+    records_bad = 0;
+    memset(seen, 0, sizeof(seen));
+
+    snprintf(path, sizeof(path), "/tmp/flb-rt-in_syslog-%i.conf", getpid());
+    fp = fopen(path, "w");
+    TEST_CHECK(fp != NULL);
+    if (!fp) {
+        return NULL;
+    }
+    fputs(PARSERS_CONF, fp);
+    fclose(fp);
+
+    ctx = flb_create();
+    TEST_CHECK(flb_service_set(ctx, "Flush", "0.2", "Grace", "1",
+                               "Parsers_File", path,
+                               NULL) == 0);
+    unlink(path);
+
+    in_ffd = flb_input(ctx, (char *) "syslog", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    TEST_CHECK(flb_input_set(ctx, in_ffd, "tag", "syslog",
+                             "mode", mode,
+                             "listen", "127.0.0.1",
+                             "port", SYSLOG_PORT,
+                             "parser", parser,
+                             "workers", workers,
+                             NULL) == 0);
+    if (batch) {
+        TEST_CHECK(flb_input_set(ctx, in_ffd,
+                                 "receive_batch", batch,
+                                 "receive_buffer_size", "4M",
+                                 NULL) == 0);
+    }
+
+    out_ffd = flb_output(ctx, (char *) "lib", &cb);
+    TEST_CHECK(out_ffd >= 0);
+    TEST_CHECK(flb_output_set(ctx, out_ffd, "match", "*", "format", "json",
+                              NULL) == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+    usleep(200000);
+
+    return ctx;
+}
+
+static void syslog_check(int expected)
+{
+    int c;
+    int i;
+    int missing = 0;
+
+    TEST_CHECK(records_bad == 0);
+    TEST_MSG("corrupted records: %i", records_bad);
+    TEST_CHECK(records_out == expected);
+    TEST_MSG("records: expected %i, got %i", expected, records_out);
+
+    for (c = 0; c < CONNS; c++) {
+        for (i = 0; i < MESSAGES; i++) {
+            if (seen[c][i] != 1) {
+                missing++;
+            }
+        }
+    }
+    TEST_CHECK(missing == 0);
+    TEST_MSG("messages not received exactly once: %i", missing);
+}
+
+/* Several connections to the listener threads, messages are decoded */
+void flb_test_syslog_tcp_workers_decoders()
+{
+    int c;
+    int i;
+    int len;
+    int fds[CONNS];
+    char body[MSG_MAX];
+    char line[MSG_MAX + 64];
+    flb_ctx_t *ctx;
+
+    ctx = syslog_start("tcp", "2", "syslog_dec", NULL);
+    if (!ctx) {
+        return;
+    }
+
+    for (c = 0; c < CONNS; c++) {
+        fds[c] = tcp_connect(SYSLOG_PORT);
+        TEST_CHECK(fds[c] != -1);
+    }
+
+    /* interleave the connections so the listeners parse at the same time */
+    for (i = 0; i < MESSAGES; i++) {
+        for (c = 0; c < CONNS; c++) {
+            if (fds[c] == -1) {
+                continue;
+            }
+            msg_body(body, sizeof(body), c, i);
+            len = snprintf(line, sizeof(line), "<13>host%i %s\n", c, body);
+            fd_write(fds[c], line, len);
+        }
+    }
+
+    wait_records(CONNS * MESSAGES, 10);
+    syslog_check(CONNS * MESSAGES);
+
+    for (c = 0; c < CONNS; c++) {
+        if (fds[c] != -1) {
+            close(fds[c]);
+        }
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/*
+ * Many more datagrams than 'receive_batch': every receive call takes a few
+ * of them, none may be lost or mixed with the content of another slot.
+ */
+void flb_test_syslog_udp_batch()
+{
+    int c;
+    int i;
+    int n = 0;
+    int len;
+    int fds[CONNS];
+    char body[MSG_MAX];
+    char line[MSG_MAX + 64];
+    flb_ctx_t *ctx;
+
+    ctx = syslog_start("udp", "0", "syslog_dec", "4");
+    if (!ctx) {
+        return;
+    }
+
+    for (c = 0; c < CONNS; c++) {
+        fds[c] = udp_connect(SYSLOG_PORT);
+        TEST_CHECK(fds[c] != -1);
+    }
+
+    for (i = 0; i < MESSAGES; i++) {
+        for (c = 0; c < CONNS; c++) {
+            if (fds[c] == -1) {
+                continue;
+            }
+            msg_body(body, sizeof(body), c, i);
+            len = snprintf(line, sizeof(line), "<13>host%i %s", c, body);
+            TEST_CHECK(send(fds[c], line, len, 0) == len);
+
+            /* UDP has no flow control: don't overrun the receive queue */
+            if (++n % 64 == 0) {
+                usleep(2000);
+            }
+        }
+    }
+
+    wait_records(CONNS * MESSAGES, 10);
+    syslog_check(CONNS * MESSAGES);
+
+    for (c = 0; c < CONNS; c++) {
+        if (fds[c] != -1) {
+            close(fds[c]);
+        }
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+TEST_LIST = {
+    {"tcp_workers_decoders", flb_test_syslog_tcp_workers_decoders},
+    {"udp_batch",            flb_test_syslog_udp_batch},
+    {NULL, NULL}
+};
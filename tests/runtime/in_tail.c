@@ -0,0 +1,1347 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_metrics.h>
+#include <fluent-bit/flb_gzip.h>
+#include "flb_tests_runtime.h"
+#include "../lib/bench.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+struct tail_test {
+    pthread_mutex_t lock;
+    int records;
+    int keep;                  /* keep the records content ? */
+    flb_sds_t out;             /* records, one per line      */
+    flb_ctx_t *flb;
+    int in_ffd;
+    char path[PATH_MAX];
+};
+
+static int cb_collect(void *record, size_t size, void *data)
+{
+    struct tail_test *t = data;
+
+    pthread_mutex_lock(&t->lock);
+    if (t->keep) {
+        t->out = flb_sds_cat(t->out, record, size);
+        t->out = flb_sds_cat(t->out, "\n", 1);
+    }
+    t->records++;
+    pthread_mutex_unlock(&t->lock);
+
+    flb_free(record);
+    return 0;
+}
+
+static int tail_records(struct tail_test *t)
+{
+    int n;
+
+    pthread_mutex_lock(&t->lock);
+    n = t->records;
+    pthread_mutex_unlock(&t->lock);
+
+    return n;
+}
+
+/* Wait up to 'sec' seconds until 'n' records have been flushed */
+static int tail_wait(struct tail_test *t, int n, int sec)
+{
+    int i;
+
+    for (i = 0; i < sec * 100; i++) {
+        if (tail_records(t) >= n) {
+            return 0;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+/* Create a log file with the given lines */
+static int tail_write(const char *path, const char **lines, int n)
+{
+    int i;
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%s\n", lines[i]);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Start an engine tailing 't->path' with the given input properties, the
+ * list of key/value pairs ends with NULL.
+ */
+static int tail_start(struct tail_test *t, const char *format, int keep, ...)
+{
+    int ret;
+    int out_ffd;
+    char *key;
+    char *value;
+    va_list va;
+    struct flb_lib_out_cb cb;
+
+    pthread_mutex_init(&t->lock, NULL);
+    t->records = 0;
+    t->keep = keep;
+    t->out = flb_sds_create_size(1024);
+
+    t->flb = flb_create();
+    TEST_CHECK(t->flb != NULL);
+    if (!t->flb) {
+        return -1;
+    }
+
+    flb_service_set(t->flb,
+                    "Flush", "0.2",
+                    "Grace", "1",
+                    "Log_Level", "error",
+                    NULL);
+
+    /* Parsers available for the input */
+    flb_parser_create("tail_json", "json", NULL, NULL, NULL, NULL,
+                      MK_FALSE, NULL, 0, NULL, t->flb->config);
+
+    t->in_ffd = flb_input(t->flb, "tail", NULL);
+    TEST_CHECK(t->in_ffd >= 0);
+    ret = flb_input_set(t->flb, t->in_ffd,
+                        "Tag", "test",
+                        "Path", t->path,
+                        NULL);
+    TEST_CHECK(ret == 0);
+
+    va_start(va, keep);
+    while ((key = va_arg(va, char *))) {
+        value = va_arg(va, char *);
+        ret = flb_input_set(t->flb, t->in_ffd, key, value, NULL);
+        TEST_CHECK(ret == 0);
+    }
+    va_end(va);
+
+    cb.cb = cb_collect;
+    cb.data = t;
+    out_ffd = flb_output(t->flb, "lib", &cb);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(t->flb, out_ffd,
+                   "Match", "*",
+                   "Format", format,
+                   NULL);
+
+    ret = flb_start(t->flb);
+    TEST_CHECK(ret == 0);
+    return ret;
+}
+
+static void tail_stop(struct tail_test *t)
+{
+    flb_stop(t->flb);
+    flb_destroy(t->flb);
+    flb_sds_destroy(t->out);
+    pthread_mutex_destroy(&t->lock);
+    unlink(t->path);
+}
+
+static void tail_path(struct tail_test *t, const char *name)
+{
+    snprintf(t->path, sizeof(t->path) - 1, "/tmp/flb-rt-in_tail-%i-%s.log",
+             getpid(), name);
+}
+
+/* Check that the flushed records, one per line, contain 'expected' */
+static void tail_check(struct tail_test *t, const char *expected)
+{
+    pthread_mutex_lock(&t->lock);
+    TEST_CHECK(strstr(t->out, expected) != NULL);
+    TEST_MSG("expected: %s", expected);
+    TEST_MSG("got     : %s", t->out);
+    pthread_mutex_unlock(&t->lock);
+}
+
+void flb_test_tail_path_key_raw()
+{
+    int ret;
+    char expected[PATH_MAX + 128];
+    struct tail_test t;
+    const char *lines[] = {
+        "first line",
+        "second line",
+    };
+
+    tail_path(&t, "raw");
+    ret = tail_write(t.path, lines, 2);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE, "Path_Key", "file", NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 2, 5) == 0);
+        snprintf(expected, sizeof(expected),
+                 ",{\"file\":\"%s\",\"log\":\"second line\"}]", t.path);
+        tail_check(&t, expected);
+    }
+    tail_stop(&t);
+}
+
+void flb_test_tail_path_key_parser()
+{
+    int ret;
+    char expected[PATH_MAX + 512];
+    struct tail_test t;
+    const char *lines[] = {
+        "{\"a\": 1, \"b\": \"x\"}",
+        /* more than 15 keys, packed with a 16 bits map header */
+        "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,"
+        "\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,"
+        "\"k13\":13,\"k14\":14,\"k15\":15}",
+        "not json",
+    };
+
+    tail_path(&t, "parser");
+    ret = tail_write(t.path, lines, 3);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Path_Key", "file",
+                     "Parser", "tail_json",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 3, 5) == 0);
+
+        snprintf(expected, sizeof(expected),
+                 ",{\"file\":\"%s\",\"a\":1,\"b\":\"x\"}]", t.path);
+        tail_check(&t, expected);
+
+        snprintf(expected, sizeof(expected),
+                 ",{\"file\":\"%s\",\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,"
+                 "\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,"
+                 "\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,"
+                 "\"k15\":15}]", t.path);
+        tail_check(&t, expected);
+
+        /* lines the parser cannot handle are packed as they are */
+        snprintf(expected, sizeof(expected),
+                 ",{\"file\":\"%s\",\"log\":\"not json\"}]", t.path);
+        tail_check(&t, expected);
+    }
+    tail_stop(&t);
+}
+
+/* Content of the line 'i', with lengths crossing the buffer boundaries */
+static int tail_line(int i, char *buf)
+{
+    int j;
+    int len;
+
+    len = 1 + (i * 7919) % 3000;
+    for (j = 0; j < len; j++) {
+        buf[j] = 'a' + (i + j) % 26;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+void flb_test_tail_long_lines()
+{
+    int i;
+    int ret;
+    int n = 2000;
+    int ok = 0;
+    char line[4096];
+    char *p;
+    char *end;
+    FILE *fp;
+    struct tail_test t;
+
+    tail_path(&t, "long");
+    fp = fopen(t.path, "w");
+    TEST_CHECK(fp != NULL);
+    if (!fp) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        tail_line(i, line);
+        fprintf(fp, "%s\n", line);
+    }
+    fclose(fp);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Buffer_Chunk_Size", "4k",
+                     "Buffer_Max_Size", "8k",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, n, 10) == 0);
+
+        /* every record must hold its line untouched, in order */
+        pthread_mutex_lock(&t.lock);
+        p = t.out;
+        for (i = 0; i < n && p; i++) {
+            tail_line(i, line);
+            p = strstr(p, ",{\"log\":\"");
+            if (!p) {
+                break;
+            }
+            p += 9;
+            end = strchr(p, '"');
+            if (end && end - p == strlen(line) &&
+                strncmp(p, line, end - p) == 0) {
+                ok++;
+            }
+        }
+        pthread_mutex_unlock(&t.lock);
+        TEST_CHECK(ok == n);
+        TEST_MSG("lines ok: %i/%i", ok, n);
+    }
+    tail_stop(&t);
+}
+
+/* Directory used by the tests that tail a glob pattern */
+static void tail_dir(struct tail_test *t, const char *name, char *dir, int size)
+{
+    snprintf(dir, size, "/tmp/flb-rt-in_tail-%i-%s", getpid(), name);
+    mkdir(dir, 0755);
+    snprintf(t->path, sizeof(t->path) - 1, "%s/*.log", dir);
+}
+
+static void tail_dir_file(const char *dir, const char *name, const char *line)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    tail_write(path, &line, 1);
+}
+
+static void tail_dir_remove(const char *dir, const char **names, int n)
+{
+    int i;
+    char path[PATH_MAX];
+
+    for (i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (unlink(path) == -1) {
+            rmdir(path);
+        }
+    }
+    rmdir(dir);
+}
+
+static int tail_has(struct tail_test *t, const char *str)
+{
+    int ret;
+
+    pthread_mutex_lock(&t->lock);
+    ret = strstr(t->out, str) != NULL;
+    pthread_mutex_unlock(&t->lock);
+    return ret;
+}
+
+/* Files created or excluded between scans */
+void flb_test_tail_scan_exclude()
+{
+    int ret;
+    char dir[PATH_MAX];
+    struct tail_test t;
+    const char *names[] = {"a.log", "b-skip.log", "c.log", "d-skip.log"};
+
+    tail_dir(&t, "scan", dir, sizeof(dir));
+    tail_dir_file(dir, "a.log", "file-a");
+    tail_dir_file(dir, "b-skip.log", "file-b");
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Exclude_Path", "*.tmp,*-skip.log",
+                     "Refresh_Interval", "1",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 1, 5) == 0);
+
+        /* picked up by the next scans */
+        tail_dir_file(dir, "c.log", "file-c");
+        tail_dir_file(dir, "d-skip.log", "file-d");
+        TEST_CHECK(tail_wait(&t, 2, 5) == 0);
+
+        /* two more scans: nothing else must be read */
+        sleep(2);
+        TEST_CHECK(tail_records(&t) == 2);
+        TEST_MSG("records: %i", tail_records(&t));
+        tail_check(&t, "{\"log\":\"file-a\"}");
+        tail_check(&t, "{\"log\":\"file-c\"}");
+        TEST_CHECK(!tail_has(&t, "file-b") && !tail_has(&t, "file-d"));
+    }
+    tail_stop(&t);
+    tail_dir_remove(dir, names, 4);
+}
+
+/* A file reachable through two names is read once */
+void flb_test_tail_scan_same_inode()
+{
+    int ret;
+    char dir[PATH_MAX];
+    char src[PATH_MAX + 8];
+    char dst[PATH_MAX + 8];
+    struct tail_test t;
+    const char *names[] = {"a.log", "b.log"};
+
+    tail_dir(&t, "inode", dir, sizeof(dir));
+    tail_dir_file(dir, "a.log", "file-a");
+    snprintf(src, sizeof(src), "%s/a.log", dir);
+    snprintf(dst, sizeof(dst), "%s/b.log", dir);
+    ret = link(src, dst);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE, "Refresh_Interval", "1", NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 1, 5) == 0);
+        sleep(2);
+        TEST_CHECK(tail_records(&t) == 1);
+        TEST_MSG("records: %i", tail_records(&t));
+    }
+    tail_stop(&t);
+    tail_dir_remove(dir, names, 2);
+}
+
+/* A rotated file keeps being read and the new file is picked up */
+void flb_test_tail_scan_rotate()
+{
+    int ret;
+    char dir[PATH_MAX];
+    char src[PATH_MAX + 8];
+    char dst[PATH_MAX + 8];
+    FILE *fp;
+    struct tail_test t;
+    const char *names[] = {"a.log", "a.log.1"};
+
+    tail_dir(&t, "rotate", dir, sizeof(dir));
+    tail_dir_file(dir, "a.log", "before");
+    snprintf(src, sizeof(src), "%s/a.log", dir);
+    snprintf(dst, sizeof(dst), "%s/a.log.1", dir);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Refresh_Interval", "1",
+                     "Rotate_Wait", "5",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 1, 5) == 0);
+
+        ret = rename(src, dst);
+        TEST_CHECK(ret == 0);
+        fp = fopen(dst, "a");
+        TEST_CHECK(fp != NULL);
+        if (fp) {
+            fprintf(fp, "rotated\n");
+            fclose(fp);
+        }
+        tail_dir_file(dir, "a.log", "after");
+
+        TEST_CHECK(tail_wait(&t, 3, 5) == 0);
+        sleep(2);
+        TEST_CHECK(tail_records(&t) == 3);
+        TEST_MSG("records: %i", tail_records(&t));
+        tail_check(&t, "{\"log\":\"rotated\"}");
+        tail_check(&t, "{\"log\":\"after\"}");
+    }
+    tail_stop(&t);
+    tail_dir_remove(dir, names, 2);
+}
+
+#ifdef FLB_HAVE_METRICS
+static size_t tail_metric(struct tail_test *t, int id)
+{
+    struct flb_metric *metric;
+    struct flb_input_instance *ins;
+
+    ins = mk_list_entry_first(&t->flb->config->inputs,
+                              struct flb_input_instance, _head);
+    metric = flb_metrics_get_id(id, ins->metrics);
+    if (!metric) {
+        return (size_t) -1;
+    }
+    return metric->val;
+}
+#endif
+
+/* A file with a backlog doesn't hold the others longer than its budget */
+void flb_test_tail_read_budget()
+{
+    int i;
+    int ret;
+    int n = 40000;
+    char *a1;
+    char *a2;
+    char *b;
+    char dir[256];
+    char path[PATH_MAX];
+    FILE *fp;
+    struct tail_test t;
+    const char *names[] = {"a.log", "b.log"};
+
+    tail_dir(&t, "budget", dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/a.log", dir);
+    fp = fopen(path, "w");
+    TEST_CHECK(fp != NULL);
+    if (!fp) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "a-%06i-%054i\n", i, 0);
+    }
+    fclose(fp);
+    tail_dir_file(dir, "b.log", "b-00");
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "File_Read_Budget", "256k",
+                     "Round_Read_Budget", "256k",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, n + 1, 10) == 0);
+
+        /* 'b' is served after the first 256k of 'a': about 4000 lines */
+        pthread_mutex_lock(&t.lock);
+        a1 = strstr(t.out, "a-003000-");
+        a2 = strstr(t.out, "a-006000-");
+        b = strstr(t.out, "b-00");
+        TEST_CHECK(a1 && a2 && b && a1 < b && b < a2);
+        pthread_mutex_unlock(&t.lock);
+
+#ifdef FLB_HAVE_METRICS
+        /* everything was read: 'lag_bytes' and 'lag_max_bytes' */
+        sleep(2);
+        TEST_CHECK(tail_metric(&t, 103) == 0);
+        TEST_CHECK(tail_metric(&t, 104) == 0);
+#endif
+    }
+    tail_stop(&t);
+    tail_dir_remove(dir, names, 2);
+}
+
+/* Append the records '{"v":"f-<id>-<seq>"}' from 'from' to 'to - 1' */
+static void tail_threads_append(const char *dir, int id, int from, int to)
+{
+    int i;
+    char path[PATH_MAX];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%02i.log", dir, id);
+    fp = fopen(path, "a");
+    TEST_CHECK(fp != NULL);
+    if (!fp) {
+        return;
+    }
+    for (i = from; i < to; i++) {
+        fprintf(fp, "{\"v\":\"f-%02i-%06i\"}\n", id, i);
+    }
+    fclose(fp);
+}
+
+/* Records of every file arrive complete and in order */
+static int tail_threads_check(struct tail_test *t, int files, int n)
+{
+    int id;
+    int seq;
+    int ok = 0;
+    int next[16] = {0};
+    char *p;
+
+    pthread_mutex_lock(&t->lock);
+    p = t->out;
+    while ((p = strstr(p, "\"v\":\"f-"))) {
+        p += 7;
+        if (sscanf(p, "%2d-%6d", &id, &seq) != 2 || id >= files ||
+            seq != next[id]) {
+            break;
+        }
+        next[id]++;
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    for (id = 0; id < files; id++) {
+        TEST_CHECK(next[id] == n);
+        TEST_MSG("file %02i: %i/%i records in order", id, next[id], n);
+        ok += next[id] == n;
+    }
+    return ok == files ? 0 : -1;
+}
+
+void flb_test_tail_threads()
+{
+    int i;
+    int ret;
+    int n = 2000;
+    int files = 16;
+    char dir[256];
+    char path[PATH_MAX];
+    struct tail_test t;
+    const char *names[16];
+    char name[16][8];
+
+    tail_dir(&t, "threads", dir, sizeof(dir));
+    for (i = 0; i < files; i++) {
+        snprintf(name[i], sizeof(name[i]), "%02i.log", i);
+        names[i] = name[i];
+        tail_threads_append(dir, i, 0, n);
+    }
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Threads", "4",
+                     "Parser", "tail_json",
+                     "Path_Key", "path",
+                     "File_Read_Budget", "16k",
+                     NULL);
+    if (ret == 0) {
+        /* content existing at start, read as static files */
+        TEST_CHECK(tail_wait(&t, files * n, 10) == 0);
+
+        /* new content, read on events */
+        sleep(1);
+        for (i = 0; i < files; i++) {
+            tail_threads_append(dir, i, n, n * 2);
+        }
+        TEST_CHECK(tail_wait(&t, files * n * 2, 10) == 0);
+        usleep(500000);
+
+        TEST_CHECK(tail_records(&t) == files * n * 2);
+        TEST_MSG("records: %i", tail_records(&t));
+        TEST_CHECK(tail_threads_check(&t, files, n * 2) == 0);
+
+        snprintf(path, sizeof(path), "\"path\":\"%s/07.log\"", dir);
+        TEST_CHECK(tail_has(&t, path));
+    }
+    tail_stop(&t);
+    tail_dir_remove(dir, names, files);
+}
+
+/* Append 'n' lines of 100 bytes: '<prefix>-<seq>-000...' */
+static void tail_truncate_append(const char *path, char prefix, int n)
+{
+    int i;
+    FILE *fp;
+
+    fp = fopen(path, "a");
+    TEST_CHECK(fp != NULL);
+    if (!fp) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%c-%06i-%090i\n", prefix, i, 0);
+    }
+    fclose(fp);
+}
+
+/*
+ * A file truncated while its reader is held by a paused engine, then
+ * written again past the previous offset: the new content is read from
+ * the beginning.
+ */
+void flb_test_tail_threads_truncate()
+{
+    int i;
+    int ret;
+    int seq;
+    int missing = 0;
+    int n = 20000;
+    char *p;
+    char path[PATH_MAX];
+    char *seen;
+    struct tail_test t;
+
+    tail_path(&t, "truncate");
+    snprintf(path, sizeof(path), "%s", t.path);
+    unlink(path);
+    tail_truncate_append(path, 's', 1);
+
+    seen = flb_calloc(1, n);
+    TEST_CHECK(seen != NULL);
+    if (!seen) {
+        return;
+    }
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Threads", "1",
+                     "Mem_Buf_Limit", "64k",
+                     "File_Read_Budget", "16k",
+                     NULL);
+    if (ret == 0) {
+        /* the file is promoted to the event mode */
+        TEST_CHECK(tail_wait(&t, 1, 5) == 0);
+        sleep(1);
+
+        tail_truncate_append(path, 'o', n);
+        TEST_CHECK(tail_wait(&t, n / 10, 10) == 0);
+        TEST_CHECK(truncate(path, 0) == 0);
+        usleep(500000);
+
+        /* more content than what was read before the truncation */
+        tail_truncate_append(path, 'n', n);
+        for (i = 0; i < 200; i++) {
+            if (tail_has(&t, "n-019999-")) {
+                break;
+            }
+            usleep(100000);
+        }
+        usleep(500000);
+
+        pthread_mutex_lock(&t.lock);
+        p = t.out;
+        while ((p = strstr(p, "\"n-"))) {
+            p += 3;
+            if (sscanf(p, "%6d", &seq) == 1 && seq >= 0 && seq < n) {
+                seen[seq] = 1;
+            }
+        }
+        pthread_mutex_unlock(&t.lock);
+
+        for (i = 0; i < n; i++) {
+            missing += !seen[i];
+        }
+        TEST_CHECK(missing == 0);
+        TEST_MSG("lines written after the truncation missing: %i", missing);
+    }
+    tail_stop(&t);
+    flb_free(seen);
+}
+
+/* Stack traces joined by the built-in multiline rules */
+void flb_test_tail_multiline_rules()
+{
+    int ret;
+    struct tail_test t;
+    const char *lines[] = {
+        "app started",
+        "Exception in thread \"main\" java.lang.IllegalStateException: boom",
+        "    at com.example.Foo.bar(Foo.java:10)",
+        "    at com.example.Main.main(Main.java:5)",
+        "Caused by: java.lang.NullPointerException: null",
+        "    at com.example.Foo.baz(Foo.java:20)",
+        "    ... 1 more",
+        "request done",
+        "Traceback (most recent call last):",
+        "  File \"app.py\", line 3, in <module>",
+        "    main()",
+        "  File \"app.py\", line 2, in main",
+        "    raise ValueError(\"bad\")",
+        "ValueError: bad",
+        "panic: runtime error: index out of range",
+        "",
+        "goroutine 1 [running]:",
+        "main.main()",
+        "\t/app/main.go:8 +0x1d",
+        "exit status 2",
+        /* the last record is completed by the flush timeout */
+        "java.lang.RuntimeException: last",
+        "\tat com.example.Main.main(Main.java:9)",
+    };
+
+    tail_path(&t, "mult_rules");
+    ret = tail_write(t.path, lines, sizeof(lines) / sizeof(char *));
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Multiline_Rules", "java, python,go",
+                     "Multiline_Flush", "1",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 7, 10) == 0);
+        usleep(500000);
+        TEST_CHECK(tail_records(&t) == 7);
+        TEST_MSG("records: %i", tail_records(&t));
+
+        tail_check(&t, "{\"log\":\"app started\"}");
+        tail_check(&t, "{\"log\":\"Exception in thread \\\"main\\\" "
+                   "java.lang.IllegalStateException: boom\\n"
+                   "    at com.example.Foo.bar(Foo.java:10)\\n"
+                   "    at com.example.Main.main(Main.java:5)\\n"
+                   "Caused by: java.lang.NullPointerException: null\\n"
+                   "    at com.example.Foo.baz(Foo.java:20)\\n"
+                   "    ... 1 more\"}");
+        tail_check(&t, "{\"log\":\"request done\"}");
+        tail_check(&t, "{\"log\":\"Traceback (most recent call last):\\n"
+                   "  File \\\"app.py\\\", line 3, in <module>\\n"
+                   "    main()\\n"
+                   "  File \\\"app.py\\\", line 2, in main\\n"
+                   "    raise ValueError(\\\"bad\\\")\\n"
+                   "ValueError: bad\"}");
+        tail_check(&t, "{\"log\":\"panic: runtime error: index out of range\\n"
+                   "goroutine 1 [running]:\\n"
+                   "main.main()\\n"
+                   "\\t/app/main.go:8 +0x1d\"}");
+        tail_check(&t, "{\"log\":\"exit status 2\"}");
+        tail_check(&t, "{\"log\":\"java.lang.RuntimeException: last\\n"
+                   "\\tat com.example.Main.main(Main.java:9)\"}");
+    }
+    tail_stop(&t);
+}
+
+/* Custom rules, the parser runs once over the joined record */
+void flb_test_tail_multiline_rules_parser()
+{
+    int ret;
+    struct tail_test t;
+    const char *lines[] = {
+        "{\"a\": 1,",
+        " \"b\": \"x\",",
+        " \"c\": [1, 2]}",
+        "{\"d\": true}",
+        "not json",
+    };
+
+    tail_path(&t, "mult_rules_parser");
+    ret = tail_write(t.path, lines, 5);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Multiline_Rule", "start_state /^\\{/ json",
+                     "Multiline_Rule", "json /^ / json",
+                     "Multiline_Flush", "1",
+                     "Parser", "tail_json",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 3, 10) == 0);
+        usleep(500000);
+        TEST_CHECK(tail_records(&t) == 3);
+        TEST_MSG("records: %i", tail_records(&t));
+
+        tail_check(&t, ",{\"a\":1,\"b\":\"x\",\"c\":[1,2]}]");
+        tail_check(&t, ",{\"d\":true}]");
+        tail_check(&t, ",{\"log\":\"not json\"}]");
+    }
+    tail_stop(&t);
+}
+
+/* Long lines split by Docker and CRI are joined before being parsed */
+void flb_test_tail_docker_mode()
+{
+    int ret;
+    struct tail_test t;
+    const char *lines[] = {
+        "{\"log\":\"part one, \",\"stream\":\"stdout\","
+        "\"time\":\"2020-01-01T00:00:00.1Z\"}",
+        "{\"log\":\"part two\\n\",\"stream\":\"stdout\","
+        "\"time\":\"2020-01-01T00:00:00.2Z\"}",
+        "{\"log\":\"single\\n\",\"stream\":\"stderr\","
+        "\"time\":\"2020-01-01T00:00:01Z\"}",
+        /* an escaped backslash followed by 'n' is not a new line */
+        "{\"log\":\"escaped \\\\n\",\"stream\":\"stdout\","
+        "\"time\":\"2020-01-01T00:00:02Z\"}",
+        "{\"log\":\" end\\u000a\",\"stream\":\"stdout\","
+        "\"time\":\"2020-01-01T00:00:03Z\"}",
+        "2020-01-01T00:00:04.1Z stdout P cri one, ",
+        "2020-01-01T00:00:04.2Z stdout P cri two, ",
+        "2020-01-01T00:00:04.3Z stdout F cri three",
+        "2020-01-01T00:00:05Z stderr F cri single",
+        /* the last piece is completed by the flush timeout */
+        "{\"log\":\"flushed on timeout\",\"stream\":\"stdout\","
+        "\"time\":\"2020-01-01T00:00:06Z\"}",
+    };
+
+    tail_path(&t, "docker_mode");
+    ret = tail_write(t.path, lines, sizeof(lines) / sizeof(char *));
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Docker_Mode", "On",
+                     "Docker_Mode_Flush", "1",
+                     "Parser", "tail_json",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 6, 10) == 0);
+        usleep(500000);
+        TEST_CHECK(tail_records(&t) == 6);
+        TEST_MSG("records: %i", tail_records(&t));
+
+        tail_check(&t, "{\"log\":\"part one, part two\\n\",\"stream\":\"stdout\","
+                   "\"time\":\"2020-01-01T00:00:00.2Z\"}");
+        tail_check(&t, "{\"log\":\"single\\n\",\"stream\":\"stderr\",");
+        tail_check(&t, "{\"log\":\"escaped \\\\n end\\n\",\"stream\":\"stdout\","
+                   "\"time\":\"2020-01-01T00:00:03Z\"}");
+        tail_check(&t, "{\"log\":\"2020-01-01T00:00:04.1Z stdout F "
+                   "cri one, cri two, cri three\"}");
+        tail_check(&t, "{\"log\":\"2020-01-01T00:00:05Z stderr F cri single\"}");
+        tail_check(&t, "{\"log\":\"flushed on timeout\",\"stream\":\"stdout\",");
+    }
+    tail_stop(&t);
+}
+
+#ifdef FLB_HAVE_INOTIFY
+/* New files and directories are found without waiting for a scan */
+void flb_test_tail_dir_events()
+{
+    int ret;
+    char dir[256];
+    char sub[512];
+    char tmp[PATH_MAX];
+    char dst[PATH_MAX];
+    struct tail_test t;
+    const char *names[] = {"a/1.log", "b/2.log", "b/3.log", "b/4.tmp",
+                           ".hidden/5.log", "a", "b", ".hidden"};
+
+    tail_dir(&t, "events", dir, sizeof(dir));
+    snprintf(sub, sizeof(sub), "%s/a", dir);
+    mkdir(sub, 0755);
+    snprintf(t.path, sizeof(t.path) - 1, "%s/*/*.log", dir);
+
+    ret = tail_start(&t, "json", FLB_TRUE, "Refresh_Interval", "60", NULL);
+    if (ret == 0) {
+        /* a file in a directory existing at start */
+        tail_dir_file(sub, "1.log", "file-1");
+        TEST_CHECK(tail_wait(&t, 1, 3) == 0);
+
+        /* a new directory */
+        snprintf(sub, sizeof(sub), "%s/b", dir);
+        mkdir(sub, 0755);
+        usleep(200000);
+        tail_dir_file(sub, "2.log", "file-2");
+        TEST_CHECK(tail_wait(&t, 2, 3) == 0);
+
+        /* a file moved into a watched directory, only the name matches */
+        tail_dir_file(sub, "4.tmp", "file-3");
+        snprintf(tmp, sizeof(tmp), "%s/4.tmp", sub);
+        snprintf(dst, sizeof(dst), "%s/3.log", sub);
+        ret = rename(tmp, dst);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(tail_wait(&t, 3, 3) == 0);
+
+        /* not covered by the pattern */
+        snprintf(sub, sizeof(sub), "%s/.hidden", dir);
+        mkdir(sub, 0755);
+        tail_dir_file(sub, "5.log", "file-5");
+        sleep(1);
+
+        TEST_CHECK(tail_records(&t) == 3);
+        TEST_MSG("records: %i", tail_records(&t));
+        tail_check(&t, "{\"log\":\"file-1\"}");
+        tail_check(&t, "{\"log\":\"file-2\"}");
+        tail_check(&t, "{\"log\":\"file-3\"}");
+    }
+    tail_stop(&t);
+    tail_dir_remove(dir, names, 8);
+}
+#endif
+
+/* Append the lines 'line-<from>' to 'line-<to - 1>' as a new GZip member */
+static int tail_append_gz(const char *path, int from, int to)
+{
+    int i;
+    int ret;
+    size_t len;
+    void *zip;
+    FILE *fp;
+    flb_sds_t tmp;
+    flb_sds_t buf;
+
+    buf = flb_sds_create_size(16 * (to - from) + 1);
+    if (!buf) {
+        return -1;
+    }
+    for (i = from; i < to; i++) {
+        tmp = flb_sds_printf(&buf, "line-%04i\n", i);
+        if (!tmp) {
+            flb_sds_destroy(buf);
+            return -1;
+        }
+    }
+
+    ret = flb_gzip_compress(buf, flb_sds_len(buf), &zip, &len);
+    flb_sds_destroy(buf);
+    if (ret != 0) {
+        return -1;
+    }
+
+    fp = fopen(path, "a");
+    if (!fp) {
+        flb_free(zip);
+        return -1;
+    }
+    ret = (fwrite(zip, len, 1, fp) == 1) ? 0 : -1;
+    fclose(fp);
+    flb_free(zip);
+    return ret;
+}
+
+/* A compressed file is inflated while it's read, new members included */
+void flb_test_tail_gzip()
+{
+    int ret;
+    struct tail_test t;
+
+    tail_path(&t, "gzip");
+    unlink(t.path);
+    ret = tail_append_gz(t.path, 0, 1000);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE, NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 1000, 10) == 0);
+
+        ret = tail_append_gz(t.path, 1000, 1500);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(tail_wait(&t, 1500, 10) == 0);
+        sleep(1);
+        TEST_CHECK(tail_records(&t) == 1500);
+        TEST_MSG("records: %i", tail_records(&t));
+
+        tail_check(&t, "{\"log\":\"line-0000\"}");
+        tail_check(&t, "{\"log\":\"line-0999\"}");
+        tail_check(&t, "{\"log\":\"line-1000\"}");
+        tail_check(&t, "{\"log\":\"line-1499\"}");
+    }
+    tail_stop(&t);
+    unlink(t.path);
+}
+
+/* Members appended to a compressed file while its reader inflates it */
+void flb_test_tail_threads_gzip()
+{
+    int i;
+    int ret;
+    int n = 6000;
+    char line[32];
+    struct tail_test t;
+
+    tail_path(&t, "threads-gzip");
+    unlink(t.path);
+    ret = tail_append_gz(t.path, 0, 2000);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "Threads", "1",
+                     "File_Read_Budget", "4k",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 2000, 10) == 0);
+
+        for (i = 2000; i < n; i += 100) {
+            ret = tail_append_gz(t.path, i, i + 100);
+            TEST_CHECK(ret == 0);
+            usleep(10000);
+        }
+        TEST_CHECK(tail_wait(&t, n, 10) == 0);
+        sleep(1);
+        TEST_CHECK(tail_records(&t) == n);
+        TEST_MSG("records: %i", tail_records(&t));
+
+        for (i = 0; i < n; i += 500) {
+            snprintf(line, sizeof(line), "{\"log\":\"line-%04i\"}", i);
+            tail_check(&t, line);
+        }
+        tail_check(&t, "{\"log\":\"line-5999\"}");
+    }
+    tail_stop(&t);
+    unlink(t.path);
+}
+
+#ifdef FLB_HAVE_SQLDB
+/* Append the lines 'line-<from>' to 'line-<to - 1>' to a file */
+static int tail_append(const char *path, int from, int to)
+{
+    int i;
+    FILE *fp;
+
+    fp = fopen(path, "a");
+    if (!fp) {
+        return -1;
+    }
+    for (i = from; i < to; i++) {
+        fprintf(fp, "line-%04i\n", i);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Tail the file in a child process until 'n' records are flushed, wait
+ * 'sec' seconds more and kill it without giving it the chance to exit.
+ */
+static int tail_db_crash(struct tail_test *t, const char *db,
+                         const char *interval, int n, int sec)
+{
+    int ret;
+    int status;
+    pid_t pid;
+
+    pid = fork();
+    if (pid == -1) {
+        return -1;
+    }
+
+    if (pid == 0) {
+        ret = tail_start(t, "json", FLB_FALSE,
+                         "DB", db,
+                         "DB.sync_interval", interval,
+                         NULL);
+        if (ret != 0 || tail_wait(t, n, 10) != 0) {
+            _exit(1);
+        }
+        sleep(sec);
+        raise(SIGKILL);
+        _exit(1);
+    }
+
+    waitpid(pid, &status, 0);
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL) {
+        return -1;
+    }
+    return 0;
+}
+
+static void tail_db_unlink(const char *db)
+{
+    char tmp[PATH_MAX + 8];
+
+    unlink(db);
+    snprintf(tmp, sizeof(tmp), "%s-wal", db);
+    unlink(tmp);
+    snprintf(tmp, sizeof(tmp), "%s-shm", db);
+    unlink(tmp);
+}
+
+/*
+ * After a crash, a restart must resume from the last synced offset: lines
+ * read after the last sync are read again, no line is ever lost.
+ */
+static void tail_db_restart(const char *name, const char *interval,
+                            int sec, int expected, int gz)
+{
+    int ret;
+    char db[PATH_MAX + 8];
+    struct tail_test t;
+
+    tail_path(&t, name);
+    snprintf(db, sizeof(db), "%s.db", t.path);
+    unlink(t.path);
+    tail_db_unlink(db);
+
+    ret = gz ? tail_append_gz(t.path, 0, 100) : tail_append(t.path, 0, 100);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_db_crash(&t, db, interval, 100, sec);
+    TEST_CHECK(ret == 0);
+    TEST_MSG("tail process did not crash as expected");
+
+    ret = gz ? tail_append_gz(t.path, 100, 150) :
+        tail_append(t.path, 100, 150);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "DB", db,
+                     "DB.sync_interval", interval,
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, expected, 10) == 0);
+        /* give a chance to any unexpected record */
+        sleep(1);
+        TEST_CHECK(tail_records(&t) == expected);
+        TEST_MSG("records: %i, expected: %i", tail_records(&t), expected);
+
+        tail_check(&t, "{\"log\":\"line-0100\"}");
+        tail_check(&t, "{\"log\":\"line-0149\"}");
+        if (expected == 150) {
+            tail_check(&t, "{\"log\":\"line-0000\"}");
+        }
+    }
+    tail_stop(&t);
+    tail_db_unlink(db);
+}
+
+/* Offsets were synced before the crash: only the new lines are read */
+void flb_test_tail_db_restart_synced()
+{
+    tail_db_restart("db-synced", "1", 3, 50, FLB_FALSE);
+}
+
+/* Crash before any sync: everything is read again */
+void flb_test_tail_db_restart_unsynced()
+{
+    tail_db_restart("db-unsynced", "60", 0, 150, FLB_FALSE);
+}
+
+/* The lines of a compressed file read before a restart are skipped */
+void flb_test_tail_db_restart_gzip()
+{
+    tail_db_restart("db-gzip", "1", 3, 50, FLB_TRUE);
+}
+
+/*
+ * A compressed file resumes from the inflate checkpoint saved in the
+ * database: the content before it is not inflated again, it's damaged
+ * in place to make sure of it.
+ */
+void flb_test_tail_db_resume_gzip()
+{
+    int fd;
+    int ret;
+    char junk[32];
+    char db[PATH_MAX + 8];
+    struct tail_test t;
+
+    tail_path(&t, "db-resume-gzip");
+    snprintf(db, sizeof(db), "%s.db", t.path);
+    unlink(t.path);
+    tail_db_unlink(db);
+
+    ret = tail_append_gz(t.path, 0, 100);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_db_crash(&t, db, "1", 100, 3);
+    TEST_CHECK(ret == 0);
+    TEST_MSG("tail process did not crash as expected");
+
+    /* same file and size, the first member can't be inflated anymore */
+    memset(junk, 0xAA, sizeof(junk));
+    fd = open(t.path, O_WRONLY);
+    TEST_CHECK(fd != -1);
+    if (fd != -1) {
+        TEST_CHECK(pwrite(fd, junk, sizeof(junk), 16) == sizeof(junk));
+        close(fd);
+    }
+
+    ret = tail_append_gz(t.path, 100, 150);
+    TEST_CHECK(ret == 0);
+
+    ret = tail_start(&t, "json", FLB_TRUE,
+                     "DB", db,
+                     "DB.sync_interval", "1",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, 50, 10) == 0);
+        sleep(1);
+        TEST_CHECK(tail_records(&t) == 50);
+        TEST_MSG("records: %i, expected: 50", tail_records(&t));
+
+        tail_check(&t, "{\"log\":\"line-0100\"}");
+        tail_check(&t, "{\"log\":\"line-0149\"}");
+    }
+    tail_stop(&t);
+    unlink(t.path);
+    tail_db_unlink(db);
+}
+#endif
+
+/*
+ * Benchmark: lines per second per core, parsed and with the path key. The
+ * same corpus can be written as a GZip file to measure the inflate cost.
+ */
+static void tail_bench(const char *name, int gz)
+{
+    int i;
+    int ret;
+    int n = 200000;
+    size_t len;
+    void *zip = NULL;
+    double t0;
+    double t1;
+    FILE *fp;
+    flb_sds_t tmp;
+    flb_sds_t buf;
+    struct tail_test t;
+
+    buf = flb_sds_create_size(n * 128);
+    TEST_CHECK(buf != NULL);
+    if (!buf) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        tmp = flb_sds_printf(&buf, "{\"level\":\"info\",\"method\":\"GET\","
+                             "\"path\":\"/api/v1/items/%i\",\"status\":200,"
+                             "\"bytes\":%i,\"agent\":\"curl/7.58.0\"}\n",
+                             i, i % 4096);
+        TEST_CHECK(tmp != NULL);
+    }
+    len = flb_sds_len(buf);
+
+    tail_path(&t, name);
+    fp = fopen(t.path, "w");
+    TEST_CHECK(fp != NULL);
+    if (!fp) {
+        flb_sds_destroy(buf);
+        return;
+    }
+    if (gz) {
+        ret = flb_gzip_compress(buf, flb_sds_len(buf), &zip, &len);
+        TEST_CHECK(ret == 0);
+        fwrite(zip, len, 1, fp);
+        flb_free(zip);
+    }
+    else {
+        fwrite(buf, len, 1, fp);
+    }
+    fclose(fp);
+
+    t0 = bench_cpu_time();
+    ret = tail_start(&t, "msgpack", FLB_FALSE,
+                     "Path_Key", "file",
+                     "Parser", "tail_json",
+                     NULL);
+    if (ret == 0) {
+        TEST_CHECK(tail_wait(&t, n, 60) == 0);
+        t1 = bench_cpu_time();
+        printf("\n  lines: %i, file: %zu bytes, content: %zu bytes, "
+               "cpu: %.3fs\n  lines/s per core: %.0f, content MB/s: %.1f\n",
+               tail_records(&t), len, flb_sds_len(buf), t1 - t0,
+               tail_records(&t) / (t1 - t0),
+               flb_sds_len(buf) / (t1 - t0) / (1024 * 1024));
+    }
+    tail_stop(&t);
+    flb_sds_destroy(buf);
+    unlink(t.path);
+}
+
+void flb_test_tail_bench_lines()
+{
+    tail_bench("bench", FLB_FALSE);
+}
+
+/* Benchmark: the same corpus read from a GZip file */
+void flb_test_tail_bench_gzip()
+{
+    tail_bench("bench-gzip", FLB_TRUE);
+}
+
+TEST_LIST = {
+#ifndef FLB_TESTS_BENCH
+    {"tail_path_key_raw",    flb_test_tail_path_key_raw},
+    {"tail_path_key_parser", flb_test_tail_path_key_parser},
+    {"tail_long_lines",      flb_test_tail_long_lines},
+    {"tail_scan_exclude",    flb_test_tail_scan_exclude},
+    {"tail_scan_same_inode", flb_test_tail_scan_same_inode},
+    {"tail_scan_rotate",     flb_test_tail_scan_rotate},
+    {"tail_read_budget",     flb_test_tail_read_budget},
+    {"tail_threads",         flb_test_tail_threads},
+    {"tail_threads_truncate", flb_test_tail_threads_truncate},
+    {"tail_multiline_rules", flb_test_tail_multiline_rules},
+    {"tail_multiline_rules_parser", flb_test_tail_multiline_rules_parser},
+    {"tail_docker_mode",     flb_test_tail_docker_mode},
+    {"tail_gzip",            flb_test_tail_gzip},
+    {"tail_threads_gzip",    flb_test_tail_threads_gzip},
+#ifdef FLB_HAVE_INOTIFY
+    {"tail_dir_events",      flb_test_tail_dir_events},
+#endif
+#ifdef FLB_HAVE_SQLDB
+    {"tail_db_restart_synced",   flb_test_tail_db_restart_synced},
+    {"tail_db_restart_unsynced", flb_test_tail_db_restart_unsynced},
+    {"tail_db_restart_gzip",     flb_test_tail_db_restart_gzip},
+    {"tail_db_resume_gzip",      flb_test_tail_db_resume_gzip},
+#endif
+#else
+    /* Benchmarks: flb-bench-* targets */
+    {"tail_bench_lines",     flb_test_tail_bench_lines},
+    {"tail_bench_gzip",      flb_test_tail_bench_gzip},
+#endif
+    {NULL, NULL}
+};
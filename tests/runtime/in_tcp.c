@@ -0,0 +1,305 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "flb_tests_runtime.h"
+
+#define TCP_PORT        "5170"
+#define CONNS           8
+#define MESSAGES        1000
+#define QUEUE_RECORDS   5000
+
+static int seen[CONNS][QUEUE_RECORDS];
+static int records_out;
+static int records_bad;
+
+/* Hold the engine thread on the first record */
+static int block_sec;
+static volatile int blocked;
+
+static void rec_pad(char *buf, int c, int i)
+{
+    int len;
+
+    len = 8 + ((i * 7 + c) % 120);
+    memset(buf, 'a' + ((c * 7 + i) % 26), len);
+    buf[len] = '\0';
+}
+
+static int rec_json(char *buf, size_t size, int c, int i)
+{
+    char pad[256];
+
+    rec_pad(pad, c, i);
+    return snprintf(buf, size, "{\"c\":%i,\"i\":%i,\"pad\":\"%s\"}",
+                    c, i, pad);
+}
+
+/* Validate every record against the message it comes from */
+static int callback_check(void *data, size_t size, void *cb_data)
+{
+    int c;
+    int i;
+    char *p;
+    char *end;
+    char pad[256];
+
+    if (size == 0) {
+        return 0;
+    }
+
+    if (block_sec > 0 && !blocked) {
+        blocked = FLB_TRUE;
+        sleep(block_sec);
+        flb_lib_free(data);
+        return 0;
+    }
+
+    p = strstr(data, "{\"c\":");
+    if (!p || sscanf(p, "{\"c\":%i,\"i\":%i,", &c, &i) != 2 ||
+        c < 0 || c >= CONNS || i < 0 || i >= QUEUE_RECORDS) {
+        __sync_fetch_and_add(&records_bad, 1);
+        flb_lib_free(data);
+        return 0;
+    }
+
+    rec_pad(pad, c, i);
+    p = strstr(p, "\"pad\":\"");
+    end = p ? strchr(p + 7, '"') : NULL;
+    if (!end || end - (p + 7) != strlen(pad) ||
+        memcmp(p + 7, pad, strlen(pad)) != 0) {
+        __sync_fetch_and_add(&records_bad, 1);
+    }
+    else {
+        __sync_fetch_and_add(&seen[c][i], 1);
+    }
+    __sync_fetch_and_add(&records_out, 1);
+
+    flb_lib_free(data);
+    return 0;
+}
+
+static int wait_records(int expected, int sec)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < sec * 10; i++) {
+        n = __sync_fetch_and_add(&records_out, 0);
+        if (n >= expected) {
+            break;
+        }
+        usleep(100000);
+    }
+    return n;
+}
+
+static int tcp_connect(const char *port)
+{
+    int fd;
+    int ret;
+    int on = 1;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int fd_write(int fd, const char *buf, size_t size)
+{
+    ssize_t bytes;
+    size_t sent = 0;
+
+    while (sent < size) {
+        bytes = write(fd, buf + sent, size - sent);
+        if (bytes <= 0) {
+            return -1;
+        }
+        sent += bytes;
+    }
+    return 0;
+}
+
+static flb_ctx_t *tcp_start(const char *workers)
+{
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    flb_ctx_t *ctx;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_check;
+    cb.data = NULL;
+    records_out = 0;
+    records_bad = 0;
+    blocked = FLB_FALSE;
+    memset(seen, 0, sizeof(seen));
+
+    ctx = flb_create();
+    TEST_CHECK(flb_service_set(ctx, "Flush", "0.2", "Grace", "1",
+                               NULL) == 0);
+
+    in_ffd = flb_input(ctx, (char *) "tcp", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    TEST_CHECK(flb_input_set(ctx, in_ffd, "tag", "tcp",
+                             "port", TCP_PORT,
+                             "format", "json",
+                             "workers", workers,
+                             NULL) == 0);
+
+    out_ffd = flb_output(ctx, (char *) "lib", &cb);
+    TEST_CHECK(out_ffd >= 0);
+    TEST_CHECK(flb_output_set(ctx, out_ffd, "match", "*", "format", "json",
+                              NULL) == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+    usleep(200000);
+
+    return ctx;
+}
+
+static void tcp_check(int conns, int messages)
+{
+    int c;
+    int i;
+    int missing = 0;
+
+    TEST_CHECK(records_bad == 0);
+    TEST_MSG("corrupted records: %i", records_bad);
+    TEST_CHECK(records_out == conns * messages);
+    TEST_MSG("records: expected %i, got %i", conns * messages, records_out);
+
+    for (c = 0; c < conns; c++) {
+        for (i = 0; i < messages; i++) {
+            if (seen[c][i] != 1) {
+                missing++;
+            }
+        }
+    }
+    TEST_CHECK(missing == 0);
+    TEST_MSG("records not received exactly once: %i", missing);
+}
+
+/* JSON records over several connections handled by two listener threads */
+void flb_test_tcp_json_workers()
+{
+    int c;
+    int i;
+    int len;
+    int fds[CONNS];
+    char buf[512];
+    flb_ctx_t *ctx;
+
+    ctx = tcp_start("2");
+
+    for (c = 0; c < CONNS; c++) {
+        fds[c] = tcp_connect(TCP_PORT);
+        TEST_CHECK(fds[c] != -1);
+    }
+
+    /* Interleave the connections, some records are split in two writes */
+    for (i = 0; i < MESSAGES; i++) {
+        for (c = 0; c < CONNS; c++) {
+            if (fds[c] == -1) {
+                continue;
+            }
+            len = rec_json(buf, sizeof(buf), c, i);
+            if (i % 5 == 0) {
+                fd_write(fds[c], buf, len / 2);
+                fd_write(fds[c], buf + len / 2, len - len / 2);
+            }
+            else {
+                fd_write(fds[c], buf, len);
+            }
+        }
+    }
+
+    wait_records(CONNS * MESSAGES, 10);
+    tcp_check(CONNS, MESSAGES);
+
+    for (c = 0; c < CONNS; c++) {
+        if (fds[c] != -1) {
+            close(fds[c]);
+        }
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/*
+ * The engine thread is held while a connection sends more buffers than the
+ * listener queue can take: the listener stops reading until the engine
+ * drains the queue, no record is lost.
+ */
+void flb_test_tcp_queue_full()
+{
+    int i;
+    int fd;
+    int len;
+    char buf[512];
+    flb_ctx_t *ctx;
+
+    block_sec = 3;
+    ctx = tcp_start("1");
+
+    fd = tcp_connect(TCP_PORT);
+    TEST_CHECK(fd != -1);
+    if (fd == -1) {
+        flb_stop(ctx);
+        flb_destroy(ctx);
+        return;
+    }
+
+    /* This record holds the engine in the output callback */
+    fd_write(fd, "{\"block\":true}", 14);
+    for (i = 0; i < 50 && !blocked; i++) {
+        usleep(100000);
+    }
+    TEST_CHECK(blocked == FLB_TRUE);
+
+    /* One buffer per read: wait a bit between writes */
+    for (i = 0; i < QUEUE_RECORDS; i++) {
+        len = rec_json(buf, sizeof(buf), 0, i);
+        fd_write(fd, buf, len);
+        if (i % 4 == 0) {
+            usleep(100);
+        }
+    }
+
+    wait_records(QUEUE_RECORDS, 20);
+    tcp_check(1, QUEUE_RECORDS);
+
+    close(fd);
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    block_sec = 0;
+}
+
+TEST_LIST = {
+    {"json_workers", flb_test_tcp_json_workers},
+    {"queue_full",   flb_test_tcp_queue_full},
+    {NULL, NULL}
+};
@@ -1,6 +1,14 @@
 /* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <fluent-bit.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <msgpack.h>
 #include "flb_tests_runtime.h"
 
 /* Test data */
@@ -8,10 +16,14 @@
 
 /* Test functions */
 void flb_test_fluentd_json_long(void);
+void flb_test_ack_pipeline(void);
+void flb_test_ack_timeout(void);
 
 /* Test list */
 TEST_LIST = {
     {"json_long",       flb_test_fluentd_json_long    },
+    {"ack_pipeline",    flb_test_ack_pipeline         },
+    {"ack_timeout",     flb_test_ack_timeout          },
     {NULL, NULL}
 };
 
@@ -43,3 +55,323 @@ void flb_test_fluentd_json_long(void)
     flb_stop(ctx);
     flb_destroy(ctx);
 }
+
+/*
+ * Mock aggregator: accepts Forward connections and acknowledges every
+ * chunk after a delay, without blocking the reception of the next ones.
+ */
+#define MOCK_MAX_FDS    16
+#define MOCK_MAX_ACKS   256
+
+struct mock_ack {
+    int fd;
+    int64_t due;
+    char chunk[64];
+};
+
+struct mock_agg {
+    int port;
+    int ack_delay;              /* milliseconds */
+    int drop_first_ack;         /* never acknowledge the first chunk */
+    volatile int stop;
+    pthread_t tid;
+
+    /* stats */
+    int connections;
+    int messages;
+    int entries;
+    int acks;
+    int max_pending;
+    int64_t first_msg;
+    int64_t last_ack;
+
+    int n_pending;
+    struct mock_ack pending[MOCK_MAX_ACKS];
+};
+
+static int64_t mock_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void mock_message(struct mock_agg *agg, int fd, msgpack_object *root)
+{
+    int i;
+    msgpack_object *opts;
+    msgpack_object *key;
+    msgpack_object *val;
+    struct mock_ack *ack;
+
+    if (root->type != MSGPACK_OBJECT_ARRAY || root->via.array.size < 3) {
+        return;
+    }
+
+    if (agg->messages == 0) {
+        agg->first_msg = mock_now();
+    }
+    agg->messages++;
+
+    if (root->via.array.ptr[1].type == MSGPACK_OBJECT_ARRAY) {
+        agg->entries += root->via.array.ptr[1].via.array.size;
+    }
+
+    opts = &root->via.array.ptr[2];
+    if (opts->type != MSGPACK_OBJECT_MAP) {
+        return;
+    }
+
+    for (i = 0; i < opts->via.map.size; i++) {
+        key = &opts->via.map.ptr[i].key;
+        val = &opts->via.map.ptr[i].val;
+        if (key->via.str.size != 5 || strncmp(key->via.str.ptr, "chunk", 5)) {
+            continue;
+        }
+
+        if (agg->drop_first_ack && agg->messages == 1) {
+            return;
+        }
+
+        ack = &agg->pending[agg->n_pending++];
+        ack->fd = fd;
+        ack->due = mock_now() + agg->ack_delay;
+        snprintf(ack->chunk, sizeof(ack->chunk), "%.*s",
+                 (int) val->via.str.size, val->via.str.ptr);
+
+        if (agg->n_pending > agg->max_pending) {
+            agg->max_pending = agg->n_pending;
+        }
+    }
+}
+
+static void mock_send_acks(struct mock_agg *agg)
+{
+    int i;
+    int64_t now;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    struct mock_ack *ack;
+
+    now = mock_now();
+    i = 0;
+    while (i < agg->n_pending) {
+        ack = &agg->pending[i];
+        if (ack->due > now) {
+            i++;
+            continue;
+        }
+
+        msgpack_sbuffer_init(&sbuf);
+        msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+        msgpack_pack_map(&pck, 1);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "ack", 3);
+        msgpack_pack_str(&pck, strlen(ack->chunk));
+        msgpack_pack_str_body(&pck, ack->chunk, strlen(ack->chunk));
+        if (write(ack->fd, sbuf.data, sbuf.size) == sbuf.size) {
+            agg->acks++;
+            agg->last_ack = now;
+        }
+        msgpack_sbuffer_destroy(&sbuf);
+
+        agg->pending[i] = agg->pending[--agg->n_pending];
+    }
+}
+
+static void *mock_agg_worker(void *data)
+{
+    int i;
+    int fd;
+    int ret;
+    int n_fds = 1;
+    int on = 1;
+    ssize_t bytes;
+    struct sockaddr_in addr;
+    struct pollfd fds[MOCK_MAX_FDS];
+    msgpack_unpacker unp[MOCK_MAX_FDS];
+    msgpack_unpacked result;
+    struct mock_agg *agg = data;
+
+    fds[0].fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fds[0].fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(agg->port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(fds[0].fd, (struct sockaddr *) &addr, sizeof(addr));
+    listen(fds[0].fd, 16);
+    fds[0].events = POLLIN;
+
+    msgpack_unpacked_init(&result);
+    while (!agg->stop) {
+        ret = poll(fds, n_fds, 10);
+        if (ret > 0 && (fds[0].revents & POLLIN) && n_fds < MOCK_MAX_FDS) {
+            fd = accept(fds[0].fd, NULL, NULL);
+            if (fd != -1) {
+                fds[n_fds].fd = fd;
+                fds[n_fds].events = POLLIN;
+                msgpack_unpacker_init(&unp[n_fds], 4096);
+                n_fds++;
+                agg->connections++;
+            }
+        }
+
+        for (i = 1; i < n_fds && ret > 0; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+
+            msgpack_unpacker_reserve_buffer(&unp[i], 65536);
+            bytes = read(fds[i].fd, msgpack_unpacker_buffer(&unp[i]),
+                         msgpack_unpacker_buffer_capacity(&unp[i]));
+            if (bytes <= 0) {
+                fds[i].events = 0;
+                continue;
+            }
+            msgpack_unpacker_buffer_consumed(&unp[i], bytes);
+
+            while (msgpack_unpacker_next(&unp[i], &result) ==
+                   MSGPACK_UNPACK_SUCCESS) {
+                mock_message(agg, fds[i].fd, &result.data);
+            }
+        }
+
+        mock_send_acks(agg);
+    }
+    msgpack_unpacked_destroy(&result);
+
+    for (i = 0; i < n_fds; i++) {
+        close(fds[i].fd);
+        if (i > 0) {
+            msgpack_unpacker_destroy(&unp[i]);
+        }
+    }
+    return NULL;
+}
+
+static void mock_agg_start(struct mock_agg *agg, int port, int ack_delay)
+{
+    memset(agg, 0, sizeof(struct mock_agg));
+    agg->port = port;
+    agg->ack_delay = ack_delay;
+    pthread_create(&agg->tid, NULL, mock_agg_worker, agg);
+    usleep(100000);
+}
+
+static void mock_agg_stop(struct mock_agg *agg)
+{
+    agg->stop = 1;
+    pthread_join(agg->tid, NULL);
+}
+
+/* Several chunks share one connection while their acks are delayed */
+void flb_test_ack_pipeline(void)
+{
+    int i;
+    int ret;
+    int in_ffd[8];
+    int out_ffd;
+    char tag[16];
+    char *record = "[1448403340,{\"key\":\"value\"}]";
+    flb_ctx_t *ctx;
+    struct mock_agg agg;
+
+    mock_agg_start(&agg, 24301, 300);
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", NULL);
+
+    for (i = 0; i < 8; i++) {
+        snprintf(tag, sizeof(tag), "t%i", i);
+        in_ffd[i] = flb_input(ctx, (char *) "lib", NULL);
+        TEST_CHECK(in_ffd[i] >= 0);
+        flb_input_set(ctx, in_ffd[i], "tag", tag, NULL);
+    }
+
+    out_ffd = flb_output(ctx, (char *) "forward", NULL);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd,
+                   "match", "*",
+                   "host", "127.0.0.1",
+                   "port", "24301",
+                   "require_ack_response", "true",
+                   "max_inflight_chunks", "8",
+                   NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < 8; i++) {
+        flb_lib_push(ctx, in_ffd[i], record, strlen(record));
+    }
+
+    for (i = 0; i < 50 && agg.acks < 8; i++) {
+        usleep(100000);
+    }
+
+    TEST_CHECK(agg.acks == 8);
+    TEST_CHECK(agg.messages == 8);
+    TEST_CHECK(agg.entries == 8);
+    TEST_CHECK(agg.connections == 1);
+    TEST_CHECK(agg.max_pending > 1);
+
+    /* Serialized acks would take 8 x 300ms */
+    TEST_CHECK(agg.last_ack - agg.first_msg < 4 * 300);
+    printf("\n  8 chunks, max %i in flight, acked in %lims (ack delay 300ms)\n",
+           agg.max_pending, (long) (agg.last_ack - agg.first_msg));
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    mock_agg_stop(&agg);
+}
+
+/* A chunk without ack is retried once its ack timeout expires */
+void flb_test_ack_timeout(void)
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    char *record = "[1448403340,{\"key\":\"value\"}]";
+    flb_ctx_t *ctx;
+    struct mock_agg agg;
+
+    mock_agg_start(&agg, 24302, 50);
+    agg.drop_first_ack = 1;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "tag", "test", NULL);
+
+    out_ffd = flb_output(ctx, (char *) "forward", NULL);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd,
+                   "match", "test",
+                   "host", "127.0.0.1",
+                   "port", "24302",
+                   "require_ack_response", "true",
+                   "ack_response_timeout", "1",
+                   NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    flb_lib_push(ctx, in_ffd, record, strlen(record));
+
+    /* first try times out, the retry is scheduled within 5-10 seconds */
+    for (i = 0; i < 150 && agg.acks < 1; i++) {
+        usleep(100000);
+    }
+
+    TEST_CHECK(agg.messages == 2);
+    TEST_CHECK(agg.acks == 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    mock_agg_stop(&agg);
+}
@@ -0,0 +1,401 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
+#include "flb_tests_runtime.h"
+
+/*
+ * The records are sent by out_http to an in_http instance running in the
+ * same service, the URI sets the tag used to route them back to the lib
+ * output.
+ */
+#define HTTP_PORT     "9884"
+#define RECORDS       2000
+
+static int64_t records_out;
+
+static int callback_count(void *data, size_t size, void *cb_data)
+{
+    if (size > 0) {
+        __sync_fetch_and_add(&records_out, 1);
+        flb_lib_free(data);
+    }
+    return 0;
+}
+
+static int64_t wait_records(int64_t expected)
+{
+    int i;
+    int64_t n = 0;
+
+    for (i = 0; i < 100; i++) {
+        n = __sync_fetch_and_add(&records_out, 0);
+        if (n >= expected) {
+            break;
+        }
+        usleep(100000);
+    }
+    return n;
+}
+
+static void gzip_roundtrip(const char *workers, const char *level)
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    int lib_ffd;
+    int back_ffd;
+    int64_t n;
+    char buf[256];
+    flb_ctx_t *ctx;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_count;
+    cb.data = NULL;
+    records_out = 0;
+
+    ctx = flb_create();
+    TEST_CHECK(flb_service_set(ctx, "Flush", "0.5", "Grace", "1",
+                               "compress.workers", workers,
+                               NULL) == 0);
+
+    lib_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(lib_ffd >= 0);
+    flb_input_set(ctx, lib_ffd, "tag", "test", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "http", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "port", HTTP_PORT, NULL);
+
+    out_ffd = flb_output(ctx, (char *) "http", NULL);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd,
+                   "match", "test",
+                   "host", "127.0.0.1",
+                   "port", HTTP_PORT,
+                   "uri", "/back",
+                   "format", "json",
+                   "compress", "gzip",
+                   "compress_level", level,
+                   NULL);
+
+    back_ffd = flb_output(ctx, (char *) "lib", &cb);
+    TEST_CHECK(back_ffd >= 0);
+    flb_output_set(ctx, back_ffd, "match", "back", NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    /* Enough data for the payload to be handed to the compression pool */
+    for (i = 0; i < RECORDS; i++) {
+        ret = snprintf(buf, sizeof(buf) - 1,
+                       "[%i, {\"id\": %i, \"log\": \"GET /api/v1/items/%i "
+                       "HTTP/1.1 200 %i\"}]",
+                       1580000000 + i, i, i * 7, (i * 31) % 5000);
+        flb_lib_push(ctx, lib_ffd, buf, ret);
+    }
+
+    n = wait_records(RECORDS);
+    if (!TEST_CHECK(n == RECORDS)) {
+        TEST_MSG("records: expected %i, got %li", RECORDS, n);
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+void flb_test_http_gzip()
+{
+    gzip_roundtrip("0", "-1");
+}
+
+void flb_test_http_gzip_workers()
+{
+    gzip_roundtrip("2", "1");
+}
+
+/*
+ * Mock HTTP server: answers every request on its own connection, the first
+ * request carrying the record 'fail_id' gets a 500 response.
+ */
+#define MOCK_PORT       9885
+#define MOCK_MAX_FDS    32
+#define MOCK_BUF_SIZE   65536
+#define MOCK_RECORDS    200
+
+struct mock_conn {
+    int fd;
+    size_t len;
+    char buf[MOCK_BUF_SIZE];
+};
+
+struct mock_http {
+    int fail_id;
+    volatile int stop;
+    pthread_t tid;
+
+    /* stats, updated by the server thread only */
+    int requests;
+    int failed;
+    int open;
+    int max_open;
+    int failed_ids;                      /* records in the failed request */
+    int accepted[MOCK_RECORDS];          /* times each record was accepted */
+};
+
+/* Returns the request length once complete, 0 if more data is needed */
+static size_t mock_request_len(struct mock_conn *c)
+{
+    char *end;
+    char *cl;
+    size_t hdr;
+
+    c->buf[c->len] = '\0';
+    end = strstr(c->buf, "\r\n\r\n");
+    if (!end) {
+        return 0;
+    }
+    hdr = (end - c->buf) + 4;
+
+    cl = strstr(c->buf, "Content-Length:");
+    if (!cl || cl > end) {
+        return hdr;
+    }
+    if (c->len < hdr + atoi(cl + 15)) {
+        return 0;
+    }
+    return hdr + atoi(cl + 15);
+}
+
+static void mock_request(struct mock_http *m, struct mock_conn *c)
+{
+    int id;
+    int fail;
+    int n = 0;
+    int ids[MOCK_RECORDS];
+    char *p;
+    const char *resp;
+
+    p = c->buf;
+    while ((p = strstr(p, "\"id\":")) != NULL) {
+        id = atoi(p + 5);
+        if (id >= 0 && id < MOCK_RECORDS && n < MOCK_RECORDS) {
+            ids[n++] = id;
+        }
+        p += 5;
+    }
+
+    fail = FLB_FALSE;
+    if (m->failed == 0) {
+        for (id = 0; id < n; id++) {
+            if (ids[id] == m->fail_id) {
+                fail = FLB_TRUE;
+                break;
+            }
+        }
+    }
+
+    m->requests++;
+    if (fail) {
+        m->failed++;
+        m->failed_ids = n;
+        resp = "HTTP/1.1 500 Internal Server Error\r\n"
+               "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    else {
+        for (id = 0; id < n; id++) {
+            m->accepted[ids[id]]++;
+        }
+        resp = "HTTP/1.1 200 OK\r\n"
+               "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    if (write(c->fd, resp, strlen(resp)) == -1) {
+        perror("write");
+    }
+}
+
+static void *mock_http_worker(void *data)
+{
+    int i;
+    int fd;
+    int ret;
+    int n_fds = 1;
+    int on = 1;
+    ssize_t bytes;
+    struct sockaddr_in addr;
+    struct pollfd fds[MOCK_MAX_FDS];
+    struct mock_conn *conns;
+    struct mock_http *m = data;
+
+    conns = flb_calloc(MOCK_MAX_FDS, sizeof(struct mock_conn));
+
+    fds[0].fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fds[0].fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(MOCK_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(fds[0].fd, (struct sockaddr *) &addr, sizeof(addr));
+    listen(fds[0].fd, 16);
+    fds[0].events = POLLIN;
+
+    while (!m->stop) {
+        ret = poll(fds, n_fds, 10);
+        if (ret <= 0) {
+            continue;
+        }
+
+        if ((fds[0].revents & POLLIN) && n_fds < MOCK_MAX_FDS) {
+            fd = accept(fds[0].fd, NULL, NULL);
+            if (fd != -1) {
+                fds[n_fds].fd = fd;
+                fds[n_fds].events = POLLIN;
+                conns[n_fds].fd = fd;
+                conns[n_fds].len = 0;
+                n_fds++;
+                m->open++;
+                if (m->open > m->max_open) {
+                    m->max_open = m->open;
+                }
+            }
+        }
+
+        for (i = 1; i < n_fds; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+
+            bytes = read(fds[i].fd, conns[i].buf + conns[i].len,
+                         MOCK_BUF_SIZE - 1 - conns[i].len);
+            if (bytes > 0) {
+                conns[i].len += bytes;
+                if (mock_request_len(&conns[i]) == 0 &&
+                    conns[i].len < MOCK_BUF_SIZE - 1) {
+                    continue;
+                }
+                mock_request(m, &conns[i]);
+            }
+
+            /* one request per connection */
+            close(fds[i].fd);
+            m->open--;
+            fds[i] = fds[n_fds - 1];
+            conns[i] = conns[n_fds - 1];
+            n_fds--;
+            i--;
+        }
+    }
+
+    for (i = 0; i < n_fds; i++) {
+        close(fds[i].fd);
+    }
+    flb_free(conns);
+    return NULL;
+}
+
+/*
+ * A chunk is flushed in sub-batches by concurrent workers, one of them
+ * fails: the retry must only send that sub-batch again.
+ */
+void flb_test_http_batch_retry()
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    int missing = 0;
+    int duplicated = 0;
+    char buf[64];
+    char port[16];
+    flb_ctx_t *ctx;
+    struct mock_http *m;
+
+    m = flb_calloc(1, sizeof(struct mock_http));
+    m->fail_id = MOCK_RECORDS / 2;
+    pthread_create(&m->tid, NULL, mock_http_worker, m);
+    usleep(100000);
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", "Log_Level", "error",
+                    NULL);
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "tag", "test", NULL);
+
+    snprintf(port, sizeof(port), "%i", MOCK_PORT);
+    out_ffd = flb_output(ctx, (char *) "http", NULL);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd,
+                   "match", "test",
+                   "host", "127.0.0.1",
+                   "port", port,
+                   "format", "json",
+                   "max_payload_size", "512",
+                   "batch_workers", "2",
+                   "retry_limit", "2",
+                   NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    /* every record goes into the same chunk */
+    for (i = 0; i < MOCK_RECORDS; i++) {
+        ret = snprintf(buf, sizeof(buf) - 1, "[%i, {\"id\":%i}]",
+                       1580000000 + i, i);
+        flb_lib_push(ctx, in_ffd, buf, ret);
+    }
+
+    /* the first retry happens after 5 to 10 seconds */
+    for (i = 0; i < 150; i++) {
+        if (m->failed > 0 && m->accepted[m->fail_id] > 0) {
+            break;
+        }
+        usleep(100000);
+    }
+    sleep(1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    m->stop = 1;
+    pthread_join(m->tid, NULL);
+
+    for (i = 0; i < MOCK_RECORDS; i++) {
+        if (m->accepted[i] == 0) {
+            missing++;
+        }
+        else if (m->accepted[i] > 1) {
+            duplicated++;
+        }
+    }
+
+    TEST_CHECK(m->failed == 1);
+    TEST_CHECK(missing == 0);
+    TEST_MSG("records never accepted: %i", missing);
+    TEST_CHECK(duplicated == 0);
+    TEST_MSG("records accepted more than once: %i", duplicated);
+
+    /* several sub-batches, sent concurrently, and a single one resent */
+    TEST_CHECK(m->requests > 2);
+    TEST_CHECK(m->failed_ids > 0 && m->failed_ids < MOCK_RECORDS);
+    TEST_CHECK(m->max_open > 1);
+    TEST_MSG("requests: %i, max concurrent connections: %i",
+             m->requests, m->max_open);
+
+    flb_free(m);
+}
+
+TEST_LIST = {
+    {"gzip",         flb_test_http_gzip},
+    {"gzip_workers", flb_test_http_gzip_workers},
+    {"batch_retry",  flb_test_http_batch_retry},
+    {NULL, NULL}
+};